@@ -0,0 +1,411 @@
+// kernel/arch/x86_64/cpu.c
+// GDT, TSS and IDT for the boot CPU, trap and SYSCALL entry stubs, ring 3
+// entry, FPU state and the local APIC slice timer.
+
+#include "cpu.h"
+#include "io.h"
+#include "timer.h"
+#include "klib.h"
+
+#define MSR_APIC_BASE      0x1B
+#define MSR_EFER           0xC0000080
+#define MSR_STAR           0xC0000081
+#define MSR_LSTAR          0xC0000082
+#define MSR_SFMASK         0xC0000084
+
+#define EFER_SCE           (1ull << 0)
+#define APIC_BASE_ENABLE   (1ull << 11)
+#define APIC_BASE_X2APIC   (1ull << 10)
+#define APIC_BASE_ADDR     0x000FFFFFFFFFF000ull
+
+#define LAPIC_TPR          0x080
+#define LAPIC_EOI          0x0B0
+#define LAPIC_SVR          0x0F0
+#define LAPIC_LVT_TIMER    0x320
+#define LAPIC_TIMER_INIT   0x380
+#define LAPIC_TIMER_COUNT  0x390
+#define LAPIC_TIMER_DIV    0x3E0
+#define LVT_MASKED         (1u << 16)
+#define SVR_ENABLE         (1u << 8)
+
+// Cleared on SYSCALL: interrupts, direction, trap and alignment check.
+#define SYSCALL_MASK       0x40700u
+
+// ---------------------------------------------------------------------
+// Descriptor tables
+// ---------------------------------------------------------------------
+
+typedef struct __attribute__((packed)) {
+    uint32_t reserved0;
+    uint64_t rsp[3];
+    uint64_t reserved1;
+    uint64_t ist[7];
+    uint64_t reserved2;
+    uint16_t reserved3;
+    uint16_t iomap;
+} Tss;
+
+typedef struct __attribute__((packed)) {
+    uint16_t offset_lo;
+    uint16_t selector;
+    uint8_t  ist;
+    uint8_t  type;
+    uint16_t offset_mid;
+    uint32_t offset_hi;
+    uint32_t reserved;
+} IdtGate;
+
+typedef struct __attribute__((packed)) {
+    uint16_t limit;
+    uint64_t base;
+} TablePtr;
+
+static uint64_t g_gdt[7] = {
+    0,
+    0x00AF9A000000FFFFull,          // 0x08 kernel code, 64-bit
+    0x00CF92000000FFFFull,          // 0x10 kernel data
+    0x00CFF2000000FFFFull,          // 0x18 user data
+    0x00AFFA000000FFFFull,          // 0x20 user code, 64-bit
+    0, 0,                           // 0x28 TSS, two slots
+};
+
+static Tss     g_tss;
+static IdtGate g_idt[256];
+
+static TrapHandler    g_trap_handler;
+static SyscallHandler g_syscall_handler;
+
+// Read by the SYSCALL stub before it has a stack.
+uint64_t g_syscall_stack;
+uint64_t g_syscall_user_rsp;
+
+// ---------------------------------------------------------------------
+// Entry stubs
+// ---------------------------------------------------------------------
+
+// 256 trap stubs, 16 bytes apart. Vectors where the CPU pushes no error
+// code push a zero, so every frame looks the same.
+__asm__(
+    ".text\n"
+    ".global trap_stubs, syscall_entry, user_enter, user_return, user_leave\n"
+    "    .balign 16\n"
+    "trap_stubs:\n"
+    "    .set vec, 0\n"
+    "    .rept 256\n"
+    "    .balign 16\n"
+    "    .if vec == 8 || (vec >= 10 && vec <= 14) || vec == 17 || vec == 21 || vec == 29 || vec == 30\n"
+    "    .else\n"
+    "    pushq $0\n"
+    "    .endif\n"
+    "    pushq $vec\n"
+    "    jmp trap_common\n"
+    "    .set vec, vec + 1\n"
+    "    .endr\n"
+
+    "trap_common:\n"
+    "    push %rax\n"
+    "    push %rbx\n"
+    "    push %rcx\n"
+    "    push %rdx\n"
+    "    push %rsi\n"
+    "    push %rdi\n"
+    "    push %rbp\n"
+    "    push %r8\n"
+    "    push %r9\n"
+    "    push %r10\n"
+    "    push %r11\n"
+    "    push %r12\n"
+    "    push %r13\n"
+    "    push %r14\n"
+    "    push %r15\n"
+    "    mov  %rsp, %rdi\n"
+    "    cld\n"
+    "    call trap_dispatch\n"
+    "    pop  %r15\n"
+    "    pop  %r14\n"
+    "    pop  %r13\n"
+    "    pop  %r12\n"
+    "    pop  %r11\n"
+    "    pop  %r10\n"
+    "    pop  %r9\n"
+    "    pop  %r8\n"
+    "    pop  %rbp\n"
+    "    pop  %rdi\n"
+    "    pop  %rsi\n"
+    "    pop  %rdx\n"
+    "    pop  %rcx\n"
+    "    pop  %rbx\n"
+    "    pop  %rax\n"
+    "    add  $16, %rsp\n"
+    "    iretq\n"
+
+    // SYSCALL: rcx = user rip, r11 = user rflags, interrupts already off.
+    "syscall_entry:\n"
+    "    mov  %rsp, g_syscall_user_rsp(%rip)\n"
+    "    mov  g_syscall_stack(%rip), %rsp\n"
+    "    pushq g_syscall_user_rsp(%rip)\n"
+    "    push %rcx\n"
+    "    push %r11\n"
+    "    push %rax\n"
+    "    push %rdi\n"
+    "    push %rsi\n"
+    "    push %rdx\n"
+    "    push %r10\n"
+    "    push %r8\n"
+    "    push %r9\n"
+    "    push %rbx\n"
+    "    push %rbp\n"
+    "    push %r12\n"
+    "    push %r13\n"
+    "    push %r14\n"
+    "    push %r15\n"
+    "    mov  %rsp, %rdi\n"
+    "    call syscall_dispatch\n"
+    "syscall_exit:\n"
+    "    pop  %r15\n"
+    "    pop  %r14\n"
+    "    pop  %r13\n"
+    "    pop  %r12\n"
+    "    pop  %rbp\n"
+    "    pop  %rbx\n"
+    "    pop  %r9\n"
+    "    pop  %r8\n"
+    "    pop  %r10\n"
+    "    pop  %rdx\n"
+    "    pop  %rsi\n"
+    "    pop  %rdi\n"
+    "    pop  %rax\n"
+    "    pop  %r11\n"
+    "    pop  %rcx\n"
+    "    pop  %rsp\n"
+    "    sysretq\n"
+
+    // user_enter(save, rip, rsp): keep the callee-saved registers for
+    // user_leave(), then SYSRET with nothing of the kernel's left in the
+    // other registers.
+    "user_enter:\n"
+    "    push %rbp\n"
+    "    push %rbx\n"
+    "    push %r12\n"
+    "    push %r13\n"
+    "    push %r14\n"
+    "    push %r15\n"
+    "    mov  %rsp, (%rdi)\n"
+    "    mov  %rsi, %rcx\n"
+    "    mov  %rdx, %rsp\n"
+    "    mov  $0x202, %r11\n"
+    "    xor  %eax, %eax\n"
+    "    xor  %ebx, %ebx\n"
+    "    xor  %edx, %edx\n"
+    "    xor  %esi, %esi\n"
+    "    xor  %edi, %edi\n"
+    "    xor  %ebp, %ebp\n"
+    "    xor  %r8d, %r8d\n"
+    "    xor  %r9d, %r9d\n"
+    "    xor  %r10d, %r10d\n"
+    "    xor  %r12d, %r12d\n"
+    "    xor  %r13d, %r13d\n"
+    "    xor  %r14d, %r14d\n"
+    "    xor  %r15d, %r15d\n"
+    "    sysretq\n"
+
+    // user_return(save, frame): as user_enter(), then out through the end
+    // of syscall_entry with the frame as its stack.
+    "user_return:\n"
+    "    push %rbp\n"
+    "    push %rbx\n"
+    "    push %r12\n"
+    "    push %r13\n"
+    "    push %r14\n"
+    "    push %r15\n"
+    "    mov  %rsp, (%rdi)\n"
+    "    mov  %rsi, %rsp\n"
+    "    jmp  syscall_exit\n"
+
+    "user_leave:\n"
+    "    mov  %rdi, %rsp\n"
+    "    mov  %rsi, %rax\n"
+    "    pop  %r15\n"
+    "    pop  %r14\n"
+    "    pop  %r13\n"
+    "    pop  %r12\n"
+    "    pop  %rbx\n"
+    "    pop  %rbp\n"
+    "    ret\n"
+);
+
+extern const char trap_stubs[];
+void syscall_entry(void);
+
+static void halt(void) {
+    for (;;) __asm__ volatile("cli; hlt");
+}
+
+void trap_dispatch(TrapFrame *f);
+void trap_dispatch(TrapFrame *f) {
+    if ((f->cs & 3) == 3) {
+        if (g_trap_handler) {
+            g_trap_handler(f);
+            return;
+        }
+        halt();
+    }
+    // The kernel runs with interrupts off, so a vector of 32 and up here
+    // was left pending by ring 3 or is a stray one: acknowledge and go on.
+    if (f->vector == TRAP_SPURIOUS) return;
+    if (f->vector >= 32) {
+        cpu_timer_eoi();
+        return;
+    }
+    halt();
+}
+
+void syscall_dispatch(SyscallFrame *f);
+void syscall_dispatch(SyscallFrame *f) {
+    g_syscall_handler(f);
+}
+
+void cpu_set_trap_handler(TrapHandler h) {
+    g_trap_handler = h;
+}
+
+void cpu_set_syscall_handler(SyscallHandler h) {
+    g_syscall_handler = h;
+}
+
+void cpu_set_kernel_stack(uint64_t top) {
+    g_tss.rsp[0]    = top;
+    g_syscall_stack = top;
+}
+
+// ---------------------------------------------------------------------
+// Local APIC timer
+// ---------------------------------------------------------------------
+
+static uint64_t g_lapic;
+static int      g_x2apic;
+static uint32_t g_apic_ticks_per_ms;
+
+static uint32_t lapic_read(uint32_t reg) {
+    if (g_x2apic) return (uint32_t)rdmsr(0x800 + (reg >> 4));
+    return mmio_read32(g_lapic + reg);
+}
+
+static void lapic_write(uint32_t reg, uint32_t v) {
+    if (g_x2apic) {
+        wrmsr(0x800 + (reg >> 4), v);
+    } else {
+        mmio_write32(g_lapic + reg, v);
+    }
+}
+
+// Divide by 16, counted down from the top for 10 ms of TSC time.
+static void timer_calibrate(void) {
+    uint64_t base = rdmsr(MSR_APIC_BASE);
+    if (!(base & APIC_BASE_ENABLE)) return;
+    g_x2apic = (base & APIC_BASE_X2APIC) != 0;
+    g_lapic  = base & APIC_BASE_ADDR;
+
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, lapic_read(LAPIC_SVR) | SVR_ENABLE | TRAP_SPURIOUS);
+    lapic_write(LAPIC_TIMER_DIV, 0x3);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED | TRAP_TIMER);
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFFu);
+    delay_ms(10);
+    uint32_t left = lapic_read(LAPIC_TIMER_COUNT);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+    g_apic_ticks_per_ms = (0xFFFFFFFFu - left) / 10;
+}
+
+int cpu_timer_start(uint32_t us) {
+    if (!g_apic_ticks_per_ms) return 0;
+    uint64_t ticks = (uint64_t)g_apic_ticks_per_ms * us / 1000;
+    lapic_write(LAPIC_LVT_TIMER, TRAP_TIMER);
+    lapic_write(LAPIC_TIMER_INIT, ticks ? (uint32_t)ticks : 1);
+    return 1;
+}
+
+void cpu_timer_eoi(void) {
+    if (g_lapic || g_x2apic) lapic_write(LAPIC_EOI, 0);
+}
+
+// ---------------------------------------------------------------------
+// FPU
+// ---------------------------------------------------------------------
+
+static uint8_t g_fpu_initial[FPU_STATE_SIZE] __attribute__((aligned(16)));
+
+void fpu_save(void *area) {
+    __asm__ volatile("fxsave64 (%0)" : : "r"(area) : "memory");
+}
+
+void fpu_restore(const void *area) {
+    __asm__ volatile("fxrstor64 (%0)" : : "r"(area) : "memory");
+}
+
+const void *fpu_initial(void) {
+    return g_fpu_initial;
+}
+
+// ---------------------------------------------------------------------
+// Setup
+// ---------------------------------------------------------------------
+
+static void idt_set(int vec, uint64_t handler) {
+    IdtGate *g = &g_idt[vec];
+    g->offset_lo  = (uint16_t)handler;
+    g->selector   = GDT_KERNEL_CS;
+    g->ist        = 0;
+    g->type       = 0x8E;               // present, DPL 0, interrupt gate
+    g->offset_mid = (uint16_t)(handler >> 16);
+    g->offset_hi  = (uint32_t)(handler >> 32);
+    g->reserved   = 0;
+}
+
+void cpu_init(void) {
+    // TSS descriptor: 16 bytes, available 64-bit TSS.
+    uint64_t tss = (uint64_t)(uintptr_t)&g_tss;
+    g_tss.iomap = sizeof(Tss);
+    g_gdt[5] = (sizeof(Tss) - 1) |
+               ((tss & 0xFFFFFFull) << 16) |
+               (0x89ull << 40) |
+               (((tss >> 24) & 0xFF) << 56);
+    g_gdt[6] = tss >> 32;
+
+    TablePtr gdtr = { sizeof(g_gdt) - 1, (uint64_t)(uintptr_t)g_gdt };
+    __asm__ volatile(
+        "lgdt %0\n"
+        "pushq %1\n"
+        "leaq 1f(%%rip), %%rax\n"
+        "pushq %%rax\n"
+        "lretq\n"
+        "1:\n"
+        "mov %2, %%ax\n"
+        "mov %%ax, %%ds\n"
+        "mov %%ax, %%es\n"
+        "mov %%ax, %%ss\n"
+        : : "m"(gdtr), "i"(GDT_KERNEL_CS), "i"(GDT_KERNEL_DS) : "rax", "memory");
+    __asm__ volatile("ltr %w0" : : "r"(GDT_TSS));
+
+    for (int v = 0; v < 256; ++v) {
+        idt_set(v, (uint64_t)(uintptr_t)(trap_stubs + 16 * v));
+    }
+    TablePtr idtr = { sizeof(g_idt) - 1, (uint64_t)(uintptr_t)g_idt };
+    __asm__ volatile("lidt %0" : : "m"(idtr));
+
+    // The 8259s would deliver on top of the exception vectors.
+    outb(0x21, 0xFF);
+    outb(0xA1, 0xFF);
+
+    wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_SCE);
+    // SYSCALL: CS from bits 32..47, SS = CS + 8. SYSRET: SS = bits 48..63
+    // + 8, CS = that + 16, both with RPL 3.
+    wrmsr(MSR_STAR, ((uint64_t)GDT_KERNEL_DS << 48) | ((uint64_t)GDT_KERNEL_CS << 32));
+    wrmsr(MSR_LSTAR, (uint64_t)(uintptr_t)syscall_entry);
+    wrmsr(MSR_SFMASK, SYSCALL_MASK);
+
+    __asm__ volatile("fninit");
+    fpu_save(g_fpu_initial);
+
+    timer_calibrate();
+}
@@ -0,0 +1,336 @@
+// kernel/arch/x86_64/smp.c
+// Application processor startup (local APIC INIT-SIPI-SIPI, real mode to
+// long mode trampoline) and a fork/join job runner.
+
+#include "smp.h"
+#include "acpi.h"
+#include "timer.h"
+#include "io.h"
+#include "cpu.h"
+#include "mm.h"
+#include "klib.h"
+
+#define MSR_APIC_BASE        0x1B
+#define MSR_EFER             0xC0000080
+#define MSR_TSC_AUX          0xC0000103
+#define APIC_BASE_X2APIC     (1ull << 10)
+#define APIC_BASE_ADDR_MASK  0x000FFFFFFFFFF000ull
+
+#define LAPIC_ID             0x020
+#define LAPIC_ICR_LOW        0x300
+#define LAPIC_ICR_HIGH       0x310
+#define X2APIC_MSR(reg)      (0x800 + ((reg) >> 4))
+
+#define ICR_INIT             0x00000500
+#define ICR_STARTUP          0x00000600
+#define ICR_LEVEL_ASSERT     0x00004000
+#define ICR_PENDING          0x00001000
+
+#define EFER_LMA             (1ull << 10)
+#define CR4_PCIDE            (1ull << 17)
+#define CR4_CET              (1ull << 23)
+
+#define AP_STACK_SIZE        (16 * 1024)
+#define AP_START_TIMEOUT_MS  100
+
+// ---------------------------------------------------------------------
+// Trampoline. Copied to a page below 1 MiB; a SIPI starts the AP at its
+// first byte in real mode with CS = page >> 4. It loads a temporary GDT,
+// switches straight to long mode on the boot CPU's page tables, then moves
+// onto the boot CPU's GDT and its own stack and calls ap_main().
+// ---------------------------------------------------------------------
+
+// Filled in by the boot CPU; lives at the end of the trampoline page.
+typedef struct __attribute__((packed)) {
+    uint64_t cr0;           // +0
+    uint64_t cr3;           // +8   must be below 4 GiB (loaded in real mode)
+    uint64_t cr4;           // +16
+    uint64_t efer;          // +24
+    uint64_t stack;         // +32  top of this AP's stack
+    uint64_t entry;         // +40  void (*)(void)
+    uint16_t gdt_limit;     // +48  boot CPU's GDT
+    uint64_t gdt_base;      // +50
+    uint16_t cs;            // +58
+    uint16_t ds;            // +60
+} ApParams;
+
+// Offsets inside the page, for operands.
+#define TP(off) "smp_tramp_params - smp_tramp_start + " #off
+#define TO(sym) #sym " - smp_tramp_start"
+
+__asm__(
+    ".pushsection .rodata\n"
+    ".global smp_tramp_start, smp_tramp_params, smp_tramp_end\n"
+    ".code16\n"
+    "smp_tramp_start:\n"
+    "    cli\n"
+    "    cld\n"
+    "    xorl %ebx, %ebx\n"
+    "    movw %cs, %bx\n"
+    "    movw %bx, %ds\n"
+    "    shll $4, %ebx\n"                       // linear address of the page
+    // Absolute addresses depend on where the page is: patch them in.
+    "    leal " TO(tramp_gdt) "(%ebx), %eax\n"
+    "    movl %eax, " TO(tramp_gdtr) " + 2\n"
+    "    leal " TO(tramp_long) "(%ebx), %eax\n"
+    "    movl %eax, " TO(tramp_jump) "\n"
+    "    lgdtl " TO(tramp_gdtr) "\n"
+    // Long mode in one step: PAE etc., page tables, EFER.LME, then PG|PE.
+    "    movl " TP(16) ", %eax\n"
+    "    movl %eax, %cr4\n"
+    "    movl " TP(8) ", %eax\n"
+    "    movl %eax, %cr3\n"
+    "    movl $0xC0000080, %ecx\n"
+    "    movl " TP(24) ", %eax\n"
+    "    movl " TP(28) ", %edx\n"
+    "    wrmsr\n"
+    "    movl " TP(0) ", %eax\n"
+    "    movl %eax, %cr0\n"
+    "    ljmpl *" TO(tramp_jump) "\n"
+
+    ".code64\n"
+    "tramp_long:\n"
+    "    movw $0x10, %ax\n"
+    "    movw %ax, %ds\n"
+    "    movw %ax, %es\n"
+    "    movw %ax, %ss\n"
+    "    lgdt " TP(48) "(%rbx)\n"
+    "    movq " TP(32) "(%rbx), %rsp\n"
+    "    movzwq " TP(58) "(%rbx), %rax\n"
+    "    pushq %rax\n"
+    "    leaq 1f(%rip), %rax\n"
+    "    pushq %rax\n"
+    "    lretq\n"
+    "1:  movw " TP(60) "(%rbx), %ax\n"
+    "    movw %ax, %ds\n"
+    "    movw %ax, %es\n"
+    "    movw %ax, %ss\n"
+    "    movq " TP(40) "(%rbx), %rax\n"
+    "    callq *%rax\n"
+    "2:  hlt\n"
+    "    jmp 2b\n"
+
+    "    .balign 8\n"
+    "tramp_gdt:\n"
+    "    .quad 0\n"
+    "    .quad 0x00AF9A000000FFFF\n"            // 0x08: 64-bit code
+    "    .quad 0x00CF92000000FFFF\n"            // 0x10: data
+    "tramp_gdtr:\n"
+    "    .word 23\n"
+    "    .long 0\n"
+    "tramp_jump:\n"
+    "    .long 0\n"
+    "    .word 0x08\n"
+    "    .balign 8\n"
+    "smp_tramp_params:\n"
+    "    .space 64\n"
+    "smp_tramp_end:\n"
+    ".popsection\n"
+);
+
+extern const char smp_tramp_start[];
+extern const char smp_tramp_params[];
+extern const char smp_tramp_end[];
+
+// ---------------------------------------------------------------------
+// Local APIC
+// ---------------------------------------------------------------------
+
+static uint64_t g_lapic  = 0;
+static int      g_x2apic = 0;
+
+static uint32_t lapic_id(void) {
+    if (g_x2apic) return (uint32_t)rdmsr(X2APIC_MSR(LAPIC_ID));
+    return mmio_read32(g_lapic + LAPIC_ID) >> 24;
+}
+
+static void lapic_ipi(uint32_t apic_id, uint32_t icr) {
+    if (g_x2apic) {
+        wrmsr(X2APIC_MSR(LAPIC_ICR_LOW), ((uint64_t)apic_id << 32) | icr);
+        return;
+    }
+    mmio_write32(g_lapic + LAPIC_ICR_HIGH, apic_id << 24);
+    mmio_write32(g_lapic + LAPIC_ICR_LOW, icr);
+    for (int i = 0; i < 100000 && (mmio_read32(g_lapic + LAPIC_ICR_LOW) & ICR_PENDING); ++i) {
+        cpu_relax();
+    }
+}
+
+// ---------------------------------------------------------------------
+// CPUs and jobs
+// ---------------------------------------------------------------------
+
+static int      g_cpu_count = 1;
+static uint32_t g_apic_ids[SMP_MAX_CPUS];   // by CPU index
+static int      g_rdtscp;                   // TSC_AUX holds the CPU index
+static volatile int g_starting;         // index the next AP takes
+static volatile int g_started;          // AP_WAITING, AP_STARTED, AP_ABANDONED
+
+#define AP_WAITING   0
+#define AP_STARTED   1
+#define AP_ABANDONED 2                  // timed out: a late AP parks
+
+static SmpJob   g_job;
+static void    *g_job_arg;
+static int      g_job_cpus;
+static uint32_t g_job_gen;              // bumped to start a job
+static uint32_t g_job_done;             // APs finished with it
+
+__attribute__((noreturn))
+static void ap_main(void) {
+    int cpu = g_starting;
+    uint32_t seen = __atomic_load_n(&g_job_gen, __ATOMIC_ACQUIRE);
+    // Only the CPU being started, and only before start_ap() gives up on
+    // it. Any other never joins the jobs: its index is not its own, and it
+    // would throw smp_run()'s count of finished CPUs off.
+    int waiting = AP_WAITING;
+    if (g_apic_ids[cpu] != lapic_id() ||
+        !__atomic_compare_exchange_n(&g_started, &waiting, AP_STARTED, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        for (;;) __asm__ volatile("cli; hlt");
+    }
+    if (g_rdtscp) wrmsr(MSR_TSC_AUX, (uint64_t)cpu);
+
+    for (;;) {
+        uint32_t gen;
+        while ((gen = __atomic_load_n(&g_job_gen, __ATOMIC_ACQUIRE)) == seen) {
+            cpu_relax();
+        }
+        seen = gen;
+        if (cpu < g_job_cpus) g_job(g_job_arg, cpu);
+        __atomic_add_fetch(&g_job_done, 1, __ATOMIC_RELEASE);
+    }
+}
+
+static int start_ap(uint32_t apic_id, uint64_t trampoline, ApParams *params) {
+    uint8_t *stack = (uint8_t*)kmalloc(AP_STACK_SIZE);
+    if (!stack) return 0;
+    params->stack = ((uint64_t)(uintptr_t)(stack + AP_STACK_SIZE)) & ~15ull;
+    g_starting = g_cpu_count;
+    g_apic_ids[g_cpu_count] = apic_id;
+    __atomic_store_n(&g_started, AP_WAITING, __ATOMIC_RELEASE);
+
+    lapic_ipi(apic_id, ICR_INIT | ICR_LEVEL_ASSERT);
+    delay_ms(10);
+    for (int sipi = 0; sipi < 2; ++sipi) {
+        lapic_ipi(apic_id, ICR_STARTUP | (uint32_t)(trampoline >> 12));
+        uint64_t until = time_us() + 200;
+        while (time_us() < until && !__atomic_load_n(&g_started, __ATOMIC_ACQUIRE)) {
+            cpu_relax();
+        }
+        if (__atomic_load_n(&g_started, __ATOMIC_ACQUIRE)) break;
+    }
+    uint64_t until = time_ms() + AP_START_TIMEOUT_MS;
+    while (time_ms() < until && !__atomic_load_n(&g_started, __ATOMIC_ACQUIRE)) {
+        cpu_relax();
+    }
+    // A CPU that has not shown up keeps its stack: it may still come up
+    // late and must not land on someone else's. It parks then; if it
+    // claims the start first, it counts after all.
+    int waiting = AP_WAITING;
+    if (__atomic_compare_exchange_n(&g_started, &waiting, AP_ABANDONED, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    g_cpu_count++;
+    return 1;
+}
+
+int smp_init(uint64_t trampoline) {
+    const AcpiHeader *madt = acpi_find_table("APIC");
+    if (!trampoline || !madt) return g_cpu_count;
+
+    uint64_t cr0, cr3, cr4;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    if (cr3 >> 32) return g_cpu_count;     // out of the trampoline's reach
+
+    uint64_t apic_base = rdmsr(MSR_APIC_BASE);
+    g_x2apic = (apic_base & APIC_BASE_X2APIC) != 0;
+    g_lapic  = apic_base & APIC_BASE_ADDR_MASK;
+    uint32_t self = lapic_id();
+    g_apic_ids[0] = self;
+    uint32_t r[4];
+    cpuid(0x80000001, 0, r);
+    g_rdtscp = (r[3] >> 27) & 1;
+    if (g_rdtscp) wrmsr(MSR_TSC_AUX, 0);
+
+    uint32_t size = (uint32_t)(smp_tramp_end - smp_tramp_start);
+    memcpy((void*)(uintptr_t)trampoline, smp_tramp_start, size);
+    ApParams *params = (ApParams*)(uintptr_t)(trampoline +
+                       (uint64_t)(smp_tramp_params - smp_tramp_start));
+
+    struct __attribute__((packed)) { uint16_t limit; uint64_t base; } gdtr;
+    uint16_t cs, ds;
+    __asm__ volatile("sgdt %0" : "=m"(gdtr));
+    __asm__ volatile("mov %%cs, %0" : "=r"(cs));
+    __asm__ volatile("mov %%ds, %0" : "=r"(ds));
+
+    params->cr0       = cr0;
+    params->cr3       = cr3;
+    params->cr4       = cr4 & ~(CR4_PCIDE | CR4_CET);   // not valid from real mode
+    params->efer      = rdmsr(MSR_EFER) & ~EFER_LMA;
+    params->entry     = (uint64_t)(uintptr_t)ap_main;
+    params->gdt_limit = gdtr.limit;
+    params->gdt_base  = gdtr.base;
+    params->cs        = cs;
+    params->ds        = ds;
+
+    // MADT: 8 bytes (local APIC address, flags) after the header, then
+    // variable-length entries.
+    const uint8_t *p   = (const uint8_t*)madt + sizeof(AcpiHeader) + 8;
+    const uint8_t *end = (const uint8_t*)madt + madt->length;
+    while (p + 2 <= end && p[1] >= 2 && g_cpu_count < SMP_MAX_CPUS) {
+        uint32_t id = 0xFFFFFFFFu, flags = 0;
+        if (p[0] == MADT_LAPIC && p[1] >= 8) {
+            id = p[3];
+            memcpy(&flags, p + 4, 4);
+        } else if (p[0] == MADT_X2APIC && p[1] >= 16) {
+            memcpy(&id, p + 4, 4);
+            memcpy(&flags, p + 8, 4);
+        }
+        p += p[1];
+
+        if (id == 0xFFFFFFFFu || id == self || !(flags & MADT_ENABLED)) continue;
+        if (!g_x2apic && id > 0xFE) continue;
+        if (!start_ap(id, trampoline, params)) break;
+    }
+    return g_cpu_count;
+}
+
+int smp_cpu_count(void) {
+    return g_cpu_count;
+}
+
+int smp_cpu_id(void) {
+    if (g_cpu_count == 1) return 0;
+    if (g_rdtscp) {
+        uint32_t aux;
+        __asm__ volatile("rdtscp" : "=c"(aux) : : "rax", "rdx");
+        return (int)aux;
+    }
+    uint32_t id = lapic_id();
+    for (int i = 1; i < g_cpu_count; ++i) {
+        if (g_apic_ids[i] == id) return i;
+    }
+    return 0;
+}
+
+void smp_run(SmpJob job, void *arg, int cpus) {
+    if (cpus > g_cpu_count) cpus = g_cpu_count;
+    if (cpus <= 1) {
+        job(arg, 0);
+        return;
+    }
+    g_job      = job;
+    g_job_arg  = arg;
+    g_job_cpus = cpus;
+    __atomic_store_n(&g_job_done, 0, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&g_job_gen, 1, __ATOMIC_RELEASE);
+
+    job(arg, 0);
+    while (__atomic_load_n(&g_job_done, __ATOMIC_ACQUIRE) < (uint32_t)(g_cpu_count - 1)) {
+        cpu_relax();
+    }
+}
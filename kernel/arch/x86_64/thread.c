@@ -0,0 +1,127 @@
+// kernel/arch/x86_64/thread.c
+// Cooperative kernel threads: a ring of runnable threads and a context
+// switch that saves only what the SysV ABI says a callee must preserve.
+
+#include "thread.h"
+#include "mm.h"
+#include "klib.h"
+
+struct Thread {
+    uint64_t  rsp;              // saved while switched out
+    void     *stack;            // 0 for the boot thread
+    ThreadFn  fn;
+    void     *arg;
+    int       done;
+    Thread   *next;             // run ring
+    char      name[THREAD_NAME_LEN];
+};
+
+static Thread  g_boot = { 0, 0, 0, 0, 0, &g_boot, "main" };
+static Thread *g_current = &g_boot;
+static int     g_count = 1;
+
+// thread_switch(&old->rsp, new->rsp): pushes the callee-saved registers,
+// swaps stacks and pops the other thread's. A new thread's stack is built
+// to "return" into thread_entry.
+void thread_switch(uint64_t *save_rsp, uint64_t rsp);
+void thread_entry(void);
+
+__asm__(
+    ".text\n"
+    ".global thread_switch, thread_entry\n"
+    "thread_switch:\n"
+    "    push %rbp\n"
+    "    push %rbx\n"
+    "    push %r12\n"
+    "    push %r13\n"
+    "    push %r14\n"
+    "    push %r15\n"
+    "    mov  %rsp, (%rdi)\n"
+    "    mov  %rsi, %rsp\n"
+    "    pop  %r15\n"
+    "    pop  %r14\n"
+    "    pop  %r13\n"
+    "    pop  %r12\n"
+    "    pop  %rbx\n"
+    "    pop  %rbp\n"
+    "    ret\n"
+    "thread_entry:\n"
+    "    and  $-16, %rsp\n"
+    "    call thread_main\n"
+    "    ud2\n"
+);
+
+static void switch_to(Thread *next) {
+    Thread *prev = g_current;
+    if (next == prev) return;
+    g_current = next;
+    thread_switch(&prev->rsp, next->rsp);
+}
+
+// Runs on the new thread's stack; never returns.
+void thread_main(void);
+void thread_main(void) {
+    Thread *self = g_current;
+    self->fn(self->arg);
+
+    // Off the ring, then away for good; the joiner frees the stack.
+    Thread *prev = self;
+    while (prev->next != self) prev = prev->next;
+    prev->next = self->next;
+    self->done = 1;
+    g_count--;
+    switch_to(self->next);
+    for (;;) { }
+}
+
+Thread *thread_create(ThreadFn fn, void *arg, const char *name) {
+    Thread *t = (Thread*)kzalloc(sizeof(Thread));
+    if (!t) return 0;
+    t->stack = page_alloc(THREAD_STACK_ORDER);
+    if (!t->stack) {
+        kfree(t);
+        return 0;
+    }
+    t->fn  = fn;
+    t->arg = arg;
+    str_copy(t->name, name ? name : "", sizeof(t->name));
+
+    // Six zeroed registers for thread_switch to pop, then its return
+    // address.
+    uint64_t *sp = (uint64_t*)((uint8_t*)t->stack + (4096u << THREAD_STACK_ORDER));
+    *--sp = 0;
+    *--sp = (uint64_t)(uintptr_t)thread_entry;
+    for (int i = 0; i < 6; ++i) *--sp = 0;
+    t->rsp = (uint64_t)(uintptr_t)sp;
+
+    // Last in the ring, so threads first run in the order they were made.
+    Thread *prev = g_current;
+    while (prev->next != g_current) prev = prev->next;
+    prev->next = t;
+    t->next = g_current;
+    g_count++;
+    return t;
+}
+
+void thread_yield(void) {
+    switch_to(g_current->next);
+}
+
+int thread_done(const Thread *t) {
+    return t->done;
+}
+
+void thread_join(Thread *t) {
+    if (!t || t == g_current || t == &g_boot) return;
+    while (!t->done) thread_yield();
+    page_free(t->stack, THREAD_STACK_ORDER);
+    kfree(t);
+}
+
+Thread *thread_current(void) {
+    return g_current;
+}
+
+int thread_count(void) {
+    return g_count;
+}
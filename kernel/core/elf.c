@@ -0,0 +1,146 @@
+// kernel/core/elf.c
+// ELF64 executable loader for user processes.
+
+#include "elf.h"
+#include "mm.h"
+#include "klib.h"
+
+#define ELF_PT_LOAD   1
+#define ELF_PF_X      0x1
+#define ELF_PF_W      0x2
+#define ELF_ET_EXEC   2
+#define ELF_EM_X86_64 62
+
+typedef struct {
+    uint8_t  ident[16];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint64_t entry;
+    uint64_t phoff;
+    uint64_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+} ElfHeader;
+
+typedef struct {
+    uint32_t type;
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t vaddr;
+    uint64_t paddr;
+    uint64_t filesz;
+    uint64_t memsz;
+    uint64_t align;
+} ElfSegment;
+
+static uint64_t page_down(uint64_t v) {
+    return v & ~(uint64_t)(PAGE_SIZE - 1);
+}
+
+static uint64_t page_up(uint64_t v) {
+    return page_down(v + PAGE_SIZE - 1);
+}
+
+static uint32_t segment_access(const ElfSegment *s) {
+    return ((s->flags & ELF_PF_W) ? VM_WRITE : 0) |
+           ((s->flags & ELF_PF_X) ? VM_EXEC : 0);
+}
+
+int elf_load(AddressSpace *as, const uint8_t *image, uint32_t size,
+             uint64_t *entry, uint64_t *end, const char **why) {
+    const ElfHeader *h = (const ElfHeader*)image;
+    if (size < sizeof(ElfHeader) ||
+        h->ident[0] != 0x7F || h->ident[1] != 'E' ||
+        h->ident[2] != 'L' || h->ident[3] != 'F') {
+        *why = "not an ELF file";
+        return -1;
+    }
+    if (h->ident[4] != 2 || h->ident[5] != 1 || h->machine != ELF_EM_X86_64) {
+        *why = "not a 64-bit x86 program";
+        return -1;
+    }
+    if (h->type != ELF_ET_EXEC) {
+        *why = "not a static executable";
+        return -1;
+    }
+    if (h->phentsize != sizeof(ElfSegment) || h->phoff > size ||
+        (uint64_t)h->phnum * sizeof(ElfSegment) > size - h->phoff) {
+        *why = "bad program headers";
+        return -1;
+    }
+
+    const ElfSegment *segs = (const ElfSegment*)(image + h->phoff);
+    uint64_t top = 0;
+    int loads = 0;
+
+    // Check everything before mapping anything.
+    for (uint32_t i = 0; i < h->phnum; ++i) {
+        const ElfSegment *s = &segs[i];
+        if (s->type != ELF_PT_LOAD) continue;
+        if (s->filesz > s->memsz || s->offset > size || s->filesz > size - s->offset) {
+            *why = "segment outside the file";
+            return -1;
+        }
+        if (s->vaddr < USER_BASE || s->vaddr >= USER_TOP ||
+            s->memsz > USER_TOP - s->vaddr) {
+            *why = "segment outside user memory";
+            return -1;
+        }
+        if (page_up(s->vaddr + s->memsz) > top) top = page_up(s->vaddr + s->memsz);
+        ++loads;
+    }
+    if (!loads || h->entry < USER_BASE || h->entry >= top) {
+        *why = "bad entry point";
+        return -1;
+    }
+
+    // Segments may share a page at their ends, so pages are mapped one at
+    // a time with what any segment on them asks for. Pages holding none of
+    // the file's bytes are only reserved: .bss comes zeroed on demand.
+    for (uint32_t i = 0; i < h->phnum; ++i) {
+        const ElfSegment *s = &segs[i];
+        if (s->type != ELF_PT_LOAD || !s->memsz) continue;
+        uint64_t last = page_up(s->vaddr + s->memsz);
+        for (uint64_t va = page_down(s->vaddr); va < last; va += PAGE_SIZE) {
+            if (!vm_range_free(as, va, PAGE_SIZE)) continue;
+            uint32_t access = 0;
+            int      data   = 0;
+            for (uint32_t j = 0; j < h->phnum; ++j) {
+                const ElfSegment *o = &segs[j];
+                if (o->type != ELF_PT_LOAD || !o->memsz) continue;
+                if (page_down(o->vaddr) <= va && page_up(o->vaddr + o->memsz) > va) {
+                    access |= segment_access(o);
+                }
+                if (o->filesz && page_down(o->vaddr) <= va &&
+                    page_up(o->vaddr + o->filesz) > va) {
+                    data = 1;
+                }
+            }
+            int rc = data ? vm_map(as, va, PAGE_SIZE, access)
+                          : vm_reserve(as, va, PAGE_SIZE, access, 0, 0, 0);
+            if (rc < 0) {
+                *why = "out of memory";
+                return -1;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < h->phnum; ++i) {
+        const ElfSegment *s = &segs[i];
+        if (s->type != ELF_PT_LOAD || !s->filesz) continue;
+        if (vm_load(as, s->vaddr, image + s->offset, s->filesz) < 0) {
+            *why = "out of memory";
+            return -1;
+        }
+    }
+
+    *entry = h->entry;
+    *end   = top;
+    return 0;
+}
@@ -0,0 +1,256 @@
+// kernel/core/ioring.c
+// I/O rings: the shared queues, the requests taken from them and the
+// worker threads that carry them out.
+
+#include "ioring.h"
+#include "thread.h"
+#include "timer.h"
+#include "mm.h"
+#include "klib.h"
+
+#define IORING_HEADER 64                // bytes before the submission queue
+
+typedef struct IoReq IoReq;
+struct IoReq {
+    IoReq   *next;
+    IoSqe    sqe;                       // a copy: the slot is reused at once
+    uint64_t deadline;                  // TIMEOUT: time_ms() it completes at
+};
+
+struct IoRing {
+    IoRingShared *shared;
+    IoSqe        *sqes;
+    IoCqe        *cqes;
+    uint32_t      order;                // of the shared memory's block
+    // Ours; the shared copies are only for the ring's user to read, and it
+    // can write them too.
+    uint32_t      sq_entries;
+    uint32_t      cq_entries;
+    uint32_t      sq_head;
+    uint32_t      cq_tail;
+    IoRingOps     ops;
+    IoReq        *reqs;                 // cq_entries of them
+    IoReq        *free;
+    IoReq        *queued;               // taken, not tried yet, in order
+    IoReq       **queued_tail;
+    uint32_t      queued_count;
+    IoReq        *waiting;              // answered IORING_AGAIN
+    uint32_t      in_flight;            // taken and not completed
+    uint32_t      running;              // in ops.run() now
+    Thread       *workers[IORING_WORKERS];
+    int           stopping;
+};
+
+static IoRingStats g_stats;
+
+// ---------------------------------------------------------------------
+// Requests
+// ---------------------------------------------------------------------
+
+// Posts q's completion and lets q go. With the completion queue full
+// (only if the ring's user moved cq_head wrongly) it is counted and lost.
+static void complete(IoRing *r, IoReq *q, int64_t res) {
+    IoRingShared *s = r->shared;
+    if (r->cq_tail - s->cq_head >= r->cq_entries) {
+        s->cq_overflow++;
+    } else {
+        IoCqe *c = &r->cqes[r->cq_tail & (r->cq_entries - 1)];
+        c->user_data = q->sqe.user_data;
+        c->res       = res;
+        r->cq_tail++;
+        __atomic_store_n(&s->cq_tail, r->cq_tail, __ATOMIC_RELEASE);
+    }
+    q->next = r->free;
+    r->free = q;
+    r->in_flight--;
+    g_stats.completed++;
+}
+
+// Tries q once: it completes, or joins the waiting ones.
+static void attempt(IoRing *r, IoReq *q) {
+    int64_t res;
+    if (r->stopping) {
+        res = SYS_ECANCELED;
+    } else if (q->sqe.opcode == IORING_OP_NOP) {
+        res = 0;
+    } else if (q->sqe.opcode == IORING_OP_TIMEOUT) {
+        res = time_ms() >= q->deadline ? 0 : IORING_AGAIN;
+    } else {
+        r->running++;
+        res = r->ops.run(r->ops.ctx, &q->sqe);
+        r->running--;
+        if (res == IORING_AGAIN) g_stats.retries++;
+    }
+    if (res == IORING_AGAIN) {
+        q->next    = r->waiting;
+        r->waiting = q;
+        return;
+    }
+    complete(r, q, res);
+}
+
+// Takes queued requests in order; once there are none, goes round the
+// waiting ones until they are done too or new ones come, then exits.
+static void worker(void *arg) {
+    IoRing *r = (IoRing*)arg;
+    for (;;) {
+        IoReq *q = r->queued;
+        if (q) {
+            r->queued = q->next;
+            if (!r->queued) r->queued_tail = &r->queued;
+            r->queued_count--;
+            attempt(r, q);
+            continue;
+        }
+        if (!r->waiting) break;
+        // The list is this worker's while it goes round; the others find
+        // nothing waiting and leave it to it.
+        IoReq *list = r->waiting;
+        r->waiting  = 0;
+        while (list) {
+            IoReq *next = list->next;
+            attempt(r, list);
+            list = next;
+        }
+        thread_yield();
+    }
+}
+
+// Joins the workers that have exited and starts enough for what is left:
+// one per request not tried yet, besides those busy in run(), and one to
+// go round the waiting ones.
+static void workers_start(IoRing *r) {
+    uint32_t live = 0;
+    for (int i = 0; i < IORING_WORKERS; ++i) {
+        if (r->workers[i] && thread_done(r->workers[i])) {
+            thread_join(r->workers[i]);
+            r->workers[i] = 0;
+        }
+        if (r->workers[i]) live++;
+    }
+    uint32_t want = r->running + r->queued_count + (r->waiting ? 1u : 0u);
+    for (int i = 0; i < IORING_WORKERS && live < want; ++i) {
+        if (r->workers[i]) continue;
+        r->workers[i] = thread_create(worker, r, "io");
+        if (!r->workers[i]) break;
+        g_stats.workers_started++;
+        live++;
+    }
+}
+
+uint32_t ioring_submit(IoRing *r, uint32_t count) {
+    IoRingShared *s = r->shared;
+    uint32_t queued = __atomic_load_n(&s->sq_tail, __ATOMIC_ACQUIRE) - r->sq_head;
+    if (queued > r->sq_entries) queued = r->sq_entries;     // a bad sq_tail
+    if (count > queued) count = queued;
+
+    uint32_t taken = 0;
+    while (taken < count && r->free && !r->stopping) {
+        // Room for every completion: those not read yet and those to come.
+        uint32_t unread = r->cq_tail - s->cq_head;
+        if (unread > r->cq_entries || unread + r->in_flight >= r->cq_entries) break;
+        IoReq *q = r->free;
+        r->free  = q->next;
+        q->sqe   = r->sqes[r->sq_head & (r->sq_entries - 1)];
+        q->next  = 0;
+        if (q->sqe.opcode == IORING_OP_TIMEOUT) {
+            uint64_t now = time_ms();
+            q->deadline  = q->sqe.off > ~0ull - now ? ~0ull : now + q->sqe.off;
+        }
+        *r->queued_tail = q;
+        r->queued_tail  = &q->next;
+        r->queued_count++;
+        r->in_flight++;
+        r->sq_head++;
+        taken++;
+    }
+    __atomic_store_n(&s->sq_head, r->sq_head, __ATOMIC_RELEASE);
+    g_stats.submitted += taken;
+    if (taken) workers_start(r);
+    return taken;
+}
+
+uint32_t ioring_ready(const IoRing *r) {
+    uint32_t ready = r->cq_tail - r->shared->cq_head;
+    return ready > r->cq_entries ? r->cq_entries : ready;
+}
+
+uint32_t ioring_in_flight(const IoRing *r) {
+    return r->in_flight;
+}
+
+// ---------------------------------------------------------------------
+// Rings
+// ---------------------------------------------------------------------
+
+IoRing *ioring_create(uint32_t entries, const IoRingOps *ops) {
+    uint32_t n = 1;
+    while (n < entries && n < IORING_MAX_ENTRIES) n <<= 1;
+    uint32_t cq_offset = IORING_HEADER + n * (uint32_t)sizeof(IoSqe);
+    uint32_t size      = cq_offset + 2 * n * (uint32_t)sizeof(IoCqe);
+
+    IoRing *r = (IoRing*)kzalloc(sizeof(IoRing));
+    if (!r) return 0;
+    r->order = page_order_for(size);
+    r->reqs  = (IoReq*)kmalloc(2 * n * sizeof(IoReq));
+    void *mem = r->reqs ? page_alloc(r->order) : 0;
+    if (!mem) {
+        kfree(r->reqs);
+        kfree(r);
+        return 0;
+    }
+    // Pages of their own, so a mapping can outlive the ring.
+    page_split(mem, r->order);
+    memset(mem, 0, (size_t)PAGE_SIZE << r->order);
+
+    IoRingShared *s = (IoRingShared*)mem;
+    s->sq_entries = n;
+    s->sq_offset  = IORING_HEADER;
+    s->cq_entries = 2 * n;
+    s->cq_offset  = cq_offset;
+    s->size       = PAGE_SIZE << r->order;
+    r->shared      = s;
+    r->sq_entries  = n;
+    r->cq_entries  = 2 * n;
+    r->sqes        = (IoSqe*)((uint8_t*)mem + IORING_HEADER);
+    r->cqes        = (IoCqe*)((uint8_t*)mem + cq_offset);
+    r->ops         = *ops;
+    r->queued_tail = &r->queued;
+    for (uint32_t i = 0; i < 2 * n; ++i) {
+        r->reqs[i].next = r->free;
+        r->free         = &r->reqs[i];
+    }
+    return r;
+}
+
+void ioring_destroy(IoRing *r) {
+    // Workers cancel whatever they try from now on, and finish what they
+    // are running first.
+    r->stopping = 1;
+    for (int i = 0; i < IORING_WORKERS; ++i) {
+        if (r->workers[i]) thread_join(r->workers[i]);
+    }
+    for (uint32_t i = 0; i < ioring_page_count(r); ++i) {
+        page_put((uint8_t*)r->shared + (size_t)i * PAGE_SIZE);
+    }
+    kfree(r->reqs);
+    kfree(r);
+}
+
+IoRingShared *ioring_shared(IoRing *r) {
+    return r->shared;
+}
+
+uint32_t ioring_page_count(const IoRing *r) {
+    return 1u << r->order;
+}
+
+void *ioring_page(IoRing *r, uint32_t index) {
+    void *page = (uint8_t*)r->shared + (size_t)index * PAGE_SIZE;
+    page_get(page);
+    return page;
+}
+
+void ioring_stats(IoRingStats *out) {
+    *out = g_stats;
+}
@@ -6,12 +6,82 @@
 //   * Basic PS/2 mouse support (physical mouse / PS/2 trackpad)
 //   * Keyboard navigation fallback still works.
 //
+//   * virtio-net NIC driver (zero-copy packet rings, polled)
+//   * TCP/IP stack (ARP, IPv4, ICMP, UDP, TCP, DHCP, DNS) and an HTTP/1.1
+//     client behind the Browser's Network tab
+//   * Window manager: every app in its own movable, resizable window,
+//     composited from cached surfaces
+//   * Anti-aliased text from PSF or TrueType fonts through a glyph cache
+//   * Boot resolution from \lightos.cfg; runtime mode switching on Bochs VBE
+//   * Application processors started from the ACPI MADT; large repaints
+//     are rasterized in tiles on every core
+//   * Table-driven keyboard driver: Ctrl/Alt/extended keys, locks and
+//     software key repeat, delivered to the focused window as events
+//   * Retained widget trees: layout once per resize, grid-indexed hit
+//     tests, hover highlighting in the menus
+//   * Command Block shell: commands registered in a hashed table (drivers
+//     add their own), quoted arguments, generated help
+//   * Pipelines and redirection: `a | b | c > file`, each command in its
+//     own cooperative kernel thread, streaming through bounded pipes;
+//     grep, head, tail, wc and more filters; Ctrl+C stops a running job
+//   * Line editing: history on Up/Down, Ctrl+R reverse search, Tab
+//     completion of commands and paths; multi-component paths resolved
+//     through a dentry hash
+//   * Full-screen `edit`: piece-table buffer over the file's own bytes,
+//     search, undo/redo, only changed lines repainted; files of any size
+//     up to 16 MiB on the heap
+//   * User processes: `run <file>` loads static ELF programs from the
+//     file system into ring 3, each with its own PCID-tagged page tables;
+//     SYSCALL/SYSRET system calls, spawn/wait, APIC timer time slices
+//   * Page cache: virtio-blk disks under \dev read through a radix-tree
+//     cache with readahead and written back in batches by a flusher
+//     thread; mmap() maps the cached pages of files and disks
+//
+//   * xHCI USB host driver: boot-protocol HID keyboards and mice feed the
+//     same event queues as PS/2
+//   * virtio-input tablets: absolute pointer positions, so the cursor
+//     tracks the host's under QEMU/VNC without grabbing
+//
 // NOTE: For the mouse to move, the machine/firmware must expose a PS/2-compatible
-// pointing device. In QEMU this works out of the box. On some real laptops the
-// touchpad is USB/I2C-only, so PS/2 polling in this kernel will not see it.
+// pointing device or a USB boot-protocol mouse on an xHCI controller. In QEMU
+// both work out of the box. Touchpads that are I2C-only are still not seen.
 
 #include <stdint.h>
 #include "boot.h"
+#include "klib.h"
+#include "io.h"
+#include "mm.h"
+#include "pci.h"
+#include "netdev.h"
+#include "virtio_net.h"
+#include "timer.h"
+#include "net.h"
+#include "tcp.h"
+#include "http.h"
+#include "html.h"
+#include "wm.h"
+#include "font.h"
+#include "bga.h"
+#include "dlist.h"
+#include "acpi.h"
+#include "smp.h"
+#include "keyboard.h"
+#include "mouse.h"
+#include "xhci.h"
+#include "virtio_input.h"
+#include "widget.h"
+#include "shell.h"
+#include "thread.h"
+#include "editor.h"
+#include "cpu.h"
+#include "vm.h"
+#include "proc.h"
+#include "syscall.h"
+#include "userbin.h"
+#include "pagecache.h"
+#include "blkdev.h"
+#include "virtio_blk.h"
+#include "ioring.h"
 
 // ---------------------------------------------------------------------
 // Global framebuffer + time
@@ -30,239 +100,150 @@ static uint8_t  g_minute = 0;
 static uint8_t  g_second = 0;
 
 // ---------------------------------------------------------------------
-// Basic pixel ops
+// Display modes
 // ---------------------------------------------------------------------
 
-static void put_pixel(uint32_t x, uint32_t y, uint32_t color) {
-    if (!g_fb) return;
-    if (x >= g_width || y >= g_height) return;
-    g_fb[(uint64_t)y * g_pitch + x] = color;
-}
+// Modes the kernel can switch to at runtime; empty when the resolution is
+// fixed at boot (GOP cannot set modes after ExitBootServices()).
+static DisplayMode g_modes[BGA_MAX_MODES];
+static int         g_mode_count = 0;
 
-static void fill_rect(uint32_t x, uint32_t y,
-                      uint32_t w, uint32_t h,
-                      uint32_t color) {
-    if (!g_fb) return;
-    if (x >= g_width || y >= g_height) return;
-    if (x + w > g_width)  w = g_width  - x;
-    if (y + h > g_height) h = g_height - y;
-    for (uint32_t j = 0; j < h; ++j) {
-        uint32_t *row = &g_fb[(uint64_t)(y + j) * g_pitch + x];
-        for (uint32_t i = 0; i < w; ++i) {
-            row[i] = color;
-        }
-    }
+static void format_mode(char *buf, uint32_t size, uint32_t w, uint32_t h) {
+    buf[0] = '\0';
+    str_cat_u64(buf, w, size);
+    str_cat(buf, "x", size);
+    str_cat_u64(buf, h, size);
 }
 
-static void draw_rect_border(uint32_t x, uint32_t y,
-                             uint32_t w, uint32_t h,
-                             uint32_t color) {
-    if (!g_fb) return;
-    if (w < 2 || h < 2) return;
-    for (uint32_t i = 0; i < w; ++i) {
-        put_pixel(x + i, y,         color);
-        put_pixel(x + i, y + h - 1, color);
-    }
-    for (uint32_t j = 0; j < h; ++j) {
-        put_pixel(x,         y + j, color);
-        put_pixel(x + w - 1, y + j, color);
+// "1024x768" -> 1024, 768. Returns 0 if s is not of that form.
+static int parse_mode(const char *s, uint32_t *w, uint32_t *h) {
+    uint32_t v[2] = { 0, 0 };
+    int part = 0, digits = 0;
+    for (; *s; ++s) {
+        if (*s >= '0' && *s <= '9' && v[part] < 100000) {
+            v[part] = v[part] * 10 + (uint32_t)(*s - '0');
+            digits++;
+        } else if ((*s == 'x' || *s == 'X') && part == 0 && digits) {
+            part = 1;
+            digits = 0;
+        } else {
+            return 0;
+        }
     }
+    if (part != 1 || !digits || !v[0] || !v[1]) return 0;
+    *w = v[0];
+    *h = v[1];
+    return 1;
 }
 
 // ---------------------------------------------------------------------
-// 8x8 Font (uppercase, digits, some punctuation)
+// Basic pixel ops
 // ---------------------------------------------------------------------
 
-typedef struct {
-    char    c;
-    uint8_t rows[8];
-} Glyph8;
-
-static const Glyph8 FONT8[] = {
-    // Digits
-    { '0', { 0x3C,0x42,0x46,0x4A,0x52,0x62,0x3C,0x00 } },
-    { '1', { 0x08,0x18,0x28,0x08,0x08,0x08,0x3E,0x00 } },
-    { '2', { 0x3C,0x42,0x02,0x1C,0x20,0x40,0x7E,0x00 } },
-    { '3', { 0x3C,0x42,0x02,0x1C,0x02,0x42,0x3C,0x00 } },
-    { '4', { 0x04,0x0C,0x14,0x24,0x44,0x7E,0x04,0x00 } },
-    { '5', { 0x7E,0x40,0x7C,0x02,0x02,0x42,0x3C,0x00 } },
-    { '6', { 0x1C,0x20,0x40,0x7C,0x42,0x42,0x3C,0x00 } },
-    { '7', { 0x7E,0x02,0x04,0x08,0x10,0x20,0x20,0x00 } },
-    { '8', { 0x3C,0x42,0x42,0x3C,0x42,0x42,0x3C,0x00 } },
-    { '9', { 0x3C,0x42,0x42,0x3E,0x02,0x04,0x38,0x00 } },
-
-    // Uppercase letters
-    { 'A', { 0x10,0x28,0x44,0x44,0x7C,0x44,0x44,0x00 } },
-    { 'B', { 0x78,0x44,0x44,0x78,0x44,0x44,0x78,0x00 } },
-    { 'C', { 0x3C,0x42,0x40,0x40,0x40,0x42,0x3C,0x00 } },
-    { 'D', { 0x78,0x44,0x42,0x42,0x42,0x44,0x78,0x00 } },
-    { 'E', { 0x7E,0x40,0x40,0x7C,0x40,0x40,0x7E,0x00 } },
-    { 'F', { 0x7E,0x40,0x40,0x7C,0x40,0x40,0x40,0x00 } },
-    { 'G', { 0x3C,0x42,0x40,0x4E,0x42,0x42,0x3C,0x00 } },
-    { 'H', { 0x42,0x42,0x42,0x7E,0x42,0x42,0x42,0x00 } },
-    { 'I', { 0x3E,0x08,0x08,0x08,0x08,0x08,0x3E,0x00 } },
-    { 'J', { 0x0E,0x04,0x04,0x04,0x44,0x44,0x38,0x00 } },
-    { 'K', { 0x42,0x44,0x48,0x70,0x48,0x44,0x42,0x00 } },
-    { 'L', { 0x40,0x40,0x40,0x40,0x40,0x40,0x7E,0x00 } },
-    { 'M', { 0x42,0x66,0x5A,0x5A,0x42,0x42,0x42,0x00 } },
-    { 'N', { 0x42,0x62,0x52,0x4A,0x46,0x42,0x42,0x00 } },
-    { 'O', { 0x3C,0x42,0x42,0x42,0x42,0x42,0x3C,0x00 } },
-    { 'P', { 0x7C,0x42,0x42,0x7C,0x40,0x40,0x40,0x00 } },
-    { 'Q', { 0x3C,0x42,0x42,0x42,0x4A,0x44,0x3A,0x00 } },
-    { 'R', { 0x7C,0x42,0x42,0x7C,0x48,0x44,0x42,0x00 } },
-    { 'S', { 0x3C,0x40,0x40,0x3C,0x02,0x02,0x3C,0x00 } },
-    { 'T', { 0x7F,0x49,0x08,0x08,0x08,0x08,0x1C,0x00 } },
-    { 'U', { 0x42,0x42,0x42,0x42,0x42,0x42,0x3C,0x00 } },
-    { 'V', { 0x42,0x42,0x42,0x24,0x24,0x18,0x18,0x00 } },
-    { 'W', { 0x42,0x42,0x5A,0x5A,0x5A,0x66,0x42,0x00 } },
-    { 'X', { 0x42,0x24,0x18,0x18,0x18,0x24,0x42,0x00 } },
-    { 'Y', { 0x42,0x24,0x18,0x18,0x18,0x18,0x18,0x00 } },
-    { 'Z', { 0x7E,0x02,0x04,0x08,0x10,0x20,0x7E,0x00 } },
-
-    // Basic punctuation + symbols used by the shell/UI
-    { ' ', { 0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 } },
-    { '>', { 0x00,0x40,0x20,0x10,0x20,0x40,0x00,0x00 } },
-    { '<', { 0x00,0x02,0x04,0x08,0x04,0x02,0x00,0x00 } },
-    { ':', { 0x00,0x18,0x18,0x00,0x18,0x18,0x00,0x00 } },
-    { '.', { 0x00,0x00,0x00,0x00,0x00,0x18,0x18,0x00 } },
-    { ',', { 0x00,0x00,0x00,0x00,0x18,0x18,0x10,0x20 } },
-    { '/', { 0x02,0x04,0x08,0x10,0x20,0x40,0x00,0x00 } },
-    { '\\',{ 0x40,0x20,0x10,0x08,0x04,0x02,0x00,0x00 } },
-    { '-', { 0x00,0x00,0x00,0x3C,0x00,0x00,0x00,0x00 } },
-    { '_', { 0x00,0x00,0x00,0x00,0x00,0x00,0x7E,0x00 } },
-    { '=', { 0x00,0x00,0x3C,0x00,0x3C,0x00,0x00,0x00 } },
-    { '[', { 0x1E,0x10,0x10,0x10,0x10,0x10,0x1E,0x00 } },
-    { ']', { 0x78,0x08,0x08,0x08,0x08,0x08,0x78,0x00 } },
-    { '(', { 0x0C,0x10,0x20,0x20,0x20,0x10,0x0C,0x00 } },
-    { ')', { 0x30,0x08,0x04,0x04,0x04,0x08,0x30,0x00 } },
-    { '?', { 0x3C,0x42,0x02,0x0C,0x10,0x00,0x10,0x00 } },
-    { '!', { 0x08,0x08,0x08,0x08,0x08,0x00,0x08,0x00 } },
-    { '|', { 0x08,0x08,0x08,0x08,0x08,0x08,0x08,0x00 } },
-    { '+', { 0x00,0x08,0x08,0x3E,0x08,0x08,0x00,0x00 } },
-};
+// Everything below records into a display list (kernel/gui/dlist.c) for
+// the current target: the framebuffer during boot, then whichever window
+// surface the window manager is repainting. Nothing reaches the pixels
+// until gfx_flush().
+static DrawList g_dl;
+static Surface  g_fb_surface;
 
-static const uint8_t *font_lookup(char c) {
-    // Lowercase -> uppercase reuse
-    if (c >= 'a' && c <= 'z') {
-        c = (char)(c - 'a' + 'A');
-    }
-    for (unsigned i = 0; i < sizeof(FONT8)/sizeof(FONT8[0]); ++i) {
-        if (FONT8[i].c == c) return FONT8[i].rows;
-    }
-    // Fallback: '?'
-    for (unsigned i = 0; i < sizeof(FONT8)/sizeof(FONT8[0]); ++i) {
-        if (FONT8[i].c == '?') return FONT8[i].rows;
-    }
-    return 0;
+// Rasterizes what has been drawn since gfx_target().
+static void gfx_flush(void) {
+    dl_execute(&g_dl);
 }
 
-static void draw_char(uint32_t x, uint32_t y, char c,
-                      uint32_t color, uint32_t scale) {
-    const uint8_t *rows = font_lookup(c);
-    if (!rows) return;
-    for (uint32_t row = 0; row < 8; ++row) {
-        uint8_t bits = rows[row];
-        for (uint32_t col = 0; col < 8; ++col) {
-            if (bits & (1u << (7 - col))) {
-                for (uint32_t yy = 0; yy < scale; ++yy) {
-                    for (uint32_t xx = 0; xx < scale; ++xx) {
-                        put_pixel(x + col*scale + xx,
-                                  y + row*scale + yy,
-                                  color);
-                    }
-                }
-            }
-        }
-    }
+// Draw into s, or straight to the framebuffer when s is 0.
+static void gfx_target(Surface *s) {
+    gfx_flush();
+    if (!s) {
+        g_fb_surface.pixels = g_fb;
+        g_fb_surface.w      = g_width;
+        g_fb_surface.h      = g_height;
+        g_fb_surface.pitch  = g_pitch;
+        s = &g_fb_surface;
+    }
+    dl_begin(&g_dl, s);
 }
 
-static void draw_text(uint32_t x, uint32_t y,
-                      const char *s,
-                      uint32_t color,
-                      uint32_t scale) {
-    if (!s) return;
-    uint32_t cx = x;
-    while (*s) {
-        if (*s == '\n') {
-            y += 8 * scale + 2;
-            cx = x;
-        } else {
-            draw_char(cx, y, *s, color, scale);
-            cx += 8 * scale;
-        }
-        ++s;
-    }
+// Paint callbacks: draw into the window, limited to the part that changed.
+static void gfx_target_window(Window *win) {
+    gfx_target(&win->surface);
+    dl_clip(&g_dl, win->dirty_rect);
 }
 
-// ---------------------------------------------------------------------
-// Tiny string helpers
-// ---------------------------------------------------------------------
+static void put_pixel(uint32_t x, uint32_t y, uint32_t color) {
+    dl_fill(&g_dl, (int32_t)x, (int32_t)y, 1, 1, color);
+}
 
-static uint32_t str_len(const char *s) {
-    uint32_t n = 0;
-    if (!s) return 0;
-    while (s[n]) n++;
-    return n;
+static void fill_rect(uint32_t x, uint32_t y,
+                      uint32_t w, uint32_t h,
+                      uint32_t color) {
+    dl_fill(&g_dl, (int32_t)x, (int32_t)y, (int32_t)w, (int32_t)h, color);
 }
 
-static void str_copy(char *dst, const char *src, uint32_t max_len) {
-    if (!dst || !src || max_len == 0) return;
-    uint32_t i = 0;
-    for (; i + 1 < max_len && src[i]; ++i) {
-        dst[i] = src[i];
-    }
-    dst[i] = '\0';
+static void draw_rect_border(uint32_t x, uint32_t y,
+                             uint32_t w, uint32_t h,
+                             uint32_t color) {
+    dl_border(&g_dl, (int32_t)x, (int32_t)y, (int32_t)w, (int32_t)h, color);
 }
 
-static void str_cat(char *dst, const char *src, uint32_t max_len) {
-    if (!dst || !src) return;
-    uint32_t len = str_len(dst);
-    uint32_t i = 0;
-    while (len + 1 < max_len && src[i]) {
-        dst[len++] = src[i++];
-    }
-    dst[len] = '\0';
+static void blit(int32_t x, int32_t y, const Surface *src, Rect from) {
+    dl_blit(&g_dl, x, y, src, from.x, from.y, from.w, from.h);
 }
 
-static int str_eq(const char *a, const char *b) {
-    if (!a || !b) return 0;
-    while (*a && *b) {
-        if (*a != *b) return 0;
-        ++a; ++b;
+// ---------------------------------------------------------------------
+// UI text. Characters sit in 8x8 cells (times scale). Glyphs come from the
+// UI font through the glyph cache (kernel/gui/font.c), sized so capitals
+// are 7 rows tall like the built-in font and centred in the cell.
+// ---------------------------------------------------------------------
+
+#define UI_MAX_SCALE 8
+
+static Font    *g_ui_font   = 0;
+static Font    *g_boot_font = 0;    // loaded by the UEFI loader, if any
+static uint32_t g_ui_font_size[UI_MAX_SCALE + 1];
+
+static uint32_t ui_font_size(uint32_t scale) {
+    if (!g_ui_font) g_ui_font = font_builtin();
+    if (scale > UI_MAX_SCALE) scale = UI_MAX_SCALE;
+    if (!g_ui_font_size[scale]) {
+        g_ui_font_size[scale] = font_size_for_cap(g_ui_font, 7 * scale);
     }
-    return (*a == '\0' && *b == '\0');
+    return g_ui_font_size[scale];
 }
 
-static const char *skip_spaces(const char *p) {
-    while (*p == ' ' || *p == '\t') ++p;
-    return p;
+static void ui_set_font(Font *f) {
+    g_ui_font = f;
+    memset(g_ui_font_size, 0, sizeof(g_ui_font_size));
 }
 
-static const char *next_word(const char *p, char *out, uint32_t max_len) {
-    p = skip_spaces(p);
-    uint32_t i = 0;
-    while (*p && *p != ' ' && *p != '\t') {
-        if (i + 1 < max_len) {
-            out[i++] = *p;
-        }
-        ++p;
-    }
-    out[i] = '\0';
-    return p;
+static void draw_text_scaled(uint32_t x, uint32_t y, const char *s, uint32_t len,
+                             uint32_t color, uint32_t scale) {
+    if (!scale) return;
+    uint32_t size = ui_font_size(scale);    // also picks the default font
+    dl_text(&g_dl, (int32_t)x, (int32_t)y, s, len, g_ui_font, size,
+            8 * scale, color);
 }
 
-// ---------------------------------------------------------------------
-// Port I/O (keyboard, mouse, CMOS)
-// ---------------------------------------------------------------------
-
-static inline uint8_t inb(uint16_t port) {
-    uint8_t v;
-    __asm__ volatile("inb %1, %0" : "=a"(v) : "Nd"(port));
-    return v;
+static void draw_text(uint32_t x, uint32_t y,
+                      const char *s,
+                      uint32_t color,
+                      uint32_t scale) {
+    if (!s) return;
+    for (;;) {
+        uint32_t n = 0;
+        while (s[n] && s[n] != '\n') ++n;
+        draw_text_scaled(x, y, s, n, color, scale);
+        if (!s[n]) break;
+        s += n + 1;
+        y += 8 * scale + 2;
+    }
 }
 
-static inline void outb(uint16_t port, uint8_t val) {
-    __asm__ volatile("outb %0, %1" : : "a"(val), "Nd"(port));
+// Draws exactly len characters (no NUL needed, no newline handling).
+static void draw_text_n(uint32_t x, uint32_t y, const char *s, uint32_t len,
+                        uint32_t color) {
+    draw_text_scaled(x, y, s, len, color, 1);
 }
 
 // ---------------------------------------------------------------------
@@ -391,6 +372,7 @@ static void run_boot_splash(void) {
     uint32_t x = (g_width  - name_px) / 2;
     uint32_t y = g_height / 3;
     draw_text(x, y, name, 0xFFFFFFu, 2);
+    gfx_flush();
 
     // spinner below name
     uint32_t cx = g_width  / 2;
@@ -453,6 +435,62 @@ static void run_boot_splash(void) {
     }
 }
 
+// ---------------------------------------------------------------------
+// Frame pacing. Input is drained and applied as soon as it arrives, but
+// the screen is composited at most once per FRAME_US, so a burst of events
+// (key repeat, a wheel spin, a flood of mouse packets) collapses into one
+// frame drawn from one merged damage set.
+// ---------------------------------------------------------------------
+
+#define FRAME_HZ      60
+#define FRAME_US      (1000000u / FRAME_HZ)
+#define FRAME_BUCKETS 7         // <1, <2, <4, <8, <16, <32, >=32 ms
+#define PERF_RASTER_FRAMES 8    // repaints timed per CPU count by `perf raster`
+#define PERF_ALLOC_OBJS    1024 // 64-byte objects per CPU per round of `perf alloc`
+#define PERF_ALLOC_ROUNDS  20
+
+typedef struct {
+    uint64_t frames;
+    uint64_t events;            // input events applied
+    uint64_t merged;            // events that shared a frame with another
+    uint64_t over_budget;       // frames that took longer than FRAME_US
+    uint64_t pixels;            // written to the framebuffer
+    uint64_t hist[FRAME_BUCKETS];
+} FrameStats;
+
+static FrameStats g_frame_stats;
+static uint64_t   g_next_frame_us = 0;
+static uint32_t   g_frame_events  = 0;  // events waiting for the next frame
+
+static void frame_input_event(void) {
+    g_frame_stats.events++;
+    g_frame_events++;
+}
+
+// Composites if anything changed and the frame slot has come round.
+static void frame_tick(void) {
+    if (!wm_pending()) {
+        g_frame_events = 0;     // those events changed nothing on screen
+        return;
+    }
+    uint64_t now = time_us();
+    if (now < g_next_frame_us) return;
+
+    uint32_t pixels = wm_compose();
+    uint64_t took = time_us() - now;
+
+    g_next_frame_us = now + FRAME_US;
+    g_frame_stats.frames++;
+    g_frame_stats.pixels += pixels;
+    if (g_frame_events > 1) g_frame_stats.merged += g_frame_events - 1;
+    g_frame_events = 0;
+    if (took > FRAME_US) g_frame_stats.over_budget++;
+
+    int b = 0;
+    while (b < FRAME_BUCKETS - 1 && took >= (1000ull << b)) b++;
+    g_frame_stats.hist[b]++;
+}
+
 // ---------------------------------------------------------------------
 // Mouse state (UI-level). Hardware updated by PS/2 driver.
 // ---------------------------------------------------------------------
@@ -469,90 +507,30 @@ static MouseState g_mouse = { 80, 80, 0, 0 };
 static uint8_t g_prev_left  = 0;
 static uint8_t g_prev_right = 0;
 
-// Cursor overlay state. We draw the cursor as a small "layer" on top of the
-// framebuffer by saving the background pixels under it and restoring them
-// when the cursor moves, instead of repainting the entire desktop.
+// Mouse cursor: an arrow image handed to the compositor's cursor plane,
+// which draws it over the framebuffer and restores what it covers from the
+// back buffer.
 #define CURSOR_W 16
 #define CURSOR_H 16
 
-static uint32_t g_cursor_bg[CURSOR_W * CURSOR_H];
-static int32_t  g_cursor_prev_x = 0;
-static int32_t  g_cursor_prev_y = 0;
-static int      g_cursor_bg_valid = 0;
-
-// Invalidate any saved cursor background. Call this whenever the desktop is
-// being completely redrawn.
-static void cursor_invalidate(void) {
-    g_cursor_bg_valid = 0;
-}
-
-// Draw simple arrow cursor using an overlay technique:
-//  1) Restore the background under the old cursor (if valid).
-//  2) Capture the background under the new cursor position.
-//  3) Draw the arrow on top.
-static void draw_mouse_cursor(void) {
-    const uint32_t col_fg = 0xFFFFFFu;
-    const uint32_t col_bd = 0x000000u;
-
-    int32_t base_x = g_mouse.x;
-    int32_t base_y = g_mouse.y;
-    int32_t h      = 16;
-
-    // Step 1: restore background under previous cursor position.
-    if (g_cursor_bg_valid) {
-        for (int32_t row = 0; row < h; ++row) {
-            for (int32_t col = 0; col < h; ++col) {
-                int32_t x = g_cursor_prev_x + col;
-                int32_t y = g_cursor_prev_y + row;
-                if (x < 0 || y < 0 ||
-                    (uint32_t)x >= g_width ||
-                    (uint32_t)y >= g_height)
-                    continue;
-                uint32_t c = g_cursor_bg[row * CURSOR_W + col];
-                g_fb[(uint64_t)y * g_pitch + (uint32_t)x] = c;
-            }
-        }
-        g_cursor_bg_valid = 0;
-    }
-
-    // Clamp target position to the visible screen.
-    if (base_x < 0) base_x = 0;
-    if (base_y < 0) base_y = 0;
-    if ((uint32_t)base_x >= g_width)  base_x = (int32_t)g_width - 1;
-    if ((uint32_t)base_y >= g_height) base_y = (int32_t)g_height - 1;
-
-    // Step 2: capture background under the new cursor square.
-    for (int32_t row = 0; row < h; ++row) {
-        for (int32_t col = 0; col < h; ++col) {
-            int32_t x = base_x + col;
-            int32_t y = base_y + row;
-            uint32_t c = 0;
-            if (x >= 0 && y >= 0 &&
-                (uint32_t)x < g_width &&
-                (uint32_t)y < g_height) {
-                c = g_fb[(uint64_t)y * g_pitch + (uint32_t)x];
-            }
-            g_cursor_bg[row * CURSOR_W + col] = c;
-        }
-    }
+static uint32_t g_cursor_img[CURSOR_W * CURSOR_H];
 
-    g_cursor_prev_x   = base_x;
-    g_cursor_prev_y   = base_y;
-    g_cursor_bg_valid = 1;
+static void cursor_init(void) {
+    const uint32_t col_fg = 0xFF000000u | 0xFFFFFFu;
+    const uint32_t col_bd = 0xFF000000u | 0x000000u;
 
-    // Step 3: draw arrow on top of the newly captured background.
-    for (int32_t row = 0; row < h; ++row) {
-        for (int32_t col = 0; col <= row; ++col) {
-            int32_t x = base_x + col;
-            int32_t y = base_y + row;
-            if (x < 0 || y < 0 ||
-                (uint32_t)x >= g_width ||
-                (uint32_t)y >= g_height)
-                continue;
-            uint32_t color = (col == 0 || row == 0 || col == row) ? col_bd : col_fg;
-            g_fb[(uint64_t)y * g_pitch + (uint32_t)x] = color;
+    for (int32_t row = 0; row < CURSOR_H; ++row) {
+        for (int32_t col = 0; col < CURSOR_W; ++col) {
+            uint32_t c = 0;     // transparent
+            if (col <= row) {
+                c = (col == 0 || row == 0 || col == row) ? col_bd : col_fg;
+            }
+            g_cursor_img[row * CURSOR_W + col] = c;
         }
     }
+    wm_cursor_set(g_cursor_img, CURSOR_W, CURSOR_H);
+    wm_cursor_move(g_mouse.x, g_mouse.y);
+    wm_cursor_show(1);
 }
 
 // ---------------------------------------------------------------------
@@ -566,56 +544,202 @@ typedef struct {
     uint32_t line_count;
     char     input[TERM_MAX_COLS];
     uint32_t input_len;
+    int      hist_age;                  // history line in input, -1 = none
+    char     stash[TERM_MAX_COLS];      // what was typed before Up or Ctrl+R
+    int      searching;                 // Ctrl+R: query picks the input
+    int      search_failed;
+    char     query[TERM_MAX_COLS];
 } TerminalState;
 
 static TerminalState g_term;
 
-// Simple in-terminal editor state (for nano/micro/edit/notepad)
-// When g_editor_active is non-zero, Enter appends lines to the current file
-// instead of executing commands, until the user types :wq, :q, or exit.
-static int g_editor_active     = 0;
-static int g_editor_file_index = -1;
+// Full-screen editor (edit/nano/micro/notepad). While g_editor_active is
+// set the Command Block shows it and every key goes to it. It reads the
+// file's buffer in place (the node is marked borrowed), so g_editor_orig
+// is kept alive until it closes even if the file is saved or rewritten.
+static Editor      g_editor;
+static int         g_editor_active     = 0;
+static int         g_editor_file_index = -1;
+static const char *g_editor_orig       = 0;
+static uint32_t    g_editor_w, g_editor_h;     // window size it was fitted to
 
 // Simple RAM "filesystem"
-#define VFS_MAX_NODES   128
+//
+// Names are found through a dentry hash keyed on (parent, name), so paths
+// resolve one component per probe, and each directory keeps a list of its
+// children for listings and tab completion. Deleting or moving a node is
+// rare and renumbers the array, so those just rebuild both indexes.
+#define VFS_MAX_NODES   2048
 #define VFS_NAME_LEN    32
-#define VFS_CONTENT_LEN 512
+#define VFS_FILE_MAX    (16u << 20)     // bytes in one file
+#define VFS_HASH_SIZE   4096            // power of two, twice the nodes
 
 typedef enum {
     VFS_DIR,
-    VFS_FILE
+    VFS_FILE,
+    VFS_DEV                           // a disk, read through its page cache
 } VfsType;
 
 typedef struct {
     VfsType type;
     int     parent;                   // index of parent, -1 for root
+    int     first_child;              // directories: -1 when empty
+    int     next_sibling;
     char    name[VFS_NAME_LEN];
-    char    content[VFS_CONTENT_LEN]; // for files
+    char    *data;                    // files: NUL-terminated, 0 when empty
+    uint32_t size, cap;
+    uint8_t  borrowed;                // the editor reads data: never free it
+    PcFile  *cache;                   // files: pages mmap() hands out; disks: theirs
 } VfsNode;
 
 static VfsNode g_vfs[VFS_MAX_NODES];
 static int     g_vfs_count = 0;
 static int     g_cwd       = 0; // current directory index
 
+static uint16_t g_dentry[VFS_HASH_SIZE];       // node index + 1, 0 = empty
+static uint64_t g_dentry_lookups = 0;
+static uint64_t g_dentry_probes  = 0;
+
+static uint32_t dentry_hash(int parent, const char *name) {
+    uint32_t h = 2166136261u ^ (uint32_t)parent;    // FNV-1a, seeded
+    while (*name) {
+        h ^= (uint8_t)*name++;
+        h *= 16777619u;
+    }
+    return h & (VFS_HASH_SIZE - 1);
+}
+
+static void dentry_insert(int idx) {
+    uint32_t i = dentry_hash(g_vfs[idx].parent, g_vfs[idx].name);
+    while (g_dentry[i]) i = (i + 1) & (VFS_HASH_SIZE - 1);
+    g_dentry[i] = (uint16_t)(idx + 1);
+}
+
+static void vfs_link(int idx) {
+    int parent = g_vfs[idx].parent;
+    g_vfs[idx].first_child  = -1;
+    g_vfs[idx].next_sibling = -1;
+    if (parent >= 0) {
+        g_vfs[idx].next_sibling    = g_vfs[parent].first_child;
+        g_vfs[parent].first_child  = idx;
+        dentry_insert(idx);
+    }
+}
+
+static void vfs_reindex(void) {
+    memset(g_dentry, 0, sizeof(g_dentry));
+    for (int i = 0; i < g_vfs_count; ++i) g_vfs[i].first_child = -1;
+    for (int i = 0; i < g_vfs_count; ++i) vfs_link(i);
+}
+
 static int vfs_add_node(VfsType type, int parent, const char *name) {
     if (g_vfs_count >= VFS_MAX_NODES) return -1;
     int idx = g_vfs_count++;
+    memset(&g_vfs[idx], 0, sizeof(g_vfs[idx]));
     g_vfs[idx].type   = type;
     g_vfs[idx].parent = parent;
     str_copy(g_vfs[idx].name, name ? name : "", VFS_NAME_LEN);
-    if (type == VFS_FILE) {
-        g_vfs[idx].content[0] = '\0';
-    }
+    vfs_link(idx);
     return idx;
 }
 
+// File contents live on the heap, grown by doubling. A borrowed buffer is
+// left alone (the editor frees it when it is done) and replaced by a copy.
+static const char *vfs_text(const VfsNode *n) {
+    return n->data ? n->data : "";
+}
+
+// Pages of a file that processes map come from the page cache, filled
+// from data the first time one is asked for and shared by all of them
+// from then on. Any change to the file drops them: mappings keep the old
+// page, new ones get a fresh copy.
+static int vfs_cache_read(void *ctx, uint64_t index, void *const *pages, uint32_t count) {
+    VfsNode *n = (VfsNode*)ctx;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint64_t pos = (index + i) * PAGE_SIZE;
+        uint32_t len = 0;
+        if (pos < n->size) len = n->size - pos < PAGE_SIZE ? n->size - (uint32_t)pos : PAGE_SIZE;
+        if (len) memcpy(pages[i], n->data + pos, len);
+        memset((uint8_t*)pages[i] + len, 0, PAGE_SIZE - len);
+    }
+    return 0;
+}
+
+static const PcOps g_vfs_cache_ops = { vfs_cache_read, 0 };
+
+static void vfs_file_changed(VfsNode *n) {
+    if (n->cache) pc_invalidate(n->cache);
+}
+
+// With a reference for the caller; 0 past the end or when out of memory.
+static void *vfs_file_page(VfsNode *n, uint64_t index) {
+    if (!n->cache) {
+        n->cache = (PcFile*)kmalloc(sizeof(PcFile));
+        if (!n->cache) return 0;
+        pc_file_init(n->cache, &g_vfs_cache_ops, n, n->size);
+    }
+    n->cache->size = n->size;
+    return pc_page(n->cache, index);
+}
+
+static void vfs_file_clear(VfsNode *n) {
+    vfs_file_changed(n);
+    if (!n->borrowed) kfree(n->data);
+    n->data     = 0;
+    n->size     = 0;
+    n->cap      = 0;
+    n->borrowed = 0;
+}
+
+// Room for size bytes and the NUL.
+static int vfs_file_reserve(VfsNode *n, uint32_t size) {
+    if (size > VFS_FILE_MAX) return -1;
+    if (n->data && !n->borrowed && size < n->cap) return 0;
+    uint32_t cap = 64;
+    while (cap <= size) cap *= 2;
+    if (cap > VFS_FILE_MAX + 1) cap = VFS_FILE_MAX + 1;
+    char *p = kmalloc(cap);
+    if (!p) return -1;
+    if (n->size) memcpy(p, n->data, n->size);
+    p[n->size] = '\0';
+    if (!n->borrowed) kfree(n->data);
+    n->data     = p;
+    n->cap      = cap;
+    n->borrowed = 0;
+    return 0;
+}
+
+// Returns how many bytes were stored: fewer at the size limit or when out
+// of memory.
+static uint32_t vfs_file_append(VfsNode *n, const char *data, uint32_t len) {
+    if (len > VFS_FILE_MAX - n->size) len = VFS_FILE_MAX - n->size;
+    if (!len || vfs_file_reserve(n, n->size + len) < 0) return 0;
+    vfs_file_changed(n);
+    memcpy(n->data + n->size, data, len);
+    n->size += len;
+    n->data[n->size] = '\0';
+    return len;
+}
+
+// Takes over buf, which holds size bytes and a NUL.
+static void vfs_file_set(VfsNode *n, char *buf, uint32_t size) {
+    vfs_file_clear(n);
+    n->data = buf;
+    n->size = size;
+    n->cap  = size + 1;
+}
+
 static int vfs_find_child(int parent, const char *name) {
     if (!name) return -1;
-    for (int i = 0; i < g_vfs_count; ++i) {
-        if (g_vfs[i].parent == parent &&
-            str_eq(g_vfs[i].name, name)) {
-            return i;
+    g_dentry_lookups++;
+    uint32_t i = dentry_hash(parent, name);
+    while (g_dentry[i]) {
+        g_dentry_probes++;
+        int idx = g_dentry[i] - 1;
+        if (g_vfs[idx].parent == parent && str_eq(g_vfs[idx].name, name)) {
+            return idx;
         }
+        i = (i + 1) & (VFS_HASH_SIZE - 1);
     }
     return -1;
 }
@@ -623,16 +747,24 @@ static int vfs_find_child(int parent, const char *name) {
 static int vfs_is_empty_dir(int idx) {
     if (idx < 0 || idx >= g_vfs_count) return 0;
     if (g_vfs[idx].type != VFS_DIR) return 0;
-    for (int i = 0; i < g_vfs_count; ++i) {
-        if (g_vfs[i].parent == idx) return 0;
-    }
-    return 1;
+    return g_vfs[idx].first_child < 0;
 }
 
 static void vfs_delete_node(int idx) {
     if (idx <= 0 || idx >= g_vfs_count) return; // don't delete root
+    if (g_vfs[idx].type == VFS_FILE) {
+        vfs_file_clear(&g_vfs[idx]);
+        if (g_vfs[idx].cache) {
+            pc_file_release(g_vfs[idx].cache);
+            kfree(g_vfs[idx].cache);
+        }
+    }
     for (int i = idx + 1; i < g_vfs_count; ++i) {
         g_vfs[i - 1] = g_vfs[i];
+        // A file's cache reads it from where it is now.
+        if (g_vfs[i - 1].type == VFS_FILE && g_vfs[i - 1].cache) {
+            g_vfs[i - 1].cache->ctx = &g_vfs[i - 1];
+        }
     }
     g_vfs_count--;
 
@@ -645,6 +777,9 @@ static void vfs_delete_node(int idx) {
     }
     if (g_cwd == idx) g_cwd = 0;
     if (g_cwd > idx)  g_cwd--;
+    if (g_editor_file_index == idx) g_editor_file_index = -1;
+    if (g_editor_file_index > idx)  g_editor_file_index--;
+    vfs_reindex();
 }
 
 static void vfs_init(void) {
@@ -657,19 +792,36 @@ static void vfs_init(void) {
 
     int readme = vfs_add_node(VFS_FILE, docs, "readme.txt");
     if (readme >= 0) {
-        str_copy(g_vfs[readme].content,
-                 "Welcome to LightOS 4.\n"
-                 "This is a RAM filesystem demo.\n"
-                 "Use 'dir', 'cd', 'mkdir', 'touch', 'type', etc.\n",
-                 VFS_CONTENT_LEN);
+        const char *text = "Welcome to LightOS 4.\n"
+                           "This is a RAM filesystem demo.\n"
+                           "Use 'dir', 'cd', 'mkdir', 'touch', 'type', etc.\n";
+        vfs_file_append(&g_vfs[readme], text, str_len(text));
     }
 
     int conf = vfs_add_node(VFS_FILE, etc, "system.conf");
     if (conf >= 0) {
-        str_copy(g_vfs[conf].content,
-                 "# LightOS 4 config\n"
-                 "theme=light\n",
-                 VFS_CONTENT_LEN);
+        const char *text = "# LightOS 4 config\n"
+                           "theme=light\n";
+        vfs_file_append(&g_vfs[conf], text, str_len(text));
+    }
+
+    // The user programs linked into the kernel, for `run`.
+    int bin = vfs_add_node(VFS_DIR, 0, "bin");
+    int count;
+    const UserBinary *bins = user_binaries(&count);
+    for (int i = 0; i < count && bin >= 0; ++i) {
+        int f = vfs_add_node(VFS_FILE, bin, bins[i].name);
+        if (f >= 0) vfs_file_append(&g_vfs[f], (const char*)bins[i].data, bins[i].size);
+    }
+
+    // Disks, whole, up to what a file size can say.
+    int dev = blkdev_count() ? vfs_add_node(VFS_DIR, 0, "dev") : -1;
+    for (int i = 0; i < blkdev_count() && dev >= 0; ++i) {
+        BlockDevice *bd = blkdev_get(i);
+        int d = vfs_add_node(VFS_DEV, dev, bd->name);
+        if (d < 0) break;
+        g_vfs[d].cache = &bd->cache;
+        g_vfs[d].size  = bd->cache.size < 0xFFFFF000u ? (uint32_t)bd->cache.size : 0xFFFFF000u;
     }
 
     g_cwd = 0;
@@ -703,26 +855,28 @@ static void vfs_build_path(char *buf, uint32_t max_len, int node_index) {
 
 static void term_add_line(TerminalState *t, const char *text);
 
-static void vfs_list_dir_to_terminal(TerminalState *t, int dir_index) {
+static void vfs_list_dir(Shell *sh, int dir_index) {
     char line[TERM_MAX_COLS];
     char path[64];
     vfs_build_path(path, sizeof(path), dir_index);
 
     str_copy(line, " Directory of ", TERM_MAX_COLS);
     str_cat(line, path, TERM_MAX_COLS);
-    term_add_line(t, line);
-    term_add_line(t, "");
+    shell_print(sh, line);
+    shell_print(sh, "");
 
     for (int i = 0; i < g_vfs_count; ++i) {
         if (g_vfs[i].parent != dir_index) continue;
         char entry[TERM_MAX_COLS];
         if (g_vfs[i].type == VFS_DIR) {
             str_copy(entry, "<DIR>  ", TERM_MAX_COLS);
+        } else if (g_vfs[i].type == VFS_DEV) {
+            str_copy(entry, "<DEV>  ", TERM_MAX_COLS);
         } else {
             str_copy(entry, "       ", TERM_MAX_COLS);
         }
         str_cat(entry, g_vfs[i].name, TERM_MAX_COLS);
-        term_add_line(t, entry);
+        shell_print(sh, entry);
     }
 }
 
@@ -731,6 +885,8 @@ static void term_reset(TerminalState *t) {
     t->line_count = 0;
     t->input_len  = 0;
     t->input[0]   = '\0';
+    t->hist_age   = -1;
+    t->searching  = 0;
 
     term_add_line(t, "LightOS 4 Command Block");
     term_add_line(t, "Type 'help' for commands.");
@@ -749,45 +905,62 @@ static void term_add_line(TerminalState *t, const char *text) {
     t->line_count++;
 }
 
-static int vfs_resolve_simple(const char *name, int expect_dir, int *out_parent) {
-    if (!name || !*name) {
-        if (out_parent) *out_parent = g_cwd;
-        return g_cwd;
+// Resolves path one component at a time. "C:\\", "\\" or "/" at the start
+// means the root, anything else starts at g_cwd; "." and ".." work
+// anywhere. With leaf set, the last component is not looked up but copied
+// there and its directory returned. Returns -1 if a directory on the way
+// doesn't exist.
+static int vfs_walk(const char *path, char *leaf) {
+    const char *p = path ? path : "";
+    int cur = g_cwd;
+    if ((p[0] == 'C' || p[0] == 'c') && p[1] == ':') {
+        p  += 2;
+        cur = 0;
     }
+    if (*p == '\\' || *p == '/') cur = 0;
 
-    if ((name[0] == 'C' || name[0] == 'c') && name[1] == ':' &&
-        (name[2] == '\\' || name[2] == '/')) {
-        name += 3;
-        g_cwd = 0;
-    }
+    for (;;) {
+        while (*p == '\\' || *p == '/') ++p;
+        const char *start = p;
+        while (*p && *p != '\\' && *p != '/') ++p;
+        uint32_t len = (uint32_t)(p - start);
 
-    if (str_eq(name, "/") || str_eq(name, "\\")) {
-        if (out_parent) *out_parent = 0;
-        return 0;
-    }
-    if (str_eq(name, ".")) {
-        if (out_parent) *out_parent = g_cwd;
-        return g_cwd;
-    }
-    if (str_eq(name, "..")) {
-        int parent = g_vfs[g_cwd].parent;
-        if (parent < 0) parent = 0;
-        if (out_parent) *out_parent = parent;
-        return parent;
-    }
+        const char *rest = p;
+        while (*rest == '\\' || *rest == '/') ++rest;
+        int last = !*rest;
 
-    int parent = g_cwd;
-    int child  = vfs_find_child(parent, name);
-    if (child < 0) {
-        if (out_parent) *out_parent = parent;
-        return -1;
-    }
-    if (expect_dir && g_vfs[child].type != VFS_DIR) {
-        if (out_parent) *out_parent = parent;
-        return -1;
+        if (len >= VFS_NAME_LEN) return -1;
+        char name[VFS_NAME_LEN];
+        memcpy(name, start, len);
+        name[len] = '\0';
+
+        if (g_vfs[cur].type != VFS_DIR) return -1;
+        if (leaf && last) {
+            str_copy(leaf, name, VFS_NAME_LEN);
+            return cur;
+        }
+        if (!len) return cur;
+
+        if (str_eq(name, "..")) {
+            if (g_vfs[cur].parent >= 0) cur = g_vfs[cur].parent;
+        } else if (!str_eq(name, ".")) {
+            cur = vfs_find_child(cur, name);
+            if (cur < 0) return -1;
+        }
+        if (last) return cur;
     }
-    if (out_parent) *out_parent = parent;
-    return child;
+}
+
+static int vfs_lookup(const char *path) {
+    return vfs_walk(path, 0);
+}
+
+// For creating path: its directory, and in name the new entry's name.
+// Returns -1 if the directory doesn't exist or the name can't be used.
+static int vfs_lookup_parent(const char *path, char *name) {
+    int dir = vfs_walk(path, name);
+    if (dir < 0 || !name[0] || str_eq(name, ".") || str_eq(name, "..")) return -1;
+    return dir;
 }
 
 static void term_print_prompt_path(char *buf, uint32_t max_len) {
@@ -797,430 +970,1396 @@ static void term_print_prompt_path(char *buf, uint32_t max_len) {
     str_cat(buf, ">", max_len);
 }
 
+// What goes before the input line: the path, or the Ctrl+R query.
+static void term_print_prompt(const TerminalState *t, char *buf, uint32_t max_len) {
+    if (!t->searching) {
+        term_print_prompt_path(buf, max_len);
+        str_cat(buf, " ", max_len);
+        return;
+    }
+    str_copy(buf, t->search_failed ? "(failing reverse-i-search)'" : "(reverse-i-search)'",
+             max_len);
+    str_cat(buf, t->query, max_len);
+    str_cat(buf, "': ", max_len);
+}
+
 // ---------------------------------------------------------------------
 // Command execution (Windows + Linux style commands)
 // ---------------------------------------------------------------------
 
-static void term_execute_command(TerminalState *t, const char *cmd) {
-    if (!cmd || !*cmd) return;
-
-    cmd = skip_spaces(cmd);
-    if (!*cmd) return;
-
-    char word[32];
-    const char *rest = next_word(cmd, word, sizeof(word));
-
-    // help / ?
-    if (str_eq(word, "help") || str_eq(word, "?")) {
-        term_add_line(t, "Commands:");
-        term_add_line(t, "  cls / clear");
-        term_add_line(t, "  dir / ls");
-        term_add_line(t, "  cd / chdir [dir]");
-        term_add_line(t, "  mkdir / md <name>");
-        term_add_line(t, "  rmdir / rd <name>");
-        term_add_line(t, "  touch / create / mkfile <name>");
-        term_add_line(t, "  del / erase / rm <name>");
-        term_add_line(t, "  type / cat <file>");
-        term_add_line(t, "  edit / nano / micro / notepad <file>");
-        term_add_line(t, "  copy / cp <src> <dst>");
-        term_add_line(t, "  move / mv <src> <dst>");
-        term_add_line(t, "  pwd");
-        term_add_line(t, "  ver / uname");
-        term_add_line(t, "  time / date");
-        term_add_line(t, "  echo <text>");
+static void desktop_refresh(void);
+static int  display_set_mode(uint32_t width, uint32_t height);
+
+// cls / clear
+static void cmd_cls(Shell *sh, int argc, char **argv) {
+    (void)sh; (void)argc; (void)argv;
+    term_reset(&g_term);
+}
+
+// dir / ls
+static void cmd_dir(Shell *sh, int argc, char **argv) {
+    int dir = vfs_lookup(argc > 1 ? argv[1] : "");
+    if (dir < 0 || g_vfs[dir].type != VFS_DIR) {
+        shell_print(sh, "dir: directory not found.");
         return;
     }
+    vfs_list_dir(sh, dir);
+}
 
-    // cls / clear
-    if (str_eq(word, "cls") || str_eq(word, "clear")) {
-        term_reset(t);
+// cd / chdir
+static void cmd_cd(Shell *sh, int argc, char **argv) {
+    const char *arg = argc > 1 ? argv[1] : "";
+    if (!arg[0]) {
+        char path[64];
+        vfs_build_path(path, sizeof(path), g_cwd);
+        shell_print(sh, path);
         return;
     }
-
-    // dir / ls
-    if (str_eq(word, "dir") || str_eq(word, "ls")) {
-        vfs_list_dir_to_terminal(t, g_cwd);
+    int newdir = vfs_lookup(arg);
+    if (newdir < 0 || g_vfs[newdir].type != VFS_DIR) {
+        char msg[TERM_MAX_COLS];
+        str_copy(msg, "The system cannot find the path specified: ", TERM_MAX_COLS);
+        str_cat(msg, arg, TERM_MAX_COLS);
+        shell_print(sh, msg);
         return;
     }
+    g_cwd = newdir;
+}
 
-    // cd / chdir
-    if (str_eq(word, "cd") || str_eq(word, "chdir")) {
-        char arg[64];
-        rest = next_word(rest, arg, sizeof(arg));
-        if (!arg[0]) {
-            char path[64];
-            vfs_build_path(path, sizeof(path), g_cwd);
-            term_add_line(t, path);
-            return;
-        }
-        int parent = 0;
-        int newdir = vfs_resolve_simple(arg, 1, &parent);
-        if (newdir < 0) {
-            char msg[TERM_MAX_COLS];
-            str_copy(msg, "The system cannot find the path specified: ", TERM_MAX_COLS);
-            str_cat(msg, arg, TERM_MAX_COLS);
-            term_add_line(t, msg);
-            return;
-        }
-        g_cwd = newdir;
+// mkdir / md
+static void cmd_mkdir(Shell *sh, int argc, char **argv) {
+    const char *name = argc > 1 ? argv[1] : "";
+    if (!name[0]) {
+        shell_print(sh, "mkdir: missing directory name.");
         return;
     }
-
-    // mkdir / md
-    if (str_eq(word, "mkdir") || str_eq(word, "md")) {
-        char name[64];
-        rest = next_word(rest, name, sizeof(name));
-        if (!name[0]) {
-            term_add_line(t, "mkdir: missing directory name.");
-            return;
-        }
-        if (vfs_find_child(g_cwd, name) >= 0) {
-            term_add_line(t, "mkdir: already exists.");
-            return;
-        }
-        if (vfs_add_node(VFS_DIR, g_cwd, name) < 0) {
-            term_add_line(t, "mkdir: no space left in VFS.");
-        }
+    char leaf[VFS_NAME_LEN];
+    int parent = vfs_lookup_parent(name, leaf);
+    if (parent < 0) {
+        shell_print(sh, "mkdir: path not found.");
         return;
     }
-
-    // rmdir / rd
-    if (str_eq(word, "rmdir") || str_eq(word, "rd")) {
-        char name[64];
-        rest = next_word(rest, name, sizeof(name));
-        if (!name[0]) {
-            term_add_line(t, "rmdir: missing directory name.");
-            return;
-        }
-        int idx = vfs_find_child(g_cwd, name);
-        if (idx < 0 || g_vfs[idx].type != VFS_DIR) {
-            term_add_line(t, "rmdir: not a directory or not found.");
-            return;
-        }
-        if (!vfs_is_empty_dir(idx)) {
-            term_add_line(t, "rmdir: directory not empty.");
-            return;
-        }
-        vfs_delete_node(idx);
+    if (vfs_find_child(parent, leaf) >= 0) {
+        shell_print(sh, "mkdir: already exists.");
         return;
     }
+    if (vfs_add_node(VFS_DIR, parent, leaf) < 0) {
+        shell_print(sh, "mkdir: no space left in VFS.");
+    }
+}
 
-    // touch / create / mkfile
-    if (str_eq(word, "touch") || str_eq(word, "create") || str_eq(word, "mkfile")) {
-        char name[64];
-        rest = next_word(rest, name, sizeof(name));
-        if (!name[0]) {
-            term_add_line(t, "touch: missing file name.");
-            return;
-        }
-        int idx = vfs_find_child(g_cwd, name);
-        if (idx >= 0) {
-            if (g_vfs[idx].type == VFS_DIR) {
-                term_add_line(t, "touch: name is a directory.");
-            }
-            return;
-        }
-        idx = vfs_add_node(VFS_FILE, g_cwd, name);
-        if (idx < 0) {
-            term_add_line(t, "touch: no space left in VFS.");
-            return;
-        }
-        g_vfs[idx].content[0] = '\0';
+// rmdir / rd
+static void cmd_rmdir(Shell *sh, int argc, char **argv) {
+    const char *name = argc > 1 ? argv[1] : "";
+    if (!name[0]) {
+        shell_print(sh, "rmdir: missing directory name.");
         return;
     }
-
-    // del / erase / rm
-    if (str_eq(word, "del") || str_eq(word, "erase") || str_eq(word, "rm")) {
-        char name[64];
-        rest = next_word(rest, name, sizeof(name));
-        if (!name[0]) {
-            term_add_line(t, "del: missing file name.");
-            return;
-        }
-        int idx = vfs_find_child(g_cwd, name);
-        if (idx < 0 || g_vfs[idx].type != VFS_FILE) {
-            term_add_line(t, "del: file not found.");
-            return;
-        }
-        vfs_delete_node(idx);
+    int idx = vfs_lookup(name);
+    if (idx < 0 || g_vfs[idx].type != VFS_DIR) {
+        shell_print(sh, "rmdir: not a directory or not found.");
         return;
     }
-
-    // type / cat
-    if (str_eq(word, "type") || str_eq(word, "cat")) {
-        char name[64];
-        rest = next_word(rest, name, sizeof(name));
-        if (!name[0]) {
-            term_add_line(t, "type: missing file name.");
-            return;
-        }
-        int idx = vfs_find_child(g_cwd, name);
-        if (idx < 0 || g_vfs[idx].type != VFS_FILE) {
-            term_add_line(t, "type: file not found.");
-            return;
-        }
-        if (!g_vfs[idx].content[0]) {
-            term_add_line(t, "(empty file)");
-        } else {
-            char buf[VFS_CONTENT_LEN];
-            str_copy(buf, g_vfs[idx].content, sizeof(buf));
-            char *p = buf;
-            while (*p) {
-                char *line = p;
-                while (*p && *p != '\n') ++p;
-                char saved = *p;
-                *p = '\0';
-                term_add_line(t, line);
-                if (saved == '\n') {
-                    *p = saved;
-                    ++p;
-                }
-            }
-        }
+    if (!vfs_is_empty_dir(idx)) {
+        shell_print(sh, "rmdir: directory not empty.");
         return;
     }
+    vfs_delete_node(idx);
+}
 
-
-    // edit / nano / micro / notepad
-    if (str_eq(word, "edit") || str_eq(word, "nano") ||
-        str_eq(word, "micro") || str_eq(word, "notepad")) {
-        char name[64];
-        rest = next_word(rest, name, sizeof(name));
-        if (!name[0]) {
-            term_add_line(t, "edit: usage: edit <file>");
-            return;
-        }
-
-        int idx = vfs_find_child(g_cwd, name);
-        if (idx < 0) {
-            idx = vfs_add_node(VFS_FILE, g_cwd, name);
-            if (idx < 0) {
-                term_add_line(t, "edit: no space left in VFS.");
-                return;
-            }
-            g_vfs[idx].content[0] = '\0';
-        } else if (g_vfs[idx].type != VFS_FILE) {
-            term_add_line(t, "edit: target is not a file.");
-            return;
-        }
-
-        g_editor_active     = 1;
-        g_editor_file_index = idx;
-
-        char header[TERM_MAX_COLS];
-        str_copy(header, "[editor] Editing ", TERM_MAX_COLS);
-        str_cat(header, name, TERM_MAX_COLS);
-        term_add_line(t, header);
-        term_add_line(t, "[editor] Type text, Enter = new line.");
-        term_add_line(t, "[editor] Type :wq, :q, or exit on a line by itself to quit.");
-        term_add_line(t, "[editor] Current contents:");
-
-        if (!g_vfs[idx].content[0]) {
-            term_add_line(t, "(empty file)");
-        } else {
-            char buf[VFS_CONTENT_LEN];
-            str_copy(buf, g_vfs[idx].content, sizeof(buf));
-            char *p = buf;
-            while (*p) {
-                char *linep = p;
-                while (*p && *p != '\n') ++p;
-                char saved = *p;
-                *p = '\0';
-                term_add_line(t, linep);
-                if (saved == '\n') {
-                    *p = saved;
-                    ++p;
-                }
-            }
-        }
-
-        term_add_line(t, "[editor] --- begin editing ---");
+// touch / create / mkfile
+static void cmd_touch(Shell *sh, int argc, char **argv) {
+    const char *name = argc > 1 ? argv[1] : "";
+    if (!name[0]) {
+        shell_print(sh, "touch: missing file name.");
         return;
     }
-
-    // copy / cp
-    if (str_eq(word, "copy") || str_eq(word, "cp")) {
-        char src[64], dst[64];
-        rest = next_word(rest, src, sizeof(src));
-        rest = next_word(rest, dst, sizeof(dst));
-        if (!src[0] || !dst[0]) {
-            term_add_line(t, "copy: usage: copy <src> <dst>");
-            return;
-        }
-        int sidx = vfs_find_child(g_cwd, src);
-        if (sidx < 0 || g_vfs[sidx].type != VFS_FILE) {
-            term_add_line(t, "copy: src file not found.");
-            return;
-        }
-        int didx = vfs_find_child(g_cwd, dst);
-        if (didx >= 0 && g_vfs[didx].type == VFS_DIR) {
-            term_add_line(t, "copy: dst is directory (not supported).");
-            return;
-        }
-        if (didx < 0) {
-            didx = vfs_add_node(VFS_FILE, g_cwd, dst);
-            if (didx < 0) {
-                term_add_line(t, "copy: no space left in VFS.");
-                return;
-            }
-        }
-        str_copy(g_vfs[didx].content, g_vfs[sidx].content, VFS_CONTENT_LEN);
+    char leaf[VFS_NAME_LEN];
+    int parent = vfs_lookup_parent(name, leaf);
+    if (parent < 0) {
+        shell_print(sh, "touch: path not found.");
         return;
     }
-
-    // move / mv
-    if (str_eq(word, "move") || str_eq(word, "mv")) {
-        char src[64], dst[64];
-        rest = next_word(rest, src, sizeof(src));
-        rest = next_word(rest, dst, sizeof(dst));
-        if (!src[0] || !dst[0]) {
-            term_add_line(t, "move: usage: move <src> <dst>");
-            return;
-        }
-        int sidx = vfs_find_child(g_cwd, src);
-        if (sidx < 0) {
-            term_add_line(t, "move: src not found.");
-            return;
+    int idx = vfs_find_child(parent, leaf);
+    if (idx >= 0) {
+        if (g_vfs[idx].type == VFS_DIR) {
+            shell_print(sh, "touch: name is a directory.");
         }
-        str_copy(g_vfs[sidx].name, dst, VFS_NAME_LEN);
         return;
     }
+    idx = vfs_add_node(VFS_FILE, parent, leaf);
+    if (idx < 0) {
+        shell_print(sh, "touch: no space left in VFS.");
+    }
+}
 
-    // pwd
-    if (str_eq(word, "pwd")) {
-        char path[64];
-        vfs_build_path(path, sizeof(path), g_cwd);
-        term_add_line(t, path);
+// del / erase / rm
+static void cmd_del(Shell *sh, int argc, char **argv) {
+    const char *name = argc > 1 ? argv[1] : "";
+    if (!name[0]) {
+        shell_print(sh, "del: missing file name.");
         return;
     }
-
-    // ver / uname
-    if (str_eq(word, "ver") || str_eq(word, "uname")) {
-        term_add_line(t, "LightOS 4 demo kernel (x86_64, UEFI framebuffer).");
+    int idx = vfs_lookup(name);
+    if (idx < 0 || g_vfs[idx].type != VFS_FILE) {
+        shell_print(sh, "del: file not found.");
         return;
     }
-
-    // time / date
-    if (str_eq(word, "time") || str_eq(word, "date")) {
-        char tbuf[16], dbuf[16], buf[32];
-        format_time(tbuf, sizeof(tbuf));
-        format_date(dbuf, sizeof(dbuf));
-        str_copy(buf, dbuf, sizeof(buf));
-        str_cat(buf, " ", sizeof(buf));
-        str_cat(buf, tbuf, sizeof(buf));
-        term_add_line(t, buf);
+    if (g_editor_active && idx == g_editor_file_index) {
+        shell_print(sh, "del: file is open in the editor.");
         return;
     }
+    vfs_delete_node(idx);
+}
 
-    // echo
-    if (str_eq(word, "echo")) {
-        rest = skip_spaces(rest);
-        term_add_line(t, rest);
-        return;
+// A disk through its page cache, a chunk at a time; the second time it
+// comes from memory.
+static void type_device(Shell *sh, PcFile *cache) {
+    char     line[SHELL_LINE_MAX];
+    char     chunk[512];
+    uint32_t n   = 0;
+    uint64_t pos = 0;
+    int      got = 0;
+    while (!shell_cancelled(sh) && (got = pc_read(cache, pos, chunk, sizeof(chunk))) > 0) {
+        for (int i = 0; i < got; ++i) {
+            if (chunk[i] != '\n' && n < sizeof(line) - 1) {
+                line[n++] = chunk[i] ? chunk[i] : ' ';
+                continue;
+            }
+            line[n] = '\0';
+            shell_print(sh, line);
+            n = 0;
+            if (chunk[i] != '\n') line[n++] = chunk[i] ? chunk[i] : ' ';
+        }
+        pos += (uint32_t)got;
+    }
+    if (got < 0) shell_print(sh, "type: read error.");
+    if (n) {
+        line[n] = '\0';
+        shell_print(sh, line);
     }
+}
 
-        // ipconfig / ifconfig (network stub)
-    if (str_eq(word, "ipconfig") || str_eq(word, "ifconfig")) {
-        term_add_line(t, "Network stack not implemented yet.");
-        term_add_line(t, "Once a NIC driver + TCP/IP stack exist,");
-        term_add_line(t, "ipconfig/ifconfig will show interface details.");
+// type / cat
+static void cmd_type(Shell *sh, int argc, char **argv) {
+    const char *name = argc > 1 ? argv[1] : "";
+    if (!name[0]) {
+        shell_print(sh, "type: missing file name.");
         return;
     }
-
-    // ping (network stub)
-    if (str_eq(word, "ping")) {
-        term_add_line(t, "ping: no network stack yet (no TCP/IP).");
+    int idx = vfs_lookup(name);
+    if (idx >= 0 && g_vfs[idx].type == VFS_DEV) {
+        type_device(sh, g_vfs[idx].cache);
         return;
     }
-
-// Unknown
-    {
-        char msg[TERM_MAX_COLS];
-        str_copy(msg, "Unknown command: ", TERM_MAX_COLS);
-        str_cat(msg, word, TERM_MAX_COLS);
-        str_cat(msg, " (type 'help')", TERM_MAX_COLS);
-        term_add_line(t, msg);
+    if (idx < 0 || g_vfs[idx].type != VFS_FILE) {
+        shell_print(sh, "type: file not found.");
+        return;
+    }
+    if (!g_vfs[idx].size) {
+        shell_print(sh, "(empty file)");
+        return;
+    }
+    // By offset: printing yields, and a writer may move the buffer meanwhile.
+    char line[SHELL_LINE_MAX];
+    uint32_t pos = 0;
+    while (pos < g_vfs[idx].size && !shell_cancelled(sh)) {
+        const char *text = g_vfs[idx].data;
+        uint32_t n = 0;
+        while (pos + n < g_vfs[idx].size && text[pos + n] != '\n' && n < sizeof(line) - 1) {
+            line[n] = text[pos + n];
+            n++;
+        }
+        line[n] = '\0';
+        pos += n;
+        if (pos < g_vfs[idx].size && text[pos] == '\n') pos++;
+        shell_print(sh, line);
+    }
+}
+
+// edit / nano / micro / notepad
+static void cmd_edit(Shell *sh, int argc, char **argv) {
+    const char *name = argc > 1 ? argv[1] : "";
+    if (!name[0]) {
+        shell_print(sh, "edit: usage: edit <file>");
+        return;
+    }
+    if (g_editor_active) {
+        shell_print(sh, "edit: the editor is already open.");
+        return;
+    }
+
+    int idx = vfs_lookup(name);
+    if (idx < 0) {
+        char leaf[VFS_NAME_LEN];
+        int parent = vfs_lookup_parent(name, leaf);
+        if (parent < 0) {
+            shell_print(sh, "edit: path not found.");
+            return;
+        }
+        idx = vfs_add_node(VFS_FILE, parent, leaf);
+        if (idx < 0) {
+            shell_print(sh, "edit: no space left in VFS.");
+            return;
+        }
+    } else if (g_vfs[idx].type != VFS_FILE) {
+        shell_print(sh, "edit: target is not a file.");
+        return;
+    }
+
+    // The editor reads the file where it is; nothing is copied.
+    VfsNode *node = &g_vfs[idx];
+    if (editor_open(&g_editor, node->name, vfs_text(node), node->size) < 0) {
+        shell_print(sh, "edit: out of memory.");
+        return;
+    }
+    node->borrowed      = node->data != 0;
+    g_editor_orig       = node->data;
+    g_editor_file_index = idx;
+    g_editor_w          = 0;            // fitted to the window when drawn
+    g_editor_h          = 0;
+    g_editor_active     = 1;
+}
+
+// copy / cp
+static void cmd_copy(Shell *sh, int argc, char **argv) {
+    const char *src = argc > 1 ? argv[1] : "";
+    const char *dst = argc > 2 ? argv[2] : "";
+    if (!src[0] || !dst[0]) {
+        shell_print(sh, "copy: usage: copy <src> <dst>");
+        return;
+    }
+    int sidx = vfs_lookup(src);
+    if (sidx < 0 || g_vfs[sidx].type != VFS_FILE) {
+        shell_print(sh, "copy: src file not found.");
+        return;
+    }
+    // Into a directory: same name there.
+    char leaf[VFS_NAME_LEN];
+    int parent = -1;
+    int didx = vfs_lookup(dst);
+    if (didx >= 0 && g_vfs[didx].type == VFS_DIR) {
+        parent = didx;
+        str_copy(leaf, g_vfs[sidx].name, sizeof(leaf));
+        didx = vfs_find_child(parent, leaf);
+        if (didx >= 0 && g_vfs[didx].type == VFS_DIR) {
+            shell_print(sh, "copy: dst is a directory.");
+            return;
+        }
+    } else if (didx < 0) {
+        parent = vfs_lookup_parent(dst, leaf);
+        if (parent < 0) {
+            shell_print(sh, "copy: dst path not found.");
+            return;
+        }
+    }
+    if (didx == sidx) return;
+    if (didx >= 0 && g_vfs[didx].type != VFS_FILE) {
+        // A disk, say: its node's data is not what is on it.
+        shell_print(sh, "copy: dst is not a file.");
+        return;
+    }
+    if (didx < 0) {
+        didx = vfs_add_node(VFS_FILE, parent, leaf);
+        if (didx < 0) {
+            shell_print(sh, "copy: no space left in VFS.");
+            return;
+        }
+    }
+    vfs_file_clear(&g_vfs[didx]);
+    if (vfs_file_append(&g_vfs[didx], vfs_text(&g_vfs[sidx]), g_vfs[sidx].size) <
+        g_vfs[sidx].size) {
+        shell_print(sh, "copy: out of memory, dst truncated.");
+    }
+}
+
+// move / mv
+static void cmd_move(Shell *sh, int argc, char **argv) {
+    const char *src = argc > 1 ? argv[1] : "";
+    const char *dst = argc > 2 ? argv[2] : "";
+    if (!src[0] || !dst[0]) {
+        shell_print(sh, "move: usage: move <src> <dst>");
+        return;
+    }
+    int sidx = vfs_lookup(src);
+    if (sidx <= 0) {
+        shell_print(sh, "move: src not found.");
+        return;
+    }
+    // Into a directory keeps the name; otherwise dst is the new path.
+    char leaf[VFS_NAME_LEN];
+    int parent = vfs_lookup(dst);
+    if (parent >= 0 && g_vfs[parent].type == VFS_DIR) {
+        str_copy(leaf, g_vfs[sidx].name, sizeof(leaf));
+    } else {
+        parent = vfs_lookup_parent(dst, leaf);
+        if (parent < 0) {
+            shell_print(sh, "move: dst path not found.");
+            return;
+        }
+    }
+    for (int up = parent; up >= 0; up = g_vfs[up].parent) {
+        if (up == sidx) {
+            shell_print(sh, "move: cannot move a directory into itself.");
+            return;
+        }
+    }
+    int existing = vfs_find_child(parent, leaf);
+    if (existing == sidx) return;
+    if (existing >= 0) {
+        shell_print(sh, "move: dst already exists.");
+        return;
+    }
+    g_vfs[sidx].parent = parent;
+    str_copy(g_vfs[sidx].name, leaf, VFS_NAME_LEN);
+    vfs_reindex();
+}
+
+// pwd
+static void cmd_pwd(Shell *sh, int argc, char **argv) {
+    (void)argc; (void)argv;
+    char path[64];
+    vfs_build_path(path, sizeof(path), g_cwd);
+    shell_print(sh, path);
+}
+
+// ver / uname
+static void cmd_ver(Shell *sh, int argc, char **argv) {
+    (void)argc; (void)argv;
+    shell_print(sh, "LightOS 4 demo kernel (x86_64, UEFI framebuffer).");
+}
+
+// time / date
+static void cmd_time(Shell *sh, int argc, char **argv) {
+    (void)argc; (void)argv;
+    char tbuf[16], dbuf[16], buf[32];
+    format_time(tbuf, sizeof(tbuf));
+    format_date(dbuf, sizeof(dbuf));
+    str_copy(buf, dbuf, sizeof(buf));
+    str_cat(buf, " ", sizeof(buf));
+    str_cat(buf, tbuf, sizeof(buf));
+    shell_print(sh, buf);
+}
+
+// echo
+static void cmd_echo(Shell *sh, int argc, char **argv) {
+    char line[TERM_MAX_COLS];
+    line[0] = '\0';
+    for (int i = 1; i < argc; ++i) {
+        if (i > 1) str_cat(line, " ", sizeof(line));
+        str_cat(line, argv[i], sizeof(line));
+    }
+    shell_print(sh, line);
+}
+
+// ipconfig / ifconfig
+static void cmd_ipconfig(Shell *sh, int argc, char **argv) {
+    (void)argc; (void)argv;
+    if (netdev_count() == 0) {
+        shell_print(sh, "No network adapter found.");
+        shell_print(sh, "(QEMU: -device virtio-net-pci,netdev=...)");
+        return;
+    }
+    for (int i = 0; i < netdev_count(); ++i) {
+        NetDevice *dev = netdev_get(i);
+        char line[TERM_MAX_COLS];
+
+        str_copy(line, dev->name, sizeof(line));
+        str_cat(line, ": virtio-net, link ", sizeof(line));
+        str_cat(line, dev->link_up ? "up" : "down", sizeof(line));
+        str_cat(line, ", mtu ", sizeof(line));
+        str_cat_u64(line, dev->mtu, sizeof(line));
+        shell_print(sh, line);
+
+        str_copy(line, "  MAC ", sizeof(line));
+        for (int b = 0; b < 6; ++b) {
+            if (b) str_cat(line, ":", sizeof(line));
+            str_cat_hex(line, dev->mac[b], 2, sizeof(line));
+        }
+        shell_print(sh, line);
+
+        str_copy(line, "  RX ", sizeof(line));
+        str_cat_u64(line, dev->stats.rx_packets, sizeof(line));
+        str_cat(line, " pkts ", sizeof(line));
+        str_cat_u64(line, dev->stats.rx_bytes, sizeof(line));
+        str_cat(line, " bytes, dropped ", sizeof(line));
+        str_cat_u64(line, dev->stats.rx_dropped, sizeof(line));
+        shell_print(sh, line);
+
+        str_copy(line, "  TX ", sizeof(line));
+        str_cat_u64(line, dev->stats.tx_packets, sizeof(line));
+        str_cat(line, " pkts ", sizeof(line));
+        str_cat_u64(line, dev->stats.tx_bytes, sizeof(line));
+        str_cat(line, " bytes, kicks ", sizeof(line));
+        str_cat_u64(line, dev->stats.tx_kicks, sizeof(line));
+        shell_print(sh, line);
+
+        NetIf *nif = net_if_for(dev);
+        if (!nif) continue;
+        char ip[16];
+        if (nif->configured) {
+            net_format_ip(ip, sizeof(ip), nif->ip);
+            str_copy(line, "  IPv4 ", sizeof(line));
+            str_cat(line, ip, sizeof(line));
+            net_format_ip(ip, sizeof(ip), nif->netmask);
+            str_cat(line, "  mask ", sizeof(line));
+            str_cat(line, ip, sizeof(line));
+            shell_print(sh, line);
+
+            net_format_ip(ip, sizeof(ip), nif->gateway);
+            str_copy(line, "  Gateway ", sizeof(line));
+            str_cat(line, ip, sizeof(line));
+            net_format_ip(ip, sizeof(ip), nif->dns);
+            str_cat(line, "  DNS ", sizeof(line));
+            str_cat(line, ip, sizeof(line));
+            shell_print(sh, line);
+        }
+        str_copy(line, "  DHCP ", sizeof(line));
+        str_cat(line, dhcp_state_name(), sizeof(line));
+        str_cat(line, ", ARP entries ", sizeof(line));
+        str_cat_u64(line, (uint64_t)arp_cache_count(), sizeof(line));
+        str_cat(line, ", TCP blocks ", sizeof(line));
+        str_cat_u64(line, (uint64_t)tcp_count(), sizeof(line));
+        shell_print(sh, line);
+    }
+
+    HttpCacheStats cs;
+    http_cache_stats(&cs);
+    char line[TERM_MAX_COLS];
+    str_copy(line, "HTTP cache: ", sizeof(line));
+    str_cat_u64(line, cs.entries, sizeof(line));
+    str_cat(line, " pages, ", sizeof(line));
+    str_cat_u64(line, cs.bytes / 1024, sizeof(line));
+    str_cat(line, " KB; hits ", sizeof(line));
+    str_cat_u64(line, cs.hits, sizeof(line));
+    str_cat(line, ", 304s ", sizeof(line));
+    str_cat_u64(line, cs.revalidated, sizeof(line));
+    str_cat(line, ", misses ", sizeof(line));
+    str_cat_u64(line, cs.misses, sizeof(line));
+    shell_print(sh, line);
+}
+
+// `perf alloc`: each CPU allocates a batch, then frees its neighbour's, so
+// most frees land on a CPU other than the one whose slab the object is in.
+typedef struct {
+    void **objs[SMP_MAX_CPUS];
+    int    cpus;
+} PerfAlloc;
+
+static void perf_alloc_job(void *arg, int cpu) {
+    PerfAlloc *pa = (PerfAlloc*)arg;
+    for (int i = 0; i < PERF_ALLOC_OBJS; ++i) pa->objs[cpu][i] = kmalloc(64);
+}
+
+static void perf_free_job(void *arg, int cpu) {
+    PerfAlloc *pa   = (PerfAlloc*)arg;
+    void     **objs = pa->objs[(cpu + 1) % pa->cpus];
+    for (int i = 0; i < PERF_ALLOC_OBJS; ++i) kfree(objs[i]);
+}
+
+static void perf_alloc(Shell *sh) {
+    char      line[TERM_MAX_COLS];
+    PerfAlloc pa;
+    int       n = smp_cpu_count();
+    for (int cpu = 0; cpu < n; ++cpu) {
+        pa.objs[cpu] = (void**)kzalloc(PERF_ALLOC_OBJS * sizeof(void*));
+        if (!pa.objs[cpu]) {
+            while (cpu--) kfree(pa.objs[cpu]);
+            shell_print(sh, "perf: out of memory");
+            return;
+        }
+    }
+    uint64_t base = 0;                  // tenths of M ops/s on one CPU
+    for (int cpus = 1; cpus <= n; ++cpus) {
+        pa.cpus = cpus;
+        uint64_t start = time_us();
+        for (int r = 0; r < PERF_ALLOC_ROUNDS; ++r) {
+            smp_run(perf_alloc_job, &pa, cpus);
+            smp_run(perf_free_job, &pa, cpus);
+        }
+        uint64_t us   = time_us() - start;
+        uint64_t ops  = 2ull * PERF_ALLOC_OBJS * PERF_ALLOC_ROUNDS * (uint64_t)cpus;
+        uint64_t rate = ops * 10 / (us ? us : 1);
+        if (cpus == 1) base = rate ? rate : 1;
+        uint64_t speedup = rate * 10 / base;
+        str_copy(line, "  ", sizeof(line));
+        str_cat_u64(line, (uint64_t)cpus, sizeof(line));
+        str_cat(line, cpus == 1 ? " CPU:  " : " CPUs: ", sizeof(line));
+        str_cat_u64(line, rate / 10, sizeof(line));
+        str_cat(line, ".", sizeof(line));
+        str_cat_u64(line, rate % 10, sizeof(line));
+        str_cat(line, " M allocs+frees/s, x", sizeof(line));
+        str_cat_u64(line, speedup / 10, sizeof(line));
+        str_cat(line, ".", sizeof(line));
+        str_cat_u64(line, speedup % 10, sizeof(line));
+        shell_print(sh, line);
+    }
+    for (int cpu = 0; cpu < n; ++cpu) kfree(pa.objs[cpu]);
+}
+
+// perf [raster|alloc]: frame pacing, compositor and allocator statistics,
+// or time full repaints or kmalloc()/kfree() on 1..N CPUs
+static void cmd_perf(Shell *sh, int argc, char **argv) {
+    static const char *bucket_names[FRAME_BUCKETS] = {
+        "<1", "1-2", "2-4", "4-8", "8-16", "16-32", ">32"
+    };
+    char line[TERM_MAX_COLS];
+    const char *arg = argc > 1 ? argv[1] : "";
+
+    if (str_eq(arg, "raster")) {
+        for (int cpus = 1; cpus <= smp_cpu_count(); ++cpus) {
+            dl_set_cpus(cpus);
+            uint64_t start = time_us();
+            for (int i = 0; i < PERF_RASTER_FRAMES; ++i) {
+                for (int z = 0; z < wm_window_count(); ++z) {
+                    wm_invalidate(wm_window(z));
+                }
+                wm_compose();
+            }
+            uint64_t us = (time_us() - start) / PERF_RASTER_FRAMES;
+            str_copy(line, "  ", sizeof(line));
+            str_cat_u64(line, (uint64_t)cpus, sizeof(line));
+            str_cat(line, cpus == 1 ? " CPU:  " : " CPUs: ", sizeof(line));
+            str_cat_u64(line, us / 1000, sizeof(line));
+            str_cat(line, ".", sizeof(line));
+            str_cat_u64(line, (us % 1000) / 100, sizeof(line));
+            str_cat(line, " ms per full repaint", sizeof(line));
+            shell_print(sh, line);
+        }
+        dl_set_cpus(0);
+        return;
+    }
+    if (str_eq(arg, "alloc")) {
+        perf_alloc(sh);
+        return;
+    }
+
+    str_copy(line, "Frames: ", sizeof(line));
+    str_cat_u64(line, g_frame_stats.frames, sizeof(line));
+    str_cat(line, " (cap ", sizeof(line));
+    str_cat_u64(line, FRAME_HZ, sizeof(line));
+    str_cat(line, " Hz), over budget ", sizeof(line));
+    str_cat_u64(line, g_frame_stats.over_budget, sizeof(line));
+    str_cat(line, ", pixels ", sizeof(line));
+    str_cat_u64(line, g_frame_stats.pixels, sizeof(line));
+    shell_print(sh, line);
+
+    str_copy(line, "Input: ", sizeof(line));
+    str_cat_u64(line, g_frame_stats.events, sizeof(line));
+    str_cat(line, " events, ", sizeof(line));
+    str_cat_u64(line, g_frame_stats.merged, sizeof(line));
+    str_cat(line, " merged into shared frames", sizeof(line));
+    shell_print(sh, line);
+
+    str_copy(line, "Frame time (ms):", sizeof(line));
+    for (int b = 0; b < FRAME_BUCKETS; ++b) {
+        str_cat(line, " ", sizeof(line));
+        str_cat(line, bucket_names[b], sizeof(line));
+        str_cat(line, ":", sizeof(line));
+        str_cat_u64(line, g_frame_stats.hist[b], sizeof(line));
+    }
+    shell_print(sh, line);
+
+    DrawListStats ds;
+    dl_stats(&ds);
+    str_copy(line, "Draw lists: ", sizeof(line));
+    str_cat_u64(line, ds.lists, sizeof(line));
+    str_cat(line, ", commands ", sizeof(line));
+    str_cat_u64(line, ds.commands, sizeof(line));
+    str_cat(line, " (culled ", sizeof(line));
+    str_cat_u64(line, ds.culled, sizeof(line));
+    str_cat(line, ", merged ", sizeof(line));
+    str_cat_u64(line, ds.merged, sizeof(line));
+    str_cat(line, ", overdrawn ", sizeof(line));
+    str_cat_u64(line, ds.occluded, sizeof(line));
+    str_cat(line, ")", sizeof(line));
+    shell_print(sh, line);
+
+    str_copy(line, "CPUs: ", sizeof(line));
+    str_cat_u64(line, (uint64_t)smp_cpu_count(), sizeof(line));
+    str_cat(line, ", tiled lists ", sizeof(line));
+    str_cat_u64(line, ds.tiled, sizeof(line));
+    str_cat(line, " (", sizeof(line));
+    str_cat_u64(line, ds.tiles, sizeof(line));
+    str_cat(line, " tiles)", sizeof(line));
+    shell_print(sh, line);
+
+    WidgetStats ws;
+    widget_stats(&ws);
+    str_copy(line, "Widgets: ", sizeof(line));
+    str_cat_u64(line, ws.layouts, sizeof(line));
+    str_cat(line, " layouts, ", sizeof(line));
+    str_cat_u64(line, ws.hit_tests, sizeof(line));
+    str_cat(line, " hit tests, ", sizeof(line));
+    str_cat_u64(line, ws.candidates, sizeof(line));
+    str_cat(line, " widgets looked at", sizeof(line));
+    shell_print(sh, line);
+
+    str_copy(line, "VFS: ", sizeof(line));
+    str_cat_u64(line, (uint64_t)g_vfs_count, sizeof(line));
+    str_cat(line, " nodes, ", sizeof(line));
+    str_cat_u64(line, g_dentry_lookups, sizeof(line));
+    str_cat(line, " dentry lookups, ", sizeof(line));
+    str_cat_u64(line, g_dentry_probes, sizeof(line));
+    str_cat(line, " probes", sizeof(line));
+    shell_print(sh, line);
+
+    VmStats vs;
+    vm_stats(&vs);
+    str_copy(line, "Paging: ", sizeof(line));
+    str_cat_u64(line, vs.faults, sizeof(line));
+    str_cat(line, " faults (", sizeof(line));
+    str_cat_u64(line, vs.zero_fills, sizeof(line));
+    str_cat(line, " zero, ", sizeof(line));
+    str_cat_u64(line, vs.file_pages, sizeof(line));
+    str_cat(line, " file, ", sizeof(line));
+    str_cat_u64(line, vs.cow_copies, sizeof(line));
+    str_cat(line, " copied, ", sizeof(line));
+    str_cat_u64(line, vs.cow_reuses, sizeof(line));
+    str_cat(line, " reused), ", sizeof(line));
+    str_cat_u64(line, vs.bad_faults, sizeof(line));
+    str_cat(line, " refused", sizeof(line));
+    shell_print(sh, line);
+
+    PcStats ps;
+    pc_stats(&ps);
+    str_copy(line, "Page cache: ", sizeof(line));
+    str_cat_u64(line, ps.pages, sizeof(line));
+    str_cat(line, " pages (", sizeof(line));
+    str_cat_u64(line, ps.dirty, sizeof(line));
+    str_cat(line, " dirty), hits ", sizeof(line));
+    str_cat_u64(line, ps.hits, sizeof(line));
+    str_cat(line, ", misses ", sizeof(line));
+    str_cat_u64(line, ps.misses, sizeof(line));
+    str_cat(line, ", read ahead ", sizeof(line));
+    str_cat_u64(line, ps.readahead, sizeof(line));
+    str_cat(line, ", evicted ", sizeof(line));
+    str_cat_u64(line, ps.evicted, sizeof(line));
+    shell_print(sh, line);
+
+    str_copy(line, "Writeback: ", sizeof(line));
+    str_cat_u64(line, ps.pages_written, sizeof(line));
+    str_cat(line, " pages in ", sizeof(line));
+    str_cat_u64(line, ps.write_requests, sizeof(line));
+    str_cat(line, " requests; ", sizeof(line));
+    str_cat_u64(line, ps.read_requests, sizeof(line));
+    str_cat(line, " read requests", sizeof(line));
+    shell_print(sh, line);
+
+    KmemStats ks;
+    kmem_stats(&ks);
+    uint64_t served = ks.allocs + ks.frees;
+    uint64_t slabbed = ks.slab_ops < served ? ks.slab_ops : served;
+    str_copy(line, "Slab: ", sizeof(line));
+    str_cat_u64(line, ks.allocs, sizeof(line));
+    str_cat(line, " allocs, ", sizeof(line));
+    str_cat_u64(line, ks.frees, sizeof(line));
+    str_cat(line, " frees (", sizeof(line));
+    str_cat_u64(line, served ? (served - slabbed) * 100 / served : 0, sizeof(line));
+    str_cat(line, "% from magazines), ", sizeof(line));
+    str_cat_u64(line, ks.depot_trades, sizeof(line));
+    str_cat(line, " depot trades, ", sizeof(line));
+    str_cat_u64(line, ks.remote_frees, sizeof(line));
+    str_cat(line, " remote frees, ", sizeof(line));
+    str_cat_u64(line, ks.slabs, sizeof(line));
+    str_cat(line, " slabs", sizeof(line));
+    shell_print(sh, line);
+
+    IoRingStats is;
+    ioring_stats(&is);
+    str_copy(line, "I/O rings: ", sizeof(line));
+    str_cat_u64(line, is.submitted, sizeof(line));
+    str_cat(line, " submitted, ", sizeof(line));
+    str_cat_u64(line, is.completed, sizeof(line));
+    str_cat(line, " completed, ", sizeof(line));
+    str_cat_u64(line, is.retries, sizeof(line));
+    str_cat(line, " retried, ", sizeof(line));
+    str_cat_u64(line, is.workers_started, sizeof(line));
+    str_cat(line, " workers started", sizeof(line));
+    shell_print(sh, line);
+
+    for (int i = 0; i < blkdev_count(); ++i) {
+        BlockDevice *bd = blkdev_get(i);
+        str_copy(line, "Disk ", sizeof(line));
+        str_cat(line, bd->name, sizeof(line));
+        str_cat(line, ": ", sizeof(line));
+        str_cat_u64(line, bd->sectors / 2048, sizeof(line));
+        str_cat(line, bd->read_only ? " MiB read-only, " : " MiB, ", sizeof(line));
+        str_cat_u64(line, bd->stats.reads, sizeof(line));
+        str_cat(line, " reads (", sizeof(line));
+        str_cat_u64(line, bd->stats.read_bytes / 1024, sizeof(line));
+        str_cat(line, " KiB), ", sizeof(line));
+        str_cat_u64(line, bd->stats.writes, sizeof(line));
+        str_cat(line, " writes (", sizeof(line));
+        str_cat_u64(line, bd->stats.write_bytes / 1024, sizeof(line));
+        str_cat(line, " KiB), ", sizeof(line));
+        str_cat_u64(line, bd->stats.errors, sizeof(line));
+        str_cat(line, " errors", sizeof(line));
+        shell_print(sh, line);
+    }
+}
+
+// sync: write every dirty cached page back now
+static void cmd_sync(Shell *sh, int argc, char **argv) {
+    (void)argc; (void)argv;
+    if (pc_sync(0) < 0) shell_print(sh, "sync: some pages could not be written back.");
+}
+
+// mode [WxH]: list display modes or switch to one
+static void cmd_mode(Shell *sh, int argc, char **argv) {
+    const char *arg = argc > 1 ? argv[1] : "";
+    char line[TERM_MAX_COLS];
+    char tmp[16];
+    if (arg[0]) {
+        uint32_t w, h;
+        if (!parse_mode(arg, &w, &h)) {
+            shell_print(sh, "Usage: mode [WxH]");
+            return;
+        }
+        if (!g_mode_count) {
+            shell_print(sh, "Resolution is fixed; set resolution=WxH in \\lightos.cfg.");
+            return;
+        }
+        if (display_set_mode(w, h) < 0) {
+            shell_print(sh, "mode: display refused that resolution");
+            return;
+        }
+    }
+
+    format_mode(tmp, sizeof(tmp), g_width, g_height);
+    str_copy(line, "Display: ", sizeof(line));
+    str_cat(line, tmp, sizeof(line));
+    str_cat(line, g_mode_count ? " (Bochs VBE)" : " (fixed at boot)", sizeof(line));
+    shell_print(sh, line);
+    for (int i = 0; i < g_mode_count; ++i) {
+        format_mode(tmp, sizeof(tmp), g_modes[i].width, g_modes[i].height);
+        int current = g_modes[i].width == g_width && g_modes[i].height == g_height;
+        str_copy(line, current ? " * " : "   ", sizeof(line));
+        str_cat(line, tmp, sizeof(line));
+        shell_print(sh, line);
+    }
+}
+
+// font [builtin|boot]: show or switch the UI font
+static void cmd_font(Shell *sh, int argc, char **argv) {
+    const char *arg = argc > 1 ? argv[1] : "";
+    if (str_eq(arg, "builtin")) {
+        ui_set_font(font_builtin());
+        desktop_refresh();
+    } else if (str_eq(arg, "boot")) {
+        if (!g_boot_font) {
+            shell_print(sh, "No font was loaded at boot (\\font.ttf or \\font.psf).");
+            return;
+        }
+        ui_set_font(g_boot_font);
+        desktop_refresh();
+    } else if (arg[0]) {
+        shell_print(sh, "Usage: font [builtin|boot]");
+        return;
+    }
+
+    char line[TERM_MAX_COLS];
+    str_copy(line, "Font: ", sizeof(line));
+    str_cat(line, font_name(g_ui_font), sizeof(line));
+    str_cat(line, " (", sizeof(line));
+    str_cat(line, font_kind(g_ui_font), sizeof(line));
+    str_cat(line, "), ", sizeof(line));
+    str_cat_u64(line, ui_font_size(1), sizeof(line));
+    str_cat(line, " px at scale 1", sizeof(line));
+    shell_print(sh, line);
+
+    FontCacheStats fs;
+    font_cache_stats(&fs);
+    str_copy(line, "Glyph cache: ", sizeof(line));
+    str_cat_u64(line, fs.glyphs, sizeof(line));
+    str_cat(line, " glyphs, ", sizeof(line));
+    str_cat_u64(line, fs.bytes / 1024, sizeof(line));
+    str_cat(line, " KB; hits ", sizeof(line));
+    str_cat_u64(line, fs.hits, sizeof(line));
+    str_cat(line, ", misses ", sizeof(line));
+    str_cat_u64(line, fs.misses, sizeof(line));
+    str_cat(line, ", flushes ", sizeof(line));
+    str_cat_u64(line, fs.flushes, sizeof(line));
+    shell_print(sh, line);
+}
+
+// ping <host> [count]
+static void cmd_ping(Shell *sh, int argc, char **argv) {
+    if (argc < 2) {
+        shell_print(sh, "Usage: ping <host> [count]");
+        return;
+    }
+    const char *host = argv[1];
+    const char *arg  = argc > 2 ? argv[2] : "";
+    uint32_t count = 4;
+    if (*arg >= '0' && *arg <= '9') {
+        count = 0;
+        while (*arg >= '0' && *arg <= '9') count = count * 10 + (uint32_t)(*arg++ - '0');
+        if (count == 0)  count = 1;
+        if (count > 20)  count = 20;
+    }
+
+    if (net_wait_configured(5000) < 0) {
+        shell_print(sh, "ping: network is not configured (no DHCP lease).");
+        return;
+    }
+    uint32_t ip = 0;
+    if (dns_resolve(host, &ip, 3000) < 0) {
+        char msg[TERM_MAX_COLS];
+        str_copy(msg, "ping: cannot resolve ", sizeof(msg));
+        str_cat(msg, host, sizeof(msg));
+        shell_print(sh, msg);
+        return;
+    }
+
+    char ipstr[16];
+    char line[TERM_MAX_COLS];
+    net_format_ip(ipstr, sizeof(ipstr), ip);
+    str_copy(line, "Pinging ", sizeof(line));
+    str_cat(line, ipstr, sizeof(line));
+    str_cat(line, " with 32 bytes of data:", sizeof(line));
+    shell_print(sh, line);
+
+    uint32_t received = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t rtt_us = 0;
+        int rc = icmp_ping(ip, (uint16_t)(i + 1), 1000, &rtt_us);
+        if (rc == 0) {
+            received++;
+            str_copy(line, "Reply from ", sizeof(line));
+            str_cat(line, ipstr, sizeof(line));
+            str_cat(line, ": seq=", sizeof(line));
+            str_cat_u64(line, i + 1, sizeof(line));
+            str_cat(line, " time=", sizeof(line));
+            str_cat_u64(line, rtt_us / 1000, sizeof(line));
+            str_cat(line, ".", sizeof(line));
+            str_cat_u64(line, (rtt_us % 1000) / 100, sizeof(line));
+            str_cat(line, "ms", sizeof(line));
+        } else {
+            str_copy(line, "Request timed out (seq=", sizeof(line));
+            str_cat_u64(line, i + 1, sizeof(line));
+            str_cat(line, ")", sizeof(line));
+        }
+        shell_print(sh, line);
+        // Pace requests roughly a second apart, like everyone else.
+        if (i + 1 < count && rc == 0 && rtt_us < 1000000) {
+            // Let the desktop and the rest of the pipeline run meanwhile.
+            uint64_t until = time_ms() + 1000 - rtt_us / 1000;
+            while (time_ms() < until && !shell_cancelled(sh)) {
+                net_tick();
+                thread_yield();
+            }
+        }
+        if (shell_cancelled(sh)) return;
+    }
+    str_copy(line, "Sent ", sizeof(line));
+    str_cat_u64(line, count, sizeof(line));
+    str_cat(line, ", received ", sizeof(line));
+    str_cat_u64(line, received, sizeof(line));
+    str_cat(line, ", lost ", sizeof(line));
+    str_cat_u64(line, count - received, sizeof(line));
+    shell_print(sh, line);
+}
+
+// Built-in commands, in the order `help` lists them.
+static const ShellCommand g_term_commands[] = {
+    { "cls",      { "clear" },                     0,
+      "clear the screen",                                   cmd_cls },
+    { "dir",      { "ls" },                        "[dir]",
+      "list a directory (the current one)",                 cmd_dir },
+    { "cd",       { "chdir" },                     "[dir]",
+      "change or show the current directory",               cmd_cd },
+    { "mkdir",    { "md" },                        "<name>",
+      "create a directory",                                 cmd_mkdir },
+    { "rmdir",    { "rd" },                        "<name>",
+      "remove an empty directory",                          cmd_rmdir },
+    { "touch",    { "create", "mkfile" },          "<name>",
+      "create an empty file",                               cmd_touch },
+    { "del",      { "erase", "rm" },               "<name>",
+      "delete a file",                                      cmd_del },
+    { "type",     { "cat" },                       "<file>",
+      "print a file",                                       cmd_type },
+    { "edit",     { "nano", "micro", "notepad" },  "<file>",
+      "append lines to a file",                             cmd_edit },
+    { "copy",     { "cp" },                        "<src> <dst>",
+      "copy a file",                                        cmd_copy },
+    { "move",     { "mv" },                        "<src> <dst>",
+      "rename a file or directory",                         cmd_move },
+    { "pwd",      { 0 },                           0,
+      "print the current directory",                        cmd_pwd },
+    { "ver",      { "uname" },                     0,
+      "kernel version",                                     cmd_ver },
+    { "time",     { "date" },                      0,
+      "current date and time",                              cmd_time },
+    { "echo",     { 0 },                           "<text>",
+      "print the arguments",                                cmd_echo },
+    { "ipconfig", { "ifconfig" },                  0,
+      "network adapters, addresses and counters",           cmd_ipconfig },
+    { "ping",     { 0 },                           "<host> [count]",
+      "send ICMP echo requests",                            cmd_ping },
+    { "perf",     { 0 },                           "[raster|alloc]",
+      "frame, draw list, widget, allocator and I/O statistics", cmd_perf },
+    { "sync",     { 0 },                           0,
+      "write cached disk pages back now",                   cmd_sync },
+    { "font",     { 0 },                           "[builtin|boot]",
+      "show or switch the UI font",                         cmd_font },
+    { "mode",     { 0 },                           "[WxH]",
+      "show or switch the display mode",                    cmd_mode },
+};
+
+static void term_register_commands(void) {
+    for (uint32_t i = 0; i < sizeof(g_term_commands) / sizeof(g_term_commands[0]); ++i) {
+        shell_register(&g_term_commands[i]);
     }
 }
 
+static void term_line(void *ctx, const char *line) {
+    term_add_line((TerminalState*)ctx, line);
+}
+
+// `> file` / `>> file`. Looked up by directory and name on every write,
+// since vfs_delete_node() moves nodes.
+typedef struct {
+    int  parent;
+    char name[VFS_NAME_LEN];
+} TermRedirect;
+
+static TermRedirect g_redirect;
+
+static void *term_open(void *ctx, const char *name, int append) {
+    (void)ctx;
+    char leaf[VFS_NAME_LEN];
+    int parent = vfs_lookup_parent(name, leaf);
+    if (parent < 0) return 0;
+    int idx = vfs_find_child(parent, leaf);
+    if (idx >= 0 && g_vfs[idx].type != VFS_FILE) return 0;
+    if (idx < 0) idx = vfs_add_node(VFS_FILE, parent, leaf);
+    if (idx < 0) return 0;
+
+    VfsNode *node = &g_vfs[idx];
+    if (!append) {
+        vfs_file_clear(node);
+    } else if (node->size && node->data[node->size - 1] != '\n') {
+        vfs_file_append(node, "\n", 1);
+    }
+    g_redirect.parent = parent;
+    str_copy(g_redirect.name, leaf, sizeof(g_redirect.name));
+    return &g_redirect;
+}
+
+static int term_file_write(void *ctx, void *file, const char *data, uint32_t len) {
+    (void)ctx;
+    TermRedirect *r = (TermRedirect*)file;
+    int idx = vfs_find_child(r->parent, r->name);
+    if (idx < 0 || g_vfs[idx].type != VFS_FILE) return 0;
+
+    return (int)vfs_file_append(&g_vfs[idx], data, len);
+}
+
+static void term_close(void *ctx, void *file) {
+    (void)ctx; (void)file;
+}
+
+// ---------------------------------------------------------------------
+// Files for user processes
+// ---------------------------------------------------------------------
+
+// An open file: found again by directory and name on every call, like
+// TermRedirect, since nodes move.
+typedef struct {
+    int  parent;
+    char name[VFS_NAME_LEN];
+} ProcVfsFile;
+
+// A file or a disk.
+static VfsNode *proc_vfs_node(void *file) {
+    ProcVfsFile *f = (ProcVfsFile*)file;
+    int idx = vfs_find_child(f->parent, f->name);
+    if (idx < 0 || g_vfs[idx].type == VFS_DIR) return 0;
+    return &g_vfs[idx];
+}
+
+static void *proc_vfs_open(void *ctx, const char *path, int flags) {
+    (void)ctx;
+    char leaf[VFS_NAME_LEN];
+    int parent = vfs_lookup_parent(path, leaf);
+    if (parent < 0) return 0;
+    int idx = vfs_find_child(parent, leaf);
+    if (idx >= 0 && g_vfs[idx].type == VFS_DIR) return 0;
+    if (idx < 0 && !(flags & O_CREAT)) return 0;
+
+    ProcVfsFile *f = (ProcVfsFile*)kmalloc(sizeof(ProcVfsFile));
+    if (!f) return 0;
+    if (idx < 0) idx = vfs_add_node(VFS_FILE, parent, leaf);
+    if (idx < 0) {
+        kfree(f);
+        return 0;
+    }
+    if ((flags & O_TRUNC) && (flags & O_ACCMODE) != O_RDONLY &&
+        g_vfs[idx].type == VFS_FILE) {
+        vfs_file_clear(&g_vfs[idx]);
+    }
+    f->parent = parent;
+    str_copy(f->name, leaf, sizeof(f->name));
+    return f;
+}
+
+static int proc_vfs_read(void *ctx, void *file, uint32_t pos, void *buf, uint32_t len) {
+    (void)ctx;
+    VfsNode *n = proc_vfs_node(file);
+    if (!n) return -1;
+    if (n->type == VFS_DEV) return pc_read(n->cache, pos, buf, len);
+    if (pos >= n->size) return 0;
+    if (len > n->size - pos) len = n->size - pos;
+    memcpy(buf, vfs_text(n) + pos, len);
+    return (int)len;
+}
+
+// Writing past the end leaves no hole: pos is at most the size. Disks
+// don't grow, and their writes reach them from the page cache later.
+static int proc_vfs_write(void *ctx, void *file, uint32_t pos, const void *data,
+                          uint32_t len) {
+    (void)ctx;
+    VfsNode *n = proc_vfs_node(file);
+    if (!n) return -1;
+    if (n->type == VFS_DEV) return pc_write(n->cache, pos, data, len);
+    if (pos > n->size) pos = n->size;
+    if (len > VFS_FILE_MAX - pos) len = VFS_FILE_MAX - pos;
+    if (!len) return 0;
+    if (pos + len > n->size && vfs_file_reserve(n, pos + len) < 0) return 0;
+    if (n->borrowed && vfs_file_reserve(n, n->size) < 0) return 0;
+    vfs_file_changed(n);
+    memcpy(n->data + pos, data, len);
+    if (pos + len > n->size) {
+        n->size = pos + len;
+        n->data[n->size] = '\0';
+    }
+    return (int)len;
+}
+
+static int proc_vfs_size(void *ctx, void *file) {
+    (void)ctx;
+    VfsNode *n = proc_vfs_node(file);
+    return n ? (int)n->size : -1;
+}
+
+static void *proc_vfs_dup(void *ctx, void *file) {
+    (void)ctx;
+    ProcVfsFile *f = (ProcVfsFile*)kmalloc(sizeof(ProcVfsFile));
+    if (f) *f = *(ProcVfsFile*)file;
+    return f;
+}
+
+static void *proc_vfs_page(void *ctx, void *file, uint64_t index) {
+    (void)ctx;
+    VfsNode *n = proc_vfs_node(file);
+    if (!n) return 0;
+    return n->type == VFS_DEV ? pc_page(n->cache, index) : vfs_file_page(n, index);
+}
+
+// Files are written through already; disks have their cache to write back.
+static int proc_vfs_sync(void *ctx, void *file) {
+    (void)ctx;
+    VfsNode *n = proc_vfs_node(file);
+    if (!n) return -1;
+    return n->type == VFS_DEV ? pc_sync(n->cache) : 0;
+}
+
+static void proc_vfs_close(void *ctx, void *file) {
+    (void)ctx;
+    kfree(file);
+}
+
+static const ProcFs g_proc_fs = {
+    proc_vfs_open, proc_vfs_read, proc_vfs_write, proc_vfs_size, proc_vfs_dup,
+    proc_vfs_page, proc_vfs_sync, proc_vfs_close, 0
+};
+
+static int term_window_rows(void);
+
+static void term_execute_command(TerminalState *t, const char *cmd) {
+    ShellConsole con = {
+        term_line, term_open, term_file_write, term_close, t, term_window_rows()
+    };
+    shell_start(&con, cmd);
+}
+
 // ---------------------------------------------------------------------
 // Keyboard input â†’ terminal
 // ---------------------------------------------------------------------
 
-static int g_shift_down = 0;
+static void app_close(int app);
+
+static void term_set_input(TerminalState *t, const char *text) {
+    str_copy(t->input, text, TERM_MAX_COLS);
+    t->input_len = str_len(t->input);
+}
 
-static void term_handle_scancode(uint8_t sc, TerminalState *t,
-                                 int *selected_icon, int *open_app) {
-    (void)selected_icon; // unused while inside Command Block
+// Up/Down: older and newer history lines; below the newest is whatever
+// was being typed.
+static void term_history_step(TerminalState *t, int older) {
+    int age = t->hist_age + (older ? 1 : -1);
+    if (age < -1 || age >= shell_history_count()) return;
+    if (t->hist_age < 0) str_copy(t->stash, t->input, TERM_MAX_COLS);
+    t->hist_age = age;
+    term_set_input(t, age < 0 ? t->stash : shell_history_get(age));
+}
 
-    // Shift press/release
-    if (sc == 0x2A || sc == 0x36) {
-        g_shift_down = 1;
+// Ctrl+R: the input becomes the newest line at least from_age old that
+// contains the query; on a miss it stays as it was.
+static void term_search(TerminalState *t, int from_age) {
+    if (!t->query[0]) {
+        t->search_failed = 0;
+        t->hist_age = -1;
+        term_set_input(t, t->stash);
         return;
     }
-    if (sc == 0xAA || sc == 0xB6) {
-        g_shift_down = 0;
+    int age = shell_history_search(t->query, from_age);
+    t->search_failed = age < 0;
+    if (age >= 0) {
+        t->hist_age = age;
+        term_set_input(t, shell_history_get(age));
+    }
+}
+
+// Returns nonzero if the search took the key.
+static int term_search_key(const KeyEvent *ev, TerminalState *t) {
+    int ctrl = ev->mods & KMOD_CTRL;
+    if (ctrl && ev->code == KEY_LETTER('r')) {
+        term_search(t, t->hist_age + 1);
+        return 1;
+    }
+    if (ctrl && (ev->code == KEY_LETTER('g') || ev->code == KEY_LETTER('c'))) {
+        t->searching = 0;                   // give up: back to the typed line
+        t->hist_age  = -1;
+        term_set_input(t, t->stash);
+        return 1;
+    }
+    if (ev->code == KEY_BACKSPACE) {
+        uint32_t len = str_len(t->query);
+        if (len) t->query[len - 1] = '\0';
+        term_search(t, 0);
+        return 1;
+    }
+    if (!ctrl && ev->ch >= ' ') {
+        uint32_t len = str_len(t->query);
+        if (len < TERM_MAX_COLS / 2) {      // the prompt must still fit
+            t->query[len]     = ev->ch;
+            t->query[len + 1] = '\0';
+        }
+        term_search(t, t->hist_age < 0 ? 0 : t->hist_age);
+        return 1;
+    }
+    // Anything else keeps the match and then does what it normally does;
+    // Esc only ends the search.
+    t->searching = 0;
+    return ev->code == KEY_ESC;
+}
+
+static void sort_names(const char **names, int n) {
+    for (int i = 1; i < n; ++i) {
+        const char *key = names[i];
+        int j = i - 1;
+        while (j >= 0) {
+            const char *a = names[j];
+            const char *b = key;
+            while (*a && *a == *b) { ++a; ++b; }
+            if ((uint8_t)*a <= (uint8_t)*b) break;
+            names[j + 1] = names[j];
+            --j;
+        }
+        names[j + 1] = key;
+    }
+}
+
+// Lists what Tab could complete to, a line at a time, under the prompt.
+static void term_list_candidates(TerminalState *t, ShellCompletion *c) {
+    char line[TERM_MAX_COLS];
+    term_print_prompt_path(line, sizeof(line));
+    str_cat(line, " ", sizeof(line));
+    str_cat(line, t->input, sizeof(line));
+    term_add_line(t, line);
+
+    int shown = c->count < SHELL_COMPLETE_MAX ? c->count : SHELL_COMPLETE_MAX;
+    sort_names(c->names, shown);
+    line[0] = '\0';
+    for (int i = 0; i < shown; ++i) {
+        if (line[0] && str_len(line) + 2 + str_len(c->names[i]) >= TERM_MAX_COLS) {
+            term_add_line(t, line);
+            line[0] = '\0';
+        }
+        if (line[0]) str_cat(line, "  ", sizeof(line));
+        str_cat(line, c->names[i], sizeof(line));
+    }
+    if (line[0]) term_add_line(t, line);
+    if (c->count > shown) {
+        str_copy(line, "... ", sizeof(line));
+        str_cat_u64(line, (uint64_t)c->count, sizeof(line));
+        str_cat(line, " matches", sizeof(line));
+        term_add_line(t, line);
+    }
+}
+
+// Tab: completes the last word of the input: a command name where a
+// command goes, otherwise a path, walking the directory's child list. When
+// the candidates share nothing more, lists them instead.
+static void term_complete(TerminalState *t) {
+    uint32_t start = 0;
+    int      words = 0;                     // before this one, in this command
+    for (uint32_t i = 0; i < t->input_len; ++i) {
+        char c = t->input[i];
+        if (c == '|') {
+            start = i + 1;
+            words = 0;
+        } else if (c == '>') {
+            start = i + 1;
+            words = 1;
+        } else if (c == ' ' || c == '\t') {
+            if (i > start) words++;
+            start = i + 1;
+        }
+    }
+    const char *word = t->input + start;
+
+    ShellCompletion c;
+    if (!words) {
+        shell_complete_begin(&c, word);
+        shell_complete_commands(&c);
+    } else {
+        uint32_t len = str_len(word);
+        uint32_t cut = len;
+        while (cut > 0 && word[cut - 1] != '\\' && word[cut - 1] != '/') --cut;
+        int dir = g_cwd;
+        if (cut) {
+            char path[TERM_MAX_COLS];
+            str_copy(path, word, cut + 1 < sizeof(path) ? cut + 1 : sizeof(path));
+            dir = vfs_lookup(path);
+            if (dir < 0 || g_vfs[dir].type != VFS_DIR) return;
+        }
+        shell_complete_begin(&c, word + cut);
+        for (int i = g_vfs[dir].first_child; i >= 0; i = g_vfs[i].next_sibling) {
+            shell_complete_offer(&c, g_vfs[i].name,
+                                 g_vfs[i].type == VFS_DIR ? "\\" : " ");
+        }
+    }
+    if (!c.count) return;
+
+    uint32_t have = c.prefix_len;
+    if (c.count == 1) {
+        str_cat(t->input, c.common + have, TERM_MAX_COLS);
+        str_cat(t->input, c.suffix, TERM_MAX_COLS);
+    } else if (str_len(c.common) > have) {
+        str_cat(t->input, c.common + have, TERM_MAX_COLS);
+    } else {
+        term_list_candidates(t, &c);
+    }
+    t->input_len = str_len(t->input);
+    t->hist_age  = -1;
+}
+
+// The original text stays with the editor until it closes: the file keeps
+// pointing at it (borrowed) until a save or a write gives it a new buffer,
+// and then nothing else holds it.
+static void term_editor_close(void) {
+    editor_close(&g_editor);
+    VfsNode *node = g_editor_file_index >= 0 ? &g_vfs[g_editor_file_index] : 0;
+    if (node && node->data == g_editor_orig && node->borrowed) {
+        node->borrowed = 0;
+    } else {
+        kfree((void*)g_editor_orig);
+    }
+    g_editor_orig       = 0;
+    g_editor_file_index = -1;
+    g_editor_active     = 0;
+}
+
+static void term_editor_key(const KeyEvent *ev) {
+    int action = editor_key(&g_editor, ev);
+    if (action == EDITOR_SAVE) {
+        uint32_t len = editor_length(&g_editor);
+        char *buf = 0;
+        if (g_editor_file_index >= 0 && len <= VFS_FILE_MAX) buf = kmalloc(len + 1);
+        if (buf) {
+            editor_copy(&g_editor, buf);
+            buf[len] = '\0';
+            vfs_file_set(&g_vfs[g_editor_file_index], buf, len);
+        }
+        editor_saved(&g_editor, buf != 0);
+    } else if (action == EDITOR_QUIT) {
+        term_editor_close();
+    }
+}
+
+static void term_handle_key(const KeyEvent *ev, TerminalState *t) {
+    if (!(ev->flags & KEY_PRESSED)) return;
+
+    if (g_editor_active) {
+        term_editor_key(ev);
         return;
     }
 
-    // Ignore other releases
-    if (sc & 0x80) return;
+    // While a command runs, Ctrl+C stops it and other keys are its input.
+    if (shell_busy()) {
+        if ((ev->mods & KMOD_CTRL) && ev->code == KEY_LETTER('c')) {
+            shell_cancel();
+            term_add_line(t, "^C");
+        } else if (ev->code == KEY_ENTER || ev->code == KEY_KP_ENTER) {
+            shell_key('\n');
+        } else if (ev->ch && !(ev->mods & KMOD_CTRL)) {
+            shell_key(ev->ch);
+        }
+        return;
+    }
+
+    if (t->searching && term_search_key(ev, t)) return;
+
+    if (ev->mods & KMOD_CTRL) {
+        if (ev->code == KEY_LETTER('r')) {          // Ctrl+R: search history
+            if (t->hist_age < 0) str_copy(t->stash, t->input, TERM_MAX_COLS);
+            t->searching     = 1;
+            t->search_failed = 0;
+            t->query[0]      = '\0';
+        } else if (ev->code == KEY_LETTER('l')) {   // Ctrl+L: clear the screen
+            term_reset(t);
+        } else if (ev->code == KEY_LETTER('u')) {   // Ctrl+U: clear the input
+            t->input_len = 0;
+            t->input[0]  = '\0';
+        } else if (ev->code == KEY_LETTER('c')) {   // Ctrl+C: abandon the line
+            char line[TERM_MAX_COLS];
+            str_copy(line, t->input, sizeof(line));
+            str_cat(line, "^C", sizeof(line));
+            term_add_line(t, line);
+            t->input_len = 0;
+            t->input[0]  = '\0';
+        }
+        return;
+    }
 
-    if (sc == 0x01) { // Esc -> close app
-        *open_app = -1;
+    if (ev->code == KEY_ESC) { // Esc -> close app
+        app_close(2);
         return;
     }
 
-    if (sc == 0x0E) { // Backspace
+    if (ev->code == KEY_BACKSPACE) {
         if (t->input_len > 0) {
             t->input_len--;
             t->input[t->input_len] = '\0';
         }
+        t->hist_age = -1;
         return;
     }
 
-    if (sc == 0x1C) { // Enter
-        t->input[t->input_len] = '\0';
-
-        // If a simple editor session is active, append this line to the file
-        // instead of executing a command.
-        if (g_editor_active &&
-            g_editor_file_index >= 0 &&
-            g_editor_file_index < g_vfs_count &&
-            g_vfs[g_editor_file_index].type == VFS_FILE) {
-
-            // Show the line inside the editor without a prompt
-            term_add_line(t, t->input);
-
-            // Exit commands for the editor
-            if (str_eq(t->input, ":wq") ||
-                str_eq(t->input, ":q")  ||
-                str_eq(t->input, ":q!") ||
-                str_eq(t->input, "exit")) {
-                g_editor_active     = 0;
-                g_editor_file_index = -1;
-                term_add_line(t, "[editor] exited.");
-            } else {
-                VfsNode *node = &g_vfs[g_editor_file_index];
-                uint32_t cur_len = str_len(node->content);
-                if (cur_len >= VFS_CONTENT_LEN - 2) {
-                    term_add_line(t, "[editor] file too large, cannot append.");
-                } else {
-                    if (cur_len > 0) {
-                        node->content[cur_len++] = '\n';
-                    }
-                    uint32_t i = 0;
-                    while (t->input[i] && cur_len < VFS_CONTENT_LEN - 1) {
-                        node->content[cur_len++] = t->input[i++];
-                    }
-                    node->content[cur_len] = '\0';
-                }
-            }
+    if (ev->code == KEY_UP || ev->code == KEY_DOWN) {
+        term_history_step(t, ev->code == KEY_UP);
+        return;
+    }
+    if (ev->code == KEY_TAB) {
+        term_complete(t);
+        return;
+    }
 
-            t->input_len = 0;
-            t->input[0]  = '\0';
-            return;
-        }
+    if (ev->code == KEY_ENTER || ev->code == KEY_KP_ENTER) {
+        t->input[t->input_len] = '\0';
 
         // Normal command-mode behavior
         char prompt[TERM_MAX_COLS];
@@ -1231,77 +2370,19 @@ static void term_handle_scancode(uint8_t sc, TerminalState *t,
         str_cat(line, t->input, sizeof(line));
         term_add_line(t, line);
 
+        shell_history_add(t->input);
+        t->hist_age = -1;
         term_execute_command(t, t->input);
         t->input_len = 0;
         t->input[0]  = '\0';
         return;
     }
 
-    // Scancode -> ASCII
-    char c = 0;
-    switch (sc) {
-        // Number row
-        case 0x02: c = g_shift_down ? '!' : '1'; break;
-        case 0x03: c = g_shift_down ? '@' : '2'; break;
-        case 0x04: c = g_shift_down ? '#' : '3'; break;
-        case 0x05: c = g_shift_down ? '$' : '4'; break;
-        case 0x06: c = g_shift_down ? '%' : '5'; break;
-        case 0x07: c = g_shift_down ? '^' : '6'; break;
-        case 0x08: c = g_shift_down ? '&' : '7'; break;
-        case 0x09: c = g_shift_down ? '*' : '8'; break;
-        case 0x0A: c = g_shift_down ? '(' : '9'; break;
-        case 0x0B: c = g_shift_down ? ')' : '0'; break;
-        case 0x0C: c = g_shift_down ? '_' : '-'; break;
-        case 0x0D: c = g_shift_down ? '+' : '='; break;
-
-        // QWERTY rows
-        case 0x10: c = 'q'; break;
-        case 0x11: c = 'w'; break;
-        case 0x12: c = 'e'; break;
-        case 0x13: c = 'r'; break;
-        case 0x14: c = 't'; break;
-        case 0x15: c = 'y'; break;
-        case 0x16: c = 'u'; break;
-        case 0x17: c = 'i'; break;
-        case 0x18: c = 'o'; break;
-        case 0x19: c = 'p'; break;
-
-        case 0x1A: c = g_shift_down ? '{' : '['; break;
-        case 0x1B: c = g_shift_down ? '}' : ']'; break;
-
-        case 0x1E: c = 'a'; break;
-        case 0x1F: c = 's'; break;
-        case 0x20: c = 'd'; break;
-        case 0x21: c = 'f'; break;
-        case 0x22: c = 'g'; break;
-        case 0x23: c = 'h'; break;
-        case 0x24: c = 'j'; break;
-        case 0x25: c = 'k'; break;
-        case 0x26: c = 'l'; break;
-
-        case 0x27: c = g_shift_down ? ':' : ';'; break;
-        case 0x28: c = g_shift_down ? '"' : '\''; break;
-        case 0x2B: c = g_shift_down ? '|' : '\\'; break;
-
-        case 0x2C: c = 'z'; break;
-        case 0x2D: c = 'x'; break;
-        case 0x2E: c = 'c'; break;
-        case 0x2F: c = 'v'; break;
-        case 0x30: c = 'b'; break;
-        case 0x31: c = 'n'; break;
-        case 0x32: c = 'm'; break;
-        case 0x33: c = g_shift_down ? '<' : ','; break;
-        case 0x34: c = g_shift_down ? '>' : '.'; break;
-        case 0x35: c = g_shift_down ? '?' : '/'; break;
-
-        case 0x39: c = ' '; break; // space
-
-        default: break;
-    }
-
-    if (c && t->input_len < TERM_MAX_COLS - 1) {
+    char c = ev->ch;
+    if (c && c != '\t' && t->input_len < TERM_MAX_COLS - 1) {
         t->input[t->input_len++] = c;
         t->input[t->input_len]   = '\0';
+        t->hist_age = -1;
     }
 }
 
@@ -1311,51 +2392,127 @@ static void term_handle_scancode(uint8_t sc, TerminalState *t,
 
 static int g_start_open = 0;
 static int g_context_menu_open = 0;
-static int g_context_menu_x = 0;
-static int g_context_menu_y = 0;
+static int g_selected_icon = 2;     // dock highlight (Command Block)
 
+// One window per app; 0 while the app is closed.
+#define APP_COUNT 5
+static const char *g_app_titles[APP_COUNT] = {
+    "Settings", "File Block", "Command Block", "Browser", "Extra"
+};
+static Window *g_app_win[APP_COUNT];
 
-// Forward declarations
-static void draw_desktop(int selected_icon, int open_app);
-static void draw_context_menu(int open_app);
+static Window *g_desktop_win = 0;   // background, dock and taskbar
+static Window *g_start_win   = 0;   // Start menu popup
+static Window *g_menu_win    = 0;   // right-click menu popup
 
-// Desktop background â€“ ChromeOS-ish flat gradient
-static void draw_desktop_background(void) {
-    for (uint32_t y = 0; y < g_height; ++y) {
-        uint8_t shade = (uint8_t)(0x20 + (y * 80 / (g_height ? g_height : 1)));
-        uint32_t col = (0x00u << 16) | ((uint32_t)shade << 8) | 0x80u;
-        for (uint32_t x = 0; x < g_width; ++x) {
-            g_fb[(uint64_t)y * g_pitch + x] = col;
-        }
+static uint32_t taskbar_height(void) {
+    uint32_t bar_h = g_height / 12;
+    return bar_h < 40 ? 40 : bar_h;
+}
+
+// ---------------------------------------------------------------------
+// Widget trees
+//
+// The clickable parts of each window, placed by a layout function next to
+// the code that draws them, and only when the window's size changes.
+// Painting reads the rects from here and clicks and hover go through
+// wtree_click() / wtree_hover(), so no geometry is worked out twice.
+// ---------------------------------------------------------------------
+
+#define START_MENU_ITEMS 4          // the first four apps, in app order
+#define MENU_ITEMS       4          // right-click menu; "Close app" last
+#define MENU_ITEM_H      18
+
+// App window frame (widget ids)
+#define UI_TITLE  0
+#define UI_CLOSE  1
+#define UI_GRIP   2
+#define UI_CLIENT 3
+
+static WidgetTree g_desktop_ui;
+static WidgetTree g_start_ui;
+static WidgetTree g_menu_ui;
+static WidgetTree g_app_ui[APP_COUNT];
+static WidgetTree *g_hover_ui;      // tree the pointer was last over
+
+static Widget *g_ui_taskbar, *g_ui_start_button, *g_ui_clock;
+static Widget *g_ui_dock, *g_ui_dock_icons[APP_COUNT];
+static Widget *g_ui_start_items[START_MENU_ITEMS];
+static Widget *g_ui_menu_items[MENU_ITEMS];
+
+typedef struct {
+    Widget *title, *close, *client, *grip;
+    Widget *items[BGA_MAX_MODES];   // Settings: mode buttons; Browser: tabs
+    Widget *page;                   // Browser: the scrolling content
+} AppWidgets;
+
+static AppWidgets g_app_widgets[APP_COUNT];
+
+static void ui_build(void);
+
+// ---------------------------------------------------------------------
+// Desktop layers
+//
+// The static parts of the desktop are rendered once, at boot (and again
+// whenever the resolution changes), and the desktop window is assembled
+// from them with row copies. Only the dock highlight and the clock text are
+// drawn live, and each is refreshed on its own: moving the selection or
+// ticking the clock touches a few hundred pixels, not the whole screen.
+// ---------------------------------------------------------------------
+
+static uint32_t *g_bg_rows;         // gradient: one colour per scanline
+static Surface   g_layer_dock;      // icon column over the gradient, unselected
+static Surface   g_layer_taskbar;   // bar, Start button, wifi, battery; no clock
+static char      g_clock_shown[16]; // time string currently in the taskbar
+
+// Dock column on the left, taskbar along the bottom.
+static void desktop_layout(WidgetTree *t, int32_t w, int32_t h) {
+    (void)t;
+    int32_t icon_w = w / 16;
+    if (icon_w < 40) icon_w = 40;
+    int32_t gap = icon_w / 4;
+
+    for (int i = 0; i < APP_COUNT; ++i) {
+        Rect r = { w / 40, h / 7 + i * (icon_w + gap), icon_w, icon_w };
+        g_ui_dock_icons[i]->r = r;
+    }
+    Rect dock = { w / 40, h / 7, icon_w, APP_COUNT * (icon_w + gap) - gap };
+    g_ui_dock->r = dock;
+
+    int32_t bar_h = (int32_t)taskbar_height();
+    Rect bar   = { 0, h - bar_h, w, bar_h };
+    Rect start = { 8, bar.y + 6, 80, bar_h - 12 };
+    Rect clock = { w - 220, bar.y + 6, 10 * 8, 16 + 8 };    // time over date
+    g_ui_taskbar->r      = bar;
+    g_ui_start_button->r = start;
+    g_ui_clock->r        = clock;
+}
+
+// Desktop background â€“ ChromeOS-ish flat gradient, from the row table
+// (rows of equal colour merge into one fill in the display list).
+static void draw_desktop_background(uint32_t y0, uint32_t w, uint32_t h) {
+    for (uint32_t y = 0; y < h; ++y) {
+        fill_rect(0, y, w, 1, g_bg_rows[y0 + y < g_height ? y0 + y : g_height - 1]);
     }
 }
 
-// Taskbar (bottom bar) with Start, time/date, fake wifi/battery
+// Taskbar (bottom bar) with Start, fake wifi/battery; drawn at 0,0
 static void draw_taskbar(void) {
-    uint32_t bar_h = g_height / 12;
-    if (bar_h < 40) bar_h = 40;
-    uint32_t y = g_height - bar_h;
+    uint32_t bar_h = taskbar_height();
+    uint32_t y = 0;
 
     fill_rect(0, y, g_width, bar_h, 0x202428u);
 
     // Start button (left)
-    uint32_t sx = 8;
-    uint32_t sy = y + 6;
-    uint32_t sw = 80;
-    uint32_t sh = bar_h - 12;
+    Rect start = g_ui_start_button->r;
+    uint32_t sx = (uint32_t)start.x;
+    uint32_t sy = (uint32_t)(start.y - g_ui_taskbar->r.y);
+    uint32_t sw = (uint32_t)start.w;
+    uint32_t sh = (uint32_t)start.h;
     fill_rect(sx, sy, sw, sh, 0x303840u);
     draw_rect_border(sx, sy, sw, sh, 0x505860u);
     draw_text(sx + 8, sy + (sh / 2) - 6, "Start", 0xFFFFFFu, 1);
 
-    // Right side: time/date
-    char tbuf[16], dbuf[16];
-    format_time(tbuf, sizeof(tbuf));
-    format_date(dbuf, sizeof(dbuf));
-
-    uint32_t tx = g_width - 220;
-    draw_text(tx, y + 6, tbuf, 0xFFFFFFu, 1);
-    draw_text(tx, y + 22, dbuf, 0xC0C0C0u, 1);
-
     // Battery icon
     uint32_t bx = g_width - 80;
     uint32_t by = y + 8;
@@ -1373,20 +2530,19 @@ static void draw_taskbar(void) {
     fill_rect(wx + 12, wy +  2, 4, 14, 0xFFFFFFu);
 }
 
-// Dock icons (left vertical strip)
-static void draw_icons_column(int selected_icon) {
-    uint32_t icon_w = g_width / 16;
-    if (icon_w < 40) icon_w = 40;
-    uint32_t icon_h = icon_w;
-    uint32_t gap    = icon_h / 4;
+// Dock icons (left vertical strip), relative to the dock's top-left
+static void draw_icons_column(void) {
+    Rect dock = g_ui_dock->r;
 
-    uint32_t x = g_width / 40;
-    uint32_t y = g_height / 7;
+    for (int i = 0; i < APP_COUNT; ++i) {
+        Rect r = g_ui_dock_icons[i]->r;
+        uint32_t x = (uint32_t)(r.x - dock.x);
+        uint32_t y = (uint32_t)(r.y - dock.y);
+        uint32_t icon_w = (uint32_t)r.w;
+        uint32_t icon_h = (uint32_t)r.h;
 
-    for (int i = 0; i < 5; ++i) {
-        uint32_t col = (i == selected_icon) ? 0xFFFFFFu : 0xAAAAAAu;
         fill_rect(x, y, icon_w, icon_h, 0x252C32u);
-        draw_rect_border(x, y, icon_w, icon_h, col);
+        draw_rect_border(x, y, icon_w, icon_h, 0xAAAAAAu);
 
         uint32_t ix = x + icon_w / 6;
         uint32_t iy = y + icon_h / 6;
@@ -1419,20 +2575,102 @@ static void draw_icons_column(int selected_icon) {
                 draw_text(ix + 4, iy + ih/2 - 4, "App", 0x000000u, 1);
                 break;
         }
+    }
+}
+
+// Renders the static layers for the current resolution.
+static void desktop_layers_build(void) {
+    kfree(g_bg_rows);
+    g_bg_rows = (uint32_t*)kmalloc((size_t)g_height * sizeof(uint32_t));
+    for (uint32_t y = 0; y < g_height; ++y) {
+        uint8_t shade = (uint8_t)(0x20 + (y * 80 / (g_height ? g_height : 1)));
+        g_bg_rows[y] = (0x00u << 16) | ((uint32_t)shade << 8) | 0x80u;
+    }
+
+    wtree_layout(&g_desktop_ui, (int32_t)g_width, (int32_t)g_height);
+    Rect dock = g_ui_dock->r;
+    surface_alloc(&g_layer_dock, (uint32_t)dock.w, (uint32_t)dock.h);
+    gfx_target(&g_layer_dock);
+    draw_desktop_background((uint32_t)dock.y, (uint32_t)dock.w, (uint32_t)dock.h);
+    draw_icons_column();
+
+    Rect bar = g_ui_taskbar->r;
+    surface_alloc(&g_layer_taskbar, (uint32_t)bar.w, (uint32_t)bar.h);
+    gfx_target(&g_layer_taskbar);
+    draw_taskbar();
+    gfx_flush();
+}
 
-        y += icon_h + gap;
+// Wall clock: the boot time (firmware or CMOS) advanced by the monotonic
+// timer, so the RTC is only read once.
+static void format_clock(char *buf, uint32_t max) {
+    uint32_t secs = (uint32_t)g_hour * 3600u + (uint32_t)g_minute * 60u + g_second;
+    secs = (uint32_t)((secs + time_ms() / 1000) % 86400u);
+    if (max < 9) { if (max) buf[0] = '\0'; return; }
+    uint32_t v[3] = { secs / 3600, (secs / 60) % 60, secs % 60 };
+    for (int i = 0; i < 3; ++i) {
+        buf[i * 3]     = (char)('0' + v[i] / 10);
+        buf[i * 3 + 1] = (char)('0' + v[i] % 10);
+        buf[i * 3 + 2] = (i < 2) ? ':' : '\0';
     }
 }
 
-// Start menu
-static void draw_start_menu(void) {
-    if (!g_start_open) return;
-    uint32_t bar_h = g_height / 12;
-    if (bar_h < 40) bar_h = 40;
-    uint32_t h = g_height / 2;
-    uint32_t w = g_width / 3;
-    uint32_t x = 8;
-    uint32_t y = g_height - bar_h - h - 8;
+// The parts of the desktop drawn over the layers.
+static void draw_dock_highlight(void) {
+    Rect r = g_ui_dock_icons[g_selected_icon]->r;
+    draw_rect_border((uint32_t)r.x, (uint32_t)r.y, (uint32_t)r.w, (uint32_t)r.h,
+                     0xFFFFFFu);
+}
+
+static void draw_clock(void) {
+    Rect r = g_ui_clock->r;
+    char dbuf[16];
+    format_clock(g_clock_shown, sizeof(g_clock_shown));
+    format_date(dbuf, sizeof(dbuf));
+    draw_text((uint32_t)r.x, (uint32_t)r.y, g_clock_shown, 0xFFFFFFu, 1);
+    draw_text((uint32_t)r.x, (uint32_t)r.y + 16, dbuf, 0xC0C0C0u, 1);
+}
+
+// Moves the dock highlight: repaints the two icons, not the desktop.
+static void desktop_select_icon(int i) {
+    if (i < 0 || i >= APP_COUNT || i == g_selected_icon) return;
+    wm_invalidate_rect(g_desktop_win, g_ui_dock_icons[g_selected_icon]->r);
+    wm_invalidate_rect(g_desktop_win, g_ui_dock_icons[i]->r);
+    g_selected_icon = i;
+}
+
+// Called from the main loop; redraws the clock when the second changes.
+static void desktop_tick(void) {
+    char now[16];
+    format_clock(now, sizeof(now));
+    if (str_eq(now, g_clock_shown)) return;
+    str_copy(g_clock_shown, now, sizeof(g_clock_shown));
+    wm_invalidate_rect(g_desktop_win, g_ui_clock->r);
+}
+
+// Start menu (drawn into its popup surface)
+static Rect start_menu_rect(void) {
+    Rect r;
+    r.w = (int32_t)(g_width / 3);
+    r.h = (int32_t)(g_height / 2);
+    r.x = 8;
+    r.y = (int32_t)(g_height - taskbar_height()) - r.h - 8;
+    return r;
+}
+
+// One row per app under the "Apps:" heading.
+static void start_menu_layout(WidgetTree *t, int32_t w, int32_t h) {
+    (void)t;
+    (void)h;
+    for (int i = 0; i < START_MENU_ITEMS; ++i) {
+        Rect r = { 12, 40 + i * 16, w - 24, 16 };
+        g_ui_start_items[i]->r = r;
+    }
+}
+
+static void draw_start_menu(uint32_t w, uint32_t h) {
+    uint32_t x = 0;
+    uint32_t y = 0;
 
     fill_rect(x, y, w, h, 0x252C32u);
     draw_rect_border(x, y, w, h, 0xFFFFFFu);
@@ -1440,18 +2678,128 @@ static void draw_start_menu(void) {
     draw_text(x + 8, y + 8, "Start", 0xFFFFFFu, 1);
     draw_text(x + 8, y + 24, "Apps:", 0xC0C0C0u, 1);
 
-    uint32_t ax = x + 16;
-    uint32_t ay = y + 40;
-    draw_text(ax, ay,    "Settings",      0xFFFFFFu, 1);
-    draw_text(ax, ay+16, "File Block",    0xFFFFFFu, 1);
-    draw_text(ax, ay+32, "Command Block", 0xFFFFFFu, 1);
-    draw_text(ax, ay+48, "Browser",       0xFFFFFFu, 1);
+    for (int i = 0; i < START_MENU_ITEMS; ++i) {
+        Rect r = g_ui_start_items[i]->r;
+        if (g_ui_start_items[i]->flags & WG_HOVER) {
+            fill_rect((uint32_t)r.x, (uint32_t)r.y, (uint32_t)r.w, (uint32_t)r.h, 0x3A6EA5u);
+        }
+        draw_text((uint32_t)r.x + 4, (uint32_t)r.y, g_app_titles[i], 0xFFFFFFu, 1);
+    }
 }
 
 // ---------------------------------------------------------------------
 // App windows: Command Block, Settings, File Block, Browser
 // ---------------------------------------------------------------------
 
+// Terminal lines that fit above the prompt in a window win_h tall.
+static uint32_t term_rows(uint32_t title_h, uint32_t win_h) {
+    uint32_t top = title_h + 10;
+    uint32_t rows = win_h > top + 17 ? (win_h - top - 17) / 12 : 0;
+    return rows < TERM_MAX_LINES ? rows : TERM_MAX_LINES;
+}
+
+static uint32_t term_shown(uint32_t title_h, uint32_t win_h) {
+    uint32_t rows = term_rows(title_h, win_h);
+    return g_term.line_count < rows ? g_term.line_count : rows;
+}
+
+// For `more`: how many lines the Command Block window shows.
+static int term_window_rows(void) {
+    const Window *win = g_app_win[2];
+    return win ? (int)term_rows(WM_TITLE_H, (uint32_t)win->r.h) : TERM_MAX_LINES;
+}
+
+// Editor rows in window coordinates: text from the top, then the status
+// bar and the message line at the bottom.
+#define EDIT_LINE_H   12
+#define EDIT_MAX_COLS 256
+
+static Rect edit_row_rect(int32_t w, int32_t h, uint32_t row) {
+    Rect r = { 1, 0, w - 2, EDIT_LINE_H };
+    if (row == EDITOR_ROW_STATUS) {
+        r.y = h - 36;
+        r.h = EDIT_LINE_H + 4;
+    } else if (row == EDITOR_ROW_MESSAGE) {
+        r.y = h - 18;
+    } else {
+        r.y = WM_TITLE_H + 6 + EDIT_LINE_H * (int32_t)row;
+    }
+    return r;
+}
+
+// Sizes the editor to the window the first time it is drawn there. That
+// draw repaints everything, so the rows it marked are already done.
+static void edit_fit(uint32_t w, uint32_t h) {
+    if (w == g_editor_w && h == g_editor_h) return;
+    g_editor_w = w;
+    g_editor_h = h;
+    int32_t text_h = (int32_t)h - 38 - (WM_TITLE_H + 6);
+    uint32_t rows  = text_h > 0 ? (uint32_t)text_h / EDIT_LINE_H : 0;
+    uint32_t cols  = w > 20 ? (w - 20) / 8 : 1;
+    editor_resize(&g_editor, rows, cols < EDIT_MAX_COLS ? cols : EDIT_MAX_COLS - 1);
+    for (uint32_t row = 0; row <= EDITOR_ROW_MESSAGE; ++row) {
+        editor_take_dirty(&g_editor, row);
+    }
+}
+
+// Only the rows inside the area being repainted are built and drawn.
+static void draw_editor(uint32_t win_x, uint32_t win_y,
+                        uint32_t win_w, uint32_t win_h) {
+    const Window *win = g_app_win[2];
+    Rect clip = win ? win->dirty_rect : (Rect){ 0, 0, (int32_t)win_w, (int32_t)win_h };
+    edit_fit(win_w, win_h);
+
+    uint32_t crow, ccol;
+    editor_cursor(&g_editor, &crow, &ccol);
+    char buf[EDIT_MAX_COLS];
+    for (uint32_t row = 0; row <= EDITOR_ROW_MESSAGE; ++row) {
+        if (row == g_editor.rows) row = EDITOR_ROW_STATUS;
+        Rect r = edit_row_rect((int32_t)win_w, (int32_t)win_h, row);
+        if (r.y >= clip.y + clip.h || r.y + r.h <= clip.y) continue;
+
+        editor_row(&g_editor, row, buf, sizeof(buf));
+        uint32_t x = win_x + 10;
+        uint32_t y = win_y + (uint32_t)r.y + 2;
+        uint32_t color = 0xFFFFFFu;
+        if (row == EDITOR_ROW_STATUS) {
+            fill_rect(win_x + (uint32_t)r.x, win_y + (uint32_t)r.y,
+                      (uint32_t)r.w, (uint32_t)r.h, 0xC0C0C0u);
+            color = 0x000000u;
+            y += 2;
+        } else if (row == EDITOR_ROW_MESSAGE) {
+            color = 0x00FF00u;
+        }
+        draw_text(x, y, buf, color, 1);
+
+        if (row == crow && !g_editor.finding) {
+            char under = ccol < str_len(buf) ? buf[ccol] : ' ';
+            fill_rect(x + 8 * ccol, y - 1, 8, 10, 0x00FF00u);
+            draw_text_n(x + 8 * ccol, y, &under, 1, 0x000000u);
+        }
+    }
+}
+
+// Marks the editor rows that changed since the last key: the text rows
+// as one area (usually a line, or a line and everything under it) and the
+// status and message lines apart from it.
+static void edit_invalidate(Window *win) {
+    Rect text  = { 0, 0, 0, 0 };
+    int  any   = 0;
+    for (uint32_t row = 0; row < g_editor.rows; ++row) {
+        if (!editor_take_dirty(&g_editor, row)) continue;
+        Rect r = edit_row_rect(win->r.w, win->r.h, row);
+        if (!any) text = r;
+        text.h = r.y + r.h - text.y;
+        any = 1;
+    }
+    if (any) wm_invalidate_rect(win, text);
+    for (uint32_t row = EDITOR_ROW_STATUS; row <= EDITOR_ROW_MESSAGE; ++row) {
+        if (editor_take_dirty(&g_editor, row)) {
+            wm_invalidate_rect(win, edit_row_rect(win->r.w, win->r.h, row));
+        }
+    }
+}
+
 static void draw_terminal_contents(uint32_t win_x, uint32_t win_y,
                                    uint32_t win_w, uint32_t win_h,
                                    uint32_t title_h) {
@@ -1461,19 +2809,22 @@ static void draw_terminal_contents(uint32_t win_x, uint32_t win_y,
     fill_rect(win_x, win_y + title_h,
               win_w, win_h - title_h, 0x000000u);
 
-    for (uint32_t i = 0; i < g_term.line_count; ++i) {
+    if (g_editor_active) {
+        draw_editor(win_x, win_y, win_w, win_h);
+        return;
+    }
+
+    // The newest lines that fit, with the prompt under them.
+    uint32_t shown = term_shown(title_h, win_h);
+    for (uint32_t i = g_term.line_count - shown; i < g_term.line_count; ++i) {
         draw_text(x, y, g_term.lines[i], 0xFFFFFFu, 1);
         y += 12;
-        if (y + 16 >= win_y + win_h) break;
     }
 
-    if (y + 16 < win_y + win_h) {
-        char prompt[TERM_MAX_COLS];
-        term_print_prompt_path(prompt, sizeof(prompt));
-
+    // A running command owns the keyboard; the prompt comes back after it.
+    if (!shell_busy() && y + 16 < win_y + win_h) {
         char buf[TERM_MAX_COLS];
-        str_copy(buf, prompt, sizeof(buf));
-        str_cat(buf, " ", sizeof(buf));
+        term_print_prompt(&g_term, buf, sizeof(buf));
 
         uint32_t base_len = str_len(buf);
         uint32_t len = g_term.input_len;
@@ -1490,6 +2841,35 @@ static void draw_terminal_contents(uint32_t win_x, uint32_t win_y,
     }
 }
 
+// Where draw_terminal_contents() puts the prompt line, down to the frame.
+// Typing only changes this part of the window.
+static Rect term_input_rect(const Window *win) {
+    int32_t h = win->r.h;
+    int32_t y = WM_TITLE_H + 10 + 12 * (int32_t)term_shown(WM_TITLE_H, (uint32_t)h);
+    Rect r = { 1, y, win->r.w - 2, h - 1 - y };
+    return r;
+}
+
+// Settings > Display: one button per runtime mode, wrapped to the window.
+#define SETTINGS_MODES_Y  102     // below the client area's top edge
+#define SETTINGS_MODE_W   88
+#define SETTINGS_MODE_H   20
+#define SETTINGS_MODE_GAP 6
+
+// Mode buttons flow in rows across the window.
+static void settings_layout(AppWidgets *a, int32_t w) {
+    int32_t cols = (w - 28 + SETTINGS_MODE_GAP) / (SETTINGS_MODE_W + SETTINGS_MODE_GAP);
+    if (cols < 1) cols = 1;
+    for (int i = 0; i < g_mode_count; ++i) {
+        Rect r;
+        r.x = 14 + (i % cols) * (SETTINGS_MODE_W + SETTINGS_MODE_GAP);
+        r.y = WM_TITLE_H + SETTINGS_MODES_Y + (i / cols) * (SETTINGS_MODE_H + SETTINGS_MODE_GAP);
+        r.w = SETTINGS_MODE_W;
+        r.h = SETTINGS_MODE_H;
+        a->items[i]->r = r;
+    }
+}
+
 static void draw_settings_contents(uint32_t win_x, uint32_t win_y,
                                    uint32_t win_w, uint32_t win_h,
                                    uint32_t title_h) {
@@ -1509,32 +2889,7 @@ static void draw_settings_contents(uint32_t win_x, uint32_t win_y,
 
     // Resolution
     char tmp[16];
-    uint32_t w = g_width;
-    uint32_t h = g_height;
-    // Format "WxH" without sprintf
-    int pos = 0;
-    uint32_t div = 1000;
-    int started = 0;
-    while (div > 0 && pos < 4) {
-        char digit = (char)('0' + (w / div) % 10);
-        if (digit != '0' || started || div == 1) {
-            tmp[pos++] = digit;
-            started = 1;
-        }
-        div /= 10;
-    }
-    tmp[pos++] = 'x';
-    div = 1000;
-    started = 0;
-    while (div > 0 && pos < 9) {
-        char digit = (char)('0' + (h / div) % 10);
-        if (digit != '0' || started || div == 1) {
-            tmp[pos++] = digit;
-            started = 1;
-        }
-        div /= 10;
-    }
-    tmp[pos] = '\0';
+    format_mode(tmp, sizeof(tmp), g_width, g_height);
 
     str_copy(buf, "Resolution: ", sizeof(buf));
     str_cat(buf, tmp, sizeof(buf));
@@ -1551,7 +2906,30 @@ static void draw_settings_contents(uint32_t win_x, uint32_t win_y,
     str_cat(buf, " ", sizeof(buf));
     str_cat(buf, tbuf, sizeof(buf));
     draw_text(x + 4, y, buf, 0x000000u, 1);
-    y += 14;
+    y += 22;
+
+    draw_text(x, y, "Display", 0x202020u, 1);
+    y += 16;
+
+    if (!g_mode_count) {
+        draw_text(x + 4, y, "Resolution is chosen at boot:", 0x000000u, 1);
+        draw_text(x + 4, y + 14, "resolution=WxH in \\lightos.cfg", 0x000000u, 1);
+        y += 28;
+    }
+    for (int i = 0; i < g_mode_count; ++i) {
+        Rect r = g_app_widgets[0].items[i]->r;
+        r.x += (int32_t)win_x;
+        r.y += (int32_t)win_y;
+        int current = g_modes[i].width == g_width && g_modes[i].height == g_height;
+        fill_rect((uint32_t)r.x, (uint32_t)r.y, (uint32_t)r.w, (uint32_t)r.h,
+                  current ? 0x3A6EA5u : 0xDADADAu);
+        draw_rect_border((uint32_t)r.x, (uint32_t)r.y, (uint32_t)r.w, (uint32_t)r.h,
+                         0x808080u);
+        format_mode(tmp, sizeof(tmp), g_modes[i].width, g_modes[i].height);
+        draw_text((uint32_t)r.x + 6, (uint32_t)r.y + 6, tmp,
+                  current ? 0xFFFFFFu : 0x000000u, 1);
+        y = (uint32_t)(r.y + r.h + SETTINGS_MODE_GAP);
+    }
 
     draw_text(x, y + 4, "LightOS 4 (demo kernel)", 0x000000u, 1);
 }
@@ -1599,138 +2977,228 @@ static void draw_fileblock_contents(uint32_t win_x, uint32_t win_y,
 }
 
 // ---------------------------------------------------------------------
-// Browser (stub â€“ tabs + address bar + content, no real network yet)
+// Browser (tabs + address bar + content; the Network tab is live HTTP)
 // ---------------------------------------------------------------------
 
+#define BROWSER_LINE_H   12
+#define BROWSER_FOOTER_H 20
+#define BROWSER_TAB_H    20
+#define BROWSER_ADDR_H   16
+
 typedef struct {
-    char title[32];
-    char url[128];
-    char content[512];
+    char     title[32];
+    char     url[128];
+    HtmlDoc *doc;       // parsed page and its cached line layout
+    int      loaded;    // doc holds the page for url (not an error page)
 } BrowserTab;
 
 static BrowserTab g_tabs[3];
 static int        g_active_tab    = 0;
 static int        g_browser_scroll = 0;
+static int        g_browser_visible = 1;   // content rows at the last draw
+
+// Text colour for each HTML_STYLE_*.
+static const uint32_t g_html_colors[] = {
+    0x000000u,  // text
+    0x203080u,  // heading
+    0x0000CCu,  // link
+    0x000000u,  // bold (drawn twice)
+    0x404040u,  // pre
+    0x909090u,  // rule
+};
 
-// Stub net: replace later with real NIC + TCP/IP
-static int net_http_get(const char *url, char *buf, uint32_t max_len) {
-    (void)url;
-    const char *demo =
-        "<html>\n"
-        "<h1>LightOS Browser</h1>\n"
-        "<p>No real network stack yet.</p>\n"
-        "<p>Implement NIC + TCP/IP and replace net_http_get().</p>\n"
-        "</html>\n";
-    str_copy(buf, demo, max_len);
+static void browser_set_page(BrowserTab *tab, const char *html) {
+    html_reset(tab->doc);
+    html_feed(tab->doc, html, str_len(html));
+    html_finish(tab->doc);
+}
+
+static int browser_sink(void *ctx, const uint8_t *data, uint32_t len) {
+    html_feed((HtmlDoc *)ctx, (const char *)data, len);
     return 0;
 }
 
+// Fetches the tab's URL, parsing and laying out the page as the body
+// streams in. The HTTP cache answers repeat loads of a fresh page without a
+// request. Network failures are shown as a page of their own.
+static void browser_load_tab(BrowserTab *tab) {
+    html_reset(tab->doc);
+    int status = net_http_fetch(tab->url, browser_sink, tab->doc);
+    html_finish(tab->doc);
+    tab->loaded = status > 0;
+    if (status > 0) return;    // any HTTP response has a page to show
+
+    char page[512];
+    str_copy(page, "<h1>Could not load page</h1><p>", sizeof(page));
+    str_cat(page, tab->url, sizeof(page));
+    str_cat(page, "</p><p>", sizeof(page));
+    if (status == NET_ENOTSUP) {
+        str_cat(page, "Only http:// URLs are supported.", sizeof(page));
+    } else if (status == NET_ETIMEDOUT) {
+        str_cat(page, "Timed out (is the server running?)", sizeof(page));
+    } else if (status == NET_EREFUSED || status == NET_ERESET) {
+        str_cat(page, "Connection refused.", sizeof(page));
+    } else {
+        str_cat(page, "Network error ", sizeof(page));
+        str_cat_u64(page, (uint64_t)(-status), sizeof(page));
+    }
+    str_cat(page, "</p><p>Serve a page from the host with:</p>"
+                  "<pre>  python3 -m http.server 8000</pre>", sizeof(page));
+    browser_set_page(tab, page);
+}
+
+static void browser_scroll_by(int delta) {
+    int max_scroll = (int)html_line_count(g_tabs[g_active_tab].doc) - g_browser_visible;
+    if (max_scroll < 0) max_scroll = 0;
+    g_browser_scroll += delta;
+    if (g_browser_scroll > max_scroll) g_browser_scroll = max_scroll;
+    if (g_browser_scroll < 0) g_browser_scroll = 0;
+}
+
 static void browser_init(void) {
     g_browser_scroll = 0;
+    for (int i = 0; i < 3; ++i) {
+        g_tabs[i].doc = html_create(80);
+    }
+
     str_copy(g_tabs[0].title, "Home", sizeof(g_tabs[0].title));
     str_copy(g_tabs[0].url,   "https://lightos.local/home", sizeof(g_tabs[0].url));
-    str_copy(g_tabs[0].content,
-             "Welcome to LightOS Browser.\n"
-             "This is a static demo tab.\n",
-             sizeof(g_tabs[0].content));
+    browser_set_page(&g_tabs[0],
+                     "<h1>Welcome to LightOS Browser</h1>"
+                     "<p>This is a static demo tab.</p>");
 
     str_copy(g_tabs[1].title, "Docs", sizeof(g_tabs[1].title));
     str_copy(g_tabs[1].url,   "https://lightos.local/docs", sizeof(g_tabs[1].url));
-    str_copy(g_tabs[1].content,
-             "Documentation is not available yet.\n",
-             sizeof(g_tabs[1].content));
+    browser_set_page(&g_tabs[1],
+                     "<h1>Docs</h1>"
+                     "<p>Documentation is not available yet.</p>");
 
     str_copy(g_tabs[2].title, "Network", sizeof(g_tabs[2].title));
-    str_copy(g_tabs[2].url,   "https://example.com/", sizeof(g_tabs[2].url));
-    char buf[512];
-    net_http_get(g_tabs[2].url, buf, sizeof(buf));
-    str_copy(g_tabs[2].content, buf, sizeof(g_tabs[2].content));
+    // QEMU user networking maps the host to 10.0.2.2.
+    str_copy(g_tabs[2].url,   "http://10.0.2.2:8000/", sizeof(g_tabs[2].url));
+    browser_set_page(&g_tabs[2], "<p>Select this tab to load the page.</p>");
+}
+
+// Tab strip under the title bar, then the address bar, then the page.
+static void browser_layout(AppWidgets *a, int32_t w, int32_t h) {
+    int32_t tab_w = w / 3;
+    for (int i = 0; i < 3; ++i) {
+        Rect r = { i * tab_w, WM_TITLE_H, tab_w, BROWSER_TAB_H };
+        a->items[i]->r = r;
+    }
+    int32_t top = WM_TITLE_H + BROWSER_TAB_H + 4 + BROWSER_ADDR_H + 6;
+    Rect page = { 0, top, w, h - top };
+    a->page->r = page;
 }
 
 static void draw_browser_contents(uint32_t win_x, uint32_t win_y,
                                   uint32_t win_w, uint32_t win_h,
                                   uint32_t title_h) {
-    uint32_t x = win_x;
+    const AppWidgets *a = &g_app_widgets[3];
     uint32_t y = win_y + title_h;
 
     fill_rect(win_x, y, win_w, win_h - title_h, 0xF5F5F5u);
 
     // Tabs
-    uint32_t tab_h = 20;
-    uint32_t tab_w = win_w / 3;
     for (int i = 0; i < 3; ++i) {
-        uint32_t tx = x + i * tab_w;
+        Rect tab = a->items[i]->r;
+        uint32_t tx = win_x + (uint32_t)tab.x;
+        uint32_t ty = win_y + (uint32_t)tab.y;
         uint32_t col_bg = (i == g_active_tab) ? 0xFFFFFFu : 0xD0D0D0u;
         uint32_t col_bd = 0x808080u;
-        fill_rect(tx, y, tab_w, tab_h, col_bg);
-        draw_rect_border(tx, y, tab_w, tab_h, col_bd);
-        draw_text(tx + 6, y + 4, g_tabs[i].title, 0x000000u, 1);
+        fill_rect(tx, ty, (uint32_t)tab.w, (uint32_t)tab.h, col_bg);
+        draw_rect_border(tx, ty, (uint32_t)tab.w, (uint32_t)tab.h, col_bd);
+        draw_text(tx + 6, ty + 4, g_tabs[i].title, 0x000000u, 1);
     }
-    y += tab_h + 4;
+    y += BROWSER_TAB_H + 4;
 
     // Address bar
-    uint32_t addr_h = 16;
     uint32_t addr_x = win_x + 10;
     uint32_t addr_w = win_w - 20;
-    fill_rect(addr_x, y, addr_w, addr_h, 0xFFFFFFu);
-    draw_rect_border(addr_x, y, addr_w, addr_h, 0xA0A0A0u);
+    fill_rect(addr_x, y, addr_w, BROWSER_ADDR_H, 0xFFFFFFu);
+    draw_rect_border(addr_x, y, addr_w, BROWSER_ADDR_H, 0xA0A0A0u);
     draw_text(addr_x + 4, y + 2, g_tabs[g_active_tab].url, 0x000000u, 1);
-    y += addr_h + 6;
-
-    // Content (scrollable via g_browser_scroll)
-    char buf[512];
-    str_copy(buf, g_tabs[g_active_tab].content, sizeof(buf));
-    uint32_t cx = win_x + 10;
-    uint32_t cy = y;
-
-    // Skip lines according to scroll offset
-    char *p = buf;
-    int skip = g_browser_scroll;
-    while (*p && skip > 0) {
-        while (*p && *p != '\n') ++p;
-        if (*p == '\n') {
-            ++p;
+    y = win_y + (uint32_t)a->page->r.y;
+
+    // Content: the page is already laid out, so a frame only walks the
+    // lines that are on screen, whatever the page size or scroll offset.
+    HtmlDoc *doc = g_tabs[g_active_tab].doc;
+    html_set_width(doc, (win_w - 20) / 8);
+
+    uint32_t content_bottom = win_y + win_h - BROWSER_FOOTER_H;
+    g_browser_visible = (int)((content_bottom - y) / BROWSER_LINE_H);
+    if (g_browser_visible < 1) g_browser_visible = 1;
+    browser_scroll_by(0);
+
+    uint32_t total = html_line_count(doc);
+    uint32_t cy    = y;
+    for (uint32_t line = (uint32_t)g_browser_scroll;
+         line < total && cy + BROWSER_LINE_H <= content_bottom;
+         ++line, cy += BROWSER_LINE_H) {
+        const HtmlRun *runs;
+        uint32_t n = html_line_runs(doc, line, &runs);
+        for (uint32_t r = 0; r < n; ++r) {
+            const char *text  = html_run_text(doc, &runs[r]);
+            uint32_t    rx    = win_x + 10 + runs[r].col * 8u;
+            uint32_t    color = g_html_colors[runs[r].style];
+            draw_text_n(rx, cy, text, runs[r].len, color);
+            if (runs[r].style == HTML_STYLE_BOLD || runs[r].style == HTML_STYLE_HEADING) {
+                draw_text_n(rx + 1, cy, text, runs[r].len, color);
+            }
         }
-        --skip;
     }
 
-    while (*p && cy + 12 < win_y + win_h) {
-        char *line = p;
-        while (*p && *p != '\n') ++p;
-        char saved = *p;
-        *p = '\0';
-        draw_text(cx, cy, line, 0x000000u, 1);
-        if (saved == '\n') {
-            *p = saved;
-            ++p;
-        }
-        cy += 12;
-    }
+    // Footer: page title and position.
+    char status[TERM_MAX_COLS];
+    str_copy(status, html_title(doc), sizeof(status));
+    if (status[0]) str_cat(status, "  ", sizeof(status));
+    str_cat(status, "line ", sizeof(status));
+    str_cat_u64(status, total ? (uint64_t)g_browser_scroll + 1 : 0, sizeof(status));
+    str_cat(status, "/", sizeof(status));
+    str_cat_u64(status, total, sizeof(status));
+    draw_text(win_x + 10, win_y + win_h - 16, status, 0x808080u, 1);
+}
 
-    draw_text(win_x + 10, win_y + win_h - 16,
-              "NOTE: Real internet requires NIC + TCP/IP driver.",
-              0x808080u, 1);
+// Frame parts, where wm_hit() expects them, then the app's own controls.
+static void app_layout(WidgetTree *t, int32_t w, int32_t h) {
+    AppWidgets *a = &g_app_widgets[t->owner];
+    Rect title  = { 0, 0, w, WM_TITLE_H };
+    Rect close  = { w - 20, 4, WM_CLOSE_SZ, WM_CLOSE_SZ };
+    Rect client = { 0, WM_TITLE_H, w, h - WM_TITLE_H };
+    Rect grip   = { w - WM_GRIP_SZ, h - WM_GRIP_SZ, WM_GRIP_SZ, WM_GRIP_SZ };
+    a->title->r  = title;
+    a->close->r  = close;
+    a->client->r = client;
+    a->grip->r   = grip;
+
+    if (t->owner == 0) {
+        settings_layout(a, w);
+    } else if (t->owner == 3) {
+        browser_layout(a, w, h);
+    }
 }
 
-// Generic window wrapper
+// Generic window wrapper: frame, title bar, close box and resize grip
+// around the app contents. Drawn in surface coordinates.
 static void draw_window(uint32_t win_x, uint32_t win_y,
                         uint32_t win_w, uint32_t win_h,
-                        const char *title, int open_app) {
-    uint32_t title_h = 24;
+                        const char *title, int app, int focused) {
+    uint32_t title_h = WM_TITLE_H;
 
     fill_rect(win_x, win_y, win_w, win_h, 0x202020u);
     draw_rect_border(win_x, win_y, win_w, win_h, 0x000000u);
 
     // Title bar
-    fill_rect(win_x, win_y, win_w, title_h, 0x303840u);
-    draw_text(win_x + 8, win_y + 6, title, 0xFFFFFFu, 1);
+    fill_rect(win_x, win_y, win_w, title_h, focused ? 0x303840u : 0x585E64u);
+    draw_text(win_x + 8, win_y + 6, title, focused ? 0xFFFFFFu : 0xC0C0C0u, 1);
 
-    // (Close button â€“ not wired)
-    uint32_t bx = win_x + win_w - 20;
-    uint32_t by = win_y + 4;
-    fill_rect(bx, by, 14, 14, 0xAA0000u);
+    // Close button
+    const AppWidgets *a = &g_app_widgets[app];
+    Rect close = a->close->r;
+    fill_rect(win_x + (uint32_t)close.x, win_y + (uint32_t)close.y,
+              (uint32_t)close.w, (uint32_t)close.h, 0xAA0000u);
 
-    switch (open_app) {
+    switch (app) {
         case 0: // Settings
             draw_settings_contents(win_x, win_y, win_w, win_h, title_h);
             break;
@@ -1750,416 +3218,482 @@ static void draw_window(uint32_t win_x, uint32_t win_y,
                       "Extra app placeholder.", 0xFFFFFFu, 1);
             break;
     }
+
+    // Resize grip (bottom-right corner)
+    uint32_t gx = win_x + (uint32_t)a->grip->r.x;
+    uint32_t gy = win_y + (uint32_t)a->grip->r.y;
+    for (uint32_t i = 2; i < WM_GRIP_SZ; i += 4) {
+        for (uint32_t j = i; j < WM_GRIP_SZ; ++j) {
+            put_pixel(gx + j, gy + WM_GRIP_SZ - 1 - (j - i), 0x808080u);
+        }
+    }
 }
 
-static void draw_context_menu(int open_app) {
-    if (!g_context_menu_open) return;
+// ---------------------------------------------------------------------
+// Right-click menu
+// ---------------------------------------------------------------------
 
-    int item_count = 3; // Settings, Command Block, About
-    if (open_app >= 0) {
-        item_count += 1; // "Close app" when something is open
-    }
+static int app_focused(void);
 
-    if (item_count <= 0) return;
+static int context_menu_items(void) {
+    // Settings, Command Block, About, plus "Close app" when one is focused
+    return app_focused() >= 0 ? 4 : 3;
+}
 
-    uint32_t w = 200;
-    uint32_t h = (uint32_t)item_count * 18 + 8;
+// Menu at (x, y), kept fully on-screen.
+static Rect context_menu_rect(int x, int y) {
+    Rect r;
+    r.w = 200;
+    r.h = context_menu_items() * MENU_ITEM_H + 8;
+    r.x = x;
+    r.y = y;
+    if (r.x + r.w > (int32_t)g_width)  r.x = (int32_t)g_width  - r.w;
+    if (r.y + r.h > (int32_t)g_height) r.y = (int32_t)g_height - r.h;
+    if (r.x < 0) r.x = 0;
+    if (r.y < 0) r.y = 0;
+    return r;
+}
 
-    int mx = g_context_menu_x;
-    int my = g_context_menu_y;
+static const char *g_menu_labels[MENU_ITEMS] = {
+    "Open Settings", "Open Command Block", "About LightOS 4", "Close app"
+};
 
-    // Keep menu fully on-screen
-    if (mx < 0) mx = 0;
-    if (my < 0) my = 0;
-    if ((uint32_t)(mx + (int)w) > g_width) {
-        mx = (int)g_width - (int)w;
-        if (mx < 0) mx = 0;
+static void context_menu_layout(WidgetTree *t, int32_t w, int32_t h) {
+    (void)t;
+    (void)h;
+    for (int i = 0; i < MENU_ITEMS; ++i) {
+        Rect r = { 2, 4 + i * MENU_ITEM_H, w - 4, MENU_ITEM_H };
+        g_ui_menu_items[i]->r = r;
+        widget_show(g_ui_menu_items[i], i < context_menu_items());
     }
-    if ((uint32_t)(my + (int)h) > g_height) {
-        my = (int)g_height - (int)h;
-        if (my < 0) my = 0;
+}
+
+static void draw_context_menu(uint32_t w, uint32_t h) {
+    fill_rect(0, 0, w, h, 0x202020u);
+    draw_rect_border(0, 0, w, h, 0xFFFFFFu);
+
+    for (int i = 0; i < MENU_ITEMS; ++i) {
+        const Widget *item = g_ui_menu_items[i];
+        if (item->flags & WG_HIDDEN) continue;
+        if (item->flags & WG_HOVER) {
+            fill_rect((uint32_t)item->r.x, (uint32_t)item->r.y,
+                      (uint32_t)item->r.w, (uint32_t)item->r.h, 0x3A6EA5u);
+        }
+        draw_text(6, (uint32_t)item->r.y, g_menu_labels[i], 0xFFFFFFu, 1);
     }
+}
 
-    // Background + border
-    fill_rect((uint32_t)mx, (uint32_t)my, w, h, 0x202020u);
-    draw_rect_border((uint32_t)mx, (uint32_t)my, w, h, 0xFFFFFFu);
+// ---------------------------------------------------------------------
+// Windows: paint callbacks and app open/close/focus
+// ---------------------------------------------------------------------
 
-    int cy = my + 4;
-    draw_text((uint32_t)mx + 6, (uint32_t)cy, "Open Settings", 0xFFFFFFu, 1);
-    cy += 18;
-    draw_text((uint32_t)mx + 6, (uint32_t)cy, "Open Command Block", 0xFFFFFFu, 1);
-    cy += 18;
-    draw_text((uint32_t)mx + 6, (uint32_t)cy, "About LightOS 4", 0xFFFFFFu, 1);
-    cy += 18;
+// The widget tree of win, laid out for the window's current size.
+static WidgetTree *window_ui(const Window *win) {
+    WidgetTree *t = 0;
+    if (win == g_desktop_win) {
+        t = &g_desktop_ui;
+    } else if (win == g_start_win) {
+        t = &g_start_ui;
+    } else if (win == g_menu_win) {
+        t = &g_menu_ui;
+    } else if (win && win->id >= 0 && win->id < APP_COUNT) {
+        t = &g_app_ui[win->id];
+    }
+    if (t) wtree_layout(t, win->r.w, win->r.h);
+    return t;
+}
 
-    if (open_app >= 0) {
-        draw_text((uint32_t)mx + 6, (uint32_t)cy, "Close app", 0xFFFFFFu, 1);
-    }
+// Background rows, then the cached dock and taskbar, then the live parts.
+// Only the dirty part is rasterized: for a clock tick that is the clock's
+// corner of the taskbar blit plus the text.
+static void paint_desktop(Window *win) {
+    gfx_target_window(win);
+    draw_desktop_background(0, win->surface.w, win->surface.h);
+
+    Rect dock = g_ui_dock->r;
+    Rect bar  = g_ui_taskbar->r;
+    Rect all  = { 0, 0, dock.w, dock.h };
+    blit(dock.x, dock.y, &g_layer_dock, all);
+    all.w = bar.w;
+    all.h = bar.h;
+    blit(bar.x, bar.y, &g_layer_taskbar, all);
+
+    draw_dock_highlight();
+    draw_clock();
+    gfx_flush();
 }
 
-static void draw_desktop(int selected_icon, int open_app) {
-    cursor_invalidate();
-    draw_desktop_background();
-    draw_taskbar();
-    draw_icons_column(selected_icon);
-    draw_start_menu();
-    if (g_context_menu_open) {
-        draw_context_menu(open_app);
-    }
+static void paint_start_menu(Window *win) {
+    window_ui(win);
+    gfx_target_window(win);
+    draw_start_menu(win->surface.w, win->surface.h);
+    gfx_flush();
+}
 
-    if (open_app >= 0) {
-        uint32_t win_w = g_width * 3 / 5;
-        uint32_t win_h = g_height * 3 / 5;
-        uint32_t win_x = (g_width  - win_w) / 2;
-        uint32_t win_y = (g_height - win_h) / 2 - g_height / 20;
-        if (win_y < 10) win_y = 10;
+static void paint_context_menu(Window *win) {
+    window_ui(win);
+    gfx_target_window(win);
+    draw_context_menu(win->surface.w, win->surface.h);
+    gfx_flush();
+}
 
-        const char *title = "App";
-        switch (open_app) {
-            case 0: title = "Settings";      break;
-            case 1: title = "File Block";    break;
-            case 2: title = "Command Block"; break;
-            case 3: title = "Browser";       break;
-            case 4: title = "Extra";         break;
-        }
+static void paint_app(Window *win) {
+    window_ui(win);
+    gfx_target_window(win);
+    draw_window(0, 0, win->surface.w, win->surface.h,
+                g_app_titles[win->id], win->id, win == wm_top());
+    gfx_flush();
+}
 
-        draw_window(win_x, win_y, win_w, win_h, title, open_app);
+// Everything on screen changed style (e.g. the UI font): re-render the
+// cached layers and repaint every window.
+static void desktop_refresh(void) {
+    desktop_layers_build();
+    for (int z = 0; z < wm_window_count(); ++z) {
+        wm_invalidate(wm_window(z));
     }
-
-    // Cursor on top of everything
-    draw_mouse_cursor();
 }
 
+static void desktop_init(void) {
+    if (wm_init(g_fb, g_width, g_height, g_pitch) < 0) {
+        // Nothing could be composed: say so on the framebuffer and stop.
+        fill_rect(0, 0, g_width, g_height, 0x001020u);
+        draw_text(16, 16, "No memory for the screen's back buffer.", 0xFFFFFFu, 1);
+        gfx_flush();
+        for (;;) __asm__ volatile("cli; hlt");
+    }
+    ui_build();
+    desktop_layers_build();
+    cursor_init();
+
+    Rect full = { 0, 0, (int32_t)g_width, (int32_t)g_height };
+    g_desktop_win = wm_create(full, WIN_DESKTOP | WIN_VISIBLE, -1, paint_desktop);
+    g_start_win   = wm_create(start_menu_rect(), WIN_POPUP, -1, paint_start_menu);
+    g_menu_win    = wm_create(context_menu_rect(0, 0), WIN_POPUP, -1, paint_context_menu);
+}
 
+static int app_focused(void) {
+    Window *top = wm_top();
+    return top ? top->id : -1;
+}
 
+static void app_redraw(int app) {
+    if (app >= 0 && app < APP_COUNT) wm_invalidate(g_app_win[app]);
+}
 
-static void draw_command_block_window(int selected_icon, int open_app) {
-    (void)selected_icon; // currently unused
+// Raise an open app's window; both it and the window that loses focus
+// repaint their title bars.
+static void app_focus(int app) {
+    Window *old = wm_top();
+    Window *win = g_app_win[app];
+    if (!win || old == win) return;
+    wm_raise(win);
+    wm_invalidate(win);
+    wm_invalidate(old);
+}
 
-    if (open_app != 2) {
-        // Only Command Block uses the text terminal window.
+static void app_open(int app) {
+    if (app < 0 || app >= APP_COUNT) return;
+    desktop_select_icon(app);
+    if (g_app_win[app]) {
+        app_focus(app);
         return;
     }
 
-    // We are about to redraw only the Command Block client area, so discard any
-    // saved cursor background from the previous frame.
-    cursor_invalidate();
-
-    uint32_t win_w = g_width * 3 / 5;
-    uint32_t win_h = g_height * 3 / 5;
-    uint32_t win_x = (g_width  - win_w) / 2;
-    uint32_t win_y = (g_height - win_h) / 2 - g_height / 20;
-    if (win_y < 10) win_y = 10;
-
-    // The window frame/title bar/close button are drawn by draw_desktop()
-    // when the app is opened. For normal typing we only need to redraw the
-    // terminal contents to avoid repainting the whole desktop every keypress.
-    const uint32_t title_h = 24; // must stay in sync with draw_window().
-    draw_terminal_contents(win_x, win_y, win_w, win_h, title_h);
+    // New windows cascade from the centre so they don't stack exactly.
+    int open = 0;
+    for (int i = 0; i < APP_COUNT; ++i) {
+        if (g_app_win[i]) open++;
+    }
+    Rect r;
+    r.w = (int32_t)(g_width * 3 / 5);
+    r.h = (int32_t)(g_height * 3 / 5);
+    r.x = ((int32_t)g_width - r.w) / 2 + open * 24;
+    r.y = ((int32_t)g_height - r.h) / 2 - (int32_t)(g_height / 20) + open * 24;
+    if (r.y < 10) r.y = 10;
 
-    // Cursor on top of everything
-    draw_mouse_cursor();
+    Window *old = wm_top();
+    g_app_win[app] = wm_create(r, WIN_VISIBLE | WIN_FRAMED, app, paint_app);
+    wm_invalidate(old);
+    if (app == 2) term_reset(&g_term);
 }
 
-// ---------------------------------------------------------------------
-// Mouse â†’ UI hit-testing (icons, Start menu, windows, browser)
-// ---------------------------------------------------------------------
+static void app_close(int app) {
+    if (app < 0 || app >= APP_COUNT || !g_app_win[app]) return;
+    wm_destroy(g_app_win[app]);
+    g_app_win[app] = 0;
+    wm_invalidate(wm_top());    // new focus
+}
 
-static void handle_browser_click(uint32_t win_x, uint32_t win_y,
-                                 uint32_t win_w, uint32_t win_h,
-                                 int mouse_x, int mouse_y,
-                                 int left, int right,
-                                 int *need_redraw) {
-    (void)right;
-    if (!left) return;
-
-    uint32_t title_h = 24;
-
-    // Tab bar geometry
-    uint32_t tab_h = 20;
-    uint32_t tab_w = win_w / 3;
-    uint32_t tab_y = win_y + title_h;
-
-    if ((uint32_t)mouse_y >= tab_y && (uint32_t)mouse_y < tab_y + tab_h) {
-        for (int i = 0; i < 3; ++i) {
-            uint32_t tx = win_x + (uint32_t)i * tab_w;
-            if ((uint32_t)mouse_x >= tx && (uint32_t)mouse_x < tx + tab_w) {
-                g_active_tab = i;
-                g_browser_scroll = 0;
-                if (need_redraw) *need_redraw = 1;
-                return;
-            }
-        }
-    }
+static void start_menu_show(int open) {
+    g_start_open = open;
+    if (!open) wtree_hover(&g_start_ui, -1, -1);
+    wm_show(g_start_win, open);
+}
 
-    // Content area geometry
-    uint32_t addr_h = 16;
-    uint32_t y_addr = tab_y + tab_h + 4;
-    uint32_t content_top    = y_addr + addr_h + 6;
-    uint32_t content_bottom = win_y + win_h;
-    if ((uint32_t)mouse_y < content_top || (uint32_t)mouse_y >= content_bottom) {
-        return;
+static void context_menu_show(int open, int x, int y) {
+    g_context_menu_open = open;
+    if (open) {
+        Rect r = context_menu_rect(x, y);
+        wm_resize(g_menu_win, r.w, r.h);
+        wm_move(g_menu_win, r.x, r.y);
+        wm_invalidate(g_menu_win);
+        wm_raise(g_menu_win);
+    } else {
+        wtree_hover(&g_menu_ui, -1, -1);
     }
+    wm_show(g_menu_win, open);
+}
 
-    // Compute how many lines exist in the active tab
-    const char *content = g_tabs[g_active_tab].content;
-    int total_lines = 0;
-    for (const char *p = content; *p; ++p) {
-        if (*p == '\n') {
-            total_lines++;
-        }
+// Switches the screen to width x height. The desktop and its cached layers
+// are rebuilt for the new size and app windows are pulled back on screen.
+static int display_set_mode(uint32_t width, uint32_t height) {
+    uint32_t pitch;
+    if (!g_mode_count || bga_set_mode(width, height, &pitch) < 0) return -1;
+    if (wm_set_screen(g_fb, width, height, pitch) < 0) {
+        // No back buffer that big: stay as we were, and repaint what the
+        // switch wiped.
+        bga_set_mode(g_width, g_height, &pitch);
+        desktop_refresh();
+        return -1;
     }
-    total_lines++; // last line
 
-    int visible_lines = (int)((content_bottom - content_top) / 12);
-    if (visible_lines < 1) visible_lines = 1;
+    g_width  = width;
+    g_height = height;
+    g_pitch  = pitch;
+    gfx_target(0);
 
-    int max_scroll = total_lines - visible_lines;
-    if (max_scroll < 0) max_scroll = 0;
+    wm_resize(g_desktop_win, (int32_t)g_width, (int32_t)g_height);
+    Rect sm = start_menu_rect();
+    wm_resize(g_start_win, sm.w, sm.h);
+    wm_move(g_start_win, sm.x, sm.y);
+    context_menu_show(0, 0, 0);
 
-    int mid = (int)(content_top + content_bottom) / 2;
-    if (mouse_y < mid) {
-        g_browser_scroll -= 3;
-    } else {
-        g_browser_scroll += 3;
-    }
-    if (g_browser_scroll < 0) g_browser_scroll = 0;
-    if (g_browser_scroll > max_scroll) g_browser_scroll = max_scroll;
+    if ((uint32_t)g_mouse.x >= g_width)  g_mouse.x = (int32_t)g_width - 1;
+    if ((uint32_t)g_mouse.y >= g_height) g_mouse.y = (int32_t)g_height - 1;
+    wm_cursor_move(g_mouse.x, g_mouse.y);
 
-    if (need_redraw) *need_redraw = 1;
+    desktop_refresh();
+    return 0;
 }
 
-static void handle_mouse_click(int mouse_x, int mouse_y,
-                               int left, int right,
-                               int *selected_icon, int *open_app,
-                               int *need_redraw) {
-    if (!selected_icon || !open_app) return;
-
-    int handled = 0;
+// ---------------------------------------------------------------------
+// Mouse â†’ UI: widget event handlers (menus, windows, dock, browser)
+// ---------------------------------------------------------------------
 
-    // Taskbar geometry
-    uint32_t bar_h = g_height / 12;
-    if (bar_h < 40) bar_h = 40;
-    uint32_t tb_y = g_height - bar_h;
-
-    // If a context menu is open, handle clicks there first.
-    if (g_context_menu_open && (left || right)) {
-        int item_count = 3;
-        if (*open_app >= 0) item_count += 1;
-
-        uint32_t w = 200;
-        uint32_t h = (uint32_t)item_count * 18 + 8;
-
-        int mx = g_context_menu_x;
-        int my = g_context_menu_y;
-
-        if (mx < 0) mx = 0;
-        if (my < 0) my = 0;
-        if ((uint32_t)(mx + (int)w) > g_width) {
-            mx = (int)g_width - (int)w;
-            if (mx < 0) mx = 0;
-        }
-        if ((uint32_t)(my + (int)h) > g_height) {
-            my = (int)g_height - (int)h;
-            if (my < 0) my = 0;
-        }
-
-        if ((uint32_t)mouse_x >= (uint32_t)mx &&
-            (uint32_t)mouse_x <  (uint32_t)(mx + (int)w) &&
-            (uint32_t)mouse_y >= (uint32_t)my &&
-            (uint32_t)mouse_y <  (uint32_t)(my + (int)h)) {
-
-            if (left) {
-                int cy = my + 4;
-                int index = -1;
-                for (int i = 0; i < item_count; ++i) {
-                    if (mouse_y >= cy && mouse_y < cy + 18) {
-                        index = i;
-                        break;
-                    }
-                    cy += 18;
-                }
+// Desktop background and taskbar: a click there closes the Start menu.
+static int on_desktop(Widget *w, int event, int32_t x, int32_t y) {
+    (void)w; (void)x; (void)y;
+    if (event != WG_CLICK) return 0;
+    start_menu_show(0);
+    return 1;
+}
 
-                if (index == 0) {
-                    // Open Settings
-                    *selected_icon = 0;
-                    *open_app      = 0;
-                    handled        = 1;
-                } else if (index == 1) {
-                    // Open Command Block
-                    *selected_icon = 2;
-                    *open_app      = 2;
-                    term_reset(&g_term);
-                    handled = 1;
-                } else if (index == 2) {
-                    // About: show a short line in Command Block
-                    if (*open_app != 2) {
-                        *selected_icon = 2;
-                        *open_app      = 2;
-                        term_reset(&g_term);
-                    }
-                    term_add_line(&g_term, "LightOS 4 demo desktop kernel.");
-                    handled = 1;
-                } else if (index == 3 && *open_app >= 0) {
-                    // Close whatever app is open
-                    *open_app = -1;
-                    handled   = 1;
-                }
-            }
+static int on_start_button(Widget *w, int event, int32_t x, int32_t y) {
+    (void)w; (void)x; (void)y;
+    if (event != WG_CLICK) return 0;
+    start_menu_show(!g_start_open);
+    return 1;
+}
 
-            g_context_menu_open = 0;
-            if (need_redraw) *need_redraw = 1;
-            if (handled) return;
-        } else {
-            // Click outside context menu closes it and falls through to normal handling.
-            g_context_menu_open = 0;
-            if (need_redraw) *need_redraw = 1;
-        }
-    }
+static int on_dock_icon(Widget *w, int event, int32_t x, int32_t y) {
+    (void)x; (void)y;
+    if (event != WG_CLICK) return 0;
+    start_menu_show(0);
+    app_open(w->id);
+    return 1;
+}
 
-    // Right-click anywhere on the desktop opens the context menu.
-    if (right && !left) {
-        g_context_menu_open = 1;
-        g_context_menu_x = mouse_x;
-        g_context_menu_y = mouse_y;
-        if (need_redraw) *need_redraw = 1;
-        return;
+// Start menu rows are in app order. Clicks elsewhere in the menu fall
+// through to its root, which ignores them: the menu stays open.
+static int on_start_item(Widget *w, int event, int32_t x, int32_t y) {
+    (void)x; (void)y;
+    if (event == WG_CLICK) {
+        start_menu_show(0);
+        app_open(w->id);
+    } else {
+        wm_invalidate_rect(g_start_win, w->r);
     }
+    return 1;
+}
 
-    // Start button bounds
-    uint32_t sx = 8;
-    uint32_t sy = tb_y + 6;
-    uint32_t sw = 80;
-    uint32_t sh = bar_h - 12;
-
-    if (left &&
-        (uint32_t)mouse_x >= sx && (uint32_t)mouse_x < sx + sw &&
-        (uint32_t)mouse_y >= sy && (uint32_t)mouse_y < sy + sh) {
-        g_start_open = !g_start_open;
-        if (need_redraw) *need_redraw = 1;
-        return;
+static int on_menu_item(Widget *w, int event, int32_t x, int32_t y) {
+    (void)x; (void)y;
+    if (event != WG_CLICK) {
+        wm_invalidate_rect(g_menu_win, w->r);
+        return 1;
+    }
+    int focused = app_focused();
+    context_menu_show(0, 0, 0);
+
+    if (w->id == 0) {
+        app_open(0);
+    } else if (w->id == 1) {
+        app_open(2);
+    } else if (w->id == 2) {
+        // About: show a short line in Command Block
+        app_open(2);
+        term_add_line(&g_term, "LightOS 4 demo desktop kernel.");
+        app_redraw(2);
+    } else if (w->id == 3) {
+        app_close(focused);
     }
+    return 1;
+}
 
-    // Start menu geometry
-    if (g_start_open) {
-        uint32_t h = g_height / 2;
-        uint32_t w = g_width / 3;
-        uint32_t mx = 8;
-        uint32_t my = g_height - bar_h - h - 8;
-
-        if ((uint32_t)mouse_x >= mx && (uint32_t)mouse_x < mx + w &&
-            (uint32_t)mouse_y >= my && (uint32_t)mouse_y < my + h) {
-
-            uint32_t ax = mx + 16;
-            uint32_t ay = my + 40;
-            uint32_t item_h = 20;
-
-            // For now just one visible item: Command Block
-            if (left &&
-                (uint32_t)mouse_x >= ax && (uint32_t)mouse_x < ax + w - 32 &&
-                (uint32_t)mouse_y >= ay && (uint32_t)mouse_y < ay + item_h) {
-                *selected_icon = 2;
-                *open_app      = 2;
-                term_reset(&g_term);
-                g_start_open = 0;
-                handled = 1;
-                if (need_redraw) *need_redraw = 1;
-                return;
-            }
+// Title bar, close box and resize grip of an app window.
+static int on_app_frame(Widget *w, int event, int32_t x, int32_t y) {
+    int app = w->tree->owner;
+    Window *win = g_app_win[app];
+    if (event != WG_CLICK || !win) return 0;
 
-            handled = 1; // click inside menu but not on an item; keep it open
-        } else {
-            // Click outside the menu â†’ close it
-            g_start_open = 0;
-            if (need_redraw) *need_redraw = 1;
-        }
+    if (w->id == UI_CLOSE) {
+        app_close(app);
+    } else {
+        wm_drag_begin(win, w->id == UI_GRIP ? WM_HIT_GRIP : WM_HIT_TITLE,
+                      win->r.x + x, win->r.y + y);
     }
+    return 1;
+}
 
-    if (!handled) {
-        g_start_open = 0; // any non-start click closes the menu
-        g_context_menu_open = 0;
-    }
+static int on_settings_mode(Widget *w, int event, int32_t x, int32_t y) {
+    (void)x; (void)y;
+    if (event != WG_CLICK) return 0;
+    display_set_mode(g_modes[w->id].width, g_modes[w->id].height);
+    return 1;
+}
 
-    // Dock icons (left column)
-    if (left) {
-        uint32_t icon_w = g_width / 16;
-        if (icon_w < 40) icon_w = 40;
-        uint32_t icon_h = icon_w;
-        uint32_t gap    = icon_h / 4;
+static int on_browser_tab(Widget *w, int event, int32_t x, int32_t y) {
+    (void)x; (void)y;
+    if (event != WG_CLICK) return 0;
+    // Switching tabs just shows the page already laid out; the live
+    // Network tab is fetched the first time it is shown (or after a
+    // failure), and clicking it again reloads.
+    int i = w->id;
+    if (i == 2 && (!g_tabs[i].loaded || g_active_tab == i)) {
+        browser_load_tab(&g_tabs[i]);
+        g_browser_scroll = 0;
+    }
+    if (g_active_tab != i) g_browser_scroll = 0;
+    g_active_tab = i;
+    app_redraw(3);
+    return 1;
+}
 
-        uint32_t x = g_width / 40;
-        uint32_t y = g_height / 7;
+// Upper half of the page scrolls up, lower half down.
+static int on_browser_page(Widget *w, int event, int32_t x, int32_t y) {
+    (void)x;
+    if (event != WG_CLICK) return 0;
+    browser_scroll_by(y < w->r.y + w->r.h / 2 ? -3 : 3);
+    app_redraw(3);
+    return 1;
+}
 
-        for (int i = 0; i < 5; ++i) {
-            if ((uint32_t)mouse_x >= x && (uint32_t)mouse_x < x + icon_w &&
-                (uint32_t)mouse_y >= y && (uint32_t)mouse_y < y + icon_h) {
-                *selected_icon = i;
-                *open_app      = i;
-                if (*open_app == 2) {
-                    term_reset(&g_term);
-                }
-                if (need_redraw) *need_redraw = 1;
-                return;
+// Builds the widget trees; the layout functions place them.
+static void ui_build(void) {
+    wtree_init(&g_desktop_ui, 5 + APP_COUNT, desktop_layout, -1);
+    g_desktop_ui.root->on_event = on_desktop;
+    g_ui_dock = wtree_add(&g_desktop_ui, 0, -1, 0, 0);
+    for (int i = 0; i < APP_COUNT; ++i) {
+        g_ui_dock_icons[i] = wtree_add(&g_desktop_ui, g_ui_dock, i, 0, on_dock_icon);
+    }
+    g_ui_taskbar      = wtree_add(&g_desktop_ui, 0, -1, 0, 0);
+    g_ui_start_button = wtree_add(&g_desktop_ui, g_ui_taskbar, -1, 0, on_start_button);
+    g_ui_clock        = wtree_add(&g_desktop_ui, g_ui_taskbar, -1, 0, 0);
+
+    wtree_init(&g_start_ui, 1 + START_MENU_ITEMS, start_menu_layout, -1);
+    for (int i = 0; i < START_MENU_ITEMS; ++i) {
+        g_ui_start_items[i] = wtree_add(&g_start_ui, 0, i, WG_TRACK, on_start_item);
+    }
+
+    wtree_init(&g_menu_ui, 1 + MENU_ITEMS, context_menu_layout, -1);
+    for (int i = 0; i < MENU_ITEMS; ++i) {
+        g_ui_menu_items[i] = wtree_add(&g_menu_ui, 0, i, WG_TRACK, on_menu_item);
+    }
+
+    // Frame, the app's controls inside the client area, and the grip on
+    // top of everything.
+    for (int app = 0; app < APP_COUNT; ++app) {
+        WidgetTree *t = &g_app_ui[app];
+        AppWidgets *a = &g_app_widgets[app];
+        wtree_init(t, 6 + BGA_MAX_MODES, app_layout, app);
+        a->title  = wtree_add(t, 0, UI_TITLE, 0, on_app_frame);
+        a->close  = wtree_add(t, a->title, UI_CLOSE, 0, on_app_frame);
+        a->client = wtree_add(t, 0, UI_CLIENT, 0, 0);
+        if (app == 0) {
+            for (int i = 0; i < g_mode_count; ++i) {
+                a->items[i] = wtree_add(t, a->client, i, 0, on_settings_mode);
             }
-            y += icon_h + gap;
+        } else if (app == 3) {
+            for (int i = 0; i < 3; ++i) {
+                a->items[i] = wtree_add(t, a->client, i, 0, on_browser_tab);
+            }
+            a->page = wtree_add(t, a->client, -1, 0, on_browser_page);
         }
+        a->grip   = wtree_add(t, 0, UI_GRIP, 0, on_app_frame);
     }
+}
 
-    // Window close button + browser tab/content clicks when an app is open
-    if (*open_app >= 0 && left) {
-        uint32_t win_w = g_width * 3 / 5;
-        uint32_t win_h = g_height * 3 / 5;
-        uint32_t win_x = (g_width  - win_w) / 2;
-        uint32_t win_y = (g_height - win_h) / 2 - g_height / 20;
-        if (win_y < 10) win_y = 10;
+// Sends a click to the widget under the pointer in win.
+static int ui_click(Window *win, int32_t x, int32_t y) {
+    WidgetTree *t = window_ui(win);
+    return t ? wtree_click(t, x - win->r.x, y - win->r.y) : 0;
+}
 
-        uint32_t title_h = 24;
-        uint32_t bx = win_x + win_w - 20;
-        uint32_t by = win_y + 4;
-        uint32_t bw = 14;
-        uint32_t bh = 14;
+// Pointer motion: hover follows it between widgets, and out of the tree
+// it was last over. Nothing hovers while a window is being dragged.
+static void ui_hover(int32_t x, int32_t y) {
+    Window *win = wm_dragging() ? 0 : wm_window_at(x, y);
+    WidgetTree *t = win ? window_ui(win) : 0;
+    if (g_hover_ui && g_hover_ui != t) wtree_hover(g_hover_ui, -1, -1);
+    g_hover_ui = t;
+    if (t) wtree_hover(t, x - win->r.x, y - win->r.y);
+}
 
-        // Close button
-        if ((uint32_t)mouse_x >= bx && (uint32_t)mouse_x < bx + bw &&
-            (uint32_t)mouse_y >= by && (uint32_t)mouse_y < by + bh) {
-            *open_app = -1;
-            if (need_redraw) *need_redraw = 1;
-            return;
-        }
+static void handle_mouse_click(int mouse_x, int mouse_y, int left, int right) {
+    // An open context menu takes the click (and closes either way).
+    if (g_context_menu_open) {
+        if (left) ui_click(g_menu_win, mouse_x, mouse_y);
+        context_menu_show(0, 0, 0);
+        return;
+    }
 
-        // Browser-specific hit testing for tabs + scroll
-        if (*open_app == 3) {
-            handle_browser_click(win_x, win_y, win_w, win_h,
-                                 mouse_x, mouse_y, left, right, need_redraw);
-        }
+    // Right-click anywhere opens the context menu.
+    if (right && !left) {
+        start_menu_show(0);
+        context_menu_show(1, mouse_x, mouse_y);
+        return;
     }
+
+    Window *win = wm_window_at(mouse_x, mouse_y);
+    if (!win) win = g_desktop_win;
+
+    // App window: focus it, then act on the part that was hit.
+    if (win->flags & WIN_FRAMED) {
+        start_menu_show(0);
+        app_focus(win->id);
+    }
+    ui_click(win, mouse_x, mouse_y);
 }
+
 // ---------------------------------------------------------------------
 // Desktop keyboard navigation (arrows, Start toggle)
 // ---------------------------------------------------------------------
 
-static void handle_nav_scancode(uint8_t sc,
-                                int *selected_icon,
-                                int *open_app) {
-    if (sc & 0x80) return; // ignore releases (Shift handled elsewhere)
+static void handle_nav_key(const KeyEvent *ev) {
+    if (!(ev->flags & KEY_PRESSED)) return;
 
     // Up/Down select dock icon
-    if (sc == 0x48) {            // Up arrow
-        if (*selected_icon > 0) (*selected_icon)--;
-    } else if (sc == 0x50) {     // Down arrow
-        if (*selected_icon < 4) (*selected_icon)++;
-    } else if (sc == 0x1F) {     // 's' -> toggle Start
-        g_start_open = !g_start_open;
-        return;
-    } else if (sc == 0x1C) {     // Enter: open selected app
-        if (*selected_icon >= 0 && *selected_icon <= 4) {
-            *open_app = *selected_icon;
-            if (*open_app == 2) term_reset(&g_term);
-        }
-        return;
-    } else if (sc == 0x01) {     // Esc: close app
-        *open_app = -1;
-        return;
+    if (ev->code == KEY_UP) {
+        desktop_select_icon(g_selected_icon - 1);
+    } else if (ev->code == KEY_DOWN) {
+        desktop_select_icon(g_selected_icon + 1);
+    } else if (ev->code == KEY_LETTER('s') && !ev->mods) {  // 's' -> toggle Start
+        start_menu_show(!g_start_open);
+    } else if (ev->code == KEY_ENTER || ev->code == KEY_KP_ENTER) {
+        app_open(g_selected_icon);
+    } else if (ev->code == KEY_ESC) {   // Esc: close the focused app
+        app_close(app_focused());
     }
 }
 
@@ -2192,10 +3726,7 @@ static void ps2_write_mouse(uint8_t val) {
     outb(0x60, val);
 }
 
-static void ps2_mouse_process_byte(uint8_t data,
-                                   int *selected_icon,
-                                   int *open_app,
-                                   int *need_full_redraw) {
+static void ps2_mouse_process_byte(uint8_t data) {
     int needed_bytes = g_mouse_has_wheel ? 4 : 3;
 
     if (mouse_cycle == 0) {
@@ -2227,61 +3758,10 @@ static void ps2_mouse_process_byte(uint8_t data,
         wheel = (int8_t)mouse_bytes[3];
     }
 
-    // Update mouse position. In PS/2 packets, positive Y is up, but our
-    // framebuffer origin is top-left, so subtract dy.
-    g_mouse.x += dx;
-    g_mouse.y -= dy;
-
-    if (g_mouse.x < 0) g_mouse.x = 0;
-    if (g_mouse.y < 0) g_mouse.y = 0;
-    if ((uint32_t)g_mouse.x >= g_width)  g_mouse.x = (int32_t)g_width - 1;
-    if ((uint32_t)g_mouse.y >= g_height) g_mouse.y = (int32_t)g_height - 1;
-
-    uint8_t new_left  = (mouse_bytes[0] & 0x01) ? 1u : 0u;
-    uint8_t new_right = (mouse_bytes[0] & 0x02) ? 1u : 0u;
-
-    g_mouse.left_down  = new_left;
-    g_mouse.right_down = new_right;
-
-    // Scroll wheel â†’ browser scrolling (only when Browser app is open).
-    if (wheel != 0 && open_app && *open_app == 3) {
-        if (wheel > 0) {
-            g_browser_scroll -= 3;
-        } else if (wheel < 0) {
-            g_browser_scroll += 3;
-        }
-        if (g_browser_scroll < 0) g_browser_scroll = 0;
-        // No strict upper bound; draw_browser_contents() will just stop
-        // rendering once the text runs out.
-        if (need_full_redraw) *need_full_redraw = 1;
-    }
-
-    // Edge-triggered click handling
-    if (selected_icon && open_app) {
-        if (new_left && !g_prev_left) {
-            handle_mouse_click(g_mouse.x, g_mouse.y,
-                               1, 0,
-                               selected_icon, open_app,
-                               need_full_redraw);
-        } else if (new_right && !g_prev_right) {
-            handle_mouse_click(g_mouse.x, g_mouse.y,
-                               0, 1,
-                               selected_icon, open_app,
-                               need_full_redraw);
-        }
-    }
-
-    g_prev_left  = new_left;
-    g_prev_right = new_right;
-
-    // If a click or scroll event requested a full redraw, the main loop
-    // will call draw_desktop(), which in turn will redraw the cursor on top.
-    // For pure movement, avoid repainting the entire desktop and instead
-    // just move the cursor overlay.
-    int requested = (need_full_redraw && *need_full_redraw);
-    if (!requested) {
-        draw_mouse_cursor();
-    }
+    // In PS/2 packets positive Y is up and positive Z is towards the user;
+    // the event queue has Y down (framebuffer origin is top-left) and the
+    // wheel positive away from the user.
+    mouse_report(dx, -dy, -wheel, (uint8_t)(mouse_bytes[0] & 0x07));
 }
 static void ps2_mouse_init(void) {
     // Enable auxiliary device (mouse)
@@ -2335,34 +3815,118 @@ static void ps2_mouse_init(void) {
 // Unified PS/2 poll: routes bytes to mouse or keyboard
 // ---------------------------------------------------------------------
 
-static void ps2_poll(int *selected_icon, int *open_app,
-                     int *need_full_redraw,
-                     int *need_cmd_redraw) {
-    uint8_t status = inb(0x64);
-    if (!(status & 0x01)) return; // no data pending
+// Drains everything the controller has before the next frame is drawn;
+// the cap only keeps a stuck controller from starving the loop.
+#define PS2_DRAIN_MAX 256
 
-    uint8_t data = inb(0x60);
+static void ps2_poll(void) {
+    for (int n = 0; n < PS2_DRAIN_MAX; ++n) {
+        uint8_t status = inb(0x64);
+        if (!(status & 0x01)) return; // no data pending
 
-    if (status & 0x20) {
-        // Mouse data: ps2_mouse_process_byte() will decide whether a full
-        // desktop redraw is needed (for clicks/scroll) or whether it can
-        // simply move the cursor overlay for plain motion.
-        ps2_mouse_process_byte(data, selected_icon, open_app, need_full_redraw);
-    } else {
-        // Keyboard scancode
-        if (*open_app == 2) {
-            // Command Block (terminal) is active: only redraw the terminal
-            // window instead of the entire desktop to avoid flicker.
-            term_handle_scancode(data, &g_term, selected_icon, open_app);
-            if (need_cmd_redraw) {
-                *need_cmd_redraw = 1;
-            }
+        uint8_t data = inb(0x60);
+
+        if (status & 0x20) {
+            // Mouse data: clicks and drags update the windows; plain motion
+            // only moves the cursor plane.
+            ps2_mouse_process_byte(data);
+            continue;
+        }
+
+        kbd_ps2_byte(data);
+    }
+}
+
+// ---------------------------------------------------------------------
+// Pointer events (PS/2 and USB mice, tablets) â†’ windows
+// ---------------------------------------------------------------------
+
+static void mouse_poll(void) {
+    MouseEvent ev;
+    while (mouse_read(&ev)) {
+        frame_input_event();
+
+        if (ev.absolute) {
+            // Tablets say where the pointer is; no acceleration, no drift.
+            g_mouse.x = (int32_t)((int64_t)ev.dx * ((int32_t)g_width - 1) / MOUSE_ABS_MAX);
+            g_mouse.y = (int32_t)((int64_t)ev.dy * ((int32_t)g_height - 1) / MOUSE_ABS_MAX);
         } else {
-            // Desktop navigation / other apps: desktop layout may have changed.
-            handle_nav_scancode(data, selected_icon, open_app);
-            if (need_full_redraw) {
-                *need_full_redraw = 1;
+            g_mouse.x += ev.dx;
+            g_mouse.y += ev.dy;
+        }
+
+        if (g_mouse.x < 0) g_mouse.x = 0;
+        if (g_mouse.y < 0) g_mouse.y = 0;
+        if ((uint32_t)g_mouse.x >= g_width)  g_mouse.x = (int32_t)g_width - 1;
+        if ((uint32_t)g_mouse.y >= g_height) g_mouse.y = (int32_t)g_height - 1;
+        ui_hover(g_mouse.x, g_mouse.y);
+
+        uint8_t new_left  = (ev.buttons & MOUSE_LEFT)  ? 1u : 0u;
+        uint8_t new_right = (ev.buttons & MOUSE_RIGHT) ? 1u : 0u;
+
+        g_mouse.left_down  = new_left;
+        g_mouse.right_down = new_right;
+
+        // Scroll wheel scrolls the Browser when it is under the pointer.
+        if (ev.wheel != 0) {
+            Window *win = wm_window_at(g_mouse.x, g_mouse.y);
+            if (win && win == g_app_win[3]) {
+                browser_scroll_by(ev.wheel < 0 ? -3 : 3);
+                app_redraw(3);
+            }
+        }
+
+        // Dragging a title bar or resize grip follows the pointer until the
+        // button is released.
+        if (wm_dragging()) {
+            if (new_left) wm_drag_motion(g_mouse.x, g_mouse.y);
+            else          wm_drag_end();
+        }
+
+        // Edge-triggered click handling
+        if (new_left && !g_prev_left) {
+            handle_mouse_click(g_mouse.x, g_mouse.y, 1, 0);
+        } else if (new_right && !g_prev_right) {
+            handle_mouse_click(g_mouse.x, g_mouse.y, 0, 1);
+        }
+
+        g_prev_left  = new_left;
+        g_prev_right = new_right;
+
+        // Only recorded here; the next compose draws the latest position once.
+        wm_cursor_move(g_mouse.x, g_mouse.y);
+    }
+}
+
+// ---------------------------------------------------------------------
+// Key events â†’ focused window
+// ---------------------------------------------------------------------
+
+static void key_poll(void) {
+    KeyEvent ev;
+    kbd_tick();
+    while (kbd_read(&ev)) {
+        if (!(ev.flags & KEY_PRESSED)) continue;    // nothing acts on release yet
+        frame_input_event();
+
+        if ((ev.mods & KMOD_ALT) && ev.code == KEY_FN(4)) {
+            app_close(app_focused());
+        } else if (app_focused() == 2) {
+            // Command Block (terminal) has focus: only its window repaints,
+            // and in the editor only the rows that changed.
+            int editing = g_editor_active;
+            term_handle_key(&ev, &g_term);
+            if (editing && g_editor_active) {
+                if (g_app_win[2]) edit_invalidate(g_app_win[2]);
+            } else if (editing || ev.code == KEY_ENTER || ev.code == KEY_KP_ENTER || ev.code == KEY_TAB ||
+                (ev.mods & KMOD_CTRL)) {
+                app_redraw(2);
+                app_redraw(1);      // a command may have changed files
+            } else if (g_app_win[2]) {
+                wm_invalidate_rect(g_app_win[2], term_input_rect(g_app_win[2]));
             }
+        } else {
+            handle_nav_key(&ev);
         }
     }
 }
@@ -2375,6 +3939,7 @@ void kernel_main(BootInfo *bi) {
     g_width  = bi->framebuffer_width;
     g_height = bi->framebuffer_height;
     g_pitch  = bi->framebuffer_pitch ? bi->framebuffer_pitch : bi->framebuffer_width;
+    gfx_target(0);
 
     // Initialise time/date from UEFI BootInfo when available,
     // fall back to CMOS RTC if firmware didn't give us anything useful.
@@ -2391,42 +3956,75 @@ void kernel_main(BootInfo *bi) {
         rtc_read();
     }
 
+    // Physical memory, then devices. The loader has already called
+    // ExitBootServices(), so from here on the hardware is ours.
+    mm_init(bi);
+    timer_init();
+    pc_init();
+    cpu_init();
+    shell_init();
+    term_register_commands();
+    // User processes need the firmware to have left the user slot free.
+    if (vm_init() == 0) proc_init(&g_proc_fs);
+
+    // A font file next to kernel.bin becomes the UI font.
+    if (bi->font_size) {
+        g_boot_font = font_load("boot font", (const uint8_t*)(uintptr_t)bi->font_base,
+                                (uint32_t)bi->font_size);
+        if (g_boot_font) ui_set_font(g_boot_font);
+    }
+    // Other cores wait in smp.c for rasterizer work.
+    if (acpi_init(bi->acpi_rsdp)) smp_init(bi->ap_trampoline);
+    pci_init();
+    if (bga_probe((uint64_t)(uintptr_t)g_fb)) {
+        g_mode_count = bga_modes(g_modes, BGA_MAX_MODES);
+    }
+    virtio_net_probe();
+    virtio_input_probe();
+    virtio_blk_probe();
+    xhci_probe();
+    net_init();
+
     vfs_init();
     browser_init();
 
     run_boot_splash();
 
-    int selected_icon = 2;  // Command Block highlighted
-    int open_app      = -1; // none open yet
-
     term_reset(&g_term);
     g_start_open = 0;
 
     // Initialize PS/2 mouse (if hardware supports it)
     ps2_mouse_init();
 
-    draw_desktop(selected_icon, open_app);
+    desktop_init();
 
     for (;;) {
-        int need_full_redraw = 0;
-        int need_cmd_redraw  = 0;
-
-        ps2_poll(&selected_icon, &open_app,
-                 &need_full_redraw,
-                 &need_cmd_redraw);
-
-        if (need_full_redraw) {
-            draw_desktop(selected_icon, open_app);
-        } else if (need_cmd_redraw) {
-            // Only Command Block content changed â€“ redraw just that window
-            // to avoid repainting the entire desktop every keypress.
-            draw_command_block_window(selected_icon, open_app);
+        ps2_poll();
+        xhci_poll();
+        virtio_input_poll();
+        key_poll();
+        mouse_poll();
+        net_tick();
+        pc_poll();
+        if (shell_poll()) {
+            app_redraw(2);
+            app_redraw(1);          // `> file` may have changed the VFS
         }
+        desktop_tick();
+
+        frame_tick();
     }
 }
 
+extern char __bss_start[];
+extern char __bss_end[];
+
 __attribute__((noreturn, section(".entry")))
 void _start(BootInfo *bi) {
+    // Firmware interrupt handlers are gone after ExitBootServices(); we poll.
+    __asm__ volatile("cli");
+    // kernel.bin is a flat image without .bss, so zero it ourselves.
+    memset(__bss_start, 0, (size_t)(__bss_end - __bss_start));
     kernel_main(bi);
     for (;;) {
         __asm__ volatile("hlt");
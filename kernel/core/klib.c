@@ -0,0 +1,115 @@
+// kernel/core/klib.c
+// Freestanding memory and string helpers shared by the whole kernel.
+
+#include "klib.h"
+
+// ---------------------------------------------------------------------
+// Memory helpers
+// ---------------------------------------------------------------------
+
+void *memcpy(void *dst, const void *src, size_t n) {
+    // rep movsb is fast on every CPU we care about (ERMS) and keeps GCC from
+    // turning this loop back into a call to memcpy().
+    void *ret = dst;
+    __asm__ volatile("rep movsb"
+                     : "+D"(dst), "+S"(src), "+c"(n)
+                     :
+                     : "memory");
+    return ret;
+}
+
+void *memmove(void *dst, const void *src, size_t n) {
+    uint8_t       *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+    if (d == s || n == 0) return dst;
+    if (d < s || d >= s + n) {
+        return memcpy(dst, src, n);
+    }
+    // Overlapping with dst after src: copy backwards.
+    d += n - 1;
+    s += n - 1;
+    __asm__ volatile("std\n\trep movsb\n\tcld"
+                     : "+D"(d), "+S"(s), "+c"(n)
+                     :
+                     : "memory");
+    return dst;
+}
+
+void *memset(void *dst, int c, size_t n) {
+    void *ret = dst;
+    __asm__ volatile("rep stosb"
+                     : "+D"(dst), "+c"(n)
+                     : "a"((uint8_t)c)
+                     : "memory");
+    return ret;
+}
+
+int memcmp(const void *a, const void *b, size_t n) {
+    const uint8_t *pa = (const uint8_t *)a;
+    const uint8_t *pb = (const uint8_t *)b;
+    for (size_t i = 0; i < n; ++i) {
+        if (pa[i] != pb[i]) return (int)pa[i] - (int)pb[i];
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------
+// String helpers
+// ---------------------------------------------------------------------
+
+uint32_t str_len(const char *s) {
+    uint32_t n = 0;
+    if (!s) return 0;
+    while (s[n]) n++;
+    return n;
+}
+
+void str_copy(char *dst, const char *src, uint32_t max_len) {
+    if (!dst || !src || max_len == 0) return;
+    uint32_t i = 0;
+    for (; i + 1 < max_len && src[i]; ++i) {
+        dst[i] = src[i];
+    }
+    dst[i] = '\0';
+}
+
+void str_cat(char *dst, const char *src, uint32_t max_len) {
+    if (!dst || !src) return;
+    uint32_t len = str_len(dst);
+    uint32_t i = 0;
+    while (len + 1 < max_len && src[i]) {
+        dst[len++] = src[i++];
+    }
+    dst[len] = '\0';
+}
+
+int str_eq(const char *a, const char *b) {
+    if (!a || !b) return 0;
+    while (*a && *b) {
+        if (*a != *b) return 0;
+        ++a; ++b;
+    }
+    return (*a == '\0' && *b == '\0');
+}
+
+void str_cat_u64(char *dst, uint64_t v, uint32_t max_len) {
+    char tmp[21];
+    int  pos = 20;
+    tmp[pos] = '\0';
+    do {
+        tmp[--pos] = (char)('0' + (v % 10));
+        v /= 10;
+    } while (v && pos > 0);
+    str_cat(dst, &tmp[pos], max_len);
+}
+
+void str_cat_hex(char *dst, uint64_t v, uint32_t digits, uint32_t max_len) {
+    static const char hex[] = "0123456789ABCDEF";
+    char tmp[17];
+    if (digits == 0 || digits > 16) digits = 16;
+    for (uint32_t i = 0; i < digits; ++i) {
+        tmp[digits - 1 - i] = hex[(v >> (i * 4)) & 0xF];
+    }
+    tmp[digits] = '\0';
+    str_cat(dst, tmp, max_len);
+}
@@ -0,0 +1,67 @@
+// kernel/core/pipe.c
+// Bounded ring-buffer pipes; full and empty ends yield to other threads.
+
+#include "pipe.h"
+#include "thread.h"
+#include "mm.h"
+
+Pipe *pipe_create(void) {
+    Pipe *p = (Pipe*)kzalloc(sizeof(Pipe));
+    if (!p) return 0;
+    p->buf = (char*)kmalloc(PIPE_SIZE);
+    if (!p->buf) {
+        kfree(p);
+        return 0;
+    }
+    return p;
+}
+
+void pipe_free(Pipe *p) {
+    if (!p) return;
+    kfree(p->buf);
+    kfree(p);
+}
+
+int pipe_write(Pipe *p, const void *data, uint32_t len) {
+    const char *src = (const char*)data;
+    uint32_t done = 0;
+    while (done < len) {
+        if (p->read_closed) return -1;
+        uint32_t space = PIPE_SIZE - (p->tail - p->head);
+        if (!space) {
+            thread_yield();
+            continue;
+        }
+        uint32_t n = len - done < space ? len - done : space;
+        for (uint32_t i = 0; i < n; ++i) {
+            p->buf[(p->tail + i) & (PIPE_SIZE - 1)] = src[done + i];
+        }
+        p->tail += n;
+        done    += n;
+    }
+    return (int)len;
+}
+
+int pipe_read(Pipe *p, void *data, uint32_t len, int wait) {
+    char *dst = (char*)data;
+    while (p->tail == p->head) {
+        if (p->write_closed) return -1;
+        if (!wait) return 0;
+        thread_yield();
+    }
+    uint32_t avail = p->tail - p->head;
+    uint32_t n = len < avail ? len : avail;
+    for (uint32_t i = 0; i < n; ++i) {
+        dst[i] = p->buf[(p->head + i) & (PIPE_SIZE - 1)];
+    }
+    p->head += n;
+    return (int)n;
+}
+
+void pipe_close_read(Pipe *p) {
+    p->read_closed = 1;
+}
+
+void pipe_close_write(Pipe *p) {
+    p->write_closed = 1;
+}
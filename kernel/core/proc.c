@@ -0,0 +1,916 @@
+// kernel/core/proc.c
+// User processes: loading, ring 3 entry and exit, time slices, the system
+// calls, I/O rings and the `run` command.
+
+#include "proc.h"
+#include "syscall.h"
+#include "cpu.h"
+#include "vm.h"
+#include "elf.h"
+#include "ioring.h"
+#include "socket.h"
+#include "net.h"
+#include "shell.h"
+#include "thread.h"
+#include "timer.h"
+#include "mm.h"
+#include "klib.h"
+
+#define PROC_KSTACK_SIZE (4096u << PROC_KSTACK_ORDER)
+#define PROC_STACK_BASE  (USER_TOP - PROC_STACK_SIZE)
+#define PROC_CHUNK       512            // bytes copied per step through the kernel
+
+#define EXIT_KILLED      130            // as a shell reports SIGINT
+#define EXIT_FAULT       139            // and SIGSEGV
+
+typedef enum {
+    PF_FREE,
+    PF_IN,                              // the command's input
+    PF_OUT,                             // the command's output
+    PF_FILE,
+    PF_RING,                            // file is the IoRing
+    PF_SOCKET                           // file is the Socket
+} ProcFileKind;
+
+typedef struct {
+    uint8_t   kind;
+    uint8_t   flags;                    // O_ACCMODE and O_APPEND
+    uint16_t  users;                    // system calls and ring requests in it
+    uint32_t  pos;
+    void     *file;
+    uint64_t  map;                      // PF_RING: where its memory is mapped
+} ProcFile;
+
+typedef struct Process Process;
+struct Process {
+    uint8_t       fpu[FPU_STATE_SIZE] __attribute__((aligned(16)));
+    uint32_t      pid;
+    char          name[THREAD_NAME_LEN];
+    AddressSpace *as;
+    Shell        *sh;
+    ProcFile      files[PROC_MAX_FILES];
+    uint8_t      *kstack;
+    uint64_t      kctx;                 // user_enter()'s kernel rsp
+    uint64_t      entry, sp;
+    int           forked;               // starts from frame, not entry
+    SyscallFrame  frame;
+    uint64_t      mmap_next;            // where the next mmap() looks first
+    int           exit_code;
+    Thread       *thread;               // spawned or forked: its thread
+    Process      *children;             // spawned and not waited for
+    Process      *sibling;
+};
+
+static ProcFs   g_fs;
+static VmPager  g_pager;                // g_fs's pages, for mmap()
+static Process *g_current;              // the one in ring 3, or last there
+static uint32_t g_next_pid = 1;
+static int      g_count;
+
+// The slice timer runs for whoever entered ring 3 last; it restarts when
+// someone else does or the slice is over.
+static Process *g_slice_owner;
+static uint64_t g_slice_start;
+static uint64_t g_slice_tsc;
+
+// ---------------------------------------------------------------------
+// Entry and exit
+// ---------------------------------------------------------------------
+
+// Everything a return to ring 3 needs. Last thing before the return, as
+// it puts back the process's FPU state.
+static void user_resume(Process *p) {
+    cpu_set_kernel_stack((uint64_t)(uintptr_t)(p->kstack + PROC_KSTACK_SIZE));
+    g_current = p;
+    vm_activate(p->as);
+    uint64_t now = rdtsc();
+    if (p != g_slice_owner || now - g_slice_start >= g_slice_tsc) {
+        g_slice_owner = p;
+        g_slice_start = now;
+        cpu_timer_start(PROC_SLICE_MS * 1000);
+    }
+    fpu_restore(p->fpu);
+}
+
+// First thing in the kernel from ring 3.
+static Process *user_entered(void) {
+    Process *p = g_current;
+    fpu_save(p->fpu);
+    fpu_restore(fpu_initial());
+    return p;
+}
+
+__attribute__((noreturn)) static void proc_exit(Process *p, int code) {
+    user_leave(p->kctx, (uint64_t)(uint32_t)code);
+}
+
+static int proc_killed(const Process *p) {
+    return shell_cancelled(p->sh);
+}
+
+// ---------------------------------------------------------------------
+// Files
+// ---------------------------------------------------------------------
+
+static ProcFile *file_get(Process *p, uint64_t fd) {
+    if (fd >= PROC_MAX_FILES || p->files[fd].kind == PF_FREE) return 0;
+    return &p->files[fd];
+}
+
+// Waits for whoever is still reading or writing it (a ring request may
+// be waiting for the disk).
+static void file_close(ProcFile *f) {
+    while (f->users) thread_yield();
+    if (f->kind == PF_FILE)   g_fs.close(g_fs.ctx, f->file);
+    if (f->kind == PF_RING)   ioring_destroy((IoRing*)f->file);
+    if (f->kind == PF_SOCKET) sock_close((Socket*)f->file);
+    f->kind = PF_FREE;
+    f->file = 0;
+}
+
+// The lowest free descriptor, or -1.
+static int fd_alloc(Process *p) {
+    int fd = 0;
+    while (fd < PROC_MAX_FILES && p->files[fd].kind != PF_FREE) ++fd;
+    return fd < PROC_MAX_FILES ? fd : -1;
+}
+
+// Tries path, then \bin\path and \bin\path.elf, for a bare name.
+static void *open_program(const char *path) {
+    void *f = g_fs.open(g_fs.ctx, path, O_RDONLY);
+    for (const char *p = path; *p && !f; ++p) {
+        if (*p == '\\' || *p == '/' || *p == ':') return 0;
+    }
+    for (int ext = 0; ext < 2 && !f; ++ext) {
+        char name[SHELL_LINE_MAX];
+        str_copy(name, "\\bin\\", sizeof(name));
+        str_cat(name, path, sizeof(name));
+        if (ext) str_cat(name, ".elf", sizeof(name));
+        f = g_fs.open(g_fs.ctx, name, O_RDONLY);
+    }
+    return f;
+}
+
+// The whole file in a kmalloc() buffer.
+static uint8_t *read_program(const char *path, uint32_t *size, const char **why) {
+    void *f = open_program(path);
+    if (!f) {
+        *why = "no such file";
+        return 0;
+    }
+    int n = g_fs.size(g_fs.ctx, f);
+    uint8_t *image = n > 0 ? (uint8_t*)kmalloc((size_t)n) : 0;
+    if (n <= 0) {
+        *why = "empty file";
+    } else if (!image) {
+        *why = "out of memory";
+    } else if (g_fs.read(g_fs.ctx, f, 0, image, (uint32_t)n) != n) {
+        *why = "read error";
+        kfree(image);
+        image = 0;
+    }
+    g_fs.close(g_fs.ctx, f);
+    *size = (uint32_t)n;
+    return image;
+}
+
+// ---------------------------------------------------------------------
+// Processes
+// ---------------------------------------------------------------------
+
+// argc, then the argv pointers and a 0, then an empty environment, as the
+// SysV ABI has them at _start; the strings go above.
+static int push_args(Process *p, int argc, char **argv) {
+    uint64_t ptrs[PROC_MAX_ARGS];
+    uint64_t sp = USER_TOP;
+    for (int i = argc - 1; i >= 0; --i) {
+        uint32_t len = str_len(argv[i]) + 1;
+        sp -= len;
+        if (vm_copy_out(p->as, sp, argv[i], len) < 0) return -1;
+        ptrs[i] = sp;
+    }
+    uint64_t words[PROC_MAX_ARGS + 3];
+    uint32_t count = 0;
+    words[count++] = (uint64_t)argc;
+    for (int i = 0; i < argc; ++i) words[count++] = ptrs[i];
+    words[count++] = 0;
+    words[count++] = 0;
+    sp = (sp - count * 8) & ~15ull;
+    if (vm_copy_out(p->as, sp, words, count * 8) < 0) return -1;
+    p->sp = sp;
+    return 0;
+}
+
+static void proc_free(Process *p) {
+    if (p->as) vm_destroy(p->as);
+    if (p->kstack) page_free(p->kstack, PROC_KSTACK_ORDER);
+    kfree(p);
+}
+
+// A process ready to run path with argv (argv[0] is its name), printing
+// through sh. Returns 0 with the reason in *why.
+static Process *proc_create(const char *path, int argc, char **argv, Shell *sh,
+                            const char **why) {
+    if (argc > PROC_MAX_ARGS) {
+        *why = "too many arguments";
+        return 0;
+    }
+    uint32_t size;
+    uint8_t *image = read_program(path, &size, why);
+    if (!image) return 0;
+
+    Process *p = (Process*)kzalloc(sizeof(Process));
+    uint64_t end = 0;
+    *why = "out of memory";
+    if (!p || !(p->as = vm_create()) ||
+        !(p->kstack = (uint8_t*)page_alloc(PROC_KSTACK_ORDER))) {
+        if (p) proc_free(p);
+        kfree(image);
+        return 0;
+    }
+    int rc = elf_load(p->as, image, size, &p->entry, &end, why);
+    kfree(image);
+    if (rc < 0) {
+        proc_free(p);
+        return 0;
+    }
+    if (end > PROC_STACK_BASE - PAGE_SIZE) {
+        *why = "program too large";
+        proc_free(p);
+        return 0;
+    }
+    if (vm_reserve(p->as, PROC_STACK_BASE, PROC_STACK_SIZE, VM_WRITE, 0, 0, 0) < 0 ||
+        push_args(p, argc, argv) < 0) {
+        *why = "out of memory";
+        proc_free(p);
+        return 0;
+    }
+
+    const char *base = path;
+    for (const char *c = path; *c; ++c) {
+        if (*c == '\\' || *c == '/') base = c + 1;
+    }
+    str_copy(p->name, base, sizeof(p->name));
+    p->pid       = g_next_pid++;
+    p->sh        = sh;
+    p->mmap_next = end;
+    p->files[STDIN_FILENO].kind  = PF_IN;
+    p->files[STDOUT_FILENO].kind = PF_OUT;
+    p->files[STDERR_FILENO].kind = PF_OUT;
+    memcpy(p->fpu, fpu_initial(), FPU_STATE_SIZE);
+    return p;
+}
+
+// Runs p on this thread until it exits; its memory, files and children
+// are gone when this returns, p itself is the caller's to free.
+static int proc_exec(Process *p) {
+    g_count++;
+    user_resume(p);
+    int code = p->forked ? (int)user_return(&p->kctx, &p->frame)
+                         : (int)user_enter(&p->kctx, p->entry, p->sp);
+
+    vm_activate(0);
+    if (g_slice_owner == p) g_slice_owner = 0;
+    if (g_current == p) g_current = 0;
+    // Rings first: their requests are cancelled rather than carried on.
+    for (int fd = 0; fd < PROC_MAX_FILES; ++fd) {
+        if (p->files[fd].kind == PF_RING) file_close(&p->files[fd]);
+    }
+    for (int fd = 0; fd < PROC_MAX_FILES; ++fd) file_close(&p->files[fd]);
+    while (p->children) {
+        Process *c = p->children;
+        p->children = c->sibling;
+        thread_join(c->thread);
+        proc_free(c);
+    }
+    vm_destroy(p->as);
+    p->as = 0;
+    page_free(p->kstack, PROC_KSTACK_ORDER);
+    p->kstack = 0;
+    g_count--;
+    return code;
+}
+
+static void proc_thread(void *arg) {
+    Process *p = (Process*)arg;
+    p->exit_code = proc_exec(p);
+}
+
+int proc_count(void) {
+    return g_count;
+}
+
+// ---------------------------------------------------------------------
+// System calls
+// ---------------------------------------------------------------------
+
+// The transfers behind read() and write(), for system calls and ring
+// requests alike; the caller has checked the descriptor and that the
+// memory is there (vm_mapped()). A copy can still fail if faulting a page
+// in runs out of memory. pos is the file position to use and move on.
+
+static int64_t file_read(Process *p, ProcFile *f, uint64_t buf, uint64_t len, uint32_t *pos) {
+    char     kbuf[PROC_CHUNK];
+    uint64_t done = 0;
+    while (done < len) {
+        uint32_t want = len - done < PROC_CHUNK ? (uint32_t)(len - done) : PROC_CHUNK;
+        int n = g_fs.read(g_fs.ctx, f->file, *pos, kbuf, want);
+        if (n < 0) return done ? (int64_t)done : SYS_EBADF;
+        if (n == 0) break;
+        if (vm_copy_out(p->as, buf + done, kbuf, (uint32_t)n) < 0) {
+            return done ? (int64_t)done : SYS_EFAULT;
+        }
+        *pos += (uint32_t)n;
+        done += (uint32_t)n;
+    }
+    return (int64_t)done;
+}
+
+static int64_t file_write(Process *p, ProcFile *f, uint64_t data, uint64_t len, uint32_t *pos) {
+    char     kbuf[PROC_CHUNK];
+    uint64_t done = 0;
+    while (done < len) {
+        uint32_t want = len - done < PROC_CHUNK ? (uint32_t)(len - done) : PROC_CHUNK;
+        if (vm_copy_in(p->as, kbuf, data + done, want) < 0) {
+            return done ? (int64_t)done : SYS_EFAULT;
+        }
+        int n;
+        if (f->kind == PF_OUT) {
+            n = shell_write(p->sh, kbuf, want);
+            if (n < 0) return done ? (int64_t)done : SYS_EPIPE;
+        } else {
+            if (f->flags & O_APPEND) {
+                int size = g_fs.size(g_fs.ctx, f->file);
+                if (size < 0) return done ? (int64_t)done : SYS_EBADF;
+                *pos = (uint32_t)size;
+            }
+            n = g_fs.write(g_fs.ctx, f->file, *pos, kbuf, want);
+            if (n < 0) return done ? (int64_t)done : SYS_EBADF;
+            *pos += (uint32_t)n;
+            if ((uint32_t)n < want) {
+                done += (uint32_t)n;
+                return done ? (int64_t)done : SYS_ENOSPC;
+            }
+        }
+        done += want;
+    }
+    return (int64_t)done;
+}
+
+// Sockets never wait here: IORING_AGAIN if nothing could move yet.
+static int64_t socket_read(Process *p, ProcFile *f, uint64_t buf, uint64_t len) {
+    char kbuf[PROC_CHUNK];
+    int  n = sock_recv((Socket*)f->file, kbuf, len < PROC_CHUNK ? (uint32_t)len : PROC_CHUNK, 0);
+    if (n == NET_EAGAIN) return len ? IORING_AGAIN : 0;
+    if (n < 0) return SYS_ECONNRESET;
+    if (vm_copy_out(p->as, buf, kbuf, (uint32_t)n) < 0) return SYS_EFAULT;
+    return n;
+}
+
+static int64_t socket_write(Process *p, ProcFile *f, uint64_t data, uint64_t len) {
+    char     kbuf[PROC_CHUNK];
+    uint64_t done = 0;
+    while (done < len) {
+        uint32_t want = len - done < PROC_CHUNK ? (uint32_t)(len - done) : PROC_CHUNK;
+        if (vm_copy_in(p->as, kbuf, data + done, want) < 0) {
+            return done ? (int64_t)done : SYS_EFAULT;
+        }
+        int n = sock_send((Socket*)f->file, kbuf, want, 0);
+        if (n == NET_EAGAIN) break;
+        if (n < 0) return done ? (int64_t)done : SYS_EPIPE;
+        done += (uint32_t)n;
+        if ((uint32_t)n < want) break;
+    }
+    return done || !len ? (int64_t)done : IORING_AGAIN;
+}
+
+static int64_t sys_read(Process *p, uint64_t fd, uint64_t buf, uint64_t len) {
+    ProcFile *f = file_get(p, fd);
+    if (!f || f->kind == PF_OUT || f->kind == PF_RING || (f->flags & O_ACCMODE) == O_WRONLY) {
+        return SYS_EBADF;
+    }
+    if (!vm_mapped(p->as, buf, len, 1)) return SYS_EFAULT;
+
+    if (f->kind == PF_IN) {
+        // Whatever arrives first, like a read from a terminal or pipe.
+        char kbuf[PROC_CHUNK];
+        int n = len ? shell_read(p->sh, kbuf, len < PROC_CHUNK ? (uint32_t)len : PROC_CHUNK) : 0;
+        if (n <= 0) return 0;
+        if (vm_copy_out(p->as, buf, kbuf, (uint32_t)n) < 0) return SYS_EFAULT;
+        return n;
+    }
+    int64_t r;
+    f->users++;
+    if (f->kind == PF_SOCKET) {
+        while ((r = socket_read(p, f, buf, len)) == IORING_AGAIN && !proc_killed(p)) {
+            thread_yield();
+        }
+        if (r == IORING_AGAIN) r = 0;
+    } else {
+        r = file_read(p, f, buf, len, &f->pos);
+    }
+    f->users--;
+    return r;
+}
+
+static int64_t sys_write(Process *p, uint64_t fd, uint64_t data, uint64_t len) {
+    ProcFile *f = file_get(p, fd);
+    if (!f || f->kind == PF_IN || f->kind == PF_RING) return SYS_EBADF;
+    if (f->kind == PF_FILE && (f->flags & O_ACCMODE) == O_RDONLY) return SYS_EBADF;
+    if (!vm_mapped(p->as, data, len, 0)) return SYS_EFAULT;
+
+    int64_t r;
+    f->users++;
+    if (f->kind == PF_SOCKET) {
+        uint64_t done = 0;
+        r = 0;
+        while (done < len && !proc_killed(p)) {
+            r = socket_write(p, f, data + done, len - done);
+            if (r == IORING_AGAIN) {
+                thread_yield();
+                continue;
+            }
+            if (r < 0) break;
+            done += (uint64_t)r;
+        }
+        if (done || r == IORING_AGAIN) r = (int64_t)done;
+    } else {
+        r = file_write(p, f, data, len, &f->pos);
+    }
+    f->users--;
+    return r;
+}
+
+static int64_t sys_open(Process *p, uint64_t upath, uint64_t flags) {
+    char path[SHELL_LINE_MAX];
+    if (vm_copy_string(p->as, path, upath, sizeof(path)) < 0) return SYS_EFAULT;
+    if ((flags & O_ACCMODE) == O_ACCMODE) return SYS_EINVAL;
+
+    int fd = fd_alloc(p);
+    if (fd < 0) return SYS_EMFILE;
+    void *file = g_fs.open(g_fs.ctx, path, (int)flags);
+    if (!file) return SYS_ENOENT;
+
+    ProcFile *f = &p->files[fd];
+    f->kind  = PF_FILE;
+    f->flags = (uint8_t)(flags & (O_ACCMODE | O_APPEND));
+    f->pos   = 0;
+    f->file  = file;
+    return fd;
+}
+
+static int64_t sys_close(Process *p, uint64_t fd) {
+    ProcFile *f = file_get(p, fd);
+    if (!f) return SYS_EBADF;
+    file_close(f);
+    return 0;
+}
+
+// Where len bytes go: the hint if that space is free, else the first free
+// space from mmap_next up to the stack's guard page. 0 if there is none.
+static uint64_t mmap_place(Process *p, uint64_t addr, uint64_t len) {
+    uint64_t limit = PROC_STACK_BASE - PAGE_SIZE;
+    uint64_t va    = addr & ~(uint64_t)(PAGE_SIZE - 1);
+    if (addr && va >= USER_BASE && va <= limit && len <= limit - va &&
+        vm_range_free(p->as, va, len)) {
+        return va;
+    }
+    // The first gap that fits, from mmap_next: past each region in the way,
+    // in one walk of the sorted list.
+    va = p->mmap_next;
+    for (VmRegion *r = p->as->regions; r && va <= limit && len <= limit - va; r = r->next) {
+        if (r->end <= va) continue;
+        if (r->start >= va + len) break;
+        va = r->end;
+    }
+    if (va > limit || len > limit - va) return 0;
+    p->mmap_next = va + len;
+    return va;
+}
+
+static int64_t sys_mmap(Process *p, uint64_t addr, uint64_t len, uint64_t prot,
+                        uint64_t flags, uint64_t fd, uint64_t offset) {
+    ProcFile *f = 0;
+    if (!len || len > PROC_STACK_BASE - USER_BASE) return SYS_EINVAL;
+    len = (len + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    if (!(flags & MAP_ANON)) {
+        f = file_get(p, fd);
+        if (!f || f->kind != PF_FILE || (f->flags & O_ACCMODE) == O_WRONLY) return SYS_EBADF;
+        if ((offset & (PAGE_SIZE - 1)) || offset > 0xFFFFFFFFu) return SYS_EINVAL;
+    }
+
+    uint64_t va = mmap_place(p, addr, len);
+    if (!va) return SYS_ENOMEM;
+
+    // Nothing is there until it is touched; the region keeps its own
+    // handle to the file.
+    uint32_t access = ((prot & PROT_WRITE) ? VM_WRITE : 0) | ((prot & PROT_EXEC) ? VM_EXEC : 0);
+    void    *file   = 0;
+    if (f && !(file = g_fs.dup(g_fs.ctx, f->file))) return SYS_ENOMEM;
+    if (vm_reserve(p->as, va, len, access, f ? &g_pager : 0, file, offset) < 0) {
+        if (file) g_fs.close(g_fs.ctx, file);
+        return SYS_ENOMEM;
+    }
+    return (int64_t)va;
+}
+
+static int64_t sys_munmap(Process *p, uint64_t addr, uint64_t len) {
+    if ((addr & (PAGE_SIZE - 1)) || !len) return SYS_EINVAL;
+    len = (len + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    if (addr < USER_BASE || addr >= USER_TOP || len > USER_TOP - addr) return SYS_EINVAL;
+    vm_unmap(p->as, addr, len);
+    return 0;
+}
+
+static int64_t sys_spawn(Process *p, uint64_t upath, uint64_t uargs) {
+    char path[SHELL_LINE_MAX];
+    char args[SHELL_LINE_MAX];
+    char words[SHELL_LINE_MAX];
+    char *argv[PROC_MAX_ARGS + 1];
+    if (vm_copy_string(p->as, path, upath, sizeof(path)) < 0) return SYS_EFAULT;
+    args[0] = '\0';
+    if (uargs && vm_copy_string(p->as, args, uargs, sizeof(args)) < 0) return SYS_EFAULT;
+
+    argv[0] = path;
+    int argc = shell_tokenize(args, words, sizeof(words), argv + 1, PROC_MAX_ARGS - 1);
+    if (argc < 0) return SYS_EINVAL;
+
+    const char *why;
+    Process *c = proc_create(path, argc + 1, argv, p->sh, &why);
+    if (!c) {
+        if (str_eq(why, "no such file")) return SYS_ENOENT;
+        if (str_eq(why, "out of memory")) return SYS_ENOMEM;
+        return SYS_ENOEXEC;
+    }
+    c->thread = thread_create(proc_thread, c, c->name);
+    if (!c->thread) {
+        proc_free(c);
+        return SYS_ENOMEM;
+    }
+    c->sibling  = p->children;
+    p->children = c;
+    return c->pid;
+}
+
+// The child starts as the parent returns from this call, with 0 in rax.
+static int64_t sys_fork(Process *p, const SyscallFrame *f) {
+    Process *c = (Process*)kzalloc(sizeof(Process));
+    if (!c) return SYS_ENOMEM;
+    if (!(c->as = vm_clone(p->as)) ||
+        !(c->kstack = (uint8_t*)page_alloc(PROC_KSTACK_ORDER))) {
+        proc_free(c);
+        return SYS_ENOMEM;
+    }
+    for (int fd = 0; fd < PROC_MAX_FILES; ++fd) {
+        ProcFile *f = &p->files[fd];
+        // Rings and sockets stay the parent's; so does the ring's memory.
+        if (f->kind == PF_RING) {
+            vm_unmap(c->as, f->map, (uint64_t)ioring_page_count((IoRing*)f->file) * PAGE_SIZE);
+        }
+        if (f->kind == PF_RING || f->kind == PF_SOCKET) continue;
+        c->files[fd]       = *f;
+        c->files[fd].users = 0;
+        if (p->files[fd].kind == PF_FILE &&
+            !(c->files[fd].file = g_fs.dup(g_fs.ctx, p->files[fd].file))) {
+            for (int i = 0; i < fd; ++i) file_close(&c->files[i]);
+            proc_free(c);
+            return SYS_ENOMEM;
+        }
+    }
+    memcpy(c->fpu, p->fpu, FPU_STATE_SIZE);
+    str_copy(c->name, p->name, sizeof(c->name));
+    c->pid       = g_next_pid++;
+    c->sh        = p->sh;
+    c->mmap_next = p->mmap_next;
+    c->forked    = 1;
+    c->frame     = *f;
+    c->frame.rax = 0;
+    c->thread    = thread_create(proc_thread, c, c->name);
+    if (!c->thread) {
+        for (int fd = 0; fd < PROC_MAX_FILES; ++fd) file_close(&c->files[fd]);
+        proc_free(c);
+        return SYS_ENOMEM;
+    }
+    c->sibling  = p->children;
+    p->children = c;
+    return c->pid;
+}
+
+static int64_t sys_wait(Process *p, uint64_t pid) {
+    Process **link = &p->children;
+    while (*link && (*link)->pid != pid) link = &(*link)->sibling;
+    Process *c = *link;
+    if (!c) return SYS_ECHILD;
+    thread_join(c->thread);
+    *link = c->sibling;
+    int code = c->exit_code;
+    proc_free(c);
+    return code;
+}
+
+// ---------------------------------------------------------------------
+// I/O rings and sockets
+// ---------------------------------------------------------------------
+
+// A ring's memory is all mapped at setup, so page() is never asked for
+// once the ring may be gone.
+static void *ring_page(void *ctx, void *file, uint64_t index) {
+    (void)ctx;
+    IoRing *r = (IoRing*)file;
+    return index < ioring_page_count(r) ? ioring_page(r, (uint32_t)index) : 0;
+}
+
+static void *ring_dup(void *ctx, void *file) {
+    (void)ctx;
+    return file;
+}
+
+static void ring_close(void *ctx, void *file) {
+    (void)ctx; (void)file;
+}
+
+static const VmPager g_ring_pager = { ring_page, ring_dup, ring_close, 0 };
+
+// The position a request reads or writes at.
+static uint32_t *ring_pos(ProcFile *f, const IoSqe *sqe, uint32_t *at) {
+    if (sqe->off == IORING_OFF_CUR) return &f->pos;
+    *at = (uint32_t)sqe->off;
+    return at;
+}
+
+static int64_t ring_rw(Process *p, ProcFile *f, const IoSqe *sqe) {
+    int write = sqe->opcode == IORING_OP_WRITE;
+    uint32_t at;
+    // Not the command's input: a read of it could wait for good.
+    if (f->kind == PF_IN || f->kind == PF_RING || (!write && f->kind == PF_OUT) ||
+        (write && f->kind == PF_FILE && (f->flags & O_ACCMODE) == O_RDONLY) ||
+        (!write && (f->flags & O_ACCMODE) == O_WRONLY)) {
+        return SYS_EBADF;
+    }
+    if (sqe->off != IORING_OFF_CUR && sqe->off > 0xFFFFFFFFu) return SYS_EINVAL;
+    if (!vm_mapped(p->as, sqe->addr, sqe->len, !write)) return SYS_EFAULT;
+    if (f->kind == PF_SOCKET) {
+        return write ? socket_write(p, f, sqe->addr, sqe->len)
+                     : socket_read(p, f, sqe->addr, sqe->len);
+    }
+    return write ? file_write(p, f, sqe->addr, sqe->len, ring_pos(f, sqe, &at))
+                 : file_read(p, f, sqe->addr, sqe->len, ring_pos(f, sqe, &at));
+}
+
+static int64_t ring_accept(Process *p, ProcFile *f) {
+    if (f->kind != PF_SOCKET) return SYS_EBADF;
+    int fd = fd_alloc(p);
+    if (fd < 0) return SYS_EMFILE;
+    int err;
+    Socket *s = sock_accept((Socket*)f->file, 0, &err);
+    if (!s) {
+        if (err == NET_EAGAIN) return IORING_AGAIN;
+        return err == NET_ENOMEM ? SYS_ENOMEM : SYS_EINVAL;
+    }
+    ProcFile *c = &p->files[fd];
+    c->kind  = PF_SOCKET;
+    c->flags = O_RDWR;
+    c->pos   = 0;
+    c->file  = s;
+    return fd;
+}
+
+// IoRingOps.run() for a process's rings: its descriptors and memory.
+static int64_t ring_run(void *ctx, const IoSqe *sqe) {
+    Process *p = (Process*)ctx;
+    if (sqe->opcode == IORING_OP_OPEN) return sys_open(p, sqe->addr, sqe->flags);
+    ProcFile *f = file_get(p, (uint32_t)sqe->fd);
+    if (!f) return SYS_EBADF;
+    if (sqe->opcode == IORING_OP_CLOSE) {
+        // Not a ring, which would wait for its own workers.
+        if (f->kind == PF_RING) return SYS_EBADF;
+        file_close(f);
+        return 0;
+    }
+
+    int64_t r;
+    f->users++;
+    switch (sqe->opcode) {
+    case IORING_OP_READ:
+    case IORING_OP_WRITE:
+        r = ring_rw(p, f, sqe);
+        break;
+    case IORING_OP_FSYNC:
+        if (f->kind != PF_FILE) r = SYS_EINVAL;
+        else r = g_fs.sync(g_fs.ctx, f->file) < 0 ? SYS_EIO : 0;
+        break;
+    case IORING_OP_ACCEPT:
+        r = ring_accept(p, f);
+        break;
+    default:
+        r = SYS_EINVAL;
+        break;
+    }
+    f->users--;
+    return r;
+}
+
+static int64_t sys_ioring_setup(Process *p, uint64_t entries, uint64_t uring) {
+    if (!entries || entries > IORING_MAX_ENTRIES) return SYS_EINVAL;
+    if (!vm_mapped(p->as, uring, sizeof(uint64_t), 1)) return SYS_EFAULT;
+    int fd = fd_alloc(p);
+    if (fd < 0) return SYS_EMFILE;
+
+    IoRingOps ops = { ring_run, p };
+    IoRing   *r   = ioring_create((uint32_t)entries, &ops);
+    if (!r) return SYS_ENOMEM;
+    // Shared with the kernel, so never copied on write; faulted in now.
+    uint64_t len = (uint64_t)ioring_page_count(r) * PAGE_SIZE;
+    uint64_t va  = mmap_place(p, 0, len);
+    if (!va || vm_reserve(p->as, va, len, VM_WRITE | VM_SHARED, &g_ring_pager, r, 0) < 0) {
+        ioring_destroy(r);
+        return SYS_ENOMEM;
+    }
+    for (uint64_t off = 0; off < len; off += PAGE_SIZE) {
+        if (vm_fault(p->as, va + off, 1) < 0) {
+            vm_unmap(p->as, va, len);
+            ioring_destroy(r);
+            return SYS_ENOMEM;
+        }
+    }
+    if (vm_copy_out(p->as, uring, &va, sizeof(va)) < 0) {
+        vm_unmap(p->as, va, len);
+        ioring_destroy(r);
+        return SYS_EFAULT;
+    }
+
+    ProcFile *f = &p->files[fd];
+    f->kind  = PF_RING;
+    f->flags = O_RDWR;
+    f->pos   = 0;
+    f->file  = r;
+    f->map   = va;
+    return fd;
+}
+
+static int64_t sys_ioring_enter(Process *p, uint64_t fd, uint64_t submit, uint64_t wait) {
+    ProcFile *f = file_get(p, fd);
+    if (!f || f->kind != PF_RING) return SYS_EBADF;
+    IoRing  *r     = (IoRing*)f->file;
+    uint32_t taken = ioring_submit(r, submit > IORING_MAX_ENTRIES ? IORING_MAX_ENTRIES : (uint32_t)submit);
+    while (ioring_ready(r) < wait && ioring_in_flight(r) && !proc_killed(p)) thread_yield();
+    return taken;
+}
+
+static int64_t sys_listen(Process *p, uint64_t port, uint64_t backlog) {
+    if (!port || port > 0xFFFF || backlog > 64) return SYS_EINVAL;
+    int fd = fd_alloc(p);
+    if (fd < 0) return SYS_EMFILE;
+    Socket *s = sock_open(SOCK_STREAM);
+    if (!s) return SYS_ENOMEM;
+    int rc = sock_bind(s, (uint16_t)port);
+    if (rc == 0) rc = sock_listen(s, backlog ? (int)backlog : 4);
+    if (rc < 0) {
+        sock_close(s);
+        return rc == NET_EADDRINUSE ? SYS_EADDRINUSE : SYS_EINVAL;
+    }
+    ProcFile *f = &p->files[fd];
+    f->kind  = PF_SOCKET;
+    f->flags = O_RDWR;
+    f->pos   = 0;
+    f->file  = s;
+    return fd;
+}
+
+// Kept out of proc_syscall() so none of its SSE code can be scheduled
+// before the user's registers are saved.
+__attribute__((noinline)) static int64_t syscall_run(Process *p, SyscallFrame *f) {
+    int64_t r;
+    switch (f->rax) {
+    case SYS_READ:   r = sys_read(p, f->rdi, f->rsi, f->rdx);                     break;
+    case SYS_WRITE:  r = sys_write(p, f->rdi, f->rsi, f->rdx);                    break;
+    case SYS_OPEN:   r = sys_open(p, f->rdi, f->rsi);                             break;
+    case SYS_CLOSE:  r = sys_close(p, f->rdi);                                    break;
+    case SYS_MMAP:   r = sys_mmap(p, f->rdi, f->rsi, f->rdx, f->r10, f->r8, f->r9); break;
+    case SYS_MUNMAP: r = sys_munmap(p, f->rdi, f->rsi);                           break;
+    case SYS_EXIT:   proc_exit(p, (int)f->rdi);
+    case SYS_SPAWN:  r = sys_spawn(p, f->rdi, f->rsi);                            break;
+    case SYS_WAIT:   r = sys_wait(p, f->rdi);                                     break;
+    case SYS_FORK:   r = sys_fork(p, f);                                          break;
+    case SYS_IORING_SETUP: r = sys_ioring_setup(p, f->rdi, f->rsi);               break;
+    case SYS_IORING_ENTER: r = sys_ioring_enter(p, f->rdi, f->rsi, f->rdx);       break;
+    case SYS_LISTEN: r = sys_listen(p, f->rdi, f->rsi);                           break;
+    default:         r = SYS_ENOSYS;                                              break;
+    }
+    return r;
+}
+
+static void proc_syscall(SyscallFrame *f) {
+    Process *p = user_entered();
+    f->rax = (uint64_t)syscall_run(p, f);
+    if (proc_killed(p)) proc_exit(p, EXIT_KILLED);
+    user_resume(p);
+}
+
+// ---------------------------------------------------------------------
+// Traps from ring 3
+// ---------------------------------------------------------------------
+
+static const char *trap_name(uint64_t vector) {
+    switch (vector) {
+    case 0:  return "divide error";
+    case 3:  return "breakpoint";
+    case 6:  return "invalid opcode";
+    case 13: return "general protection fault";
+    case 14: return "page fault";
+    case 17: return "alignment check";
+    case 19: return "SIMD exception";
+    default: return "exception";
+    }
+}
+
+static void proc_trap(TrapFrame *f) {
+    Process *p = user_entered();
+
+    if (f->vector == TRAP_TIMER) {
+        cpu_timer_eoi();
+        // Left pending from before the current slice started: not ours.
+        if (rdtsc() - g_slice_start < g_slice_tsc / 2) {
+            user_resume(p);
+            return;
+        }
+        if (proc_killed(p)) proc_exit(p, EXIT_KILLED);
+        g_slice_owner = 0;              // a new slice when it goes back
+        thread_yield();
+        if (proc_killed(p)) proc_exit(p, EXIT_KILLED);
+        user_resume(p);
+        return;
+    }
+    if (f->vector >= 32) {
+        if (f->vector != TRAP_SPURIOUS) cpu_timer_eoi();
+        user_resume(p);
+        return;
+    }
+
+    // Demand paging and copy-on-write. A read of a page that is there is
+    // a real violation (an instruction fetch from data, say).
+    uint64_t cr2 = 0;
+    if (f->vector == TRAP_PAGE_FAULT) {
+        __asm__ volatile("mov %%cr2, %0" : "=r"(cr2));
+        int write = (f->error & 2) != 0;
+        if ((!(f->error & 1) || write) && vm_fault(p->as, cr2, write) == 0) {
+            if (proc_killed(p)) proc_exit(p, EXIT_KILLED);
+            user_resume(p);
+            return;
+        }
+    }
+
+    char line[96];
+    str_copy(line, p->name, sizeof(line));
+    str_cat(line, ": ", sizeof(line));
+    str_cat(line, trap_name(f->vector), sizeof(line));
+    if (f->vector == TRAP_PAGE_FAULT) {
+        str_cat(line, " at 0x", sizeof(line));
+        str_cat_hex(line, cr2, 16, sizeof(line));
+    }
+    str_cat(line, " (rip 0x", sizeof(line));
+    str_cat_hex(line, f->rip, 16, sizeof(line));
+    str_cat(line, ")", sizeof(line));
+    shell_print(p->sh, line);
+    proc_exit(p, EXIT_FAULT);
+}
+
+// ---------------------------------------------------------------------
+// run
+// ---------------------------------------------------------------------
+
+static void cmd_run(Shell *sh, int argc, char **argv) {
+    if (argc < 2) {
+        shell_print(sh, "run: usage: run <file> [args]");
+        return;
+    }
+    const char *why;
+    Process *p = proc_create(argv[1], argc - 1, argv + 1, sh, &why);
+    if (!p) {
+        char line[96];
+        str_copy(line, "run: ", sizeof(line));
+        str_cat(line, argv[1], sizeof(line));
+        str_cat(line, ": ", sizeof(line));
+        str_cat(line, why, sizeof(line));
+        shell_print(sh, line);
+        return;
+    }
+    proc_exec(p);
+    proc_free(p);
+}
+
+static const ShellCommand g_run_command = {
+    "run", { 0 }, "<file> [args]", "run a program in user mode", cmd_run
+};
+
+void proc_init(const ProcFs *fs) {
+    g_fs          = *fs;
+    g_pager.page  = fs->page;
+    g_pager.dup   = fs->dup;
+    g_pager.close = fs->close;
+    g_pager.ctx   = fs->ctx;
+    g_slice_tsc   = timer_tsc_per_ms() * PROC_SLICE_MS;
+    cpu_set_syscall_handler(proc_syscall);
+    cpu_set_trap_handler(proc_trap);
+    shell_register(&g_run_command);
+}
@@ -0,0 +1,788 @@
+// kernel/core/shell.c
+// Command registry (open-addressing hash over names and aliases),
+// tokenizer, pipeline jobs, filters, history and completion for the
+// Command Block shell.
+
+#include "shell.h"
+#include "thread.h"
+#include "mm.h"
+#include "klib.h"
+
+#define SHELL_HASH_SIZE 256     // power of two, well over names + aliases
+
+typedef struct {
+    const char         *key;    // 0 = empty slot
+    const ShellCommand *cmd;
+} ShellSlot;
+
+static ShellSlot           g_table[SHELL_HASH_SIZE];
+static const ShellCommand *g_commands[SHELL_MAX_COMMANDS];
+static int                 g_command_count = 0;
+
+// FNV-1a
+static uint32_t hash_name(const char *s) {
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (uint8_t)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// The slot holding name, or the empty slot where it would go.
+static ShellSlot *slot_for(const char *name) {
+    uint32_t i = hash_name(name) & (SHELL_HASH_SIZE - 1);
+    for (uint32_t probes = 0; probes < SHELL_HASH_SIZE; ++probes) {
+        ShellSlot *s = &g_table[i];
+        if (!s->key || str_eq(s->key, name)) return s;
+        i = (i + 1) & (SHELL_HASH_SIZE - 1);
+    }
+    return 0;
+}
+
+static int insert(const char *name, const ShellCommand *cmd) {
+    ShellSlot *s = slot_for(name);
+    if (!s || s->key) return -1;
+    s->key = name;
+    s->cmd = cmd;
+    return 0;
+}
+
+int shell_register(const ShellCommand *cmd) {
+    if (!cmd || !cmd->name || !cmd->fn) return -1;
+    if (g_command_count == SHELL_MAX_COMMANDS) return -1;
+
+    int rc = insert(cmd->name, cmd);
+    if (rc < 0) return -1;
+    for (int i = 0; i < SHELL_MAX_ALIASES && cmd->aliases[i]; ++i) {
+        if (insert(cmd->aliases[i], cmd) < 0) rc = -1;
+    }
+    g_commands[g_command_count++] = cmd;
+    return rc;
+}
+
+const ShellCommand *shell_find(const char *name) {
+    ShellSlot *s = slot_for(name);
+    return (s && s->key) ? s->cmd : 0;
+}
+
+int shell_command_count(void) {
+    return g_command_count;
+}
+
+const ShellCommand *shell_command(int i) {
+    return (i >= 0 && i < g_command_count) ? g_commands[i] : 0;
+}
+
+int shell_tokenize(const char *line, char *buf, uint32_t buf_len,
+                   char **argv, int max_args) {
+    int argc = 0;
+    uint32_t used = 0;
+    const char *p = line;
+
+    for (;;) {
+        while (*p == ' ' || *p == '\t') ++p;
+        if (!*p) break;
+        if (argc == max_args) return -1;
+
+        argv[argc++] = &buf[used];
+        while (*p && *p != ' ' && *p != '\t') {
+            if (*p == '"' || *p == '\'') {
+                char quote = *p++;
+                while (*p && *p != quote) {
+                    if (used + 1 >= buf_len) return -1;
+                    buf[used++] = *p++;
+                }
+                if (!*p) return -1;
+                ++p;
+                continue;
+            }
+            if (used + 1 >= buf_len) return -1;
+            buf[used++] = *p++;
+        }
+        if (used >= buf_len) return -1;
+        buf[used++] = '\0';
+    }
+    return argc;
+}
+
+// "name / alias / alias usage"
+static void format_synopsis(char *line, uint32_t max, const ShellCommand *c) {
+    str_copy(line, c->name, max);
+    for (int i = 0; i < SHELL_MAX_ALIASES && c->aliases[i]; ++i) {
+        str_cat(line, " / ", max);
+        str_cat(line, c->aliases[i], max);
+    }
+    if (c->usage) {
+        str_cat(line, " ", max);
+        str_cat(line, c->usage, max);
+    }
+}
+
+static void cmd_help(Shell *sh, int argc, char **argv) {
+    char line[96];
+    if (argc > 1) {
+        const ShellCommand *c = shell_find(argv[1]);
+        if (!c) {
+            str_copy(line, "help: no such command: ", sizeof(line));
+            str_cat(line, argv[1], sizeof(line));
+            shell_print(sh, line);
+            return;
+        }
+        format_synopsis(line, sizeof(line), c);
+        shell_print(sh, line);
+        str_copy(line, "  ", sizeof(line));
+        str_cat(line, c->help, sizeof(line));
+        shell_print(sh, line);
+        return;
+    }
+
+    shell_print(sh, "Commands:");
+    for (int i = 0; i < g_command_count; ++i) {
+        str_copy(line, "  ", sizeof(line));
+        format_synopsis(line + 2, sizeof(line) - 2, g_commands[i]);
+        shell_print(sh, line);
+    }
+    shell_print(sh, "'help <command>' describes one.");
+}
+
+static const ShellCommand g_help = {
+    "help", { "?" }, "[command]", "list commands, or describe one", cmd_help
+};
+
+
+// ---------------------------------------------------------------------
+// Jobs: one thread per command, pipes in between
+// ---------------------------------------------------------------------
+
+typedef struct {
+    Shell               sh;
+    const ShellCommand *cmd;
+    int                 argc;
+    char               *argv[SHELL_MAX_ARGS + 1];
+    char                words[SHELL_LINE_MAX];
+    Thread             *thread;
+} ShellStage;
+
+struct ShellJob {
+    ShellStage   stages[SHELL_MAX_STAGES];
+    Pipe        *pipes[SHELL_MAX_STAGES];   // pipes[i] carries stage i's output
+    int          count;
+    Pipe        *tty;                       // keys for shell_read_key()
+    ShellConsole con;
+    void        *file;                      // > / >> target, or 0
+    int          truncated;                 // the file filled up
+    int          cancelled;
+    char         partial[SHELL_LINE_MAX];   // console output without its '\n' yet
+    uint32_t     partial_len;
+};
+
+static ShellJob *g_job = 0;
+
+void shell_print(Shell *sh, const char *line) {
+    if (sh->broken) return;
+    if (!line) line = "";
+    if (pipe_write(sh->out, line, str_len(line)) < 0 ||
+        pipe_write(sh->out, "\n", 1) < 0) {
+        sh->broken = 1;
+    }
+}
+
+int shell_write(Shell *sh, const void *data, uint32_t len) {
+    if (sh->broken) return -1;
+    if (pipe_write(sh->out, data, len) < 0) {
+        sh->broken = 1;
+        return -1;
+    }
+    return (int)len;
+}
+
+int shell_read(Shell *sh, void *buf, uint32_t max) {
+    if (max == 0 || shell_cancelled(sh)) return -1;
+    if (sh->rpos < sh->rlen) {
+        uint32_t n = sh->rlen - sh->rpos;
+        if (n > max) n = max;
+        memcpy(buf, sh->rbuf + sh->rpos, n);
+        sh->rpos += n;
+        return (int)n;
+    }
+    return pipe_read(sh->in ? sh->in : sh->job->tty, buf, max, 1);
+}
+
+int shell_cancelled(const Shell *sh) {
+    return sh->broken || sh->job->cancelled;
+}
+
+int shell_read_line(Shell *sh, char *buf, uint32_t max) {
+    if (!sh->in || max == 0) return -1;
+    uint32_t len = 0;
+    for (;;) {
+        if (shell_cancelled(sh)) return -1;
+        if (sh->rpos == sh->rlen) {
+            int n = pipe_read(sh->in, sh->rbuf, sizeof(sh->rbuf), 1);
+            if (n < 0) {
+                if (!len) return -1;
+                break;                      // last line had no '\n'
+            }
+            sh->rpos = 0;
+            sh->rlen = (uint32_t)n;
+        }
+        char c = sh->rbuf[sh->rpos++];
+        if (c == '\n') break;
+        if (c == '\r') continue;
+        buf[len++] = c;
+        if (len == max - 1) break;
+    }
+    buf[len] = '\0';
+    return (int)len;
+}
+
+int shell_read_key(Shell *sh) {
+    char c;
+    if (sh->job->cancelled) return -1;
+    return pipe_read(sh->job->tty, &c, 1, 1) == 1 ? (uint8_t)c : -1;
+}
+
+static void stage_main(void *arg) {
+    ShellStage *s = (ShellStage*)arg;
+    if (!s->sh.job->cancelled) {
+        s->cmd->fn(&s->sh, s->argc, s->argv);
+    }
+    if (s->sh.in) pipe_close_read(s->sh.in);
+    pipe_close_write(s->sh.out);
+}
+
+static void job_free(ShellJob *job) {
+    for (int i = 0; i < job->count; ++i) {
+        thread_join(job->stages[i].thread);
+    }
+    for (int i = 0; i < SHELL_MAX_STAGES; ++i) {
+        pipe_free(job->pipes[i]);
+    }
+    pipe_free(job->tty);
+    if (job->file) job->con.close(job->con.ctx, job->file);
+    kfree(job);
+}
+
+// Cuts line (a copy) at unquoted '|' into segs and at an unquoted '>' or
+// '>>' into *target. Returns the number of segments, or -1 with *err set.
+static int split_line(char *line, char **segs, char **target, int *append,
+                      const char **err) {
+    int   count = 0;
+    char  quote = 0;
+    segs[count++] = line;
+    *target = 0;
+    *append = 0;
+
+    for (char *p = line; *p; ++p) {
+        if (quote) {
+            if (*p == quote) quote = 0;
+            continue;
+        }
+        if (*p == '"' || *p == '\'') {
+            quote = *p;
+        } else if (*p == '|') {
+            if (*target) {
+                *err = "Syntax error: '|' after a redirection.";
+                return -1;
+            }
+            if (count == SHELL_MAX_STAGES) {
+                *err = "Syntax error: too many commands in one pipeline.";
+                return -1;
+            }
+            *p = '\0';
+            segs[count++] = p + 1;
+        } else if (*p == '>') {
+            if (*target) {
+                *err = "Syntax error: more than one redirection.";
+                return -1;
+            }
+            *p = '\0';
+            if (p[1] == '>') {
+                *append = 1;
+                ++p;
+            }
+            *target = p + 1;
+        }
+    }
+    if (quote) {
+        *err = "Syntax error: unterminated quote.";
+        return -1;
+    }
+    return count;
+}
+
+static void report(const ShellConsole *con, const char *msg, const char *arg) {
+    char line[96];
+    str_copy(line, msg, sizeof(line));
+    if (arg) str_cat(line, arg, sizeof(line));
+    con->line(con->ctx, line);
+}
+
+int shell_start(const ShellConsole *con, const char *line) {
+    char  copy[SHELL_LINE_MAX];
+    char *segs[SHELL_MAX_STAGES];
+    char *target;
+    int   append;
+    const char *err = 0;
+
+    if (g_job) {
+        report(con, "A command is still running.", 0);
+        return -1;
+    }
+    if (str_len(line) >= sizeof(copy)) {
+        report(con, "Syntax error: line too long.", 0);
+        return -1;
+    }
+    str_copy(copy, line, sizeof(copy));
+    int count = split_line(copy, segs, &target, &append, &err);
+    if (count < 0) {
+        report(con, err, 0);
+        return -1;
+    }
+
+    ShellJob *job = (ShellJob*)kzalloc(sizeof(ShellJob));
+    if (!job) {
+        report(con, "Out of memory.", 0);
+        return -1;
+    }
+    job->con = *con;
+
+    // Every command must parse and exist before any of them runs.
+    for (int i = 0; i < count; ++i) {
+        ShellStage *s = &job->stages[i];
+        s->argc = shell_tokenize(segs[i], s->words, sizeof(s->words),
+                                 s->argv, SHELL_MAX_ARGS);
+        if (s->argc < 0) {
+            err = "Syntax error: too many words.";
+        } else if (s->argc == 0) {
+            if (count == 1 && !target) {
+                kfree(job);
+                return 1;
+            }
+            err = "Syntax error: empty command.";
+        } else if (!(s->cmd = shell_find(s->argv[0]))) {
+            report(con, "Unknown command: ", s->argv[0]);
+            con->line(con->ctx, "(type 'help')");
+            kfree(job);
+            return -1;
+        }
+        if (err) {
+            report(con, err, 0);
+            kfree(job);
+            return -1;
+        }
+        s->argv[s->argc] = 0;
+    }
+
+    if (target) {
+        char  name[SHELL_LINE_MAX];
+        char *argv[2];
+        if (shell_tokenize(target, name, sizeof(name), argv, 2) != 1) {
+            report(con, "Syntax error: '>' needs one file name.", 0);
+            kfree(job);
+            return -1;
+        }
+        job->file = con->open(con->ctx, argv[0], append);
+        if (!job->file) {
+            report(con, "Cannot write to ", argv[0]);
+            kfree(job);
+            return -1;
+        }
+    }
+
+    job->tty = pipe_create();
+    int ok = job->tty != 0;
+    for (int i = 0; i < count && ok; ++i) {
+        job->pipes[i] = pipe_create();
+        ok = job->pipes[i] != 0;
+    }
+    if (!ok) {
+        report(con, "Out of memory.", 0);
+        job_free(job);
+        return -1;
+    }
+
+    // A thread that can't be made cancels the job; the ones already made
+    // then run straight to their end and shell_poll() cleans up as usual.
+    for (int i = 0; i < count; ++i) {
+        ShellStage *s = &job->stages[i];
+        s->sh.in   = i ? job->pipes[i - 1] : 0;
+        s->sh.out  = job->pipes[i];
+        s->sh.job  = job;
+        s->sh.rows = con->rows;
+        s->thread  = thread_create(stage_main, s, s->argv[0]);
+        if (!s->thread) {
+            report(con, "Out of memory.", 0);
+            job->cancelled = 1;
+            if (i == 0) {
+                job_free(job);
+                return -1;
+            }
+            break;
+        }
+        job->count = i + 1;
+    }
+    g_job = job;
+    return 0;
+}
+
+int shell_busy(void) {
+    return g_job != 0;
+}
+
+static void flush_partial(ShellJob *job) {
+    job->partial[job->partial_len] = '\0';
+    job->con.line(job->con.ctx, job->partial);
+    job->partial_len = 0;
+}
+
+static void deliver(ShellJob *job, const char *data, uint32_t len) {
+    if (job->file) {
+        if (job->truncated) return;
+        int stored = job->con.write(job->con.ctx, job->file, data, len);
+        if (stored < (int)len) job->truncated = 1;
+        return;
+    }
+    for (uint32_t i = 0; i < len; ++i) {
+        char c = data[i];
+        if (c == '\n') {
+            flush_partial(job);
+        } else if (c != '\r' && job->partial_len < sizeof(job->partial) - 1) {
+            job->partial[job->partial_len++] = c;
+        }
+    }
+}
+
+int shell_poll(void) {
+    ShellJob *job = g_job;
+    if (!job) return 0;
+
+    thread_yield();
+
+    int  changed = 0;
+    int  n;
+    char buf[256];
+    Pipe *out = job->pipes[job->count - 1];
+    while ((n = pipe_read(out, buf, sizeof(buf), 0)) > 0) {
+        if (job->cancelled) continue;
+        deliver(job, buf, (uint32_t)n);
+        changed = !job->file;
+    }
+    if (n == 0) return changed;
+    for (int i = 0; i < job->count; ++i) {
+        if (!thread_done(job->stages[i].thread)) return changed;
+    }
+
+    if (job->partial_len && !job->cancelled) flush_partial(job);
+    if (job->truncated) {
+        job->con.line(job->con.ctx, "File is full: output truncated.");
+    }
+    g_job = 0;
+    job_free(job);
+    return 1;
+}
+
+void shell_key(char c) {
+    ShellJob *job = g_job;
+    if (!job || job->tty->write_closed) return;
+    // Never wait on a full tty: the job may not be reading keys at all.
+    if (job->tty->tail - job->tty->head < PIPE_SIZE) {
+        pipe_write(job->tty, &c, 1);
+    }
+}
+
+void shell_cancel(void) {
+    ShellJob *job = g_job;
+    if (!job) return;
+    job->cancelled = 1;
+    for (int i = 0; i < job->count; ++i) {
+        pipe_close_read(job->pipes[i]);
+        pipe_close_write(job->pipes[i]);
+    }
+    pipe_close_write(job->tty);
+}
+
+// ---------------------------------------------------------------------
+// Filters: grep, head, tail, wc, more
+// ---------------------------------------------------------------------
+
+#define FILTER_LINE 128
+
+static int no_input(Shell *sh, const char *name) {
+    if (sh->in) return 0;
+    char line[64];
+    str_copy(line, name, sizeof(line));
+    str_cat(line, ": reads a pipe, e.g. help | ", sizeof(line));
+    str_cat(line, name, sizeof(line));
+    shell_print(sh, line);
+    return 1;
+}
+
+// Decimal digits only; returns -1 otherwise.
+static int parse_count(const char *s, uint32_t *out) {
+    uint32_t v = 0;
+    if (!*s) return -1;
+    for (; *s; ++s) {
+        if (*s < '0' || *s > '9' || v > 100000000u) return -1;
+        v = v * 10 + (uint32_t)(*s - '0');
+    }
+    *out = v;
+    return 0;
+}
+
+static char lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+static int contains(const char *hay, const char *needle, int fold) {
+    if (!*needle) return 1;
+    for (; *hay; ++hay) {
+        const char *h = hay;
+        const char *n = needle;
+        while (*h && *n && (fold ? lower(*h) == lower(*n) : *h == *n)) {
+            ++h;
+            ++n;
+        }
+        if (!*n) return 1;
+    }
+    return 0;
+}
+
+static void cmd_grep(Shell *sh, int argc, char **argv) {
+    int fold = 0, invert = 0, i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; ++i) {
+        if (str_eq(argv[i], "-i"))      fold = 1;
+        else if (str_eq(argv[i], "-v")) invert = 1;
+        else break;
+    }
+    if (i != argc - 1) {
+        shell_print(sh, "Usage: grep [-i] [-v] <text>");
+        return;
+    }
+    if (no_input(sh, "grep")) return;
+
+    char line[FILTER_LINE];
+    while (shell_read_line(sh, line, sizeof(line)) >= 0) {
+        if (contains(line, argv[i], fold) != invert) shell_print(sh, line);
+    }
+}
+
+// "N", "-n N" or "-N"; 10 when absent.
+static int line_count_arg(int argc, char **argv, uint32_t *n) {
+    *n = 10;
+    if (argc == 1) return 0;
+    if (argc == 3 && str_eq(argv[1], "-n")) return parse_count(argv[2], n);
+    if (argc == 2 && argv[1][0] == '-') return parse_count(argv[1] + 1, n);
+    if (argc == 2) return parse_count(argv[1], n);
+    return -1;
+}
+
+static void cmd_head(Shell *sh, int argc, char **argv) {
+    uint32_t n;
+    if (line_count_arg(argc, argv, &n) < 0) {
+        shell_print(sh, "Usage: head [-n N]");
+        return;
+    }
+    if (no_input(sh, "head")) return;
+
+    // Stop reading as soon as we have enough; the writer sees the closed
+    // pipe and stops too.
+    char line[FILTER_LINE];
+    for (uint32_t i = 0; i < n && shell_read_line(sh, line, sizeof(line)) >= 0; ++i) {
+        shell_print(sh, line);
+    }
+}
+
+#define TAIL_MAX 100
+
+static void cmd_tail(Shell *sh, int argc, char **argv) {
+    uint32_t n;
+    if (line_count_arg(argc, argv, &n) < 0) {
+        shell_print(sh, "Usage: tail [-n N]");
+        return;
+    }
+    if (no_input(sh, "tail")) return;
+    if (n > TAIL_MAX) n = TAIL_MAX;
+    if (n == 0) return;
+
+    char (*ring)[FILTER_LINE] = (char(*)[FILTER_LINE])kmalloc(n * FILTER_LINE);
+    if (!ring) {
+        shell_print(sh, "tail: out of memory.");
+        return;
+    }
+    uint32_t seen = 0;
+    while (shell_read_line(sh, ring[seen % n], FILTER_LINE) >= 0) seen++;
+
+    uint32_t first = seen > n ? seen - n : 0;
+    for (uint32_t i = first; i < seen; ++i) shell_print(sh, ring[i % n]);
+    kfree(ring);
+}
+
+static void cmd_wc(Shell *sh, int argc, char **argv) {
+    (void)argv;
+    if (argc > 1) {
+        shell_print(sh, "Usage: wc");
+        return;
+    }
+    if (no_input(sh, "wc")) return;
+
+    uint64_t lines = 0, words = 0, bytes = 0;
+    int in_word = 0;
+    char buf[256];
+    int n;
+    while (!shell_cancelled(sh) && (n = pipe_read(sh->in, buf, sizeof(buf), 1)) > 0) {
+        bytes += (uint32_t)n;
+        for (int i = 0; i < n; ++i) {
+            char c = buf[i];
+            if (c == '\n') lines++;
+            if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+                in_word = 0;
+            } else if (!in_word) {
+                in_word = 1;
+                words++;
+            }
+        }
+    }
+
+    char line[64];
+    str_copy(line, "", sizeof(line));
+    str_cat_u64(line, lines, sizeof(line));
+    str_cat(line, " lines, ", sizeof(line));
+    str_cat_u64(line, words, sizeof(line));
+    str_cat(line, " words, ", sizeof(line));
+    str_cat_u64(line, bytes, sizeof(line));
+    str_cat(line, " bytes", sizeof(line));
+    shell_print(sh, line);
+}
+
+// A screenful at a time: Space for the next page, Enter for one more line,
+// q to stop.
+static void cmd_more(Shell *sh, int argc, char **argv) {
+    (void)argv;
+    if (argc > 1) {
+        shell_print(sh, "Usage: more");
+        return;
+    }
+    if (no_input(sh, "more")) return;
+
+    uint32_t page = sh->rows > 2 ? (uint32_t)sh->rows - 1 : 1;
+    uint32_t left = page;
+    char line[FILTER_LINE];
+    while (shell_read_line(sh, line, sizeof(line)) >= 0) {
+        if (!left) {
+            shell_print(sh, "-- More -- (Space: page, Enter: line, q: quit)");
+            int key;
+            do {
+                key = shell_read_key(sh);
+            } while (key != -1 && key != ' ' && key != '\n' && key != 'q' && key != 'Q');
+            if (key == -1 || key == 'q' || key == 'Q') return;
+            left = key == ' ' ? page : 1;
+        }
+        shell_print(sh, line);
+        left--;
+    }
+}
+
+static const ShellCommand g_filters[] = {
+    { "grep", { "find", "findstr" }, "[-i] [-v] <text>",
+      "pass only the lines containing text",        cmd_grep },
+    { "head", { 0 },                 "[-n N]",
+      "pass the first N lines (10)",                cmd_head },
+    { "tail", { 0 },                 "[-n N]",
+      "pass the last N lines (10, at most 100)",    cmd_tail },
+    { "wc",   { 0 },                 0,
+      "count lines, words and bytes",               cmd_wc },
+    { "more", { "less" },            0,
+      "show the input a screen at a time",          cmd_more },
+};
+
+// ---------------------------------------------------------------------
+// History and completion
+// ---------------------------------------------------------------------
+
+static char g_history[SHELL_HISTORY][SHELL_LINE_MAX];
+static int  g_history_added = 0;            // ever; the ring keeps the last ones
+
+void shell_history_add(const char *line) {
+    const char *p = line;
+    while (*p == ' ' || *p == '\t') ++p;
+    if (!*p) return;
+    if (g_history_added && str_eq(shell_history_get(0), line)) return;
+    str_copy(g_history[g_history_added % SHELL_HISTORY], line, SHELL_LINE_MAX);
+    g_history_added++;
+}
+
+int shell_history_count(void) {
+    return g_history_added < SHELL_HISTORY ? g_history_added : SHELL_HISTORY;
+}
+
+const char *shell_history_get(int age) {
+    if (age < 0 || age >= shell_history_count()) return 0;
+    return g_history[(g_history_added - 1 - age) % SHELL_HISTORY];
+}
+
+int shell_history_search(const char *text, int from_age) {
+    int count = shell_history_count();
+    for (int age = from_age < 0 ? 0 : from_age; age < count; ++age) {
+        if (contains(shell_history_get(age), text, 0)) return age;
+    }
+    return -1;
+}
+
+static void cmd_history(Shell *sh, int argc, char **argv) {
+    (void)argc; (void)argv;
+    char line[SHELL_LINE_MAX + 8];
+    for (int age = shell_history_count() - 1; age >= 0; --age) {
+        str_copy(line, "  ", sizeof(line));
+        str_cat_u64(line, (uint64_t)(g_history_added - age), sizeof(line));
+        str_cat(line, "  ", sizeof(line));
+        str_cat(line, shell_history_get(age), sizeof(line));
+        shell_print(sh, line);
+    }
+}
+
+static const ShellCommand g_history_command = {
+    "history", { 0 }, 0, "list the commands run so far", cmd_history
+};
+
+void shell_complete_begin(ShellCompletion *c, const char *prefix) {
+    c->prefix     = prefix;
+    c->prefix_len = str_len(prefix);
+    c->count      = 0;
+    c->common[0]  = '\0';
+    c->suffix     = 0;
+}
+
+void shell_complete_offer(ShellCompletion *c, const char *name, const char *suffix) {
+    for (uint32_t i = 0; i < c->prefix_len; ++i) {
+        if (name[i] != c->prefix[i]) return;
+    }
+    if (c->count < SHELL_COMPLETE_MAX) c->names[c->count] = name;
+    if (c->count++ == 0) {
+        str_copy(c->common, name, sizeof(c->common));
+        c->suffix = suffix;
+        return;
+    }
+    uint32_t i = c->prefix_len;
+    while (c->common[i] && c->common[i] == name[i]) ++i;
+    c->common[i] = '\0';
+}
+
+void shell_complete_commands(ShellCompletion *c) {
+    for (int i = 0; i < g_command_count; ++i) {
+        const ShellCommand *cmd = g_commands[i];
+        shell_complete_offer(c, cmd->name, " ");
+        for (int a = 0; a < SHELL_MAX_ALIASES && cmd->aliases[a]; ++a) {
+            shell_complete_offer(c, cmd->aliases[a], " ");
+        }
+    }
+}
+
+void shell_init(void) {
+    shell_register(&g_help);
+    shell_register(&g_history_command);
+    for (uint32_t i = 0; i < sizeof(g_filters) / sizeof(g_filters[0]); ++i) {
+        shell_register(&g_filters[i]);
+    }
+}
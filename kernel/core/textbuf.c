@@ -0,0 +1,284 @@
+// kernel/core/textbuf.c
+// Piece table over a read-only original and an append-only add buffer,
+// with undo/redo.
+
+#include "textbuf.h"
+#include "mm.h"
+#include "klib.h"
+
+static const char *piece_text(const TextBuf *tb, const TextPiece *p) {
+    return (p->add ? tb->add : tb->orig) + p->start;
+}
+
+// Makes room for need elements of size bytes, doubling.
+static int grow(void **arr, uint32_t *cap, uint32_t need, uint32_t size) {
+    if (need <= *cap) return 0;
+    uint32_t n = *cap ? *cap : 16;
+    while (n < need) n *= 2;
+    void *p = kmalloc((size_t)n * size);
+    if (!p) return -1;
+    if (*arr) {
+        memcpy(p, *arr, (size_t)*cap * size);
+        kfree(*arr);
+    }
+    *arr = p;
+    *cap = n;
+    return 0;
+}
+
+static int grow_pieces(TextBuf *tb, uint32_t need) {
+    return grow((void**)&tb->pieces, &tb->cap, need, sizeof(TextPiece));
+}
+
+int tb_init(TextBuf *tb, const char *orig, uint32_t len) {
+    memset(tb, 0, sizeof(*tb));
+    tb->orig     = orig;
+    tb->orig_len = len;
+    if (!len) return 0;
+    if (grow_pieces(tb, 1) < 0) return -1;
+    tb->pieces[0].add   = 0;
+    tb->pieces[0].start = 0;
+    tb->pieces[0].len   = len;
+    tb->count  = 1;
+    tb->length = len;
+    return 0;
+}
+
+void tb_free(TextBuf *tb) {
+    kfree(tb->add);
+    kfree(tb->pieces);
+    kfree(tb->edits);
+    memset(tb, 0, sizeof(*tb));
+}
+
+// The piece holding pos and where it starts; pos == length gives count.
+// Walks from the last piece found, so nearby lookups are cheap.
+static uint32_t find_piece(TextBuf *tb, uint32_t pos, uint32_t *start) {
+    uint32_t i  = tb->hint;
+    uint32_t at = tb->hint_pos;
+    if (pos < at) {
+        while (i > 0 && pos < at) {
+            i--;
+            at -= tb->pieces[i].len;
+        }
+    } else {
+        while (i < tb->count && pos >= at + tb->pieces[i].len) {
+            at += tb->pieces[i].len;
+            i++;
+        }
+    }
+    tb->hint     = i;
+    tb->hint_pos = at;
+    *start = at;
+    return i;
+}
+
+// Makes a piece start at pos and returns its index. The caller has made
+// room for one more piece.
+static uint32_t split_at(TextBuf *tb, uint32_t pos) {
+    uint32_t at;
+    uint32_t i = find_piece(tb, pos, &at);
+    if (i == tb->count || at == pos) return i;
+
+    TextPiece *p = &tb->pieces[i];
+    memmove(&tb->pieces[i + 2], &tb->pieces[i + 1],
+            (tb->count - i - 1) * sizeof(TextPiece));
+    tb->pieces[i + 1].add   = p->add;
+    tb->pieces[i + 1].start = p->start + (pos - at);
+    tb->pieces[i + 1].len   = p->len - (pos - at);
+    p->len = pos - at;
+    tb->count++;
+    return i + 1;
+}
+
+static int insert_piece(TextBuf *tb, uint32_t pos, uint8_t add,
+                        uint32_t start, uint32_t len) {
+    // Typing on: the piece that ends at pos continues into these bytes.
+    if (pos > 0) {
+        uint32_t at;
+        uint32_t i = find_piece(tb, pos - 1, &at);
+        TextPiece *p = &tb->pieces[i];
+        if (at + p->len == pos && p->add == add && p->start + p->len == start) {
+            p->len     += len;
+            tb->length += len;
+            return 0;
+        }
+    }
+    if (grow_pieces(tb, tb->count + 2) < 0) return -1;
+    uint32_t i = split_at(tb, pos);
+    memmove(&tb->pieces[i + 1], &tb->pieces[i], (tb->count - i) * sizeof(TextPiece));
+    tb->pieces[i].add   = add;
+    tb->pieces[i].start = start;
+    tb->pieces[i].len   = len;
+    tb->count++;
+    tb->length  += len;
+    tb->hint     = i;
+    tb->hint_pos = pos;
+    return 0;
+}
+
+static int remove_range(TextBuf *tb, uint32_t pos, uint32_t len) {
+    if (grow_pieces(tb, tb->count + 2) < 0) return -1;
+    uint32_t i = split_at(tb, pos);
+    uint32_t j = split_at(tb, pos + len);
+    memmove(&tb->pieces[i], &tb->pieces[j], (tb->count - j) * sizeof(TextPiece));
+    tb->count   -= j - i;
+    tb->length  -= len;
+    tb->hint     = i;
+    tb->hint_pos = pos;
+    return 0;
+}
+
+// Room is made first, so a failed edit changes nothing.
+static int reserve(TextBuf *tb, uint32_t add_bytes) {
+    if (grow((void**)&tb->edits, &tb->edit_cap, tb->edit_pos + 1, sizeof(TextEdit)) < 0) {
+        return -1;
+    }
+    return grow((void**)&tb->add, &tb->add_cap, tb->add_len + add_bytes, 1);
+}
+
+static void record(TextBuf *tb, uint8_t insert, uint32_t pos, uint32_t len,
+                   uint32_t add_off) {
+    if (tb->merge && tb->edit_pos && tb->edit_pos == tb->edit_count) {
+        TextEdit *e = &tb->edits[tb->edit_pos - 1];
+        int follows = insert ? e->pos + e->len == pos : e->pos == pos;
+        if (e->insert == insert && follows && e->add_off + e->len == add_off) {
+            e->len += len;
+            return;
+        }
+    }
+    TextEdit *e = &tb->edits[tb->edit_pos++];
+    e->insert  = insert;
+    e->pos     = pos;
+    e->len     = len;
+    e->add_off = add_off;
+    tb->edit_count = tb->edit_pos;
+    tb->merge = 1;
+}
+
+int tb_insert(TextBuf *tb, uint32_t pos, const char *text, uint32_t len) {
+    if (pos > tb->length) pos = tb->length;
+    if (!len) return 0;
+    if (reserve(tb, len) < 0) return -1;
+
+    uint32_t off = tb->add_len;
+    memcpy(tb->add + off, text, len);
+    if (insert_piece(tb, pos, 1, off, len) < 0) return -1;
+    tb->add_len += len;
+    record(tb, 1, pos, len, off);
+    return 0;
+}
+
+int tb_delete(TextBuf *tb, uint32_t pos, uint32_t len) {
+    if (pos >= tb->length) return 0;
+    if (len > tb->length - pos) len = tb->length - pos;
+    if (!len) return 0;
+    if (reserve(tb, len) < 0) return -1;
+
+    // Keep the bytes for undo.
+    uint32_t off = tb->add_len;
+    tb_read(tb, pos, tb->add + off, len);
+    if (remove_range(tb, pos, len) < 0) return -1;
+    tb->add_len += len;
+    record(tb, 0, pos, len, off);
+    return 0;
+}
+
+void tb_break_undo(TextBuf *tb) {
+    tb->merge = 0;
+}
+
+int tb_undo(TextBuf *tb, uint32_t *pos) {
+    if (!tb->edit_pos) return -1;
+    TextEdit *e = &tb->edits[tb->edit_pos - 1];
+    int rc = e->insert ? remove_range(tb, e->pos, e->len)
+                       : insert_piece(tb, e->pos, 1, e->add_off, e->len);
+    if (rc < 0) return -1;
+    tb->edit_pos--;
+    tb->merge = 0;
+    *pos = e->insert ? e->pos : e->pos + e->len;
+    return 0;
+}
+
+int tb_redo(TextBuf *tb, uint32_t *pos) {
+    if (tb->edit_pos == tb->edit_count) return -1;
+    TextEdit *e = &tb->edits[tb->edit_pos];
+    int rc = e->insert ? insert_piece(tb, e->pos, 1, e->add_off, e->len)
+                       : remove_range(tb, e->pos, e->len);
+    if (rc < 0) return -1;
+    tb->edit_pos++;
+    tb->merge = 0;
+    *pos = e->insert ? e->pos + e->len : e->pos;
+    return 0;
+}
+
+uint32_t tb_read(TextBuf *tb, uint32_t pos, char *dst, uint32_t len) {
+    uint32_t at;
+    uint32_t i = find_piece(tb, pos, &at);
+    uint32_t done = 0;
+    while (done < len && i < tb->count) {
+        const TextPiece *p = &tb->pieces[i];
+        uint32_t skip = pos + done - at;
+        uint32_t n = p->len - skip;
+        if (n > len - done) n = len - done;
+        memcpy(dst + done, piece_text(tb, p) + skip, n);
+        done += n;
+        at   += p->len;
+        i++;
+    }
+    return done;
+}
+
+int tb_char(TextBuf *tb, uint32_t pos) {
+    uint32_t at;
+    uint32_t i = find_piece(tb, pos, &at);
+    if (i == tb->count) return -1;
+    return (uint8_t)piece_text(tb, &tb->pieces[i])[pos - at];
+}
+
+void tb_iter(TextBuf *tb, TextIter *it, uint32_t pos) {
+    uint32_t at;
+    if (pos > tb->length) pos = tb->length;
+    it->tb    = tb;
+    it->piece = find_piece(tb, pos, &at);
+    it->off   = pos - at;
+    it->pos   = pos;
+}
+
+int ti_next(TextIter *it) {
+    const TextBuf *tb = it->tb;
+    while (it->piece < tb->count && it->off == tb->pieces[it->piece].len) {
+        it->piece++;
+        it->off = 0;
+    }
+    if (it->piece == tb->count) return -1;
+    it->pos++;
+    return (uint8_t)piece_text(tb, &tb->pieces[it->piece])[it->off++];
+}
+
+int ti_prev(TextIter *it) {
+    const TextBuf *tb = it->tb;
+    if (!it->pos) return -1;
+    while (!it->off) {
+        it->piece--;
+        it->off = tb->pieces[it->piece].len;
+    }
+    it->pos--;
+    return (uint8_t)piece_text(tb, &tb->pieces[it->piece])[--it->off];
+}
+
+int64_t tb_find(TextBuf *tb, uint32_t from, const char *needle, uint32_t n) {
+    if (!n) return -1;
+    TextIter it;
+    tb_iter(tb, &it, from);
+    for (;;) {
+        uint32_t pos = it.pos;
+        int c = ti_next(&it);
+        if (c < 0 || pos + n > tb->length) return -1;
+        if (c != (uint8_t)needle[0]) continue;
+        TextIter m = it;
+        uint32_t k = 1;
+        while (k < n && ti_next(&m) == (uint8_t)needle[k]) k++;
+        if (k == n) return pos;
+    }
+}
@@ -0,0 +1,39 @@
+// kernel/core/userbin.c
+// User program ELF files embedded with .incbin (the Makefile builds them
+// into USER_BIN_DIR first).
+
+#include "userbin.h"
+
+#define USER_BIN(sym, file)                                 \
+    ".balign 16\n"                                          \
+    ".global " #sym "_start, " #sym "_end\n"                \
+    #sym "_start:\n"                                        \
+    ".incbin \"" USER_BIN_DIR "/" file "\"\n"               \
+    #sym "_end:\n"
+
+__asm__(
+    ".section .rodata\n"
+    USER_BIN(user_hello, "hello.elf")
+    USER_BIN(user_upper, "upper.elf")
+    USER_BIN(user_echod, "echod.elf")
+    ".text\n"
+);
+
+extern const uint8_t user_hello_start[], user_hello_end[];
+extern const uint8_t user_upper_start[], user_upper_end[];
+extern const uint8_t user_echod_start[], user_echod_end[];
+
+const UserBinary *user_binaries(int *count) {
+    static UserBinary bins[3];
+    bins[0].name = "hello.elf";
+    bins[0].data = user_hello_start;
+    bins[0].size = (uint32_t)(user_hello_end - user_hello_start);
+    bins[1].name = "upper.elf";
+    bins[1].data = user_upper_start;
+    bins[1].size = (uint32_t)(user_upper_end - user_upper_start);
+    bins[2].name = "echod.elf";
+    bins[2].data = user_echod_start;
+    bins[2].size = (uint32_t)(user_echod_end - user_echod_start);
+    *count = 3;
+    return bins;
+}
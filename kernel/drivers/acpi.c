@@ -0,0 +1,63 @@
+// kernel/drivers/acpi.c
+// RSDP/XSDT walk to find ACPI tables by signature.
+
+#include "acpi.h"
+#include "klib.h"
+
+typedef struct __attribute__((packed)) {
+    char     signature[8];      // "RSD PTR "
+    uint8_t  checksum;          // first 20 bytes
+    char     oem_id[6];
+    uint8_t  revision;          // 0: ACPI 1.0, 2: ACPI 2.0+
+    uint32_t rsdt;
+    uint32_t length;            // 2.0+
+    uint64_t xsdt;
+    uint8_t  ext_checksum;      // whole structure
+    uint8_t  reserved[3];
+} AcpiRsdp;
+
+static const AcpiHeader *g_root = 0;   // XSDT, or RSDT on ACPI 1.0
+static int               g_xsdt = 0;
+
+static int checksum_ok(const void *p, uint32_t len) {
+    const uint8_t *b = (const uint8_t*)p;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < len; ++i) sum = (uint8_t)(sum + b[i]);
+    return sum == 0;
+}
+
+int acpi_init(uint64_t rsdp_addr) {
+    const AcpiRsdp *rsdp = (const AcpiRsdp*)(uintptr_t)rsdp_addr;
+    if (!rsdp || memcmp(rsdp->signature, "RSD PTR ", 8) != 0) return 0;
+    if (!checksum_ok(rsdp, 20)) return 0;
+
+    if (rsdp->revision >= 2 && rsdp->xsdt &&
+        checksum_ok(rsdp, rsdp->length)) {
+        g_root = (const AcpiHeader*)(uintptr_t)rsdp->xsdt;
+        g_xsdt = 1;
+    } else {
+        g_root = (const AcpiHeader*)(uintptr_t)rsdp->rsdt;
+        g_xsdt = 0;
+    }
+    if (!g_root || !checksum_ok(g_root, g_root->length)) {
+        g_root = 0;
+        return 0;
+    }
+    return 1;
+}
+
+const AcpiHeader *acpi_find_table(const char *signature) {
+    if (!g_root) return 0;
+    const uint8_t *entries = (const uint8_t*)g_root + sizeof(AcpiHeader);
+    uint32_t stride = g_xsdt ? 8 : 4;
+    uint32_t count = (g_root->length - (uint32_t)sizeof(AcpiHeader)) / stride;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        uint64_t addr = 0;
+        memcpy(&addr, entries + i * stride, stride);   // entries are unaligned
+        const AcpiHeader *t = (const AcpiHeader*)(uintptr_t)addr;
+        if (!t || memcmp(t->signature, signature, 4) != 0) continue;
+        if (checksum_ok(t, t->length)) return t;
+    }
+    return 0;
+}
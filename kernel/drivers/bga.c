@@ -0,0 +1,128 @@
+// kernel/drivers/bga.c
+// Bochs Graphics Adapter mode setting through the VBE DISPI registers.
+
+#include "bga.h"
+#include "pci.h"
+#include "io.h"
+
+#define BGA_PORT_INDEX 0x01CE
+#define BGA_PORT_DATA  0x01CF
+
+#define BGA_REG_ID          0x0
+#define BGA_REG_XRES        0x1
+#define BGA_REG_YRES        0x2
+#define BGA_REG_BPP         0x3
+#define BGA_REG_ENABLE      0x4
+#define BGA_REG_VIRT_WIDTH  0x6
+#define BGA_REG_X_OFFSET    0x8
+#define BGA_REG_Y_OFFSET    0x9
+#define BGA_REG_VIDEO_MEM   0xA     // in 64 KiB units
+
+#define BGA_ID_MIN          0xB0C0
+#define BGA_ID_MAX          0xB0C5
+
+#define BGA_ENABLED         0x01
+#define BGA_GETCAPS         0x02
+#define BGA_LFB_ENABLED     0x40
+
+static int      g_bga = 0;
+static uint32_t g_max_w, g_max_h;
+static uint64_t g_vram;
+
+static uint16_t bga_read(uint16_t reg) {
+    outw(BGA_PORT_INDEX, reg);
+    return inw(BGA_PORT_DATA);
+}
+
+static void bga_write(uint16_t reg, uint16_t v) {
+    outw(BGA_PORT_INDEX, reg);
+    outw(BGA_PORT_DATA, v);
+}
+
+// PCI functions known to expose the DISPI registers, framebuffer in BAR0.
+static const struct { uint16_t vendor, device; } g_bga_ids[] = {
+    { 0x1234, 0x1111 },     // QEMU/Bochs stdvga, bochs-display
+    { 0x80EE, 0xBEEF },     // VirtualBox VGA
+};
+
+int bga_probe(uint64_t fb_base) {
+    uint16_t id = bga_read(BGA_REG_ID);
+    if (id < BGA_ID_MIN || id > BGA_ID_MAX) return 0;
+
+    // Only take over if the framebuffer the loader gave us is the BGA's;
+    // other adapters (virtio-gpu, QXL) may answer on the same ports.
+    PciDevice *dev = 0;
+    for (unsigned k = 0; k < sizeof(g_bga_ids) / sizeof(g_bga_ids[0]); ++k) {
+        PciDevice *d = pci_find(g_bga_ids[k].vendor, g_bga_ids[k].device, 0);
+        int is_io;
+        if (d && pci_bar_base(d, 0, &is_io) == fb_base && !is_io) {
+            dev = d;
+            break;
+        }
+    }
+    if (!dev) return 0;
+    dev->claimed = 1;
+
+    // Limits: GETCAPS makes XRES/YRES/BPP read back their maxima.
+    uint16_t enable = bga_read(BGA_REG_ENABLE);
+    bga_write(BGA_REG_ENABLE, (uint16_t)(enable | BGA_GETCAPS));
+    g_max_w = bga_read(BGA_REG_XRES);
+    g_max_h = bga_read(BGA_REG_YRES);
+    bga_write(BGA_REG_ENABLE, enable);
+
+    g_vram = (uint64_t)bga_read(BGA_REG_VIDEO_MEM) * 64 * 1024;
+    if (!g_vram) g_vram = 16ull * 1024 * 1024;     // older versions: fixed
+    g_bga = 1;
+    return 1;
+}
+
+int bga_present(void) {
+    return g_bga;
+}
+
+static const DisplayMode g_std_modes[] = {
+    {  640,  480 }, {  800,  600 }, { 1024,  768 }, { 1152,  864 },
+    { 1280,  720 }, { 1280,  800 }, { 1280, 1024 }, { 1366,  768 },
+    { 1440,  900 }, { 1600,  900 }, { 1680, 1050 }, { 1920, 1080 },
+    { 1920, 1200 }, { 2560, 1440 },
+};
+
+int bga_modes(DisplayMode *out, int max) {
+    int n = 0;
+    if (!g_bga) return 0;
+    for (unsigned i = 0; i < sizeof(g_std_modes) / sizeof(g_std_modes[0]) && n < max; ++i) {
+        const DisplayMode *m = &g_std_modes[i];
+        if (m->width > g_max_w || m->height > g_max_h) continue;
+        if ((uint64_t)m->width * m->height * 4 > g_vram) continue;
+        out[n++] = *m;
+    }
+    return n;
+}
+
+static void bga_program(uint16_t width, uint16_t height) {
+    bga_write(BGA_REG_ENABLE, 0);
+    bga_write(BGA_REG_XRES, width);
+    bga_write(BGA_REG_YRES, height);
+    bga_write(BGA_REG_BPP, 32);
+    bga_write(BGA_REG_X_OFFSET, 0);
+    bga_write(BGA_REG_Y_OFFSET, 0);
+    bga_write(BGA_REG_ENABLE, BGA_ENABLED | BGA_LFB_ENABLED);
+}
+
+int bga_set_mode(uint32_t width, uint32_t height, uint32_t *pitch) {
+    if (!g_bga || width > g_max_w || height > g_max_h ||
+        (uint64_t)width * height * 4 > g_vram) {
+        return -1;
+    }
+    uint16_t old_w = bga_read(BGA_REG_XRES);
+    uint16_t old_h = bga_read(BGA_REG_YRES);
+
+    bga_program((uint16_t)width, (uint16_t)height);
+    if (bga_read(BGA_REG_XRES) != width || bga_read(BGA_REG_YRES) != height) {
+        bga_program(old_w, old_h);
+        return -1;
+    }
+    *pitch = bga_read(BGA_REG_VIRT_WIDTH);
+    if (*pitch < width) *pitch = width;
+    return 0;
+}
@@ -0,0 +1,73 @@
+// kernel/drivers/blkdev.c
+// Registry of block devices and their page cache backing.
+
+#include "blkdev.h"
+#include "mm.h"
+#include "klib.h"
+
+static BlockDevice *g_blkdevs[BLKDEV_MAX];
+static int          g_blkdev_count = 0;
+
+// count pages from page index, in requests the driver can take. The last
+// page of the device may be short.
+static int blk_transfer(BlockDevice *dev, int write, uint64_t index,
+                        void *const *pages, uint32_t count) {
+    uint64_t size = dev->sectors * BLK_SECTOR;
+    while (count) {
+        uint32_t n = count < dev->max_pages ? count : dev->max_pages;
+        uint64_t pos = index * PAGE_SIZE;
+        if (pos >= size) return -1;
+        uint64_t bytes = (uint64_t)n * PAGE_SIZE;
+        if (bytes > size - pos) bytes = size - pos;
+        uint32_t tail = (uint32_t)(bytes % PAGE_SIZE);
+        if (!write && tail) memset((uint8_t*)pages[n - 1] + tail, 0, PAGE_SIZE - tail);
+        int rc = dev->rw(dev, write, pos / BLK_SECTOR, pages, (uint32_t)bytes);
+        if (rc < 0) {
+            dev->stats.errors++;
+            return -1;
+        }
+        if (write) {
+            dev->stats.writes++;
+            dev->stats.write_bytes += bytes;
+        } else {
+            dev->stats.reads++;
+            dev->stats.read_bytes += bytes;
+        }
+        index += n;
+        pages += n;
+        count -= n;
+    }
+    return 0;
+}
+
+static int blk_read(void *ctx, uint64_t index, void *const *pages, uint32_t count) {
+    return blk_transfer((BlockDevice*)ctx, 0, index, pages, count);
+}
+
+static int blk_write(void *ctx, uint64_t index, void *const *pages, uint32_t count) {
+    return blk_transfer((BlockDevice*)ctx, 1, index, pages, count);
+}
+
+static const PcOps g_blk_ops    = { blk_read, blk_write };
+// No write: pc_write() refuses, rather than dirtying pages that never go.
+static const PcOps g_blk_ro_ops = { blk_read, 0 };
+
+int blkdev_register(BlockDevice *dev) {
+    if (!dev || g_blkdev_count >= BLKDEV_MAX || !dev->max_pages) return -1;
+    str_copy(dev->name, "vd", sizeof(dev->name));
+    char letter[2] = { (char)('a' + g_blkdev_count), '\0' };
+    str_cat(dev->name, letter, sizeof(dev->name));
+    pc_file_init(&dev->cache, dev->read_only ? &g_blk_ro_ops : &g_blk_ops, dev,
+                 dev->sectors * BLK_SECTOR);
+    g_blkdevs[g_blkdev_count++] = dev;
+    return 0;
+}
+
+int blkdev_count(void) {
+    return g_blkdev_count;
+}
+
+BlockDevice *blkdev_get(int index) {
+    if (index < 0 || index >= g_blkdev_count) return 0;
+    return g_blkdevs[index];
+}
@@ -0,0 +1,279 @@
+// kernel/drivers/keyboard.c
+// Keyboard driver: scancode translation, modifiers, software repeat and the
+// event queue.
+
+#include "keyboard.h"
+#include "timer.h"
+#include "io.h"
+
+#define PS2_DATA    0x60
+#define PS2_STATUS  0x64
+
+#define PS2_ACK     0xFA
+#define PS2_RESEND  0xFE
+#define PS2_SET_LEDS 0xED
+#define PS2_LED_TIMEOUT_MS 100      // no ACK by then: no keyboard, or lost
+
+// ---------------------------------------------------------------------
+// Translation tables
+// ---------------------------------------------------------------------
+
+// Scancode set 1 make codes (break = make | 0x80) to usages.
+static const uint8_t g_set1[128] = {
+    [0x01] = KEY_ESC,
+    [0x02] = KEY_1,     [0x03] = KEY_1 + 1, [0x04] = KEY_1 + 2, [0x05] = KEY_1 + 3,
+    [0x06] = KEY_1 + 4, [0x07] = KEY_1 + 5, [0x08] = KEY_1 + 6, [0x09] = KEY_1 + 7,
+    [0x0A] = KEY_1 + 8, [0x0B] = KEY_0,
+    [0x0C] = KEY_MINUS, [0x0D] = KEY_EQUAL, [0x0E] = KEY_BACKSPACE, [0x0F] = KEY_TAB,
+    [0x10] = KEY_LETTER('q'), [0x11] = KEY_LETTER('w'), [0x12] = KEY_LETTER('e'),
+    [0x13] = KEY_LETTER('r'), [0x14] = KEY_LETTER('t'), [0x15] = KEY_LETTER('y'),
+    [0x16] = KEY_LETTER('u'), [0x17] = KEY_LETTER('i'), [0x18] = KEY_LETTER('o'),
+    [0x19] = KEY_LETTER('p'),
+    [0x1A] = KEY_LBRACKET, [0x1B] = KEY_RBRACKET, [0x1C] = KEY_ENTER, [0x1D] = KEY_LCTRL,
+    [0x1E] = KEY_LETTER('a'), [0x1F] = KEY_LETTER('s'), [0x20] = KEY_LETTER('d'),
+    [0x21] = KEY_LETTER('f'), [0x22] = KEY_LETTER('g'), [0x23] = KEY_LETTER('h'),
+    [0x24] = KEY_LETTER('j'), [0x25] = KEY_LETTER('k'), [0x26] = KEY_LETTER('l'),
+    [0x27] = KEY_SEMICOLON, [0x28] = KEY_APOSTROPHE, [0x29] = KEY_GRAVE,
+    [0x2A] = KEY_LSHIFT, [0x2B] = KEY_BACKSLASH,
+    [0x2C] = KEY_LETTER('z'), [0x2D] = KEY_LETTER('x'), [0x2E] = KEY_LETTER('c'),
+    [0x2F] = KEY_LETTER('v'), [0x30] = KEY_LETTER('b'), [0x31] = KEY_LETTER('n'),
+    [0x32] = KEY_LETTER('m'),
+    [0x33] = KEY_COMMA, [0x34] = KEY_DOT, [0x35] = KEY_SLASH, [0x36] = KEY_RSHIFT,
+    [0x37] = KEY_KP_STAR, [0x38] = KEY_LALT, [0x39] = KEY_SPACE, [0x3A] = KEY_CAPSLOCK,
+    [0x3B] = KEY_FN(1), [0x3C] = KEY_FN(2), [0x3D] = KEY_FN(3), [0x3E] = KEY_FN(4),
+    [0x3F] = KEY_FN(5), [0x40] = KEY_FN(6), [0x41] = KEY_FN(7), [0x42] = KEY_FN(8),
+    [0x43] = KEY_FN(9), [0x44] = KEY_FN(10),
+    [0x45] = KEY_NUMLOCK, [0x46] = KEY_SCROLLLOCK,
+    [0x47] = KEY_KP_1 + 6, [0x48] = KEY_KP_1 + 7, [0x49] = KEY_KP_1 + 8, [0x4A] = KEY_KP_MINUS,
+    [0x4B] = KEY_KP_1 + 3, [0x4C] = KEY_KP_1 + 4, [0x4D] = KEY_KP_1 + 5, [0x4E] = KEY_KP_PLUS,
+    [0x4F] = KEY_KP_1,     [0x50] = KEY_KP_1 + 1, [0x51] = KEY_KP_1 + 2,
+    [0x52] = KEY_KP_0,     [0x53] = KEY_KP_DOT,
+    [0x56] = KEY_102ND, [0x57] = KEY_FN(11), [0x58] = KEY_FN(12),
+};
+
+// The same after an 0xE0 prefix. E0 2A / E0 36 (the fake shifts some
+// keyboards wrap around Print Screen and the arrows) map to nothing.
+static const uint8_t g_set1_e0[128] = {
+    [0x1C] = KEY_KP_ENTER, [0x1D] = KEY_RCTRL, [0x35] = KEY_KP_SLASH,
+    [0x37] = KEY_PRINTSCREEN, [0x38] = KEY_RALT,
+    [0x47] = KEY_HOME, [0x48] = KEY_UP,   [0x49] = KEY_PAGEUP,
+    [0x4B] = KEY_LEFT,                    [0x4D] = KEY_RIGHT,
+    [0x4F] = KEY_END,  [0x50] = KEY_DOWN, [0x51] = KEY_PAGEDOWN,
+    [0x52] = KEY_INSERT, [0x53] = KEY_DELETE,
+    [0x5B] = KEY_LGUI, [0x5C] = KEY_RGUI, [0x5D] = KEY_MENU,
+};
+
+// Keypad 1..9, 0, . with Num Lock off.
+static const uint8_t g_keypad_nav[11] = {
+    KEY_END, KEY_DOWN, KEY_PAGEDOWN, KEY_LEFT, KEY_KP_1 + 4, KEY_RIGHT,
+    KEY_HOME, KEY_UP, KEY_PAGEUP, KEY_INSERT, KEY_DELETE,
+};
+
+// Usage to character: unshifted, shifted (US layout).
+#define KEYMAP_LEN (KEY_102ND + 1)
+static const char g_keymap[KEYMAP_LEN][2] = {
+    [KEY_A +  0] = { 'a', 'A' }, [KEY_A +  1] = { 'b', 'B' }, [KEY_A +  2] = { 'c', 'C' },
+    [KEY_A +  3] = { 'd', 'D' }, [KEY_A +  4] = { 'e', 'E' }, [KEY_A +  5] = { 'f', 'F' },
+    [KEY_A +  6] = { 'g', 'G' }, [KEY_A +  7] = { 'h', 'H' }, [KEY_A +  8] = { 'i', 'I' },
+    [KEY_A +  9] = { 'j', 'J' }, [KEY_A + 10] = { 'k', 'K' }, [KEY_A + 11] = { 'l', 'L' },
+    [KEY_A + 12] = { 'm', 'M' }, [KEY_A + 13] = { 'n', 'N' }, [KEY_A + 14] = { 'o', 'O' },
+    [KEY_A + 15] = { 'p', 'P' }, [KEY_A + 16] = { 'q', 'Q' }, [KEY_A + 17] = { 'r', 'R' },
+    [KEY_A + 18] = { 's', 'S' }, [KEY_A + 19] = { 't', 'T' }, [KEY_A + 20] = { 'u', 'U' },
+    [KEY_A + 21] = { 'v', 'V' }, [KEY_A + 22] = { 'w', 'W' }, [KEY_A + 23] = { 'x', 'X' },
+    [KEY_A + 24] = { 'y', 'Y' }, [KEY_A + 25] = { 'z', 'Z' },
+    [KEY_1 + 0] = { '1', '!' }, [KEY_1 + 1] = { '2', '@' }, [KEY_1 + 2] = { '3', '#' },
+    [KEY_1 + 3] = { '4', '$' }, [KEY_1 + 4] = { '5', '%' }, [KEY_1 + 5] = { '6', '^' },
+    [KEY_1 + 6] = { '7', '&' }, [KEY_1 + 7] = { '8', '*' }, [KEY_1 + 8] = { '9', '(' },
+    [KEY_0]     = { '0', ')' },
+    [KEY_SPACE]      = { ' ', ' ' },
+    [KEY_MINUS]      = { '-', '_' }, [KEY_EQUAL]     = { '=', '+' },
+    [KEY_LBRACKET]   = { '[', '{' }, [KEY_RBRACKET]  = { ']', '}' },
+    [KEY_BACKSLASH]  = { '\\', '|' }, [KEY_SEMICOLON] = { ';', ':' },
+    [KEY_APOSTROPHE] = { '\'', '"' }, [KEY_GRAVE]     = { '`', '~' },
+    [KEY_COMMA]      = { ',', '<' }, [KEY_DOT]       = { '.', '>' },
+    [KEY_SLASH]      = { '/', '?' },
+    [KEY_KP_SLASH]   = { '/', '/' }, [KEY_KP_STAR]   = { '*', '*' },
+    [KEY_KP_MINUS]   = { '-', '-' }, [KEY_KP_PLUS]   = { '+', '+' },
+    [KEY_KP_1 + 0] = { '1', '1' }, [KEY_KP_1 + 1] = { '2', '2' }, [KEY_KP_1 + 2] = { '3', '3' },
+    [KEY_KP_1 + 3] = { '4', '4' }, [KEY_KP_1 + 4] = { '5', '5' }, [KEY_KP_1 + 5] = { '6', '6' },
+    [KEY_KP_1 + 6] = { '7', '7' }, [KEY_KP_1 + 7] = { '8', '8' }, [KEY_KP_1 + 8] = { '9', '9' },
+    [KEY_KP_0]     = { '0', '0' }, [KEY_KP_DOT]    = { '.', '.' },
+    [KEY_102ND]    = { '\\', '|' },
+};
+
+// ---------------------------------------------------------------------
+// State
+// ---------------------------------------------------------------------
+
+static uint8_t  g_mods  = 0;
+static uint8_t  g_locks = 0;        // Num Lock starts off, like the LEDs
+static uint32_t g_down[8];          // bitmap of held usages
+
+static uint8_t  g_repeat_code = 0;  // held key that repeats, 0 if none
+static uint64_t g_repeat_at   = 0;  // ms
+
+static KeyEvent g_queue[KBD_QUEUE_LEN];
+static uint32_t g_head = 0, g_tail = 0;
+static uint64_t g_dropped = 0;
+
+static int      g_e0 = 0;           // last byte was the 0xE0 prefix
+static int      g_pause_skip = 0;   // bytes left of the Pause sequence
+static int      g_led_step = 0;     // 1: 0xED sent, 2: LED byte sent
+static uint64_t g_led_at   = 0;     // ms, when the step began
+static uint8_t  g_led_sent = 0;
+
+// ---------------------------------------------------------------------
+// Events
+// ---------------------------------------------------------------------
+
+static int key_is_down(uint8_t code) {
+    return (g_down[code >> 5] >> (code & 31)) & 1;
+}
+
+static void key_set_down(uint8_t code, int down) {
+    if (down) g_down[code >> 5] |=  (1u << (code & 31));
+    else      g_down[code >> 5] &= ~(1u << (code & 31));
+}
+
+static void queue_push(const KeyEvent *ev) {
+    if (g_tail - g_head == KBD_QUEUE_LEN) {
+        g_dropped++;
+        return;
+    }
+    g_queue[g_tail++ % KBD_QUEUE_LEN] = *ev;
+}
+
+// Queues the event for physical key code in the current modifier and lock
+// state. Keypad keys turn into navigation keys with Num Lock off.
+static void emit(uint8_t code, uint8_t flags) {
+    KeyEvent ev = { code, flags, g_mods, 0 };
+    int nav = code >= KEY_KP_1 && code <= KEY_KP_DOT && !(g_locks & KLOCK_NUM);
+    if (nav) ev.code = g_keypad_nav[code - KEY_KP_1];
+    if (!nav && ev.code < KEYMAP_LEN && !(g_mods & (KMOD_CTRL | KMOD_LALT))) {
+        int shift = (g_mods & KMOD_SHIFT) != 0;
+        if (ev.code >= KEY_A && ev.code <= KEY_A + 25 && (g_locks & KLOCK_CAPS)) {
+            shift = !shift;
+        }
+        ev.ch = g_keymap[ev.code][shift];
+    }
+    queue_push(&ev);
+}
+
+static void leds_update(void);
+
+void kbd_key(uint8_t code, int pressed) {
+    if (!code) return;
+    if (pressed && key_is_down(code)) return;   // device typematic; we repeat ourselves
+    if (!pressed && !key_is_down(code)) return;
+    key_set_down(code, pressed);
+
+    if (code >= KEY_LCTRL && code <= KEY_RGUI) {
+        uint8_t bit = (uint8_t)(1u << (code - KEY_LCTRL));
+        g_mods = pressed ? (uint8_t)(g_mods | bit) : (uint8_t)(g_mods & ~bit);
+    } else if (pressed && (code == KEY_NUMLOCK || code == KEY_CAPSLOCK ||
+                           code == KEY_SCROLLLOCK)) {
+        g_locks ^= code == KEY_NUMLOCK  ? KLOCK_NUM :
+                   code == KEY_CAPSLOCK ? KLOCK_CAPS : KLOCK_SCROLL;
+        leds_update();
+    } else if (pressed) {
+        g_repeat_code = code;
+        g_repeat_at   = time_ms() + KBD_REPEAT_DELAY_MS;
+    } else if (code == g_repeat_code) {
+        g_repeat_code = 0;
+    }
+
+    emit(code, pressed ? KEY_PRESSED : 0);
+}
+
+void kbd_tick(void) {
+    if (!g_repeat_code) return;
+    uint64_t now = time_ms();
+    if (now < g_repeat_at) return;
+    emit(g_repeat_code, KEY_PRESSED | KEY_REPEAT);
+    // One repeat per tick: a stalled loop doesn't come back to a burst.
+    g_repeat_at = now + KBD_REPEAT_RATE_MS;
+}
+
+int kbd_read(KeyEvent *ev) {
+    if (g_head == g_tail) return 0;
+    *ev = g_queue[g_head++ % KBD_QUEUE_LEN];
+    return 1;
+}
+
+uint8_t kbd_mods(void) {
+    return g_mods;
+}
+
+uint8_t kbd_locks(void) {
+    return g_locks;
+}
+
+uint64_t kbd_dropped(void) {
+    return g_dropped;
+}
+
+// ---------------------------------------------------------------------
+// PS/2
+// ---------------------------------------------------------------------
+
+static void ps2_send(uint8_t v) {
+    for (int spin = 0; spin < 100000 && (inb(PS2_STATUS) & 0x02); ++spin) {
+        cpu_relax();
+    }
+    outb(PS2_DATA, v);
+}
+
+// The LED byte may only follow the keyboard's ACK of 0xED, which arrives
+// through the normal poll; kbd_ps2_byte() sends it from there. An update
+// still waiting for its ACK after PS2_LED_TIMEOUT_MS is given up on.
+static void leds_update(void) {
+    uint64_t now = time_ms();
+    if (g_led_step && now - g_led_at < PS2_LED_TIMEOUT_MS) return;
+    ps2_send(PS2_SET_LEDS);
+    g_led_step = 1;
+    g_led_at   = now;
+}
+
+static uint8_t leds_byte(void) {
+    return (uint8_t)(((g_locks & KLOCK_SCROLL) ? 0x01 : 0) |
+                     ((g_locks & KLOCK_NUM)    ? 0x02 : 0) |
+                     ((g_locks & KLOCK_CAPS)   ? 0x04 : 0));
+}
+
+void kbd_ps2_byte(uint8_t data) {
+    // Replies to our commands; no set-1 key produces these as a break code.
+    if (data == PS2_ACK || data == PS2_RESEND) {
+        if (data == PS2_ACK && g_led_step == 1) {
+            g_led_sent = leds_byte();
+            ps2_send(g_led_sent);
+            g_led_step = 2;
+            g_led_at   = time_ms();
+        } else {
+            g_led_step = 0;
+            // A lock key went down while the last update was in flight.
+            if (data == PS2_ACK && g_led_sent != leds_byte()) leds_update();
+        }
+        return;
+    }
+    if (data == 0x00 || data == 0xFF) return;   // buffer overrun
+
+    // Pause is E1 1D 45 E1 9D C5, press and release at once.
+    if (g_pause_skip) {
+        g_pause_skip--;
+        return;
+    }
+    if (data == 0xE1) {
+        g_pause_skip = 5;
+        kbd_key(KEY_PAUSE, 1);
+        kbd_key(KEY_PAUSE, 0);
+        return;
+    }
+    if (data == 0xE0) {
+        g_e0 = 1;
+        return;
+    }
+
+    const uint8_t *table = g_e0 ? g_set1_e0 : g_set1;
+    g_e0 = 0;
+    kbd_key(table[data & 0x7F], !(data & 0x80));
+}
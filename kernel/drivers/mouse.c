@@ -0,0 +1,68 @@
+// kernel/drivers/mouse.c
+// Pointer event queue shared by the mouse and tablet drivers.
+
+#include "mouse.h"
+
+static MouseEvent g_queue[MOUSE_QUEUE_LEN];
+static uint32_t   g_head = 0, g_tail = 0;
+static uint64_t   g_coalesced = 0;
+
+// Relative motion adds up; an absolute position replaces the last one.
+static void fold(MouseEvent *ev, int32_t x, int32_t y, int absolute) {
+    if (absolute) {
+        ev->dx = x;
+        ev->dy = y;
+    } else {
+        ev->dx += x;
+        ev->dy += y;
+    }
+}
+
+static void report(int32_t x, int32_t y, int32_t wheel, uint8_t buttons, int absolute) {
+    // Motion only: add it to the newest event unless that one changed the
+    // buttons or scrolled, which the UI must see in order.
+    if (g_tail != g_head) {
+        MouseEvent *last = &g_queue[(g_tail - 1) % MOUSE_QUEUE_LEN];
+        if (!wheel && !last->wheel && last->buttons == buttons &&
+            last->absolute == absolute) {
+            fold(last, x, y, absolute);
+            g_coalesced++;
+            return;
+        }
+        if (g_tail - g_head == MOUSE_QUEUE_LEN) {
+            // Full: fold into the newest anyway; only a brief button state
+            // in between can be lost. Positions and deltas don't mix, so a
+            // second device's event is dropped instead.
+            if (last->absolute != absolute) return;
+            fold(last, x, y, absolute);
+            last->wheel   += wheel;
+            last->buttons  = buttons;
+            g_coalesced++;
+            return;
+        }
+    }
+    MouseEvent *ev = &g_queue[g_tail++ % MOUSE_QUEUE_LEN];
+    ev->dx       = x;
+    ev->dy       = y;
+    ev->wheel    = wheel;
+    ev->buttons  = buttons;
+    ev->absolute = (uint8_t)absolute;
+}
+
+void mouse_report(int32_t dx, int32_t dy, int32_t wheel, uint8_t buttons) {
+    report(dx, dy, wheel, buttons, 0);
+}
+
+void mouse_report_abs(int32_t x, int32_t y, int32_t wheel, uint8_t buttons) {
+    report(x, y, wheel, buttons, 1);
+}
+
+int mouse_read(MouseEvent *ev) {
+    if (g_head == g_tail) return 0;
+    *ev = g_queue[g_head++ % MOUSE_QUEUE_LEN];
+    return 1;
+}
+
+uint64_t mouse_coalesced(void) {
+    return g_coalesced;
+}
@@ -0,0 +1,169 @@
+// kernel/drivers/pci.c
+// PCI configuration space access and a one-shot bus scan at boot.
+
+#include "pci.h"
+#include "io.h"
+
+#define PCI_CONFIG_ADDR 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+
+static PciDevice g_pci[PCI_MAX_DEVICES];
+static int       g_pci_count = 0;
+
+// ---------------------------------------------------------------------
+// Raw configuration access
+// ---------------------------------------------------------------------
+
+static uint32_t cfg_addr(uint8_t bus, uint8_t dev, uint8_t func, uint8_t off) {
+    return 0x80000000u |
+           ((uint32_t)bus  << 16) |
+           ((uint32_t)dev  << 11) |
+           ((uint32_t)func << 8)  |
+           (off & 0xFC);
+}
+
+static uint32_t cfg_read32(uint8_t bus, uint8_t dev, uint8_t func, uint8_t off) {
+    outl(PCI_CONFIG_ADDR, cfg_addr(bus, dev, func, off));
+    return inl(PCI_CONFIG_DATA);
+}
+
+uint32_t pci_read32(const PciDevice *d, uint8_t off) {
+    return cfg_read32(d->bus, d->dev, d->func, off);
+}
+
+uint16_t pci_read16(const PciDevice *d, uint8_t off) {
+    return (uint16_t)(pci_read32(d, off) >> ((off & 2) * 8));
+}
+
+uint8_t pci_read8(const PciDevice *d, uint8_t off) {
+    return (uint8_t)(pci_read32(d, off) >> ((off & 3) * 8));
+}
+
+void pci_write32(const PciDevice *d, uint8_t off, uint32_t v) {
+    outl(PCI_CONFIG_ADDR, cfg_addr(d->bus, d->dev, d->func, off));
+    outl(PCI_CONFIG_DATA, v);
+}
+
+void pci_write16(const PciDevice *d, uint8_t off, uint16_t v) {
+    outl(PCI_CONFIG_ADDR, cfg_addr(d->bus, d->dev, d->func, off));
+    outw((uint16_t)(PCI_CONFIG_DATA + (off & 2)), v);
+}
+
+void pci_write8(const PciDevice *d, uint8_t off, uint8_t v) {
+    outl(PCI_CONFIG_ADDR, cfg_addr(d->bus, d->dev, d->func, off));
+    outb((uint16_t)(PCI_CONFIG_DATA + (off & 3)), v);
+}
+
+// ---------------------------------------------------------------------
+// Enumeration
+// ---------------------------------------------------------------------
+
+static void pci_add(uint8_t bus, uint8_t dev, uint8_t func, uint32_t id) {
+    if (g_pci_count >= PCI_MAX_DEVICES) return;
+    PciDevice *d = &g_pci[g_pci_count++];
+    d->bus       = bus;
+    d->dev       = dev;
+    d->func      = func;
+    d->vendor_id = (uint16_t)(id & 0xFFFF);
+    d->device_id = (uint16_t)(id >> 16);
+
+    uint32_t class_reg = cfg_read32(bus, dev, func, PCI_CFG_REVISION);
+    d->class_code = (uint8_t)(class_reg >> 24);
+    d->subclass   = (uint8_t)(class_reg >> 16);
+    d->prog_if    = (uint8_t)(class_reg >> 8);
+    d->irq_line   = (uint8_t)cfg_read32(bus, dev, func, PCI_CFG_IRQ_LINE);
+    d->claimed    = 0;
+}
+
+void pci_init(void) {
+    g_pci_count = 0;
+    // Brute-force scan: firmware has configured the bridges, and 8K config
+    // reads at boot are cheap compared to walking bridge secondary buses.
+    for (uint32_t bus = 0; bus < 256; ++bus) {
+        for (uint8_t dev = 0; dev < 32; ++dev) {
+            uint32_t id = cfg_read32((uint8_t)bus, dev, 0, PCI_CFG_VENDOR_ID);
+            if ((id & 0xFFFF) == 0xFFFF) continue;
+
+            uint8_t header = (uint8_t)(cfg_read32((uint8_t)bus, dev, 0, 0x0C) >> 16);
+            uint8_t funcs  = (header & 0x80) ? 8 : 1;
+            for (uint8_t func = 0; func < funcs; ++func) {
+                if (func) {
+                    id = cfg_read32((uint8_t)bus, dev, func, PCI_CFG_VENDOR_ID);
+                    if ((id & 0xFFFF) == 0xFFFF) continue;
+                }
+                pci_add((uint8_t)bus, dev, func, id);
+            }
+        }
+    }
+}
+
+int pci_device_count(void) {
+    return g_pci_count;
+}
+
+PciDevice *pci_get(int index) {
+    if (index < 0 || index >= g_pci_count) return 0;
+    return &g_pci[index];
+}
+
+PciDevice *pci_find(uint16_t vendor, uint16_t device, int start) {
+    for (int i = start; i < g_pci_count; ++i) {
+        if (g_pci[i].vendor_id == vendor && g_pci[i].device_id == device) {
+            return &g_pci[i];
+        }
+    }
+    return 0;
+}
+
+PciDevice *pci_find_class(uint8_t class_code, uint8_t subclass, uint8_t prog_if, int start) {
+    for (int i = start; i < g_pci_count; ++i) {
+        if (g_pci[i].class_code == class_code &&
+            g_pci[i].subclass   == subclass &&
+            g_pci[i].prog_if    == prog_if) {
+            return &g_pci[i];
+        }
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------
+// BARs and capabilities
+// ---------------------------------------------------------------------
+
+uint64_t pci_bar_base(const PciDevice *d, int bar, int *is_io) {
+    if (bar < 0 || bar > 5) return 0;
+    uint8_t  off = (uint8_t)(PCI_CFG_BAR0 + bar * 4);
+    uint32_t lo  = pci_read32(d, off);
+
+    if (lo & 1) {
+        if (is_io) *is_io = 1;
+        return lo & ~0x3u;
+    }
+    if (is_io) *is_io = 0;
+
+    uint64_t base = lo & ~0xFu;
+    if (((lo >> 1) & 3) == 2 && bar < 5) {
+        base |= (uint64_t)pci_read32(d, (uint8_t)(off + 4)) << 32;
+    }
+    return base;
+}
+
+void pci_enable(const PciDevice *d) {
+    uint16_t cmd = pci_read16(d, PCI_CFG_COMMAND);
+    cmd |= PCI_CMD_IO | PCI_CMD_MEMORY | PCI_CMD_BUS_MASTER | PCI_CMD_INTX_OFF;
+    pci_write16(d, PCI_CFG_COMMAND, cmd);
+}
+
+uint8_t pci_find_cap(const PciDevice *d, uint8_t cap_id, uint8_t after) {
+    if (!(pci_read16(d, PCI_CFG_STATUS) & PCI_STATUS_CAP_LIST)) return 0;
+
+    uint8_t ptr = after ? pci_read8(d, (uint8_t)(after + 1))
+                        : pci_read8(d, PCI_CFG_CAP_PTR);
+    // Bound the walk so a broken list cannot loop forever.
+    for (int guard = 0; ptr >= 0x40 && guard < 48; ++guard) {
+        ptr &= 0xFC;
+        if (pci_read8(d, ptr) == cap_id) return ptr;
+        ptr = pci_read8(d, (uint8_t)(ptr + 1));
+    }
+    return 0;
+}
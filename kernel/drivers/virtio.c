@@ -0,0 +1,318 @@
+// kernel/drivers/virtio.c
+// Virtio 1.0 PCI transport and split virtqueue handling shared by the virtio
+// device drivers.
+
+#include "virtio.h"
+#include "io.h"
+#include "mm.h"
+#include "klib.h"
+
+// virtio_pci_cap cfg_type values
+#define VIRTIO_PCI_CAP_COMMON 1
+#define VIRTIO_PCI_CAP_NOTIFY 2
+#define VIRTIO_PCI_CAP_ISR    3
+#define VIRTIO_PCI_CAP_DEVICE 4
+
+// Offsets in the common configuration structure
+#define VCOMMON_DFSELECT   0x00
+#define VCOMMON_DF         0x04
+#define VCOMMON_GFSELECT   0x08
+#define VCOMMON_GF         0x0C
+#define VCOMMON_MSIX       0x10
+#define VCOMMON_NUMQ       0x12
+#define VCOMMON_STATUS     0x14
+#define VCOMMON_CFGGEN     0x15
+#define VCOMMON_Q_SELECT   0x16
+#define VCOMMON_Q_SIZE     0x18
+#define VCOMMON_Q_MSIX     0x1A
+#define VCOMMON_Q_ENABLE   0x1C
+#define VCOMMON_Q_NOFF     0x1E
+#define VCOMMON_Q_DESC     0x20
+#define VCOMMON_Q_DRIVER   0x28
+#define VCOMMON_Q_DEVICE   0x30
+
+#define VIRTIO_MSI_NO_VECTOR 0xFFFF
+
+// ---------------------------------------------------------------------
+// Transport
+// ---------------------------------------------------------------------
+
+static void common_write64(VirtioDevice *vd, uint32_t off, uint64_t v) {
+    // 64-bit fields may be written as two 32-bit halves, low first.
+    mmio_write32(vd->common + off,     (uint32_t)v);
+    mmio_write32(vd->common + off + 4, (uint32_t)(v >> 32));
+}
+
+static void set_status(VirtioDevice *vd, uint8_t bits) {
+    uint8_t s = mmio_read8(vd->common + VCOMMON_STATUS);
+    mmio_write8(vd->common + VCOMMON_STATUS, (uint8_t)(s | bits));
+}
+
+int virtio_pci_init(VirtioDevice *vd, PciDevice *pci) {
+    memset(vd, 0, sizeof(*vd));
+    vd->pci = pci;
+
+    for (uint8_t cap = pci_find_cap(pci, PCI_CAP_ID_VENDOR, 0);
+         cap;
+         cap = pci_find_cap(pci, PCI_CAP_ID_VENDOR, cap)) {
+        uint8_t  type   = pci_read8(pci, (uint8_t)(cap + 3));
+        uint8_t  bar    = pci_read8(pci, (uint8_t)(cap + 4));
+        uint32_t offset = pci_read32(pci, (uint8_t)(cap + 8));
+        if (bar > 5) continue;
+
+        int      is_io = 0;
+        uint64_t base  = pci_bar_base(pci, bar, &is_io);
+        if (!base || is_io) continue;
+        uint64_t addr = base + offset;
+
+        // Use the first structure of each type, as the spec recommends.
+        switch (type) {
+            case VIRTIO_PCI_CAP_COMMON:
+                if (!vd->common) vd->common = addr;
+                break;
+            case VIRTIO_PCI_CAP_NOTIFY:
+                if (!vd->notify_base) {
+                    vd->notify_base = addr;
+                    vd->notify_mult = pci_read32(pci, (uint8_t)(cap + 16));
+                }
+                break;
+            case VIRTIO_PCI_CAP_ISR:
+                if (!vd->isr) vd->isr = addr;
+                break;
+            case VIRTIO_PCI_CAP_DEVICE:
+                if (!vd->device_cfg) vd->device_cfg = addr;
+                break;
+            default:
+                break;
+        }
+    }
+    if (!vd->common || !vd->notify_base) return -1;
+
+    pci_enable(pci);
+    virtio_reset(vd);
+
+    set_status(vd, VIRTIO_STATUS_ACK);
+    set_status(vd, VIRTIO_STATUS_DRIVER);
+    mmio_write16(vd->common + VCOMMON_MSIX, VIRTIO_MSI_NO_VECTOR);
+    return 0;
+}
+
+uint64_t virtio_device_features(VirtioDevice *vd) {
+    mmio_write32(vd->common + VCOMMON_DFSELECT, 0);
+    uint64_t lo = mmio_read32(vd->common + VCOMMON_DF);
+    mmio_write32(vd->common + VCOMMON_DFSELECT, 1);
+    uint64_t hi = mmio_read32(vd->common + VCOMMON_DF);
+    return lo | (hi << 32);
+}
+
+int virtio_negotiate(VirtioDevice *vd, uint64_t wanted) {
+    uint64_t offered = virtio_device_features(vd);
+    if (!(offered & VIRTIO_F_VERSION_1)) return -1;
+
+    vd->features = offered & (wanted | VIRTIO_F_VERSION_1);
+    mmio_write32(vd->common + VCOMMON_GFSELECT, 0);
+    mmio_write32(vd->common + VCOMMON_GF, (uint32_t)vd->features);
+    mmio_write32(vd->common + VCOMMON_GFSELECT, 1);
+    mmio_write32(vd->common + VCOMMON_GF, (uint32_t)(vd->features >> 32));
+
+    set_status(vd, VIRTIO_STATUS_FEATURES_OK);
+    if (!(mmio_read8(vd->common + VCOMMON_STATUS) & VIRTIO_STATUS_FEATURES_OK)) {
+        return -1;
+    }
+    return 0;
+}
+
+void virtio_driver_ok(VirtioDevice *vd) {
+    set_status(vd, VIRTIO_STATUS_DRIVER_OK);
+}
+
+void virtio_fail(VirtioDevice *vd) {
+    if (vd->common) set_status(vd, VIRTIO_STATUS_FAILED);
+}
+
+// Reset and wait for the device to acknowledge it; after that it touches
+// none of our memory.
+void virtio_reset(VirtioDevice *vd) {
+    if (!vd->common) return;
+    mmio_write8(vd->common + VCOMMON_STATUS, 0);
+    for (int spin = 0; spin < 1000000; ++spin) {
+        if (mmio_read8(vd->common + VCOMMON_STATUS) == 0) break;
+        cpu_relax();
+    }
+}
+
+uint8_t virtio_cfg_read8(VirtioDevice *vd, uint32_t off) {
+    return mmio_read8(vd->device_cfg + off);
+}
+
+uint16_t virtio_cfg_read16(VirtioDevice *vd, uint32_t off) {
+    return mmio_read16(vd->device_cfg + off);
+}
+
+uint32_t virtio_cfg_read32(VirtioDevice *vd, uint32_t off) {
+    return mmio_read32(vd->device_cfg + off);
+}
+
+void virtio_cfg_write8(VirtioDevice *vd, uint32_t off, uint8_t v) {
+    mmio_write8(vd->device_cfg + off, v);
+}
+
+// ---------------------------------------------------------------------
+// Virtqueues
+// ---------------------------------------------------------------------
+
+int virtio_queue_setup(VirtioDevice *vd, VirtQueue *vq,
+                       uint16_t index, uint16_t max_size) {
+    memset(vq, 0, sizeof(*vq));
+
+    mmio_write16(vd->common + VCOMMON_Q_SELECT, index);
+    uint16_t size = mmio_read16(vd->common + VCOMMON_Q_SIZE);
+    if (size == 0) return -1;
+
+    // Split rings must be a power of two.
+    uint16_t n = 1;
+    while ((uint16_t)(n << 1) != 0 && (uint16_t)(n << 1) <= size &&
+           (uint16_t)(n << 1) <= max_size) {
+        n = (uint16_t)(n << 1);
+    }
+    mmio_write16(vd->common + VCOMMON_Q_SIZE, n);
+
+    // desc (16 bytes each) | avail (flags, idx, ring[n], used_event)
+    // | pad to 4 | used (flags, idx, ring[n], avail_event)
+    uint64_t desc_bytes  = 16ull * n;
+    uint64_t avail_bytes = 6ull + 2ull * n;
+    uint64_t used_off    = (desc_bytes + avail_bytes + 3) & ~3ull;
+    uint64_t total       = used_off + 6ull + 8ull * n;
+    uint32_t order       = page_order_for(total);
+
+    uint8_t *mem = (uint8_t *)page_alloc(order);
+    if (!mem) return -1;
+    memset(mem, 0, (uint64_t)PAGE_SIZE << order);
+
+    vq->cookie = (void **)kzalloc(sizeof(void *) * n);
+    if (!vq->cookie) {
+        page_free(mem, order);
+        return -1;
+    }
+
+    vq->vdev        = vd;
+    vq->index       = index;
+    vq->size        = n;
+    vq->desc        = (VirtqDesc *)mem;
+    vq->avail       = (volatile VirtqAvail *)(mem + desc_bytes);
+    vq->used        = (volatile VirtqUsed *)(mem + used_off);
+    vq->avail_event = (volatile uint16_t *)&vq->used->ring[n];
+
+    for (uint16_t i = 0; i < n; ++i) {
+        vq->desc[i].next = (uint16_t)(i + 1);
+    }
+    vq->free_head = 0;
+    vq->num_free  = n;
+
+    // We poll: ask the device not to interrupt us. With EVENT_IDX the device
+    // ignores this flag, but no MSI-X vector is assigned and INTx is masked,
+    // so nothing is delivered either way.
+    vq->avail->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+
+    mmio_write16(vd->common + VCOMMON_Q_MSIX, VIRTIO_MSI_NO_VECTOR);
+    common_write64(vd, VCOMMON_Q_DESC,   (uint64_t)(uintptr_t)vq->desc);
+    common_write64(vd, VCOMMON_Q_DRIVER, (uint64_t)(uintptr_t)vq->avail);
+    common_write64(vd, VCOMMON_Q_DEVICE, (uint64_t)(uintptr_t)vq->used);
+
+    uint16_t noff   = mmio_read16(vd->common + VCOMMON_Q_NOFF);
+    vq->notify_addr = vd->notify_base + (uint64_t)noff * vd->notify_mult;
+
+    mmio_write16(vd->common + VCOMMON_Q_ENABLE, 1);
+    return 0;
+}
+
+void virtio_queue_free(VirtQueue *vq) {
+    if (vq->desc) {
+        uint64_t used_off = (16ull * vq->size + 6ull + 2ull * vq->size + 3) & ~3ull;
+        page_free(vq->desc, page_order_for(used_off + 6ull + 8ull * vq->size));
+    }
+    kfree(vq->cookie);
+    memset(vq, 0, sizeof(*vq));
+}
+
+int virtq_add(VirtQueue *vq, const VirtqSeg *segs, uint16_t count, void *cookie) {
+    if (count == 0 || vq->num_free < count) return -1;
+
+    uint16_t head = vq->free_head;
+    uint16_t idx  = head;
+    uint16_t last = head;
+    for (uint16_t i = 0; i < count; ++i) {
+        VirtqDesc *d = &vq->desc[idx];
+        d->addr  = segs[i].addr;
+        d->len   = segs[i].len;
+        d->flags = segs[i].device_writes ? VIRTQ_DESC_F_WRITE : 0;
+        if (i + 1 < count) d->flags |= VIRTQ_DESC_F_NEXT;
+        last = idx;
+        idx  = d->next;
+    }
+    vq->free_head = vq->desc[last].next;
+    vq->num_free  = (uint16_t)(vq->num_free - count);
+    vq->cookie[head] = cookie;
+
+    vq->avail->ring[vq->avail_idx & (vq->size - 1)] = head;
+    vq->avail_idx++;
+    // Descriptor and ring writes must be visible before the index moves.
+    barrier();
+    vq->avail->idx = vq->avail_idx;
+    return 0;
+}
+
+void virtq_kick(VirtQueue *vq) {
+    uint16_t old_idx = vq->kicked_idx;
+    uint16_t new_idx = vq->avail_idx;
+    if (old_idx == new_idx) return;
+    vq->kicked_idx = new_idx;
+
+    // The index store must be visible before we read the device's
+    // notification request, or we could miss a needed kick.
+    mb();
+
+    int notify;
+    if (vq->vdev->features & VIRTIO_F_RING_EVENT_IDX) {
+        uint16_t event = *vq->avail_event;
+        notify = (uint16_t)(new_idx - event - 1) < (uint16_t)(new_idx - old_idx);
+    } else {
+        notify = !(vq->used->flags & VIRTQ_USED_F_NO_NOTIFY);
+    }
+
+    if (notify) {
+        mmio_write16(vq->notify_addr, vq->index);
+        vq->kicks++;
+    } else {
+        vq->kicks_suppressed++;
+    }
+}
+
+int virtq_has_used(const VirtQueue *vq) {
+    return vq->last_used != vq->used->idx;
+}
+
+void *virtq_get_used(VirtQueue *vq, uint32_t *len) {
+    if (vq->last_used == vq->used->idx) return 0;
+    barrier();
+
+    volatile VirtqUsedElem *e = &vq->used->ring[vq->last_used & (vq->size - 1)];
+    uint16_t head = (uint16_t)e->id;
+    if (len) *len = e->len;
+    vq->last_used++;
+
+    void *cookie = vq->cookie[head];
+    vq->cookie[head] = 0;
+
+    // Return the chain to the free list.
+    uint16_t idx   = head;
+    uint16_t count = 1;
+    while (vq->desc[idx].flags & VIRTQ_DESC_F_NEXT) {
+        idx = vq->desc[idx].next;
+        count++;
+    }
+    vq->desc[idx].next = vq->free_head;
+    vq->free_head      = head;
+    vq->num_free       = (uint16_t)(vq->num_free + count);
+    return cookie;
+}
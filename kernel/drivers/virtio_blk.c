@@ -0,0 +1,149 @@
+// kernel/drivers/virtio_blk.c
+// virtio-blk driver: one request per rw(), the page cache's pages posted
+// as they are (one descriptor each) between the request header and the
+// status byte, so a run of pages goes to the disk without a copy.
+//
+// The kernel polls, so a caller waits for its request by reaping the used
+// ring and yielding; whoever reaps marks any finished request done, so
+// several threads can have requests in flight.
+
+#include "virtio_blk.h"
+#include "virtio.h"
+#include "blkdev.h"
+#include "thread.h"
+#include "mm.h"
+#include "klib.h"
+
+#define VIRTIO_BLK_DEVICE_MODERN       0x1042
+#define VIRTIO_BLK_DEVICE_TRANSITIONAL 0x1001
+
+#define VIRTIO_BLK_F_SEG_MAX (1ull << 2)
+#define VIRTIO_BLK_F_RO      (1ull << 5)
+
+// Device configuration layout
+#define VBLK_CFG_CAPACITY 0             // 64-bit, in 512-byte sectors
+#define VBLK_CFG_SEG_MAX  12
+
+#define VIRTIO_BLK_T_IN  0
+#define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_S_OK  0
+
+#define VBLK_RING      128
+#define VBLK_MAX_PAGES 64
+
+typedef struct {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} VirtioBlkHeader;
+
+typedef struct {
+    VirtioBlkHeader   hdr;
+    volatile uint8_t  status;           // written by the device
+    volatile int      done;
+} VblkRequest;
+
+typedef struct {
+    BlockDevice  blkdev;
+    VirtioDevice vdev;
+    VirtQueue    vq;
+} VirtioBlk;
+
+static void vblk_reap(VirtioBlk *vb) {
+    VblkRequest *r;
+    while ((r = (VblkRequest *)virtq_get_used(&vb->vq, 0)) != 0) r->done = 1;
+}
+
+static int vblk_rw(BlockDevice *dev, int write, uint64_t sector,
+                   void *const *pages, uint32_t bytes) {
+    VirtioBlk  *vb = (VirtioBlk *)dev->priv;
+    VblkRequest req;
+    VirtqSeg    segs[VBLK_MAX_PAGES + 2];
+    uint16_t    count = 0;
+
+    req.hdr.type     = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    req.hdr.reserved = 0;
+    req.hdr.sector   = sector;
+    req.status       = 0xFF;
+    req.done         = 0;
+
+    segs[count].addr          = (uint64_t)(uintptr_t)&req.hdr;
+    segs[count].len           = sizeof(req.hdr);
+    segs[count].device_writes = 0;
+    count++;
+    for (uint32_t off = 0, i = 0; off < bytes; off += PAGE_SIZE, ++i) {
+        if (i >= dev->max_pages) return -1;
+        segs[count].addr          = (uint64_t)(uintptr_t)pages[i];
+        segs[count].len           = bytes - off < PAGE_SIZE ? bytes - off : PAGE_SIZE;
+        segs[count].device_writes = !write;
+        count++;
+    }
+    segs[count].addr          = (uint64_t)(uintptr_t)&req.status;
+    segs[count].len           = 1;
+    segs[count].device_writes = 1;
+    count++;
+
+    // The request lives on this stack until the device is done with it.
+    while (virtq_add(&vb->vq, segs, count, &req) < 0) {
+        vblk_reap(vb);
+        thread_yield();
+    }
+    virtq_kick(&vb->vq);
+    for (;;) {
+        vblk_reap(vb);
+        if (req.done) break;
+        thread_yield();
+    }
+    return req.status == VIRTIO_BLK_S_OK ? 0 : -1;
+}
+
+static int vblk_init_one(PciDevice *pci) {
+    VirtioBlk *vb = (VirtioBlk *)kzalloc(sizeof(VirtioBlk));
+    if (!vb) return -1;
+
+    if (virtio_pci_init(&vb->vdev, pci) < 0) goto fail;
+    if (virtio_negotiate(&vb->vdev, VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_RO |
+                                    VIRTIO_F_RING_EVENT_IDX) < 0) {
+        goto fail;
+    }
+    if (virtio_queue_setup(&vb->vdev, &vb->vq, 0, VBLK_RING) < 0) goto fail;
+
+    BlockDevice *dev = &vb->blkdev;
+    dev->priv    = vb;
+    dev->rw      = vblk_rw;
+    dev->sectors = virtio_cfg_read32(&vb->vdev, VBLK_CFG_CAPACITY) |
+                   (uint64_t)virtio_cfg_read32(&vb->vdev, VBLK_CFG_CAPACITY + 4) << 32;
+    dev->read_only = (vb->vdev.features & VIRTIO_BLK_F_RO) != 0;
+
+    // Header and status take two descriptors of every chain.
+    uint32_t max = vb->vq.size - 2u;
+    if (vb->vdev.features & VIRTIO_BLK_F_SEG_MAX) {
+        uint32_t seg_max = virtio_cfg_read32(&vb->vdev, VBLK_CFG_SEG_MAX);
+        if (seg_max && seg_max < max) max = seg_max;
+    }
+    dev->max_pages = max < VBLK_MAX_PAGES ? max : VBLK_MAX_PAGES;
+    if (!dev->sectors || !dev->max_pages) goto fail;
+
+    virtio_driver_ok(&vb->vdev);
+    pci->claimed = 1;
+    return blkdev_register(dev);
+
+fail:
+    virtio_fail(&vb->vdev);
+    kfree(vb);
+    return -1;
+}
+
+int virtio_blk_probe(void) {
+    int count = 0;
+    for (int i = 0; i < pci_device_count(); ++i) {
+        PciDevice *pci = pci_get(i);
+        if (pci->claimed || pci->vendor_id != VIRTIO_PCI_VENDOR) continue;
+        if (pci->device_id != VIRTIO_BLK_DEVICE_MODERN &&
+            pci->device_id != VIRTIO_BLK_DEVICE_TRANSITIONAL) {
+            continue;
+        }
+        if (vblk_init_one(pci) == 0) count++;
+    }
+    return count;
+}
@@ -0,0 +1,219 @@
+// kernel/drivers/virtio_input.c
+// virtio-input driver for tablets and mice.
+//
+// The device delivers Linux evdev-style events (type, code, value) into
+// buffers posted on the event queue. Events up to an EV_SYN make one
+// report: its position, motion, wheel and buttons become a single
+// MouseEvent.
+
+#include "virtio_input.h"
+#include "virtio.h"
+#include "mouse.h"
+#include "mm.h"
+#include "klib.h"
+
+#define VIRTIO_INPUT_DEVICE 0x1052
+
+#define VINPUT_MAX_DEVICES 2
+#define VINPUT_EVENTS      64
+#define VINPUT_EVENTQ      0
+
+// Device configuration: write select/subsel, then read size and data.
+#define VINPUT_CFG_SELECT  0
+#define VINPUT_CFG_SUBSEL  1
+#define VINPUT_CFG_SIZE    2
+#define VINPUT_CFG_DATA    8
+
+#define VIRTIO_INPUT_CFG_EV_BITS  0x11
+#define VIRTIO_INPUT_CFG_ABS_INFO 0x12
+
+// evdev types and codes
+#define EV_SYN      0x00
+#define EV_KEY      0x01
+#define EV_REL      0x02
+#define EV_ABS      0x03
+#define REL_X       0x00
+#define REL_Y       0x01
+#define REL_WHEEL   0x08
+#define ABS_X       0x00
+#define ABS_Y       0x01
+#define BTN_LEFT    0x110
+#define BTN_RIGHT   0x111
+#define BTN_MIDDLE  0x112
+
+typedef struct {
+    uint16_t type;
+    uint16_t code;
+    uint32_t value;
+} VirtioInputEvent;
+
+typedef struct {
+    int32_t min, max;
+} AbsRange;
+
+typedef struct {
+    VirtioDevice      vdev;
+    VirtQueue         eventq;
+    VirtioInputEvent *events;
+    int               absolute;
+    AbsRange          range[2];     // X, Y
+    // the report being assembled
+    int32_t           x, y;         // absolute: device units
+    int32_t           dx, dy, wheel;
+    uint8_t           buttons;
+    int               dirty;
+} VirtioInput;
+
+static VirtioInput *g_inputs[VINPUT_MAX_DEVICES];
+static int          g_input_count = 0;
+
+// ---------------------------------------------------------------------
+// Configuration
+// ---------------------------------------------------------------------
+
+static uint8_t cfg_select(VirtioInput *vi, uint8_t select, uint8_t subsel) {
+    virtio_cfg_write8(&vi->vdev, VINPUT_CFG_SELECT, select);
+    virtio_cfg_write8(&vi->vdev, VINPUT_CFG_SUBSEL, subsel);
+    return virtio_cfg_read8(&vi->vdev, VINPUT_CFG_SIZE);
+}
+
+// Whether the device reports event type `type` with code `code`.
+static int has_event(VirtioInput *vi, uint8_t type, uint32_t code) {
+    uint8_t size = cfg_select(vi, VIRTIO_INPUT_CFG_EV_BITS, type);
+    if (code / 8 >= size) return 0;
+    return (virtio_cfg_read8(&vi->vdev, VINPUT_CFG_DATA + code / 8) >> (code % 8)) & 1;
+}
+
+static void abs_range(VirtioInput *vi, uint8_t axis, AbsRange *out) {
+    out->min = 0;
+    out->max = MOUSE_ABS_MAX;
+    if (cfg_select(vi, VIRTIO_INPUT_CFG_ABS_INFO, axis) >= 8) {
+        out->min = (int32_t)virtio_cfg_read32(&vi->vdev, VINPUT_CFG_DATA);
+        out->max = (int32_t)virtio_cfg_read32(&vi->vdev, VINPUT_CFG_DATA + 4);
+    }
+    if (out->max <= out->min) out->max = out->min + 1;
+}
+
+// ---------------------------------------------------------------------
+// Events
+// ---------------------------------------------------------------------
+
+static void post(VirtioInput *vi, VirtioInputEvent *ev) {
+    VirtqSeg seg;
+    seg.addr          = (uint64_t)(uintptr_t)ev;
+    seg.len           = sizeof(*ev);
+    seg.device_writes = 1;
+    virtq_add(&vi->eventq, &seg, 1, ev);
+}
+
+static int32_t scale(const AbsRange *r, int32_t v) {
+    if (v < r->min) v = r->min;
+    if (v > r->max) v = r->max;
+    return (int32_t)((int64_t)(v - r->min) * MOUSE_ABS_MAX / (r->max - r->min));
+}
+
+static void handle(VirtioInput *vi, const VirtioInputEvent *ev) {
+    int32_t value = (int32_t)ev->value;
+    switch (ev->type) {
+        case EV_ABS:
+            if (ev->code == ABS_X) vi->x = value;
+            if (ev->code == ABS_Y) vi->y = value;
+            vi->dirty = 1;
+            break;
+        case EV_REL:
+            if (ev->code == REL_X)     vi->dx += value;
+            if (ev->code == REL_Y)     vi->dy += value;
+            if (ev->code == REL_WHEEL) vi->wheel += value;
+            vi->dirty = 1;
+            break;
+        case EV_KEY: {
+            uint8_t bit = ev->code == BTN_LEFT   ? MOUSE_LEFT  :
+                          ev->code == BTN_RIGHT  ? MOUSE_RIGHT :
+                          ev->code == BTN_MIDDLE ? MOUSE_MIDDLE : 0;
+            if (!bit) break;
+            vi->buttons = value ? (uint8_t)(vi->buttons | bit) : (uint8_t)(vi->buttons & ~bit);
+            vi->dirty = 1;
+            break;
+        }
+        case EV_SYN:
+            if (!vi->dirty) break;
+            if (vi->absolute) {
+                mouse_report_abs(scale(&vi->range[0], vi->x), scale(&vi->range[1], vi->y),
+                                 vi->wheel, vi->buttons);
+            } else {
+                mouse_report(vi->dx, vi->dy, vi->wheel, vi->buttons);
+            }
+            vi->dx = vi->dy = vi->wheel = 0;
+            vi->dirty = 0;
+            break;
+        default:
+            break;
+    }
+}
+
+void virtio_input_poll(void) {
+    for (int i = 0; i < g_input_count; ++i) {
+        VirtioInput *vi = g_inputs[i];
+        VirtioInputEvent *ev;
+        int reaped = 0;
+        while ((ev = (VirtioInputEvent *)virtq_get_used(&vi->eventq, 0)) != 0) {
+            handle(vi, ev);
+            post(vi, ev);
+            reaped++;
+        }
+        if (reaped) virtq_kick(&vi->eventq);
+    }
+}
+
+// ---------------------------------------------------------------------
+// Probe
+// ---------------------------------------------------------------------
+
+static int vinput_init_one(PciDevice *pci) {
+    VirtioInput *vi = (VirtioInput *)kzalloc(sizeof(VirtioInput));
+    if (!vi) return -1;
+
+    if (virtio_pci_init(&vi->vdev, pci) < 0) goto fail;
+
+    // Pointing devices only: absolute X/Y, or relative motion.
+    vi->absolute = has_event(vi, EV_ABS, ABS_X) && has_event(vi, EV_ABS, ABS_Y);
+    if (!vi->absolute && !has_event(vi, EV_REL, REL_X)) goto fail;
+    if (vi->absolute) {
+        abs_range(vi, ABS_X, &vi->range[0]);
+        abs_range(vi, ABS_Y, &vi->range[1]);
+    }
+
+    if (virtio_negotiate(&vi->vdev, 0) < 0) goto fail;
+    if (virtio_queue_setup(&vi->vdev, &vi->eventq, VINPUT_EVENTQ, VINPUT_EVENTS) < 0) goto fail;
+    vi->events = (VirtioInputEvent *)kzalloc(sizeof(VirtioInputEvent) * VINPUT_EVENTS);
+    if (!vi->events) goto fail;
+
+    virtio_driver_ok(&vi->vdev);
+    for (uint32_t i = 0; i < VINPUT_EVENTS && vi->eventq.num_free; ++i) {
+        post(vi, &vi->events[i]);
+    }
+    virtq_kick(&vi->eventq);
+
+    pci->claimed = 1;
+    g_inputs[g_input_count++] = vi;
+    return 0;
+
+fail:
+    virtio_fail(&vi->vdev);
+    kfree(vi->events);
+    kfree(vi);
+    return -1;
+}
+
+int virtio_input_probe(void) {
+    int count = 0;
+    for (int i = 0; i < pci_device_count() && g_input_count < VINPUT_MAX_DEVICES; ++i) {
+        PciDevice *pci = pci_get(i);
+        if (pci->claimed || pci->vendor_id != VIRTIO_PCI_VENDOR ||
+            pci->device_id != VIRTIO_INPUT_DEVICE) {
+            continue;
+        }
+        if (vinput_init_one(pci) == 0) count++;
+    }
+    return count;
+}
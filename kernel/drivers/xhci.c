@@ -0,0 +1,841 @@
+// kernel/drivers/xhci.c
+// xHCI host controller driver: command/event/transfer rings, device
+// enumeration on the root hub ports, and HID boot keyboards and mice.
+//
+//  * One command ring and one event ring (a single segment each); the
+//    event ring is polled, interrupter 0 never raises an interrupt.
+//  * Enumeration is synchronous: a command or control transfer is queued
+//    and the event ring is polled until its completion comes back. Other
+//    events that turn up meanwhile (HID reports) are handled as usual.
+//  * Each HID interrupt IN endpoint keeps HID_INFLIGHT transfers queued;
+//    every completed report is decoded and its transfer re-queued, so the
+//    device can deliver a report every interval without waiting for us.
+
+#include "xhci.h"
+#include "keyboard.h"
+#include "mouse.h"
+#include "pci.h"
+#include "io.h"
+#include "mm.h"
+#include "timer.h"
+#include "klib.h"
+#include "shell.h"
+
+#define XHCI_MAX_CONTROLLERS 2
+#define XHCI_MAX_SLOTS       32
+
+// Capability registers
+#define XCAP_CAPLENGTH  0x00
+#define XCAP_HCSPARAMS1 0x04
+#define XCAP_HCSPARAMS2 0x08
+#define XCAP_HCCPARAMS1 0x10
+#define XCAP_DBOFF      0x14
+#define XCAP_RTSOFF     0x18
+
+// Operational registers
+#define XOP_USBCMD      0x00
+#define XOP_USBSTS      0x04
+#define XOP_CRCR        0x18
+#define XOP_DCBAAP      0x30
+#define XOP_CONFIG      0x38
+#define XOP_PORTSC(p)   (0x400u + 0x10u * ((p) - 1))
+
+#define USBCMD_RS       (1u << 0)
+#define USBCMD_HCRST    (1u << 1)
+#define USBSTS_HCH      (1u << 0)
+#define USBSTS_CNR      (1u << 11)
+
+#define HCC_CSZ         (1u << 2)   // 64-byte contexts
+
+#define PORTSC_CCS      (1u << 0)
+#define PORTSC_PED      (1u << 1)
+#define PORTSC_PR       (1u << 4)
+#define PORTSC_SPEED(v) (((v) >> 10) & 0xF)
+#define PORTSC_CSC      (1u << 17)
+#define PORTSC_PRC      (1u << 21)
+#define PORTSC_CHANGES  0x00FE0000u // status change bits, write 1 to clear
+#define PORTSC_KEEP     0x0E00C3E0u // read/write bits to write back unchanged
+
+// Interrupter 0, in the runtime registers
+#define XRT_IMAN        0x20
+#define XRT_ERSTSZ      0x28
+#define XRT_ERSTBA      0x30
+#define XRT_ERDP        0x38
+#define ERDP_EHB        (1ull << 3)
+
+// USB legacy support extended capability
+#define XECP_LEGACY       1
+#define LEGACY_BIOS_OWNED (1u << 16)
+#define LEGACY_OS_OWNED   (1u << 24)
+
+// TRB types
+#define TRB_NORMAL        1
+#define TRB_SETUP         2
+#define TRB_DATA          3
+#define TRB_STATUS        4
+#define TRB_LINK          6
+#define TRB_ENABLE_SLOT   9
+#define TRB_DISABLE_SLOT  10
+#define TRB_ADDRESS_DEV   11
+#define TRB_CONFIGURE_EP  12
+#define TRB_EVALUATE_CTX  13
+#define TRB_TRANSFER_EV   32
+#define TRB_COMMAND_EV    33
+#define TRB_PORT_EV       34
+
+#define TRB_CYCLE         (1u << 0)
+#define TRB_TC            (1u << 1)   // link: toggle the cycle bit
+#define TRB_ISP           (1u << 2)
+#define TRB_IOC           (1u << 5)
+#define TRB_IDT           (1u << 6)
+#define TRB_DIR_IN        (1u << 16)
+#define TRB_TYPE(t)       ((uint32_t)(t) << 10)
+#define TRB_GET_TYPE(c)   (((c) >> 10) & 0x3F)
+#define TRB_SLOT(s)       ((uint32_t)(s) << 24)
+
+#define CC_SUCCESS        1
+#define CC_SHORT_PACKET   13
+
+// Endpoint context types
+#define EP_CONTROL        4
+#define EP_INTERRUPT_IN   7
+
+// Standard requests and descriptors
+#define USB_REQ_GET_DESCRIPTOR 6
+#define USB_REQ_SET_CONFIG     9
+#define USB_DESC_DEVICE        1
+#define USB_DESC_CONFIG        2
+#define USB_DESC_INTERFACE     4
+#define USB_DESC_ENDPOINT      5
+
+// HID class
+#define USB_CLASS_HID          3
+#define HID_SUBCLASS_BOOT      1
+#define HID_REQ_SET_IDLE       0x0A
+#define HID_REQ_SET_PROTOCOL   0x0B
+#define HID_BOOT_KEYBOARD      1
+#define HID_BOOT_MOUSE         2
+
+#define HID_INFLIGHT      4
+#define HID_MAX_PACKET    64
+#define CMD_TIMEOUT_MS    500
+
+typedef struct {
+    uint64_t param;
+    uint32_t status;
+    uint32_t control;
+} Trb;
+
+// One page of TRBs; the last slot is a link back to the first.
+#define RING_TRBS (PAGE_SIZE / sizeof(Trb))
+
+typedef struct {
+    Trb     *trbs;
+    uint32_t enq;
+    uint32_t cycle;
+} Ring;
+
+typedef struct {
+    uint64_t base;
+    uint32_t size;
+    uint32_t rsvd;
+} ErstEntry;
+
+typedef struct {
+    uint8_t  kind;              // USB_HID_KEYBOARD / USB_HID_MOUSE
+    uint8_t  iface;
+    uint8_t  dci;               // device context index of the endpoint
+    uint8_t  interval;          // bInterval
+    uint16_t mps;
+    uint8_t  dead;              // halted; no more transfers queued
+    uint8_t  last[8];           // keyboard: previous report
+    Ring     ring;
+    uint8_t *buffers;           // one packet per ring slot
+} HidEndpoint;
+
+typedef struct {
+    uint8_t     used;
+    uint8_t     slot;
+    uint8_t     port;
+    uint8_t     speed;
+    uint16_t    vendor_id;
+    uint16_t    product_id;
+    void       *out_ctx;        // device context (owned by the controller)
+    void       *in_ctx;         // input context for commands
+    uint8_t    *buf;            // control transfer data
+    Ring        ep0;
+    HidEndpoint hid[2];
+    int         hid_count;
+} UsbDevice;
+
+typedef struct {
+    PciDevice *pci;
+    uint64_t   cap, op, rt, db;
+    uint32_t   max_ports;
+    uint32_t   csz;             // context size: 32 or 64 bytes
+    uint64_t  *dcbaa;
+    uint64_t  *scratch;         // scratchpad buffer array, scratch_count pages
+    uint32_t   scratch_count;
+    Ring       cmd;
+    Trb       *events;
+    ErstEntry *erst;
+    uint32_t   evt_deq;
+    uint32_t   evt_cycle;
+    const Trb *wait_for;        // TRB whose completion a caller is waiting for
+    Trb        wait_event;
+    int        wait_done;
+    int        rescan;          // a port changed; look at the ports again
+    UsbDevice  dev[USB_MAX_DEVICES];
+} Xhci;
+
+static Xhci g_xhci[XHCI_MAX_CONTROLLERS];
+static int  g_xhci_count = 0;
+
+static void handle_event(Xhci *x, const Trb *ev);
+
+// ---------------------------------------------------------------------
+// Memory and registers
+// ---------------------------------------------------------------------
+
+static void *dma_alloc(uint32_t order) {
+    void *p = page_alloc(order);
+    if (p) memset(p, 0, (size_t)PAGE_SIZE << order);
+    return p;
+}
+
+static uint64_t phys(const void *p) {
+    return (uint64_t)(uintptr_t)p;
+}
+
+static void write64(uint64_t addr, uint64_t v) {
+    // Not every controller takes 64-bit accesses; two halves, low first.
+    mmio_write32(addr,     (uint32_t)v);
+    mmio_write32(addr + 4, (uint32_t)(v >> 32));
+}
+
+static int wait_bits(uint64_t addr, uint32_t mask, uint32_t want, uint32_t ms) {
+    uint64_t deadline = time_ms() + ms;
+    while ((mmio_read32(addr) & mask) != want) {
+        if (time_ms() >= deadline) return -1;
+        cpu_relax();
+    }
+    return 0;
+}
+
+static uint32_t *ctx_at(const Xhci *x, void *base, uint32_t index) {
+    return (uint32_t*)((uint8_t*)base + index * x->csz);
+}
+
+// ---------------------------------------------------------------------
+// Rings
+// ---------------------------------------------------------------------
+
+static int ring_init(Ring *r) {
+    r->trbs = (Trb*)dma_alloc(0);
+    if (!r->trbs) return -1;
+    r->enq   = 0;
+    r->cycle = 1;
+    Trb *link = &r->trbs[RING_TRBS - 1];
+    link->param   = phys(r->trbs);
+    link->control = TRB_TYPE(TRB_LINK) | TRB_TC;
+    return 0;
+}
+
+// Queues one TRB; the cycle bit goes in last, handing it to the controller.
+static Trb *ring_push(Ring *r, uint64_t param, uint32_t status, uint32_t control) {
+    Trb *t = &r->trbs[r->enq];
+    t->param  = param;
+    t->status = status;
+    barrier();
+    t->control = (control & ~TRB_CYCLE) | r->cycle;
+
+    if (++r->enq == RING_TRBS - 1) {
+        Trb *link = &r->trbs[r->enq];
+        barrier();
+        link->control = TRB_TYPE(TRB_LINK) | TRB_TC | r->cycle;
+        r->enq    = 0;
+        r->cycle ^= 1;
+    }
+    return t;
+}
+
+static void ring_doorbell(Xhci *x, uint32_t slot, uint32_t target) {
+    mmio_write32(x->db + 4 * slot, target);
+}
+
+// Handles every event the controller has posted. Returns how many.
+static int events_poll(Xhci *x) {
+    int n = 0;
+    for (;;) {
+        Trb *e = &x->events[x->evt_deq];
+        if ((e->control & TRB_CYCLE) != x->evt_cycle) break;
+        Trb ev = *e;
+        if (++x->evt_deq == RING_TRBS) {
+            x->evt_deq   = 0;
+            x->evt_cycle ^= 1;
+        }
+        handle_event(x, &ev);
+        n++;
+    }
+    if (n) write64(x->rt + XRT_ERDP, phys(&x->events[x->evt_deq]) | ERDP_EHB);
+    return n;
+}
+
+// Polls until the event for t arrives. Returns its completion code, or -1
+// on timeout.
+static int wait_for(Xhci *x, const Trb *t, Trb *out) {
+    x->wait_for  = t;
+    x->wait_done = 0;
+    uint64_t deadline = time_ms() + CMD_TIMEOUT_MS;
+    while (!x->wait_done) {
+        if (!events_poll(x)) {
+            if (time_ms() >= deadline) {
+                x->wait_for = 0;
+                return -1;
+            }
+            cpu_relax();
+        }
+    }
+    x->wait_for = 0;
+    if (out) *out = x->wait_event;
+    return (int)(x->wait_event.status >> 24);
+}
+
+static int command(Xhci *x, uint64_t param, uint32_t control, Trb *out) {
+    Trb *t = ring_push(&x->cmd, param, 0, control);
+    ring_doorbell(x, 0, 0);
+    return wait_for(x, t, out);
+}
+
+// ---------------------------------------------------------------------
+// Control transfers
+// ---------------------------------------------------------------------
+
+static int control(Xhci *x, UsbDevice *d, uint8_t type, uint8_t req,
+                   uint16_t value, uint16_t index, uint16_t len) {
+    int in = (type & 0x80) != 0;
+    uint64_t setup = (uint64_t)type | ((uint64_t)req << 8) |
+                     ((uint64_t)value << 16) | ((uint64_t)index << 32) |
+                     ((uint64_t)len << 48);
+    uint32_t trt = len ? (in ? 3u : 2u) : 0u;
+
+    ring_push(&d->ep0, setup, 8, TRB_TYPE(TRB_SETUP) | TRB_IDT | (trt << 16));
+    if (len) {
+        ring_push(&d->ep0, phys(d->buf), len,
+                  TRB_TYPE(TRB_DATA) | (in ? TRB_DIR_IN : 0));
+    }
+    // The status stage runs opposite to the data (IN when there is none).
+    Trb *status = ring_push(&d->ep0, 0, 0, TRB_TYPE(TRB_STATUS) | TRB_IOC |
+                            ((len && in) ? 0 : TRB_DIR_IN));
+    ring_doorbell(x, d->slot, 1);
+    return wait_for(x, status, 0) == CC_SUCCESS ? 0 : -1;
+}
+
+static int get_descriptor(Xhci *x, UsbDevice *d, uint8_t type, uint16_t len) {
+    return control(x, d, 0x80, USB_REQ_GET_DESCRIPTOR,
+                   (uint16_t)(type << 8), 0, len);
+}
+
+// ---------------------------------------------------------------------
+// HID boot protocol
+// ---------------------------------------------------------------------
+
+static void hid_queue(Xhci *x, UsbDevice *d, HidEndpoint *h, int count) {
+    for (int i = 0; i < count; ++i) {
+        uint8_t *buf = h->buffers + h->ring.enq * h->mps;
+        ring_push(&h->ring, phys(buf), h->mps, TRB_TYPE(TRB_NORMAL) | TRB_ISP | TRB_IOC);
+    }
+    ring_doorbell(x, d->slot, h->dci);
+}
+
+static int in_report(const uint8_t *keys, uint32_t n, uint8_t code) {
+    for (uint32_t i = 0; i < n; ++i) {
+        if (keys[i] == code) return 1;
+    }
+    return 0;
+}
+
+// Boot keyboard report: modifiers, reserved, up to six usages. Diffing it
+// against the previous one gives the presses and releases.
+static void hid_keyboard(HidEndpoint *h, const uint8_t *r, uint32_t len) {
+    uint8_t now[8] = { 0 };
+    if (len > 8) len = 8;
+    memcpy(now, r, len);
+    // Usages 0x01-0x03 are error codes (rollover, POST failure, undefined),
+    // not keys: a report of them says nothing about what is held.
+    if (now[2] >= 0x01 && now[2] <= 0x03) return;
+    for (int i = 2; i < 8; ++i) {
+        if (now[i] < 0x04) now[i] = 0;
+    }
+
+    uint8_t changed = (uint8_t)(now[0] ^ h->last[0]);
+    for (int i = 0; i < 8; ++i) {
+        if (changed & (1u << i)) kbd_key((uint8_t)(KEY_LCTRL + i), (now[0] >> i) & 1);
+    }
+    for (int i = 2; i < 8; ++i) {
+        if (h->last[i] && !in_report(now + 2, 6, h->last[i])) kbd_key(h->last[i], 0);
+    }
+    for (int i = 2; i < 8; ++i) {
+        if (now[i] && !in_report(h->last + 2, 6, now[i])) kbd_key(now[i], 1);
+    }
+    memcpy(h->last, now, sizeof(now));
+}
+
+// Boot mouse report: buttons, dx, dy and, on most mice, the wheel.
+static void hid_mouse(const uint8_t *r, uint32_t len) {
+    if (len < 3) return;
+    int32_t wheel = len >= 4 ? (int8_t)r[3] : 0;
+    mouse_report((int8_t)r[1], (int8_t)r[2], wheel, (uint8_t)(r[0] & 0x07));
+}
+
+static void hid_complete(Xhci *x, UsbDevice *d, HidEndpoint *h, const Trb *ev) {
+    uint32_t cc  = ev->status >> 24;
+    uint64_t off = ev->param - phys(h->ring.trbs);
+    uint32_t idx = (uint32_t)(off / sizeof(Trb));
+    if (idx >= RING_TRBS - 1) return;
+    if (cc != CC_SUCCESS && cc != CC_SHORT_PACKET) {
+        // The endpoint has halted. Recovering needs a Reset Endpoint
+        // command; losing the device until it is replugged is simpler.
+        h->dead = 1;
+        return;
+    }
+
+    uint32_t residue = ev->status & 0xFFFFFF;
+    uint32_t len = residue < h->mps ? h->mps - residue : 0;
+    const uint8_t *report = h->buffers + idx * h->mps;
+    if (h->kind == USB_HID_KEYBOARD) hid_keyboard(h, report, len);
+    else                             hid_mouse(report, len);
+    hid_queue(x, d, h, 1);
+}
+
+// ---------------------------------------------------------------------
+// Events
+// ---------------------------------------------------------------------
+
+static UsbDevice *device_by_slot(Xhci *x, uint32_t slot) {
+    for (int i = 0; i < USB_MAX_DEVICES; ++i) {
+        if (x->dev[i].used && x->dev[i].slot == slot) return &x->dev[i];
+    }
+    return 0;
+}
+
+static void handle_event(Xhci *x, const Trb *ev) {
+    uint32_t type = TRB_GET_TYPE(ev->control);
+
+    if ((type == TRB_TRANSFER_EV || type == TRB_COMMAND_EV) &&
+        x->wait_for && ev->param == phys(x->wait_for)) {
+        x->wait_event = *ev;
+        x->wait_done  = 1;
+        return;
+    }
+    if (type == TRB_TRANSFER_EV) {
+        UsbDevice *d = device_by_slot(x, ev->control >> 24);
+        uint32_t dci = (ev->control >> 16) & 0x1F;
+        if (!d) return;
+        for (int i = 0; i < d->hid_count; ++i) {
+            if (d->hid[i].dci == dci && !d->hid[i].dead) hid_complete(x, d, &d->hid[i], ev);
+        }
+    } else if (type == TRB_PORT_EV) {
+        x->rescan = 1;
+    }
+}
+
+// ---------------------------------------------------------------------
+// Enumeration
+// ---------------------------------------------------------------------
+
+static void device_free(Xhci *x, UsbDevice *d) {
+    for (int i = 0; i < d->hid_count; ++i) {
+        HidEndpoint *h = &d->hid[i];
+        // Keys still held on a keyboard that went away come up now.
+        if (h->kind == USB_HID_KEYBOARD) {
+            uint8_t none[8] = { 0 };
+            hid_keyboard(h, none, sizeof(none));
+        }
+        if (h->ring.trbs) page_free(h->ring.trbs, 0);
+        if (h->buffers) page_free(h->buffers, page_order_for(RING_TRBS * h->mps));
+    }
+    if (d->slot) x->dcbaa[d->slot] = 0;
+    if (d->ep0.trbs) page_free(d->ep0.trbs, 0);
+    if (d->out_ctx) page_free(d->out_ctx, 0);
+    if (d->in_ctx) page_free(d->in_ctx, 0);
+    if (d->buf) page_free(d->buf, 0);
+    memset(d, 0, sizeof(*d));
+}
+
+// Periodic endpoint interval in the controller's 2^n x 125 us units.
+static uint32_t ep_interval(uint8_t speed, uint8_t binterval) {
+    if (!binterval) binterval = 1;
+    if (speed == USB_SPEED_FULL || speed == USB_SPEED_LOW) {
+        // bInterval is in frames (ms): the largest 2^n x 125 us under it.
+        uint32_t uframes = (uint32_t)binterval * 8, n = 0;
+        while ((2u << n) <= uframes) n++;
+        return n < 3 ? 3 : n;
+    }
+    return binterval > 16 ? 15u : binterval - 1u;
+}
+
+// Finds boot keyboard/mouse interfaces and their interrupt IN endpoints.
+static uint8_t parse_config(UsbDevice *d, uint32_t total) {
+    const uint8_t *p = d->buf, *end = d->buf + total;
+    uint8_t config = p[5];
+    int     iface_kind = 0;
+    uint8_t iface_num = 0;
+
+    while (p + 2 <= end && p[0] >= 2 && p + p[0] <= end) {
+        if (p[1] == USB_DESC_INTERFACE && p[0] >= 9) {
+            iface_kind = 0;
+            iface_num  = p[2];
+            if (p[5] == USB_CLASS_HID && p[6] == HID_SUBCLASS_BOOT) {
+                if (p[7] == HID_BOOT_KEYBOARD) iface_kind = USB_HID_KEYBOARD;
+                if (p[7] == HID_BOOT_MOUSE)    iface_kind = USB_HID_MOUSE;
+            }
+        } else if (p[1] == USB_DESC_ENDPOINT && p[0] >= 7 && iface_kind &&
+                   (p[2] & 0x80) && (p[3] & 0x03) == 3 && d->hid_count < 2) {
+            HidEndpoint *h = &d->hid[d->hid_count++];
+            h->kind     = (uint8_t)iface_kind;
+            h->iface    = iface_num;
+            h->dci      = (uint8_t)((p[2] & 0x0F) * 2 + 1);
+            h->mps      = (uint16_t)((p[4] | (p[5] << 8)) & 0x7FF);
+            h->interval = p[6];
+            if (h->mps > HID_MAX_PACKET) h->mps = HID_MAX_PACKET;
+            if (!h->mps) h->mps = 8;
+            iface_kind = 0;         // one endpoint per interface
+        }
+        p += p[0];
+    }
+    return config;
+}
+
+static int configure_endpoints(Xhci *x, UsbDevice *d) {
+    uint32_t add = 1, max_dci = 1;
+    memset(d->in_ctx, 0, PAGE_SIZE);
+    for (int i = 0; i < d->hid_count; ++i) {
+        HidEndpoint *h = &d->hid[i];
+        if (ring_init(&h->ring) < 0) return -1;
+        h->buffers = (uint8_t*)dma_alloc(page_order_for(RING_TRBS * h->mps));
+        if (!h->buffers) return -1;
+
+        uint32_t *ep = ctx_at(x, d->in_ctx, 1u + h->dci);
+        ep[0] = ep_interval(d->speed, h->interval) << 16;
+        ep[1] = (3u << 1) | ((uint32_t)EP_INTERRUPT_IN << 3) | ((uint32_t)h->mps << 16);
+        ep[2] = (uint32_t)phys(h->ring.trbs) | 1u;
+        ep[3] = (uint32_t)(phys(h->ring.trbs) >> 32);
+        ep[4] = h->mps | ((uint32_t)h->mps << 16);     // average TRB, max ESIT payload
+        add |= 1u << h->dci;
+        if (h->dci > max_dci) max_dci = h->dci;
+    }
+    uint32_t *icc  = ctx_at(x, d->in_ctx, 0);
+    uint32_t *slot = ctx_at(x, d->in_ctx, 1);
+    icc[1] = add;
+    memcpy(slot, ctx_at(x, d->out_ctx, 0), x->csz);
+    slot[0] = (slot[0] & ~(0x1Fu << 27)) | (max_dci << 27);
+    return command(x, phys(d->in_ctx), TRB_TYPE(TRB_CONFIGURE_EP) | TRB_SLOT(d->slot), 0)
+           == CC_SUCCESS ? 0 : -1;
+}
+
+static int device_setup(Xhci *x, UsbDevice *d) {
+    Trb ev;
+    if (command(x, 0, TRB_TYPE(TRB_ENABLE_SLOT), &ev) != CC_SUCCESS) return -1;
+    d->slot = (uint8_t)(ev.control >> 24);
+
+    d->out_ctx = dma_alloc(0);
+    d->in_ctx  = dma_alloc(0);
+    d->buf     = (uint8_t*)dma_alloc(0);
+    if (!d->out_ctx || !d->in_ctx || !d->buf || ring_init(&d->ep0) < 0) return -1;
+    x->dcbaa[d->slot] = phys(d->out_ctx);
+
+    // Address the device with a default EP0 packet size for its speed.
+    uint32_t mps0 = d->speed >= USB_SPEED_SUPER ? 512 :
+                    d->speed == USB_SPEED_HIGH  ? 64 : 8;
+    uint32_t *icc  = ctx_at(x, d->in_ctx, 0);
+    uint32_t *slot = ctx_at(x, d->in_ctx, 1);
+    uint32_t *ep0  = ctx_at(x, d->in_ctx, 2);
+    icc[1]  = 0x3;                              // slot + EP0
+    slot[0] = ((uint32_t)d->speed << 20) | (1u << 27);
+    slot[1] = (uint32_t)d->port << 16;
+    ep0[1]  = (3u << 1) | ((uint32_t)EP_CONTROL << 3) | (mps0 << 16);
+    ep0[2]  = (uint32_t)phys(d->ep0.trbs) | 1u;
+    ep0[3]  = (uint32_t)(phys(d->ep0.trbs) >> 32);
+    ep0[4]  = 8;
+    if (command(x, phys(d->in_ctx), TRB_TYPE(TRB_ADDRESS_DEV) | TRB_SLOT(d->slot), 0)
+        != CC_SUCCESS) {
+        return -1;
+    }
+
+    // Full-speed devices may use anything from 8 to 64: ask, then fix EP0.
+    if (get_descriptor(x, d, USB_DESC_DEVICE, 8) < 0) return -1;
+    uint32_t real = d->speed >= USB_SPEED_SUPER ? (1u << d->buf[7]) : d->buf[7];
+    if (real && real != mps0) {
+        memset(d->in_ctx, 0, PAGE_SIZE);
+        icc[1] = 0x2;
+        memcpy(ep0, ctx_at(x, d->out_ctx, 1), x->csz);
+        ep0[1] = (ep0[1] & 0xFFFFu) | (real << 16);
+        if (command(x, phys(d->in_ctx), TRB_TYPE(TRB_EVALUATE_CTX) | TRB_SLOT(d->slot), 0)
+            != CC_SUCCESS) {
+            return -1;
+        }
+    }
+
+    if (get_descriptor(x, d, USB_DESC_DEVICE, 18) < 0) return -1;
+    d->vendor_id  = (uint16_t)(d->buf[8]  | (d->buf[9]  << 8));
+    d->product_id = (uint16_t)(d->buf[10] | (d->buf[11] << 8));
+
+    if (get_descriptor(x, d, USB_DESC_CONFIG, 9) < 0) return -1;
+    uint32_t total = (uint32_t)(d->buf[2] | (d->buf[3] << 8));
+    if (total > PAGE_SIZE) total = PAGE_SIZE;
+    if (total < 9 || get_descriptor(x, d, USB_DESC_CONFIG, (uint16_t)total) < 0) return -1;
+    uint8_t config = parse_config(d, total);
+    if (!d->hid_count) return -1;
+
+    if (control(x, d, 0x00, USB_REQ_SET_CONFIG, config, 0, 0) < 0) return -1;
+    for (int i = 0; i < d->hid_count; ++i) {
+        HidEndpoint *h = &d->hid[i];
+        // Boot protocol, so reports have the fixed layout decoded above;
+        // keyboards report only on change (idle 0), repeat is ours.
+        control(x, d, 0x21, HID_REQ_SET_PROTOCOL, 0, h->iface, 0);
+        if (h->kind == USB_HID_KEYBOARD) control(x, d, 0x21, HID_REQ_SET_IDLE, 0, h->iface, 0);
+    }
+    if (configure_endpoints(x, d) < 0) return -1;
+
+    for (int i = 0; i < d->hid_count; ++i) hid_queue(x, d, &d->hid[i], HID_INFLIGHT);
+    return 0;
+}
+
+static UsbDevice *device_on_port(Xhci *x, uint32_t port) {
+    for (int i = 0; i < USB_MAX_DEVICES; ++i) {
+        if (x->dev[i].used && x->dev[i].port == port) return &x->dev[i];
+    }
+    return 0;
+}
+
+static void port_detach(Xhci *x, UsbDevice *d) {
+    if (d->slot) command(x, 0, TRB_TYPE(TRB_DISABLE_SLOT) | TRB_SLOT(d->slot), 0);
+    device_free(x, d);
+}
+
+static void port_attach(Xhci *x, uint32_t port) {
+    uint64_t reg = x->op + XOP_PORTSC(port);
+    uint32_t sc  = mmio_read32(reg);
+
+    // USB 3 ports enable themselves; USB 2 ports need a reset first.
+    if (!(sc & PORTSC_PED)) {
+        mmio_write32(reg, (sc & PORTSC_KEEP) | PORTSC_PR);
+        if (wait_bits(reg, PORTSC_PRC, PORTSC_PRC, 200) < 0) return;
+        sc = mmio_read32(reg);
+        mmio_write32(reg, (sc & PORTSC_KEEP) | PORTSC_PRC);
+        delay_ms(10);               // reset recovery
+        sc = mmio_read32(reg);
+    }
+    if (!(sc & PORTSC_CCS) || !(sc & PORTSC_PED)) return;
+
+    UsbDevice *d = 0;
+    for (int i = 0; i < USB_MAX_DEVICES && !d; ++i) {
+        if (!x->dev[i].used) d = &x->dev[i];
+    }
+    if (!d) return;
+    d->used  = 1;
+    d->port  = (uint8_t)port;
+    d->speed = (uint8_t)PORTSC_SPEED(sc);
+    if (device_setup(x, d) < 0) port_detach(x, d);
+}
+
+static void ports_scan(Xhci *x) {
+    x->rescan = 0;
+    for (uint32_t port = 1; port <= x->max_ports; ++port) {
+        uint64_t reg = x->op + XOP_PORTSC(port);
+        uint32_t sc  = mmio_read32(reg);
+        if (sc & PORTSC_CHANGES) mmio_write32(reg, (sc & PORTSC_KEEP) | (sc & PORTSC_CHANGES));
+
+        UsbDevice *d = device_on_port(x, port);
+        if (d && (!(sc & PORTSC_CCS) || (sc & PORTSC_CSC))) {
+            port_detach(x, d);
+            d = 0;
+        }
+        if (!d && (sc & PORTSC_CCS)) port_attach(x, port);
+    }
+}
+
+// ---------------------------------------------------------------------
+// Controller
+// ---------------------------------------------------------------------
+
+// Takes the controller from the firmware if it still claims it.
+static void bios_handoff(Xhci *x, uint32_t hcc1) {
+    uint32_t off = (hcc1 >> 16) << 2;
+    while (off) {
+        uint64_t reg = x->cap + off;
+        uint32_t v   = mmio_read32(reg);
+        if ((v & 0xFF) == XECP_LEGACY) {
+            mmio_write32(reg, v | LEGACY_OS_OWNED);
+            wait_bits(reg, LEGACY_BIOS_OWNED, 0, 1000);
+            mmio_write32(reg + 4, 0);           // no SMIs
+            return;
+        }
+        off = ((v >> 8) & 0xFF) << 2;
+        if (!off) return;
+        off += (uint32_t)(reg - x->cap);
+    }
+}
+
+// Undoes a setup that failed part way: halts the controller so it stops
+// using our memory, then frees what was allocated.
+static void xhci_release(Xhci *x) {
+    mmio_write32(x->op + XOP_USBCMD, mmio_read32(x->op + XOP_USBCMD) & ~USBCMD_RS);
+    wait_bits(x->op + XOP_USBSTS, USBSTS_HCH, USBSTS_HCH, 100);
+    if (x->scratch) {
+        for (uint32_t i = 0; i < x->scratch_count; ++i) {
+            if (x->scratch[i]) page_free((void*)(uintptr_t)x->scratch[i], 0);
+        }
+        page_free(x->scratch, 0);
+    }
+    if (x->dcbaa) page_free(x->dcbaa, 0);
+    if (x->cmd.trbs) page_free(x->cmd.trbs, 0);
+    if (x->events) page_free(x->events, 0);
+    if (x->erst) page_free(x->erst, 0);
+    memset(x, 0, sizeof(*x));
+}
+
+static int xhci_init_one(Xhci *x, PciDevice *pci) {
+    int is_io = 0;
+    uint64_t base = pci_bar_base(pci, 0, &is_io);
+    if (!base || is_io) return -1;
+    pci_enable(pci);
+
+    memset(x, 0, sizeof(*x));
+    x->pci = pci;
+    x->cap = base;
+    x->op  = base + mmio_read8(base + XCAP_CAPLENGTH);
+    x->rt  = base + (mmio_read32(base + XCAP_RTSOFF) & ~0x1Fu);
+    x->db  = base + (mmio_read32(base + XCAP_DBOFF) & ~0x3u);
+
+    uint32_t hcs1 = mmio_read32(base + XCAP_HCSPARAMS1);
+    uint32_t hcs2 = mmio_read32(base + XCAP_HCSPARAMS2);
+    uint32_t hcc1 = mmio_read32(base + XCAP_HCCPARAMS1);
+    uint32_t slots = hcs1 & 0xFF;
+    if (slots > XHCI_MAX_SLOTS) slots = XHCI_MAX_SLOTS;
+    x->max_ports = hcs1 >> 24;
+    x->csz       = (hcc1 & HCC_CSZ) ? 64 : 32;
+
+    bios_handoff(x, hcc1);
+
+    // Stop whatever the firmware left running, then reset.
+    mmio_write32(x->op + XOP_USBCMD, mmio_read32(x->op + XOP_USBCMD) & ~USBCMD_RS);
+    if (wait_bits(x->op + XOP_USBSTS, USBSTS_HCH, USBSTS_HCH, 100) < 0) return -1;
+    mmio_write32(x->op + XOP_USBCMD, USBCMD_HCRST);
+    if (wait_bits(x->op + XOP_USBCMD, USBCMD_HCRST, 0, 1000) < 0) return -1;
+    if (wait_bits(x->op + XOP_USBSTS, USBSTS_CNR, 0, 1000) < 0) return -1;
+
+    mmio_write32(x->op + XOP_CONFIG, slots);
+
+    x->dcbaa = (uint64_t*)dma_alloc(0);
+    if (!x->dcbaa) goto fail;
+    uint32_t scratch = (((hcs2 >> 21) & 0x1F) << 5) | ((hcs2 >> 27) & 0x1F);
+    if (scratch) {
+        x->scratch       = (uint64_t*)dma_alloc(0);
+        x->scratch_count = scratch;
+        if (!x->scratch) goto fail;
+        for (uint32_t i = 0; i < scratch; ++i) {
+            void *page = dma_alloc(0);
+            if (!page) goto fail;
+            x->scratch[i] = phys(page);
+        }
+        x->dcbaa[0] = phys(x->scratch);
+    }
+    write64(x->op + XOP_DCBAAP, phys(x->dcbaa));
+
+    if (ring_init(&x->cmd) < 0) goto fail;
+    write64(x->op + XOP_CRCR, phys(x->cmd.trbs) | 1u);
+
+    x->events = (Trb*)dma_alloc(0);
+    x->erst   = (ErstEntry*)dma_alloc(0);
+    if (!x->events || !x->erst) goto fail;
+    x->erst->base = phys(x->events);
+    x->erst->size = RING_TRBS;
+    x->evt_cycle  = 1;
+    mmio_write32(x->rt + XRT_ERSTSZ, 1);
+    write64(x->rt + XRT_ERDP, phys(x->events));
+    write64(x->rt + XRT_ERSTBA, phys(x->erst));
+
+    mmio_write32(x->op + XOP_USBCMD, USBCMD_RS);
+    if (wait_bits(x->op + XOP_USBSTS, USBSTS_HCH, 0, 100) < 0) goto fail;
+
+    delay_ms(50);                   // let the ports report what is attached
+    ports_scan(x);
+    events_poll(x);
+    x->rescan = 0;                  // the scan has seen those changes
+    pci->claimed = 1;
+    return 0;
+
+fail:
+    xhci_release(x);
+    return -1;
+}
+
+// usb: attached HID devices
+static void cmd_usb(Shell *sh, int argc, char **argv) {
+    static const char *speeds[] = { "?", "full", "low", "high", "super", "super+" };
+    (void)argc; (void)argv;
+    UsbDeviceInfo devs[USB_MAX_DEVICES];
+    int n = xhci_devices(devs, USB_MAX_DEVICES);
+    if (!n) {
+        shell_print(sh, "No USB input devices.");
+        return;
+    }
+    for (int i = 0; i < n; ++i) {
+        char line[80];
+        str_copy(line, "Port ", sizeof(line));
+        str_cat_u64(line, devs[i].port, sizeof(line));
+        str_cat(line, ": ", sizeof(line));
+        str_cat_hex(line, devs[i].vendor_id, 4, sizeof(line));
+        str_cat(line, ":", sizeof(line));
+        str_cat_hex(line, devs[i].product_id, 4, sizeof(line));
+        str_cat(line, " ", sizeof(line));
+        str_cat(line, speeds[devs[i].speed < 6 ? devs[i].speed : 0], sizeof(line));
+        str_cat(line, " speed,", sizeof(line));
+        if (devs[i].kind & USB_HID_KEYBOARD) str_cat(line, " keyboard", sizeof(line));
+        if (devs[i].kind & USB_HID_MOUSE)    str_cat(line, " mouse", sizeof(line));
+        shell_print(sh, line);
+    }
+}
+
+static const ShellCommand g_usb_command = {
+    "usb", { 0 }, 0, "attached USB keyboards and mice", cmd_usb
+};
+
+int xhci_probe(void) {
+    shell_register(&g_usb_command);
+    for (int i = 0; i < pci_device_count() && g_xhci_count < XHCI_MAX_CONTROLLERS; ++i) {
+        PciDevice *pci = pci_get(i);
+        if (pci->claimed) continue;
+        if (pci->class_code != 0x0C || pci->subclass != 0x03 || pci->prog_if != 0x30) continue;
+        if (xhci_init_one(&g_xhci[g_xhci_count], pci) == 0) g_xhci_count++;
+    }
+    return g_xhci_count;
+}
+
+void xhci_poll(void) {
+    for (int i = 0; i < g_xhci_count; ++i) {
+        Xhci *x = &g_xhci[i];
+        events_poll(x);
+        if (x->rescan) ports_scan(x);
+    }
+}
+
+int xhci_devices(UsbDeviceInfo *out, int max) {
+    int n = 0;
+    for (int i = 0; i < g_xhci_count; ++i) {
+        for (int j = 0; j < USB_MAX_DEVICES && n < max; ++j) {
+            const UsbDevice *d = &g_xhci[i].dev[j];
+            if (!d->used) continue;
+            UsbDeviceInfo *info = &out[n++];
+            info->port       = d->port;
+            info->speed      = d->speed;
+            info->kind       = 0;
+            info->vendor_id  = d->vendor_id;
+            info->product_id = d->product_id;
+            for (int k = 0; k < d->hid_count; ++k) info->kind |= d->hid[k].kind;
+        }
+    }
+    return n;
+}
@@ -0,0 +1,464 @@
+// kernel/gui/dlist.c
+// Display lists: recording with culling, fill merging and overdraw
+// removal, then a single rasterization pass into the target surface.
+
+#include "dlist.h"
+#include "smp.h"
+#include "klib.h"
+#include "mm.h"
+
+#define DL_MIN_CMDS 64
+#define DL_MIN_TEXT 1024
+
+#define DL_TILE                 64
+#define DL_PARALLEL_MIN_PIXELS  (256 * 256)
+
+static DrawListStats g_stats;
+
+static Rect rect_clip(Rect a, Rect b) {
+    int32_t x0 = a.x > b.x ? a.x : b.x;
+    int32_t y0 = a.y > b.y ? a.y : b.y;
+    int32_t x1 = (a.x + a.w) < (b.x + b.w) ? (a.x + a.w) : (b.x + b.w);
+    int32_t y1 = (a.y + a.h) < (b.y + b.h) ? (a.y + a.h) : (b.y + b.h);
+    Rect r = { x0, y0, x1 - x0, y1 - y0 };
+    if (r.w <= 0 || r.h <= 0) r.w = r.h = 0;
+    return r;
+}
+
+static int rect_inside(Rect inner, Rect outer) {
+    return inner.x >= outer.x && inner.y >= outer.y &&
+           inner.x + inner.w <= outer.x + outer.w &&
+           inner.y + inner.h <= outer.y + outer.h;
+}
+
+void dl_begin(DrawList *dl, Surface *target) {
+    dl->count    = 0;
+    dl->text_len = 0;
+    dl->target   = target;
+    dl->clip.x   = 0;
+    dl->clip.y   = 0;
+    dl->clip.w   = target ? (int32_t)target->w : 0;
+    dl->clip.h   = target ? (int32_t)target->h : 0;
+}
+
+void dl_clip(DrawList *dl, Rect clip) {
+    dl->clip = rect_clip(dl->clip, clip);
+}
+
+// ---------------------------------------------------------------------
+// Recording
+// ---------------------------------------------------------------------
+
+static int grow(void **buf, uint32_t *cap, uint32_t need, uint32_t elem,
+                uint32_t min) {
+    if (need <= *cap) return 0;
+    uint32_t n = *cap ? *cap : min;
+    while (n < need) n *= 2;
+    void *p = kmalloc((size_t)n * elem);
+    if (!p) return -1;
+    if (*buf) memcpy(p, *buf, (size_t)*cap * elem);
+    kfree(*buf);
+    *buf = p;
+    *cap = n;
+    return 0;
+}
+
+// A slot for one more command (and text_extra characters). If memory runs
+// out, what has been recorded so far is drawn now to make room.
+static DrawCmd *cmd_alloc(DrawList *dl, uint32_t text_extra) {
+    for (int tries = 0; tries < 2; ++tries) {
+        if (grow((void**)&dl->cmds, &dl->cap, dl->count + 1,
+                 sizeof(DrawCmd), DL_MIN_CMDS) == 0 &&
+            grow((void**)&dl->text, &dl->text_cap, dl->text_len + text_extra,
+                 1, DL_MIN_TEXT) == 0) {
+            DrawCmd *c = &dl->cmds[dl->count];
+            memset(c, 0, sizeof(*c));
+            return c;
+        }
+        dl_execute(dl);
+    }
+    return 0;
+}
+
+// Drops earlier commands that `by` hides completely.
+static void occlude(DrawList *dl, const DrawCmd *by) {
+    for (uint32_t i = 0; i < dl->count; ++i) {
+        DrawCmd *c = &dl->cmds[i];
+        if (c == by || !c->op) continue;
+        if (rect_inside(c->bounds, by->bounds)) {
+            c->op = 0;
+            g_stats.occluded++;
+        }
+    }
+}
+
+// Culls, then commits the command just filled in at dl->cmds[dl->count].
+static void commit(DrawList *dl, DrawCmd *c, int opaque) {
+    g_stats.commands++;
+    if (!c->bounds.w) {
+        g_stats.culled++;
+        return;
+    }
+    dl->count++;
+    if (opaque) occlude(dl, c);
+}
+
+void dl_fill(DrawList *dl, int32_t x, int32_t y, int32_t w, int32_t h,
+             uint32_t color) {
+    if (w <= 0 || h <= 0 || !dl->target) return;
+    Rect r = { x, y, w, h };
+
+    // Continues the previous fill (a row of a gradient, the next cell of
+    // a bar): grow that one instead.
+    if (dl->count) {
+        DrawCmd *last = &dl->cmds[dl->count - 1];
+        Rect m = last->r;
+        int join = 0;
+        if (last->op == DL_FILL && last->color == color) {
+            if (m.x == r.x && m.w == r.w && (m.y + m.h == r.y || r.y + r.h == m.y)) {
+                join = 1;
+                m.h += r.h;
+                if (r.y < m.y) m.y = r.y;
+            } else if (m.y == r.y && m.h == r.h && (m.x + m.w == r.x || r.x + r.w == m.x)) {
+                join = 1;
+                m.w += r.w;
+                if (r.x < m.x) m.x = r.x;
+            }
+        }
+        if (join) {
+            g_stats.commands++;
+            g_stats.merged++;
+            last->r = m;
+            last->bounds = rect_clip(m, dl->clip);
+            occlude(dl, last);
+            return;
+        }
+    }
+
+    DrawCmd *c = cmd_alloc(dl, 0);
+    if (!c) return;
+    c->op     = DL_FILL;
+    c->r      = r;
+    c->bounds = rect_clip(r, dl->clip);
+    c->color  = color;
+    commit(dl, c, 1);
+}
+
+void dl_border(DrawList *dl, int32_t x, int32_t y, int32_t w, int32_t h,
+               uint32_t color) {
+    if (w < 2 || h < 2 || !dl->target) return;
+    DrawCmd *c = cmd_alloc(dl, 0);
+    if (!c) return;
+    Rect r = { x, y, w, h };
+    c->op     = DL_BORDER;
+    c->r      = r;
+    c->bounds = rect_clip(r, dl->clip);
+    // Entirely inside the frame: nothing to draw.
+    Rect inner = { x + 1, y + 1, w - 2, h - 2 };
+    if (rect_inside(c->bounds, inner)) c->bounds.w = c->bounds.h = 0;
+    c->color  = color;
+    commit(dl, c, 0);
+}
+
+void dl_text(DrawList *dl, int32_t x, int32_t y, const char *s, uint32_t len,
+             Font *font, uint32_t size, uint32_t cell, uint32_t color) {
+    if (!len || !cell || !dl->target) return;
+    if (len > 0xFFFF) len = 0xFFFF;
+    if (cell > 0xFF) cell = 0xFF;
+
+    // Glyphs are centred in their cells but may overhang them (italics,
+    // descenders), so allow half a cell around the text and a full one
+    // below.
+    int32_t half = (int32_t)cell / 2;
+    Rect box = { x - half, y - half, (int32_t)(len * cell) + 2 * half,
+                 2 * (int32_t)cell + half };
+    Rect bounds = rect_clip(box, dl->clip);
+    if (!bounds.w) {
+        g_stats.commands++;
+        g_stats.culled++;
+        return;
+    }
+
+    DrawCmd *c = cmd_alloc(dl, len);
+    if (!c) return;
+    c->op     = DL_TEXT;
+    c->cell   = (uint8_t)cell;
+    c->len    = (uint16_t)len;
+    c->r.x    = x;
+    c->r.y    = y;
+    c->r.w    = (int32_t)(len * cell);
+    c->r.h    = (int32_t)cell;
+    c->bounds = bounds;
+    c->color  = color;
+    c->u.text.font   = font;
+    c->u.text.size   = size;
+    c->u.text.offset = dl->text_len;
+    memcpy(dl->text + dl->text_len, s, len);
+    dl->text_len += len;
+    commit(dl, c, 0);
+}
+
+void dl_blit(DrawList *dl, int32_t dx, int32_t dy, const Surface *src,
+             int32_t sx, int32_t sy, int32_t w, int32_t h) {
+    if (!src || !src->pixels || !dl->target) return;
+
+    // Trim to the source so that bounds are exactly the pixels written.
+    if (sx < 0) { dx -= sx; w += sx; sx = 0; }
+    if (sy < 0) { dy -= sy; h += sy; sy = 0; }
+    if (sx + w > (int32_t)src->w) w = (int32_t)src->w - sx;
+    if (sy + h > (int32_t)src->h) h = (int32_t)src->h - sy;
+    if (w <= 0 || h <= 0) return;
+
+    DrawCmd *c = cmd_alloc(dl, 0);
+    if (!c) return;
+    Rect r = { dx, dy, w, h };
+    c->op     = DL_BLIT;
+    c->r      = r;
+    c->bounds = rect_clip(r, dl->clip);
+    c->u.blit.src = src;
+    c->u.blit.sx  = sx;
+    c->u.blit.sy  = sy;
+    commit(dl, c, 1);
+}
+
+// ---------------------------------------------------------------------
+// Execution. Glyphs are looked up once on the calling CPU, then commands
+// run either in order over the whole clip, or, for large lists when other
+// CPUs are up, binned into DL_TILE x DL_TILE tiles that the CPUs render
+// in parallel. Tiles don't overlap, so no two CPUs touch the same pixel.
+// ---------------------------------------------------------------------
+
+static const Glyph **g_glyphs;      // per character of dl->text
+static uint32_t      g_glyph_cap;
+static int           g_glyphs_ok;   // else looked up while drawing
+
+static uint32_t     *g_bins;        // command indices, grouped by tile
+static uint32_t      g_bin_cap;
+static uint32_t     *g_tile_first;  // per tile: start in g_bins (+1 sentinel)
+static uint32_t     *g_tile_fill;
+static uint32_t      g_tile_cap;
+static uint32_t      g_fill_cap;
+
+// Each CPU starts on its own run of tiles and, once done, takes tiles from
+// the others' runs. Taking is a fetch-and-add, so every tile goes exactly
+// once whoever takes it.
+typedef struct {
+    uint32_t next;
+    uint32_t end;
+    uint8_t  pad[56];       // one cache line each
+} TileQueue;
+
+static TileQueue       g_queues[SMP_MAX_CPUS];
+static const DrawList *g_tiled;
+static uint32_t        g_tiles_x;
+static int             g_cpus = 0;     // 0: all online
+
+static void fill(Surface *dst, Rect r, uint32_t color) {
+    for (int32_t j = 0; j < r.h; ++j) {
+        uint32_t *row = dst->pixels + (uint64_t)(r.y + j) * dst->pitch + (uint32_t)r.x;
+        for (int32_t i = 0; i < r.w; ++i) row[i] = color;
+    }
+}
+
+// Text is drawn through a view of the area (its bounds at most): glyphs
+// that overhang even the margins are cut rather than escaping occlusion.
+static void run_text(const DrawList *dl, const DrawCmd *c, Rect b) {
+    Surface view = {
+        dl->target->pixels + (uint64_t)b.y * dl->target->pitch + (uint32_t)b.x,
+        (uint32_t)b.w, (uint32_t)b.h, dl->target->pitch, 0
+    };
+    const char *s = dl->text + c->u.text.offset;
+    int32_t cell = (int32_t)c->cell;
+    int32_t baseline = c->r.y + cell * 7 / 8 - b.y;
+    for (uint32_t i = 0; i < c->len; ++i) {
+        int32_t cx = c->r.x + (int32_t)i * cell;
+        if (cx + 2 * cell <= b.x) continue;
+        if (cx - cell >= b.x + b.w) break;
+        const Glyph *g;
+        if (g_glyphs_ok) {
+            g = g_glyphs[c->u.text.offset + i];
+        } else {
+            g = s[i] == ' ' ? 0 : font_glyph(c->u.text.font, c->u.text.size, (uint8_t)s[i]);
+        }
+        if (!g) continue;
+        int32_t pen = cx + (cell - (int32_t)g->advance) / 2 - b.x;
+        font_blit(&view, pen, baseline, g, c->color);
+    }
+}
+
+// Runs one command, restricted to area.
+static void run_cmd(const DrawList *dl, const DrawCmd *c, Rect area) {
+    Surface *dst = dl->target;
+    Rect b = rect_clip(c->bounds, area);
+    if (!b.w) return;
+    switch (c->op) {
+        case DL_FILL:
+            fill(dst, b, c->color);
+            break;
+        case DL_BORDER: {
+            Rect edges[4] = {
+                { c->r.x, c->r.y, c->r.w, 1 },
+                { c->r.x, c->r.y + c->r.h - 1, c->r.w, 1 },
+                { c->r.x, c->r.y + 1, 1, c->r.h - 2 },
+                { c->r.x + c->r.w - 1, c->r.y + 1, 1, c->r.h - 2 },
+            };
+            for (int e = 0; e < 4; ++e) {
+                fill(dst, rect_clip(edges[e], b), c->color);
+            }
+            break;
+        }
+        case DL_TEXT:
+            run_text(dl, c, b);
+            break;
+        case DL_BLIT:
+            surface_blit(dst, b.x, b.y, c->u.blit.src,
+                         c->u.blit.sx + (b.x - c->r.x),
+                         c->u.blit.sy + (b.y - c->r.y),
+                         b.w, b.h);
+            break;
+        default:
+            break;
+    }
+}
+
+static int resolve_glyphs(DrawList *dl) {
+    if (grow((void**)&g_glyphs, &g_glyph_cap, dl->text_len,
+             sizeof(*g_glyphs), DL_MIN_TEXT) < 0) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < dl->count; ++i) {
+        const DrawCmd *c = &dl->cmds[i];
+        if (c->op != DL_TEXT) continue;
+        const char *s = dl->text + c->u.text.offset;
+        for (uint32_t k = 0; k < c->len; ++k) {
+            g_glyphs[c->u.text.offset + k] = s[k] == ' ' ? 0 :
+                font_glyph(c->u.text.font, c->u.text.size, (uint8_t)s[k]);
+        }
+    }
+    return 0;
+}
+
+// Tiles a command touches, as a column/row range; 0 if none.
+static int tile_span(const DrawList *dl, const DrawCmd *c,
+                     uint32_t *x0, uint32_t *x1, uint32_t *y0, uint32_t *y1) {
+    if (!c->op) return 0;
+    Rect b = rect_clip(c->bounds, dl->clip);
+    if (!b.w || !b.h) return 0;
+    *x0 = (uint32_t)(b.x - dl->clip.x) / DL_TILE;
+    *x1 = (uint32_t)(b.x + b.w - 1 - dl->clip.x) / DL_TILE;
+    *y0 = (uint32_t)(b.y - dl->clip.y) / DL_TILE;
+    *y1 = (uint32_t)(b.y + b.h - 1 - dl->clip.y) / DL_TILE;
+    return 1;
+}
+
+// Counting sort of command indices into per-tile bins, keeping list order
+// inside each bin.
+static int bin_commands(const DrawList *dl, uint32_t tiles_x, uint32_t tiles) {
+    if (grow((void**)&g_tile_first, &g_tile_cap, tiles + 1, sizeof(uint32_t), 256) < 0) {
+        return -1;
+    }
+    if (grow((void**)&g_tile_fill, &g_fill_cap, tiles, sizeof(uint32_t), 256) < 0) {
+        return -1;
+    }
+
+    memset(g_tile_first, 0, (tiles + 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < dl->count; ++i) {
+        uint32_t x0, x1, y0, y1;
+        if (!tile_span(dl, &dl->cmds[i], &x0, &x1, &y0, &y1)) continue;
+        for (uint32_t ty = y0; ty <= y1; ++ty) {
+            for (uint32_t tx = x0; tx <= x1; ++tx) g_tile_first[ty * tiles_x + tx + 1]++;
+        }
+    }
+    for (uint32_t t = 0; t < tiles; ++t) g_tile_first[t + 1] += g_tile_first[t];
+    if (grow((void**)&g_bins, &g_bin_cap, g_tile_first[tiles], sizeof(uint32_t), 1024) < 0) {
+        return -1;
+    }
+
+    memcpy(g_tile_fill, g_tile_first, tiles * sizeof(uint32_t));
+    for (uint32_t i = 0; i < dl->count; ++i) {
+        uint32_t x0, x1, y0, y1;
+        if (!tile_span(dl, &dl->cmds[i], &x0, &x1, &y0, &y1)) continue;
+        for (uint32_t ty = y0; ty <= y1; ++ty) {
+            for (uint32_t tx = x0; tx <= x1; ++tx) g_bins[g_tile_fill[ty * tiles_x + tx]++] = i;
+        }
+    }
+    return 0;
+}
+
+static void run_tile(uint32_t t) {
+    const DrawList *dl = g_tiled;
+    Rect tile = {
+        dl->clip.x + (int32_t)(t % g_tiles_x) * DL_TILE,
+        dl->clip.y + (int32_t)(t / g_tiles_x) * DL_TILE,
+        DL_TILE, DL_TILE
+    };
+    tile = rect_clip(tile, dl->clip);
+    for (uint32_t k = g_tile_first[t]; k < g_tile_first[t + 1]; ++k) {
+        run_cmd(dl, &dl->cmds[g_bins[k]], tile);
+    }
+}
+
+static void tile_worker(void *arg, int cpu) {
+    int cpus = *(const int*)arg;
+    for (int k = 0; k < cpus; ++k) {
+        TileQueue *q = &g_queues[(cpu + k) % cpus];
+        uint32_t t;
+        while ((t = __atomic_fetch_add(&q->next, 1, __ATOMIC_RELAXED)) < q->end) {
+            run_tile(t);
+        }
+    }
+}
+
+static void run_tiled(const DrawList *dl, int cpus, uint32_t tiles_x, uint32_t tiles) {
+    g_tiled   = dl;
+    g_tiles_x = tiles_x;
+    for (int i = 0; i < cpus; ++i) {
+        g_queues[i].next = (uint32_t)((uint64_t)tiles * (uint32_t)i / (uint32_t)cpus);
+        g_queues[i].end  = (uint32_t)((uint64_t)tiles * (uint32_t)(i + 1) / (uint32_t)cpus);
+    }
+    smp_run(tile_worker, &cpus, cpus);
+    g_stats.tiled++;
+    g_stats.tiles += tiles;
+}
+
+void dl_execute(DrawList *dl) {
+    Surface *dst = dl->target;
+    if (!dst || !dst->pixels || !dl->count) {
+        dl->count = 0;
+        dl->text_len = 0;
+        return;
+    }
+
+    // Glyph pointers must survive until every CPU is done with them.
+    // Without the table (out of memory) the list is drawn here, in order.
+    font_cache_hold();
+    g_glyphs_ok = resolve_glyphs(dl) == 0;
+
+    int cpus = smp_cpu_count();
+    if (g_cpus && g_cpus < cpus) cpus = g_cpus;
+    uint32_t tiles_x = ((uint32_t)dl->clip.w + DL_TILE - 1) / DL_TILE;
+    uint32_t tiles_y = ((uint32_t)dl->clip.h + DL_TILE - 1) / DL_TILE;
+    uint64_t area = (uint64_t)dl->clip.w * (uint32_t)dl->clip.h;
+
+    if (g_glyphs_ok && cpus > 1 && area >= DL_PARALLEL_MIN_PIXELS &&
+        bin_commands(dl, tiles_x, tiles_x * tiles_y) == 0) {
+        run_tiled(dl, cpus, tiles_x, tiles_x * tiles_y);
+    } else {
+        for (uint32_t i = 0; i < dl->count; ++i) {
+            if (dl->cmds[i].op) run_cmd(dl, &dl->cmds[i], dl->clip);
+        }
+    }
+    font_cache_release();
+
+    g_stats.lists++;
+    dl->count = 0;
+    dl->text_len = 0;
+}
+
+void dl_set_cpus(int cpus) {
+    g_cpus = cpus;
+}
+
+void dl_stats(DrawListStats *out) {
+    *out = g_stats;
+}
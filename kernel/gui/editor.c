@@ -0,0 +1,474 @@
+// kernel/gui/editor.c
+// Full-screen editor state over a piece table: cursor, scrolling, search,
+// undo, and which screen rows need repainting.
+
+#include "editor.h"
+#include "klib.h"
+
+#define NO_ROW       0xFFFFFFFFu    // row_start[] past the end of the text
+#define TAB_SPACES   "    "
+
+// ---------------------------------------------------------------------
+// Lines
+// ---------------------------------------------------------------------
+
+static uint32_t line_start(Editor *ed, uint32_t pos) {
+    TextIter it;
+    tb_iter(&ed->tb, &it, pos);
+    int c;
+    while ((c = ti_prev(&it)) >= 0) {
+        if (c == '\n') return it.pos + 1;
+    }
+    return 0;
+}
+
+// The '\n' ending pos's line, or the end of the text.
+static uint32_t line_end(Editor *ed, uint32_t pos) {
+    TextIter it;
+    tb_iter(&ed->tb, &it, pos);
+    int c;
+    while ((c = ti_next(&it)) >= 0) {
+        if (c == '\n') return it.pos - 1;
+    }
+    return ed->tb.length;
+}
+
+static uint32_t count_lines(Editor *ed, uint32_t from, uint32_t to) {
+    TextIter it;
+    uint32_t n = 0;
+    tb_iter(&ed->tb, &it, from);
+    while (it.pos < to) {
+        if (ti_next(&it) == '\n') n++;
+    }
+    return n;
+}
+
+static uint32_t column(Editor *ed) {
+    return ed->cursor - line_start(ed, ed->cursor);
+}
+
+// ---------------------------------------------------------------------
+// Repainting
+// ---------------------------------------------------------------------
+
+static void mark_row(Editor *ed, uint32_t row) {
+    if (row < ed->rows) ed->dirty[row] = 1;
+}
+
+static void mark_from(Editor *ed, uint32_t row) {
+    for (uint32_t r = row; r < ed->rows; ++r) ed->dirty[r] = 1;
+    ed->rows_valid = 0;
+}
+
+static void mark_all(Editor *ed) {
+    mark_from(ed, 0);
+    ed->dirty[EDITOR_ROW_STATUS]  = 1;
+    ed->dirty[EDITOR_ROW_MESSAGE] = 1;
+}
+
+static uint32_t cursor_row(const Editor *ed) {
+    return ed->line - ed->top_line;
+}
+
+static void set_message(Editor *ed, const char *msg) {
+    str_copy(ed->message, msg, sizeof(ed->message));
+    ed->dirty[EDITOR_ROW_MESSAGE] = 1;
+}
+
+static void layout(Editor *ed) {
+    if (ed->rows_valid) return;
+    uint32_t pos = ed->top;
+    for (uint32_t r = 0; r <= ed->rows; ++r) {
+        ed->row_start[r] = pos;
+        if (pos == NO_ROW) continue;
+        uint32_t end = line_end(ed, pos);
+        pos = end < ed->tb.length ? end + 1 : NO_ROW;
+    }
+    ed->rows_valid = 1;
+}
+
+// Brings the cursor on screen, scrolling as little as possible, or
+// centring it after a long jump.
+static void scroll(Editor *ed) {
+    uint32_t rows = ed->rows ? ed->rows : 1;
+    if (ed->line < ed->top_line || ed->line >= ed->top_line + rows) {
+        uint32_t far = ed->line < ed->top_line ? ed->top_line - ed->line
+                                               : ed->line - (ed->top_line + rows - 1);
+        if (far > rows) {
+            ed->top      = line_start(ed, ed->cursor);
+            ed->top_line = ed->line;
+            for (uint32_t i = 0; i < rows / 2 && ed->top; ++i) {
+                ed->top = line_start(ed, ed->top - 1);
+                ed->top_line--;
+            }
+        }
+        while (ed->line < ed->top_line) {
+            ed->top = line_start(ed, ed->top - 1);
+            ed->top_line--;
+        }
+        while (ed->line >= ed->top_line + rows) {
+            ed->top = line_end(ed, ed->top) + 1;
+            ed->top_line++;
+        }
+        mark_from(ed, 0);
+    }
+
+    uint32_t col  = column(ed);
+    uint32_t cols = ed->cols > 8 ? ed->cols : 8;
+    uint32_t left = ed->left;
+    if (col < left) left = col > cols / 2 ? col - cols / 2 : 0;
+    if (col >= left + cols) left = col - cols + cols / 4 + 1;
+    if (left != ed->left) {
+        ed->left = left;
+        mark_from(ed, 0);
+    }
+}
+
+// After a jump or an edit somewhere off screen: work out the cursor's line
+// from the closest place that is known.
+static void locate(Editor *ed, uint32_t changed_at) {
+    if (changed_at < ed->top || ed->cursor < ed->top) {
+        ed->line     = count_lines(ed, 0, ed->cursor);
+        ed->top      = line_start(ed, ed->cursor);
+        ed->top_line = ed->line;
+        for (uint32_t i = 0; i < ed->rows / 2 && ed->top; ++i) {
+            ed->top = line_start(ed, ed->top - 1);
+            ed->top_line--;
+        }
+    } else {
+        ed->line = ed->top_line + count_lines(ed, ed->top, ed->cursor);
+    }
+    mark_from(ed, 0);
+}
+
+// ---------------------------------------------------------------------
+// Open, close, resize
+// ---------------------------------------------------------------------
+
+int editor_open(Editor *ed, const char *name, const char *text, uint32_t len) {
+    memset(ed, 0, sizeof(*ed));
+    if (tb_init(&ed->tb, text, len) < 0) return -1;
+    str_copy(ed->name, name, sizeof(ed->name));
+    ed->rows = 1;
+    ed->cols = 1;
+    mark_all(ed);
+    return 0;
+}
+
+void editor_close(Editor *ed) {
+    tb_free(&ed->tb);
+}
+
+void editor_resize(Editor *ed, uint32_t rows, uint32_t cols) {
+    ed->rows = rows < EDITOR_MAX_ROWS ? rows : EDITOR_MAX_ROWS;
+    ed->cols = cols ? cols : 1;
+    if (!ed->rows) ed->rows = 1;
+    mark_all(ed);
+    scroll(ed);
+}
+
+// ---------------------------------------------------------------------
+// Editing
+// ---------------------------------------------------------------------
+
+static void insert(Editor *ed, const char *text, uint32_t len) {
+    if (tb_insert(&ed->tb, ed->cursor, text, len) < 0) {
+        set_message(ed, "Out of memory.");
+        return;
+    }
+    uint32_t lines = 0;
+    for (uint32_t i = 0; i < len; ++i) lines += text[i] == '\n';
+    if (lines) {
+        mark_from(ed, cursor_row(ed));
+    } else {
+        mark_row(ed, cursor_row(ed));
+        ed->rows_valid = 0;
+    }
+    ed->cursor  += len;
+    ed->line    += lines;
+    ed->modified = 1;
+}
+
+static void erase(Editor *ed, uint32_t pos) {
+    int c    = tb_char(&ed->tb, pos);
+    int back = pos < ed->cursor;
+    if (c < 0) return;
+    if (tb_delete(&ed->tb, pos, 1) < 0) {
+        set_message(ed, "Out of memory.");
+        return;
+    }
+    if (back) ed->cursor--;
+    if (c == '\n') {
+        // Joining onto the line above the screen scrolls; see scroll().
+        if (back) ed->line--;
+        mark_from(ed, cursor_row(ed));
+    } else {
+        mark_row(ed, cursor_row(ed));
+        ed->rows_valid = 0;
+    }
+    ed->modified = 1;
+}
+
+static void undo(Editor *ed, int redo) {
+    uint32_t pos;
+    uint32_t before = ed->tb.length;
+    int rc = redo ? tb_redo(&ed->tb, &pos) : tb_undo(&ed->tb, &pos);
+    if (rc < 0) {
+        set_message(ed, redo ? "Nothing to redo." : "Nothing to undo.");
+        return;
+    }
+    // pos is the end of text that went back in; the change started earlier.
+    uint32_t start = ed->tb.length > before ? pos - (ed->tb.length - before) : pos;
+    ed->cursor   = pos;
+    ed->modified = 1;
+    locate(ed, start);
+}
+
+// ---------------------------------------------------------------------
+// Moving
+// ---------------------------------------------------------------------
+
+static void move_left(Editor *ed) {
+    if (!ed->cursor) return;
+    ed->cursor--;
+    if (tb_char(&ed->tb, ed->cursor) == '\n') ed->line--;
+}
+
+static void move_right(Editor *ed) {
+    if (ed->cursor >= ed->tb.length) return;
+    if (tb_char(&ed->tb, ed->cursor) == '\n') ed->line++;
+    ed->cursor++;
+}
+
+static void move_up(Editor *ed) {
+    uint32_t start = line_start(ed, ed->cursor);
+    if (!start) return;
+    uint32_t prev = line_start(ed, start - 1);
+    ed->cursor = prev + ed->goal < start - 1 ? prev + ed->goal : start - 1;
+    ed->line--;
+}
+
+static void move_down(Editor *ed) {
+    uint32_t end = line_end(ed, ed->cursor);
+    if (end >= ed->tb.length) return;
+    uint32_t next     = end + 1;
+    uint32_t next_end = line_end(ed, next);
+    ed->cursor = next + ed->goal < next_end ? next + ed->goal : next_end;
+    ed->line++;
+}
+
+// ---------------------------------------------------------------------
+// Search
+// ---------------------------------------------------------------------
+
+static void find_next(Editor *ed, uint32_t from) {
+    uint32_t n = str_len(ed->query);
+    if (!n) return;
+    int64_t at = tb_find(&ed->tb, from, ed->query, n);
+    int wrapped = 0;
+    if (at < 0 && from) {
+        at = tb_find(&ed->tb, 0, ed->query, n);
+        wrapped = 1;
+    }
+    if (at < 0) {
+        char msg[80];
+        str_copy(msg, "Not found: ", sizeof(msg));
+        str_cat(msg, ed->query, sizeof(msg));
+        set_message(ed, msg);
+        return;
+    }
+    ed->cursor = (uint32_t)at;
+    locate(ed, ed->top);
+    set_message(ed, wrapped ? "Search wrapped to the top." : "");
+}
+
+static void find_key(Editor *ed, const KeyEvent *ev) {
+    uint32_t len = str_len(ed->query);
+    if (ev->code == KEY_ENTER || ev->code == KEY_KP_ENTER) {
+        ed->finding = 0;
+        find_next(ed, ed->cursor);
+    } else if (ev->code == KEY_ESC) {
+        ed->finding = 0;
+        set_message(ed, "");
+    } else if (ev->code == KEY_BACKSPACE) {
+        if (len) ed->query[len - 1] = '\0';
+    } else if (ev->ch >= ' ' && !(ev->mods & KMOD_CTRL) && len < sizeof(ed->query) - 1) {
+        ed->query[len]     = ev->ch;
+        ed->query[len + 1] = '\0';
+    }
+    ed->dirty[EDITOR_ROW_MESSAGE] = 1;
+}
+
+// ---------------------------------------------------------------------
+// Keys
+// ---------------------------------------------------------------------
+
+int editor_key(Editor *ed, const KeyEvent *ev) {
+    if (!(ev->flags & KEY_PRESSED)) return EDITOR_NONE;
+
+    uint32_t old_row  = cursor_row(ed);
+    uint32_t old_line = ed->line;
+    int      ctrl     = ev->mods & KMOD_CTRL;
+    int      vertical = 0;
+    int      quit     = 0;
+
+    if (ed->finding) {
+        find_key(ed, ev);
+    } else if (ctrl && ev->code == KEY_LETTER('s')) {
+        tb_break_undo(&ed->tb);
+        return EDITOR_SAVE;
+    } else if ((ctrl && ev->code == KEY_LETTER('q')) || ev->code == KEY_ESC) {
+        if (!ed->modified || ed->quit_armed) return EDITOR_QUIT;
+        set_message(ed, "Unsaved changes: quit again to discard them, Ctrl+S to save.");
+        quit = 1;
+    } else if (ctrl && ev->code == KEY_LETTER('f')) {
+        ed->finding = 1;
+        ed->dirty[EDITOR_ROW_MESSAGE] = 1;
+    } else if ((ctrl && ev->code == KEY_LETTER('g')) || ev->code == KEY_FN(3)) {
+        find_next(ed, ed->cursor + 1);
+    } else if (ctrl && ev->code == KEY_LETTER('z')) {
+        undo(ed, 0);
+    } else if (ctrl && ev->code == KEY_LETTER('y')) {
+        undo(ed, 1);
+    } else if (ctrl && ev->code == KEY_HOME) {
+        ed->cursor = 0;
+        ed->line   = 0;
+    } else if (ctrl && ev->code == KEY_END) {
+        ed->line  += count_lines(ed, ed->cursor, ed->tb.length);
+        ed->cursor = ed->tb.length;
+    } else {
+        switch (ev->code) {
+        case KEY_LEFT:      move_left(ed);  break;
+        case KEY_RIGHT:     move_right(ed); break;
+        case KEY_UP:        move_up(ed);   vertical = 1; break;
+        case KEY_DOWN:      move_down(ed); vertical = 1; break;
+        case KEY_PAGEUP:
+            for (uint32_t i = 1; i < ed->rows; ++i) move_up(ed);
+            vertical = 1;
+            break;
+        case KEY_PAGEDOWN:
+            for (uint32_t i = 1; i < ed->rows; ++i) move_down(ed);
+            vertical = 1;
+            break;
+        case KEY_HOME:      ed->cursor = line_start(ed, ed->cursor); break;
+        case KEY_END:       ed->cursor = line_end(ed, ed->cursor);   break;
+        case KEY_BACKSPACE: if (ed->cursor) erase(ed, ed->cursor - 1); break;
+        case KEY_DELETE:    erase(ed, ed->cursor); break;
+        case KEY_ENTER:
+        case KEY_KP_ENTER:
+            tb_break_undo(&ed->tb);
+            insert(ed, "\n", 1);
+            tb_break_undo(&ed->tb);
+            break;
+        case KEY_TAB:       insert(ed, TAB_SPACES, 4); break;
+        default:
+            if (ev->ch >= ' ' && !ctrl) {
+                insert(ed, &ev->ch, 1);
+            } else {
+                return EDITOR_NONE;
+            }
+        }
+    }
+    ed->quit_armed = quit;
+
+    // Typing continues one undo step; moving about starts another.
+    if (ev->code == KEY_LEFT || ev->code == KEY_RIGHT || vertical ||
+        ev->code == KEY_HOME || ev->code == KEY_END) {
+        tb_break_undo(&ed->tb);
+    }
+    if (!vertical) ed->goal = column(ed);
+
+    scroll(ed);
+    if (ed->line != old_line || cursor_row(ed) != old_row) mark_row(ed, old_row);
+    mark_row(ed, cursor_row(ed));
+    ed->dirty[EDITOR_ROW_STATUS] = 1;
+    return EDITOR_NONE;
+}
+
+// ---------------------------------------------------------------------
+// Saving and painting
+// ---------------------------------------------------------------------
+
+uint32_t editor_length(Editor *ed) {
+    return ed->tb.length;
+}
+
+void editor_copy(Editor *ed, char *dst) {
+    tb_read(&ed->tb, 0, dst, ed->tb.length);
+}
+
+void editor_saved(Editor *ed, int ok) {
+    char msg[80];
+    if (!ok) {
+        set_message(ed, "Could not save: out of memory or file too large.");
+        return;
+    }
+    ed->modified = 0;
+    str_copy(msg, "Saved ", sizeof(msg));
+    str_cat_u64(msg, ed->tb.length, sizeof(msg));
+    str_cat(msg, " bytes.", sizeof(msg));
+    set_message(ed, msg);
+    ed->dirty[EDITOR_ROW_STATUS] = 1;
+}
+
+int editor_take_dirty(Editor *ed, uint32_t row) {
+    if (row >= EDITOR_MAX_ROWS + 2) return 0;
+    int d = ed->dirty[row];
+    ed->dirty[row] = 0;
+    return d;
+}
+
+static void status_line(Editor *ed, char *buf, uint32_t max) {
+    str_copy(buf, " ", max);
+    str_cat(buf, ed->name, max);
+    str_cat(buf, ed->modified ? " [modified]" : "", max);
+    str_cat(buf, "   Ln ", max);
+    str_cat_u64(buf, ed->line + 1, max);
+    str_cat(buf, ", Col ", max);
+    str_cat_u64(buf, column(ed) + 1, max);
+    str_cat(buf, "   ", max);
+    str_cat_u64(buf, ed->tb.length, max);
+    str_cat(buf, " bytes", max);
+}
+
+void editor_row(Editor *ed, uint32_t row, char *buf, uint32_t max) {
+    if (!max) return;
+    buf[0] = '\0';
+    if (row == EDITOR_ROW_STATUS) {
+        status_line(ed, buf, max);
+        return;
+    }
+    if (row == EDITOR_ROW_MESSAGE) {
+        if (ed->finding) {
+            str_copy(buf, "Find: ", max);
+            str_cat(buf, ed->query, max);
+            str_cat(buf, "_   (Enter: search, Esc: cancel)", max);
+        } else if (ed->message[0]) {
+            str_copy(buf, ed->message, max);
+        } else {
+            str_copy(buf, "^S Save  ^Q Quit  ^F Find  F3 Next  ^Z Undo  ^Y Redo", max);
+        }
+        return;
+    }
+    if (row >= ed->rows) return;
+
+    layout(ed);
+    uint32_t pos = ed->row_start[row];
+    if (pos == NO_ROW) return;
+
+    TextIter it;
+    tb_iter(&ed->tb, &it, pos + ed->left);
+    // Don't run into the next line when this one is shorter than left.
+    if (line_end(ed, pos) < pos + ed->left) return;
+    uint32_t n = 0;
+    int c;
+    while (n + 1 < max && n < ed->cols && (c = ti_next(&it)) >= 0 && c != '\n') {
+        buf[n++] = (c == '\t') ? ' ' : (c < ' ' ? '?' : (char)c);
+    }
+    buf[n] = '\0';
+}
+
+void editor_cursor(Editor *ed, uint32_t *row, uint32_t *col) {
+    *row = cursor_row(ed);
+    *col = column(ed) - ed->left;
+}
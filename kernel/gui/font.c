@@ -0,0 +1,991 @@
+// kernel/gui/font.c
+// Font engine: the built-in 8x8 bitmap font, PSF1/PSF2 console fonts and
+// TrueType outlines, rasterized with anti-aliasing into a glyph cache.
+
+#include "font.h"
+#include "klib.h"
+#include "mm.h"
+
+#define FONT_BITMAP 0
+#define FONT_PSF    1
+#define FONT_TTF    2
+
+#define FONT_NAME_MAX  32
+#define FONT_NO_GLYPH  0xFFFFu
+#define FONT_MAX_SIZE  256      // pixels; larger requests are clamped
+
+struct Font {
+    char           name[FONT_NAME_MAX];
+    int            kind;
+    const uint8_t *data;
+    uint32_t       len;
+
+    // Bitmap fonts: glyph i's rows start at bits + i * stride.
+    const uint8_t *bits;
+    uint32_t       stride;
+    uint32_t       row_bytes;
+    uint32_t       width, height;
+    uint32_t       num_glyphs;
+    uint16_t       ascii[128];      // glyph index per character
+    uint32_t       baseline;        // rows above the baseline
+
+    // TrueType: table offsets into data
+    uint32_t       cmap;            // format 4 subtable
+    uint32_t       loca, glyf, hmtx;
+    uint32_t       units_per_em;
+    uint32_t       num_hmetrics;
+    uint32_t       num_glyphs_ttf;
+    int            loca_long;
+
+    int32_t        cap;             // cap height: rows, or font units
+};
+
+// ---------------------------------------------------------------------
+// Built-in 8x8 font
+// ---------------------------------------------------------------------
+
+typedef struct {
+    char    c;
+    uint8_t rows[8];
+} Glyph8;
+
+static const Glyph8 FONT8[] = {
+    // Digits
+    { '0', { 0x3C,0x42,0x46,0x4A,0x52,0x62,0x3C,0x00 } },
+    { '1', { 0x08,0x18,0x28,0x08,0x08,0x08,0x3E,0x00 } },
+    { '2', { 0x3C,0x42,0x02,0x1C,0x20,0x40,0x7E,0x00 } },
+    { '3', { 0x3C,0x42,0x02,0x1C,0x02,0x42,0x3C,0x00 } },
+    { '4', { 0x04,0x0C,0x14,0x24,0x44,0x7E,0x04,0x00 } },
+    { '5', { 0x7E,0x40,0x7C,0x02,0x02,0x42,0x3C,0x00 } },
+    { '6', { 0x1C,0x20,0x40,0x7C,0x42,0x42,0x3C,0x00 } },
+    { '7', { 0x7E,0x02,0x04,0x08,0x10,0x20,0x20,0x00 } },
+    { '8', { 0x3C,0x42,0x42,0x3C,0x42,0x42,0x3C,0x00 } },
+    { '9', { 0x3C,0x42,0x42,0x3E,0x02,0x04,0x38,0x00 } },
+
+    // Uppercase letters
+    { 'A', { 0x10,0x28,0x44,0x44,0x7C,0x44,0x44,0x00 } },
+    { 'B', { 0x78,0x44,0x44,0x78,0x44,0x44,0x78,0x00 } },
+    { 'C', { 0x3C,0x42,0x40,0x40,0x40,0x42,0x3C,0x00 } },
+    { 'D', { 0x78,0x44,0x42,0x42,0x42,0x44,0x78,0x00 } },
+    { 'E', { 0x7E,0x40,0x40,0x7C,0x40,0x40,0x7E,0x00 } },
+    { 'F', { 0x7E,0x40,0x40,0x7C,0x40,0x40,0x40,0x00 } },
+    { 'G', { 0x3C,0x42,0x40,0x4E,0x42,0x42,0x3C,0x00 } },
+    { 'H', { 0x42,0x42,0x42,0x7E,0x42,0x42,0x42,0x00 } },
+    { 'I', { 0x3E,0x08,0x08,0x08,0x08,0x08,0x3E,0x00 } },
+    { 'J', { 0x0E,0x04,0x04,0x04,0x44,0x44,0x38,0x00 } },
+    { 'K', { 0x42,0x44,0x48,0x70,0x48,0x44,0x42,0x00 } },
+    { 'L', { 0x40,0x40,0x40,0x40,0x40,0x40,0x7E,0x00 } },
+    { 'M', { 0x42,0x66,0x5A,0x5A,0x42,0x42,0x42,0x00 } },
+    { 'N', { 0x42,0x62,0x52,0x4A,0x46,0x42,0x42,0x00 } },
+    { 'O', { 0x3C,0x42,0x42,0x42,0x42,0x42,0x3C,0x00 } },
+    { 'P', { 0x7C,0x42,0x42,0x7C,0x40,0x40,0x40,0x00 } },
+    { 'Q', { 0x3C,0x42,0x42,0x42,0x4A,0x44,0x3A,0x00 } },
+    { 'R', { 0x7C,0x42,0x42,0x7C,0x48,0x44,0x42,0x00 } },
+    { 'S', { 0x3C,0x40,0x40,0x3C,0x02,0x02,0x3C,0x00 } },
+    { 'T', { 0x7F,0x49,0x08,0x08,0x08,0x08,0x1C,0x00 } },
+    { 'U', { 0x42,0x42,0x42,0x42,0x42,0x42,0x3C,0x00 } },
+    { 'V', { 0x42,0x42,0x42,0x24,0x24,0x18,0x18,0x00 } },
+    { 'W', { 0x42,0x42,0x5A,0x5A,0x5A,0x66,0x42,0x00 } },
+    { 'X', { 0x42,0x24,0x18,0x18,0x18,0x24,0x42,0x00 } },
+    { 'Y', { 0x42,0x24,0x18,0x18,0x18,0x18,0x18,0x00 } },
+    { 'Z', { 0x7E,0x02,0x04,0x08,0x10,0x20,0x7E,0x00 } },
+
+    // Lowercase letters (descenders use the bottom rows)
+    { 'a', { 0x00,0x00,0x3C,0x02,0x3E,0x42,0x3E,0x00 } },
+    { 'b', { 0x40,0x40,0x7C,0x42,0x42,0x42,0x7C,0x00 } },
+    { 'c', { 0x00,0x00,0x3C,0x40,0x40,0x40,0x3C,0x00 } },
+    { 'd', { 0x02,0x02,0x3E,0x42,0x42,0x42,0x3E,0x00 } },
+    { 'e', { 0x00,0x00,0x3C,0x42,0x7E,0x40,0x3C,0x00 } },
+    { 'f', { 0x0C,0x10,0x3C,0x10,0x10,0x10,0x10,0x00 } },
+    { 'g', { 0x00,0x00,0x3E,0x42,0x42,0x3E,0x02,0x3C } },
+    { 'h', { 0x40,0x40,0x7C,0x42,0x42,0x42,0x42,0x00 } },
+    { 'i', { 0x08,0x00,0x18,0x08,0x08,0x08,0x1C,0x00 } },
+    { 'j', { 0x04,0x00,0x0C,0x04,0x04,0x04,0x44,0x38 } },
+    { 'k', { 0x40,0x40,0x44,0x48,0x70,0x48,0x44,0x00 } },
+    { 'l', { 0x18,0x08,0x08,0x08,0x08,0x08,0x1C,0x00 } },
+    { 'm', { 0x00,0x00,0x76,0x49,0x49,0x49,0x49,0x00 } },
+    { 'n', { 0x00,0x00,0x7C,0x42,0x42,0x42,0x42,0x00 } },
+    { 'o', { 0x00,0x00,0x3C,0x42,0x42,0x42,0x3C,0x00 } },
+    { 'p', { 0x00,0x00,0x7C,0x42,0x42,0x7C,0x40,0x40 } },
+    { 'q', { 0x00,0x00,0x3E,0x42,0x42,0x3E,0x02,0x02 } },
+    { 'r', { 0x00,0x00,0x5C,0x62,0x40,0x40,0x40,0x00 } },
+    { 's', { 0x00,0x00,0x3E,0x40,0x3C,0x02,0x7C,0x00 } },
+    { 't', { 0x10,0x10,0x3C,0x10,0x10,0x10,0x0C,0x00 } },
+    { 'u', { 0x00,0x00,0x42,0x42,0x42,0x46,0x3A,0x00 } },
+    { 'v', { 0x00,0x00,0x42,0x42,0x24,0x24,0x18,0x00 } },
+    { 'w', { 0x00,0x00,0x41,0x49,0x49,0x49,0x36,0x00 } },
+    { 'x', { 0x00,0x00,0x42,0x24,0x18,0x24,0x42,0x00 } },
+    { 'y', { 0x00,0x00,0x42,0x42,0x42,0x3E,0x02,0x3C } },
+    { 'z', { 0x00,0x00,0x7E,0x04,0x18,0x20,0x7E,0x00 } },
+
+    // Basic punctuation + symbols used by the shell/UI
+    { ' ', { 0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 } },
+    { '>', { 0x00,0x40,0x20,0x10,0x20,0x40,0x00,0x00 } },
+    { '<', { 0x00,0x02,0x04,0x08,0x04,0x02,0x00,0x00 } },
+    { ':', { 0x00,0x18,0x18,0x00,0x18,0x18,0x00,0x00 } },
+    { ';', { 0x00,0x18,0x18,0x00,0x18,0x18,0x10,0x20 } },
+    { '.', { 0x00,0x00,0x00,0x00,0x00,0x18,0x18,0x00 } },
+    { ',', { 0x00,0x00,0x00,0x00,0x18,0x18,0x10,0x20 } },
+    { '/', { 0x02,0x04,0x08,0x10,0x20,0x40,0x00,0x00 } },
+    { '\\',{ 0x40,0x20,0x10,0x08,0x04,0x02,0x00,0x00 } },
+    { '-', { 0x00,0x00,0x00,0x3C,0x00,0x00,0x00,0x00 } },
+    { '_', { 0x00,0x00,0x00,0x00,0x00,0x00,0x7E,0x00 } },
+    { '=', { 0x00,0x00,0x3C,0x00,0x3C,0x00,0x00,0x00 } },
+    { '[', { 0x1E,0x10,0x10,0x10,0x10,0x10,0x1E,0x00 } },
+    { ']', { 0x78,0x08,0x08,0x08,0x08,0x08,0x78,0x00 } },
+    { '(', { 0x0C,0x10,0x20,0x20,0x20,0x10,0x0C,0x00 } },
+    { ')', { 0x30,0x08,0x04,0x04,0x04,0x08,0x30,0x00 } },
+    { '{', { 0x0C,0x10,0x10,0x20,0x10,0x10,0x0C,0x00 } },
+    { '}', { 0x30,0x08,0x08,0x04,0x08,0x08,0x30,0x00 } },
+    { '?', { 0x3C,0x42,0x02,0x0C,0x10,0x00,0x10,0x00 } },
+    { '!', { 0x08,0x08,0x08,0x08,0x08,0x00,0x08,0x00 } },
+    { '|', { 0x08,0x08,0x08,0x08,0x08,0x08,0x08,0x00 } },
+    { '+', { 0x00,0x08,0x08,0x3E,0x08,0x08,0x00,0x00 } },
+    { '*', { 0x00,0x24,0x18,0x7E,0x18,0x24,0x00,0x00 } },
+    { '\'',{ 0x08,0x08,0x10,0x00,0x00,0x00,0x00,0x00 } },
+    { '"', { 0x24,0x24,0x00,0x00,0x00,0x00,0x00,0x00 } },
+    { '`', { 0x10,0x08,0x00,0x00,0x00,0x00,0x00,0x00 } },
+    { '#', { 0x24,0x24,0x7E,0x24,0x7E,0x24,0x24,0x00 } },
+    { '$', { 0x08,0x3E,0x48,0x3C,0x12,0x7C,0x10,0x00 } },
+    { '%', { 0x62,0x64,0x08,0x10,0x26,0x46,0x00,0x00 } },
+    { '&', { 0x30,0x48,0x30,0x52,0x4C,0x44,0x3A,0x00 } },
+    { '@', { 0x3C,0x42,0x4E,0x52,0x4E,0x40,0x3C,0x00 } },
+    { '^', { 0x10,0x28,0x44,0x00,0x00,0x00,0x00,0x00 } },
+    { '~', { 0x00,0x00,0x32,0x4C,0x00,0x00,0x00,0x00 } },
+};
+
+static Font g_builtin;
+
+// Cap height and baseline of a bitmap font, measured from its 'H'.
+static void bitmap_measure(Font *f) {
+    f->cap      = (int32_t)f->height;
+    f->baseline = f->height;
+    uint16_t gi = f->ascii['H'];
+    if (gi == FONT_NO_GLYPH) return;
+
+    const uint8_t *rows = f->bits + gi * f->stride;
+    int32_t first = -1, last = -1;
+    for (uint32_t y = 0; y < f->height; ++y) {
+        for (uint32_t b = 0; b < f->row_bytes; ++b) {
+            if (rows[y * f->row_bytes + b]) {
+                if (first < 0) first = (int32_t)y;
+                last = (int32_t)y;
+                break;
+            }
+        }
+    }
+    if (first < 0) return;
+    f->cap      = last - first + 1;
+    f->baseline = (uint32_t)last + 1;
+}
+
+Font *font_builtin(void) {
+    Font *f = &g_builtin;
+    if (f->bits) return f;
+
+    str_copy(f->name, "builtin 8x8", sizeof(f->name));
+    f->kind       = FONT_BITMAP;
+    f->bits       = FONT8[0].rows;
+    f->stride     = sizeof(Glyph8);
+    f->row_bytes  = 1;
+    f->width      = 8;
+    f->height     = 8;
+    f->num_glyphs = sizeof(FONT8) / sizeof(FONT8[0]);
+    for (int c = 0; c < 128; ++c) f->ascii[c] = FONT_NO_GLYPH;
+    for (uint32_t i = 0; i < f->num_glyphs; ++i) {
+        f->ascii[(uint8_t)FONT8[i].c] = (uint16_t)i;
+    }
+    bitmap_measure(f);
+    return f;
+}
+
+// ---------------------------------------------------------------------
+// PSF1 / PSF2 console fonts
+// ---------------------------------------------------------------------
+
+static uint32_t le16(const uint8_t *p) { return (uint32_t)p[0] | ((uint32_t)p[1] << 8); }
+static uint32_t le32(const uint8_t *p) { return le16(p) | (le16(p + 2) << 16); }
+
+// Maps one code point of glyph gi from the font's Unicode table.
+static void psf_map(Font *f, uint32_t cp, uint32_t gi) {
+    if (cp < 128 && f->ascii[cp] == FONT_NO_GLYPH) f->ascii[cp] = (uint16_t)gi;
+}
+
+// PSF2 Unicode table: per glyph, UTF-8 sequences ended by 0xFF; 0xFE starts
+// a combining sequence, which we skip.
+static void psf2_unicode(Font *f, const uint8_t *p, const uint8_t *end) {
+    for (uint32_t gi = 0; gi < f->num_glyphs && p < end; ++gi) {
+        int in_seq = 0;
+        while (p < end && *p != 0xFF) {
+            uint8_t c = *p;
+            if (c == 0xFE) { in_seq = 1; p++; continue; }
+            uint32_t cp, n;
+            if (c < 0x80)      { cp = c;        n = 1; }
+            else if (c < 0xE0) { cp = c & 0x1F; n = 2; }
+            else if (c < 0xF0) { cp = c & 0x0F; n = 3; }
+            else               { cp = c & 0x07; n = 4; }
+            for (uint32_t k = 1; k < n && p + k < end; ++k) {
+                cp = (cp << 6) | (p[k] & 0x3F);
+            }
+            if (!in_seq) psf_map(f, cp, gi);
+            p += n;
+        }
+        p++;
+    }
+}
+
+// PSF1 Unicode table: per glyph, 16-bit code points ended by 0xFFFF;
+// 0xFFFE starts a combining sequence.
+static void psf1_unicode(Font *f, const uint8_t *p, const uint8_t *end) {
+    for (uint32_t gi = 0; gi < f->num_glyphs && p + 2 <= end; ++gi) {
+        int in_seq = 0;
+        while (p + 2 <= end && le16(p) != 0xFFFF) {
+            uint32_t cp = le16(p);
+            if (cp == 0xFFFE) in_seq = 1;
+            else if (!in_seq) psf_map(f, cp, gi);
+            p += 2;
+        }
+        p += 2;
+    }
+}
+
+static int psf_open(Font *f, const uint8_t *d, uint32_t len) {
+    uint32_t hdr, unicode;
+    const uint8_t *table_end = d + len;
+
+    if (len >= 32 && le32(d) == 0x864AB572u) {
+        hdr           = le32(d + 8);
+        unicode       = le32(d + 12) & 1;
+        f->num_glyphs = le32(d + 16);
+        f->stride     = le32(d + 20);
+        f->height     = le32(d + 24);
+        f->width      = le32(d + 28);
+    } else if (len >= 4 && d[0] == 0x36 && d[1] == 0x04) {
+        hdr           = 4;
+        unicode       = (d[2] & 0x06) != 0;
+        f->num_glyphs = (d[2] & 0x01) ? 512 : 256;
+        f->stride     = d[3];
+        f->height     = d[3];
+        f->width      = 8;
+    } else {
+        return 0;
+    }
+
+    f->row_bytes = (f->width + 7) / 8;
+    if (!f->width || !f->height || f->width > 64 || f->height > 64 ||
+        f->stride < f->row_bytes * f->height || !f->num_glyphs ||
+        f->num_glyphs > 0x10000 ||
+        hdr > len || (uint64_t)f->num_glyphs * f->stride > len - hdr) {
+        return 0;
+    }
+    f->kind = FONT_PSF;
+    f->bits = d + hdr;
+
+    for (int c = 0; c < 128; ++c) f->ascii[c] = FONT_NO_GLYPH;
+    const uint8_t *table = f->bits + f->num_glyphs * f->stride;
+    if (unicode && hdr == 4) {
+        psf1_unicode(f, table, table_end);
+    } else if (unicode) {
+        psf2_unicode(f, table, table_end);
+    }
+    // Fonts without a table (or with gaps in it) are in ASCII order.
+    for (uint32_t c = 0; c < 128 && c < f->num_glyphs; ++c) {
+        if (f->ascii[c] == FONT_NO_GLYPH) f->ascii[c] = (uint16_t)c;
+    }
+    bitmap_measure(f);
+    return 1;
+}
+
+// ---------------------------------------------------------------------
+// TrueType
+// ---------------------------------------------------------------------
+
+static uint32_t be16(const uint8_t *p) { return ((uint32_t)p[0] << 8) | p[1]; }
+static int32_t  bes16(const uint8_t *p) { return (int16_t)be16(p); }
+static uint32_t be32(const uint8_t *p) { return (be16(p) << 16) | be16(p + 2); }
+
+static int ttf_has(const Font *f, uint32_t off, uint32_t n) {
+    return off <= f->len && n <= f->len - off;
+}
+
+static uint32_t ttf_table(const Font *f, const char *tag, uint32_t *len) {
+    uint32_t n = be16(f->data + 4);
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t rec = 12 + i * 16;
+        if (!ttf_has(f, rec, 16)) return 0;
+        if (memcmp(f->data + rec, tag, 4) == 0) {
+            uint32_t off = be32(f->data + rec + 8);
+            uint32_t l   = be32(f->data + rec + 12);
+            if (!ttf_has(f, off, l)) return 0;
+            if (len) *len = l;
+            return off;
+        }
+    }
+    return 0;
+}
+
+static uint32_t ttf_glyph_index(const Font *f, uint32_t cp) {
+    const uint8_t *t = f->data + f->cmap;
+    uint32_t segx2 = be16(t + 6);
+    const uint8_t *ends   = t + 14;
+    const uint8_t *starts = ends + segx2 + 2;
+    const uint8_t *deltas = starts + segx2;
+    const uint8_t *ranges = deltas + segx2;
+
+    for (uint32_t i = 0; i < segx2 / 2; ++i) {
+        if (cp > be16(ends + 2 * i)) continue;
+        uint32_t start = be16(starts + 2 * i);
+        if (cp < start) return 0;
+        uint32_t delta = be16(deltas + 2 * i);
+        uint32_t ro    = be16(ranges + 2 * i);
+        if (ro == 0) return (cp + delta) & 0xFFFF;
+        const uint8_t *p = ranges + 2 * i + ro + 2 * (cp - start);
+        if (p + 2 > f->data + f->len) return 0;
+        uint32_t gi = be16(p);
+        return gi ? (gi + delta) & 0xFFFF : 0;
+    }
+    return 0;
+}
+
+// Byte range of glyph gi inside glyf; 0 length for empty glyphs.
+static uint32_t ttf_glyph_off(const Font *f, uint32_t gi, uint32_t *len) {
+    uint32_t a, b;
+    *len = 0;
+    if (gi >= f->num_glyphs_ttf) return 0;
+    if (f->loca_long) {
+        a = be32(f->data + f->loca + gi * 4);
+        b = be32(f->data + f->loca + gi * 4 + 4);
+    } else {
+        a = be16(f->data + f->loca + gi * 2) * 2;
+        b = be16(f->data + f->loca + gi * 2 + 2) * 2;
+    }
+    if (b <= a || !ttf_has(f, f->glyf + a, b - a)) return 0;
+    *len = b - a;
+    return f->glyf + a;
+}
+
+static uint32_t ttf_advance(const Font *f, uint32_t gi) {
+    if (gi >= f->num_hmetrics) gi = f->num_hmetrics - 1;
+    return be16(f->data + f->hmtx + gi * 4);
+}
+
+static int ttf_open(Font *f) {
+    if (f->len < 12) return 0;
+    uint32_t v = be32(f->data);
+    if (v != 0x00010000u && v != 0x74727565u) return 0;     // or 'true'
+    if (!ttf_has(f, 12, be16(f->data + 4) * 16)) return 0;
+
+    uint32_t head_len, maxp_len, hhea_len, cmap_len, loca_len, hmtx_len, os2_len = 0;
+    uint32_t head = ttf_table(f, "head", &head_len);
+    uint32_t maxp = ttf_table(f, "maxp", &maxp_len);
+    uint32_t hhea = ttf_table(f, "hhea", &hhea_len);
+    uint32_t cmap = ttf_table(f, "cmap", &cmap_len);
+    f->loca = ttf_table(f, "loca", &loca_len);
+    f->glyf = ttf_table(f, "glyf", 0);
+    f->hmtx = ttf_table(f, "hmtx", &hmtx_len);
+    uint32_t os2 = ttf_table(f, "OS/2", &os2_len);
+    if (!head || !maxp || !hhea || !cmap || !f->loca || !f->glyf || !f->hmtx ||
+        head_len < 54 || maxp_len < 6 || hhea_len < 36 || cmap_len < 4) {
+        return 0;
+    }
+
+    f->units_per_em   = be16(f->data + head + 18);
+    f->loca_long      = bes16(f->data + head + 50) != 0;
+    f->num_glyphs_ttf = be16(f->data + maxp + 4);
+    f->num_hmetrics   = be16(f->data + hhea + 34);
+    if (!f->units_per_em || !f->num_hmetrics ||
+        hmtx_len < f->num_hmetrics * 4 ||
+        loca_len < (f->num_glyphs_ttf + 1) * (f->loca_long ? 4u : 2u)) {
+        return 0;
+    }
+
+    // A Unicode BMP subtable in format 4 (Windows 3/1 or Unicode 0/x).
+    uint32_t n = be16(f->data + cmap + 2);
+    for (uint32_t i = 0; i < n && 4 + i * 8 + 8 <= cmap_len; ++i) {
+        const uint8_t *rec = f->data + cmap + 4 + i * 8;
+        uint32_t plat = be16(rec), enc = be16(rec + 2);
+        uint32_t sub  = cmap + be32(rec + 4);
+        if (!((plat == 3 && enc == 1) || plat == 0)) continue;
+        if (!ttf_has(f, sub, 14) || be16(f->data + sub) != 4) continue;
+        uint32_t segx2 = be16(f->data + sub + 6);
+        if (!ttf_has(f, sub, 16 + segx2 * 4)) continue;
+        f->cmap = sub;
+        break;
+    }
+    if (!f->cmap) return 0;
+
+    // Cap height from OS/2 (version 2+), else the top of 'H'.
+    f->cap = 0;
+    if (os2 && os2_len >= 90 && be16(f->data + os2) >= 2) {
+        f->cap = bes16(f->data + os2 + 88);
+    }
+    if (f->cap <= 0) {
+        uint32_t glen;
+        uint32_t g = ttf_glyph_off(f, ttf_glyph_index(f, 'H'), &glen);
+        if (glen >= 10) f->cap = bes16(f->data + g + 8);
+    }
+    if (f->cap <= 0) f->cap = (int32_t)(f->units_per_em * 7 / 10);
+
+    f->kind = FONT_TTF;
+    return 1;
+}
+
+Font *font_load(const char *name, const uint8_t *data, uint32_t len) {
+    Font *f = (Font*)kmalloc(sizeof(Font));
+    if (!f) return 0;
+    memset(f, 0, sizeof(*f));
+    str_copy(f->name, name, sizeof(f->name));
+    f->data = data;
+    f->len  = len;
+    if (psf_open(f, data, len) || ttf_open(f)) return f;
+    kfree(f);
+    return 0;
+}
+
+const char *font_name(const Font *f) {
+    return f->name;
+}
+
+const char *font_kind(const Font *f) {
+    switch (f->kind) {
+        case FONT_PSF: return "PSF";
+        case FONT_TTF: return "TrueType";
+        default:       return "bitmap";
+    }
+}
+
+uint32_t font_size_for_cap(const Font *f, uint32_t cap_px) {
+    uint32_t em = (f->kind == FONT_TTF) ? f->units_per_em : f->height;
+    uint32_t size = (cap_px * em + (uint32_t)f->cap / 2) / (uint32_t)f->cap;
+    return size ? size : 1;
+}
+
+// ---------------------------------------------------------------------
+// Rasterizers. Both produce a full coverage buffer that raster_finish()
+// trims to the ink and turns into a cache entry.
+// ---------------------------------------------------------------------
+
+typedef struct {
+    uint8_t *cov;           // w * h
+    int32_t  w, h;
+    int32_t  left, top;     // of the buffer's first column/row
+    uint32_t advance;
+} Raster;
+
+// Bitmap glyphs are sampled 4x4 per output pixel; exact multiples of the
+// cell height just replicate pixels, so the built-in font stays crisp.
+static int raster_bitmap(const Font *f, uint32_t gi, uint32_t size, Raster *r) {
+    uint32_t out_w = (f->width * size + f->height / 2) / f->height;
+    if (!out_w) out_w = 1;
+    r->w = (int32_t)out_w;
+    r->h = (int32_t)size;
+    r->left = 0;
+    r->top  = (int32_t)((f->baseline * size + f->height / 2) / f->height);
+    r->advance = out_w;
+    r->cov = (uint8_t*)kmalloc(out_w * size);
+    if (!r->cov) return 0;
+
+    const uint8_t *rows = f->bits + gi * f->stride;
+    int exact = (size % f->height) == 0 && out_w == f->width * (size / f->height);
+    for (uint32_t oy = 0; oy < size; ++oy) {
+        for (uint32_t ox = 0; ox < out_w; ++ox) {
+            uint32_t hits = 0, samples = exact ? 1 : 16;
+            for (uint32_t s = 0; s < samples; ++s) {
+                uint32_t sx, sy;
+                if (exact) {
+                    sx = ox * f->height / size;
+                    sy = oy * f->height / size;
+                } else {
+                    sx = ((ox * 8 + (s & 3) * 2 + 1) * f->width) / (out_w * 8);
+                    sy = ((oy * 8 + (s >> 2) * 2 + 1) * f->height) / (size * 8);
+                }
+                if (rows[sy * f->row_bytes + sx / 8] & (0x80u >> (sx & 7))) hits++;
+            }
+            r->cov[oy * out_w + ox] = (uint8_t)(hits * 255 / samples);
+        }
+    }
+    return 1;
+}
+
+// Outline: TrueType points (font units) and the index after each contour.
+#define OUTLINE_MAX_POINTS   2048
+#define OUTLINE_MAX_CONTOURS 256
+
+typedef struct {
+    int32_t  x, y;
+    uint8_t  on;
+} OutlinePoint;
+
+typedef struct {
+    OutlinePoint pts[OUTLINE_MAX_POINTS];
+    uint16_t     ends[OUTLINE_MAX_CONTOURS];
+    uint32_t     npts, ncontours;
+} Outline;
+
+static int ttf_outline(const Font *f, uint32_t gi, int32_t dx, int32_t dy,
+                       int depth, Outline *o) {
+    uint32_t len;
+    uint32_t off = ttf_glyph_off(f, gi, &len);
+    if (!len) return 1;                     // blank glyph
+    if (len < 10) return 0;
+    const uint8_t *p   = f->data + off;
+    const uint8_t *end = p + len;
+    int32_t n = bes16(p);
+
+    if (n < 0) {
+        // Compound glyph: components placed by x/y offsets. Scaled and
+        // point-matched components are drawn unscaled at the origin.
+        if (depth > 4) return 0;
+        p += 10;
+        uint32_t flags;
+        do {
+            if (p + 4 > end) return 0;
+            flags = be16(p);
+            uint32_t sub = be16(p + 2);
+            p += 4;
+            int32_t a, b;
+            if (flags & 0x0001) {
+                if (p + 4 > end) return 0;
+                a = bes16(p); b = bes16(p + 2); p += 4;
+            } else {
+                if (p + 2 > end) return 0;
+                a = (int8_t)p[0]; b = (int8_t)p[1]; p += 2;
+            }
+            if (!(flags & 0x0002)) a = b = 0;
+            if (flags & 0x0008)      p += 2;
+            else if (flags & 0x0040) p += 4;
+            else if (flags & 0x0080) p += 8;
+            if (!ttf_outline(f, sub, dx + a, dy + b, depth + 1, o)) return 0;
+        } while (flags & 0x0020);
+        return 1;
+    }
+
+    if (o->ncontours + (uint32_t)n > OUTLINE_MAX_CONTOURS) return 0;
+    const uint8_t *ends = p + 10;
+    if (ends + 2 * n + 2 > end) return 0;
+    uint32_t npts = n ? be16(ends + 2 * (n - 1)) + 1 : 0;
+    if (o->npts + npts > OUTLINE_MAX_POINTS) return 0;
+    const uint8_t *q = ends + 2 * n;
+    q += 2 + be16(q);                       // skip instructions
+
+    // Flags (with repeats), then x and y deltas.
+    OutlinePoint *pt = o->pts + o->npts;
+    for (uint32_t i = 0; i < npts; ) {
+        if (q >= end) return 0;
+        uint8_t fl = *q++;
+        uint32_t rep = 1;
+        if (fl & 0x08) {
+            if (q >= end) return 0;
+            rep += *q++;
+        }
+        while (rep-- && i < npts) pt[i++].on = fl;
+    }
+    int32_t v = 0;
+    for (uint32_t i = 0; i < npts; ++i) {
+        uint8_t fl = pt[i].on;
+        if (fl & 0x02) {
+            if (q >= end) return 0;
+            v += (fl & 0x10) ? *q : -(int32_t)*q;
+            q++;
+        } else if (!(fl & 0x10)) {
+            if (q + 2 > end) return 0;
+            v += bes16(q);
+            q += 2;
+        }
+        pt[i].x = v + dx;
+    }
+    v = 0;
+    for (uint32_t i = 0; i < npts; ++i) {
+        uint8_t fl = pt[i].on;
+        if (fl & 0x04) {
+            if (q >= end) return 0;
+            v += (fl & 0x20) ? *q : -(int32_t)*q;
+            q++;
+        } else if (!(fl & 0x20)) {
+            if (q + 2 > end) return 0;
+            v += bes16(q);
+            q += 2;
+        }
+        pt[i].y = v + dy;
+        pt[i].on &= 1;
+    }
+
+    for (int32_t c = 0; c < n; ++c) {
+        uint32_t e = be16(ends + 2 * c) + 1;
+        if (e > npts) return 0;
+        o->ends[o->ncontours++] = (uint16_t)(o->npts + e);
+    }
+    o->npts += npts;
+    return 1;
+}
+
+// Signed-area accumulation (as in font-rs): each edge adds the area it
+// covers to the cells it crosses, and a running sum along every row turns
+// that into exact coverage.
+typedef struct {
+    float   *acc;           // w * h + slack
+    int32_t  w, h;
+} Accum;
+
+typedef struct { float x, y; } Pt;
+
+static inline int32_t ffloor(float v) { int32_t i = (int32_t)v; return (v < (float)i) ? i - 1 : i; }
+static inline int32_t fceil(float v)  { int32_t i = (int32_t)v; return (v > (float)i) ? i + 1 : i; }
+static inline float   f_min(float a, float b) { return a < b ? a : b; }
+static inline float   f_max(float a, float b) { return a > b ? a : b; }
+
+static void accum_line(Accum *a, Pt p0, Pt p1) {
+    if (p0.y == p1.y) return;
+    float dir = 1.0f;
+    if (p0.y > p1.y) {
+        Pt t = p0; p0 = p1; p1 = t;
+        dir = -1.0f;
+    }
+    float dxdy = (p1.x - p0.x) / (p1.y - p0.y);
+    float x = p0.x;
+    int32_t y0 = ffloor(p0.y);
+    if (y0 < 0) y0 = 0;
+    int32_t y1 = fceil(p1.y);
+    if (y1 > a->h) y1 = a->h;
+    if (p0.y < 0.0f) x -= p0.y * dxdy;
+
+    for (int32_t y = y0; y < y1; ++y) {
+        float *row = a->acc + y * a->w;
+        float dy = f_min((float)(y + 1), p1.y) - f_max((float)y, p0.y);
+        float xnext = x + dxdy * dy;
+        float d = dy * dir;
+        float x0 = f_min(x, xnext), x1 = f_max(x, xnext);
+        float x0floor = (float)ffloor(x0);
+        int32_t x0i = (int32_t)x0floor;
+        float x1ceil = (float)fceil(x1);
+        int32_t x1i = (int32_t)x1ceil;
+
+        if (x1i <= x0i + 1) {
+            float xmf = 0.5f * (x + xnext) - x0floor;
+            row[x0i]     += d - d * xmf;
+            row[x0i + 1] += d * xmf;
+        } else {
+            float s   = 1.0f / (x1 - x0);
+            float x0f = x0 - x0floor;
+            float a0  = 0.5f * s * (1.0f - x0f) * (1.0f - x0f);
+            float x1f = x1 - x1ceil + 1.0f;
+            float am  = 0.5f * s * x1f * x1f;
+            row[x0i] += d * a0;
+            if (x1i == x0i + 2) {
+                row[x0i + 1] += d * (1.0f - a0 - am);
+            } else {
+                float a1 = s * (1.5f - x0f);
+                row[x0i + 1] += d * (a1 - a0);
+                for (int32_t xi = x0i + 2; xi < x1i - 1; ++xi) row[xi] += d * s;
+                float a2 = a1 + (float)(x1i - x0i - 3) * s;
+                row[x1i - 1] += d * (1.0f - a2 - am);
+            }
+            row[x1i] += d * am;
+        }
+        x = xnext;
+    }
+}
+
+static void accum_quad(Accum *a, Pt p0, Pt c, Pt p1) {
+    // Segments so that the flattening error stays below ~0.1 px.
+    float ddx = p0.x - 2.0f * c.x + p1.x;
+    float ddy = p0.y - 2.0f * c.y + p1.y;
+    float dd  = (ddx < 0 ? -ddx : ddx) + (ddy < 0 ? -ddy : ddy);
+    int n = 1;
+    while (n < 16 && (float)(n * n) * 0.8f < dd) n++;
+
+    Pt prev = p0;
+    for (int i = 1; i <= n; ++i) {
+        float t = (float)i / (float)n, u = 1.0f - t;
+        Pt q = { u * u * p0.x + 2.0f * u * t * c.x + t * t * p1.x,
+                 u * u * p0.y + 2.0f * u * t * c.y + t * t * p1.y };
+        accum_line(a, prev, q);
+        prev = q;
+    }
+}
+
+// Outline point i in buffer pixel coordinates.
+static Pt outline_pt(const Outline *o, uint32_t i, float scale, int32_t x0, int32_t y0) {
+    Pt p = { (float)o->pts[i].x * scale - (float)x0,
+             -(float)o->pts[i].y * scale - (float)y0 };
+    return p;
+}
+
+static Pt pt_mid(Pt a, Pt b) {
+    Pt m = { 0.5f * (a.x + b.x), 0.5f * (a.y + b.y) };
+    return m;
+}
+
+static int raster_ttf(const Font *f, uint32_t gi, uint32_t size, Raster *r) {
+    float scale = (float)size / (float)f->units_per_em;
+    r->advance = (uint32_t)((float)ttf_advance(f, gi) * scale + 0.5f);
+    r->w = r->h = 0;
+    r->left = r->top = 0;
+    r->cov = 0;
+
+    Outline *o = (Outline*)kmalloc(sizeof(Outline));
+    if (!o) return 0;
+    o->npts = o->ncontours = 0;
+    if (!ttf_outline(f, gi, 0, 0, 0, o) || !o->npts) {
+        kfree(o);
+        return 1;                           // nothing to draw
+    }
+
+    // Pixel bounds (y grows downwards from the baseline).
+    float minx = 1e9f, miny = 1e9f, maxx = -1e9f, maxy = -1e9f;
+    for (uint32_t i = 0; i < o->npts; ++i) {
+        float x = (float)o->pts[i].x * scale, y = -(float)o->pts[i].y * scale;
+        minx = f_min(minx, x); maxx = f_max(maxx, x);
+        miny = f_min(miny, y); maxy = f_max(maxy, y);
+    }
+    int32_t x0 = ffloor(minx), y0 = ffloor(miny);
+    Accum a;
+    a.w = fceil(maxx) - x0 + 1;
+    a.h = fceil(maxy) - y0 + 1;
+    a.acc = (float*)kmalloc(((size_t)a.w * (size_t)a.h + 4) * sizeof(float));
+    r->cov = (uint8_t*)kmalloc((size_t)a.w * (size_t)a.h);
+    if (!a.acc || !r->cov) {
+        kfree(a.acc);
+        kfree(r->cov);
+        kfree(o);
+        r->cov = 0;
+        return 0;
+    }
+    memset(a.acc, 0, ((size_t)a.w * (size_t)a.h + 4) * sizeof(float));
+
+    uint32_t s = 0;
+    for (uint32_t c = 0; c < o->ncontours; ++c) {
+        uint32_t e = o->ends[c], n = e - s;
+        if (n < 2) { s = e; continue; }
+
+        // Start on an on-curve point; if there is none, between the last
+        // and first (both off-curve) points.
+        uint32_t k = n;
+        for (uint32_t i = 0; i < n; ++i) {
+            if (o->pts[s + i].on) { k = i; break; }
+        }
+        Pt start;
+        if (k == n) {
+            start = pt_mid(outline_pt(o, s + n - 1, scale, x0, y0),
+                           outline_pt(o, s, scale, x0, y0));
+            k = n - 1;
+        } else {
+            start = outline_pt(o, s + k, scale, x0, y0);
+        }
+
+        Pt cur = start, ctrl = start;
+        int has_ctrl = 0;
+        for (uint32_t i = 1; i <= n; ++i) {
+            uint32_t idx = (k + i) % n;
+            Pt p = outline_pt(o, s + idx, scale, x0, y0);
+            if (o->pts[s + idx].on) {
+                if (has_ctrl) accum_quad(&a, cur, ctrl, p);
+                else          accum_line(&a, cur, p);
+                cur = p;
+                has_ctrl = 0;
+            } else {
+                if (has_ctrl) {
+                    Pt m = pt_mid(ctrl, p);
+                    accum_quad(&a, cur, ctrl, m);
+                    cur = m;
+                }
+                ctrl = p;
+                has_ctrl = 1;
+            }
+        }
+        if (has_ctrl) accum_quad(&a, cur, ctrl, start);
+        else          accum_line(&a, cur, start);
+        s = e;
+    }
+    kfree(o);
+
+    float sum = 0.0f;
+    for (int32_t i = 0; i < a.w * a.h; ++i) {
+        sum += a.acc[i];
+        float v = sum < 0 ? -sum : sum;
+        if (v > 1.0f) v = 1.0f;
+        r->cov[i] = (uint8_t)(v * 255.0f + 0.5f);
+    }
+    kfree(a.acc);
+
+    r->w = a.w;
+    r->h = a.h;
+    r->left = x0;
+    r->top  = -y0;
+    return 1;
+}
+
+// ---------------------------------------------------------------------
+// Glyph cache: chained hash on (font, size, code point). Entries hold the
+// trimmed coverage right after the header. When the byte budget is hit the
+// whole cache is dropped; the working set (one UI font at a few sizes) is
+// far below it.
+// ---------------------------------------------------------------------
+
+#define GLYPH_BUCKETS 256
+
+typedef struct GlyphEntry {
+    struct GlyphEntry *next;
+    const Font *font;
+    uint32_t    size;
+    uint32_t    cp;
+    Glyph       glyph;
+} GlyphEntry;
+
+static GlyphEntry    *g_glyph_hash[GLYPH_BUCKETS];
+static FontCacheStats g_cache_stats;
+static int            g_cache_held = 0;
+
+static uint32_t glyph_hash(const Font *f, uint32_t size, uint32_t cp) {
+    uint32_t h = (uint32_t)(uintptr_t)f * 2654435761u;
+    h ^= size * 40503u + cp * 2246822519u;
+    return (h ^ (h >> 13)) % GLYPH_BUCKETS;
+}
+
+void font_cache_clear(void) {
+    for (int i = 0; i < GLYPH_BUCKETS; ++i) {
+        GlyphEntry *e = g_glyph_hash[i];
+        while (e) {
+            GlyphEntry *next = e->next;
+            kfree(e);
+            e = next;
+        }
+        g_glyph_hash[i] = 0;
+    }
+    g_cache_stats.glyphs = 0;
+    g_cache_stats.bytes  = 0;
+}
+
+void font_cache_stats(FontCacheStats *out) {
+    *out = g_cache_stats;
+}
+
+void font_cache_hold(void) {
+    g_cache_held++;
+}
+
+void font_cache_release(void) {
+    if (g_cache_held && --g_cache_held == 0 &&
+        g_cache_stats.bytes > FONT_CACHE_BYTES) {
+        font_cache_clear();
+        g_cache_stats.flushes++;
+    }
+}
+
+// Trims r to its ink and moves it into a new cache entry.
+static GlyphEntry *raster_finish(Raster *r) {
+    int32_t x0 = r->w, y0 = r->h, x1 = -1, y1 = -1;
+    for (int32_t y = 0; y < r->h; ++y) {
+        for (int32_t x = 0; x < r->w; ++x) {
+            if (!r->cov[y * r->w + x]) continue;
+            if (x < x0) x0 = x;
+            if (x > x1) x1 = x;
+            if (y < y0) y0 = y;
+            y1 = y;
+        }
+    }
+    uint32_t w = x1 >= x0 ? (uint32_t)(x1 - x0 + 1) : 0;
+    uint32_t h = y1 >= y0 ? (uint32_t)(y1 - y0 + 1) : 0;
+
+    GlyphEntry *e = (GlyphEntry*)kmalloc(sizeof(GlyphEntry) + w * h);
+    if (!e) return 0;
+    uint8_t *cov = (uint8_t*)(e + 1);
+    for (uint32_t y = 0; y < h; ++y) {
+        memcpy(cov + y * w, r->cov + (y0 + (int32_t)y) * r->w + x0, w);
+    }
+    e->glyph.w        = (uint16_t)w;
+    e->glyph.h        = (uint16_t)h;
+    e->glyph.left     = (int16_t)(w ? r->left + x0 : 0);
+    e->glyph.top      = (int16_t)(h ? r->top - y0 : 0);
+    e->glyph.advance  = (uint16_t)r->advance;
+    e->glyph.coverage = cov;
+    return e;
+}
+
+static GlyphEntry *glyph_render(Font *f, uint32_t size, uint32_t cp) {
+    Raster r;
+    int ok;
+    if (f->kind == FONT_TTF) {
+        uint32_t gi = ttf_glyph_index(f, cp);
+        if (!gi && cp != '?') gi = ttf_glyph_index(f, '?');
+        ok = raster_ttf(f, gi, size, &r);
+    } else {
+        uint32_t gi = cp < 128 ? f->ascii[cp] : FONT_NO_GLYPH;
+        if (gi == FONT_NO_GLYPH || gi >= f->num_glyphs) gi = f->ascii['?'];
+        if (gi == FONT_NO_GLYPH || gi >= f->num_glyphs) gi = 0;
+        ok = raster_bitmap(f, gi, size, &r);
+    }
+    if (!ok) return 0;
+
+    GlyphEntry *e = raster_finish(&r);
+    kfree(r.cov);
+    return e;
+}
+
+const Glyph *font_glyph(Font *f, uint32_t size, uint32_t cp) {
+    if (!f || !size) return 0;
+    if (size > FONT_MAX_SIZE) size = FONT_MAX_SIZE;
+
+    uint32_t b = glyph_hash(f, size, cp);
+    for (GlyphEntry *e = g_glyph_hash[b]; e; e = e->next) {
+        if (e->font == f && e->size == size && e->cp == cp) {
+            g_cache_stats.hits++;
+            return &e->glyph;
+        }
+    }
+
+    g_cache_stats.misses++;
+    GlyphEntry *e = glyph_render(f, size, cp);
+    if (!e) return 0;
+    uint32_t bytes = (uint32_t)sizeof(GlyphEntry) + e->glyph.w * e->glyph.h;
+    if (g_cache_stats.bytes + bytes > FONT_CACHE_BYTES && !g_cache_held) {
+        font_cache_clear();
+        g_cache_stats.flushes++;
+    }
+    e->font = f;
+    e->size = size;
+    e->cp   = cp;
+    e->next = g_glyph_hash[b];
+    g_glyph_hash[b] = e;
+    g_cache_stats.glyphs++;
+    g_cache_stats.bytes += bytes;
+    return &e->glyph;
+}
+
+// ---------------------------------------------------------------------
+// Drawing
+// ---------------------------------------------------------------------
+
+// dst + (src - dst) * a / 256 per channel, red and blue in one multiply.
+static inline uint32_t blend(uint32_t dst, uint32_t src, uint32_t a) {
+    uint32_t ia = 256 - a;
+    uint32_t rb = ((src & 0xFF00FFu) * a + (dst & 0xFF00FFu) * ia) >> 8;
+    uint32_t g  = ((src & 0x00FF00u) * a + (dst & 0x00FF00u) * ia) >> 8;
+    return (rb & 0xFF00FFu) | (g & 0x00FF00u);
+}
+
+void font_blit(Surface *dst, int32_t x, int32_t y, const Glyph *g,
+               uint32_t color) {
+    if (!dst->pixels || !g->w) return;
+    int32_t gx = x + g->left;
+    int32_t gy = y - g->top;
+
+    int32_t c0 = gx < 0 ? -gx : 0;
+    int32_t r0 = gy < 0 ? -gy : 0;
+    int32_t c1 = g->w, r1 = g->h;
+    if (gx + c1 > (int32_t)dst->w) c1 = (int32_t)dst->w - gx;
+    if (gy + r1 > (int32_t)dst->h) r1 = (int32_t)dst->h - gy;
+    if (c0 >= c1 || r0 >= r1) return;
+
+    color &= 0x00FFFFFFu;
+    for (int32_t row = r0; row < r1; ++row) {
+        const uint8_t *cov = g->coverage + row * g->w;
+        uint32_t *px = dst->pixels + (uint64_t)(gy + row) * dst->pitch + gx;
+        for (int32_t col = c0; col < c1; ++col) {
+            uint32_t a = cov[col];
+            if (a == 0) continue;
+            if (a == 255) px[col] = color;
+            else          px[col] = blend(px[col], color, a + (a >> 7));
+        }
+    }
+}
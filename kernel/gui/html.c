@@ -0,0 +1,680 @@
+// kernel/gui/html.c
+// Streaming HTML tokenizer and block/inline layout into a cached line list.
+//
+// The tokenizer is a byte-at-a-time state machine, so html_feed() can be
+// called straight from the HTTP body sink with whatever chunk the socket
+// returned. Layout is driven directly by tokens: words are wrapped into
+// lines of `cols` fixed-width cells as soon as they complete. The only
+// per-document storage is the source (kept so a width change can re-wrap),
+// a text arena, and the run/line arrays the Browser draws from.
+
+#include "html.h"
+#include "klib.h"
+#include "mm.h"
+
+#define HTML_MAX_SOURCE (1u << 20)   // bigger pages are truncated
+#define HTML_TAG_MAX    12
+#define HTML_ENTITY_MAX 10
+#define HTML_WORD_MAX   128
+#define HTML_TITLE_MAX  64
+#define HTML_MAX_DEPTH  8
+#define HTML_MIN_COLS   8
+
+// Tokenizer states
+enum {
+    TOK_TEXT = 0,
+    TOK_TAG_OPEN,       // just saw '<'
+    TOK_TAG_NAME,
+    TOK_TAG_ATTRS,      // skipping attributes up to '>'
+    TOK_ATTR_QUOTE,     // inside a quoted attribute value
+    TOK_MARKUP_DECL,    // "<!" - a comment or a doctype
+    TOK_COMMENT,
+    TOK_BOGUS,          // <!DOCTYPE ...>, <?xml ...>: skip to '>'
+    TOK_ENTITY,         // after '&'
+    TOK_RAWTEXT         // <script>/<style> body: skip to the close tag
+};
+
+typedef struct {
+    uint32_t first_run;
+    uint32_t run_count;
+} HtmlLine;
+
+struct HtmlDoc {
+    uint32_t cols;
+    int      finished;
+
+    // Saved source (for re-wrapping) and the layout caches.
+    char     *src;
+    uint32_t  src_len, src_cap;
+    char     *text;
+    uint32_t  text_len, text_cap;
+    HtmlRun  *runs;
+    uint32_t  run_count, run_cap;
+    HtmlLine *lines;
+    uint32_t  line_count, line_cap;
+    char      title[HTML_TITLE_MAX];
+    uint32_t  title_len;
+
+    // Tokenizer
+    int      tok;
+    char     tag[HTML_TAG_MAX];
+    uint32_t tag_len;
+    int      tag_close;
+    char     quote;
+    char     entity[HTML_ENTITY_MAX];
+    uint32_t entity_len;
+    int      dashes;
+    char     raw_tag[HTML_TAG_MAX];
+    uint32_t raw_match;
+
+    // Layout
+    uint32_t col;           // next free cell on the open line
+    int      line_open;     // last line still accepts runs
+    int      pending_space;
+    char     word[HTML_WORD_MAX];
+    uint32_t word_len;
+    uint8_t  word_style;
+    int      pre, heading, link, bold;
+    int      pre_start;     // a newline right after <pre> is dropped
+    int      in_head, in_title;
+    int      list_depth;
+    uint32_t list_num[HTML_MAX_DEPTH];  // 0 = bullets, else next number
+    int      quote_depth;
+};
+
+static void tok_char(HtmlDoc *doc, uint8_t c);
+
+// ---------------------------------------------------------------------
+// Buffers
+// ---------------------------------------------------------------------
+
+// Grows *buf (of elem-sized items) to hold at least need items.
+static int grow(void **buf, uint32_t *cap, uint32_t need, uint32_t elem) {
+    if (need <= *cap) return 0;
+    uint32_t ncap = *cap ? *cap * 2 : 64;
+    while (ncap < need) ncap *= 2;
+    void *nb = kmalloc((size_t)ncap * elem);
+    if (!nb) return -1;
+    if (*buf) {
+        memcpy(nb, *buf, (size_t)*cap * elem);
+        kfree(*buf);
+    }
+    *buf = nb;
+    *cap = ncap;
+    return 0;
+}
+
+static void layout_reset(HtmlDoc *doc) {
+    doc->text_len   = 0;
+    doc->run_count  = 0;
+    doc->line_count = 0;
+    doc->title[0]   = '\0';
+    doc->title_len  = 0;
+
+    doc->tok        = TOK_TEXT;
+    doc->tag_len    = 0;
+    doc->entity_len = 0;
+    doc->raw_match  = 0;
+
+    doc->col           = 0;
+    doc->line_open     = 0;
+    doc->pending_space = 0;
+    doc->word_len      = 0;
+    doc->pre = doc->heading = doc->link = doc->bold = 0;
+    doc->in_head = doc->in_title = 0;
+    doc->list_depth  = 0;
+    doc->quote_depth = 0;
+}
+
+// ---------------------------------------------------------------------
+// Layout
+// ---------------------------------------------------------------------
+
+static uint8_t cur_style(const HtmlDoc *doc) {
+    if (doc->pre)     return HTML_STYLE_PRE;
+    if (doc->heading) return HTML_STYLE_HEADING;
+    if (doc->link)    return HTML_STYLE_LINK;
+    if (doc->bold)    return HTML_STYLE_BOLD;
+    return HTML_STYLE_TEXT;
+}
+
+static uint32_t cur_indent(const HtmlDoc *doc) {
+    uint32_t ind = (uint32_t)(doc->list_depth + doc->quote_depth) * 2;
+    return ind > doc->cols / 2 ? doc->cols / 2 : ind;
+}
+
+static void line_new(HtmlDoc *doc) {
+    if (grow((void **)&doc->lines, &doc->line_cap, doc->line_count + 1, sizeof(HtmlLine)) < 0) {
+        return;
+    }
+    HtmlLine *l  = &doc->lines[doc->line_count++];
+    l->first_run = doc->run_count;
+    l->run_count = 0;
+    doc->line_open     = 1;
+    doc->col           = cur_indent(doc);
+    doc->pending_space = 0;
+}
+
+// Appends text to the open line, extending the last run when it continues
+// in the same style.
+static void emit(HtmlDoc *doc, const char *s, uint32_t len, uint8_t style) {
+    if (!len) return;
+    if (!doc->line_open) line_new(doc);
+    if (!doc->line_open) return;
+    if (grow((void **)&doc->text, &doc->text_cap, doc->text_len + len, 1) < 0) return;
+
+    HtmlLine *l   = &doc->lines[doc->line_count - 1];
+    HtmlRun  *last = l->run_count ? &doc->runs[doc->run_count - 1] : 0;
+    if (last && last->style == style &&
+        last->text + last->len == doc->text_len &&
+        last->col + last->len == doc->col &&
+        last->len + len <= 0xFFFF) {
+        last->len = (uint16_t)(last->len + len);
+    } else {
+        if (grow((void **)&doc->runs, &doc->run_cap, doc->run_count + 1, sizeof(HtmlRun)) < 0) {
+            return;
+        }
+        HtmlRun *r = &doc->runs[doc->run_count++];
+        r->text  = doc->text_len;
+        r->len   = (uint16_t)len;
+        r->col   = (uint16_t)doc->col;
+        r->style = style;
+        l->run_count++;
+    }
+    memcpy(doc->text + doc->text_len, s, len);
+    doc->text_len += len;
+    doc->col      += len;
+}
+
+// Wraps the buffered word onto the current line (or the next one).
+static void place_word(HtmlDoc *doc) {
+    uint32_t len = doc->word_len;
+    const char *w = doc->word;
+    doc->word_len = 0;
+    if (!len) return;
+
+    uint32_t indent = cur_indent(doc);
+    int space = doc->pending_space && doc->line_open && doc->col > indent;
+    if (doc->line_open && doc->col + (uint32_t)space + len > doc->cols && doc->col > indent) {
+        doc->line_open = 0;
+        space = 0;
+    }
+    if (space) emit(doc, " ", 1, doc->word_style);
+    doc->pending_space = 0;
+
+    // Words wider than the line are hard-broken.
+    while (len) {
+        if (!doc->line_open) line_new(doc);
+        if (!doc->line_open) return;    // out of memory
+        uint32_t room = doc->cols > doc->col ? doc->cols - doc->col : 0;
+        if (room == 0) {
+            doc->line_open = 0;
+            continue;
+        }
+        uint32_t n = len < room ? len : room;
+        emit(doc, w, n, doc->word_style);
+        w   += n;
+        len -= n;
+        if (len) doc->line_open = 0;
+    }
+}
+
+// Ends the current line, producing an empty one if nothing was on it.
+static void hard_break(HtmlDoc *doc) {
+    place_word(doc);
+    if (!doc->line_open) line_new(doc);
+    doc->line_open = 0;
+}
+
+// Starts a new block: the next text begins on a fresh line.
+static void block_break(HtmlDoc *doc) {
+    place_word(doc);
+    if (doc->line_open && doc->lines[doc->line_count - 1].run_count == 0) {
+        doc->line_count--;          // nothing was written to it
+    }
+    doc->line_open     = 0;
+    doc->pending_space = 0;
+}
+
+// Block break plus a blank separator line (never two, never at the top).
+static void para_break(HtmlDoc *doc) {
+    block_break(doc);
+    if (doc->line_count && doc->lines[doc->line_count - 1].run_count) {
+        line_new(doc);
+        doc->line_open = 0;
+    }
+}
+
+static void text_char(HtmlDoc *doc, char c) {
+    if (doc->in_title) {
+        if (c == '\n' || c == '\t' || c == '\r') c = ' ';
+        if (c == ' ' && (doc->title_len == 0 || doc->title[doc->title_len - 1] == ' ')) return;
+        if (doc->title_len + 1 < HTML_TITLE_MAX) {
+            doc->title[doc->title_len++] = c;
+            doc->title[doc->title_len]   = '\0';
+        }
+        return;
+    }
+    if (doc->in_head) return;
+
+    if (doc->pre) {
+        if (c == '\r') return;
+        int first = doc->pre_start;
+        doc->pre_start = 0;
+        if (c == '\n') {
+            if (first) return;
+            hard_break(doc);
+            return;
+        }
+        if (c == '\t') {
+            if (!doc->line_open) line_new(doc);
+            do {
+                emit(doc, " ", 1, HTML_STYLE_PRE);
+            } while (doc->col % 8 && doc->col < doc->cols);
+            return;
+        }
+        if (doc->line_open && doc->col >= doc->cols) doc->line_open = 0;
+        emit(doc, &c, 1, HTML_STYLE_PRE);
+        return;
+    }
+
+    if (c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\f') {
+        place_word(doc);
+        doc->pending_space = 1;
+        return;
+    }
+    uint8_t style = cur_style(doc);
+    if (doc->word_len && (doc->word_style != style || doc->word_len + 1 >= HTML_WORD_MAX)) {
+        // Style change inside a word (e.g. "foo<b>bar</b>"): place what we
+        // have and continue without a space.
+        place_word(doc);
+    }
+    doc->word_style = style;
+    doc->word[doc->word_len++] = c;
+}
+
+// A byte of document text. Non-ASCII UTF-8 is shown as one '?' per code
+// point since the font only covers ASCII.
+static void text_byte(HtmlDoc *doc, uint8_t c) {
+    if (c >= 0x80) {
+        if (c >= 0xC0) text_char(doc, '?');
+        return;
+    }
+    text_char(doc, (char)c);
+}
+
+// ---------------------------------------------------------------------
+// Tags
+// ---------------------------------------------------------------------
+
+static int tag_in(const char *tag, const char *const *list) {
+    for (; *list; ++list) {
+        if (str_eq(tag, *list)) return 1;
+    }
+    return 0;
+}
+
+static const char *const g_block_tags[] = {
+    "div", "table", "tr", "section", "article", "header", "footer", "nav",
+    "main", "aside", "dl", "dt", "dd", "form", "address", "figure",
+    "figcaption", "center", "body", "html", 0
+};
+
+static void nest(int *counter, int open) {
+    if (open) (*counter)++;
+    else if (*counter > 0) (*counter)--;
+}
+
+static void tag_done(HtmlDoc *doc) {
+    const char *t    = doc->tag;
+    int         open = !doc->tag_close;
+    doc->tok = TOK_TEXT;
+
+    if (str_eq(t, "br")) {
+        hard_break(doc);
+    } else if (str_eq(t, "p")) {
+        para_break(doc);
+    } else if (t[0] == 'h' && t[1] >= '1' && t[1] <= '6' && !t[2]) {
+        para_break(doc);
+        nest(&doc->heading, open);
+    } else if (str_eq(t, "pre")) {
+        para_break(doc);
+        doc->pre       = open;
+        doc->pre_start = open;
+    } else if (str_eq(t, "ul") || str_eq(t, "ol")) {
+        if (open) {
+            if (doc->list_depth == 0) para_break(doc);
+            else block_break(doc);
+            if (doc->list_depth < HTML_MAX_DEPTH) {
+                doc->list_num[doc->list_depth] = str_eq(t, "ol") ? 1 : 0;
+                doc->list_depth++;
+            }
+        } else {
+            block_break(doc);
+            if (doc->list_depth > 0) doc->list_depth--;
+            if (doc->list_depth == 0) para_break(doc);
+        }
+    } else if (str_eq(t, "li")) {
+        block_break(doc);
+        if (open && doc->list_depth > 0) {
+            line_new(doc);
+            if (doc->col >= 2) doc->col -= 2;
+            uint32_t *num = &doc->list_num[doc->list_depth - 1];
+            if (*num) {
+                char mark[16] = "";
+                str_cat_u64(mark, (*num)++, sizeof(mark));
+                str_cat(mark, ". ", sizeof(mark));
+                emit(doc, mark, str_len(mark), HTML_STYLE_TEXT);
+            } else {
+                emit(doc, "* ", 2, HTML_STYLE_TEXT);
+            }
+        }
+    } else if (str_eq(t, "blockquote")) {
+        para_break(doc);
+        nest(&doc->quote_depth, open);
+    } else if (str_eq(t, "hr")) {
+        block_break(doc);
+        line_new(doc);
+        while (doc->col < doc->cols) emit(doc, "-", 1, HTML_STYLE_RULE);
+        doc->line_open = 0;
+    } else if (str_eq(t, "a")) {
+        nest(&doc->link, open);
+    } else if (str_eq(t, "b") || str_eq(t, "strong")) {
+        nest(&doc->bold, open);
+    } else if (str_eq(t, "td") || str_eq(t, "th")) {
+        place_word(doc);
+        doc->pending_space = 1;
+    } else if (str_eq(t, "title")) {
+        doc->in_title = open;
+        if (open) doc->title_len = 0;
+    } else if (str_eq(t, "head")) {
+        doc->in_head = open;
+        if (open) doc->in_title = 0;
+    } else if (str_eq(t, "script") || str_eq(t, "style")) {
+        if (open) {
+            str_copy(doc->raw_tag, t, HTML_TAG_MAX);
+            doc->raw_match = 0;
+            doc->tok       = TOK_RAWTEXT;
+        }
+    } else if (tag_in(t, g_block_tags)) {
+        if (str_eq(t, "body")) doc->in_head = 0;
+        block_break(doc);
+    }
+}
+
+// ---------------------------------------------------------------------
+// Entities
+// ---------------------------------------------------------------------
+
+static const struct {
+    const char *name;
+    const char *text;
+} g_entities[] = {
+    { "amp", "&" }, { "lt", "<" }, { "gt", ">" }, { "quot", "\"" },
+    { "apos", "'" }, { "copy", "(c)" }, { "reg", "(r)" }, { "mdash", "-" },
+    { "ndash", "-" }, { "hellip", "..." }, { "laquo", "<<" }, { "raquo", ">>" },
+    { "middot", "." }, { "bull", "*" },
+};
+
+static void entity_done(HtmlDoc *doc) {
+    const char *e = doc->entity;
+    doc->tok = TOK_TEXT;
+
+    if (str_eq(e, "nbsp")) {
+        // Non-breaking: part of the word, never a wrap point.
+        uint8_t style = cur_style(doc);
+        if (doc->pre || doc->in_title || doc->in_head) {
+            text_char(doc, ' ');
+        } else if (doc->word_len + 1 < HTML_WORD_MAX) {
+            if (doc->word_len && doc->word_style != style) place_word(doc);
+            doc->word_style = style;
+            doc->word[doc->word_len++] = ' ';
+        }
+        return;
+    }
+    if (e[0] == '#') {
+        uint32_t v = 0;
+        int hex = (e[1] == 'x' || e[1] == 'X');
+        for (const char *p = e + 1 + hex; *p; ++p) {
+            char c = *p;
+            uint32_t d;
+            if (c >= '0' && c <= '9')                     d = (uint32_t)(c - '0');
+            else if (hex && c >= 'a' && c <= 'f')         d = (uint32_t)(c - 'a' + 10);
+            else if (hex && c >= 'A' && c <= 'F')         d = (uint32_t)(c - 'A' + 10);
+            else break;
+            v = v * (hex ? 16 : 10) + d;
+        }
+        text_char(doc, (v >= 32 && v < 127) || v == '\n' ? (char)v : '?');
+        return;
+    }
+    for (uint32_t i = 0; i < sizeof(g_entities) / sizeof(g_entities[0]); ++i) {
+        if (str_eq(e, g_entities[i].name)) {
+            for (const char *p = g_entities[i].text; *p; ++p) text_char(doc, *p);
+            return;
+        }
+    }
+    // Unknown: show it as written.
+    text_char(doc, '&');
+    for (const char *p = e; *p; ++p) text_char(doc, *p);
+    text_char(doc, ';');
+}
+
+// ---------------------------------------------------------------------
+// Tokenizer
+// ---------------------------------------------------------------------
+
+static char lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? (char)(c + 32) : c;
+}
+
+static int is_alnum(uint8_t c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+}
+
+static void tok_char(HtmlDoc *doc, uint8_t c) {
+    switch (doc->tok) {
+        case TOK_TEXT:
+            if (c == '<') {
+                doc->tok = TOK_TAG_OPEN;
+            } else if (c == '&') {
+                doc->tok        = TOK_ENTITY;
+                doc->entity_len = 0;
+            } else {
+                text_byte(doc, c);
+            }
+            break;
+
+        case TOK_TAG_OPEN:
+            doc->tag_len   = 0;
+            doc->tag[0]    = '\0';
+            doc->tag_close = 0;
+            if (c == '/') {
+                doc->tag_close = 1;
+                doc->tok       = TOK_TAG_NAME;
+            } else if (c == '!') {
+                doc->dashes = 0;
+                doc->tok    = TOK_MARKUP_DECL;
+            } else if (c == '?') {
+                doc->tok = TOK_BOGUS;
+            } else if (is_alnum(c)) {
+                doc->tok = TOK_TAG_NAME;
+                tok_char(doc, c);
+            } else {
+                // A lone '<' in text.
+                doc->tok = TOK_TEXT;
+                text_byte(doc, '<');
+                tok_char(doc, c);
+            }
+            break;
+
+        case TOK_TAG_NAME:
+            if (is_alnum(c)) {
+                if (doc->tag_len + 1 < HTML_TAG_MAX) {
+                    doc->tag[doc->tag_len++] = lower((char)c);
+                    doc->tag[doc->tag_len]   = '\0';
+                }
+            } else if (c == '>') {
+                tag_done(doc);
+            } else {
+                doc->tok = TOK_TAG_ATTRS;
+            }
+            break;
+
+        case TOK_TAG_ATTRS:
+            if (c == '"' || c == '\'') {
+                doc->quote = (char)c;
+                doc->tok   = TOK_ATTR_QUOTE;
+            } else if (c == '>') {
+                tag_done(doc);
+            }
+            break;
+
+        case TOK_ATTR_QUOTE:
+            if ((char)c == doc->quote) doc->tok = TOK_TAG_ATTRS;
+            break;
+
+        case TOK_MARKUP_DECL:
+            if (c == '-') {
+                if (++doc->dashes == 2) {
+                    doc->dashes = 0;
+                    doc->tok    = TOK_COMMENT;
+                }
+            } else {
+                doc->tok = (c == '>') ? TOK_TEXT : TOK_BOGUS;
+            }
+            break;
+
+        case TOK_COMMENT:
+            if (c == '-') {
+                doc->dashes++;
+            } else {
+                if (c == '>' && doc->dashes >= 2) doc->tok = TOK_TEXT;
+                doc->dashes = 0;
+            }
+            break;
+
+        case TOK_BOGUS:
+            if (c == '>') doc->tok = TOK_TEXT;
+            break;
+
+        case TOK_ENTITY:
+            if (c == ';' && doc->entity_len) {
+                doc->entity[doc->entity_len] = '\0';
+                entity_done(doc);
+            } else if ((is_alnum(c) || (c == '#' && doc->entity_len == 0)) &&
+                       doc->entity_len + 1 < HTML_ENTITY_MAX) {
+                doc->entity[doc->entity_len++] = (char)c;
+            } else {
+                // Not an entity after all: emit it literally.
+                doc->tok = TOK_TEXT;
+                text_char(doc, '&');
+                for (uint32_t i = 0; i < doc->entity_len; ++i) text_char(doc, doc->entity[i]);
+                tok_char(doc, c);
+            }
+            break;
+
+        case TOK_RAWTEXT: {
+            // Looking for "</" + raw_tag, case-insensitively.
+            uint32_t n = doc->raw_match;
+            char want  = n == 0 ? '<' : n == 1 ? '/' : doc->raw_tag[n - 2];
+            if (lower((char)c) == want) {
+                doc->raw_match++;
+                if (doc->raw_match - 2 == str_len(doc->raw_tag)) {
+                    str_copy(doc->tag, doc->raw_tag, HTML_TAG_MAX);
+                    doc->tag_close = 1;
+                    doc->tok       = TOK_TAG_ATTRS;
+                }
+            } else {
+                doc->raw_match = (c == '<') ? 1 : 0;
+            }
+            break;
+        }
+
+        default:
+            doc->tok = TOK_TEXT;
+            break;
+    }
+}
+
+static void parse(HtmlDoc *doc, const char *data, uint32_t len) {
+    for (uint32_t i = 0; i < len; ++i) tok_char(doc, (uint8_t)data[i]);
+}
+
+// ---------------------------------------------------------------------
+// Public API
+// ---------------------------------------------------------------------
+
+HtmlDoc *html_create(uint32_t cols) {
+    HtmlDoc *doc = (HtmlDoc *)kzalloc(sizeof(HtmlDoc));
+    if (!doc) return 0;
+    doc->cols = cols < HTML_MIN_COLS ? HTML_MIN_COLS : cols;
+    layout_reset(doc);
+    return doc;
+}
+
+void html_destroy(HtmlDoc *doc) {
+    if (!doc) return;
+    kfree(doc->src);
+    kfree(doc->text);
+    kfree(doc->runs);
+    kfree(doc->lines);
+    kfree(doc);
+}
+
+void html_reset(HtmlDoc *doc) {
+    doc->src_len  = 0;
+    doc->finished = 0;
+    layout_reset(doc);
+}
+
+void html_feed(HtmlDoc *doc, const char *data, uint32_t len) {
+    if (doc->src_len + len > HTML_MAX_SOURCE) len = HTML_MAX_SOURCE - doc->src_len;
+    if (!len) return;
+    if (grow((void **)&doc->src, &doc->src_cap, doc->src_len + len, 1) < 0) return;
+    memcpy(doc->src + doc->src_len, data, len);
+    doc->src_len += len;
+    parse(doc, data, len);
+}
+
+void html_finish(HtmlDoc *doc) {
+    block_break(doc);
+    doc->finished = 1;
+}
+
+void html_set_width(HtmlDoc *doc, uint32_t cols) {
+    if (cols < HTML_MIN_COLS) cols = HTML_MIN_COLS;
+    if (cols == doc->cols) return;
+    doc->cols = cols;
+    layout_reset(doc);
+    parse(doc, doc->src, doc->src_len);
+    if (doc->finished) block_break(doc);
+}
+
+uint32_t html_line_count(const HtmlDoc *doc) {
+    // A trailing line that has nothing on it yet is not worth a row.
+    uint32_t n = doc->line_count;
+    if (n && doc->line_open && doc->lines[n - 1].run_count == 0) n--;
+    return n;
+}
+
+uint32_t html_line_runs(const HtmlDoc *doc, uint32_t line, const HtmlRun **runs) {
+    if (line >= doc->line_count) {
+        *runs = 0;
+        return 0;
+    }
+    const HtmlLine *l = &doc->lines[line];
+    *runs = &doc->runs[l->first_run];
+    return l->run_count;
+}
+
+const char *html_run_text(const HtmlDoc *doc, const HtmlRun *run) {
+    return doc->text + run->text;
+}
+
+const char *html_title(const HtmlDoc *doc) {
+    return doc->title;
+}
+
+uint32_t html_source_len(const HtmlDoc *doc) {
+    return doc->src_len;
+}
@@ -0,0 +1,204 @@
+// kernel/gui/widget.c
+// Widget trees: layout when the window size changes, a grid index over
+// the laid-out rectangles, and hit testing / event bubbling on top of it.
+
+#include "widget.h"
+#include "klib.h"
+#include "mm.h"
+
+#define WG_MIN_ITEMS 64
+
+static WidgetStats g_stats;
+
+static int grow(void **buf, uint32_t *cap, uint32_t need, uint32_t elem,
+                uint32_t min) {
+    if (need <= *cap) return 0;
+    uint32_t n = *cap ? *cap : min;
+    while (n < need) n *= 2;
+    void *p = kmalloc((size_t)n * elem);
+    if (!p) return -1;
+    kfree(*buf);                // rebuilt from scratch, nothing to copy
+    *buf = p;
+    *cap = n;
+    return 0;
+}
+
+int wtree_init(WidgetTree *t, uint32_t capacity, WidgetLayout layout, int owner) {
+    memset(t, 0, sizeof(*t));
+    t->pool = (Widget*)kzalloc((size_t)capacity * sizeof(Widget));
+    if (!t->pool) return -1;
+    t->cap    = capacity;
+    t->layout = layout;
+    t->owner  = owner;
+    t->stale  = 1;
+    t->root   = wtree_add(t, 0, -1, 0, 0);
+    return 0;
+}
+
+Widget *wtree_add(WidgetTree *t, Widget *parent, int id, uint16_t flags, WidgetFn fn) {
+    if (t->count == t->cap) return 0;
+    Widget *w = &t->pool[t->count++];
+    w->parent   = parent ? parent : t->root;
+    w->tree     = t;
+    w->id       = id;
+    w->flags    = flags;
+    w->on_event = fn;
+    if (w->parent) {
+        Widget **link = &w->parent->child;
+        while (*link) link = &(*link)->next;
+        *link = w;
+    }
+    t->stale = 1;
+    return w;
+}
+
+void wtree_invalidate(WidgetTree *t) {
+    t->stale = 1;
+}
+
+void widget_show(Widget *w, int visible) {
+    uint16_t flags = visible ? (uint16_t)(w->flags & ~WG_HIDDEN)
+                             : (uint16_t)(w->flags | WG_HIDDEN);
+    if (flags == w->flags) return;
+    w->flags = flags;
+    w->tree->stale = 1;
+}
+
+int widget_visible(const Widget *w) {
+    for (; w; w = w->parent) {
+        if (w->flags & WG_HIDDEN) return 0;
+    }
+    return 1;
+}
+
+// Pre-order walk, skipping the subtrees of hidden widgets: parents come
+// before their children and earlier siblings before later ones, which is
+// also bottom-to-top stacking order.
+static Widget *walk_next(Widget *w) {
+    if (w->child && !(w->flags & WG_HIDDEN)) return w->child;
+    for (; w; w = w->parent) {
+        if (w->next) return w->next;
+    }
+    return 0;
+}
+
+// The cells r covers, clipped to the tree. Returns 0 if none.
+static int cell_span(const WidgetTree *t, Rect r, uint32_t *c0, uint32_t *r0,
+                     uint32_t *c1, uint32_t *r1) {
+    int32_t x0 = r.x < 0 ? 0 : r.x;
+    int32_t y0 = r.y < 0 ? 0 : r.y;
+    int32_t x1 = r.x + r.w > t->w ? t->w : r.x + r.w;
+    int32_t y1 = r.y + r.h > t->h ? t->h : r.y + r.h;
+    if (x0 >= x1 || y0 >= y1) return 0;
+    *c0 = (uint32_t)x0 / WG_CELL;
+    *r0 = (uint32_t)y0 / WG_CELL;
+    *c1 = (uint32_t)(x1 - 1) / WG_CELL;
+    *r1 = (uint32_t)(y1 - 1) / WG_CELL;
+    return 1;
+}
+
+// Counting sort of the visible widgets into cells, keeping walk order
+// within each cell.
+static void index_build(WidgetTree *t) {
+    t->cols = ((uint32_t)t->w + WG_CELL - 1) / WG_CELL;
+    t->rows = ((uint32_t)t->h + WG_CELL - 1) / WG_CELL;
+    uint32_t cells = t->cols * t->rows;
+
+    if (grow((void**)&t->first, &t->first_cap, cells + 1, sizeof(uint32_t), 64) < 0) {
+        t->cols = t->rows = 0;
+        return;
+    }
+    memset(t->first, 0, (size_t)(cells + 1) * sizeof(uint32_t));
+
+    uint32_t c0, r0, c1, r1;
+    for (Widget *w = t->root; w; w = walk_next(w)) {
+        if ((w->flags & WG_HIDDEN) || !cell_span(t, w->r, &c0, &r0, &c1, &r1)) continue;
+        for (uint32_t row = r0; row <= r1; ++row) {
+            for (uint32_t col = c0; col <= c1; ++col) {
+                t->first[row * t->cols + col + 1]++;
+            }
+        }
+    }
+    for (uint32_t c = 0; c < cells; ++c) t->first[c + 1] += t->first[c];
+
+    if (grow((void**)&t->items, &t->items_cap, t->first[cells], sizeof(Widget*),
+             WG_MIN_ITEMS) < 0) {
+        t->cols = t->rows = 0;
+        return;
+    }
+    // Fill with first[c] as the cursor; afterwards it holds the start of
+    // cell c + 1, so shift it back.
+    for (Widget *w = t->root; w; w = walk_next(w)) {
+        if ((w->flags & WG_HIDDEN) || !cell_span(t, w->r, &c0, &r0, &c1, &r1)) continue;
+        for (uint32_t row = r0; row <= r1; ++row) {
+            for (uint32_t col = c0; col <= c1; ++col) {
+                t->items[t->first[row * t->cols + col]++] = w;
+            }
+        }
+    }
+    for (uint32_t c = cells; c > 0; --c) t->first[c] = t->first[c - 1];
+    t->first[0] = 0;
+}
+
+void wtree_layout(WidgetTree *t, int32_t w, int32_t h) {
+    if (!t->root) return;
+    if (!t->stale && w == t->w && h == t->h) return;
+    t->w = w;
+    t->h = h;
+
+    Rect all = { 0, 0, w, h };
+    t->root->r = all;
+    if (t->layout) t->layout(t, w, h);
+    t->stale = 0;               // the layout may show and hide widgets
+    index_build(t);
+    g_stats.layouts++;
+
+    if (t->hover && !widget_visible(t->hover)) {
+        t->hover->flags &= (uint16_t)~WG_HOVER;
+        t->hover = 0;
+    }
+}
+
+Widget *wtree_hit(WidgetTree *t, int32_t x, int32_t y) {
+    if (x < 0 || y < 0 || x >= t->w || y >= t->h || !t->cols) return 0;
+    g_stats.hit_tests++;
+
+    uint32_t c = ((uint32_t)y / WG_CELL) * t->cols + (uint32_t)x / WG_CELL;
+    for (uint32_t i = t->first[c + 1]; i > t->first[c]; --i) {
+        Widget *w = t->items[i - 1];
+        g_stats.candidates++;
+        if (x >= w->r.x && x < w->r.x + w->r.w &&
+            y >= w->r.y && y < w->r.y + w->r.h) {
+            return w;
+        }
+    }
+    return 0;
+}
+
+int wtree_click(WidgetTree *t, int32_t x, int32_t y) {
+    for (Widget *w = wtree_hit(t, x, y); w; w = w->parent) {
+        if (w->on_event && w->on_event(w, WG_CLICK, x, y)) return 1;
+    }
+    return 0;
+}
+
+void wtree_hover(WidgetTree *t, int32_t x, int32_t y) {
+    Widget *w = x < 0 ? 0 : wtree_hit(t, x, y);
+    while (w && !(w->flags & WG_TRACK)) w = w->parent;
+    if (w == t->hover) return;
+
+    Widget *old = t->hover;
+    t->hover = w;
+    if (old) {
+        old->flags &= (uint16_t)~WG_HOVER;
+        if (old->on_event) old->on_event(old, WG_LEAVE, x, y);
+    }
+    if (w) {
+        w->flags |= WG_HOVER;
+        if (w->on_event) w->on_event(w, WG_ENTER, x, y);
+    }
+}
+
+void widget_stats(WidgetStats *out) {
+    *out = g_stats;
+}
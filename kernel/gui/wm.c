@@ -0,0 +1,579 @@
+// kernel/gui/wm.c
+// Window manager: window surfaces, z-order, move/resize and an
+// occlusion-aware compositor working from a damage list.
+
+#include "wm.h"
+#include "klib.h"
+#include "mm.h"
+
+#define WIN_LIVE      0x80000000u
+#define WM_MAX_DAMAGE 16
+#define WM_KEEP_VISIBLE 40      // pixels of a dragged window kept on screen
+
+static Window   g_windows[WM_MAX_WINDOWS];
+static Window  *g_z[WM_MAX_WINDOWS];    // bottom .. top
+static int      g_zcount = 0;
+
+static uint32_t *g_fb = 0;
+static uint32_t  g_fb_pitch = 0;
+static Surface   g_back;
+static Rect      g_screen;
+
+static Rect g_damage[WM_MAX_DAMAGE];
+static int  g_damage_count = 0;
+
+// Cursor plane. The cursor is never composited into the back buffer: it is
+// drawn onto the framebuffer after each flush, and the pixels it covered
+// are put back from the back buffer, so video memory is only ever written.
+// Moves just record the position; the next compose applies the latest one.
+static struct {
+    const uint32_t *image;      // top byte nonzero = opaque
+    int32_t w, h;
+    int32_t x, y;               // requested position
+    int     visible;
+    Rect    drawn;              // where it is on the framebuffer (w = 0: nowhere)
+} g_cursor;
+
+static struct {
+    Window *win;
+    int     mode;
+    int32_t start_x, start_y;   // pointer at drag start
+    Rect    start;              // window rect at drag start
+} g_drag;
+
+// ---------------------------------------------------------------------
+// Rectangles
+// ---------------------------------------------------------------------
+
+static int rect_empty(Rect r) {
+    return r.w <= 0 || r.h <= 0;
+}
+
+static Rect rect_intersect(Rect a, Rect b) {
+    Rect r;
+    int32_t x1 = a.x + a.w < b.x + b.w ? a.x + a.w : b.x + b.w;
+    int32_t y1 = a.y + a.h < b.y + b.h ? a.y + a.h : b.y + b.h;
+    r.x = a.x > b.x ? a.x : b.x;
+    r.y = a.y > b.y ? a.y : b.y;
+    r.w = x1 - r.x;
+    r.h = y1 - r.y;
+    return r;
+}
+
+static Rect rect_union(Rect a, Rect b) {
+    Rect r;
+    int32_t x1 = a.x + a.w > b.x + b.w ? a.x + a.w : b.x + b.w;
+    int32_t y1 = a.y + a.h > b.y + b.h ? a.y + a.h : b.y + b.h;
+    r.x = a.x < b.x ? a.x : b.x;
+    r.y = a.y < b.y ? a.y : b.y;
+    r.w = x1 - r.x;
+    r.h = y1 - r.y;
+    return r;
+}
+
+static int rect_contains(Rect outer, Rect inner) {
+    return inner.x >= outer.x && inner.y >= outer.y &&
+           inner.x + inner.w <= outer.x + outer.w &&
+           inner.y + inner.h <= outer.y + outer.h;
+}
+
+static uint64_t rect_area(Rect r) {
+    return rect_empty(r) ? 0 : (uint64_t)r.w * (uint64_t)r.h;
+}
+
+// ---------------------------------------------------------------------
+// Surfaces
+// ---------------------------------------------------------------------
+
+int surface_alloc(Surface *s, uint32_t w, uint32_t h) {
+    uint32_t need = w * h;
+    if (need > s->cap) {
+        uint32_t *p = (uint32_t *)kmalloc((size_t)need * 4);
+        if (!p) return -1;
+        kfree(s->pixels);
+        s->pixels = p;
+        s->cap    = need;
+    }
+    s->w     = w;
+    s->h     = h;
+    s->pitch = w;
+    return 0;
+}
+
+void surface_free(Surface *s) {
+    kfree(s->pixels);
+    memset(s, 0, sizeof(*s));
+}
+
+void surface_blit(Surface *dst, int32_t dx, int32_t dy,
+                  const Surface *src, int32_t sx, int32_t sy,
+                  int32_t w, int32_t h) {
+    if (sx < 0) { w += sx; dx -= sx; sx = 0; }
+    if (sy < 0) { h += sy; dy -= sy; sy = 0; }
+    if (dx < 0) { w += dx; sx -= dx; dx = 0; }
+    if (dy < 0) { h += dy; sy -= dy; dy = 0; }
+    if (sx + w > (int32_t)src->w) w = (int32_t)src->w - sx;
+    if (sy + h > (int32_t)src->h) h = (int32_t)src->h - sy;
+    if (dx + w > (int32_t)dst->w) w = (int32_t)dst->w - dx;
+    if (dy + h > (int32_t)dst->h) h = (int32_t)dst->h - dy;
+    if (w <= 0 || h <= 0) return;
+    for (int32_t j = 0; j < h; ++j) {
+        memcpy(dst->pixels + (uint64_t)(dy + j) * dst->pitch + (uint32_t)dx,
+               src->pixels + (uint64_t)(sy + j) * src->pitch + (uint32_t)sx,
+               (size_t)w * 4);
+    }
+}
+
+// Copies the screen rectangle r (inside win) from win's surface into the
+// back buffer.
+static void blit_to_back(const Window *win, Rect r) {
+    surface_blit(&g_back, r.x, r.y, &win->surface,
+                 r.x - win->r.x, r.y - win->r.y, r.w, r.h);
+}
+
+static void flush_to_fb(Rect r) {
+    for (int32_t j = 0; j < r.h; ++j) {
+        const uint32_t *src = g_back.pixels + (uint64_t)(r.y + j) * g_back.pitch + (uint32_t)r.x;
+        uint32_t *dst = g_fb + (uint64_t)(r.y + j) * g_fb_pitch + (uint32_t)r.x;
+        memcpy(dst, src, (size_t)r.w * 4);
+    }
+}
+
+// ---------------------------------------------------------------------
+// Windows and z-order
+// ---------------------------------------------------------------------
+
+int wm_init(uint32_t *fb, uint32_t width, uint32_t height, uint32_t pitch) {
+    // First, so a failure leaves the old geometry and buffer together.
+    if (surface_alloc(&g_back, width, height) < 0) return -1;
+    g_fb       = fb;
+    g_fb_pitch = pitch;
+    g_screen.x = 0;
+    g_screen.y = 0;
+    g_screen.w = (int32_t)width;
+    g_screen.h = (int32_t)height;
+    return 0;
+}
+
+int wm_set_screen(uint32_t *fb, uint32_t width, uint32_t height, uint32_t pitch) {
+    if (wm_init(fb, width, height, pitch) < 0) return -1;
+    g_drag.win = 0;
+    g_cursor.drawn.w = 0;       // the mode switch wiped it
+    g_damage_count = 0;
+    wm_damage(g_screen);
+
+    // Framed windows keep their size if they can, and stay grabbable.
+    for (int i = 0; i < g_zcount; ++i) {
+        Window *win = g_z[i];
+        if (!(win->flags & WIN_FRAMED)) continue;
+        int32_t w = win->r.w < g_screen.w ? win->r.w : g_screen.w;
+        int32_t h = win->r.h < g_screen.h ? win->r.h : g_screen.h;
+        if (w != win->r.w || h != win->r.h) wm_resize(win, w, h);
+        int32_t x = win->r.x, y = win->r.y;
+        if (x > g_screen.w - WM_KEEP_VISIBLE) x = g_screen.w - WM_KEEP_VISIBLE;
+        if (y > g_screen.h - WM_TITLE_H)      y = g_screen.h - WM_TITLE_H;
+        if (x < 0) x = 0;
+        if (y < 0) y = 0;
+        if (x != win->r.x || y != win->r.y) wm_move(win, x, y);
+    }
+    return 0;
+}
+
+static int z_index(const Window *win) {
+    for (int i = 0; i < g_zcount; ++i) {
+        if (g_z[i] == win) return i;
+    }
+    return -1;
+}
+
+static void z_remove(Window *win) {
+    int i = z_index(win);
+    if (i < 0) return;
+    for (; i + 1 < g_zcount; ++i) g_z[i] = g_z[i + 1];
+    g_zcount--;
+}
+
+// Inserts win at the top of its band: desktop < normal windows < popups.
+static void z_insert(Window *win) {
+    int pos = g_zcount;
+    if (win->flags & WIN_DESKTOP) {
+        pos = 0;
+    } else if (!(win->flags & WIN_POPUP)) {
+        while (pos > 0 && (g_z[pos - 1]->flags & WIN_POPUP)) pos--;
+    }
+    for (int i = g_zcount; i > pos; --i) g_z[i] = g_z[i - 1];
+    g_z[pos] = win;
+    g_zcount++;
+}
+
+Window *wm_create(Rect r, uint32_t flags, int id, WinPaint paint) {
+    Window *win = 0;
+    for (int i = 0; i < WM_MAX_WINDOWS; ++i) {
+        if (!(g_windows[i].flags & WIN_LIVE)) {
+            win = &g_windows[i];
+            break;
+        }
+    }
+    if (!win) return 0;
+
+    memset(win, 0, sizeof(*win));
+    if (r.w < 1) r.w = 1;
+    if (r.h < 1) r.h = 1;
+    if (surface_alloc(&win->surface, (uint32_t)r.w, (uint32_t)r.h) < 0) return 0;
+    win->r     = r;
+    win->flags = flags | WIN_LIVE;
+    win->id    = id;
+    win->paint = paint;
+    wm_invalidate(win);
+    z_insert(win);
+    return win;
+}
+
+void wm_destroy(Window *win) {
+    if (!win || !(win->flags & WIN_LIVE)) return;
+    if (win->flags & WIN_VISIBLE) wm_damage(win->r);
+    if (g_drag.win == win) g_drag.win = 0;
+    z_remove(win);
+    surface_free(&win->surface);
+    win->flags = 0;
+}
+
+void wm_raise(Window *win) {
+    if (!win || (win->flags & WIN_DESKTOP)) return;
+    int i = z_index(win);
+    if (i < 0) return;
+    z_remove(win);
+    z_insert(win);
+    if (z_index(win) != i && (win->flags & WIN_VISIBLE)) wm_damage(win->r);
+}
+
+void wm_show(Window *win, int visible) {
+    if (!win) return;
+    int was = (win->flags & WIN_VISIBLE) != 0;
+    if (was == (visible != 0)) return;
+    if (visible) win->flags |= WIN_VISIBLE;
+    else         win->flags &= ~WIN_VISIBLE;
+    wm_damage(win->r);
+}
+
+void wm_move(Window *win, int32_t x, int32_t y) {
+    if (!win || (win->r.x == x && win->r.y == y)) return;
+    if (win->flags & WIN_VISIBLE) wm_damage(win->r);
+    win->r.x = x;
+    win->r.y = y;
+    if (win->flags & WIN_VISIBLE) wm_damage(win->r);
+}
+
+void wm_resize(Window *win, int32_t w, int32_t h) {
+    if (!win || (win->r.w == w && win->r.h == h)) return;
+    if (surface_alloc(&win->surface, (uint32_t)w, (uint32_t)h) < 0) return;
+    if (win->flags & WIN_VISIBLE) wm_damage(win->r);   // old extent
+    win->r.w   = w;
+    win->r.h   = h;
+    wm_invalidate(win);
+}
+
+void wm_invalidate(Window *win) {
+    if (!win) return;
+    win->dirty = 1;
+    win->dirty_rect.x = 0;
+    win->dirty_rect.y = 0;
+    win->dirty_rect.w = win->r.w;
+    win->dirty_rect.h = win->r.h;
+    win->dirty_more_count = 0;
+}
+
+void wm_invalidate_rect(Window *win, Rect r) {
+    if (!win) return;
+    Rect all = { 0, 0, win->r.w, win->r.h };
+    r = rect_intersect(r, all);
+    if (rect_empty(r)) return;
+    if (!win->dirty) {
+        win->dirty_rect = r;
+        win->dirty_more_count = 0;
+        win->dirty = 1;
+        return;
+    }
+    if (!rect_empty(rect_intersect(win->dirty_rect, r))) {
+        win->dirty_rect = rect_union(win->dirty_rect, r);
+        return;
+    }
+    for (int i = 0; i < win->dirty_more_count; ++i) {
+        if (!rect_empty(rect_intersect(win->dirty_more[i], r))) {
+            win->dirty_more[i] = rect_union(win->dirty_more[i], r);
+            return;
+        }
+    }
+    if (win->dirty_more_count < WM_DIRTY_MORE) {
+        win->dirty_more[win->dirty_more_count++] = r;
+    } else {
+        win->dirty_rect = rect_union(win->dirty_rect, r);
+    }
+}
+
+void wm_damage(Rect r) {
+    r = rect_intersect(r, g_screen);
+    if (rect_empty(r)) return;
+
+    for (int i = 0; i < g_damage_count; ++i) {
+        if (rect_contains(g_damage[i], r)) return;
+        if (rect_contains(r, g_damage[i])) {
+            g_damage[i] = g_damage[--g_damage_count];
+            --i;
+        }
+    }
+    if (g_damage_count < WM_MAX_DAMAGE) {
+        g_damage[g_damage_count++] = r;
+        return;
+    }
+    // Full: grow whichever rectangle absorbs r most cheaply.
+    int      best = 0;
+    uint64_t best_cost = ~0ull;
+    for (int i = 0; i < g_damage_count; ++i) {
+        uint64_t cost = rect_area(rect_union(g_damage[i], r)) - rect_area(g_damage[i]);
+        if (cost < best_cost) {
+            best_cost = cost;
+            best      = i;
+        }
+    }
+    g_damage[best] = rect_union(g_damage[best], r);
+}
+
+Window *wm_window_at(int32_t x, int32_t y) {
+    for (int i = g_zcount - 1; i >= 0; --i) {
+        Window *w = g_z[i];
+        if (!(w->flags & WIN_VISIBLE)) continue;
+        if (x >= w->r.x && x < w->r.x + w->r.w &&
+            y >= w->r.y && y < w->r.y + w->r.h) {
+            return w;
+        }
+    }
+    return 0;
+}
+
+Window *wm_top(void) {
+    for (int i = g_zcount - 1; i >= 0; --i) {
+        Window *w = g_z[i];
+        if ((w->flags & WIN_VISIBLE) && !(w->flags & (WIN_POPUP | WIN_DESKTOP))) return w;
+    }
+    return 0;
+}
+
+int wm_hit(const Window *win, int32_t x, int32_t y) {
+    if (!win) return WM_HIT_NONE;
+    int32_t lx = x - win->r.x;
+    int32_t ly = y - win->r.y;
+    if (lx < 0 || ly < 0 || lx >= win->r.w || ly >= win->r.h) return WM_HIT_NONE;
+    if (!(win->flags & WIN_FRAMED)) return WM_HIT_CLIENT;
+
+    int32_t bx = win->r.w - 20;
+    if (lx >= bx && lx < bx + WM_CLOSE_SZ && ly >= 4 && ly < 4 + WM_CLOSE_SZ) {
+        return WM_HIT_CLOSE;
+    }
+    if (ly < WM_TITLE_H) return WM_HIT_TITLE;
+    if (lx >= win->r.w - WM_GRIP_SZ && ly >= win->r.h - WM_GRIP_SZ) return WM_HIT_GRIP;
+    return WM_HIT_CLIENT;
+}
+
+int wm_window_count(void) {
+    return g_zcount;
+}
+
+Window *wm_window(int z) {
+    return (z >= 0 && z < g_zcount) ? g_z[z] : 0;
+}
+
+// ---------------------------------------------------------------------
+// Dragging
+// ---------------------------------------------------------------------
+
+void wm_drag_begin(Window *win, int mode, int32_t x, int32_t y) {
+    g_drag.win     = win;
+    g_drag.mode    = mode;
+    g_drag.start_x = x;
+    g_drag.start_y = y;
+    g_drag.start   = win->r;
+}
+
+void wm_drag_motion(int32_t x, int32_t y) {
+    Window *win = g_drag.win;
+    if (!win) return;
+    int32_t dx = x - g_drag.start_x;
+    int32_t dy = y - g_drag.start_y;
+
+    if (g_drag.mode == WM_HIT_TITLE) {
+        // Keep enough of the title bar on screen to grab it again.
+        int32_t nx = g_drag.start.x + dx;
+        int32_t ny = g_drag.start.y + dy;
+        if (nx > g_screen.w - WM_KEEP_VISIBLE) nx = g_screen.w - WM_KEEP_VISIBLE;
+        if (nx < WM_KEEP_VISIBLE - win->r.w)   nx = WM_KEEP_VISIBLE - win->r.w;
+        if (ny > g_screen.h - WM_TITLE_H)      ny = g_screen.h - WM_TITLE_H;
+        if (ny < 0) ny = 0;
+        wm_move(win, nx, ny);
+    } else if (g_drag.mode == WM_HIT_GRIP) {
+        int32_t nw = g_drag.start.w + dx;
+        int32_t nh = g_drag.start.h + dy;
+        if (nw < WM_MIN_W) nw = WM_MIN_W;
+        if (nh < WM_MIN_H) nh = WM_MIN_H;
+        if (nw > g_screen.w) nw = g_screen.w;
+        if (nh > g_screen.h) nh = g_screen.h;
+        wm_resize(win, nw, nh);
+    }
+}
+
+void wm_drag_end(void) {
+    g_drag.win = 0;
+}
+
+int wm_dragging(void) {
+    return g_drag.win != 0;
+}
+
+// ---------------------------------------------------------------------
+// Compositing
+// ---------------------------------------------------------------------
+
+// Fills r from the topmost visible window at or below z-index top that
+// covers each part of it. The covered part is copied; the (up to four)
+// uncovered strips around it recurse into the windows further down, so
+// every pixel is written once.
+static void compose_rect(Rect r, int top) {
+    for (int i = top; i >= 0; --i) {
+        Window *w = g_z[i];
+        if (!(w->flags & WIN_VISIBLE)) continue;
+        Rect in = rect_intersect(r, w->r);
+        if (rect_empty(in)) continue;
+
+        blit_to_back(w, in);
+        Rect strip;
+        if (in.y > r.y) {                                   // above
+            strip.x = r.x; strip.y = r.y; strip.w = r.w; strip.h = in.y - r.y;
+            compose_rect(strip, i - 1);
+        }
+        if (in.y + in.h < r.y + r.h) {                      // below
+            strip.x = r.x; strip.y = in.y + in.h;
+            strip.w = r.w; strip.h = r.y + r.h - strip.y;
+            compose_rect(strip, i - 1);
+        }
+        if (in.x > r.x) {                                   // left
+            strip.x = r.x; strip.y = in.y; strip.w = in.x - r.x; strip.h = in.h;
+            compose_rect(strip, i - 1);
+        }
+        if (in.x + in.w < r.x + r.w) {                      // right
+            strip.x = in.x + in.w; strip.y = in.y;
+            strip.w = r.x + r.w - strip.x; strip.h = in.h;
+            compose_rect(strip, i - 1);
+        }
+        return;
+    }
+    // Nothing there (no desktop yet): leave the back buffer as it is.
+}
+
+// ---------------------------------------------------------------------
+// Cursor plane
+// ---------------------------------------------------------------------
+
+void wm_cursor_set(const uint32_t *image, int32_t w, int32_t h) {
+    g_cursor.image = image;
+    g_cursor.w     = w;
+    g_cursor.h     = h;
+    wm_damage(g_cursor.drawn);  // restore what the old image covered
+    g_cursor.drawn.w = 0;
+}
+
+void wm_cursor_move(int32_t x, int32_t y) {
+    g_cursor.x = x;
+    g_cursor.y = y;
+}
+
+void wm_cursor_show(int visible) {
+    g_cursor.visible = visible;
+}
+
+// Where the cursor should be now (clipped), or an empty rect.
+static Rect cursor_target(void) {
+    Rect r = { g_cursor.x, g_cursor.y, g_cursor.w, g_cursor.h };
+    if (!g_cursor.visible || !g_cursor.image) r.w = 0;
+    return rect_intersect(r, g_screen);
+}
+
+static int cursor_stale(void) {
+    Rect want = cursor_target();
+    Rect have = g_cursor.drawn;
+    if (rect_empty(want) && rect_empty(have)) return 0;
+    return want.x != have.x || want.y != have.y ||
+           want.w != have.w || want.h != have.h;
+}
+
+// Writes the opaque cursor pixels inside r. Returns pixels written.
+static uint32_t cursor_draw(Rect r) {
+    uint32_t n = 0;
+    for (int32_t y = r.y; y < r.y + r.h; ++y) {
+        const uint32_t *src = g_cursor.image + (y - g_cursor.y) * g_cursor.w;
+        uint32_t *dst = g_fb + (uint64_t)y * g_fb_pitch;
+        for (int32_t x = r.x; x < r.x + r.w; ++x) {
+            uint32_t c = src[x - g_cursor.x];
+            if (c >> 24) {
+                dst[x] = c & 0x00FFFFFFu;
+                n++;
+            }
+        }
+    }
+    return n;
+}
+
+int wm_pending(void) {
+    if (g_damage_count || cursor_stale()) return 1;
+    for (int i = 0; i < g_zcount; ++i) {
+        if (g_z[i]->dirty && (g_z[i]->flags & WIN_VISIBLE)) return 1;
+    }
+    return 0;
+}
+
+uint32_t wm_compose(void) {
+    for (int i = 0; i < g_zcount; ++i) {
+        Window *w = g_z[i];
+        if (!w->dirty || !(w->flags & WIN_VISIBLE)) continue;
+        for (int k = -1; k < w->dirty_more_count; ++k) {
+            if (k >= 0) w->dirty_rect = w->dirty_more[k];
+            if (w->paint) w->paint(w);
+            Rect d = w->dirty_rect;
+            d.x += w->r.x;
+            d.y += w->r.y;
+            wm_damage(d);
+        }
+        w->dirty = 0;
+        w->dirty_more_count = 0;
+    }
+    if (!g_back.pixels) {
+        g_damage_count = 0;
+        return 0;
+    }
+
+    uint32_t pixels = 0;
+    Rect cursor = cursor_target();
+    int  redraw = cursor_stale();
+    for (int i = 0; i < g_damage_count; ++i) {
+        compose_rect(g_damage[i], g_zcount - 1);
+        flush_to_fb(g_damage[i]);
+        pixels += (uint32_t)rect_area(g_damage[i]);
+        if (!rect_empty(rect_intersect(g_damage[i], cursor))) redraw = 1;
+    }
+    g_damage_count = 0;
+
+    // Lift the cursor off where it was (from the back buffer, which is now
+    // current) and put it down where it should be.
+    if (redraw) {
+        if (!rect_empty(g_cursor.drawn)) {
+            flush_to_fb(g_cursor.drawn);
+            pixels += (uint32_t)rect_area(g_cursor.drawn);
+        }
+        if (!rect_empty(cursor)) pixels += cursor_draw(cursor);
+        g_cursor.drawn = cursor;
+    }
+    return pixels;
+}
+
+const Surface *wm_backbuffer(void) {
+    return &g_back;
+}
@@ -0,0 +1,35 @@
+#ifndef LIGHTOS_ACPI_H
+#define LIGHTOS_ACPI_H
+
+#include <stdint.h>
+
+// ACPI table lookup. The loader hands over the RSDP from the UEFI
+// configuration table; tables are read in place (firmware memory stays
+// identity-mapped and the page allocator never reuses it).
+
+typedef struct __attribute__((packed)) {
+    char     signature[4];
+    uint32_t length;            // including this header
+    uint8_t  revision;
+    uint8_t  checksum;
+    char     oem_id[6];
+    char     oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} AcpiHeader;
+
+// MADT ("APIC") entry types
+#define MADT_LAPIC    0
+#define MADT_X2APIC   9
+
+#define MADT_ENABLED        0x1
+#define MADT_ONLINE_CAPABLE 0x2
+
+// Returns 1 if rsdp points at a valid RSDP.
+int acpi_init(uint64_t rsdp);
+
+// First table with the given signature whose checksum is good, or 0.
+const AcpiHeader *acpi_find_table(const char *signature);
+
+#endif
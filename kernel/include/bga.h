@@ -0,0 +1,31 @@
+#ifndef LIGHTOS_BGA_H
+#define LIGHTOS_BGA_H
+
+#include <stdint.h>
+
+// Bochs Graphics Adapter (QEMU -vga std / bochs-display, VirtualBox VGA).
+//
+// GOP can only change modes before ExitBootServices(); after that, the only
+// way to switch resolution is to talk to the display hardware. The BGA's
+// VBE "DISPI" registers (ports 0x1CE/0x1CF) take a new width, height and
+// depth at any time and keep the linear framebuffer at the same address.
+
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+} DisplayMode;
+
+#define BGA_MAX_MODES 16
+
+// Returns 1 if a BGA is present and its framebuffer is the one at fb_base.
+int bga_probe(uint64_t fb_base);
+int bga_present(void);
+
+// Common 32-bpp modes that fit the adapter's limits and video memory.
+int bga_modes(DisplayMode *out, int max);
+
+// Programs a 32-bpp mode. The framebuffer is cleared. Returns 0 and the new
+// pitch (pixels per row), or -1 if the adapter refused the mode.
+int bga_set_mode(uint32_t width, uint32_t height, uint32_t *pitch);
+
+#endif
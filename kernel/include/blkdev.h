@@ -0,0 +1,46 @@
+#ifndef LIGHTOS_BLKDEV_H
+#define LIGHTOS_BLKDEV_H
+
+#include <stdint.h>
+#include "pagecache.h"
+
+// Block device interface between disk drivers and the page cache.
+//
+// Drivers move whole pages: rw() transfers bytes to or from pages (each
+// PAGE_SIZE long but the last) starting at a 512-byte sector, and returns
+// once the device has finished, yielding while it waits. Nothing else
+// calls rw(): a device's contents are read and written through its PcFile,
+// so a second read comes from memory and writes reach the disk from the
+// flusher, merged into requests of up to max_pages pages.
+
+#define BLKDEV_MAX 4
+#define BLK_SECTOR 512
+
+typedef struct {
+    uint64_t reads;                     // requests
+    uint64_t writes;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    uint64_t errors;
+} BlockDevStats;
+
+typedef struct BlockDevice {
+    char     name[8];
+    uint64_t sectors;
+    int      read_only;
+    uint32_t max_pages;                 // in one rw()
+
+    int    (*rw)(struct BlockDevice *dev, int write, uint64_t sector,
+                 void *const *pages, uint32_t bytes);
+
+    void         *priv;
+    PcFile        cache;                // the whole device, byte for byte
+    BlockDevStats stats;
+} BlockDevice;
+
+// Names it vda, vdb, ... and sets up its cache.
+int          blkdev_register(BlockDevice *dev);
+int          blkdev_count(void);
+BlockDevice *blkdev_get(int index);
+
+#endif
@@ -3,6 +3,26 @@
 
 #include <stdint.h>
 
+// Physical address the loader copies kernel.bin to, and how much memory from
+// there it reserves for the image plus .bss. The kernel never hands out pages
+// below the end of this window.
+#define KERNEL_LOAD_ADDR     0x00100000ULL
+#define KERNEL_RESERVE_BYTES 0x00400000ULL
+
+// UEFI memory descriptor as returned by GetMemoryMap(). The firmware may use a
+// larger stride than sizeof(BootMemoryDescriptor); always step through the
+// map with BootInfo.memory_descriptor_size.
+typedef struct {
+    uint32_t type;
+    uint32_t pad;
+    uint64_t phys_start;
+    uint64_t virt_start;
+    uint64_t num_pages;   // 4 KiB pages
+    uint64_t attribute;
+} BootMemoryDescriptor;
+
+#define BOOT_MEM_CONVENTIONAL 7 // EfiConventionalMemory
+
 // This structure is passed from the UEFI loader to the kernel.
 // We extended it with RTC date/time so the kernel can show a real clock.
 typedef struct {
@@ -17,6 +37,24 @@ typedef struct {
     uint8_t  hour;
     uint8_t  minute;
     uint8_t  second;
+
+    // Final UEFI memory map, captured right before ExitBootServices(). The
+    // kernel builds its page allocator from the conventional-memory entries.
+    uint64_t memory_map;             // physical address of the descriptors
+    uint64_t memory_map_size;        // total bytes
+    uint64_t memory_descriptor_size; // stride between descriptors
+
+    // Optional UI font (\font.ttf or \font.psf on the boot volume), loaded
+    // into EfiLoaderData pages that the kernel never reuses. 0 if absent.
+    uint64_t font_base;
+    uint64_t font_size;
+
+    // ACPI RSDP from the UEFI configuration table (2.0 preferred), 0 if the
+    // firmware has none.
+    uint64_t acpi_rsdp;
+    // One page below 1 MiB for the application processors' startup code
+    // (a SIPI can only point there), or 0 if none was free.
+    uint64_t ap_trampoline;
 } BootInfo;
 
 #endif
@@ -0,0 +1,101 @@
+#ifndef LIGHTOS_CPU_H
+#define LIGHTOS_CPU_H
+
+#include <stdint.h>
+
+// Boot CPU protection setup for user mode: our own GDT (with user segments
+// and a TSS), an IDT, the SYSCALL/SYSRET MSRs and a one-shot local APIC
+// timer for time slices.
+//
+// The kernel itself still runs with interrupts off and polls. Interrupts
+// are only ever enabled in ring 3, so the only ones taken are exceptions
+// and the slice timer of a user process, always on the process's kernel
+// stack (TSS.RSP0). Exceptions in the kernel stop the machine.
+//
+// SYSCALL doesn't switch stacks; the entry stub moves to the same kernel
+// stack before it calls the handler. Numbers and arguments follow the
+// Linux convention: rax, then rdi, rsi, rdx, r10, r8, r9; the result comes
+// back in rax and only rcx and r11 are clobbered.
+
+// SYSRET takes the user SS from STAR's base + 8 and CS from base + 16, so
+// user data must come before user code.
+#define GDT_KERNEL_CS 0x08
+#define GDT_KERNEL_DS 0x10
+#define GDT_USER_DS   (0x18 | 3)
+#define GDT_USER_CS   (0x20 | 3)
+#define GDT_TSS       0x28
+
+#define TRAP_PAGE_FAULT 14
+#define TRAP_TIMER      0x40
+#define TRAP_SPURIOUS   0xFF
+
+// Saved by the trap stubs; ascending addresses.
+typedef struct {
+    uint64_t r15, r14, r13, r12, r11, r10, r9, r8;
+    uint64_t rbp, rdi, rsi, rdx, rcx, rbx, rax;
+    uint64_t vector, error;
+    uint64_t rip, cs, rflags, rsp, ss;          // pushed by the CPU
+} TrapFrame;
+
+// Saved by the SYSCALL stub, all of the user's registers but rcx and r11.
+// rax holds the number on entry and the result on the way out.
+typedef struct {
+    uint64_t r15, r14, r13, r12, rbp, rbx;
+    uint64_t r9, r8, r10, rdx, rsi, rdi, rax;
+    uint64_t rflags, rip, rsp;                  // from r11, rcx, the user stack
+} SyscallFrame;
+
+typedef void (*TrapHandler)(TrapFrame *f);
+typedef void (*SyscallHandler)(SyscallFrame *f);
+
+// Needs timer_init() first (the APIC timer is calibrated against the TSC).
+void cpu_init(void);
+
+// Traps from ring 3 go to h; the kernel's own are fatal.
+void cpu_set_trap_handler(TrapHandler h);
+void cpu_set_syscall_handler(SyscallHandler h);
+
+// Where traps and system calls from ring 3 start their kernel stack.
+void cpu_set_kernel_stack(uint64_t top);
+
+// One-shot TRAP_TIMER after us microseconds; 0 if there is no usable APIC.
+int  cpu_timer_start(uint32_t us);
+void cpu_timer_eoi(void);
+
+// Drops to ring 3 at rip with stack rsp and interrupts on. Returns the
+// value later passed to user_leave() with the rsp user_enter() stored in
+// *save, from any kernel stack.
+uint64_t user_enter(uint64_t *save, uint64_t rip, uint64_t rsp);
+__attribute__((noreturn)) void user_leave(uint64_t save, uint64_t value);
+// Like user_enter(), but returns to ring 3 as from a system call with the
+// registers in f (for a forked process).
+uint64_t user_return(uint64_t *save, const SyscallFrame *f);
+
+// x87/SSE state (FXSAVE format: 512 bytes, 16-byte aligned).
+#define FPU_STATE_SIZE 512
+void fpu_save(void *area);
+void fpu_restore(const void *area);
+// Freshly initialized state, for new processes and for the kernel.
+const void *fpu_initial(void);
+
+static inline void cpuid(uint32_t leaf, uint32_t sub, uint32_t r[4]) {
+    __asm__ volatile("cpuid"
+                     : "=a"(r[0]), "=b"(r[1]), "=c"(r[2]), "=d"(r[3])
+                     : "a"(leaf), "c"(sub));
+}
+
+static inline uint64_t read_cr3(void) {
+    uint64_t v;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr3(uint64_t v) {
+    __asm__ volatile("mov %0, %%cr3" : : "r"(v) : "memory");
+}
+
+static inline void invlpg(uint64_t va) {
+    __asm__ volatile("invlpg (%0)" : : "r"(va) : "memory");
+}
+
+#endif
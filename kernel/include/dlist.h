@@ -0,0 +1,84 @@
+#ifndef LIGHTOS_DLIST_H
+#define LIGHTOS_DLIST_H
+
+#include <stdint.h>
+#include "wm.h"
+#include "font.h"
+
+// Display lists.
+//
+// UI code does not write pixels as it goes: fills, borders, text and blits
+// are appended to a display list, and the list is rasterized in one pass
+// when it is executed. While recording, commands outside the list's clip
+// (normally the window's dirty area) are dropped, same-coloured fills that
+// continue the previous one are merged into it, and anything a later opaque
+// fill or blit covers completely is discarded, so a pixel is written about
+// once however the UI code layers its drawing.
+//
+// Apart from source surfaces and fonts a list holds no pointers into UI
+// state (text is copied), so executing it does not depend on the code that
+// recorded it.
+
+#define DL_FILL   1
+#define DL_BORDER 2
+#define DL_TEXT   3
+#define DL_BLIT   4
+
+typedef struct {
+    uint8_t  op;            // DL_*, 0 once dropped
+    uint8_t  cell;          // text: character cell width in pixels
+    uint16_t len;           // text: characters
+    Rect     r;             // geometry; text: origin of the first cell
+    Rect     bounds;        // pixels it may touch, clipped
+    uint32_t color;
+    union {
+        struct { Font *font; uint32_t size; uint32_t offset; } text;
+        struct { const Surface *src; int32_t sx, sy; } blit;
+    } u;
+} DrawCmd;
+
+typedef struct {
+    DrawCmd  *cmds;
+    uint32_t  count, cap;
+    char     *text;         // characters of all DL_TEXT commands
+    uint32_t  text_len, text_cap;
+    Surface  *target;
+    Rect      clip;         // target coordinates
+} DrawList;
+
+typedef struct {
+    uint64_t lists;         // executed
+    uint64_t commands;      // recorded
+    uint64_t culled;        // outside the clip
+    uint64_t merged;        // folded into the previous fill
+    uint64_t occluded;      // covered by a later opaque command
+    uint64_t tiled;         // executed as tiles across CPUs
+    uint64_t tiles;
+} DrawListStats;
+
+// Starts recording for target, clipped to its bounds. Any commands still
+// in the list are discarded.
+void dl_begin(DrawList *dl, Surface *target);
+// Narrows the clip (target coordinates).
+void dl_clip(DrawList *dl, Rect clip);
+
+void dl_fill(DrawList *dl, int32_t x, int32_t y, int32_t w, int32_t h,
+             uint32_t color);
+void dl_border(DrawList *dl, int32_t x, int32_t y, int32_t w, int32_t h,
+               uint32_t color);
+// len characters of s in cells of `cell` pixels, baseline at 7/8 of a cell.
+void dl_text(DrawList *dl, int32_t x, int32_t y, const char *s, uint32_t len,
+             Font *font, uint32_t size, uint32_t cell, uint32_t color);
+// src must stay valid until the list is executed.
+void dl_blit(DrawList *dl, int32_t dx, int32_t dy, const Surface *src,
+             int32_t sx, int32_t sy, int32_t w, int32_t h);
+
+// Rasterizes the list into its target and empties it. Lists covering a
+// large area are split into tiles and rendered on all CPUs.
+void dl_execute(DrawList *dl);
+// Caps the CPUs dl_execute() uses (0: all online).
+void dl_set_cpus(int cpus);
+
+void dl_stats(DrawListStats *out);
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef LIGHTOS_EDITOR_H
+#define LIGHTOS_EDITOR_H
+
+#include <stdint.h>
+#include "textbuf.h"
+#include "keyboard.h"
+
+// Full-screen text editor behind `edit` (nano, micro, notepad).
+//
+// The text lives in a piece table (textbuf.h) whose original buffer is the
+// file's contents, so opening a file of any size costs nothing up front;
+// only what is typed is stored again. Positions are byte offsets; lines
+// end at '\n' and the cursor's line number is kept up to date as it moves
+// instead of being counted from the start of the file.
+//
+// The editor only keeps state. Its owner feeds it keys, asks which screen
+// rows changed since the last look (editor_take_dirty), and paints just
+// those rows from editor_row(), plus the status and message lines.
+//
+// Keys: arrows, Home/End, PgUp/PgDn, Ctrl+Home/End, Backspace, Delete,
+// Enter, Tab (four spaces); Ctrl+S save, Ctrl+Q or Esc quit (twice if
+// there are unsaved changes); Ctrl+F find, F3 or Ctrl+G find next;
+// Ctrl+Z undo, Ctrl+Y redo.
+
+#define EDITOR_MAX_ROWS 192
+#define EDITOR_NAME_LEN 32
+
+// Rows after the text: status bar, then the message line.
+#define EDITOR_ROW_STATUS  EDITOR_MAX_ROWS
+#define EDITOR_ROW_MESSAGE (EDITOR_MAX_ROWS + 1)
+
+enum {
+    EDITOR_NONE,
+    EDITOR_SAVE,        // write editor_length() bytes from editor_copy()
+    EDITOR_QUIT,
+};
+
+typedef struct {
+    TextBuf  tb;
+    char     name[EDITOR_NAME_LEN];
+    uint32_t cursor;                    // byte offset
+    uint32_t line;                      // cursor's line, from 0
+    uint32_t goal;                      // column Up and Down aim for
+    uint32_t top;                       // offset of the first line shown
+    uint32_t top_line;
+    uint32_t left;                      // first column shown
+    uint32_t rows, cols;                // text area, in characters
+    uint32_t row_start[EDITOR_MAX_ROWS + 1];
+    int      rows_valid;                // row_start[] matches top
+    uint8_t  dirty[EDITOR_MAX_ROWS + 2];
+    int      modified;
+    int      quit_armed;                // quit pressed once with changes
+    int      finding;                   // typing a Ctrl+F query
+    char     query[48];
+    char     message[80];
+} Editor;
+
+// text must stay valid and unchanged until editor_close(), saves included:
+// saving stores a new copy. Returns -1 if out of memory.
+int      editor_open(Editor *ed, const char *name, const char *text, uint32_t len);
+void     editor_close(Editor *ed);
+
+// Text area size in characters; everything is repainted.
+void     editor_resize(Editor *ed, uint32_t rows, uint32_t cols);
+
+// Returns EDITOR_NONE, EDITOR_SAVE or EDITOR_QUIT.
+int      editor_key(Editor *ed, const KeyEvent *ev);
+
+// Saving: copy the text out, store it, then say whether that worked.
+uint32_t editor_length(Editor *ed);
+void     editor_copy(Editor *ed, char *dst);
+void     editor_saved(Editor *ed, int ok);
+
+// Painting. row is a text row, EDITOR_ROW_STATUS or EDITOR_ROW_MESSAGE.
+int      editor_take_dirty(Editor *ed, uint32_t row);
+void     editor_row(Editor *ed, uint32_t row, char *buf, uint32_t max);
+// Where the cursor is on screen, in text rows and columns.
+void     editor_cursor(Editor *ed, uint32_t *row, uint32_t *col);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef LIGHTOS_ELF_H
+#define LIGHTOS_ELF_H
+
+#include <stdint.h>
+#include "vm.h"
+
+// Loader for user programs: statically linked ELF64 x86-64 executables
+// (ET_EXEC) whose PT_LOAD segments all lie between USER_BASE and USER_TOP.
+// Position-independent and dynamically linked files are refused.
+//
+// Each segment's pages are mapped with the access its flags ask for
+// (read is implied); the file bytes are copied in and the rest of the
+// memory size, the .bss, stays zero.
+
+// Returns 0 with the entry point and the first page past the highest
+// segment, or -1 with *why saying what was wrong. What was mapped before a
+// failure stays in as.
+int elf_load(AddressSpace *as, const uint8_t *image, uint32_t size,
+             uint64_t *entry, uint64_t *end, const char **why);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef LIGHTOS_FONT_H
+#define LIGHTOS_FONT_H
+
+#include <stdint.h>
+#include "wm.h"
+
+// Font engine.
+//
+// Fonts come from the built-in 8x8 bitmap table, a PSF1/PSF2 console font
+// or a TrueType file. Each glyph is rasterized once per (font, pixel size)
+// into an anti-aliased 8-bit coverage bitmap, trimmed to its ink and kept
+// in a glyph cache; drawing text after that is only a blend of cached
+// bitmaps into the destination surface.
+//
+// Sizes are in pixels: the em height for TrueType, the scaled cell height
+// for bitmap fonts (so the built-in font at size 8*n is exactly the 8x8
+// table magnified n times).
+
+typedef struct Font Font;
+
+typedef struct {
+    uint16_t w, h;          // coverage bitmap (0 x 0 for blank glyphs)
+    int16_t  left;          // pen position to first column
+    int16_t  top;           // baseline to first row, positive upwards
+    uint16_t advance;       // pen advance in pixels
+    const uint8_t *coverage; // w * h alpha values, 0..255
+} Glyph;
+
+typedef struct {
+    uint32_t glyphs;
+    uint32_t bytes;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t flushes;       // cache emptied because it hit its budget
+} FontCacheStats;
+
+#define FONT_CACHE_BYTES (512u * 1024)
+
+Font       *font_builtin(void);
+
+// Recognises PSF1, PSF2 and TrueType by their headers. data is not copied
+// and must stay valid for as long as the font is used. Returns 0 if the
+// format is unknown or the file is malformed.
+Font       *font_load(const char *name, const uint8_t *data, uint32_t len);
+
+const char *font_name(const Font *f);
+const char *font_kind(const Font *f);   // "bitmap", "PSF" or "TrueType"
+
+// Pixel size at which the font's capital letters are cap_px tall.
+uint32_t    font_size_for_cap(const Font *f, uint32_t cap_px);
+
+// Cached glyph for a Unicode code point; characters the font lacks come
+// back as '?'. The pointer stays valid until the cache is flushed, i.e. it
+// should not be held across draw calls.
+const Glyph *font_glyph(Font *f, uint32_t size, uint32_t cp);
+
+// Blends g in colour `color` with its pen at (x, y) on the baseline.
+void        font_blit(Surface *dst, int32_t x, int32_t y,
+                      const Glyph *g, uint32_t color);
+
+void        font_cache_stats(FontCacheStats *out);
+void        font_cache_clear(void);
+
+// Between hold and release the cache is never flushed (it may overshoot
+// its budget instead), so glyph pointers stay valid, e.g. while other CPUs
+// draw with them.
+void        font_cache_hold(void);
+void        font_cache_release(void);
+
+#endif
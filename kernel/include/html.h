@@ -0,0 +1,56 @@
+#ifndef LIGHTOS_HTML_H
+#define LIGHTOS_HTML_H
+
+#include <stdint.h>
+
+// Streaming HTML renderer for the Browser.
+//
+// Bytes are fed in as they arrive from the network and go through a
+// tokenizer that keeps its state between calls, so a tag or entity may be
+// split across any number of chunks. Tokens drive a simple block/inline
+// layout (fixed-width cells, word wrap, lists, <pre>) that appends to a line
+// cache. Drawing a frame only touches the lines on screen: scrolling is an
+// index into that cache, never a re-parse.
+
+// Run styles; the Browser maps them to colours.
+#define HTML_STYLE_TEXT    0
+#define HTML_STYLE_HEADING 1
+#define HTML_STYLE_LINK    2
+#define HTML_STYLE_BOLD    3
+#define HTML_STYLE_PRE     4
+#define HTML_STYLE_RULE    5
+
+// A stretch of same-styled text on one line, starting at cell `col`.
+typedef struct {
+    uint32_t text;      // offset into the document's text arena
+    uint16_t len;
+    uint16_t col;
+    uint8_t  style;
+    uint8_t  pad[3];
+} HtmlRun;
+
+typedef struct HtmlDoc HtmlDoc;
+
+HtmlDoc *html_create(uint32_t cols);
+void     html_destroy(HtmlDoc *doc);
+
+// Start a new, empty document (keeps the allocated buffers).
+void html_reset(HtmlDoc *doc);
+
+// Append source bytes; layout advances as far as the input allows.
+void html_feed(HtmlDoc *doc, const char *data, uint32_t len);
+
+// End of input: flush the word/line still being built.
+void html_finish(HtmlDoc *doc);
+
+// Re-wrap for a new width. Cheap when the width is unchanged; otherwise
+// replays the saved source through the tokenizer once.
+void html_set_width(HtmlDoc *doc, uint32_t cols);
+
+uint32_t       html_line_count(const HtmlDoc *doc);
+uint32_t       html_line_runs(const HtmlDoc *doc, uint32_t line, const HtmlRun **runs);
+const char    *html_run_text(const HtmlDoc *doc, const HtmlRun *run);
+const char    *html_title(const HtmlDoc *doc);
+uint32_t       html_source_len(const HtmlDoc *doc);
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef LIGHTOS_HTTP_H
+#define LIGHTOS_HTTP_H
+
+#include <stdint.h>
+
+// HTTP/1.1 client over the in-kernel socket API. Only http:// URLs are
+// supported; there is no TLS.
+//
+// Connections are kept alive and reused per server, and 200 responses are
+// kept in an in-memory cache that honours Cache-Control/Expires and
+// revalidates stale copies with If-None-Match / If-Modified-Since.
+
+// Receives the response body as it arrives (already de-chunked). Return
+// nonzero to stop the transfer early.
+typedef int (*HttpSink)(void *ctx, const uint8_t *data, uint32_t len);
+
+// Splits "http://host[:port][/path]". host gets the bare host name, path
+// points into url (or at "/" when the URL has none).
+int http_parse_url(const char *url, char *host, uint32_t host_max,
+                   uint16_t *port, const char **path);
+
+// Fetches url, streaming the body into sink. Fresh cached responses are
+// replayed without touching the network. Returns the HTTP status code, or a
+// negative NET_* error if no response could be read.
+int net_http_fetch(const char *url, HttpSink sink, void *ctx);
+
+// Convenience wrapper: copies the body into buf (truncated, always
+// NUL-terminated) and returns the status like net_http_fetch().
+int net_http_get(const char *url, char *buf, uint32_t max_len);
+
+// ---------------------------------------------------------------------
+// Response cache (kernel/net/http_cache.c), used by the client above
+// ---------------------------------------------------------------------
+
+#define HTTP_URL_MAX        128
+#define HTTP_VALIDATOR_MAX  64
+#define HTTP_CACHE_MAX_ENTRY (1u * 1024 * 1024)   // larger bodies aren't kept
+
+typedef struct {
+    char     url[HTTP_URL_MAX];         // empty: slot unused
+    uint8_t *body;
+    uint32_t len;
+    int      status;
+    int      must_revalidate;           // never serve stale on errors
+    char     etag[HTTP_VALIDATOR_MAX];
+    char     last_modified[HTTP_VALIDATOR_MAX];
+    uint64_t expires;                   // time_ms() at which it goes stale
+    uint64_t last_used;                 // LRU stamp
+} HttpCacheEntry;
+
+typedef struct {
+    uint32_t entries;
+    uint32_t bytes;
+    uint32_t hits;          // served without a request
+    uint32_t revalidated;   // 304 Not Modified
+    uint32_t misses;
+} HttpCacheStats;
+
+// Returns the entry for url (fresh or stale) or 0. The pointer stays valid
+// until the next store/drop.
+HttpCacheEntry *http_cache_lookup(const char *url);
+
+// Takes ownership of body (kmalloc'd). Older entries are evicted, least
+// recently used first, to stay within the byte budget. Returns 0 (and frees
+// body) if the response is too large to cache.
+HttpCacheEntry *http_cache_store(const char *url, int status,
+                                 uint8_t *body, uint32_t len);
+void            http_cache_drop(const char *url);
+void            http_cache_clear(void);
+void            http_cache_stats(HttpCacheStats *out);
+
+// Bumps one of the hit/revalidated/miss counters.
+#define HTTP_CACHE_HIT         0
+#define HTTP_CACHE_REVALIDATED 1
+#define HTTP_CACHE_MISS        2
+void            http_cache_count(int what);
+
+#endif
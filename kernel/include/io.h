@@ -0,0 +1,116 @@
+#ifndef LIGHTOS_IO_H
+#define LIGHTOS_IO_H
+
+#include <stdint.h>
+
+// Port I/O, MMIO accessors, compiler/CPU barriers and spin locks for x86_64.
+
+static inline uint8_t inb(uint16_t port) {
+    uint8_t v;
+    __asm__ volatile("inb %1, %0" : "=a"(v) : "Nd"(port));
+    return v;
+}
+
+static inline void outb(uint16_t port, uint8_t val) {
+    __asm__ volatile("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline uint16_t inw(uint16_t port) {
+    uint16_t v;
+    __asm__ volatile("inw %1, %0" : "=a"(v) : "Nd"(port));
+    return v;
+}
+
+static inline void outw(uint16_t port, uint16_t val) {
+    __asm__ volatile("outw %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline uint32_t inl(uint16_t port) {
+    uint32_t v;
+    __asm__ volatile("inl %1, %0" : "=a"(v) : "Nd"(port));
+    return v;
+}
+
+static inline void outl(uint16_t port, uint32_t val) {
+    __asm__ volatile("outl %0, %1" : : "a"(val), "Nd"(port));
+}
+
+// MMIO. Device registers are identity mapped, so a physical address can be
+// dereferenced directly; the volatile accesses keep the compiler from merging
+// or reordering them.
+static inline uint8_t mmio_read8(uint64_t addr) {
+    return *(volatile uint8_t *)(uintptr_t)addr;
+}
+
+static inline uint16_t mmio_read16(uint64_t addr) {
+    return *(volatile uint16_t *)(uintptr_t)addr;
+}
+
+static inline uint32_t mmio_read32(uint64_t addr) {
+    return *(volatile uint32_t *)(uintptr_t)addr;
+}
+
+static inline uint64_t mmio_read64(uint64_t addr) {
+    return *(volatile uint64_t *)(uintptr_t)addr;
+}
+
+static inline void mmio_write8(uint64_t addr, uint8_t v) {
+    *(volatile uint8_t *)(uintptr_t)addr = v;
+}
+
+static inline void mmio_write16(uint64_t addr, uint16_t v) {
+    *(volatile uint16_t *)(uintptr_t)addr = v;
+}
+
+static inline void mmio_write32(uint64_t addr, uint32_t v) {
+    *(volatile uint32_t *)(uintptr_t)addr = v;
+}
+
+static inline void mmio_write64(uint64_t addr, uint64_t v) {
+    *(volatile uint64_t *)(uintptr_t)addr = v;
+}
+
+// x86 is strongly ordered for normal write-back memory, so ordering shared
+// ring updates against a device only needs the compiler not to reorder; the
+// full fence is for the (rare) case where a store must be globally visible
+// before a following load, e.g. before re-checking a device-owned index.
+static inline void barrier(void) {
+    __asm__ volatile("" : : : "memory");
+}
+
+static inline void mb(void) {
+    __asm__ volatile("mfence" : : : "memory");
+}
+
+static inline void cpu_relax(void) {
+    __asm__ volatile("pause" : : : "memory");
+}
+
+// For what application processors share with the boot CPU while smp_run()
+// jobs run. Kernel code runs with interrupts off, so nothing else on the
+// same CPU can want the lock while it is held.
+typedef struct {
+    volatile uint32_t locked;
+} SpinLock;
+
+static inline void spin_lock(SpinLock *l) {
+    while (__atomic_exchange_n(&l->locked, 1, __ATOMIC_ACQUIRE)) {
+        while (l->locked) cpu_relax();
+    }
+}
+
+static inline void spin_unlock(SpinLock *l) {
+    __atomic_store_n(&l->locked, 0, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t v) {
+    __asm__ volatile("wrmsr" : : "c"(msr), "a"((uint32_t)v), "d"((uint32_t)(v >> 32)));
+}
+
+#endif
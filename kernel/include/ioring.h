@@ -0,0 +1,65 @@
+#ifndef LIGHTOS_IORING_H
+#define LIGHTOS_IORING_H
+
+#include <stdint.h>
+#include "syscall.h"
+
+// I/O rings: batches of requests carried out in the background, with the
+// layout of syscall.h (IoRingShared, IoSqe, IoCqe) in memory both the
+// kernel and the ring's user can see.
+//
+// The ring itself only moves entries. Whoever owns it says how to carry
+// out one (IoRingOps): processes give their descriptors and memory, kernel
+// code whatever it likes. NOP and TIMEOUT need nobody.
+//
+// ioring_submit() copies queued entries out of the submission queue, so
+// their slots can be reused at once, and hands them to the ring's worker
+// threads (up to IORING_WORKERS, started as there is work and gone when
+// there isn't). A request that has to wait for the disk keeps its worker,
+// which yields meanwhile, so as many requests reach the disk at once as
+// there are workers. A request that would wait for anything else (a
+// connection, data on a socket, the clock) says so instead (IORING_AGAIN)
+// and is tried again each time round, so any number of them can be
+// waiting without holding a thread.
+
+#define IORING_WORKERS 8
+#define IORING_AGAIN   (-0x7FFFFFFFll)
+
+typedef struct IoRing IoRing;
+
+typedef struct {
+    // Carries out sqe without waiting for anything but the disk: the
+    // result for its completion, or IORING_AGAIN to be called again later.
+    int64_t (*run)(void *ctx, const IoSqe *sqe);
+    void     *ctx;
+} IoRingOps;
+
+typedef struct {
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t retries;                   // IORING_AGAIN answers
+    uint64_t workers_started;
+} IoRingStats;
+
+// entries is rounded up to a power of two, at most IORING_MAX_ENTRIES.
+// ops must stay valid until ioring_destroy(). 0 if out of memory.
+IoRing       *ioring_create(uint32_t entries, const IoRingOps *ops);
+// Waits for the requests being carried out, cancels the rest and frees
+// the ring. Its pages live on while anyone else holds them.
+void          ioring_destroy(IoRing *r);
+
+IoRingShared *ioring_shared(IoRing *r);
+uint32_t      ioring_page_count(const IoRing *r);
+// The ring's memory, page by page, for mapping it: adds a reference.
+void         *ioring_page(IoRing *r, uint32_t index);
+
+// Takes up to count entries from the submission queue; returns how many.
+uint32_t      ioring_submit(IoRing *r, uint32_t count);
+// Completions posted and not yet consumed, and requests not finished.
+uint32_t      ioring_ready(const IoRing *r);
+uint32_t      ioring_in_flight(const IoRing *r);
+
+// All rings together.
+void          ioring_stats(IoRingStats *out);
+
+#endif
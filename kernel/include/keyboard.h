@@ -0,0 +1,126 @@
+#ifndef LIGHTOS_KEYBOARD_H
+#define LIGHTOS_KEYBOARD_H
+
+#include <stdint.h>
+
+// Keyboard input.
+//
+// Keys are identified by their USB HID usage (keyboard page 0x07), whatever
+// device they came from: the PS/2 driver translates scancode set 1 through
+// lookup tables, a USB boot keyboard reports usages directly. kbd_key()
+// tracks modifier and lock state, maps the key to a character through the
+// keymap and queues a KeyEvent; the UI drains the queue with kbd_read() and
+// hands each event to whatever has focus.
+//
+// Typematic repeat is done here, in software, from kbd_tick(): devices only
+// report press and release, so every keyboard repeats at the same rate.
+
+// Usages (HID keyboard page)
+#define KEY_A           0x04        // ... KEY_A + 25 = Z
+#define KEY_1           0x1E        // ... KEY_1 + 8 = 9
+#define KEY_0           0x27
+#define KEY_ENTER       0x28
+#define KEY_ESC         0x29
+#define KEY_BACKSPACE   0x2A
+#define KEY_TAB         0x2B
+#define KEY_SPACE       0x2C
+#define KEY_MINUS       0x2D
+#define KEY_EQUAL       0x2E
+#define KEY_LBRACKET    0x2F
+#define KEY_RBRACKET    0x30
+#define KEY_BACKSLASH   0x31
+#define KEY_SEMICOLON   0x33
+#define KEY_APOSTROPHE  0x34
+#define KEY_GRAVE       0x35
+#define KEY_COMMA       0x36
+#define KEY_DOT         0x37
+#define KEY_SLASH       0x38
+#define KEY_CAPSLOCK    0x39
+#define KEY_F1          0x3A        // ... KEY_F1 + 11 = F12
+#define KEY_PRINTSCREEN 0x46
+#define KEY_SCROLLLOCK  0x47
+#define KEY_PAUSE       0x48
+#define KEY_INSERT      0x49
+#define KEY_HOME        0x4A
+#define KEY_PAGEUP      0x4B
+#define KEY_DELETE      0x4C
+#define KEY_END         0x4D
+#define KEY_PAGEDOWN    0x4E
+#define KEY_RIGHT       0x4F
+#define KEY_LEFT        0x50
+#define KEY_DOWN        0x51
+#define KEY_UP          0x52
+#define KEY_NUMLOCK     0x53
+#define KEY_KP_SLASH    0x54
+#define KEY_KP_STAR     0x55
+#define KEY_KP_MINUS    0x56
+#define KEY_KP_PLUS     0x57
+#define KEY_KP_ENTER    0x58
+#define KEY_KP_1        0x59        // ... KEY_KP_1 + 8 = keypad 9
+#define KEY_KP_0        0x62
+#define KEY_KP_DOT      0x63
+#define KEY_102ND       0x64        // extra key left of Z on ISO boards
+#define KEY_MENU        0x65
+#define KEY_LCTRL       0xE0        // modifiers: bit (usage - KEY_LCTRL)
+#define KEY_LSHIFT      0xE1
+#define KEY_LALT        0xE2
+#define KEY_LGUI        0xE3
+#define KEY_RCTRL       0xE4
+#define KEY_RSHIFT      0xE5
+#define KEY_RALT        0xE6
+#define KEY_RGUI        0xE7
+
+#define KEY_LETTER(c)   (KEY_A + ((c) - 'a'))
+#define KEY_FN(n)       (KEY_F1 + (n) - 1)
+
+// Modifier bits, in HID boot report order
+#define KMOD_LCTRL      0x01
+#define KMOD_LSHIFT     0x02
+#define KMOD_LALT       0x04
+#define KMOD_LGUI       0x08
+#define KMOD_RCTRL      0x10
+#define KMOD_RSHIFT     0x20
+#define KMOD_RALT       0x40
+#define KMOD_RGUI       0x80
+#define KMOD_CTRL       (KMOD_LCTRL  | KMOD_RCTRL)
+#define KMOD_SHIFT      (KMOD_LSHIFT | KMOD_RSHIFT)
+#define KMOD_ALT        (KMOD_LALT   | KMOD_RALT)
+
+// Lock state
+#define KLOCK_NUM       0x01
+#define KLOCK_CAPS      0x02
+#define KLOCK_SCROLL    0x04
+
+// KeyEvent.flags
+#define KEY_PRESSED     0x01        // else released
+#define KEY_REPEAT      0x02        // generated by typematic repeat
+
+#define KBD_REPEAT_DELAY_MS  500
+#define KBD_REPEAT_RATE_MS   33     // ~30 characters per second
+#define KBD_QUEUE_LEN        64
+
+typedef struct {
+    uint8_t code;                   // KEY_*
+    uint8_t flags;                  // KEY_PRESSED, KEY_REPEAT
+    uint8_t mods;                   // KMOD_* at the time of the event
+    char    ch;                     // printable character, or 0
+} KeyEvent;
+
+// A key went down or up on some keyboard.
+void kbd_key(uint8_t code, int pressed);
+
+// One byte from the PS/2 keyboard port (scancode set 1).
+void kbd_ps2_byte(uint8_t data);
+
+// Emits repeats for the held key; call from the main loop.
+void kbd_tick(void);
+
+// Pops the oldest event. Returns 0 if the queue is empty.
+int  kbd_read(KeyEvent *ev);
+
+uint8_t kbd_mods(void);
+uint8_t kbd_locks(void);
+// Events lost because the queue was full.
+uint64_t kbd_dropped(void);
+
+#endif
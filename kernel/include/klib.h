@@ -0,0 +1,30 @@
+#ifndef LIGHTOS_KLIB_H
+#define LIGHTOS_KLIB_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Small freestanding helpers shared by every kernel module. There is no libc,
+// so anything more than a couple of lines that more than one file needs
+// lives here.
+
+// Memory helpers. memcpy/memset/memmove/memcmp are also exported under their
+// standard names because GCC emits calls to them for struct copies and large
+// zero-initialisers even in -ffreestanding mode.
+void *memcpy(void *dst, const void *src, size_t n);
+void *memmove(void *dst, const void *src, size_t n);
+void *memset(void *dst, int c, size_t n);
+int   memcmp(const void *a, const void *b, size_t n);
+
+// String helpers (always NUL-terminate, never write past max_len).
+uint32_t str_len(const char *s);
+void     str_copy(char *dst, const char *src, uint32_t max_len);
+void     str_cat(char *dst, const char *src, uint32_t max_len);
+int      str_eq(const char *a, const char *b);
+
+// Append a number to an existing string. Used for status lines in the shell
+// and the Settings app where we have no printf.
+void str_cat_u64(char *dst, uint64_t v, uint32_t max_len);
+void str_cat_hex(char *dst, uint64_t v, uint32_t digits, uint32_t max_len);
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef LIGHTOS_MM_H
+#define LIGHTOS_MM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "boot.h"
+
+// Physical memory management.
+//
+// All RAM is identity mapped (UEFI left it that way and we keep it), so a
+// physical address handed out by the page allocator can be used directly as a
+// pointer and given to a DMA-capable device as-is.
+
+#define PAGE_SIZE  4096u
+#define PAGE_SHIFT 12
+#define MAX_ORDER  14   // largest buddy block is 2^13 pages (32 MiB)
+
+// Per-page metadata, one entry per physical page frame.
+#define PG_RESERVED 0x0001  // not managed (firmware, MMIO, kernel image)
+#define PG_FREE     0x0002  // head of a free buddy block
+#define PG_SLAB     0x0004  // part of a slab; see owner/head
+#define PG_LARGE    0x0008  // head of a multi-page kmalloc() block
+
+typedef struct PageFrame {
+    struct PageFrame *next;     // free list / slab list linkage
+    struct PageFrame *prev;
+    struct PageFrame *head;     // slab: first page of the slab this page is in
+    void     *owner;            // slab: KmemCache that owns this page
+    void     *freelist;         // slab head: first free object
+    uint32_t  inuse;            // slab head: allocated objects
+    int32_t   refcount;
+    uint16_t  flags;            // PG_*
+    uint8_t   order;            // block order for free/large/slab heads
+    uint8_t   cpu;              // slab head: the CPU that made it
+    uint8_t   pad[4];
+} PageFrame;
+
+// Page allocator (buddy system). One lock, for smp_run() jobs.
+void       mm_init(const BootInfo *bi);
+void      *page_alloc(uint32_t order);
+void       page_free(void *addr, uint32_t order);
+// Shared single pages (user memory, file pages): page_get() adds a
+// reference, page_put() drops one and frees the page with the last.
+void       page_get(void *addr);
+void       page_put(void *addr);
+// Makes each page of a page_alloc(order) block a page of its own with one
+// reference, so page_put() can free them one by one.
+void       page_split(void *addr, uint32_t order);
+PageFrame *virt_to_page(const void *addr);
+void      *page_to_virt(const PageFrame *pf);
+uint32_t   page_order_for(uint64_t bytes);
+uint64_t   mm_total_pages(void);
+uint64_t   mm_free_pages(void);
+
+// Slab caches for fixed-size objects.
+//
+// In front of each cache's slabs every CPU keeps two magazines, small
+// stacks of free objects: kmem_cache_alloc() pops from the loaded one and
+// kmem_cache_free() pushes onto it, swapping in the previous one when it
+// runs dry or full. Neither takes a lock or touches another CPU's data.
+// Only with both empty (or both full) does a CPU go to the cache's depot,
+// under a lock, to trade a magazine for a full (or empty) one, so objects
+// freed on one CPU come back out on whichever needs them. The depot keeps
+// KMEM_DEPOT_MAX full magazines; more go back into the slabs, and with
+// nothing in the depot either the slabs serve one object at a time.
+#define KMEM_MAG_ROUNDS 14      // objects per magazine (128 bytes)
+#define KMEM_DEPOT_MAX  8
+
+typedef struct KmemCache KmemCache;
+
+typedef struct {
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t slab_ops;          // served by the slabs, past the magazines
+    uint64_t depot_trades;
+    uint64_t remote_frees;      // into a slab another CPU made
+    uint64_t slabs;
+} KmemStats;
+
+KmemCache *kmem_cache_create(const char *name, uint32_t size, uint32_t align);
+void      *kmem_cache_alloc(KmemCache *c);
+void       kmem_cache_free(KmemCache *c, void *obj);
+// Every cache together.
+void       kmem_stats(KmemStats *out);
+
+// General purpose allocator on top of the slab caches. Requests larger than
+// the biggest size class go straight to the page allocator.
+void *kmalloc(size_t size);
+void *kzalloc(size_t size);
+void  kfree(void *p);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef LIGHTOS_MOUSE_H
+#define LIGHTOS_MOUSE_H
+
+#include <stdint.h>
+
+// Pointer input.
+//
+// Mouse drivers (PS/2, USB HID) report each packet with mouse_report();
+// tablets (virtio-input) report where the pointer is with
+// mouse_report_abs(). The UI drains the queue with mouse_read().
+// Consecutive motion with the same buttons is folded into the newest queued
+// event, so a 1 kHz device costs the UI one event per poll rather than one
+// per packet.
+
+#define MOUSE_LEFT      0x01
+#define MOUSE_RIGHT     0x02
+#define MOUSE_MIDDLE    0x04
+
+#define MOUSE_QUEUE_LEN 64
+#define MOUSE_ABS_MAX   0x7FFF      // absolute positions: 0..MOUSE_ABS_MAX
+
+typedef struct {
+    int32_t dx, dy;                 // screen convention: +y is down
+    int32_t wheel;                  // +1 per notch away from the user
+    uint8_t buttons;                // MOUSE_* held after this event
+    uint8_t absolute;               // dx/dy are a position, scaled to the screen
+} MouseEvent;
+
+void mouse_report(int32_t dx, int32_t dy, int32_t wheel, uint8_t buttons);
+void mouse_report_abs(int32_t x, int32_t y, int32_t wheel, uint8_t buttons);
+
+// Pops the oldest event. Returns 0 if the queue is empty.
+int  mouse_read(MouseEvent *ev);
+
+// Packets folded into an earlier event.
+uint64_t mouse_coalesced(void);
+
+#endif
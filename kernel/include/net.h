@@ -0,0 +1,136 @@
+#ifndef LIGHTOS_NET_H
+#define LIGHTOS_NET_H
+
+#include <stdint.h>
+#include "netdev.h"
+#include "netbuf.h"
+
+// Minimal IPv4 stack: Ethernet, ARP, IPv4, ICMP echo, UDP, TCP, plus DHCP and
+// DNS clients. Everything runs from net_tick(), which the main loop calls on
+// every pass, and from blocking socket calls that pump net_tick() themselves
+// while they wait.
+
+// Error codes returned (negated) by the stack and socket API.
+#define NET_OK           0
+#define NET_ERR         -1
+#define NET_ETIMEDOUT   -2
+#define NET_ERESET      -3
+#define NET_EREFUSED    -4
+#define NET_ENOTCONN    -5
+#define NET_EAGAIN      -6
+#define NET_ENOMEM      -7
+#define NET_EUNREACH    -8
+#define NET_EADDRINUSE  -9
+#define NET_ENOTSUP     -10
+
+#define ETH_HDR_LEN   14
+#define ETH_TYPE_IPV4 0x0800
+#define ETH_TYPE_ARP  0x0806
+
+#define IP_PROTO_ICMP 1
+#define IP_PROTO_TCP  6
+#define IP_PROTO_UDP  17
+
+#define IP_HDR_LEN    20
+#define IP_BROADCAST  0xFFFFFFFFu
+
+// Addresses are kept in host byte order everywhere above the wire format.
+#define IP4(a, b, c, d) (((uint32_t)(a) << 24) | ((uint32_t)(b) << 16) | \
+                         ((uint32_t)(c) << 8)  |  (uint32_t)(d))
+
+static inline uint16_t htons(uint16_t v) { return __builtin_bswap16(v); }
+static inline uint16_t ntohs(uint16_t v) { return __builtin_bswap16(v); }
+static inline uint32_t htonl(uint32_t v) { return __builtin_bswap32(v); }
+static inline uint32_t ntohl(uint32_t v) { return __builtin_bswap32(v); }
+
+static inline uint16_t get_be16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+static inline uint32_t get_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8)  |  (uint32_t)p[3];
+}
+static inline void put_be16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+static inline void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+// ---------------------------------------------------------------------
+// Interfaces
+// ---------------------------------------------------------------------
+
+typedef struct {
+    NetDevice *dev;
+    uint32_t   ip;
+    uint32_t   netmask;
+    uint32_t   gateway;
+    uint32_t   dns;
+    int        configured;  // address assigned (DHCP bound)
+} NetIf;
+
+void   net_init(void);
+void   net_tick(void);
+NetIf *net_default_if(void);
+NetIf *net_if_for(NetDevice *dev);
+void   net_format_ip(char *buf, uint32_t max_len, uint32_t ip);
+int    net_parse_ip(const char *s, uint32_t *out);
+
+// Wait (pumping the stack) until an interface has an address.
+int net_wait_configured(uint32_t timeout_ms);
+
+// Internet checksum helpers.
+uint32_t net_csum_add(uint32_t sum, const void *data, uint32_t len);
+uint16_t net_csum_fold(uint32_t sum);
+uint32_t net_pseudo_sum(uint32_t src, uint32_t dst, uint8_t proto, uint16_t len);
+
+// ---------------------------------------------------------------------
+// Layer entry points (internal to kernel/net)
+// ---------------------------------------------------------------------
+
+// Ethernet/ARP. arp_output() prepends the Ethernet header once the next hop
+// is resolved, queueing the buffer while a request is outstanding.
+void arp_input(NetIf *nif, NetBuf *nb);
+int  arp_output(NetIf *nif, NetBuf *nb, uint32_t next_hop);
+void arp_tick(uint64_t now);
+int  arp_cache_count(void);
+
+// IPv4. The IpInfo of the packet being delivered is passed up alongside the
+// buffer (whose data now points at the transport header).
+typedef struct {
+    uint32_t src;
+    uint32_t dst;
+    uint8_t  proto;
+    uint8_t  ttl;
+} IpInfo;
+
+void ip_input(NetIf *nif, NetBuf *nb);
+int  ip_output(NetBuf *nb, uint32_t src, uint32_t dst, uint8_t proto);
+uint32_t ip_source_for(uint32_t dst);
+
+void icmp_input(NetIf *nif, NetBuf *nb, const IpInfo *ip);
+int  icmp_ping(uint32_t dst, uint16_t seq, uint32_t timeout_ms, uint32_t *rtt_us);
+
+void udp_input(NetIf *nif, NetBuf *nb, const IpInfo *ip);
+int  udp_output(NetBuf *nb, uint32_t src, uint16_t sport, uint32_t dst, uint16_t dport);
+
+// Hands a datagram (data at the UDP payload) to the socket bound to dport.
+// Returns 0 if a socket took ownership of the buffer.
+int  sock_udp_deliver(uint16_t dport, NetBuf *nb, uint32_t src, uint16_t sport);
+
+void tcp_input(NetIf *nif, NetBuf *nb, const IpInfo *ip);
+void tcp_tick(uint64_t now);
+
+void dhcp_start(NetIf *nif);
+void dhcp_input(NetIf *nif, NetBuf *nb, const IpInfo *ip);
+void dhcp_tick(uint64_t now);
+const char *dhcp_state_name(void);
+
+int dns_resolve(const char *name, uint32_t *out_ip, uint32_t timeout_ms);
+
+#endif
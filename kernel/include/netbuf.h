@@ -0,0 +1,54 @@
+#ifndef LIGHTOS_NETBUF_H
+#define LIGHTOS_NETBUF_H
+
+#include <stdint.h>
+
+// Packet buffers.
+//
+// A NetBuf is a single 2 KiB slab object: this header followed by storage for
+// one Ethernet frame. Drivers post the storage directly to the NIC and hand
+// the same buffer up the stack on receive; protocol layers strip headers with
+// netbuf_pull() and prepend them with netbuf_push(), so a packet is never
+// copied between the wire and its consumer.
+
+#define NETBUF_SIZE     2048u
+#define NETBUF_HEADROOM 128u    // room to prepend link + IP + TCP headers
+
+struct NetDevice;
+
+typedef struct NetBuf {
+    struct NetBuf    *next;     // queue linkage, owned by whoever holds it
+    struct NetDevice *dev;      // device it arrived on / leaves through
+    uint8_t          *data;     // first valid byte
+    uint32_t          len;      // valid bytes starting at data
+    uint32_t          flags;
+    uint32_t          cb[6];    // scratch for the layer holding the buffer
+    uint8_t           storage[];
+} NetBuf;
+
+#define NETBUF_CAPACITY (NETBUF_SIZE - (uint32_t)sizeof(NetBuf))
+
+NetBuf  *netbuf_alloc(void);
+void     netbuf_free(NetBuf *nb);
+
+uint8_t *netbuf_push(NetBuf *nb, uint32_t n);   // prepend n bytes
+uint8_t *netbuf_pull(NetBuf *nb, uint32_t n);   // strip n leading bytes
+uint8_t *netbuf_put(NetBuf *nb, uint32_t n);    // append n bytes
+void     netbuf_reset(NetBuf *nb, uint32_t headroom);
+uint32_t netbuf_headroom(const NetBuf *nb);
+uint32_t netbuf_tailroom(const NetBuf *nb);
+
+uint32_t netbuf_in_use(void);
+
+// Simple FIFO of buffers.
+typedef struct {
+    NetBuf  *head;
+    NetBuf  *tail;
+    uint32_t count;
+} NetBufQueue;
+
+void    netbuf_queue_push(NetBufQueue *q, NetBuf *nb);
+NetBuf *netbuf_queue_pop(NetBufQueue *q);
+void    netbuf_queue_purge(NetBufQueue *q);
+
+#endif
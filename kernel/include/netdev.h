@@ -0,0 +1,56 @@
+#ifndef LIGHTOS_NETDEV_H
+#define LIGHTOS_NETDEV_H
+
+#include <stdint.h>
+#include "netbuf.h"
+
+// Network device interface between NIC drivers and the protocol stack.
+//
+// Transmit is split in two so callers can batch: xmit() queues a frame on the
+// device's TX ring without notifying the hardware, and flush() issues a
+// single doorbell for everything queued since the last flush. Receive is
+// polled: poll() hands up to `budget` received frames to the rx callback, one
+// NetBuf per frame, ownership included.
+
+#define NETDEV_MAX 4
+
+typedef struct {
+    uint64_t rx_packets;
+    uint64_t rx_bytes;
+    uint64_t rx_dropped;
+    uint64_t tx_packets;
+    uint64_t tx_bytes;
+    uint64_t tx_dropped;
+    uint64_t tx_kicks;
+    uint64_t rx_polls;      // poll() calls that found work
+} NetDevStats;
+
+typedef struct NetDevice {
+    char        name[8];
+    uint8_t     mac[6];
+    uint16_t    mtu;
+    int         link_up;
+
+    int  (*xmit)(struct NetDevice *dev, NetBuf *nb);
+    void (*flush)(struct NetDevice *dev);
+    int  (*poll)(struct NetDevice *dev, int budget);
+
+    // Set by the protocol stack. Takes ownership of nb.
+    void (*rx)(struct NetDevice *dev, NetBuf *nb);
+
+    void       *priv;
+    NetDevStats stats;
+} NetDevice;
+
+int        netdev_register(NetDevice *dev);
+int        netdev_count(void);
+NetDevice *netdev_get(int index);
+
+// Deliver a received frame to the stack (drivers call this from poll()).
+void netdev_receive(NetDevice *dev, NetBuf *nb);
+
+// Poll every device once, then flush whatever the stack queued in response.
+// Returns the number of frames received.
+int netdev_poll_all(int budget);
+
+#endif
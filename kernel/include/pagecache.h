@@ -0,0 +1,106 @@
+#ifndef LIGHTOS_PAGECACHE_H
+#define LIGHTOS_PAGECACHE_H
+
+#include <stdint.h>
+
+// The page cache: whole pages of files and block devices kept in memory,
+// found by (file, page index) through a radix tree per file.
+//
+// Whoever owns a file (the VFS, a block device) describes it with a PcFile
+// and says how to fill pages from where it really lives and how to write
+// them back. Reads go through the cache: a miss fills the page from the
+// backing store, and a run of misses at consecutive indexes grows a
+// readahead window so later pages come in the same request. mmap() maps
+// cache pages themselves (pc_page()), so everyone sees one copy.
+//
+// Writes only dirty the cached page. A flusher thread writes dirty pages
+// back once they have waited PC_DIRTY_MS, or sooner when more than
+// PC_DIRTY_MAX are waiting, merging runs of consecutive pages into one
+// request each. pc_sync() does the same at once.
+//
+// The cache keeps at most a quarter of RAM. Past that, and whenever the
+// page allocator comes up empty, a clock sweep over all cached pages
+// evicts clean ones nobody else holds, giving recently used pages a second
+// chance.
+
+#define PC_RADIX_BITS  6
+#define PC_DIRTY_MS    1000
+#define PC_DIRTY_MAX   1024             // pages
+#define PC_RUN_MAX     32               // pages in one backing-store request
+#define PC_RA_MIN      4                // readahead window, pages
+#define PC_RA_MAX      32
+
+// Both move count pages at index, index + 1, ... and return 0 or -1. A
+// page reaching past the end of the file only carries what is left;
+// read() zeroes the rest.
+typedef struct {
+    int (*read)(void *ctx, uint64_t index, void *const *pages, uint32_t count);
+    int (*write)(void *ctx, uint64_t index, void *const *pages, uint32_t count);
+} PcOps;
+
+typedef struct PcNode PcNode;
+typedef struct PcFile PcFile;
+
+struct PcFile {
+    const PcOps *ops;
+    void        *ctx;
+    uint64_t     size;                  // bytes; the owner keeps it current
+    PcNode      *root;
+    uint32_t     height;                // radix levels under root
+    uint32_t     pages;
+    uint32_t     dirty;
+    uint64_t     dirtied_ms;            // when the oldest dirty page was
+    uint64_t     ra_last;               // last page index read, + 1
+    uint64_t     ra_next;               // first page readahead hasn't asked for
+    uint32_t     ra_window;
+    PcFile      *dirty_next;            // on the flusher's list while dirty
+    uint32_t     sync_pass;             // the last pc_sync(0) that tried it
+};
+
+typedef struct {
+    uint64_t pages;                     // cached now
+    uint64_t dirty;
+    uint64_t limit;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t readahead;                 // pages read before anyone asked
+    uint64_t read_requests;
+    uint64_t write_requests;
+    uint64_t pages_written;
+    uint64_t evicted;
+} PcStats;
+
+void  pc_init(void);
+
+// ops and ctx must stay valid until pc_file_release().
+void  pc_file_init(PcFile *f, const PcOps *ops, void *ctx, uint64_t size);
+// Writes dirty pages back and lets every page go.
+void  pc_file_release(PcFile *f);
+
+// Bytes read, 0 at the end of the file, -1 on an I/O error or out of
+// memory with nothing read.
+int   pc_read(PcFile *f, uint64_t pos, void *buf, uint32_t len);
+// Bytes stored (fewer at the end of the file, which doesn't grow), or -1.
+int   pc_write(PcFile *f, uint64_t pos, const void *data, uint32_t len);
+
+// The page with bytes index * PAGE_SIZE.. with a reference for the caller,
+// or 0 past the end. Suits VmPager.page().
+void *pc_page(PcFile *f, uint64_t index);
+
+// Drops every clean page; for an owner whose data changed behind the
+// cache's back. Mapped pages stay with their mappings.
+void  pc_invalidate(PcFile *f);
+
+// Writes back every dirty page of f (0: of every file). 0, or -1 if the
+// backing store failed; the pages stay dirty then.
+int   pc_sync(PcFile *f);
+
+// Evicts up to count clean pages; returns how many went.
+uint32_t pc_shrink(uint32_t count);
+
+// For the main loop: lets the flusher run while it has work.
+void  pc_poll(void);
+
+void  pc_stats(PcStats *out);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef LIGHTOS_PCI_H
+#define LIGHTOS_PCI_H
+
+#include <stdint.h>
+
+// PCI bus enumeration through configuration mechanism #1 (ports 0xCF8/0xCFC).
+// The firmware has already assigned BARs, so drivers only read them.
+
+#define PCI_MAX_DEVICES 64
+
+#define PCI_CFG_VENDOR_ID   0x00
+#define PCI_CFG_DEVICE_ID   0x02
+#define PCI_CFG_COMMAND     0x04
+#define PCI_CFG_STATUS      0x06
+#define PCI_CFG_REVISION    0x08
+#define PCI_CFG_HEADER_TYPE 0x0E
+#define PCI_CFG_BAR0        0x10
+#define PCI_CFG_SUBSYS_ID   0x2E
+#define PCI_CFG_CAP_PTR     0x34
+#define PCI_CFG_IRQ_LINE    0x3C
+
+#define PCI_CMD_IO          0x0001
+#define PCI_CMD_MEMORY      0x0002
+#define PCI_CMD_BUS_MASTER  0x0004
+#define PCI_CMD_INTX_OFF    0x0400
+
+#define PCI_STATUS_CAP_LIST 0x0010
+
+#define PCI_CAP_ID_MSI      0x05
+#define PCI_CAP_ID_VENDOR   0x09
+#define PCI_CAP_ID_MSIX     0x11
+
+typedef struct {
+    uint8_t  bus;
+    uint8_t  dev;
+    uint8_t  func;
+    uint8_t  class_code;
+    uint8_t  subclass;
+    uint8_t  prog_if;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t  irq_line;
+    uint8_t  claimed;   // set by the driver that bound the device
+} PciDevice;
+
+void       pci_init(void);
+int        pci_device_count(void);
+PciDevice *pci_get(int index);
+PciDevice *pci_find(uint16_t vendor, uint16_t device, int start);
+PciDevice *pci_find_class(uint8_t class_code, uint8_t subclass, uint8_t prog_if, int start);
+
+uint32_t pci_read32(const PciDevice *d, uint8_t off);
+uint16_t pci_read16(const PciDevice *d, uint8_t off);
+uint8_t  pci_read8(const PciDevice *d, uint8_t off);
+void     pci_write32(const PciDevice *d, uint8_t off, uint32_t v);
+void     pci_write16(const PciDevice *d, uint8_t off, uint16_t v);
+void     pci_write8(const PciDevice *d, uint8_t off, uint8_t v);
+
+// Physical base of a BAR (memory or I/O). 64-bit memory BARs are combined
+// with the following BAR. Returns 0 for an unimplemented BAR.
+uint64_t pci_bar_base(const PciDevice *d, int bar, int *is_io);
+
+// Enable memory/I/O decoding and bus mastering, and mask legacy INTx.
+void pci_enable(const PciDevice *d);
+
+// Walk the capability list. Pass 0 to start, or a previous result to
+// continue after it. Returns the config offset of the capability, or 0.
+uint8_t pci_find_cap(const PciDevice *d, uint8_t cap_id, uint8_t after);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef LIGHTOS_PIPE_H
+#define LIGHTOS_PIPE_H
+
+#include <stdint.h>
+
+// Pipes: bounded byte rings between kernel threads.
+//
+// A writer that finds the ring full and a reader that finds it empty yield
+// (thread.h) until the other side catches up, so a producer can never get
+// more than PIPE_SIZE bytes ahead of its consumer however much it writes.
+// Closing the write end turns an empty pipe into end-of-file for the
+// reader; closing the read end makes further writes fail.
+
+#define PIPE_SIZE 4096                  // power of two
+
+typedef struct {
+    char     *buf;
+    uint32_t  head, tail;               // free-running: read at head, write at tail
+    uint8_t   read_closed;
+    uint8_t   write_closed;
+} Pipe;
+
+Pipe *pipe_create(void);
+void  pipe_free(Pipe *p);
+
+// Writes all len bytes, yielding while the pipe is full. Returns len, or -1
+// if the read end is (or gets) closed.
+int   pipe_write(Pipe *p, const void *data, uint32_t len);
+
+// Reads up to len bytes. With wait set, yields until there is at least one;
+// without, returns 0 when there is none yet. Returns -1 at end-of-file.
+int   pipe_read(Pipe *p, void *data, uint32_t len, int wait);
+
+void  pipe_close_read(Pipe *p);
+void  pipe_close_write(Pipe *p);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef LIGHTOS_PROC_H
+#define LIGHTOS_PROC_H
+
+#include <stdint.h>
+
+// User processes: ELF programs from the file system running in ring 3,
+// each in its own address space (vm.h), talking to the kernel through the
+// system calls in syscall.h.
+//
+// A process runs on a kernel thread. `run <file>` runs one on the shell
+// command's own thread, so it takes part in pipelines like any command:
+// its descriptors 0, 1 and 2 are that command's input and output. spawn()
+// and fork() give the child a thread of its own and the parent's streams;
+// a parent that exits without wait() still waits for its children first.
+//
+// Memory comes on demand (vm.h): the stack, .bss and anonymous mmap()s are
+// reserved and filled in page by page as they are touched, files mapped
+// with mmap() share the file system's own pages, and fork() copies the
+// address space copy-on-write.
+//
+// Besides files and the standard streams, a process's descriptors can be
+// I/O rings (ioring.h), whose requests run on worker threads while the
+// process goes on, and TCP sockets from listen() and IORING_OP_ACCEPT.
+// fork() doesn't hand either to the child: its copy of a ring's memory is
+// unmapped.
+//
+// Threads stay cooperative in the kernel. In ring 3 a process is preempted
+// by the local APIC timer every PROC_SLICE_MS: the interrupt yields to the
+// other threads and resumes it afterwards. Each process has its own kernel
+// stack for traps and system calls, and its x87/SSE state is saved on the
+// way in and restored on the way out (the kernel uses SSE too).
+//
+// A process whose job is cancelled (Ctrl+C) or whose output nobody reads
+// any more is ended at its next system call or time slice. Exceptions in
+// ring 3 end the process with a message.
+
+#define PROC_MAX_FILES    32
+#define PROC_MAX_ARGS     16
+#define PROC_SLICE_MS     4
+#define PROC_STACK_SIZE   (1024u * 1024)    // user stack, below USER_TOP
+#define PROC_KSTACK_ORDER 2                 // 2^2 pages = 16 KiB
+
+// Where open() and the loader get files. Handles are the callee's; a file
+// that has gone away since it was opened reads and writes as -1.
+typedef struct {
+    // flags are the O_* of syscall.h. Returns 0 if path can't be opened.
+    void    *(*open)(void *ctx, const char *path, int flags);
+    // Both return the bytes moved (fewer than len at the end of the file,
+    // or when it is full) or -1.
+    int      (*read)(void *ctx, void *file, uint32_t pos, void *buf, uint32_t len);
+    int      (*write)(void *ctx, void *file, uint32_t pos, const void *data, uint32_t len);
+    int      (*size)(void *ctx, void *file);
+    // Another handle to the same file, or 0.
+    void    *(*dup)(void *ctx, void *file);
+    // For mmap(): as VmPager's page(). The page stays as it was for whoever
+    // holds it, whatever happens to the file afterwards.
+    void    *(*page)(void *ctx, void *file, uint64_t index);
+    // Puts whatever of the file is only cached where it belongs: 0 or -1.
+    int      (*sync)(void *ctx, void *file);
+    void     (*close)(void *ctx, void *file);
+    void     *ctx;
+} ProcFs;
+
+// Needs cpu_init() and a vm_init() that succeeded. Registers `run`.
+void proc_init(const ProcFs *fs);
+
+// Processes alive now.
+int  proc_count(void);
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef LIGHTOS_SHELL_H
+#define LIGHTOS_SHELL_H
+
+#include <stdint.h>
+#include "pipe.h"
+
+// Command Block shell: command registry, tokenizer, pipelines and jobs.
+//
+// Commands are registered once (the kernel's built-ins at boot, drivers and
+// subsystems when they start) and looked up by name or alias in an
+// open-addressing hash table, so dispatch costs one hash and a probe or two
+// whatever the number of commands. `help` is generated from the registry.
+//
+// A command line is split into words on spaces and tabs. Single or double
+// quotes group a word that contains spaces; the quotes themselves are
+// removed. There are no escapes: backslash is the path separator.
+//
+// Outside quotes, `|` joins commands into a pipeline and a final `> file`
+// or `>> file` sends its output to a file instead of the console. Every
+// command of a line runs in its own kernel thread, joined to the next by a
+// pipe, so output streams through PIPE_SIZE buffers however long it is.
+// The console's owner drains the last pipe with shell_poll() from its main
+// loop, which also gives the job's threads their turn.
+//
+// The console's line editor keeps its history here (a ring of the last
+// SHELL_HISTORY lines, shared by every console and listed by `history`)
+// and completes words through a ShellCompletion: it offers the candidates
+// it knows (shell_complete_commands() for the first word, file names for
+// the rest) and gets back the longest extension they all share.
+
+#define SHELL_MAX_COMMANDS 64
+#define SHELL_MAX_ALIASES  3
+#define SHELL_MAX_ARGS     16
+#define SHELL_MAX_STAGES   8
+#define SHELL_LINE_MAX     256
+#define SHELL_HISTORY      64
+#define SHELL_COMPLETE_MAX 32                   // candidates kept for listing
+
+typedef struct ShellJob ShellJob;
+
+// One command's view of its job.
+typedef struct {
+    Pipe     *in;                   // previous command's output, or 0
+    Pipe     *out;                  // next command, the console or a file
+    ShellJob *job;
+    int       rows;                 // console lines on screen, for more
+    int       broken;               // whoever reads out has stopped
+    char      rbuf[128];            // shell_read_line() buffering
+    uint32_t  rpos, rlen;
+} Shell;
+
+// argv[0] is the name the command was invoked as.
+typedef void (*ShellFn)(Shell *sh, int argc, char **argv);
+
+typedef struct {
+    const char *name;
+    const char *aliases[SHELL_MAX_ALIASES];     // unused slots are 0
+    const char *usage;                          // arguments, or 0
+    const char *help;                           // one line
+    ShellFn     fn;
+} ShellCommand;
+
+// Where jobs print, and the files `>` and `>>` write to.
+typedef struct {
+    void  (*line)(void *ctx, const char *line);
+    // Opens name for writing (append: keep what is there), or returns 0.
+    void *(*open)(void *ctx, const char *name, int append);
+    // Returns the number of bytes stored.
+    int   (*write)(void *ctx, void *file, const char *data, uint32_t len);
+    void  (*close)(void *ctx, void *file);
+    void   *ctx;
+    int     rows;
+} ShellConsole;
+
+// Registers the shell's own commands (help and the filters).
+void shell_init(void);
+
+// cmd must stay valid (normally it is static). Returns -1 if the registry
+// is full or a name is already taken; the names that were free still work.
+int  shell_register(const ShellCommand *cmd);
+const ShellCommand *shell_find(const char *name);
+
+// Number of registered commands, and the i-th in registration order.
+int  shell_command_count(void);
+const ShellCommand *shell_command(int i);
+
+// Splits line into argv. Words are copied into buf. Returns argc, or -1 on
+// an unterminated quote or if the words don't fit.
+int  shell_tokenize(const char *line, char *buf, uint32_t buf_len,
+                    char **argv, int max_args);
+
+// Remembers a line the user ran. Empty lines and repeats of the previous
+// line are not kept.
+void shell_history_add(const char *line);
+int  shell_history_count(void);
+// age 0 is the newest line; 0 if there is no such line.
+const char *shell_history_get(int age);
+// The age of the newest line at least from_age old that contains text,
+// or -1.
+int  shell_history_search(const char *text, int from_age);
+
+typedef struct {
+    const char *prefix;
+    uint32_t    prefix_len;
+    int         count;                          // matches offered
+    char        common[SHELL_LINE_MAX];         // what they all start with
+    const char *suffix;                         // unique match: what follows it
+    const char *names[SHELL_COMPLETE_MAX];      // the first matches
+} ShellCompletion;
+
+void shell_complete_begin(ShellCompletion *c, const char *prefix);
+// name is kept by pointer until the completion is used. suffix goes after
+// it if it turns out to be the only match: a backslash for a directory, a
+// space for anything else.
+void shell_complete_offer(ShellCompletion *c, const char *name, const char *suffix);
+// Offers every command name and alias.
+void shell_complete_commands(ShellCompletion *c);
+
+// Parses line and starts it as a job. Returns 0 if it started, -1 if it
+// could not (the reason is printed on con), 1 for an empty line.
+int  shell_start(const ShellConsole *con, const char *line);
+int  shell_busy(void);
+// Runs the job's threads for a turn and prints their output. Returns
+// nonzero if the console changed (output, or the job finished).
+int  shell_poll(void);
+// A key typed at the console while a job runs ('\n' for Enter).
+void shell_key(char c);
+// Ctrl+C: every command's input ends and its output fails.
+void shell_cancel(void);
+
+// For commands.
+void shell_print(Shell *sh, const char *line);
+// The next input line without its newline; returns its length, or -1 at
+// the end of the input. Longer lines come back in max - 1 pieces.
+int  shell_read_line(Shell *sh, char *buf, uint32_t max);
+// Waits for a key typed at the console; -1 if the job was cancelled.
+int  shell_read_key(Shell *sh);
+// Raw bytes, for programs that do their own line handling. shell_write()
+// returns len, or -1 once nobody reads. shell_read() waits for at least one
+// byte from the input pipe (the console's keys if there is none); -1 at the
+// end of the input or if the job was cancelled.
+int  shell_write(Shell *sh, const void *data, uint32_t len);
+int  shell_read(Shell *sh, void *buf, uint32_t max);
+// Nothing more this command prints will be seen: stop early.
+int  shell_cancelled(const Shell *sh);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef LIGHTOS_SMP_H
+#define LIGHTOS_SMP_H
+
+#include <stdint.h>
+
+// Application processors.
+//
+// smp_init() starts every enabled CPU in the ACPI MADT with INIT-SIPI-SIPI
+// through the local APIC. APs run with interrupts off and do nothing but
+// wait for jobs: smp_run() hands one function to the CPUs, runs it on the
+// boot CPU as well and returns when every CPU has finished, so each call is
+// a fork/join barrier. CPU 0 is always the boot CPU.
+//
+// Jobs may use kmalloc() and the slab caches, which keep per-CPU magazines
+// (mm.h), and the page allocator; the rest of the kernel is the boot CPU's.
+
+#define SMP_MAX_CPUS 16
+
+typedef void (*SmpJob)(void *arg, int cpu);
+
+// trampoline: a free page below 1 MiB (BootInfo.ap_trampoline). Returns the
+// number of CPUs online, boot CPU included.
+int  smp_init(uint64_t trampoline);
+int  smp_cpu_count(void);
+// The index of the CPU running this, 0 .. smp_cpu_count() - 1. One
+// RDTSCP (the index is in TSC_AUX) where the CPU has it.
+int  smp_cpu_id(void);
+
+// Runs job(arg, cpu) on CPUs 0 .. cpus-1 (clamped to those online) and
+// waits for all of them.
+void smp_run(SmpJob job, void *arg, int cpus);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef LIGHTOS_SOCKET_H
+#define LIGHTOS_SOCKET_H
+
+#include <stdint.h>
+
+// In-kernel socket API over the TCP/UDP stack.
+//
+// Calls that take a timeout block by pumping net_tick() until they can make
+// progress; pass 0 for a non-blocking attempt (which returns NET_EAGAIN when
+// it would have to wait). Errors are the negative NET_* codes from net.h.
+
+#define SOCK_STREAM 1
+#define SOCK_DGRAM  2
+
+#define NET_MAX_SOCKETS 32
+
+// sock_poll() readiness bits
+#define SOCK_READABLE 0x1   // data, EOF, or a pending connection to accept
+#define SOCK_WRITABLE 0x2
+#define SOCK_ERROR    0x4
+
+typedef struct Socket Socket;
+
+Socket *sock_open(int type);
+int     sock_bind(Socket *s, uint16_t port);
+int     sock_connect(Socket *s, uint32_t ip, uint16_t port, uint32_t timeout_ms);
+int     sock_listen(Socket *s, int backlog);
+Socket *sock_accept(Socket *s, uint32_t timeout_ms, int *err);
+
+// Stream sockets. sock_send() returns bytes queued; sock_recv() returns
+// bytes read, 0 at end of stream.
+int sock_send(Socket *s, const void *buf, uint32_t len, uint32_t timeout_ms);
+int sock_recv(Socket *s, void *buf, uint32_t len, uint32_t timeout_ms);
+
+// Datagram sockets.
+int sock_sendto(Socket *s, const void *buf, uint32_t len, uint32_t ip, uint16_t port);
+int sock_recvfrom(Socket *s, void *buf, uint32_t len,
+                  uint32_t *ip, uint16_t *port, uint32_t timeout_ms);
+
+int  sock_poll(Socket *s);
+int  sock_state(Socket *s);          // TCP state for diagnostics
+void sock_close(Socket *s);
+int  sock_count(void);
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef LIGHTOS_SYSCALL_H
+#define LIGHTOS_SYSCALL_H
+
+#include <stdint.h>
+
+// System call numbers, flags and the I/O ring layout, shared by the kernel
+// and user programs (user/lightos.h wraps them).
+//
+// The number goes in rax, the arguments in rdi, rsi, rdx, r10, r8 and r9,
+// and the SYSCALL instruction returns the result in rax: a count, a file
+// descriptor or an address, or a negative SYS_E* code.
+//
+//   read(fd, buf, len)              bytes read, 0 at end of input
+//   write(fd, data, len)            bytes written
+//   open(path, flags)               fd; paths as the shell takes them
+//   close(fd)
+//   mmap(addr, len, prot, flags, fd, offset)
+//                                   address; addr is only a hint. MAP_ANON
+//                                   gives zeroed pages; otherwise the file's
+//                                   pages, shared until written (a write
+//                                   makes a private copy, as MAP_PRIVATE).
+//                                   Touching a page past the end of the
+//                                   file is a page fault
+//   munmap(addr, len)
+//   exit(code)                      doesn't return
+//   spawn(path, args)               pid of a new process running the ELF at
+//                                   path with the space-separated args; it
+//                                   shares the caller's standard streams
+//   wait(pid)                       its exit code, once it has exited
+//   fork()                          a copy of the caller, sharing its memory
+//                                   copy-on-write and with its descriptors
+//                                   (positions are not shared): pid in the
+//                                   parent, 0 in the child
+//   ioring_setup(entries, &ring)    fd of a new I/O ring with room for
+//                                   entries submissions (rounded up to a
+//                                   power of two); ring gets the address of
+//                                   its shared memory, mapped read-write
+//   ioring_enter(fd, submit, wait)  takes up to submit queued entries, then
+//                                   waits until at least wait completions
+//                                   are there (or nothing is in flight);
+//                                   returns how many entries it took
+//   listen(port, backlog)           fd of a TCP socket listening on port,
+//                                   for IORING_OP_ACCEPT; read() and
+//                                   write() work on the connections
+//
+// Descriptors 0, 1 and 2 are the command's input, output and (the same)
+// output in the shell's pipeline.
+//
+// I/O rings batch work without a system call per operation. The program
+// fills IoSqe entries at sq_tail and moves sq_tail on; ioring_enter() takes
+// them, and each finishes on its own, in any order, as an IoCqe at cq_tail
+// carrying the entry's user_data and the result its system call would have
+// returned. The program reads completions from cq_head and moves cq_head
+// on; it can look for them at any time without entering the kernel. The
+// kernel takes no more entries than the completion queue has room for,
+// counting those still in flight.
+
+#define SYS_READ    0
+#define SYS_WRITE   1
+#define SYS_OPEN    2
+#define SYS_CLOSE   3
+#define SYS_MMAP    4
+#define SYS_MUNMAP  5
+#define SYS_EXIT    6
+#define SYS_SPAWN   7
+#define SYS_WAIT    8
+#define SYS_FORK    9
+#define SYS_IORING_SETUP 10
+#define SYS_IORING_ENTER 11
+#define SYS_LISTEN  12
+#define SYS_COUNT   13
+
+#define SYS_ENOENT  (-2)
+#define SYS_EIO     (-5)
+#define SYS_ENOEXEC (-8)
+#define SYS_EBADF   (-9)
+#define SYS_ECHILD  (-10)
+#define SYS_ENOMEM  (-12)
+#define SYS_EFAULT  (-14)
+#define SYS_EINVAL  (-22)
+#define SYS_EMFILE  (-24)
+#define SYS_ENOSPC  (-28)
+#define SYS_EPIPE   (-32)
+#define SYS_ENOSYS  (-38)
+#define SYS_EADDRINUSE (-98)
+#define SYS_ECONNRESET (-104)
+#define SYS_ECANCELED (-125)
+
+#define O_RDONLY    0x0
+#define O_WRONLY    0x1
+#define O_RDWR      0x2
+#define O_ACCMODE   0x3
+#define O_CREAT     0x40
+#define O_TRUNC     0x200
+#define O_APPEND    0x400
+
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+#define PROT_EXEC   0x4
+
+#define MAP_PRIVATE 0x02
+#define MAP_ANON    0x20
+
+// IoSqe opcodes. off is a file position, or IORING_OFF_CUR for the
+// descriptor's own (which the operation then moves on, as read() and
+// write() do).
+#define IORING_OP_NOP     0
+#define IORING_OP_READ    1             // fd, addr, len, off
+#define IORING_OP_WRITE   2             // fd, addr, len, off
+#define IORING_OP_OPEN    3             // addr: path, flags: O_*; the new fd
+#define IORING_OP_CLOSE   4             // fd
+#define IORING_OP_FSYNC   5             // fd: its data reaches the disk
+#define IORING_OP_TIMEOUT 6             // completes with 0 after off ms
+#define IORING_OP_ACCEPT  7             // fd from listen(); the new connection's fd
+
+#define IORING_OFF_CUR    (~0ull)
+#define IORING_MAX_ENTRIES 256
+
+typedef struct {
+    uint8_t  opcode;
+    uint8_t  reserved[3];
+    int32_t  fd;
+    uint64_t off;
+    uint64_t addr;
+    uint32_t len;
+    uint32_t flags;
+    uint64_t user_data;
+} IoSqe;
+
+typedef struct {
+    uint64_t user_data;
+    int64_t  res;
+} IoCqe;
+
+// At the start of a ring's memory; the entries follow at the offsets
+// given. Each side only writes its own index: the program sq_tail and
+// cq_head, the kernel sq_head and cq_tail. Indexes only grow; an entry's
+// slot is its index & (entries - 1).
+typedef struct {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    uint32_t          sq_entries;
+    uint32_t          sq_offset;        // of the IoSqe array, in bytes
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    uint32_t          cq_entries;       // twice sq_entries
+    uint32_t          cq_offset;
+    volatile uint32_t cq_overflow;      // completions lost to a full queue
+    uint32_t          size;             // bytes mapped
+} IoRingShared;
+
+#define STDIN_FILENO  0
+#define STDOUT_FILENO 1
+#define STDERR_FILENO 2
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef LIGHTOS_TCP_H
+#define LIGHTOS_TCP_H
+
+#include <stdint.h>
+
+// TCP protocol control blocks. The socket layer wraps these; nothing else
+// should need to include this header.
+
+typedef enum {
+    TCP_CLOSED = 0,
+    TCP_LISTEN,
+    TCP_SYN_SENT,
+    TCP_SYN_RCVD,
+    TCP_ESTABLISHED,
+    TCP_FIN_WAIT_1,
+    TCP_FIN_WAIT_2,
+    TCP_CLOSE_WAIT,
+    TCP_CLOSING,
+    TCP_LAST_ACK,
+    TCP_TIME_WAIT
+} TcpState;
+
+typedef struct TcpCb TcpCb;
+
+TcpCb *tcp_open(void);
+int    tcp_bind(TcpCb *tcb, uint16_t port);
+int    tcp_connect(TcpCb *tcb, uint32_t ip, uint16_t port);
+int    tcp_listen(TcpCb *tcb, int backlog);
+TcpCb *tcp_accept(TcpCb *tcb);
+
+// Non-blocking data transfer. tcp_send() returns bytes copied into the send
+// buffer (possibly 0); tcp_recv() returns bytes read, 0 at end of stream, or
+// NET_EAGAIN when nothing is buffered yet.
+int tcp_send(TcpCb *tcb, const void *buf, uint32_t len);
+int tcp_recv(TcpCb *tcb, void *buf, uint32_t len);
+
+// Orderly close; the control block stays alive until the FIN handshake is
+// done, then frees itself. The caller must not use tcb afterwards.
+void tcp_close(TcpCb *tcb);
+
+int         tcp_state(const TcpCb *tcb);
+int         tcp_error(const TcpCb *tcb);
+int         tcp_readable(const TcpCb *tcb);
+int         tcp_writable(const TcpCb *tcb);
+uint32_t    tcp_remote_ip(const TcpCb *tcb);
+uint16_t    tcp_remote_port(const TcpCb *tcb);
+const char *tcp_state_name(int state);
+int         tcp_count(void);
+
+#endif
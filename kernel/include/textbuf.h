@@ -0,0 +1,87 @@
+#ifndef LIGHTOS_TEXTBUF_H
+#define LIGHTOS_TEXTBUF_H
+
+#include <stdint.h>
+
+// Piece-table text buffers, for the editor.
+//
+// The text is a list of pieces, each a run of bytes in one of two buffers:
+// the original text, which is only ever read (the editor points it at the
+// file's contents, so opening a file copies nothing), and an append-only
+// buffer that every inserted byte goes to. An insert adds a piece, or just
+// lengthens the last one when typing continues where it left off; a delete
+// shortens or drops pieces. Neither moves any text.
+//
+// Deleted bytes are appended to the add buffer too, so every edit can be
+// undone and redone by putting back or taking out a piece that points at
+// bytes the buffer already holds. Consecutive typing (and consecutive
+// forward deletes) at the same spot undo as one step.
+//
+// Lookups start from the piece last visited, so walking the text in order,
+// or editing in one place, doesn't search the piece list from the start.
+
+typedef struct {
+    uint8_t  add;               // 0: original text, 1: add buffer
+    uint32_t start, len;
+} TextPiece;
+
+typedef struct {
+    uint8_t  insert;            // 1: len bytes went in at pos; 0: came out
+    uint32_t pos, len;
+    uint32_t add_off;           // where the bytes are in the add buffer
+} TextEdit;
+
+typedef struct {
+    const char *orig;
+    uint32_t    orig_len;
+    char       *add;
+    uint32_t    add_len, add_cap;
+    TextPiece  *pieces;
+    uint32_t    count, cap;
+    uint32_t    length;         // bytes of text
+    uint32_t    hint;           // piece last found
+    uint32_t    hint_pos;       // where it starts
+    TextEdit   *edits;
+    uint32_t    edit_count;     // recorded
+    uint32_t    edit_pos;       // applied; the rest can be redone
+    uint32_t    edit_cap;
+    int         merge;          // the last edit may absorb the next
+} TextBuf;
+
+// orig must stay valid and unchanged until tb_free(). Returns -1 if out of
+// memory.
+int      tb_init(TextBuf *tb, const char *orig, uint32_t len);
+void     tb_free(TextBuf *tb);
+
+// Both return -1 (changing nothing) if out of memory.
+int      tb_insert(TextBuf *tb, uint32_t pos, const char *text, uint32_t len);
+int      tb_delete(TextBuf *tb, uint32_t pos, uint32_t len);
+// Ends the current undo step: the next edit won't merge into it.
+void     tb_break_undo(TextBuf *tb);
+// Returns -1 when there is nothing to undo or redo; else sets *pos to
+// where the text changed (the end of a redone insert).
+int      tb_undo(TextBuf *tb, uint32_t *pos);
+int      tb_redo(TextBuf *tb, uint32_t *pos);
+
+// Copies up to len bytes from pos; returns how many.
+uint32_t tb_read(TextBuf *tb, uint32_t pos, char *dst, uint32_t len);
+// Byte at pos, or -1 past the end.
+int      tb_char(TextBuf *tb, uint32_t pos);
+// First occurrence of needle at or after from; -1 if none.
+int64_t  tb_find(TextBuf *tb, uint32_t from, const char *needle, uint32_t n);
+
+// Sequential access, one byte at a time, without a lookup per byte.
+typedef struct {
+    TextBuf  *tb;
+    uint32_t  piece;
+    uint32_t  off;              // within the piece
+    uint32_t  pos;
+} TextIter;
+
+void     tb_iter(TextBuf *tb, TextIter *it, uint32_t pos);
+// The byte at the iterator, then steps forward; -1 at the end.
+int      ti_next(TextIter *it);
+// Steps back and returns that byte; -1 at the start.
+int      ti_prev(TextIter *it);
+
+#endif
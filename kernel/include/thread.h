@@ -0,0 +1,39 @@
+#ifndef LIGHTOS_THREAD_H
+#define LIGHTOS_THREAD_H
+
+#include <stdint.h>
+
+// Kernel threads on the boot CPU.
+//
+// Scheduling is cooperative: a thread runs until it calls thread_yield()
+// (directly, or by waiting on a pipe) or returns. The boot thread, which
+// runs the main loop, is one of them, so yielding from the main loop lets
+// every other thread make progress and then comes back. There is no
+// preemption and no locking: between two yields a thread has the kernel to
+// itself. Application processors never run threads; they only take
+// smp_run() jobs.
+
+#define THREAD_STACK_ORDER 3            // 2^3 pages = 32 KiB
+#define THREAD_NAME_LEN    16
+
+typedef struct Thread Thread;
+typedef void (*ThreadFn)(void *arg);
+
+// The thread runs fn(arg) and exits when fn returns. Returns 0 if out of
+// memory. It is runnable straight away but doesn't run until the caller
+// yields.
+Thread *thread_create(ThreadFn fn, void *arg, const char *name);
+
+// Lets every other runnable thread run once.
+void    thread_yield(void);
+
+// Nonzero once the thread's function has returned.
+int     thread_done(const Thread *t);
+
+// Yields until t has finished, then frees it.
+void    thread_join(Thread *t);
+
+Thread *thread_current(void);
+int     thread_count(void);             // including the boot thread
+
+#endif
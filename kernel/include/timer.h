@@ -0,0 +1,23 @@
+#ifndef LIGHTOS_TIMER_H
+#define LIGHTOS_TIMER_H
+
+#include <stdint.h>
+
+// Monotonic time from the TSC, calibrated once at boot against the PIT.
+// There is no timer interrupt; callers compare deadlines against time_ms()
+// from their poll routines.
+
+void     timer_init(void);
+uint64_t timer_tsc_per_ms(void);
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+uint64_t time_ms(void);
+uint64_t time_us(void);
+void     delay_ms(uint32_t ms);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef LIGHTOS_USERBIN_H
+#define LIGHTOS_USERBIN_H
+
+#include <stdint.h>
+
+// The user programs built from user/ and linked into the kernel image, so
+// there is something to `run` on a RAM file system. vfs_init() copies
+// them into \bin.
+
+typedef struct {
+    const char    *name;
+    const uint8_t *data;
+    uint32_t       size;
+} UserBinary;
+
+// The programs, and how many there are in *count.
+const UserBinary *user_binaries(int *count);
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef LIGHTOS_VIRTIO_H
+#define LIGHTOS_VIRTIO_H
+
+#include <stdint.h>
+#include "pci.h"
+
+// Virtio 1.0 over PCI ("modern" transport) and split virtqueues.
+//
+// The kernel polls its devices, so every queue is created with device
+// interrupts suppressed and MSI-X vectors unassigned. Drivers reap completions
+// from virtq_get_used() in their poll routine.
+
+#define VIRTIO_PCI_VENDOR 0x1AF4
+
+#define VIRTIO_STATUS_ACK         0x01
+#define VIRTIO_STATUS_DRIVER      0x02
+#define VIRTIO_STATUS_DRIVER_OK   0x04
+#define VIRTIO_STATUS_FEATURES_OK 0x08
+#define VIRTIO_STATUS_FAILED      0x80
+
+#define VIRTIO_F_RING_EVENT_IDX   (1ull << 29)
+#define VIRTIO_F_VERSION_1        (1ull << 32)
+
+#define VIRTQ_DESC_F_NEXT   1
+#define VIRTQ_DESC_F_WRITE  2
+
+#define VIRTQ_AVAIL_F_NO_INTERRUPT 1
+#define VIRTQ_USED_F_NO_NOTIFY     1
+
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} VirtqDesc;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];    // followed by used_event
+} VirtqAvail;
+
+typedef struct {
+    uint32_t id;
+    uint32_t len;
+} VirtqUsedElem;
+
+typedef struct {
+    uint16_t      flags;
+    uint16_t      idx;
+    VirtqUsedElem ring[];   // followed by avail_event
+} VirtqUsed;
+
+typedef struct VirtioDevice VirtioDevice;
+
+typedef struct {
+    VirtioDevice        *vdev;
+    uint16_t             index;
+    uint16_t             size;
+    VirtqDesc           *desc;
+    volatile VirtqAvail *avail;
+    volatile VirtqUsed  *used;
+    volatile uint16_t   *avail_event;  // written by the device (EVENT_IDX)
+    uint64_t             notify_addr;
+    void               **cookie;       // per head descriptor
+    uint16_t             free_head;
+    uint16_t             num_free;
+    uint16_t             last_used;
+    uint16_t             avail_idx;    // our copy of avail->idx
+    uint16_t             kicked_idx;   // avail_idx at the last notification
+    uint64_t             kicks;
+    uint64_t             kicks_suppressed;
+} VirtQueue;
+
+struct VirtioDevice {
+    PciDevice *pci;
+    uint64_t   common;        // common configuration structure
+    uint64_t   notify_base;
+    uint32_t   notify_mult;
+    uint64_t   isr;
+    uint64_t   device_cfg;    // device-specific configuration
+    uint64_t   features;      // negotiated feature bits
+};
+
+// One segment of a descriptor chain.
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    int      device_writes;   // 1 = device-writable (in), 0 = readable (out)
+} VirtqSeg;
+
+// Transport setup: locate the capability structures, reset the device and
+// acknowledge it. Then negotiate features, set up queues, and mark it live.
+int      virtio_pci_init(VirtioDevice *vd, PciDevice *pci);
+uint64_t virtio_device_features(VirtioDevice *vd);
+int      virtio_negotiate(VirtioDevice *vd, uint64_t wanted);
+int      virtio_queue_setup(VirtioDevice *vd, VirtQueue *vq,
+                            uint16_t index, uint16_t max_size);
+void     virtio_driver_ok(VirtioDevice *vd);
+void     virtio_fail(VirtioDevice *vd);
+// For unwinding a failed setup: reset the device first, then free its
+// queues (the caller frees whatever cookies are still in them).
+void     virtio_reset(VirtioDevice *vd);
+void     virtio_queue_free(VirtQueue *vq);
+
+uint8_t  virtio_cfg_read8(VirtioDevice *vd, uint32_t off);
+uint16_t virtio_cfg_read16(VirtioDevice *vd, uint32_t off);
+uint32_t virtio_cfg_read32(VirtioDevice *vd, uint32_t off);
+void     virtio_cfg_write8(VirtioDevice *vd, uint32_t off, uint8_t v);
+
+// Queue operations. virtq_add() publishes a chain to the device but does not
+// notify it; call virtq_kick() once after a batch of adds.
+int   virtq_add(VirtQueue *vq, const VirtqSeg *segs, uint16_t count, void *cookie);
+void  virtq_kick(VirtQueue *vq);
+void *virtq_get_used(VirtQueue *vq, uint32_t *len);
+int   virtq_has_used(const VirtQueue *vq);
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef LIGHTOS_VIRTIO_BLK_H
+#define LIGHTOS_VIRTIO_BLK_H
+
+// virtio-blk disk driver. Probes every virtio-blk PCI function and registers
+// it as a BlockDevice (blkdev.h). Returns the number of disks brought up.
+//
+// QEMU: -drive file=disk.img,format=raw,if=none,id=d0
+//       -device virtio-blk-pci,drive=d0
+int virtio_blk_probe(void);
+
+#endif
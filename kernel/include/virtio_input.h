@@ -0,0 +1,17 @@
+#ifndef LIGHTOS_VIRTIO_INPUT_H
+#define LIGHTOS_VIRTIO_INPUT_H
+
+// virtio-input pointing devices. Tablets (absolute X/Y) and mice (relative
+// motion) are bound; their events go to the mouse event queue, tablets as
+// absolute positions, so a VM's pointer sits exactly where the host's is.
+// Keyboards are left alone.
+//
+// QEMU: -device virtio-tablet-pci (or virtio-mouse-pci)
+
+// Returns the number of devices brought up.
+int  virtio_input_probe(void);
+
+// Reaps input events. Call from the main loop.
+void virtio_input_poll(void);
+
+#endif
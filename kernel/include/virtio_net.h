@@ -0,0 +1,8 @@
+#ifndef LIGHTOS_VIRTIO_NET_H
+#define LIGHTOS_VIRTIO_NET_H
+
+// virtio-net NIC driver. Probes every virtio-net PCI function and registers
+// it as a NetDevice. Returns the number of adapters brought up.
+int virtio_net_probe(void);
+
+#endif
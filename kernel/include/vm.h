@@ -0,0 +1,126 @@
+#ifndef LIGHTOS_VM_H
+#define LIGHTOS_VM_H
+
+#include <stdint.h>
+
+// Address spaces for user processes.
+//
+// Every address space starts as a copy of the boot PML4, so the kernel and
+// the identity map of RAM are there, supervisor-only, through the same
+// lower-level tables. User memory lives in one PML4 slot of its own
+// (USER_BASE .. USER_TOP) whose tables belong to the address space.
+//
+// User memory is a sorted list of regions. A region says what may be
+// there; pages appear on the first fault. Anonymous regions get zeroed
+// pages, file regions the file's own pages from its VmPager, shared by
+// everyone who maps them and never copied until someone writes. Writes to
+// a shared page (a file page, or any page after vm_clone()) fault too and
+// copy it, unless nobody else holds it any more. A VM_SHARED file region
+// is the exception: its pages are written in place, by everyone who has
+// them, and stay shared across vm_clone().
+//
+// With PCIDs each address space gets its own TLB tag and CR3 is loaded
+// without a flush, so switching between processes (or back to the kernel)
+// keeps everyone's translations. A PCID is flushed once when an address
+// space takes it over from a dead one, and whenever a mapping is taken
+// away or made read-only: at once if that address space is loaded, else
+// the next time it is.
+//
+// The kernel never reads user memory through user addresses: vm_copy_*
+// find the page in the tables (faulting it in if need be) and go through
+// the identity map, which works whichever address space is loaded.
+
+#define USER_BASE 0x00007F8000000000ull     // PML4 slot 255
+// The last page stays unmapped: SYSRET to the non-canonical address past it
+// would fault in ring 0.
+#define USER_TOP  0x00007FFFFFFFF000ull
+
+#define VM_WRITE  0x1
+#define VM_EXEC   0x2
+#define VM_SHARED 0x4                       // file regions: no copy on write
+
+// Where a file region's pages come from. page() returns the page holding
+// bytes index * PAGE_SIZE.. of file with a reference for the caller
+// (page_put() drops it), or 0 past the end of the file. A region that is
+// split or cloned dup()s its file; close() is called for each when it
+// goes.
+typedef struct {
+    void *(*page)(void *ctx, void *file, uint64_t index);
+    void *(*dup)(void *ctx, void *file);
+    void  (*close)(void *ctx, void *file);
+    void   *ctx;
+} VmPager;
+
+typedef struct VmRegion VmRegion;
+struct VmRegion {
+    VmRegion      *next;                // by address
+    uint64_t       start, end;          // page aligned
+    uint32_t       flags;               // VM_WRITE, VM_EXEC, VM_SHARED
+    const VmPager *pager;               // 0: anonymous
+    void          *file;
+    uint64_t       offset;              // file offset of start, page aligned
+};
+
+typedef struct {
+    uint64_t *pml4;
+    uint64_t  cr3;              // value to load (table, PCID, no-flush bit)
+    uint16_t  pcid;             // 0 without PCID support
+    uint32_t  pages;            // user pages present
+    VmRegion *regions;
+} AddressSpace;
+
+typedef struct {
+    uint64_t faults;            // resolved: from ring 3 or kernel copies
+    uint64_t bad_faults;        // outside any region, or not allowed
+    uint64_t zero_fills;
+    uint64_t file_pages;        // file pages mapped without a copy
+    uint64_t cow_copies;
+    uint64_t cow_reuses;        // written by the last sharer: no copy
+} VmStats;
+
+// Returns -1 if the boot page tables already use the user slot.
+int      vm_init(void);
+int      vm_pcid_enabled(void);
+
+AddressSpace *vm_create(void);
+// Must not be the loaded address space.
+void     vm_destroy(AddressSpace *as);
+// A copy of src sharing all its pages copy-on-write. 0 if out of memory.
+AddressSpace *vm_clone(AddressSpace *src);
+
+// Loads as (0: the kernel's) unless it already is.
+void     vm_activate(AddressSpace *as);
+
+// A region for [va, va + len), page aligned; pages come on demand. With a
+// pager, from file at offset. -1 if out of memory or if it would overlap
+// another region.
+int      vm_reserve(AddressSpace *as, uint64_t va, uint64_t len, uint32_t flags,
+                    const VmPager *pager, void *file, uint64_t offset);
+// An anonymous region with all its zeroed pages there at once.
+int      vm_map(AddressSpace *as, uint64_t va, uint64_t len, uint32_t flags);
+// Takes away regions and pages, splitting regions at the edges.
+void     vm_unmap(AddressSpace *as, uint64_t va, uint64_t len);
+// Nonzero if no region touches [va, va + len).
+int      vm_range_free(AddressSpace *as, uint64_t va, uint64_t len);
+
+// Resolves a fault at va. Returns -1 if nothing may be there, or it may
+// not be written, or memory ran out.
+int      vm_fault(AddressSpace *as, uint64_t va, int write);
+
+// Nonzero if regions cover all of [va, va + len) and allow writing it, if
+// asked. Nothing is faulted in: the copies do that, page by page, for the
+// bytes they actually move.
+int      vm_mapped(AddressSpace *as, uint64_t va, uint64_t len, int write);
+
+// Return 0, or -1 if some of the user range can't be accessed that way.
+int      vm_copy_in(AddressSpace *as, void *dst, uint64_t src, uint64_t len);
+int      vm_copy_out(AddressSpace *as, uint64_t dst, const void *src, uint64_t len);
+// For loaders: like vm_copy_out() but into read-only anonymous memory too.
+int      vm_load(AddressSpace *as, uint64_t dst, const void *src, uint64_t len);
+// A NUL-terminated string of at most max - 1 characters; -1 if it is
+// unmapped or longer.
+int      vm_copy_string(AddressSpace *as, char *dst, uint64_t src, uint32_t max);
+
+void     vm_stats(VmStats *out);
+
+#endif
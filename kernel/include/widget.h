@@ -0,0 +1,99 @@
+#ifndef LIGHTOS_WIDGET_H
+#define LIGHTOS_WIDGET_H
+
+#include <stdint.h>
+#include "wm.h"
+
+// Retained widget trees.
+//
+// The interactive parts of a window (buttons, menu items, tabs, dock
+// icons, its close box) are widgets in a tree the window's owner builds
+// once. A layout callback places them, in window coordinates, only when
+// the window's size changes; painting and pointer handling both read those
+// rectangles instead of each re-deriving the geometry. After a layout the
+// widgets are binned into a grid of WG_CELL squares, so a hit test looks at
+// the few widgets in one cell rather than walking the tree.
+//
+// Events go to the topmost widget under the pointer and bubble up to its
+// parents until a handler takes them.
+
+#define WG_HIDDEN    0x0001     // not hit, not drawn (with its subtree)
+#define WG_HOVER     0x0002     // the pointer is over it (set by the tree)
+#define WG_TRACK     0x0004     // wants WG_ENTER / WG_LEAVE
+
+// Events
+#define WG_CLICK     1          // left button pressed on it
+#define WG_ENTER     2
+#define WG_LEAVE     3
+
+#define WG_CELL      64         // spatial index cell, pixels
+
+typedef struct Widget Widget;
+typedef struct WidgetTree WidgetTree;
+
+// x, y are window coordinates. Returns 1 if the event was handled;
+// otherwise it goes on to the parent.
+typedef int  (*WidgetFn)(Widget *w, int event, int32_t x, int32_t y);
+// Sets the rect of every widget for a w x h window (the root's is set).
+typedef void (*WidgetLayout)(WidgetTree *t, int32_t w, int32_t h);
+
+struct Widget {
+    Rect        r;              // window coordinates
+    Widget     *parent;
+    Widget     *child;          // first child; later siblings are on top
+    Widget     *next;
+    WidgetTree *tree;
+    int         id;             // owner's identifier (e.g. item index)
+    uint16_t    flags;          // WG_*
+    WidgetFn    on_event;
+};
+
+struct WidgetTree {
+    Widget      *root;
+    Widget      *pool;
+    uint32_t     count, cap;
+    WidgetLayout layout;
+    int          owner;         // owner's identifier (e.g. app index)
+    int32_t      w, h;          // size of the last layout
+    int          stale;         // lay out again even if the size is the same
+    Widget      *hover;
+
+    // Spatial index: cell c holds items[first[c] .. first[c + 1]),
+    // in tree order.
+    uint32_t     cols, rows;
+    uint32_t    *first;
+    Widget     **items;
+    uint32_t     first_cap, items_cap;
+};
+
+typedef struct {
+    uint64_t layouts;
+    uint64_t hit_tests;
+    uint64_t candidates;        // widgets looked at by hit tests
+} WidgetStats;
+
+// capacity widgets, the root included. Returns -1 if out of memory.
+int     wtree_init(WidgetTree *t, uint32_t capacity, WidgetLayout layout, int owner);
+// Appends a widget under parent (0 = the root). Returns 0 when full.
+Widget *wtree_add(WidgetTree *t, Widget *parent, int id, uint16_t flags, WidgetFn fn);
+
+// Lays the tree out for a w x h window if that is not the size it was last
+// laid out for, or it was marked stale, and rebuilds the index.
+void    wtree_layout(WidgetTree *t, int32_t w, int32_t h);
+// Something the layout depends on besides the size changed.
+void    wtree_invalidate(WidgetTree *t);
+
+// Topmost visible widget at (x, y), window coordinates, or 0.
+Widget *wtree_hit(WidgetTree *t, int32_t x, int32_t y);
+// Sends WG_CLICK to the widget at (x, y). Returns 1 if a handler took it.
+int     wtree_click(WidgetTree *t, int32_t x, int32_t y);
+// The pointer is at (x, y): moves the hover, sending WG_LEAVE and
+// WG_ENTER to tracking widgets. Pass x < 0 when it left the window.
+void    wtree_hover(WidgetTree *t, int32_t x, int32_t y);
+
+void    widget_show(Widget *w, int visible);
+int     widget_visible(const Widget *w);
+
+void    widget_stats(WidgetStats *out);
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef LIGHTOS_WM_H
+#define LIGHTOS_WM_H
+
+#include <stdint.h>
+
+// Window manager and compositor.
+//
+// Every window (the desktop included) renders into its own off-screen
+// surface, and only when its contents change. The compositor keeps a list
+// of damaged screen rectangles; for each one it walks the z-order from the
+// top and copies every pixel exactly once, from the topmost window covering
+// it, into a back buffer, then pushes just those rectangles to the
+// framebuffer. Moving or raising a window is therefore a matter of blits
+// from cached surfaces; nothing is re-rendered.
+
+typedef struct {
+    uint32_t *pixels;
+    uint32_t  w, h;
+    uint32_t  pitch;        // pixels per row
+    uint32_t  cap;          // allocated pixels (resize reuses the buffer)
+} Surface;
+
+typedef struct {
+    int32_t x, y;
+    int32_t w, h;
+} Rect;
+
+// Surfaces. surface_alloc() reuses the buffer when it is big enough.
+int  surface_alloc(Surface *s, uint32_t w, uint32_t h);
+void surface_free(Surface *s);
+// Copies a w x h block from src (sx, sy) to dst (dx, dy), clipped to both.
+void surface_blit(Surface *dst, int32_t dx, int32_t dy,
+                  const Surface *src, int32_t sx, int32_t sy,
+                  int32_t w, int32_t h);
+
+// Window flags
+#define WIN_VISIBLE 0x1
+#define WIN_DESKTOP 0x2     // full screen, always at the bottom
+#define WIN_POPUP   0x4     // menus: always above normal windows
+#define WIN_FRAMED  0x8     // title bar, close box and resize grip
+
+// Frame geometry (drawn by the owner's paint callback)
+#define WM_TITLE_H   24
+#define WM_CLOSE_SZ  14
+#define WM_GRIP_SZ   12
+#define WM_MIN_W     160
+#define WM_MIN_H     100
+
+// wm_hit() results
+#define WM_HIT_NONE   0
+#define WM_HIT_CLIENT 1
+#define WM_HIT_TITLE  2
+#define WM_HIT_CLOSE  3
+#define WM_HIT_GRIP   4
+
+#define WM_MAX_WINDOWS 16
+#define WM_DIRTY_MORE  3    // separate areas repainted before they're merged
+
+typedef struct Window Window;
+typedef void (*WinPaint)(Window *win);
+
+struct Window {
+    Rect     r;             // screen position and size
+    Surface  surface;
+    uint32_t flags;
+    int      dirty;         // surface must be repainted before compositing
+    Rect     dirty_rect;    // the part to repaint (surface coordinates)
+    Rect     dirty_more[WM_DIRTY_MORE];     // further parts, apart from it
+    int      dirty_more_count;
+    int      id;            // owner's identifier (e.g. app index)
+    WinPaint paint;
+};
+
+// -1 if there is no memory for the back buffer; nothing is composed then.
+int  wm_init(uint32_t *fb, uint32_t width, uint32_t height, uint32_t pitch);
+// The display mode changed: new framebuffer geometry. Everything is
+// recomposited and framed windows are pulled back onto the screen; the
+// owner resizes the desktop and popups itself. -1, with nothing changed,
+// if the back buffer can't grow to the new size.
+int  wm_set_screen(uint32_t *fb, uint32_t width, uint32_t height, uint32_t pitch);
+
+Window *wm_create(Rect r, uint32_t flags, int id, WinPaint paint);
+void    wm_destroy(Window *win);
+
+void wm_raise(Window *win);
+void wm_show(Window *win, int visible);
+void wm_move(Window *win, int32_t x, int32_t y);
+void wm_resize(Window *win, int32_t w, int32_t h);
+
+// The window's contents changed: repaint its surface at the next compose.
+void wm_invalidate(Window *win);
+// Only r (surface coordinates) changed. The paint callback still runs, but
+// may restrict itself to win->dirty_rect. A few areas far apart (an edited
+// line and a status bar) are painted one at a time rather than as the one
+// rectangle around both.
+void wm_invalidate_rect(Window *win, Rect r);
+// Screen area to recomposite (no repaint).
+void wm_damage(Rect r);
+
+Window *wm_window_at(int32_t x, int32_t y);
+Window *wm_top(void);                    // topmost normal window, or 0
+int     wm_hit(const Window *win, int32_t x, int32_t y);
+int     wm_window_count(void);
+Window *wm_window(int z);                // 0 = bottom
+
+// Drag a window's title bar (WM_HIT_TITLE) or resize grip (WM_HIT_GRIP).
+void wm_drag_begin(Window *win, int mode, int32_t x, int32_t y);
+void wm_drag_motion(int32_t x, int32_t y);
+void wm_drag_end(void);
+int  wm_dragging(void);
+
+// Cursor plane, drawn over everything on the framebuffer. image is w*h
+// pixels; those with a zero top byte are transparent. Moves are cheap and
+// coalesce: only the latest position is drawn at the next compose.
+void wm_cursor_set(const uint32_t *image, int32_t w, int32_t h);
+void wm_cursor_move(int32_t x, int32_t y);
+void wm_cursor_show(int visible);
+
+// Nonzero if a compose would change the screen.
+int wm_pending(void);
+
+// Repaints dirty surfaces, recomposites the damaged area and updates the
+// cursor. Returns the number of pixels written to the framebuffer.
+uint32_t wm_compose(void);
+
+const Surface *wm_backbuffer(void);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef LIGHTOS_XHCI_H
+#define LIGHTOS_XHCI_H
+
+#include <stdint.h>
+
+// USB 3 (xHCI) host controller driver.
+//
+// Only HID boot-protocol keyboards and mice are bound. Their interrupt IN
+// endpoints keep a few transfers queued at all times; xhci_poll() reaps
+// completed reports from the event ring and feeds the keyboard and mouse
+// event queues, exactly as the PS/2 driver does. The controller's
+// interrupt is never enabled: the event ring is polled from the main loop.
+//
+// QEMU: -device qemu-xhci -device usb-kbd -device usb-mouse
+
+#define USB_MAX_DEVICES 8
+
+#define USB_HID_KEYBOARD 1
+#define USB_HID_MOUSE    2
+
+typedef struct {
+    uint8_t port;                   // root hub port, 1-based
+    uint8_t speed;                  // USB_SPEED_*
+    uint8_t kind;                   // USB_HID_* bits
+    uint16_t vendor_id;
+    uint16_t product_id;
+} UsbDeviceInfo;
+
+#define USB_SPEED_FULL  1
+#define USB_SPEED_LOW   2
+#define USB_SPEED_HIGH  3
+#define USB_SPEED_SUPER 4
+
+// Starts every xHCI controller found on the PCI bus and enumerates the
+// devices already attached. Returns the number of controllers.
+int  xhci_probe(void);
+
+// Reaps the event rings: HID reports, hotplug. Call from the main loop.
+void xhci_poll(void);
+
+// Attached HID devices, for `usb`. Returns the number written.
+int  xhci_devices(UsbDeviceInfo *out, int max);
+
+#endif
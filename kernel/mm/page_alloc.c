@@ -0,0 +1,232 @@
+// kernel/mm/page_alloc.c
+// Buddy page allocator built from the UEFI memory map.
+//
+// Every physical page below the highest usable address gets a PageFrame entry
+// in g_mem_map. Free memory is kept in per-order lists of naturally aligned
+// blocks; freeing a block merges it with its buddy while the buddy is free too.
+
+#include "mm.h"
+#include "klib.h"
+#include "io.h"
+
+extern char __kernel_end[];
+
+static PageFrame *g_mem_map   = 0;
+static uint64_t   g_max_pfn   = 0;
+static uint64_t   g_total     = 0;
+static uint64_t   g_free      = 0;
+
+static PageFrame *g_free_list[MAX_ORDER];
+static SpinLock   g_lock;               // the free lists, for smp_run() jobs
+
+// ---------------------------------------------------------------------
+// Free list helpers
+// ---------------------------------------------------------------------
+
+static void free_list_push(uint32_t order, PageFrame *pf) {
+    pf->prev  = 0;
+    pf->next  = g_free_list[order];
+    if (pf->next) pf->next->prev = pf;
+    g_free_list[order] = pf;
+    pf->flags = PG_FREE;
+    pf->order = (uint8_t)order;
+}
+
+static void free_list_remove(uint32_t order, PageFrame *pf) {
+    if (pf->prev) pf->prev->next = pf->next;
+    else          g_free_list[order] = pf->next;
+    if (pf->next) pf->next->prev = pf->prev;
+    pf->next  = 0;
+    pf->prev  = 0;
+    pf->flags = 0;
+}
+
+static void free_block(uint64_t pfn, uint32_t order) {
+    g_free += 1ull << order;
+    while (order + 1 < MAX_ORDER) {
+        uint64_t buddy = pfn ^ (1ull << order);
+        if (buddy >= g_max_pfn) break;
+        PageFrame *b = &g_mem_map[buddy];
+        if (!(b->flags & PG_FREE) || b->order != order) break;
+        free_list_remove(order, b);
+        pfn &= ~(1ull << order);
+        order++;
+    }
+    free_list_push(order, &g_mem_map[pfn]);
+}
+
+// ---------------------------------------------------------------------
+// Public API
+// ---------------------------------------------------------------------
+
+PageFrame *virt_to_page(const void *addr) {
+    uint64_t pfn = (uint64_t)(uintptr_t)addr >> PAGE_SHIFT;
+    if (!g_mem_map || pfn >= g_max_pfn) return 0;
+    return &g_mem_map[pfn];
+}
+
+void *page_to_virt(const PageFrame *pf) {
+    uint64_t pfn = (uint64_t)(pf - g_mem_map);
+    return (void *)(uintptr_t)(pfn << PAGE_SHIFT);
+}
+
+uint32_t page_order_for(uint64_t bytes) {
+    uint32_t order = 0;
+    while (((uint64_t)PAGE_SIZE << order) < bytes) order++;
+    return order;
+}
+
+void *page_alloc(uint32_t order) {
+    if (order >= MAX_ORDER) return 0;
+
+    spin_lock(&g_lock);
+    uint32_t o = order;
+    while (o < MAX_ORDER && !g_free_list[o]) o++;
+    if (o == MAX_ORDER) {
+        spin_unlock(&g_lock);
+        return 0;
+    }
+
+    PageFrame *pf = g_free_list[o];
+    free_list_remove(o, pf);
+    uint64_t pfn = (uint64_t)(pf - g_mem_map);
+
+    // Split down to the requested size, returning upper halves.
+    while (o > order) {
+        o--;
+        free_list_push(o, &g_mem_map[pfn + (1ull << o)]);
+    }
+
+    g_free -= 1ull << order;
+    pf->flags    = 0;
+    pf->order    = (uint8_t)order;
+    pf->refcount = 1;
+    spin_unlock(&g_lock);
+    return (void *)(uintptr_t)(pfn << PAGE_SHIFT);
+}
+
+void page_free(void *addr, uint32_t order) {
+    PageFrame *pf = virt_to_page(addr);
+    if (!pf || (pf->flags & (PG_FREE | PG_RESERVED))) return;
+    pf->refcount = 0;
+    spin_lock(&g_lock);
+    free_block((uint64_t)(pf - g_mem_map), order);
+    spin_unlock(&g_lock);
+}
+
+void page_get(void *addr) {
+    PageFrame *pf = virt_to_page(addr);
+    if (pf) pf->refcount++;
+}
+
+void page_put(void *addr) {
+    PageFrame *pf = virt_to_page(addr);
+    if (pf && --pf->refcount <= 0) page_free(addr, 0);
+}
+
+void page_split(void *addr, uint32_t order) {
+    PageFrame *pf = virt_to_page(addr);
+    if (!pf) return;
+    for (uint64_t i = 0; i < (1ull << order); ++i) {
+        pf[i].flags    = 0;
+        pf[i].order    = 0;
+        pf[i].refcount = 1;
+    }
+}
+
+uint64_t mm_total_pages(void) { return g_total; }
+uint64_t mm_free_pages(void)  { return g_free;  }
+
+// ---------------------------------------------------------------------
+// Initialisation
+// ---------------------------------------------------------------------
+
+#define MM_MAX_REGIONS 64
+
+typedef struct {
+    uint64_t start_pfn;
+    uint64_t end_pfn;
+} MemRegion;
+
+static void add_range(uint64_t start, uint64_t end) {
+    // Hand the range to the buddy lists as large aligned blocks.
+    while (start < end) {
+        uint32_t order = MAX_ORDER - 1;
+        while (order > 0 &&
+               ((start & ((1ull << order) - 1)) != 0 ||
+                start + (1ull << order) > end)) {
+            order--;
+        }
+        for (uint64_t i = 0; i < (1ull << order); ++i) {
+            g_mem_map[start + i].flags = 0;
+        }
+        free_block(start, order);
+        start += 1ull << order;
+    }
+}
+
+void mm_init(const BootInfo *bi) {
+    if (!bi || !bi->memory_map || !bi->memory_descriptor_size) return;
+
+    MemRegion regions[MM_MAX_REGIONS];
+    int       count = 0;
+
+    // Nothing below the end of the kernel image is ours to hand out: low
+    // memory belongs to firmware/legacy users and the image itself sits at
+    // KERNEL_LOAD_ADDR.
+    uint64_t floor_pfn = ((uint64_t)(uintptr_t)__kernel_end + PAGE_SIZE - 1) >> PAGE_SHIFT;
+
+    const uint8_t *p   = (const uint8_t *)(uintptr_t)bi->memory_map;
+    const uint8_t *end = p + bi->memory_map_size;
+    for (; p + sizeof(BootMemoryDescriptor) <= end; p += bi->memory_descriptor_size) {
+        const BootMemoryDescriptor *d = (const BootMemoryDescriptor *)p;
+        if (d->type != BOOT_MEM_CONVENTIONAL || d->num_pages == 0) continue;
+
+        uint64_t s = d->phys_start >> PAGE_SHIFT;
+        uint64_t e = s + d->num_pages;
+        if (s < floor_pfn) s = floor_pfn;
+        if (s >= e) continue;
+
+        // The firmware usually reports adjacent free ranges separately.
+        if (count > 0 && regions[count - 1].end_pfn == s) {
+            regions[count - 1].end_pfn = e;
+            continue;
+        }
+        if (count == MM_MAX_REGIONS) break;
+        regions[count].start_pfn = s;
+        regions[count].end_pfn   = e;
+        count++;
+    }
+    if (count == 0) return;
+
+    for (int i = 0; i < count; ++i) {
+        if (regions[i].end_pfn > g_max_pfn) g_max_pfn = regions[i].end_pfn;
+    }
+
+    // Carve the PageFrame array out of the first region large enough.
+    uint64_t map_pages = (g_max_pfn * sizeof(PageFrame) + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    int      host      = -1;
+    for (int i = 0; i < count; ++i) {
+        if (regions[i].end_pfn - regions[i].start_pfn > map_pages) {
+            host = i;
+            break;
+        }
+    }
+    if (host < 0) {
+        g_max_pfn = 0;
+        return;
+    }
+
+    g_mem_map = (PageFrame *)(uintptr_t)(regions[host].start_pfn << PAGE_SHIFT);
+    regions[host].start_pfn += map_pages;
+
+    memset(g_mem_map, 0, g_max_pfn * sizeof(PageFrame));
+    for (uint64_t i = 0; i < g_max_pfn; ++i) {
+        g_mem_map[i].flags = PG_RESERVED;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        g_total += regions[i].end_pfn - regions[i].start_pfn;
+        add_range(regions[i].start_pfn, regions[i].end_pfn);
+    }
+}
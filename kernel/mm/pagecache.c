@@ -0,0 +1,557 @@
+// kernel/mm/pagecache.c
+// Page cache: per-file radix trees of cached pages, readahead, a clock
+// sweep for eviction and a flusher thread for dirty pages.
+
+#include "pagecache.h"
+#include "thread.h"
+#include "timer.h"
+#include "mm.h"
+#include "klib.h"
+
+#define PC_FANOUT      (1u << PC_RADIX_BITS)
+#define PC_MASK        (PC_FANOUT - 1)
+#define PC_MAX_HEIGHT  11               // 66 bits of index
+#define PC_SHRINK      32               // pages evicted at a time
+
+#define PC_DIRTY       0x01
+#define PC_REFERENCED  0x02             // used since the clock hand passed
+#define PC_READING     0x04             // contents not there yet
+#define PC_WRITEBACK   0x08
+
+typedef struct PcPage PcPage;
+struct PcPage {
+    PcFile  *file;
+    uint64_t index;
+    void    *page;
+    uint8_t  flags;
+    PcPage  *prev, *next;               // clock ring
+};
+
+struct PcNode {
+    void    *slots[PC_FANOUT];          // PcNode, or PcPage at the bottom
+    uint32_t count;
+};
+
+static KmemCache *g_page_cache;
+static KmemCache *g_node_cache;
+static PcPage    *g_hand;               // clock ring, 0 when empty
+static PcFile    *g_dirty_files;
+static PcFile    *g_writing;            // the flusher is writing it back
+static PcStats    g_stats;
+
+// ---------------------------------------------------------------------
+// Radix tree
+// ---------------------------------------------------------------------
+
+static uint64_t max_index(uint32_t height) {
+    if (height * PC_RADIX_BITS >= 64) return ~0ull;
+    return (1ull << (height * PC_RADIX_BITS)) - 1;
+}
+
+static PcPage *tree_lookup(PcFile *f, uint64_t index) {
+    if (!f->root || index > max_index(f->height)) return 0;
+    PcNode *n = f->root;
+    for (uint32_t level = f->height - 1; level > 0; --level) {
+        n = (PcNode*)n->slots[(index >> (level * PC_RADIX_BITS)) & PC_MASK];
+        if (!n) return 0;
+    }
+    return (PcPage*)n->slots[index & PC_MASK];
+}
+
+static PcNode *node_alloc(void) {
+    PcNode *n = (PcNode*)kmem_cache_alloc(g_node_cache);
+    if (n) memset(n, 0, sizeof(PcNode));
+    return n;
+}
+
+static int tree_insert(PcFile *f, PcPage *p) {
+    while (!f->root || p->index > max_index(f->height)) {
+        PcNode *n = node_alloc();
+        if (!n) return -1;
+        if (f->root) {
+            n->slots[0] = f->root;
+            n->count    = 1;
+        }
+        f->root = n;
+        f->height++;
+    }
+    PcNode *n = f->root;
+    for (uint32_t level = f->height - 1; level > 0; --level) {
+        void **slot = &n->slots[(p->index >> (level * PC_RADIX_BITS)) & PC_MASK];
+        if (!*slot) {
+            if (!(*slot = node_alloc())) return -1;
+            n->count++;
+        }
+        n = (PcNode*)*slot;
+    }
+    n->slots[p->index & PC_MASK] = p;
+    n->count++;
+    return 0;
+}
+
+// Empty nodes go on the way back up.
+static void tree_delete(PcFile *f, uint64_t index) {
+    PcNode  *path[PC_MAX_HEIGHT];
+    uint32_t slots[PC_MAX_HEIGHT];
+    if (!f->root || index > max_index(f->height)) return;
+    PcNode *n = f->root;
+    for (uint32_t level = f->height - 1;; --level) {
+        path[level]  = n;
+        slots[level] = (index >> (level * PC_RADIX_BITS)) & PC_MASK;
+        if (!level) break;
+        if (!(n = (PcNode*)n->slots[slots[level]])) return;
+    }
+    path[0]->slots[slots[0]] = 0;
+    path[0]->count--;
+    for (uint32_t level = 0; level < f->height && !path[level]->count; ++level) {
+        kmem_cache_free(g_node_cache, path[level]);
+        if (level + 1 < f->height) {
+            path[level + 1]->slots[slots[level + 1]] = 0;
+            path[level + 1]->count--;
+        } else {
+            f->root   = 0;
+            f->height = 0;
+        }
+    }
+}
+
+// Up to max pages at index start and above, in index order.
+static uint32_t gang_node(PcNode *n, uint32_t level, uint64_t base, uint64_t start,
+                          PcPage **out, uint32_t max) {
+    uint32_t found = 0;
+    uint32_t shift = level * PC_RADIX_BITS;
+    for (uint32_t i = 0; i < PC_FANOUT && found < max; ++i) {
+        uint64_t first = base + ((uint64_t)i << shift);
+        uint64_t last  = first + (shift < 64 ? (1ull << shift) - 1 : ~0ull);
+        if (!n->slots[i] || last < start) continue;
+        if (level) {
+            found += gang_node((PcNode*)n->slots[i], level - 1, first, start,
+                               out + found, max - found);
+        } else {
+            out[found++] = (PcPage*)n->slots[i];
+        }
+    }
+    return found;
+}
+
+static void tree_free(PcNode *n, uint32_t level) {
+    for (uint32_t i = 0; level && i < PC_FANOUT; ++i) {
+        if (n->slots[i]) tree_free((PcNode*)n->slots[i], level - 1);
+    }
+    kmem_cache_free(g_node_cache, n);
+}
+
+static uint32_t tree_gang(PcFile *f, uint64_t start, PcPage **out, uint32_t max) {
+    if (!f->root) return 0;
+    return gang_node(f->root, f->height - 1, 0, start, out, max);
+}
+
+// ---------------------------------------------------------------------
+// Pages
+// ---------------------------------------------------------------------
+
+static uint64_t file_pages(const PcFile *f) {
+    return (f->size + PAGE_SIZE - 1) / PAGE_SIZE;
+}
+
+static void ring_add(PcPage *p) {
+    if (!g_hand) {
+        p->prev = p->next = p;
+        g_hand  = p;
+        return;
+    }
+    // Just behind the hand: the last the sweep gets to.
+    p->next = g_hand;
+    p->prev = g_hand->prev;
+    p->prev->next = p;
+    g_hand->prev  = p;
+}
+
+static void ring_remove(PcPage *p) {
+    if (p->next == p) {
+        g_hand = 0;
+        return;
+    }
+    if (g_hand == p) g_hand = p->next;
+    p->prev->next = p->next;
+    p->next->prev = p->prev;
+}
+
+static void dirty_list_remove(PcFile *f) {
+    for (PcFile **link = &g_dirty_files; *link; link = &(*link)->dirty_next) {
+        if (*link == f) {
+            *link = f->dirty_next;
+            break;
+        }
+    }
+    f->dirty_next = 0;
+}
+
+static void mark_dirty(PcPage *p) {
+    if (p->flags & PC_DIRTY) return;
+    PcFile *f = p->file;
+    p->flags |= PC_DIRTY;
+    g_stats.dirty++;
+    if (f->dirty++) return;
+    f->dirtied_ms  = time_ms();
+    f->dirty_next  = g_dirty_files;
+    g_dirty_files  = f;
+}
+
+static void clear_dirty(PcPage *p) {
+    if (!(p->flags & PC_DIRTY)) return;
+    p->flags &= (uint8_t)~PC_DIRTY;
+    g_stats.dirty--;
+    if (!--p->file->dirty) dirty_list_remove(p->file);
+}
+
+static void page_drop(PcPage *p) {
+    PcFile *f = p->file;
+    clear_dirty(p);
+    tree_delete(f, p->index);
+    ring_remove(p);
+    page_put(p->page);
+    kmem_cache_free(g_page_cache, p);
+    f->pages--;
+    g_stats.pages--;
+}
+
+static int evictable(const PcPage *p) {
+    if (p->flags & (PC_DIRTY | PC_READING | PC_WRITEBACK)) return 0;
+    PageFrame *pf = virt_to_page(p->page);
+    return !pf || pf->refcount <= 1;    // nobody has it mapped
+}
+
+uint32_t pc_shrink(uint32_t count) {
+    uint32_t freed = 0;
+    // Twice round at most: the first pass may only clear reference bits.
+    uint64_t budget = 2 * g_stats.pages;
+    while (freed < count && g_hand && budget--) {
+        PcPage *p = g_hand;
+        g_hand = p->next;
+        if (!evictable(p)) continue;
+        if (p->flags & PC_REFERENCED) {
+            p->flags &= (uint8_t)~PC_REFERENCED;
+            continue;
+        }
+        page_drop(p);
+        g_stats.evicted++;
+        freed++;
+    }
+    return freed;
+}
+
+// A new page at index, not in the tree yet. Over the limit, older pages
+// make room first.
+static PcPage *page_new(PcFile *f, uint64_t index) {
+    if (g_stats.pages >= g_stats.limit) pc_shrink(PC_SHRINK);
+    void *page = page_alloc(0);
+    if (!page && pc_shrink(PC_SHRINK)) page = page_alloc(0);
+    if (!page) return 0;
+    PcPage *p = (PcPage*)kmem_cache_alloc(g_page_cache);
+    if (!p) {
+        page_free(page, 0);
+        return 0;
+    }
+    p->file  = f;
+    p->index = index;
+    p->page  = page;
+    p->flags = 0;
+    if (tree_insert(f, p) < 0) {
+        kmem_cache_free(g_page_cache, p);
+        page_free(page, 0);
+        return 0;
+    }
+    ring_add(p);
+    f->pages++;
+    g_stats.pages++;
+    return p;
+}
+
+// ---------------------------------------------------------------------
+// Reading
+// ---------------------------------------------------------------------
+
+// The page at index once any read of it has finished; 0 if not cached.
+static PcPage *lookup_ready(PcFile *f, uint64_t index) {
+    PcPage *p;
+    while ((p = tree_lookup(f, index)) != 0 && (p->flags & PC_READING)) thread_yield();
+    return p;
+}
+
+// Reads the first run of uncached pages in [start, start + count) in one
+// request. asked: whether the page at start was wanted now (the rest are
+// readahead). Returns the pages read, or -1.
+static int read_run(PcFile *f, uint64_t start, uint32_t count, int asked) {
+    PcPage *run[PC_RUN_MAX];
+    void   *pages[PC_RUN_MAX];
+    uint64_t end = file_pages(f);
+    if (count > PC_RUN_MAX) count = PC_RUN_MAX;
+    if (end > start + count) end = start + count;
+    while (start < end && tree_lookup(f, start)) {
+        start++;
+        asked = 0;
+    }
+
+    uint32_t n = 0;
+    while (start + n < end && !tree_lookup(f, start + n)) {
+        PcPage *p = page_new(f, start + n);
+        if (!p) break;
+        p->flags = PC_READING;
+        run[n]   = p;
+        pages[n] = p->page;
+        n++;
+    }
+    if (start + n > f->ra_next) f->ra_next = start + n;
+    if (!n) return 0;
+
+    int rc = f->ops->read(f->ctx, start, pages, n);
+    g_stats.read_requests++;
+    for (uint32_t i = 0; i < n; ++i) {
+        run[i]->flags &= (uint8_t)~PC_READING;
+        if (rc < 0) page_drop(run[i]);
+    }
+    if (rc < 0) return -1;
+    g_stats.readahead += n - (asked ? 1 : 0);
+    return (int)n;
+}
+
+static void ra_grow(PcFile *f) {
+    f->ra_window = f->ra_window ? f->ra_window * 2 : PC_RA_MIN;
+    if (f->ra_window > PC_RA_MAX) f->ra_window = PC_RA_MAX;
+}
+
+// The cached page at index, read in if need be. A read right after the
+// previous page's is sequential: the window doubles, and the next window
+// is read as soon as the reader is half way through the last one.
+static PcPage *page_find(PcFile *f, uint64_t index) {
+    if (index >= file_pages(f)) return 0;
+    int sequential = index == f->ra_last;
+    f->ra_last = index + 1;
+
+    PcPage *p = lookup_ready(f, index);
+    if (p) {
+        g_stats.hits++;
+        if (sequential && index + f->ra_window / 2 >= f->ra_next) {
+            ra_grow(f);
+            read_run(f, f->ra_next, f->ra_window, 0);
+            p = lookup_ready(f, index);         // it may have gone meanwhile
+        }
+    } else {
+        g_stats.misses++;
+        if (sequential) {
+            ra_grow(f);
+        } else {
+            f->ra_window = 0;
+        }
+    }
+    if (!p) {
+        if (read_run(f, index, 1 + f->ra_window, 1) < 0) return 0;
+        p = lookup_ready(f, index);
+    }
+    if (p) p->flags |= PC_REFERENCED;
+    return p;
+}
+
+int pc_read(PcFile *f, uint64_t pos, void *buf, uint32_t len) {
+    if (pos >= f->size) return 0;
+    if (len > f->size - pos) len = (uint32_t)(f->size - pos);
+    uint32_t done = 0;
+    while (done < len) {
+        PcPage *p = page_find(f, (pos + done) / PAGE_SIZE);
+        if (!p) return done ? (int)done : -1;
+        uint32_t off = (uint32_t)((pos + done) % PAGE_SIZE);
+        uint32_t n   = PAGE_SIZE - off < len - done ? PAGE_SIZE - off : len - done;
+        memcpy((uint8_t*)buf + done, (uint8_t*)p->page + off, n);
+        done += n;
+    }
+    return (int)done;
+}
+
+void *pc_page(PcFile *f, uint64_t index) {
+    PcPage *p = page_find(f, index);
+    if (!p) return 0;
+    page_get(p->page);
+    return p->page;
+}
+
+// ---------------------------------------------------------------------
+// Writing
+// ---------------------------------------------------------------------
+
+int pc_write(PcFile *f, uint64_t pos, const void *data, uint32_t len) {
+    if (!f->ops->write) return -1;
+    if (pos >= f->size) return 0;
+    if (len > f->size - pos) len = (uint32_t)(f->size - pos);
+    uint32_t done = 0;
+    while (done < len) {
+        uint64_t index = (pos + done) / PAGE_SIZE;
+        uint32_t off   = (uint32_t)((pos + done) % PAGE_SIZE);
+        uint32_t n     = PAGE_SIZE - off < len - done ? PAGE_SIZE - off : len - done;
+        // A page written whole (or up to the end) isn't read first.
+        PcPage *p = lookup_ready(f, index);
+        if (!p && !off && (n == PAGE_SIZE || pos + done + n == f->size)) {
+            if ((p = page_new(f, index)) != 0) memset(p->page, 0, PAGE_SIZE);
+        } else if (!p) {
+            p = page_find(f, index);
+        }
+        if (!p) return done ? (int)done : -1;
+        memcpy((uint8_t*)p->page + off, (const uint8_t*)data + done, n);
+        p->flags |= PC_REFERENCED;
+        mark_dirty(p);
+        done += n;
+    }
+    return (int)done;
+}
+
+// Runs of consecutive dirty pages, each in one request. A page written
+// again meanwhile is dirty again; one that fails stays dirty.
+static int writeback(PcFile *f) {
+    PcPage  *found[PC_RUN_MAX];
+    void    *pages[PC_RUN_MAX];
+    uint64_t start = 0;
+    int      rc    = 0;
+    for (;;) {
+        uint32_t n = tree_gang(f, start, found, PC_RUN_MAX);
+        if (!n) break;
+        uint32_t i = 0;
+        while (i < n && !(found[i]->flags & PC_DIRTY)) ++i;
+        if (i == n) {
+            start = found[n - 1]->index + 1;
+            continue;
+        }
+        if (i) {
+            start = found[i]->index;    // again, so the run can be full size
+            continue;
+        }
+        uint32_t run = 1;
+        while (run < n && found[run]->index == found[0]->index + run &&
+               (found[run]->flags & PC_DIRTY)) {
+            ++run;
+        }
+        for (uint32_t k = 0; k < run; ++k) {
+            clear_dirty(found[k]);
+            found[k]->flags |= PC_WRITEBACK;
+            pages[k] = found[k]->page;
+        }
+        int r = f->ops->write(f->ctx, found[0]->index, pages, run);
+        g_stats.write_requests++;
+        for (uint32_t k = 0; k < run; ++k) {
+            found[k]->flags &= (uint8_t)~PC_WRITEBACK;
+            if (r < 0) mark_dirty(found[k]);
+        }
+        if (r < 0) {
+            rc = -1;
+        } else {
+            g_stats.pages_written += run;
+        }
+        start = found[0]->index + run;
+    }
+    return rc;
+}
+
+int pc_sync(PcFile *f) {
+    if (f) return f->dirty ? writeback(f) : 0;
+    // Each file once: one that fails goes back on the list, and the list
+    // changes while writeback() waits for the disk.
+    static uint32_t pass;
+    int rc = 0;
+    ++pass;
+    for (;;) {
+        PcFile *d = g_dirty_files;
+        while (d && d->sync_pass == pass) d = d->dirty_next;
+        if (!d) break;
+        d->sync_pass = pass;
+        if (writeback(d) < 0) rc = -1;
+    }
+    return rc;
+}
+
+// Writes back whatever has waited long enough, or everything once too
+// much is waiting. Runs for good; the main loop yields to it (pc_poll()).
+static void flusher(void *arg) {
+    (void)arg;
+    for (;;) {
+        PcFile  *due = 0;
+        uint64_t now = time_ms();
+        for (PcFile *f = g_dirty_files; f && !due; f = f->dirty_next) {
+            if (g_stats.dirty > PC_DIRTY_MAX || now - f->dirtied_ms >= PC_DIRTY_MS) due = f;
+        }
+        if (due) {
+            g_writing = due;
+            if (writeback(due) < 0 && due->dirty) due->dirtied_ms = time_ms();
+            g_writing = 0;
+        }
+        thread_yield();
+    }
+}
+
+void pc_poll(void) {
+    if (g_stats.dirty) thread_yield();
+}
+
+// ---------------------------------------------------------------------
+// Files
+// ---------------------------------------------------------------------
+
+void pc_file_init(PcFile *f, const PcOps *ops, void *ctx, uint64_t size) {
+    memset(f, 0, sizeof(PcFile));
+    f->ops  = ops;
+    f->ctx  = ctx;
+    f->size = size;
+}
+
+// Drops pages (dirty ones too, if asked), waiting out I/O in flight.
+static void drop_pages(PcFile *f, int dirty) {
+    int busy;
+    do {
+        PcPage  *found[PC_RUN_MAX];
+        uint64_t start = 0;
+        uint32_t n;
+        busy = 0;
+        while ((n = tree_gang(f, start, found, PC_RUN_MAX)) != 0) {
+            start = found[n - 1]->index + 1;
+            for (uint32_t i = 0; i < n; ++i) {
+                PcPage *p = found[i];
+                if (p->flags & (PC_READING | PC_WRITEBACK)) {
+                    busy = 1;
+                } else if (dirty || !(p->flags & PC_DIRTY)) {
+                    page_drop(p);
+                }
+            }
+        }
+        if (busy) thread_yield();
+    } while (busy);
+}
+
+void pc_invalidate(PcFile *f) {
+    drop_pages(f, 0);
+    f->ra_last   = 0;
+    f->ra_next   = 0;
+    f->ra_window = 0;
+}
+
+void pc_file_release(PcFile *f) {
+    while (g_writing == f) thread_yield();
+    pc_sync(f);
+    drop_pages(f, 1);
+    // Only empty nodes a failed insert left behind can be there.
+    if (f->root) tree_free(f->root, f->height - 1);
+    f->root   = 0;
+    f->height = 0;
+}
+
+// ---------------------------------------------------------------------
+// Setup
+// ---------------------------------------------------------------------
+
+void pc_stats(PcStats *out) {
+    *out = g_stats;
+}
+
+void pc_init(void) {
+    g_page_cache  = kmem_cache_create("pcpage", sizeof(PcPage), 8);
+    g_node_cache  = kmem_cache_create("pcnode", sizeof(PcNode), 8);
+    g_stats.limit = mm_total_pages() / 4;
+    thread_create(flusher, 0, "flush");
+}
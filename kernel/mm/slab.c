@@ -0,0 +1,399 @@
+// kernel/mm/slab.c
+// Slab caches for fixed-size objects, per-CPU magazines in front of them,
+// and kmalloc()/kfree() on top.
+//
+// A slab is a small run of pages carved into equal objects. Free objects are
+// chained through their first word. Each cache keeps its slabs on three lists
+// (partial, full, one spare empty slab) so alloc/free are O(1). The magazine
+// layer is described in mm.h.
+
+#include "mm.h"
+#include "smp.h"
+#include "io.h"
+#include "klib.h"
+
+typedef struct Magazine Magazine;
+struct Magazine {
+    Magazine *next;             // on a depot list
+    uint32_t  rounds;           // objects in it
+    void     *objs[KMEM_MAG_ROUNDS];
+};
+
+// One CPU's view of a cache, on cache lines of its own.
+typedef struct {
+    Magazine *loaded;
+    Magazine *previous;         // empty or full, never in between
+    uint64_t  allocs;
+    uint64_t  frees;
+    uint64_t  remote_frees;
+} __attribute__((aligned(64))) KmemCpu;
+
+struct KmemCache {
+    const char *name;
+    uint32_t    obj_size;
+    uint32_t    order;          // pages per slab = 1 << order
+    uint32_t    objs_per_slab;
+    int         magazines;      // 0 for the magazines' own cache
+    SpinLock    lock;           // the slab lists and counts
+    PageFrame  *partial;
+    PageFrame  *full;
+    PageFrame  *empty;          // at most one cached empty slab
+    uint64_t    slab_ops;
+    uint64_t    slabs;
+    SpinLock    depot_lock;
+    Magazine   *depot_full;
+    Magazine   *depot_empty;
+    uint32_t    depot_count;    // full ones
+    uint64_t    depot_trades;
+    KmemCpu     cpu[SMP_MAX_CPUS];
+};
+
+#define MAX_CACHES 32
+
+static KmemCache  g_caches[MAX_CACHES];
+static int        g_cache_count = 0;
+static SpinLock   g_create_lock;
+static KmemCache *g_magazine_cache;
+
+// ---------------------------------------------------------------------
+// Slab list helpers
+// ---------------------------------------------------------------------
+
+static void slab_push(PageFrame **list, PageFrame *pf) {
+    pf->prev = 0;
+    pf->next = *list;
+    if (pf->next) pf->next->prev = pf;
+    *list = pf;
+}
+
+static void slab_remove(PageFrame **list, PageFrame *pf) {
+    if (pf->prev) pf->prev->next = pf->next;
+    else          *list = pf->next;
+    if (pf->next) pf->next->prev = pf->prev;
+    pf->next = 0;
+    pf->prev = 0;
+}
+
+static PageFrame *slab_new(KmemCache *c) {
+    uint8_t *mem = (uint8_t *)page_alloc(c->order);
+    if (!mem) return 0;
+
+    PageFrame *head  = virt_to_page(mem);
+    uint32_t   pages = 1u << c->order;
+    for (uint32_t i = 0; i < pages; ++i) {
+        head[i].flags = PG_SLAB;
+        head[i].owner = c;
+        head[i].head  = head;
+    }
+    head->order = (uint8_t)c->order;
+    head->cpu   = (uint8_t)smp_cpu_id();
+    head->inuse = 0;
+
+    // Thread the free list through the objects, lowest address first.
+    void **prev = &head->freelist;
+    for (uint32_t i = 0; i < c->objs_per_slab; ++i) {
+        void *obj = mem + (uint64_t)i * c->obj_size;
+        *prev = obj;
+        prev  = (void **)obj;
+    }
+    *prev = 0;
+
+    c->slabs++;
+    return head;
+}
+
+static void slab_release(KmemCache *c, PageFrame *head) {
+    uint32_t pages = 1u << c->order;
+    for (uint32_t i = 0; i < pages; ++i) {
+        head[i].flags = 0;
+        head[i].owner = 0;
+        head[i].head  = 0;
+    }
+    c->slabs--;
+    page_free(page_to_virt(head), c->order);
+}
+
+// ---------------------------------------------------------------------
+// Slabs
+// ---------------------------------------------------------------------
+
+static void *slab_alloc(KmemCache *c) {
+    spin_lock(&c->lock);
+    PageFrame *slab = c->partial;
+    if (!slab) {
+        slab = c->empty;
+        if (slab) {
+            c->empty = 0;
+        } else {
+            slab = slab_new(c);
+            if (!slab) {
+                spin_unlock(&c->lock);
+                return 0;
+            }
+        }
+        slab_push(&c->partial, slab);
+    }
+
+    void *obj = slab->freelist;
+    slab->freelist = *(void **)obj;
+    slab->inuse++;
+    if (!slab->freelist) {
+        slab_remove(&c->partial, slab);
+        slab_push(&c->full, slab);
+    }
+    c->slab_ops++;
+    spin_unlock(&c->lock);
+    return obj;
+}
+
+static void slab_free(KmemCache *c, void *obj) {
+    spin_lock(&c->lock);
+    PageFrame *slab = virt_to_page(obj)->head;
+    if (!slab->freelist) {
+        slab_remove(&c->full, slab);
+        slab_push(&c->partial, slab);
+    }
+    *(void **)obj  = slab->freelist;
+    slab->freelist = obj;
+    slab->inuse--;
+    c->slab_ops++;
+
+    if (slab->inuse == 0) {
+        slab_remove(&c->partial, slab);
+        if (!c->empty) {
+            c->empty = slab;
+        } else {
+            slab_release(c, slab);
+        }
+    }
+    spin_unlock(&c->lock);
+}
+
+// ---------------------------------------------------------------------
+// Caches
+// ---------------------------------------------------------------------
+
+// With g_create_lock held; the first also makes the magazines' cache.
+static KmemCache *cache_create(const char *name, uint32_t size, uint32_t align,
+                               int magazines) {
+    if (magazines && !g_magazine_cache) {
+        g_magazine_cache = cache_create("magazine", sizeof(Magazine), 64, 0);
+        if (!g_magazine_cache) return 0;
+    }
+    if (g_cache_count >= MAX_CACHES || size == 0) return 0;
+    if (align < sizeof(void *)) align = sizeof(void *);
+    if (size < sizeof(void *))  size  = sizeof(void *);
+    size = (size + align - 1) & ~(align - 1);
+
+    KmemCache *c = &g_caches[g_cache_count++];
+    memset(c, 0, sizeof(*c));
+    c->name      = name;
+    c->obj_size  = size;
+    c->magazines = magazines;
+
+    // Grow the slab until it holds at least 8 objects, so small caches use a
+    // single page and big objects do not waste most of a slab on slack.
+    c->order = 0;
+    while (((PAGE_SIZE << c->order) / size) < 8 && c->order < 4) {
+        c->order++;
+    }
+    c->objs_per_slab = (PAGE_SIZE << c->order) / size;
+    return c;
+}
+
+KmemCache *kmem_cache_create(const char *name, uint32_t size, uint32_t align) {
+    spin_lock(&g_create_lock);
+    KmemCache *c = cache_create(name, size, align, 1);
+    spin_unlock(&g_create_lock);
+    return c;
+}
+
+// ---------------------------------------------------------------------
+// Magazines
+// ---------------------------------------------------------------------
+
+static void magazine_swap(KmemCpu *cc) {
+    Magazine *m  = cc->loaded;
+    cc->loaded   = cc->previous;
+    cc->previous = m;
+}
+
+void *kmem_cache_alloc(KmemCache *c) {
+    if (!c) return 0;
+    if (!c->magazines) return slab_alloc(c);
+
+    KmemCpu *cc = &c->cpu[smp_cpu_id()];
+    cc->allocs++;
+    for (;;) {
+        if (cc->loaded && cc->loaded->rounds) {
+            Magazine *m = cc->loaded;
+            return m->objs[--m->rounds];
+        }
+        if (cc->previous && cc->previous->rounds) {
+            magazine_swap(cc);
+            continue;
+        }
+        // Both empty: trade the previous one for a full one, if the depot
+        // has any.
+        spin_lock(&c->depot_lock);
+        Magazine *full = c->depot_full;
+        if (full) {
+            c->depot_full = full->next;
+            c->depot_count--;
+            c->depot_trades++;
+            if (cc->previous) {
+                cc->previous->next = c->depot_empty;
+                c->depot_empty     = cc->previous;
+            }
+        }
+        spin_unlock(&c->depot_lock);
+        if (!full) return slab_alloc(c);
+        cc->previous = cc->loaded;
+        cc->loaded   = full;
+    }
+}
+
+// Hands every object in m back to the slabs.
+static void magazine_drain(KmemCache *c, Magazine *m) {
+    while (m->rounds) slab_free(c, m->objs[--m->rounds]);
+}
+
+void kmem_cache_free(KmemCache *c, void *obj) {
+    if (!c || !obj) return;
+    PageFrame *pf = virt_to_page(obj);
+    if (!pf || !(pf->flags & PG_SLAB) || pf->owner != c) return;
+    if (!c->magazines) {
+        slab_free(c, obj);
+        return;
+    }
+
+    int      cpu = smp_cpu_id();
+    KmemCpu *cc  = &c->cpu[cpu];
+    cc->frees++;
+    if (pf->head->cpu != cpu) cc->remote_frees++;
+    for (;;) {
+        if (cc->loaded && cc->loaded->rounds < KMEM_MAG_ROUNDS) {
+            Magazine *m = cc->loaded;
+            m->objs[m->rounds++] = obj;
+            return;
+        }
+        if (cc->previous && cc->previous->rounds < KMEM_MAG_ROUNDS) {
+            magazine_swap(cc);
+            continue;
+        }
+        // Both full (or not there yet): the previous one goes to the depot,
+        // or back into the slabs if the depot has enough, and an empty one
+        // takes its place.
+        Magazine *spill = 0;
+        spin_lock(&c->depot_lock);
+        if (cc->previous) {
+            if (c->depot_count < KMEM_DEPOT_MAX) {
+                cc->previous->next = c->depot_full;
+                c->depot_full      = cc->previous;
+                c->depot_count++;
+            } else {
+                spill = cc->previous;
+            }
+            cc->previous = 0;
+            c->depot_trades++;
+        }
+        Magazine *empty = c->depot_empty;
+        if (empty) c->depot_empty = empty->next;
+        spin_unlock(&c->depot_lock);
+
+        if (spill) {
+            magazine_drain(c, spill);
+            if (!empty) empty = spill;
+            else        kmem_cache_free(g_magazine_cache, spill);
+        }
+        if (!empty) empty = (Magazine*)kmem_cache_alloc(g_magazine_cache);
+        if (!empty) {
+            // No memory for a magazine: straight to the slab.
+            slab_free(c, obj);
+            return;
+        }
+        empty->rounds = 0;
+        cc->previous  = cc->loaded;
+        cc->loaded    = empty;
+    }
+}
+
+// Read on the boot CPU with no jobs running, so no locks.
+void kmem_stats(KmemStats *out) {
+    memset(out, 0, sizeof(*out));
+    for (int i = 0; i < g_cache_count; ++i) {
+        const KmemCache *c = &g_caches[i];
+        out->slab_ops     += c->slab_ops;
+        out->depot_trades += c->depot_trades;
+        out->slabs        += c->slabs;
+        if (!c->magazines) continue;
+        for (int cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+            out->allocs       += c->cpu[cpu].allocs;
+            out->frees        += c->cpu[cpu].frees;
+            out->remote_frees += c->cpu[cpu].remote_frees;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------
+// kmalloc size classes
+// ---------------------------------------------------------------------
+
+static const uint32_t g_kmalloc_sizes[] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
+#define KMALLOC_CLASSES (sizeof(g_kmalloc_sizes) / sizeof(g_kmalloc_sizes[0]))
+#define KMALLOC_MAX     2048u
+
+static KmemCache *g_kmalloc_caches[KMALLOC_CLASSES];
+
+// Made on first use, which may be on two CPUs at once.
+static KmemCache *kmalloc_cache_for(size_t size) {
+    for (uint32_t i = 0; i < KMALLOC_CLASSES; ++i) {
+        if (size > g_kmalloc_sizes[i]) continue;
+        KmemCache *c = __atomic_load_n(&g_kmalloc_caches[i], __ATOMIC_ACQUIRE);
+        if (c) return c;
+        spin_lock(&g_create_lock);
+        c = g_kmalloc_caches[i];
+        if (!c) {
+            c = cache_create("kmalloc", g_kmalloc_sizes[i],
+                             g_kmalloc_sizes[i] < 64 ? g_kmalloc_sizes[i] : 64, 1);
+            __atomic_store_n(&g_kmalloc_caches[i], c, __ATOMIC_RELEASE);
+        }
+        spin_unlock(&g_create_lock);
+        return c;
+    }
+    return 0;
+}
+
+void *kmalloc(size_t size) {
+    if (size == 0) return 0;
+    if (size <= KMALLOC_MAX) {
+        return kmem_cache_alloc(kmalloc_cache_for(size));
+    }
+
+    uint32_t order = page_order_for(size);
+    void    *p     = page_alloc(order);
+    if (p) {
+        PageFrame *pf = virt_to_page(p);
+        pf->flags = PG_LARGE;
+        pf->order = (uint8_t)order;
+    }
+    return p;
+}
+
+void *kzalloc(size_t size) {
+    void *p = kmalloc(size);
+    if (p) memset(p, 0, size);
+    return p;
+}
+
+void kfree(void *p) {
+    if (!p) return;
+    PageFrame *pf = virt_to_page(p);
+    if (!pf) return;
+    if (pf->flags & PG_SLAB) {
+        kmem_cache_free((KmemCache *)pf->owner, p);
+    } else if (pf->flags & PG_LARGE) {
+        pf->flags = 0;
+        page_free(p, pf->order);
+    }
+}
@@ -0,0 +1,530 @@
+// kernel/mm/vm.c
+// Per-process page tables over the boot PML4, PCID tags, regions with
+// demand paging and copy-on-write, and user-memory copies through the
+// identity map.
+
+#include "vm.h"
+#include "cpu.h"
+#include "mm.h"
+#include "io.h"
+#include "klib.h"
+
+#define PTE_P       (1ull << 0)
+#define PTE_W       (1ull << 1)
+#define PTE_U       (1ull << 2)
+#define PTE_COW     (1ull << 9)     // software: shared, copy on write
+#define PTE_SHARED  (1ull << 10)    // software: VM_SHARED, written in place
+#define PTE_NX      (1ull << 63)
+#define PTE_ADDR    0x000FFFFFFFFFF000ull
+
+#define USER_SLOT   255
+#define MSR_EFER    0xC0000080
+#define EFER_NXE    (1ull << 11)
+#define CR4_PCIDE   (1ull << 17)
+#define CR3_NOFLUSH (1ull << 63)
+#define PCID_COUNT  4096
+
+static uint64_t *g_boot_pml4;
+static uint64_t  g_kernel_cr3;
+static uint64_t  g_loaded;          // last CR3 vm_activate() loaded
+static int       g_pcid;
+static uint64_t  g_nx;              // PTE_NX if EFER.NXE is on
+static uint8_t   g_pcid_used[PCID_COUNT / 8];
+static uint32_t  g_pcid_next = 1;   // 0 is the kernel's
+static VmStats   g_stats;
+
+int vm_init(void) {
+    uint64_t cr3 = read_cr3();
+    g_boot_pml4 = (uint64_t*)(uintptr_t)(cr3 & PTE_ADDR);
+    if (g_boot_pml4[USER_SLOT] & PTE_P) return -1;
+
+    if (rdmsr(MSR_EFER) & EFER_NXE) g_nx = PTE_NX;
+
+    // CR4.PCIDE can only be set while the current PCID is 0.
+    uint32_t r[4];
+    cpuid(1, 0, r);
+    if ((r[2] & (1u << 17)) && !(cr3 & 0xFFF)) {
+        uint64_t cr4;
+        __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+        __asm__ volatile("mov %0, %%cr4" : : "r"(cr4 | CR4_PCIDE));
+        g_pcid = 1;
+    }
+    g_kernel_cr3 = (cr3 & PTE_ADDR) | (g_pcid ? CR3_NOFLUSH : 0);
+    g_loaded     = g_kernel_cr3;
+    return 0;
+}
+
+int vm_pcid_enabled(void) {
+    return g_pcid;
+}
+
+void vm_stats(VmStats *out) {
+    *out = g_stats;
+}
+
+static uint16_t pcid_alloc(void) {
+    for (uint32_t n = 1; n < PCID_COUNT; ++n) {
+        uint32_t id = g_pcid_next;
+        g_pcid_next = id + 1 < PCID_COUNT ? id + 1 : 1;
+        if (!(g_pcid_used[id / 8] & (1u << (id % 8)))) {
+            g_pcid_used[id / 8] |= (uint8_t)(1u << (id % 8));
+            return (uint16_t)id;
+        }
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------
+// TLB
+// ---------------------------------------------------------------------
+
+static int loaded(const AddressSpace *as) {
+    return (as->cr3 | CR3_NOFLUSH) == (g_loaded | CR3_NOFLUSH);
+}
+
+// Translations of as that were taken away or made read-only go: now if it
+// is loaded, else when it next is.
+static void tlb_flush(AddressSpace *as) {
+    if (loaded(as)) {
+        write_cr3(as->cr3 & ~CR3_NOFLUSH);
+    } else if (as->pcid) {
+        as->cr3 &= ~CR3_NOFLUSH;
+    }
+}
+
+static void tlb_flush_page(AddressSpace *as, uint64_t va) {
+    if (loaded(as)) {
+        invlpg(va);
+    } else if (as->pcid) {
+        as->cr3 &= ~CR3_NOFLUSH;
+    }
+}
+
+void vm_activate(AddressSpace *as) {
+    uint64_t cr3 = as ? as->cr3 : g_kernel_cr3;
+    if (cr3 == g_loaded) return;
+    write_cr3(cr3);
+    if (as && as->pcid) {
+        // A pending flush (see tlb_flush()) has just happened.
+        as->cr3 = cr3 | CR3_NOFLUSH;
+    }
+    g_loaded = as ? as->cr3 : cr3;
+}
+
+// ---------------------------------------------------------------------
+// Page tables
+// ---------------------------------------------------------------------
+
+static int user_range(uint64_t va, uint64_t len) {
+    return va >= USER_BASE && va < USER_TOP && len <= USER_TOP - va;
+}
+
+static void *pte_page(uint64_t pte) {
+    return (void*)(uintptr_t)(pte & PTE_ADDR);
+}
+
+// The PTE for va, making the tables on the way if create is set.
+static uint64_t *pte_find(AddressSpace *as, uint64_t va, int create) {
+    uint64_t *table = as->pml4;
+    for (int shift = 39; shift > 12; shift -= 9) {
+        uint64_t *e = &table[(va >> shift) & 511];
+        if (!(*e & PTE_P)) {
+            if (!create) return 0;
+            void *page = page_alloc(0);
+            if (!page) return 0;
+            memset(page, 0, PAGE_SIZE);
+            *e = (uint64_t)(uintptr_t)page | PTE_P | PTE_W | PTE_U;
+        }
+        table = (uint64_t*)pte_page(*e);
+    }
+    return &table[(va >> 12) & 511];
+}
+
+static uint64_t pte_bits(uint32_t flags) {
+    uint64_t bits = PTE_P | PTE_U;
+    if (flags & VM_WRITE)    bits |= PTE_W;
+    if (!(flags & VM_EXEC))  bits |= g_nx;
+    return bits;
+}
+
+static void free_table(uint64_t *table, int level) {
+    for (int i = 0; i < 512; ++i) {
+        uint64_t e = table[i];
+        if (!(e & PTE_P)) continue;
+        if (level > 1) {
+            free_table((uint64_t*)pte_page(e), level - 1);
+        } else {
+            page_put(pte_page(e));
+        }
+    }
+    page_free(table, 0);
+}
+
+// ---------------------------------------------------------------------
+// Regions
+// ---------------------------------------------------------------------
+
+static VmRegion *region_find(AddressSpace *as, uint64_t va) {
+    for (VmRegion *r = as->regions; r && r->start <= va; r = r->next) {
+        if (va < r->end) return r;
+    }
+    return 0;
+}
+
+static void region_free(VmRegion *r) {
+    if (r->pager) r->pager->close(r->pager->ctx, r->file);
+    kfree(r);
+}
+
+static int region_mergeable(const VmRegion *a, const VmRegion *b) {
+    return a->end == b->start && !a->pager && !b->pager && a->flags == b->flags;
+}
+
+// Sorted in, merged with anonymous neighbours of the same kind.
+static void region_insert(AddressSpace *as, VmRegion *r) {
+    VmRegion **link = &as->regions;
+    VmRegion  *prev = 0;
+    while (*link && (*link)->start < r->start) {
+        prev = *link;
+        link = &(*link)->next;
+    }
+    r->next = *link;
+    *link   = r;
+    if (r->next && region_mergeable(r, r->next)) {
+        VmRegion *n = r->next;
+        r->end  = n->end;
+        r->next = n->next;
+        region_free(n);
+    }
+    if (prev && region_mergeable(prev, r)) {
+        prev->end  = r->end;
+        prev->next = r->next;
+        region_free(r);
+    }
+}
+
+int vm_range_free(AddressSpace *as, uint64_t va, uint64_t len) {
+    for (VmRegion *r = as->regions; r && r->start < va + len; r = r->next) {
+        if (r->end > va) return 0;
+    }
+    return 1;
+}
+
+int vm_reserve(AddressSpace *as, uint64_t va, uint64_t len, uint32_t flags,
+               const VmPager *pager, void *file, uint64_t offset) {
+    if ((va | len | offset) & (PAGE_SIZE - 1) || !len || !user_range(va, len)) return -1;
+    if (!vm_range_free(as, va, len)) return -1;
+    VmRegion *r = (VmRegion*)kzalloc(sizeof(VmRegion));
+    if (!r) return -1;
+    r->start  = va;
+    r->end    = va + len;
+    r->flags  = flags;
+    r->pager  = pager;
+    r->file   = file;
+    r->offset = offset;
+    region_insert(as, r);
+    return 0;
+}
+
+// Cuts [start, end) out of every region; one with a hole in the middle
+// becomes two. -1 if the second half's file can't be duplicated: that
+// region is left whole.
+static int region_cut(AddressSpace *as, uint64_t start, uint64_t end) {
+    VmRegion **link = &as->regions;
+    while (*link) {
+        VmRegion *r = *link;
+        if (r->end <= start || r->start >= end) {
+            link = &r->next;
+            continue;
+        }
+        if (r->start >= start && r->end <= end) {
+            *link = r->next;
+            region_free(r);
+            continue;
+        }
+        if (r->start < start && r->end > end) {
+            VmRegion *tail = (VmRegion*)kzalloc(sizeof(VmRegion));
+            if (!tail) return -1;
+            *tail = *r;
+            if (r->pager && !(tail->file = r->pager->dup(r->pager->ctx, r->file))) {
+                kfree(tail);
+                return -1;
+            }
+            tail->start   = end;
+            tail->offset += end - r->start;
+            r->end        = start;
+            r->next       = tail;
+            return 0;
+        }
+        if (r->start < start) {
+            r->end = start;
+        } else {
+            r->offset += end - r->start;
+            r->start   = end;
+        }
+        link = &r->next;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------
+// Address spaces
+// ---------------------------------------------------------------------
+
+AddressSpace *vm_create(void) {
+    AddressSpace *as = (AddressSpace*)kzalloc(sizeof(AddressSpace));
+    if (!as) return 0;
+    as->pml4 = (uint64_t*)page_alloc(0);
+    if (!as->pml4) {
+        kfree(as);
+        return 0;
+    }
+    memcpy(as->pml4, g_boot_pml4, PAGE_SIZE);
+    as->pml4[USER_SLOT] = 0;
+
+    uint64_t table = (uint64_t)(uintptr_t)as->pml4;
+    as->cr3 = table;
+    if (g_pcid && (as->pcid = pcid_alloc()) != 0) {
+        // Whatever a dead address space left under this PCID goes: load it
+        // once with a flush, then put back what was loaded.
+        write_cr3(table | as->pcid);
+        write_cr3(g_loaded);
+        as->cr3 = table | as->pcid | CR3_NOFLUSH;
+    }
+    return as;
+}
+
+void vm_destroy(AddressSpace *as) {
+    if (!as) return;
+    while (as->regions) {
+        VmRegion *r = as->regions;
+        as->regions = r->next;
+        region_free(r);
+    }
+    if (as->pml4[USER_SLOT] & PTE_P) {
+        free_table((uint64_t*)pte_page(as->pml4[USER_SLOT]), 3);
+    }
+    page_free(as->pml4, 0);
+    if (as->pcid) g_pcid_used[as->pcid / 8] &= (uint8_t)~(1u << (as->pcid % 8));
+    kfree(as);
+}
+
+// Shares every present page of src with dst, both read-only from now on
+// where src could write. -1 if dst runs out of page tables; what was
+// shared by then stays shared, which is harmless.
+static int clone_pages(AddressSpace *src, AddressSpace *dst) {
+    uint64_t l4 = src->pml4[USER_SLOT];
+    if (!(l4 & PTE_P)) return 0;
+    uint64_t *l3 = (uint64_t*)pte_page(l4);
+    for (uint64_t i = 0; i < 512; ++i) {
+        if (!(l3[i] & PTE_P)) continue;
+        uint64_t *l2 = (uint64_t*)pte_page(l3[i]);
+        for (uint64_t j = 0; j < 512; ++j) {
+            if (!(l2[j] & PTE_P)) continue;
+            uint64_t *l1 = (uint64_t*)pte_page(l2[j]);
+            for (uint64_t k = 0; k < 512; ++k) {
+                uint64_t *pte = &l1[k];
+                if (!(*pte & PTE_P)) continue;
+                uint64_t va = USER_BASE | (i << 30) | (j << 21) | (k << 12);
+                uint64_t *to = pte_find(dst, va, 1);
+                if (!to) return -1;
+                if ((*pte & PTE_W) && !(*pte & PTE_SHARED)) *pte = (*pte & ~PTE_W) | PTE_COW;
+                *to = *pte;
+                page_get(pte_page(*pte));
+                dst->pages++;
+            }
+        }
+    }
+    return 0;
+}
+
+AddressSpace *vm_clone(AddressSpace *src) {
+    AddressSpace *dst = vm_create();
+    if (!dst) return 0;
+    VmRegion **tail = &dst->regions;
+    for (VmRegion *r = src->regions; r; r = r->next) {
+        VmRegion *c = (VmRegion*)kzalloc(sizeof(VmRegion));
+        if (!c) {
+            vm_destroy(dst);
+            return 0;
+        }
+        *c = *r;
+        c->next = 0;
+        if (r->pager && !(c->file = r->pager->dup(r->pager->ctx, r->file))) {
+            kfree(c);
+            vm_destroy(dst);
+            return 0;
+        }
+        *tail = c;
+        tail  = &c->next;
+    }
+    int rc = clone_pages(src, dst);
+    tlb_flush(src);
+    if (rc < 0) {
+        vm_destroy(dst);
+        return 0;
+    }
+    return dst;
+}
+
+// ---------------------------------------------------------------------
+// Faults
+// ---------------------------------------------------------------------
+
+int vm_fault(AddressSpace *as, uint64_t va, int write) {
+    va &= ~(uint64_t)(PAGE_SIZE - 1);
+    VmRegion *r = user_range(va, PAGE_SIZE) ? region_find(as, va) : 0;
+    if (!r || (write && !(r->flags & VM_WRITE))) {
+        g_stats.bad_faults++;
+        return -1;
+    }
+    uint64_t *pte = pte_find(as, va, 1);
+    if (!pte) return -1;
+
+    if (!(*pte & PTE_P)) {
+        uint64_t bits = pte_bits(r->flags);
+        void *page;
+        if (r->pager) {
+            page = r->pager->page(r->pager->ctx, r->file, (r->offset + va - r->start) / PAGE_SIZE);
+            if (!page) {
+                g_stats.bad_faults++;
+                return -1;
+            }
+            // The file's own page, never written in place unless shared.
+            if (r->flags & VM_SHARED) bits |= PTE_SHARED;
+            else if (bits & PTE_W)    bits = (bits & ~PTE_W) | PTE_COW;
+            g_stats.file_pages++;
+        } else {
+            page = page_alloc(0);
+            if (!page) return -1;
+            memset(page, 0, PAGE_SIZE);
+            g_stats.zero_fills++;
+        }
+        *pte = (uint64_t)(uintptr_t)page | bits;
+        as->pages++;
+        g_stats.faults++;
+    }
+
+    // Present already (a stale TLB entry, or a fault taken for a read
+    // first) or now writable: done.
+    if (!write || (*pte & PTE_W)) return 0;
+    if (!(*pte & PTE_COW)) return -1;
+
+    void *old = pte_page(*pte);
+    PageFrame *pf = virt_to_page(old);
+    if (pf && pf->refcount == 1) {
+        g_stats.cow_reuses++;
+    } else {
+        void *copy = page_alloc(0);
+        if (!copy) return -1;
+        memcpy(copy, old, PAGE_SIZE);
+        page_put(old);
+        *pte = (*pte & ~PTE_ADDR) | (uint64_t)(uintptr_t)copy;
+        g_stats.cow_copies++;
+    }
+    *pte = (*pte & ~PTE_COW) | PTE_W;
+    tlb_flush_page(as, va);
+    g_stats.faults++;
+    return 0;
+}
+
+// ---------------------------------------------------------------------
+// Mapping
+// ---------------------------------------------------------------------
+
+int vm_map(AddressSpace *as, uint64_t va, uint64_t len, uint32_t flags) {
+    if (vm_reserve(as, va, len, flags, 0, 0, 0) < 0) return -1;
+    for (uint64_t off = 0; off < len; off += PAGE_SIZE) {
+        if (vm_fault(as, va + off, 0) < 0) return -1;
+    }
+    return 0;
+}
+
+void vm_unmap(AddressSpace *as, uint64_t va, uint64_t len) {
+    if ((va | len) & (PAGE_SIZE - 1) || !user_range(va, len)) return;
+    if (region_cut(as, va, va + len) < 0) return;
+    int dropped = 0;
+    for (uint64_t off = 0; off < len; off += PAGE_SIZE) {
+        uint64_t *pte = pte_find(as, va + off, 0);
+        if (!pte || !(*pte & PTE_P)) continue;
+        page_put(pte_page(*pte));
+        *pte = 0;
+        as->pages--;
+        dropped = 1;
+    }
+    if (dropped) tlb_flush(as);
+}
+
+// ---------------------------------------------------------------------
+// Copies
+// ---------------------------------------------------------------------
+
+#define ACCESS_READ  0
+#define ACCESS_WRITE 1
+#define ACCESS_LOAD  2              // write, whatever the region allows
+
+// The kernel address of the byte at va, faulting the page in, or 0.
+static uint8_t *user_byte(AddressSpace *as, uint64_t va, int access) {
+    uint64_t *pte = pte_find(as, va, 0);
+    int write = access == ACCESS_WRITE;
+    if (!pte || !(*pte & PTE_P) || (write && !(*pte & PTE_W))) {
+        if (vm_fault(as, va, write) < 0) return 0;
+        pte = pte_find(as, va, 0);
+    }
+    // A loader only writes its own fresh pages, never shared ones.
+    if (access == ACCESS_LOAD && (*pte & PTE_COW)) return 0;
+    return (uint8_t*)pte_page(*pte) + (va & (PAGE_SIZE - 1));
+}
+
+int vm_mapped(AddressSpace *as, uint64_t va, uint64_t len, int write) {
+    if (!user_range(va, len)) return 0;
+    uint64_t end = va + len;
+    for (VmRegion *r = as->regions; r && va < end; r = r->next) {
+        if (r->end <= va) continue;
+        if (r->start > va) return 0;                // a hole
+        if (write && !(r->flags & VM_WRITE)) return 0;
+        va = r->end;
+    }
+    return va >= end;
+}
+
+static int copy_user(AddressSpace *as, uint64_t va, uint8_t *kbuf, uint64_t len, int access) {
+    if (!user_range(va, len)) return -1;
+    while (len) {
+        uint8_t *p = user_byte(as, va, access);
+        if (!p) return -1;
+        uint64_t n = PAGE_SIZE - (va & (PAGE_SIZE - 1));
+        if (n > len) n = len;
+        if (access != ACCESS_READ) {
+            memcpy(p, kbuf, n);
+        } else {
+            memcpy(kbuf, p, n);
+        }
+        va   += n;
+        kbuf += n;
+        len  -= n;
+    }
+    return 0;
+}
+
+int vm_copy_in(AddressSpace *as, void *dst, uint64_t src, uint64_t len) {
+    return copy_user(as, src, (uint8_t*)dst, len, ACCESS_READ);
+}
+
+int vm_copy_out(AddressSpace *as, uint64_t dst, const void *src, uint64_t len) {
+    return copy_user(as, dst, (uint8_t*)(uintptr_t)src, len, ACCESS_WRITE);
+}
+
+int vm_load(AddressSpace *as, uint64_t dst, const void *src, uint64_t len) {
+    return copy_user(as, dst, (uint8_t*)(uintptr_t)src, len, ACCESS_LOAD);
+}
+
+int vm_copy_string(AddressSpace *as, char *dst, uint64_t src, uint32_t max) {
+    for (uint32_t i = 0; i < max; ++i) {
+        const uint8_t *p = user_range(src + i, 1) ? user_byte(as, src + i, ACCESS_READ) : 0;
+        if (!p) return -1;
+        dst[i] = (char)*p;
+        if (!*p) return (int)i;
+    }
+    return -1;
+}
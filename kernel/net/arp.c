@@ -0,0 +1,228 @@
+// kernel/net/arp.c
+// Ethernet output and the ARP cache.
+//
+// Packets for a next hop that is not resolved yet wait on the cache entry
+// (a few per entry) while a request is outstanding, and leave as soon as the
+// reply arrives. Entries expire after ARP_TTL_MS.
+
+#include "net.h"
+#include "klib.h"
+#include "timer.h"
+
+#define ARP_CACHE_SIZE   32
+#define ARP_PENDING_MAX  8
+#define ARP_TTL_MS       (5 * 60 * 1000)
+#define ARP_RETRY_MS     1000
+#define ARP_MAX_RETRIES  3
+
+#define ARP_OP_REQUEST 1
+#define ARP_OP_REPLY   2
+#define ARP_PKT_LEN    28
+
+enum { ARP_FREE = 0, ARP_PENDING, ARP_RESOLVED };
+
+typedef struct {
+    uint32_t    ip;
+    uint8_t     mac[6];
+    uint8_t     state;
+    uint8_t     retries;
+    uint64_t    expires;     // resolved: drop after; pending: next retry
+    NetIf      *nif;
+    NetBufQueue pending;
+} ArpEntry;
+
+static ArpEntry g_arp[ARP_CACHE_SIZE];
+
+static const uint8_t g_bcast_mac[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+// ---------------------------------------------------------------------
+// Ethernet output
+// ---------------------------------------------------------------------
+
+static int eth_output(NetIf *nif, NetBuf *nb, const uint8_t *dst, uint16_t type) {
+    uint8_t *eth = netbuf_push(nb, ETH_HDR_LEN);
+    if (!eth) {
+        netbuf_free(nb);
+        return NET_ENOMEM;
+    }
+    memcpy(eth, dst, 6);
+    memcpy(eth + 6, nif->dev->mac, 6);
+    put_be16(eth + 12, type);
+    nb->dev = nif->dev;
+    return nif->dev->xmit(nif->dev, nb);
+}
+
+// ---------------------------------------------------------------------
+// Cache
+// ---------------------------------------------------------------------
+
+static ArpEntry *arp_lookup(uint32_t ip) {
+    for (int i = 0; i < ARP_CACHE_SIZE; ++i) {
+        if (g_arp[i].state != ARP_FREE && g_arp[i].ip == ip) return &g_arp[i];
+    }
+    return 0;
+}
+
+static ArpEntry *arp_alloc(uint32_t ip) {
+    ArpEntry *victim = 0;
+    for (int i = 0; i < ARP_CACHE_SIZE; ++i) {
+        if (g_arp[i].state == ARP_FREE) {
+            victim = &g_arp[i];
+            break;
+        }
+        // Otherwise evict the resolved entry closest to expiry.
+        if (g_arp[i].state == ARP_RESOLVED &&
+            (!victim || g_arp[i].expires < victim->expires)) {
+            victim = &g_arp[i];
+        }
+    }
+    if (!victim) return 0;
+    netbuf_queue_purge(&victim->pending);
+    memset(victim, 0, sizeof(*victim));
+    victim->ip = ip;
+    return victim;
+}
+
+static void arp_send(NetIf *nif, uint16_t op, const uint8_t *tha, uint32_t tpa) {
+    NetBuf *nb = netbuf_alloc();
+    if (!nb) return;
+    uint8_t *p = netbuf_put(nb, ARP_PKT_LEN);
+    put_be16(p + 0, 1);               // Ethernet
+    put_be16(p + 2, ETH_TYPE_IPV4);
+    p[4] = 6;
+    p[5] = 4;
+    put_be16(p + 6, op);
+    memcpy(p + 8, nif->dev->mac, 6);
+    put_be32(p + 14, nif->ip);
+    if (tha) memcpy(p + 18, tha, 6);
+    else     memset(p + 18, 0, 6);
+    put_be32(p + 24, tpa);
+    eth_output(nif, nb, (op == ARP_OP_REQUEST) ? g_bcast_mac : tha, ETH_TYPE_ARP);
+}
+
+static void arp_resolved(ArpEntry *e, NetIf *nif, const uint8_t *mac) {
+    memcpy(e->mac, mac, 6);
+    e->state   = ARP_RESOLVED;
+    e->nif     = nif;
+    e->expires = time_ms() + ARP_TTL_MS;
+
+    NetBuf *nb;
+    while ((nb = netbuf_queue_pop(&e->pending)) != 0) {
+        eth_output(nif, nb, e->mac, ETH_TYPE_IPV4);
+    }
+}
+
+int arp_cache_count(void) {
+    int n = 0;
+    for (int i = 0; i < ARP_CACHE_SIZE; ++i) {
+        if (g_arp[i].state == ARP_RESOLVED) n++;
+    }
+    return n;
+}
+
+// ---------------------------------------------------------------------
+// Input / output
+// ---------------------------------------------------------------------
+
+void arp_input(NetIf *nif, NetBuf *nb) {
+    if (nb->len < ARP_PKT_LEN) {
+        netbuf_free(nb);
+        return;
+    }
+    uint8_t *p = nb->data;
+    if (get_be16(p) != 1 || get_be16(p + 2) != ETH_TYPE_IPV4 ||
+        p[4] != 6 || p[5] != 4) {
+        netbuf_free(nb);
+        return;
+    }
+
+    uint16_t op  = get_be16(p + 6);
+    uint32_t spa = get_be32(p + 14);
+    uint32_t tpa = get_be32(p + 24);
+    uint8_t  sha[6];
+    memcpy(sha, p + 8, 6);
+
+    // Refresh an existing entry from any ARP traffic; only create one when
+    // the packet is aimed at us (RFC 826 merge logic).
+    ArpEntry *e = arp_lookup(spa);
+    if (e) {
+        arp_resolved(e, nif, sha);
+    }
+    if (!nif->configured || tpa != nif->ip) {
+        netbuf_free(nb);
+        return;
+    }
+    if (!e && spa) {
+        e = arp_alloc(spa);
+        if (e) arp_resolved(e, nif, sha);
+    }
+
+    if (op == ARP_OP_REQUEST) {
+        // Answer in the same buffer: swap sender/target, fill in our MAC.
+        netbuf_reset(nb, NETBUF_HEADROOM);
+        p = netbuf_put(nb, ARP_PKT_LEN);
+        put_be16(p + 0, 1);
+        put_be16(p + 2, ETH_TYPE_IPV4);
+        p[4] = 6;
+        p[5] = 4;
+        put_be16(p + 6, ARP_OP_REPLY);
+        memcpy(p + 8, nif->dev->mac, 6);
+        put_be32(p + 14, nif->ip);
+        memcpy(p + 18, sha, 6);
+        put_be32(p + 24, spa);
+        eth_output(nif, nb, sha, ETH_TYPE_ARP);
+        return;
+    }
+    netbuf_free(nb);
+}
+
+int arp_output(NetIf *nif, NetBuf *nb, uint32_t next_hop) {
+    uint32_t bcast = nif->ip | ~nif->netmask;
+    if (next_hop == IP_BROADCAST || (nif->configured && next_hop == bcast)) {
+        return eth_output(nif, nb, g_bcast_mac, ETH_TYPE_IPV4);
+    }
+
+    ArpEntry *e = arp_lookup(next_hop);
+    if (e && e->state == ARP_RESOLVED) {
+        return eth_output(nif, nb, e->mac, ETH_TYPE_IPV4);
+    }
+
+    if (!e) {
+        e = arp_alloc(next_hop);
+        if (!e) {
+            netbuf_free(nb);
+            return NET_ENOMEM;
+        }
+        e->state   = ARP_PENDING;
+        e->nif     = nif;
+        e->retries = 0;
+        e->expires = time_ms() + ARP_RETRY_MS;
+        arp_send(nif, ARP_OP_REQUEST, 0, next_hop);
+    }
+
+    if (e->pending.count >= ARP_PENDING_MAX) {
+        netbuf_free(netbuf_queue_pop(&e->pending));
+    }
+    netbuf_queue_push(&e->pending, nb);
+    return NET_OK;
+}
+
+void arp_tick(uint64_t now) {
+    for (int i = 0; i < ARP_CACHE_SIZE; ++i) {
+        ArpEntry *e = &g_arp[i];
+        if (e->state == ARP_FREE || now < e->expires) continue;
+
+        if (e->state == ARP_RESOLVED) {
+            e->state = ARP_FREE;
+            continue;
+        }
+        if (++e->retries > ARP_MAX_RETRIES) {
+            // Unreachable: drop whatever was waiting.
+            netbuf_queue_purge(&e->pending);
+            e->state = ARP_FREE;
+            continue;
+        }
+        e->expires = now + ARP_RETRY_MS;
+        arp_send(e->nif, ARP_OP_REQUEST, 0, e->ip);
+    }
+}
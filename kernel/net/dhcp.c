@@ -0,0 +1,250 @@
+// kernel/net/dhcp.c
+// DHCP client (RFC 2131) for the first interface: DISCOVER -> OFFER ->
+// REQUEST -> ACK, then a unicast renewal at T1. Under QEMU user networking
+// the lease is 10.0.2.15 with the gateway at 10.0.2.2 and DNS at 10.0.2.3.
+
+#include "net.h"
+#include "klib.h"
+#include "timer.h"
+
+#define DHCP_SERVER_PORT 67
+#define DHCP_CLIENT_PORT 68
+#define DHCP_MAGIC       0x63825363u
+#define DHCP_FIXED_LEN   240         // BOOTP header + magic cookie
+#define DHCP_MIN_LEN     300         // some servers ignore shorter requests
+
+#define DHCP_RETRY_MS     1000
+#define DHCP_RETRY_MAX_MS 16000
+#define DHCP_MAX_RETRIES  4
+
+#define DHCPDISCOVER 1
+#define DHCPOFFER    2
+#define DHCPREQUEST  3
+#define DHCPACK      5
+#define DHCPNAK      6
+
+#define OPT_PAD        0
+#define OPT_NETMASK    1
+#define OPT_ROUTER     3
+#define OPT_DNS        6
+#define OPT_REQ_IP     50
+#define OPT_LEASE      51
+#define OPT_MSG_TYPE   53
+#define OPT_SERVER_ID  54
+#define OPT_PARAM_LIST 55
+#define OPT_END        255
+
+enum {
+    DHCP_OFF = 0,
+    DHCP_SELECTING,
+    DHCP_REQUESTING,
+    DHCP_BOUND,
+    DHCP_RENEWING
+};
+
+static const char *g_dhcp_state_names[] = {
+    "off", "discovering", "requesting", "bound", "renewing"
+};
+
+static struct {
+    NetIf   *nif;
+    int      state;
+    uint32_t xid;
+    uint32_t offered_ip;
+    uint32_t server_id;
+    uint32_t retry_ms;
+    int      retries;
+    uint64_t deadline;      // next retransmission
+    uint64_t renew_at;      // T1
+    uint64_t expires_at;    // end of lease
+} g_dhcp;
+
+// ---------------------------------------------------------------------
+// Output
+// ---------------------------------------------------------------------
+
+static void dhcp_send(uint8_t type) {
+    NetIf  *nif = g_dhcp.nif;
+    NetBuf *nb  = netbuf_alloc();
+    if (!nb) return;
+
+    uint8_t *p = netbuf_put(nb, DHCP_MIN_LEN);
+    memset(p, 0, DHCP_MIN_LEN);
+    int renewing = g_dhcp.state == DHCP_RENEWING;
+
+    p[0] = 1;                                   // BOOTREQUEST
+    p[1] = 1;                                   // Ethernet
+    p[2] = 6;
+    put_be32(p + 4, g_dhcp.xid);
+    put_be16(p + 10, renewing ? 0 : 0x8000);    // broadcast replies until bound
+    if (renewing) put_be32(p + 12, nif->ip);    // ciaddr
+    memcpy(p + 28, nif->dev->mac, 6);
+    put_be32(p + 236, DHCP_MAGIC);
+
+    uint8_t *o = p + DHCP_FIXED_LEN;
+    *o++ = OPT_MSG_TYPE; *o++ = 1; *o++ = type;
+    if (type == DHCPREQUEST && !renewing) {
+        *o++ = OPT_REQ_IP;    *o++ = 4; put_be32(o, g_dhcp.offered_ip); o += 4;
+        *o++ = OPT_SERVER_ID; *o++ = 4; put_be32(o, g_dhcp.server_id);  o += 4;
+    }
+    *o++ = OPT_PARAM_LIST; *o++ = 4;
+    *o++ = OPT_NETMASK; *o++ = OPT_ROUTER; *o++ = OPT_DNS; *o++ = OPT_LEASE;
+    *o++ = OPT_END;
+
+    if (renewing) {
+        udp_output(nb, nif->ip, DHCP_CLIENT_PORT, g_dhcp.server_id, DHCP_SERVER_PORT);
+    } else {
+        udp_output(nb, 0, DHCP_CLIENT_PORT, IP_BROADCAST, DHCP_SERVER_PORT);
+    }
+}
+
+static void dhcp_arm_retry(void) {
+    g_dhcp.deadline = time_ms() + g_dhcp.retry_ms;
+    g_dhcp.retry_ms *= 2;
+    if (g_dhcp.retry_ms > DHCP_RETRY_MAX_MS) g_dhcp.retry_ms = DHCP_RETRY_MAX_MS;
+}
+
+static void dhcp_discover(void) {
+    g_dhcp.state    = DHCP_SELECTING;
+    g_dhcp.xid      = (uint32_t)rdtsc();
+    g_dhcp.retry_ms = DHCP_RETRY_MS;
+    g_dhcp.retries  = 0;
+    dhcp_send(DHCPDISCOVER);
+    dhcp_arm_retry();
+}
+
+static void dhcp_request(int state) {
+    g_dhcp.state    = state;
+    g_dhcp.retry_ms = DHCP_RETRY_MS;
+    g_dhcp.retries  = 0;
+    dhcp_send(DHCPREQUEST);
+    dhcp_arm_retry();
+}
+
+void dhcp_start(NetIf *nif) {
+    memset(&g_dhcp, 0, sizeof(g_dhcp));
+    g_dhcp.nif = nif;
+    dhcp_discover();
+}
+
+const char *dhcp_state_name(void) {
+    return g_dhcp_state_names[g_dhcp.state];
+}
+
+// ---------------------------------------------------------------------
+// Input
+// ---------------------------------------------------------------------
+
+void dhcp_input(NetIf *nif, NetBuf *nb, const IpInfo *ip) {
+    (void)ip;
+    uint8_t *p   = nb->data;
+    uint32_t len = nb->len;
+
+    if (nif != g_dhcp.nif || len < DHCP_FIXED_LEN || p[0] != 2 ||
+        get_be32(p + 4) != g_dhcp.xid ||
+        memcmp(p + 28, nif->dev->mac, 6) != 0 ||
+        get_be32(p + 236) != DHCP_MAGIC) {
+        netbuf_free(nb);
+        return;
+    }
+
+    uint32_t yiaddr = get_be32(p + 16);
+    uint8_t  type = 0;
+    uint32_t mask = 0, router = 0, dns = 0, server = 0, lease = 0;
+
+    uint32_t i = DHCP_FIXED_LEN;
+    while (i < len) {
+        uint8_t opt = p[i++];
+        if (opt == OPT_PAD) continue;
+        if (opt == OPT_END || i >= len) break;
+        uint8_t olen = p[i++];
+        if (i + olen > len) break;
+        const uint8_t *v = p + i;
+        switch (opt) {
+            case OPT_MSG_TYPE:  if (olen >= 1) type   = v[0];          break;
+            case OPT_NETMASK:   if (olen >= 4) mask   = get_be32(v);   break;
+            case OPT_ROUTER:    if (olen >= 4) router = get_be32(v);   break;
+            case OPT_DNS:       if (olen >= 4) dns    = get_be32(v);   break;
+            case OPT_SERVER_ID: if (olen >= 4) server = get_be32(v);   break;
+            case OPT_LEASE:     if (olen >= 4) lease  = get_be32(v);   break;
+            default: break;
+        }
+        i += olen;
+    }
+    netbuf_free(nb);
+
+    if (type == DHCPOFFER && g_dhcp.state == DHCP_SELECTING) {
+        g_dhcp.offered_ip = yiaddr;
+        g_dhcp.server_id  = server;
+        dhcp_request(DHCP_REQUESTING);
+        return;
+    }
+
+    if (g_dhcp.state != DHCP_REQUESTING && g_dhcp.state != DHCP_RENEWING) return;
+
+    if (type == DHCPNAK) {
+        nif->configured = 0;
+        dhcp_discover();
+        return;
+    }
+    if (type != DHCPACK) return;
+
+    if (lease == 0 || lease > 0x7FFFFFFFu / 1000) lease = 3600;
+    uint64_t now = time_ms();
+
+    nif->ip      = yiaddr;
+    nif->netmask = mask ? mask : IP4(255, 255, 255, 0);
+    nif->gateway = router;
+    nif->dns     = dns ? dns : router;
+    nif->configured = 1;
+
+    if (server) g_dhcp.server_id = server;
+    g_dhcp.state      = DHCP_BOUND;
+    g_dhcp.renew_at   = now + (uint64_t)lease * 500;     // T1 = lease / 2
+    g_dhcp.expires_at = now + (uint64_t)lease * 1000;
+    g_dhcp.deadline   = 0;
+}
+
+// ---------------------------------------------------------------------
+// Timers
+// ---------------------------------------------------------------------
+
+void dhcp_tick(uint64_t now) {
+    switch (g_dhcp.state) {
+        case DHCP_SELECTING:
+            if (now >= g_dhcp.deadline) {
+                dhcp_send(DHCPDISCOVER);
+                dhcp_arm_retry();
+            }
+            break;
+
+        case DHCP_REQUESTING:
+            if (now >= g_dhcp.deadline) {
+                if (++g_dhcp.retries > DHCP_MAX_RETRIES) {
+                    dhcp_discover();
+                } else {
+                    dhcp_send(DHCPREQUEST);
+                    dhcp_arm_retry();
+                }
+            }
+            break;
+
+        case DHCP_BOUND:
+            if (now >= g_dhcp.renew_at) dhcp_request(DHCP_RENEWING);
+            break;
+
+        case DHCP_RENEWING:
+            if (now >= g_dhcp.expires_at) {
+                // Lease ran out without an answer: start over.
+                g_dhcp.nif->configured = 0;
+                dhcp_discover();
+            } else if (now >= g_dhcp.deadline) {
+                dhcp_send(DHCPREQUEST);
+                dhcp_arm_retry();
+            }
+            break;
+
+        default:
+            break;
+    }
+}
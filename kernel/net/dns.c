@@ -0,0 +1,172 @@
+// kernel/net/dns.c
+// Stub resolver: A-record lookups against the DHCP-provided server, with a
+// small TTL-bounded cache in front.
+
+#include "net.h"
+#include "socket.h"
+#include "klib.h"
+#include "timer.h"
+
+#define DNS_PORT        53
+#define DNS_HDR_LEN     12
+#define DNS_MAX_PACKET  512
+#define DNS_CACHE_SIZE  8
+#define DNS_NAME_MAX    64
+#define DNS_TRIES       3
+#define DNS_MIN_TTL_S   30
+#define DNS_MAX_TTL_S   3600
+
+typedef struct {
+    char     name[DNS_NAME_MAX];
+    uint32_t ip;
+    uint64_t expires;
+} DnsEntry;
+
+static DnsEntry g_dns_cache[DNS_CACHE_SIZE];
+static uint16_t g_dns_id = 0;
+
+static int dns_cache_lookup(const char *name, uint32_t *ip) {
+    uint64_t now = time_ms();
+    for (int i = 0; i < DNS_CACHE_SIZE; ++i) {
+        DnsEntry *e = &g_dns_cache[i];
+        if (e->expires > now && str_eq(e->name, name)) {
+            *ip = e->ip;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void dns_cache_store(const char *name, uint32_t ip, uint32_t ttl) {
+    if (ttl < DNS_MIN_TTL_S) ttl = DNS_MIN_TTL_S;
+    if (ttl > DNS_MAX_TTL_S) ttl = DNS_MAX_TTL_S;
+    DnsEntry *victim = &g_dns_cache[0];
+    for (int i = 0; i < DNS_CACHE_SIZE; ++i) {
+        if (str_eq(g_dns_cache[i].name, name)) {
+            victim = &g_dns_cache[i];
+            break;
+        }
+        if (g_dns_cache[i].expires < victim->expires) victim = &g_dns_cache[i];
+    }
+    str_copy(victim->name, name, DNS_NAME_MAX);
+    victim->ip      = ip;
+    victim->expires = time_ms() + (uint64_t)ttl * 1000;
+}
+
+// Encodes "www.example.com" as length-prefixed labels. Returns bytes written
+// or -1 if the name is malformed.
+static int dns_encode_name(uint8_t *out, uint32_t max, const char *name) {
+    uint32_t pos = 0;
+    while (*name) {
+        const char *dot = name;
+        while (*dot && *dot != '.') dot++;
+        uint32_t label = (uint32_t)(dot - name);
+        if (label == 0 || label > 63 || pos + label + 2 > max) return -1;
+        out[pos++] = (uint8_t)label;
+        memcpy(out + pos, name, label);
+        pos += label;
+        name = *dot ? dot + 1 : dot;
+    }
+    out[pos++] = 0;
+    return (int)pos;
+}
+
+// Skips a (possibly compressed) name. Returns the offset after it or 0.
+static uint32_t dns_skip_name(const uint8_t *p, uint32_t len, uint32_t off) {
+    while (off < len) {
+        uint8_t l = p[off];
+        if (l == 0) return off + 1;
+        if ((l & 0xC0) == 0xC0) return off + 2 <= len ? off + 2 : 0;
+        off += (uint32_t)l + 1;
+    }
+    return 0;
+}
+
+static int dns_parse_answer(const uint8_t *p, uint32_t len, uint16_t id,
+                            uint32_t *ip, uint32_t *ttl) {
+    if (len < DNS_HDR_LEN || get_be16(p) != id) return NET_ERR;
+    uint16_t flags = get_be16(p + 2);
+    if (!(flags & 0x8000) || (flags & 0x000F) != 0) return NET_EUNREACH;
+
+    uint16_t qd = get_be16(p + 4);
+    uint16_t an = get_be16(p + 6);
+    uint32_t off = DNS_HDR_LEN;
+    for (uint16_t i = 0; i < qd; ++i) {
+        off = dns_skip_name(p, len, off);
+        if (!off || off + 4 > len) return NET_ERR;
+        off += 4;
+    }
+    for (uint16_t i = 0; i < an; ++i) {
+        off = dns_skip_name(p, len, off);
+        if (!off || off + 10 > len) return NET_ERR;
+        uint16_t type  = get_be16(p + off);
+        uint16_t klass = get_be16(p + off + 2);
+        uint32_t t     = get_be32(p + off + 4);
+        uint16_t rdlen = get_be16(p + off + 8);
+        off += 10;
+        if (off + rdlen > len) return NET_ERR;
+        // CNAMEs come first; the server has already chased them for us.
+        if (type == 1 && klass == 1 && rdlen == 4) {
+            *ip  = get_be32(p + off);
+            *ttl = t;
+            return NET_OK;
+        }
+        off += rdlen;
+    }
+    return NET_EUNREACH;
+}
+
+int dns_resolve(const char *name, uint32_t *out_ip, uint32_t timeout_ms) {
+    if (net_parse_ip(name, out_ip) == 0) return NET_OK;
+    if (dns_cache_lookup(name, out_ip)) return NET_OK;
+
+    NetIf *nif = net_default_if();
+    if (!nif || !nif->configured || !nif->dns) return NET_EUNREACH;
+
+    uint8_t pkt[DNS_MAX_PACKET];
+    memset(pkt, 0, DNS_HDR_LEN);
+    uint16_t id = (uint16_t)(++g_dns_id ^ (uint16_t)rdtsc());
+    put_be16(pkt, id);
+    put_be16(pkt + 2, 0x0100);      // recursion desired
+    put_be16(pkt + 4, 1);
+    int nlen = dns_encode_name(pkt + DNS_HDR_LEN, DNS_MAX_PACKET - DNS_HDR_LEN - 4, name);
+    if (nlen < 0) return NET_ERR;
+    uint32_t qlen = DNS_HDR_LEN + (uint32_t)nlen;
+    put_be16(pkt + qlen, 1);        // A
+    put_be16(pkt + qlen + 2, 1);    // IN
+    qlen += 4;
+
+    Socket *s = sock_open(SOCK_DGRAM);
+    if (!s) return NET_ENOMEM;
+
+    int      rc       = NET_ETIMEDOUT;
+    uint32_t per_try  = timeout_ms / DNS_TRIES;
+    if (per_try == 0) per_try = 1;
+    for (int attempt = 0; attempt < DNS_TRIES && rc == NET_ETIMEDOUT; ++attempt) {
+        int sent = sock_sendto(s, pkt, qlen, nif->dns, DNS_PORT);
+        if (sent < 0) {
+            rc = sent;
+            break;
+        }
+        uint64_t deadline = time_ms() + per_try;
+        for (;;) {
+            uint64_t now = time_ms();
+            if (now >= deadline) break;
+            uint8_t  resp[DNS_MAX_PACKET];
+            uint32_t from = 0;
+            uint16_t port = 0;
+            int n = sock_recvfrom(s, resp, sizeof(resp), &from, &port,
+                                  (uint32_t)(deadline - now));
+            if (n < 0) break;
+            if (from != nif->dns || port != DNS_PORT) continue;
+            uint32_t ttl = 0;
+            int prc = dns_parse_answer(resp, (uint32_t)n, id, out_ip, &ttl);
+            if (prc == NET_ERR) continue;           // not ours / garbled
+            if (prc == NET_OK) dns_cache_store(name, *out_ip, ttl);
+            rc = prc;
+            break;
+        }
+    }
+    sock_close(s);
+    return rc;
+}
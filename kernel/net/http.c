@@ -0,0 +1,753 @@
+// kernel/net/http.c
+// HTTP/1.1 GET client. The response is parsed as it streams off the socket:
+// headers are collected into a small buffer, the body (Content-Length,
+// chunked, or delimited by connection close) goes straight to the caller's
+// sink. Cacheable bodies are also copied aside for the response cache, and
+// connections that end cleanly are parked in a small keep-alive pool.
+
+#include "http.h"
+#include "net.h"
+#include "socket.h"
+#include "tcp.h"
+#include "klib.h"
+#include "timer.h"
+#include "mm.h"
+
+#define HTTP_DEFAULT_PORT   80
+#define HTTP_HOST_MAX       64
+#define HTTP_HEADER_MAX     2048
+#define HTTP_IO_CHUNK       1024
+#define HTTP_DHCP_WAIT_MS   5000
+#define HTTP_DNS_TIMEOUT_MS 3000
+#define HTTP_CONNECT_MS     3000
+#define HTTP_TIMEOUT_MS     10000
+#define HTTP_POOL_SIZE      4
+#define HTTP_IDLE_MS        15000       // drop parked connections after this
+#define HTTP_HEURISTIC_MAX  86400       // cap on Last-Modified freshness (s)
+
+// Body framing, decided by the response headers.
+enum {
+    BODY_NONE = 0,      // 1xx/204/304
+    BODY_LENGTH,
+    BODY_CHUNKED,
+    BODY_UNTIL_CLOSE
+};
+
+// Chunked decoder states.
+enum {
+    CHUNK_SIZE = 0,     // reading the hex size line
+    CHUNK_EXT,          // skipping ";ext" up to LF
+    CHUNK_DATA,
+    CHUNK_DATA_CR,      // CRLF after the data
+    CHUNK_DATA_LF,
+    CHUNK_TRAILER,      // trailer lines until an empty one
+    CHUNK_TRAILER_LINE,
+    CHUNK_DONE
+};
+
+typedef struct {
+    int      framing;
+    uint32_t remaining;     // BODY_LENGTH: bytes left; CHUNKED: in chunk
+    int      chunk_state;
+    uint32_t chunk_size;
+    int      done;
+    int      aborted;
+    int      extra;         // bytes past the end of the body (no reuse)
+    HttpSink sink;
+    void    *ctx;
+    uint8_t *copy;          // body kept for the cache, or 0
+    uint32_t copy_len;
+    uint32_t copy_cap;
+} HttpBody;
+
+// Response headers that matter beyond framing. Times are seconds since the
+// epoch, or -1 when absent/unparseable.
+typedef struct {
+    int      keep_alive;
+    int      no_store;
+    int      no_cache;
+    int      must_revalidate;
+    int      has_max_age;
+    uint32_t max_age;
+    int      has_expires;
+    int64_t  expires;
+    int64_t  date;
+    int64_t  last_modified_t;
+    char     etag[HTTP_VALIDATOR_MAX];
+    char     last_modified[HTTP_VALIDATOR_MAX];
+} HttpHead;
+
+// An idle connection waiting for the next request to the same server.
+typedef struct {
+    Socket  *sock;
+    uint32_t ip;
+    uint16_t port;
+    uint64_t idle_since;
+} HttpConn;
+
+static HttpConn g_http_pool[HTTP_POOL_SIZE];
+
+// ---------------------------------------------------------------------
+// Helpers
+// ---------------------------------------------------------------------
+
+static char lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? (char)(c + 32) : c;
+}
+
+// Case-insensitive prefix match; returns the text after the prefix or 0.
+static const char *match_prefix(const char *s, const char *prefix) {
+    while (*prefix) {
+        if (lower(*s) != lower(*prefix)) return 0;
+        s++;
+        prefix++;
+    }
+    return s;
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c = lower(c);
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+int http_parse_url(const char *url, char *host, uint32_t host_max,
+                   uint16_t *port, const char **path) {
+    const char *p = match_prefix(url, "http://");
+    if (!p) {
+        return match_prefix(url, "https://") ? NET_ENOTSUP : NET_ERR;
+    }
+
+    uint32_t n = 0;
+    while (*p && *p != '/' && *p != ':') {
+        if (n + 1 >= host_max) return NET_ERR;
+        host[n++] = *p++;
+    }
+    host[n] = '\0';
+    if (n == 0) return NET_ERR;
+
+    *port = HTTP_DEFAULT_PORT;
+    if (*p == ':') {
+        uint32_t v = 0;
+        ++p;
+        if (*p < '0' || *p > '9') return NET_ERR;
+        while (*p >= '0' && *p <= '9') {
+            v = v * 10 + (uint32_t)(*p++ - '0');
+            if (v > 65535) return NET_ERR;
+        }
+        *port = (uint16_t)v;
+    }
+    *path = *p ? p : "/";
+    return NET_OK;
+}
+
+// ---------------------------------------------------------------------
+// Body decoding
+// ---------------------------------------------------------------------
+
+// Appends to the cache copy; gives up on caching if the body is too big
+// or memory runs out.
+static void body_copy(HttpBody *b, const uint8_t *data, uint32_t len) {
+    if (b->copy_len + len > HTTP_CACHE_MAX_ENTRY) {
+        kfree(b->copy);
+        b->copy = 0;
+        return;
+    }
+    if (b->copy_len + len > b->copy_cap) {
+        uint32_t ncap = b->copy_cap * 2;
+        while (ncap < b->copy_len + len) ncap *= 2;
+        uint8_t *n = (uint8_t *)kmalloc(ncap);
+        if (!n) {
+            kfree(b->copy);
+            b->copy = 0;
+            return;
+        }
+        memcpy(n, b->copy, b->copy_len);
+        kfree(b->copy);
+        b->copy     = n;
+        b->copy_cap = ncap;
+    }
+    memcpy(b->copy + b->copy_len, data, len);
+    b->copy_len += len;
+}
+
+static void body_emit(HttpBody *b, const uint8_t *data, uint32_t len) {
+    if (!len || b->aborted) return;
+    if (b->copy) body_copy(b, data, len);
+    if (b->sink && b->sink(b->ctx, data, len)) {
+        b->aborted = 1;
+        b->done    = 1;
+    }
+}
+
+// Returns the number of bytes that belonged to the body.
+static uint32_t body_chunked(HttpBody *b, const uint8_t *p, uint32_t len) {
+    uint32_t i = 0;
+    while (i < len && !b->done) {
+        char c = (char)p[i];
+        switch (b->chunk_state) {
+            case CHUNK_SIZE: {
+                int d = hex_digit(c);
+                if (d >= 0) {
+                    if (b->chunk_size > 0x0FFFFFFFu) {
+                        // Too long to frame: give up on the body.
+                        b->aborted = 1;
+                        b->done    = 1;
+                        return i;
+                    }
+                    b->chunk_size = (b->chunk_size << 4) | (uint32_t)d;
+                } else if (c == '\n') {
+                    b->remaining   = b->chunk_size;
+                    b->chunk_state = b->chunk_size ? CHUNK_DATA : CHUNK_TRAILER;
+                } else {
+                    b->chunk_state = CHUNK_EXT;  // ';' extension or CR
+                }
+                i++;
+                break;
+            }
+            case CHUNK_EXT:
+                if (c == '\n') {
+                    b->remaining   = b->chunk_size;
+                    b->chunk_state = b->chunk_size ? CHUNK_DATA : CHUNK_TRAILER;
+                }
+                i++;
+                break;
+            case CHUNK_DATA: {
+                uint32_t n = len - i;
+                if (n > b->remaining) n = b->remaining;
+                body_emit(b, p + i, n);
+                i            += n;
+                b->remaining -= n;
+                if (b->remaining == 0) b->chunk_state = CHUNK_DATA_CR;
+                break;
+            }
+            case CHUNK_DATA_CR:
+                // CRLF after the data; tolerate a bare LF.
+                if (c == '\r') {
+                    b->chunk_state = CHUNK_DATA_LF;
+                    i++;
+                    break;
+                }
+                if (c == '\n') i++;
+                b->chunk_state = CHUNK_SIZE;
+                b->chunk_size  = 0;
+                break;
+            case CHUNK_DATA_LF:
+                if (c == '\n') i++;
+                b->chunk_state = CHUNK_SIZE;
+                b->chunk_size  = 0;
+                break;
+            case CHUNK_TRAILER:
+                // Start of a trailer line: a bare CRLF ends the message.
+                if (c == '\n') b->chunk_state = CHUNK_DONE;
+                else if (c != '\r') b->chunk_state = CHUNK_TRAILER_LINE;
+                i++;
+                break;
+            case CHUNK_TRAILER_LINE:
+                if (c == '\n') b->chunk_state = CHUNK_TRAILER;
+                i++;
+                break;
+            default:
+                i = len;
+                break;
+        }
+        if (b->chunk_state == CHUNK_DONE) b->done = 1;
+    }
+    return i;
+}
+
+static void body_feed(HttpBody *b, const uint8_t *p, uint32_t len) {
+    uint32_t used = len;
+    switch (b->framing) {
+        case BODY_LENGTH:
+            if (used > b->remaining) used = b->remaining;
+            body_emit(b, p, used);
+            b->remaining -= used;
+            if (b->remaining == 0) b->done = 1;
+            break;
+        case BODY_CHUNKED:
+            used = body_chunked(b, p, len);
+            break;
+        case BODY_UNTIL_CLOSE:
+            body_emit(b, p, len);
+            break;
+        default:
+            used = 0;
+            b->done = 1;
+            break;
+    }
+    if (used < len && !b->aborted) b->extra = 1;
+}
+
+// ---------------------------------------------------------------------
+// Response headers
+// ---------------------------------------------------------------------
+
+static int parse_2digits(const char *p) {
+    if (p[0] < '0' || p[0] > '9' || p[1] < '0' || p[1] > '9') return -1;
+    return (p[0] - '0') * 10 + (p[1] - '0');
+}
+
+// Parses an IMF-fixdate ("Sun, 06 Nov 1994 08:49:37 GMT") into seconds
+// since the epoch, or -1. The obsolete RFC 850/asctime forms are rejected,
+// which only costs us a cache hit.
+static int64_t http_parse_date(const char *v) {
+    static const char months[] = "janfebmaraprmayjunjulaugsepoctnovdec";
+    while (*v && *v != ',') v++;
+    if (*v++ != ',') return -1;
+    while (*v == ' ') v++;
+
+    int day = parse_2digits(v);
+    if (day < 1 || v[2] != ' ') return -1;
+    v += 3;
+    int month = -1;
+    for (int m = 0; m < 12; ++m) {
+        if (lower(v[0]) == months[m * 3] && lower(v[1]) == months[m * 3 + 1] &&
+            lower(v[2]) == months[m * 3 + 2]) {
+            month = m + 1;
+        }
+    }
+    if (month < 0 || v[3] != ' ') return -1;
+    v += 4;
+    int hi = parse_2digits(v), lo = parse_2digits(v + 2);
+    if (hi < 0 || lo < 0 || v[4] != ' ') return -1;
+    int64_t year = hi * 100 + lo;
+    v += 5;
+    int hh = parse_2digits(v), mm = parse_2digits(v + 3), ss = parse_2digits(v + 6);
+    if (hh < 0 || mm < 0 || ss < 0 || v[2] != ':' || v[5] != ':') return -1;
+
+    // Days since 1970-01-01 (proleptic Gregorian, March-based year).
+    if (month <= 2) year--;
+    int64_t era = year / 400;
+    int64_t yoe = year - era * 400;
+    int64_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int64_t days = era * 146097 + doe - 719468;
+    return days * 86400 + hh * 3600 + mm * 60 + ss;
+}
+
+// Copies a header value without trailing CR/space.
+static void copy_value(char *dst, const char *v, uint32_t max) {
+    uint32_t n = 0;
+    while (v[n] && v[n] != '\r' && v[n] != '\n') n++;
+    while (n && v[n - 1] == ' ') n--;
+    if (n >= max) {
+        dst[0] = '\0';     // too long to echo back reliably; don't use it
+        return;
+    }
+    memcpy(dst, v, n);
+    dst[n] = '\0';
+}
+
+static void parse_cache_control(const char *v, HttpHead *h) {
+    while (*v && *v != '\r') {
+        while (*v == ' ' || *v == ',') v++;
+        const char *arg;
+        if ((arg = match_prefix(v, "max-age=")) != 0) {
+            uint32_t n = 0;
+            if (*arg == '"') arg++;
+            while (*arg >= '0' && *arg <= '9' && n < 0x7FFFFFFFu / 10) {
+                n = n * 10 + (uint32_t)(*arg++ - '0');
+            }
+            h->max_age     = n;
+            h->has_max_age = 1;
+        } else if (match_prefix(v, "no-store")) {
+            h->no_store = 1;
+        } else if (match_prefix(v, "no-cache")) {
+            h->no_cache = 1;
+        } else if (match_prefix(v, "must-revalidate")) {
+            h->must_revalidate = 1;
+        }
+        while (*v && *v != ',' && *v != '\r') v++;
+    }
+}
+
+// Parses the status line and the headers we care about. hdr is the
+// NUL-terminated header block, up to and including the blank line.
+static int http_parse_head(char *hdr, HttpBody *b, HttpHead *h) {
+    const char *p = match_prefix(hdr, "HTTP/1.");
+    if (!p || !p[0] || p[1] != ' ') return NET_ERR;
+    int http11 = p[0] != '0';
+    p += 2;
+    int status = 0;
+    for (int i = 0; i < 3; ++i, ++p) {
+        if (*p < '0' || *p > '9') return NET_ERR;
+        status = status * 10 + (*p - '0');
+    }
+
+    memset(h, 0, sizeof(*h));
+    h->keep_alive      = http11;
+    h->expires         = -1;
+    h->date            = -1;
+    h->last_modified_t = -1;
+    b->framing = BODY_UNTIL_CLOSE;
+    int has_length = 0;
+
+    char *line = hdr;
+    for (;;) {
+        char *eol = line;
+        while (*eol && *eol != '\n') eol++;
+        char saved = *eol;
+        *eol = '\0';
+
+        const char *v;
+        if ((v = match_prefix(line, "content-length:")) != 0) {
+            while (*v == ' ') v++;
+            uint32_t n = 0;
+            while (*v >= '0' && *v <= '9') {
+                uint32_t d = (uint32_t)(*v++ - '0');
+                if (n > (0xFFFFFFFFu - d) / 10) {
+                    // Too long to frame: fail, so the connection is closed
+                    // rather than pooled with the rest of the body on it.
+                    *eol = saved;
+                    return NET_ERR;
+                }
+                n = n * 10 + d;
+            }
+            b->remaining = n;
+            has_length   = 1;
+        } else if ((v = match_prefix(line, "transfer-encoding:")) != 0) {
+            while (*v == ' ') v++;
+            if (match_prefix(v, "chunked")) b->framing = BODY_CHUNKED;
+        } else if ((v = match_prefix(line, "connection:")) != 0) {
+            while (*v == ' ') v++;
+            if (match_prefix(v, "close"))      h->keep_alive = 0;
+            if (match_prefix(v, "keep-alive")) h->keep_alive = 1;
+        } else if ((v = match_prefix(line, "cache-control:")) != 0) {
+            parse_cache_control(v, h);
+        } else if ((v = match_prefix(line, "pragma:")) != 0) {
+            while (*v == ' ') v++;
+            if (match_prefix(v, "no-cache")) h->no_cache = 1;
+        } else if ((v = match_prefix(line, "expires:")) != 0) {
+            h->has_expires = 1;
+            h->expires     = http_parse_date(v);
+        } else if ((v = match_prefix(line, "date:")) != 0) {
+            h->date = http_parse_date(v);
+        } else if ((v = match_prefix(line, "etag:")) != 0) {
+            while (*v == ' ') v++;
+            copy_value(h->etag, v, sizeof(h->etag));
+        } else if ((v = match_prefix(line, "last-modified:")) != 0) {
+            while (*v == ' ') v++;
+            copy_value(h->last_modified, v, sizeof(h->last_modified));
+            h->last_modified_t = http_parse_date(v);
+        }
+
+        *eol = saved;
+        if (!saved) break;
+        line = eol + 1;
+    }
+
+    if (b->framing != BODY_CHUNKED && has_length) b->framing = BODY_LENGTH;
+    if ((status >= 100 && status < 200) || status == 204 || status == 304) {
+        b->framing = BODY_NONE;
+    }
+    if (b->framing == BODY_LENGTH && b->remaining == 0) b->framing = BODY_NONE;
+    return status;
+}
+
+// How long (ms) a response stays fresh: max-age, else Expires - Date, else
+// the usual heuristic of 10% of the document's age at the time it was sent.
+static uint64_t http_lifetime_ms(const HttpHead *h) {
+    if (h->no_cache) return 0;
+    if (h->has_max_age) return (uint64_t)h->max_age * 1000;
+    if (h->has_expires) {
+        if (h->expires < 0 || h->date < 0 || h->expires <= h->date) return 0;
+        return (uint64_t)(h->expires - h->date) * 1000;
+    }
+    if (h->last_modified_t >= 0 && h->date > h->last_modified_t) {
+        uint64_t age = (uint64_t)(h->date - h->last_modified_t) / 10;
+        if (age > HTTP_HEURISTIC_MAX) age = HTTP_HEURISTIC_MAX;
+        return age * 1000;
+    }
+    return 0;
+}
+
+static void http_cache_update(HttpCacheEntry *e, const HttpHead *h) {
+    e->expires         = time_ms() + http_lifetime_ms(h);
+    e->must_revalidate = h->must_revalidate || h->no_cache;
+    if (h->etag[0]) str_copy(e->etag, h->etag, sizeof(e->etag));
+    if (h->last_modified[0]) {
+        str_copy(e->last_modified, h->last_modified, sizeof(e->last_modified));
+    }
+}
+
+// ---------------------------------------------------------------------
+// Connections
+// ---------------------------------------------------------------------
+
+// Returns a parked connection to ip:port that still looks usable, or 0.
+static Socket *http_pool_take(uint32_t ip, uint16_t port) {
+    uint64_t now = time_ms();
+    for (int i = 0; i < HTTP_POOL_SIZE; ++i) {
+        HttpConn *c = &g_http_pool[i];
+        if (!c->sock) continue;
+        // Anything readable on an idle connection is the server closing it
+        // (or junk); either way it can't carry another request.
+        int stale = now - c->idle_since > HTTP_IDLE_MS ||
+                    (sock_poll(c->sock) & (SOCK_READABLE | SOCK_ERROR)) ||
+                    sock_state(c->sock) != TCP_ESTABLISHED;
+        if (stale) {
+            sock_close(c->sock);
+            c->sock = 0;
+            continue;
+        }
+        if (c->ip == ip && c->port == port) {
+            Socket *s = c->sock;
+            c->sock = 0;
+            return s;
+        }
+    }
+    return 0;
+}
+
+static void http_pool_put(Socket *s, uint32_t ip, uint16_t port) {
+    HttpConn *slot = &g_http_pool[0];
+    for (int i = 0; i < HTTP_POOL_SIZE; ++i) {
+        if (!g_http_pool[i].sock) {
+            slot = &g_http_pool[i];
+            break;
+        }
+        if (g_http_pool[i].idle_since < slot->idle_since) slot = &g_http_pool[i];
+    }
+    if (slot->sock) sock_close(slot->sock);
+    slot->sock       = s;
+    slot->ip         = ip;
+    slot->port       = port;
+    slot->idle_since = time_ms();
+}
+
+// ---------------------------------------------------------------------
+// Requests
+// ---------------------------------------------------------------------
+
+// Sends req on s and reads one response. Returns the status (> 0) or a
+// negative NET_* error; *got_any says whether the server sent anything.
+static int http_exchange(Socket *s, const char *req, HttpBody *body,
+                         HttpHead *head, int *got_any) {
+    uint64_t deadline = time_ms() + HTTP_TIMEOUT_MS;
+    uint32_t req_len  = str_len(req);
+    int rc = sock_send(s, req, req_len, HTTP_TIMEOUT_MS);
+    if (rc < 0 || (uint32_t)rc != req_len) return rc < 0 ? rc : NET_ETIMEDOUT;
+
+    char     hdr[HTTP_HEADER_MAX];
+    uint32_t hdr_len = 0;
+    int      status  = 0;
+    uint8_t  chunk[HTTP_IO_CHUNK];
+    rc = NET_OK;
+    while (!body->done) {
+        uint64_t now = time_ms();
+        if (now >= deadline) {
+            rc = NET_ETIMEDOUT;
+            break;
+        }
+        int n = sock_recv(s, chunk, sizeof(chunk), (uint32_t)(deadline - now));
+        if (n < 0) {
+            rc = n;
+            break;
+        }
+        if (n == 0) {
+            // Peer closed: fine for close-delimited bodies, truncation
+            // otherwise (we still hand back what arrived).
+            if (!status) rc = NET_ERESET;
+            else if (body->framing == BODY_UNTIL_CLOSE) body->done = 1;
+            break;
+        }
+        *got_any = 1;
+
+        uint32_t off = 0;
+        if (!status) {
+            // Still in the headers: accumulate until the blank line.
+            while (off < (uint32_t)n && !status) {
+                if (hdr_len + 1 >= sizeof(hdr)) {
+                    rc = NET_ERR;
+                    break;
+                }
+                hdr[hdr_len++] = (char)chunk[off++];
+                if (hdr_len >= 4 && hdr[hdr_len - 1] == '\n' &&
+                    ((hdr[hdr_len - 2] == '\n') ||
+                     (hdr[hdr_len - 2] == '\r' && hdr[hdr_len - 3] == '\n'))) {
+                    hdr[hdr_len] = '\0';
+                    status = http_parse_head(hdr, body, head);
+                    if (status < 0) {
+                        rc = status;
+                        break;
+                    }
+                    if (status >= 100 && status < 200) {
+                        // Interim response: the real one follows.
+                        status  = 0;
+                        hdr_len = 0;
+                        continue;
+                    }
+                    if (body->framing == BODY_NONE) body->done = 1;
+                }
+            }
+            if (rc < 0) break;
+        }
+        if (status && off < (uint32_t)n) {
+            body_feed(body, chunk + off, (uint32_t)n - off);
+        }
+    }
+
+    if (status > 0) return status;
+    return rc < 0 ? rc : NET_ERR;
+}
+
+static void http_build_request(char *req, uint32_t max, const char *host,
+                               uint16_t port, const char *path,
+                               const HttpCacheEntry *cached) {
+    str_copy(req, "GET ", max);
+    str_cat(req, path, max);
+    str_cat(req, " HTTP/1.1\r\nHost: ", max);
+    str_cat(req, host, max);
+    if (port != HTTP_DEFAULT_PORT) {
+        str_cat(req, ":", max);
+        str_cat_u64(req, port, max);
+    }
+    str_cat(req, "\r\nUser-Agent: LightOS/0.1\r\n"
+                 "Accept: */*\r\n"
+                 "Connection: keep-alive\r\n", max);
+    if (cached && cached->etag[0]) {
+        str_cat(req, "If-None-Match: ", max);
+        str_cat(req, cached->etag, max);
+        str_cat(req, "\r\n", max);
+    }
+    if (cached && cached->last_modified[0]) {
+        str_cat(req, "If-Modified-Since: ", max);
+        str_cat(req, cached->last_modified, max);
+        str_cat(req, "\r\n", max);
+    }
+    str_cat(req, "\r\n", max);
+}
+
+static int http_replay(const HttpCacheEntry *e, HttpSink sink, void *ctx) {
+    if (sink && e->len) sink(ctx, e->body, e->len);
+    return e->status;
+}
+
+int net_http_fetch(const char *url, HttpSink sink, void *ctx) {
+    char        host[HTTP_HOST_MAX];
+    uint16_t    port = 0;
+    const char *path = 0;
+    int rc = http_parse_url(url, host, sizeof(host), &port, &path);
+    if (rc < 0) return rc;
+
+    HttpCacheEntry *cached = http_cache_lookup(url);
+    if (cached && time_ms() < cached->expires) {
+        http_cache_count(HTTP_CACHE_HIT);
+        return http_replay(cached, sink, ctx);
+    }
+    // Only revalidate what we can actually validate.
+    if (cached && !cached->etag[0] && !cached->last_modified[0]) cached = 0;
+
+    uint32_t ip = 0;
+    rc = net_wait_configured(HTTP_DHCP_WAIT_MS);
+    if (rc == NET_OK) rc = dns_resolve(host, &ip, HTTP_DNS_TIMEOUT_MS);
+
+    char req[640];
+    http_build_request(req, sizeof(req), host, port, path, cached);
+
+    HttpBody body;
+    HttpHead head;
+    Socket  *s      = 0;
+    int      status = rc;
+    // A parked connection may have been closed by the server while idle;
+    // if it dies before answering, retry once on a fresh one.
+    for (int attempt = 0; attempt < 2 && rc == NET_OK; ++attempt) {
+        int reused = 0;
+        s = http_pool_take(ip, port);
+        if (s) {
+            reused = 1;
+        } else {
+            s = sock_open(SOCK_STREAM);
+            if (!s) {
+                status = NET_ENOMEM;
+                break;
+            }
+            status = sock_connect(s, ip, port, HTTP_CONNECT_MS);
+            if (status < 0) {
+                sock_close(s);
+                s = 0;
+                break;
+            }
+        }
+
+        memset(&body, 0, sizeof(body));
+        body.sink = sink;
+        body.ctx  = ctx;
+        body.copy = (uint8_t *)kmalloc(HTTP_IO_CHUNK);
+        body.copy_cap = body.copy ? HTTP_IO_CHUNK : 0;
+
+        int got_any = 0;
+        status = http_exchange(s, req, &body, &head, &got_any);
+        if (status > 0 || !reused || got_any) break;
+        kfree(body.copy);
+        sock_close(s);
+        s = 0;
+    }
+
+    if (status <= 0) {
+        if (s) {
+            kfree(body.copy);
+            sock_close(s);
+        }
+        // Can't reach the server: a stale copy beats an error page unless
+        // the server asked us not to.
+        if (cached && !cached->must_revalidate) {
+            http_cache_count(HTTP_CACHE_HIT);
+            return http_replay(cached, sink, ctx);
+        }
+        return status;
+    }
+
+    int complete = body.done && !body.aborted;
+    if (complete && head.keep_alive && !body.extra &&
+        body.framing != BODY_UNTIL_CLOSE) {
+        http_pool_put(s, ip, port);
+    } else {
+        sock_close(s);
+    }
+
+    if (status == 304 && cached) {
+        kfree(body.copy);
+        http_cache_count(HTTP_CACHE_REVALIDATED);
+        http_cache_update(cached, &head);
+        return http_replay(cached, sink, ctx);
+    }
+
+    http_cache_count(HTTP_CACHE_MISS);
+    uint64_t lifetime = http_lifetime_ms(&head);
+    if (status == 200 && complete && body.copy && !head.no_store &&
+        (lifetime || head.etag[0] || head.last_modified[0])) {
+        HttpCacheEntry *e = http_cache_store(url, status, body.copy, body.copy_len);
+        if (e) http_cache_update(e, &head);
+    } else {
+        kfree(body.copy);
+        http_cache_drop(url);
+    }
+    return status;
+}
+
+typedef struct {
+    char    *buf;
+    uint32_t max;
+    uint32_t len;
+} HttpBufSink;
+
+static int http_buf_sink(void *ctx, const uint8_t *data, uint32_t len) {
+    HttpBufSink *s = (HttpBufSink *)ctx;
+    uint32_t room  = s->max - 1 - s->len;
+    if (len > room) len = room;
+    memcpy(s->buf + s->len, data, len);
+    s->len += len;
+    s->buf[s->len] = '\0';
+    // Stop downloading once the buffer is full.
+    return s->len + 1 >= s->max;
+}
+
+int net_http_get(const char *url, char *buf, uint32_t max_len) {
+    if (!buf || max_len == 0) return NET_ERR;
+    buf[0] = '\0';
+    HttpBufSink s = { buf, max_len, 0 };
+    return net_http_fetch(url, http_buf_sink, &s);
+}
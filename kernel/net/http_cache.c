@@ -0,0 +1,102 @@
+// kernel/net/http_cache.c
+// In-memory HTTP response cache: a fixed table of entries keyed by URL,
+// bounded by a total byte budget and evicted least recently used first.
+// Freshness and validators are filled in by the client (http.c).
+
+#include "http.h"
+#include "klib.h"
+#include "mm.h"
+
+#define HTTP_CACHE_ENTRIES   16
+#define HTTP_CACHE_MAX_BYTES (4u * 1024 * 1024)
+
+static HttpCacheEntry g_http_cache[HTTP_CACHE_ENTRIES];
+static uint32_t       g_http_cache_bytes = 0;
+static uint64_t       g_http_cache_clock = 0;
+static uint32_t       g_http_cache_counts[3];
+
+static void cache_free(HttpCacheEntry *e) {
+    g_http_cache_bytes -= e->len;
+    kfree(e->body);
+    memset(e, 0, sizeof(*e));
+}
+
+static HttpCacheEntry *cache_find(const char *url) {
+    for (int i = 0; i < HTTP_CACHE_ENTRIES; ++i) {
+        if (g_http_cache[i].url[0] && str_eq(g_http_cache[i].url, url)) {
+            return &g_http_cache[i];
+        }
+    }
+    return 0;
+}
+
+// Least recently used live entry, or 0 if the cache is empty.
+static HttpCacheEntry *cache_lru(void) {
+    HttpCacheEntry *victim = 0;
+    for (int i = 0; i < HTTP_CACHE_ENTRIES; ++i) {
+        HttpCacheEntry *e = &g_http_cache[i];
+        if (e->url[0] && (!victim || e->last_used < victim->last_used)) victim = e;
+    }
+    return victim;
+}
+
+HttpCacheEntry *http_cache_lookup(const char *url) {
+    HttpCacheEntry *e = cache_find(url);
+    if (e) e->last_used = ++g_http_cache_clock;
+    return e;
+}
+
+HttpCacheEntry *http_cache_store(const char *url, int status,
+                                 uint8_t *body, uint32_t len) {
+    http_cache_drop(url);
+    if (len > HTTP_CACHE_MAX_ENTRY || str_len(url) >= HTTP_URL_MAX) {
+        kfree(body);
+        return 0;
+    }
+
+    while (g_http_cache_bytes + len > HTTP_CACHE_MAX_BYTES) {
+        cache_free(cache_lru());
+    }
+    HttpCacheEntry *slot = 0;
+    for (int i = 0; i < HTTP_CACHE_ENTRIES && !slot; ++i) {
+        if (!g_http_cache[i].url[0]) slot = &g_http_cache[i];
+    }
+    if (!slot) {
+        slot = cache_lru();
+        cache_free(slot);
+    }
+
+    str_copy(slot->url, url, HTTP_URL_MAX);
+    slot->body      = body;
+    slot->len       = len;
+    slot->status    = status;
+    slot->last_used = ++g_http_cache_clock;
+    g_http_cache_bytes += len;
+    return slot;
+}
+
+void http_cache_drop(const char *url) {
+    HttpCacheEntry *e = cache_find(url);
+    if (e) cache_free(e);
+}
+
+void http_cache_clear(void) {
+    for (int i = 0; i < HTTP_CACHE_ENTRIES; ++i) {
+        if (g_http_cache[i].url[0]) cache_free(&g_http_cache[i]);
+    }
+}
+
+void http_cache_count(int what) {
+    g_http_cache_counts[what]++;
+}
+
+void http_cache_stats(HttpCacheStats *out) {
+    memset(out, 0, sizeof(*out));
+    for (int i = 0; i < HTTP_CACHE_ENTRIES; ++i) {
+        if (g_http_cache[i].url[0]) out->entries++;
+    }
+    out->bytes       = g_http_cache_bytes;
+    out->hits        = g_http_cache_counts[HTTP_CACHE_HIT];
+    out->revalidated = g_http_cache_counts[HTTP_CACHE_REVALIDATED];
+    out->misses      = g_http_cache_counts[HTTP_CACHE_MISS];
+}
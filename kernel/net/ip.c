@@ -0,0 +1,196 @@
+// kernel/net/ip.c
+// IPv4 input/output and ICMP echo.
+//
+// No fragmentation: we send with DF set and an MSS that fits the MTU, and
+// drop incoming fragments (counted in g_ip_frag_dropped).
+
+#include "net.h"
+#include "klib.h"
+#include "io.h"
+#include "timer.h"
+
+static uint16_t g_ip_id = 1;
+static uint64_t g_ip_frag_dropped = 0;
+
+// ---------------------------------------------------------------------
+// IPv4
+// ---------------------------------------------------------------------
+
+static NetIf *ip_route(uint32_t dst, uint32_t *next_hop) {
+    NetIf *nif = net_default_if();
+    if (!nif) return 0;
+    if (dst == IP_BROADCAST) {
+        *next_hop = dst;
+        return nif;
+    }
+    if (!nif->configured) return 0;
+    if ((dst & nif->netmask) == (nif->ip & nif->netmask) || !nif->gateway) {
+        *next_hop = dst;
+    } else {
+        *next_hop = nif->gateway;
+    }
+    return nif;
+}
+
+uint32_t ip_source_for(uint32_t dst) {
+    uint32_t hop = 0;
+    NetIf   *nif = ip_route(dst, &hop);
+    return nif ? nif->ip : 0;
+}
+
+int ip_output(NetBuf *nb, uint32_t src, uint32_t dst, uint8_t proto) {
+    uint32_t next_hop = 0;
+    NetIf   *nif      = ip_route(dst, &next_hop);
+    if (!nif) {
+        netbuf_free(nb);
+        return NET_EUNREACH;
+    }
+    if (!src) src = nif->ip;
+
+    uint16_t total = (uint16_t)(nb->len + IP_HDR_LEN);
+    uint8_t *h     = netbuf_push(nb, IP_HDR_LEN);
+    if (!h) {
+        netbuf_free(nb);
+        return NET_ENOMEM;
+    }
+    h[0] = 0x45;            // v4, 20-byte header
+    h[1] = 0;
+    put_be16(h + 2, total);
+    put_be16(h + 4, g_ip_id++);
+    put_be16(h + 6, 0x4000); // DF
+    h[8] = 64;
+    h[9] = proto;
+    put_be16(h + 10, 0);
+    put_be32(h + 12, src);
+    put_be32(h + 16, dst);
+    put_be16(h + 10, net_csum_fold(net_csum_add(0, h, IP_HDR_LEN)));
+
+    return arp_output(nif, nb, next_hop);
+}
+
+void ip_input(NetIf *nif, NetBuf *nb) {
+    uint8_t *h = nb->data;
+    if (nb->len < IP_HDR_LEN || (h[0] >> 4) != 4) goto drop;
+
+    uint32_t hlen  = (uint32_t)(h[0] & 0x0F) * 4;
+    uint32_t total = get_be16(h + 2);
+    if (hlen < IP_HDR_LEN || hlen > nb->len || total < hlen || total > nb->len) goto drop;
+    if (net_csum_fold(net_csum_add(0, h, hlen)) != 0) goto drop;
+
+    if (get_be16(h + 6) & 0x3FFF) {
+        g_ip_frag_dropped++;
+        goto drop;
+    }
+
+    IpInfo info;
+    info.src   = get_be32(h + 12);
+    info.dst   = get_be32(h + 16);
+    info.proto = h[9];
+    info.ttl   = h[8];
+
+    // Until DHCP has bound an address we accept anything (the offer may be
+    // unicast to the address we have not taken yet).
+    if (nif->configured &&
+        info.dst != nif->ip &&
+        info.dst != IP_BROADCAST &&
+        info.dst != (nif->ip | ~nif->netmask)) {
+        goto drop;
+    }
+
+    // Strip Ethernet padding, then the IP header itself.
+    nb->len = total;
+    netbuf_pull(nb, hlen);
+
+    switch (info.proto) {
+        case IP_PROTO_ICMP: icmp_input(nif, nb, &info); return;
+        case IP_PROTO_UDP:  udp_input(nif, nb, &info);  return;
+        case IP_PROTO_TCP:  tcp_input(nif, nb, &info);  return;
+        default: break;
+    }
+
+drop:
+    netbuf_free(nb);
+}
+
+// ---------------------------------------------------------------------
+// ICMP echo
+// ---------------------------------------------------------------------
+
+#define ICMP_ECHO_REPLY   0
+#define ICMP_ECHO_REQUEST 8
+#define ICMP_HDR_LEN      8
+#define PING_ID           0x4C4F    // "LO"
+#define PING_PAYLOAD      32
+
+static struct {
+    uint16_t seq;
+    int      waiting;
+    int      answered;
+    uint64_t sent_us;
+    uint64_t rtt_us;
+} g_ping;
+
+void icmp_input(NetIf *nif, NetBuf *nb, const IpInfo *ip) {
+    (void)nif;
+    uint8_t *p = nb->data;
+    if (nb->len < ICMP_HDR_LEN ||
+        net_csum_fold(net_csum_add(0, p, nb->len)) != 0) {
+        netbuf_free(nb);
+        return;
+    }
+
+    if (p[0] == ICMP_ECHO_REQUEST && ip->dst != IP_BROADCAST) {
+        // Turn the request into the reply in place and send it back.
+        p[0] = ICMP_ECHO_REPLY;
+        put_be16(p + 2, 0);
+        put_be16(p + 2, net_csum_fold(net_csum_add(0, p, nb->len)));
+        ip_output(nb, ip->dst, ip->src, IP_PROTO_ICMP);
+        return;
+    }
+
+    if (p[0] == ICMP_ECHO_REPLY &&
+        g_ping.waiting &&
+        get_be16(p + 4) == PING_ID &&
+        get_be16(p + 6) == g_ping.seq) {
+        g_ping.rtt_us   = time_us() - g_ping.sent_us;
+        g_ping.answered = 1;
+    }
+    netbuf_free(nb);
+}
+
+int icmp_ping(uint32_t dst, uint16_t seq, uint32_t timeout_ms, uint32_t *rtt_us) {
+    NetBuf *nb = netbuf_alloc();
+    if (!nb) return NET_ENOMEM;
+
+    uint8_t *p = netbuf_put(nb, ICMP_HDR_LEN + PING_PAYLOAD);
+    p[0] = ICMP_ECHO_REQUEST;
+    p[1] = 0;
+    put_be16(p + 2, 0);
+    put_be16(p + 4, PING_ID);
+    put_be16(p + 6, seq);
+    for (uint32_t i = 0; i < PING_PAYLOAD; ++i) {
+        p[ICMP_HDR_LEN + i] = (uint8_t)('a' + (i % 23));
+    }
+    put_be16(p + 2, net_csum_fold(net_csum_add(0, p, nb->len)));
+
+    g_ping.seq      = seq;
+    g_ping.waiting  = 1;
+    g_ping.answered = 0;
+    g_ping.sent_us  = time_us();
+
+    int rc = ip_output(nb, 0, dst, IP_PROTO_ICMP);
+    if (rc < 0) {
+        g_ping.waiting = 0;
+        return rc;
+    }
+
+    uint64_t deadline = time_ms() + timeout_ms;
+    while (!g_ping.answered && time_ms() < deadline) {
+        net_tick();
+        cpu_relax();
+    }
+    g_ping.waiting = 0;
+    if (!g_ping.answered) return NET_ETIMEDOUT;
+    if (rtt_us) *rtt_us = (uint32_t)g_ping.rtt_us;
+    return NET_OK;
+}
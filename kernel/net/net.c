@@ -0,0 +1,171 @@
+// kernel/net/net.c
+// Interface table, Ethernet demux, checksums and the stack's periodic tick.
+
+#include "net.h"
+#include "klib.h"
+#include "io.h"
+#include "timer.h"
+
+// Frames handled per NIC per tick, so a flood of packets cannot starve
+// keyboard/mouse polling in the main loop.
+#define NET_POLL_BUDGET 32
+
+static NetIf g_ifs[NETDEV_MAX];
+static int   g_if_count = 0;
+
+static uint64_t g_last_tick_ms = 0;
+
+// ---------------------------------------------------------------------
+// Checksums
+// ---------------------------------------------------------------------
+
+uint32_t net_csum_add(uint32_t sum, const void *data, uint32_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+    while (len > 1) {
+        sum += (uint32_t)((p[0] << 8) | p[1]);
+        p   += 2;
+        len -= 2;
+    }
+    if (len) sum += (uint32_t)(p[0] << 8);
+    return sum;
+}
+
+uint16_t net_csum_fold(uint32_t sum) {
+    while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+uint32_t net_pseudo_sum(uint32_t src, uint32_t dst, uint8_t proto, uint16_t len) {
+    uint32_t sum = 0;
+    sum += src >> 16;
+    sum += src & 0xFFFF;
+    sum += dst >> 16;
+    sum += dst & 0xFFFF;
+    sum += proto;
+    sum += len;
+    return sum;
+}
+
+// ---------------------------------------------------------------------
+// Address formatting
+// ---------------------------------------------------------------------
+
+void net_format_ip(char *buf, uint32_t max_len, uint32_t ip) {
+    if (!buf || max_len == 0) return;
+    buf[0] = '\0';
+    for (int i = 3; i >= 0; --i) {
+        str_cat_u64(buf, (ip >> (i * 8)) & 0xFF, max_len);
+        if (i) str_cat(buf, ".", max_len);
+    }
+}
+
+int net_parse_ip(const char *s, uint32_t *out) {
+    uint32_t ip = 0;
+    for (int part = 0; part < 4; ++part) {
+        if (*s < '0' || *s > '9') return -1;
+        uint32_t v = 0;
+        int digits = 0;
+        while (*s >= '0' && *s <= '9') {
+            v = v * 10 + (uint32_t)(*s - '0');
+            if (++digits > 3 || v > 255) return -1;
+            ++s;
+        }
+        ip = (ip << 8) | v;
+        if (part < 3) {
+            if (*s != '.') return -1;
+            ++s;
+        }
+    }
+    if (*s) return -1;
+    *out = ip;
+    return 0;
+}
+
+// ---------------------------------------------------------------------
+// Interfaces
+// ---------------------------------------------------------------------
+
+NetIf *net_if_for(NetDevice *dev) {
+    for (int i = 0; i < g_if_count; ++i) {
+        if (g_ifs[i].dev == dev) return &g_ifs[i];
+    }
+    return 0;
+}
+
+NetIf *net_default_if(void) {
+    for (int i = 0; i < g_if_count; ++i) {
+        if (g_ifs[i].configured) return &g_ifs[i];
+    }
+    return g_if_count ? &g_ifs[0] : 0;
+}
+
+int net_wait_configured(uint32_t timeout_ms) {
+    if (g_if_count == 0) return NET_EUNREACH;
+    uint64_t deadline = time_ms() + timeout_ms;
+    for (;;) {
+        NetIf *nif = net_default_if();
+        if (nif && nif->configured) return NET_OK;
+        if (time_ms() >= deadline) return NET_ETIMEDOUT;
+        net_tick();
+        cpu_relax();
+    }
+}
+
+// Frames from the driver land here. The buffer is consumed in every path.
+static void net_rx(NetDevice *dev, NetBuf *nb) {
+    NetIf *nif = net_if_for(dev);
+    if (!nif || nb->len < ETH_HDR_LEN) {
+        netbuf_free(nb);
+        return;
+    }
+
+    const uint8_t *eth  = nb->data;
+    uint16_t       type = get_be16(eth + 12);
+    netbuf_pull(nb, ETH_HDR_LEN);
+
+    switch (type) {
+        case ETH_TYPE_ARP:
+            arp_input(nif, nb);
+            break;
+        case ETH_TYPE_IPV4:
+            ip_input(nif, nb);
+            break;
+        default:
+            netbuf_free(nb);
+            break;
+    }
+}
+
+void net_init(void) {
+    g_if_count = 0;
+    for (int i = 0; i < netdev_count() && g_if_count < NETDEV_MAX; ++i) {
+        NetIf *nif = &g_ifs[g_if_count++];
+        memset(nif, 0, sizeof(*nif));
+        nif->dev = netdev_get(i);
+        nif->dev->rx = net_rx;
+    }
+    if (g_if_count > 0) {
+        dhcp_start(&g_ifs[0]);
+    }
+}
+
+void net_tick(void) {
+    if (g_if_count == 0) return;
+
+    netdev_poll_all(NET_POLL_BUDGET);
+
+    // Protocol timers have millisecond granularity; don't walk the tables
+    // more often than that.
+    uint64_t now = time_ms();
+    if (now != g_last_tick_ms) {
+        g_last_tick_ms = now;
+        arp_tick(now);
+        tcp_tick(now);
+        dhcp_tick(now);
+        // Anything the timers queued leaves with one doorbell per device.
+        for (int i = 0; i < g_if_count; ++i) {
+            NetDevice *dev = g_ifs[i].dev;
+            if (dev->flush) dev->flush(dev);
+        }
+    }
+}
@@ -0,0 +1,97 @@
+// kernel/net/netbuf.c
+// Packet buffer allocation and header push/pull helpers.
+
+#include "netbuf.h"
+#include "mm.h"
+
+static KmemCache *g_netbuf_cache = 0;
+static uint32_t   g_netbuf_in_use = 0;
+
+NetBuf *netbuf_alloc(void) {
+    if (!g_netbuf_cache) {
+        g_netbuf_cache = kmem_cache_create("netbuf", NETBUF_SIZE, 64);
+        if (!g_netbuf_cache) return 0;
+    }
+    NetBuf *nb = (NetBuf *)kmem_cache_alloc(g_netbuf_cache);
+    if (!nb) return 0;
+    nb->next  = 0;
+    nb->dev   = 0;
+    nb->flags = 0;
+    netbuf_reset(nb, NETBUF_HEADROOM);
+    g_netbuf_in_use++;
+    return nb;
+}
+
+void netbuf_free(NetBuf *nb) {
+    if (!nb) return;
+    g_netbuf_in_use--;
+    kmem_cache_free(g_netbuf_cache, nb);
+}
+
+void netbuf_reset(NetBuf *nb, uint32_t headroom) {
+    if (headroom > NETBUF_CAPACITY) headroom = NETBUF_CAPACITY;
+    nb->data = nb->storage + headroom;
+    nb->len  = 0;
+}
+
+uint32_t netbuf_headroom(const NetBuf *nb) {
+    return (uint32_t)(nb->data - nb->storage);
+}
+
+uint32_t netbuf_tailroom(const NetBuf *nb) {
+    return NETBUF_CAPACITY - netbuf_headroom(nb) - nb->len;
+}
+
+uint8_t *netbuf_push(NetBuf *nb, uint32_t n) {
+    if (netbuf_headroom(nb) < n) return 0;
+    nb->data -= n;
+    nb->len  += n;
+    return nb->data;
+}
+
+uint8_t *netbuf_pull(NetBuf *nb, uint32_t n) {
+    if (nb->len < n) return 0;
+    nb->data += n;
+    nb->len  -= n;
+    return nb->data;
+}
+
+uint8_t *netbuf_put(NetBuf *nb, uint32_t n) {
+    if (netbuf_tailroom(nb) < n) return 0;
+    uint8_t *tail = nb->data + nb->len;
+    nb->len += n;
+    return tail;
+}
+
+uint32_t netbuf_in_use(void) {
+    return g_netbuf_in_use;
+}
+
+// ---------------------------------------------------------------------
+// Queues
+// ---------------------------------------------------------------------
+
+void netbuf_queue_push(NetBufQueue *q, NetBuf *nb) {
+    nb->next = 0;
+    if (q->tail) q->tail->next = nb;
+    else         q->head = nb;
+    q->tail = nb;
+    q->count++;
+}
+
+NetBuf *netbuf_queue_pop(NetBufQueue *q) {
+    NetBuf *nb = q->head;
+    if (!nb) return 0;
+    q->head = nb->next;
+    if (!q->head) q->tail = 0;
+    nb->next = 0;
+    q->count--;
+    return nb;
+}
+
+void netbuf_queue_purge(NetBufQueue *q) {
+    NetBuf *nb;
+    while ((nb = netbuf_queue_pop(q)) != 0) {
+        netbuf_free(nb);
+    }
+}
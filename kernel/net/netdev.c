@@ -0,0 +1,52 @@
+// kernel/net/netdev.c
+// Registry of network devices and the receive/poll glue.
+
+#include "netdev.h"
+#include "klib.h"
+
+static NetDevice *g_netdevs[NETDEV_MAX];
+static int        g_netdev_count = 0;
+
+int netdev_register(NetDevice *dev) {
+    if (!dev || g_netdev_count >= NETDEV_MAX) return -1;
+    str_copy(dev->name, "eth", sizeof(dev->name));
+    char num[4] = { (char)('0' + g_netdev_count), '\0' };
+    str_cat(dev->name, num, sizeof(dev->name));
+    g_netdevs[g_netdev_count++] = dev;
+    return 0;
+}
+
+int netdev_count(void) {
+    return g_netdev_count;
+}
+
+NetDevice *netdev_get(int index) {
+    if (index < 0 || index >= g_netdev_count) return 0;
+    return g_netdevs[index];
+}
+
+void netdev_receive(NetDevice *dev, NetBuf *nb) {
+    nb->dev = dev;
+    dev->stats.rx_packets++;
+    dev->stats.rx_bytes += nb->len;
+    if (dev->rx) {
+        dev->rx(dev, nb);
+    } else {
+        // No protocol stack attached yet.
+        dev->stats.rx_dropped++;
+        netbuf_free(nb);
+    }
+}
+
+int netdev_poll_all(int budget) {
+    int total = 0;
+    for (int i = 0; i < g_netdev_count; ++i) {
+        NetDevice *dev = g_netdevs[i];
+        int n = dev->poll ? dev->poll(dev, budget) : 0;
+        if (n > 0) dev->stats.rx_polls++;
+        total += n;
+        // Replies generated while processing this batch leave with one kick.
+        if (dev->flush) dev->flush(dev);
+    }
+    return total;
+}
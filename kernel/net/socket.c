@@ -0,0 +1,256 @@
+// kernel/net/socket.c
+// In-kernel sockets: a fixed table of stream (TCP) and datagram (UDP)
+// endpoints with blocking wrappers that pump the stack while they wait.
+
+#include "net.h"
+#include "socket.h"
+#include "tcp.h"
+#include "klib.h"
+#include "io.h"
+#include "timer.h"
+
+#define UDP_QUEUE_MAX 16
+
+struct Socket {
+    int         type;       // 0 = free slot
+    uint16_t    port;       // bound local port (UDP)
+    TcpCb      *tcb;        // stream sockets
+    NetBufQueue dgrams;     // datagram sockets; source in cb[0]/cb[1]
+};
+
+static Socket   g_sockets[NET_MAX_SOCKETS];
+static uint16_t g_udp_next_port = 0;
+
+// ---------------------------------------------------------------------
+// Helpers
+// ---------------------------------------------------------------------
+
+// Pumps the stack until ready(s) holds or the timeout passes. Returns 1 if
+// ready. A zero timeout just checks once.
+static int sock_wait(Socket *s, int (*ready)(Socket *), uint32_t timeout_ms) {
+    if (ready(s)) return 1;
+    if (timeout_ms == 0) return 0;
+    uint64_t deadline = time_ms() + timeout_ms;
+    while (time_ms() < deadline) {
+        net_tick();
+        if (ready(s)) return 1;
+        cpu_relax();
+    }
+    return ready(s);
+}
+
+static int ready_connected(Socket *s) {
+    int st = tcp_state(s->tcb);
+    return st != TCP_SYN_SENT && st != TCP_SYN_RCVD;
+}
+
+static int ready_readable(Socket *s) {
+    if (s->type == SOCK_DGRAM) return s->dgrams.head != 0;
+    return tcp_readable(s->tcb);
+}
+
+static int ready_writable(Socket *s) {
+    return tcp_writable(s->tcb) || tcp_error(s->tcb) ||
+           tcp_state(s->tcb) == TCP_CLOSED;
+}
+
+static Socket *sock_find_udp(uint16_t port) {
+    for (int i = 0; i < NET_MAX_SOCKETS; ++i) {
+        if (g_sockets[i].type == SOCK_DGRAM && g_sockets[i].port == port) {
+            return &g_sockets[i];
+        }
+    }
+    return 0;
+}
+
+static uint16_t udp_ephemeral_port(void) {
+    if (!g_udp_next_port) {
+        g_udp_next_port = (uint16_t)(49152u + (rdtsc() & 0x3FFF));
+    }
+    for (int tries = 0; tries < 16384; ++tries) {
+        uint16_t p = g_udp_next_port++;
+        if (g_udp_next_port < 49152u) g_udp_next_port = 49152u;
+        if (!sock_find_udp(p)) return p;
+    }
+    return 0;
+}
+
+int sock_udp_deliver(uint16_t dport, NetBuf *nb, uint32_t src, uint16_t sport) {
+    Socket *s = sock_find_udp(dport);
+    if (!s) return NET_ENOTCONN;
+    if (s->dgrams.count >= UDP_QUEUE_MAX) {
+        netbuf_free(netbuf_queue_pop(&s->dgrams));
+    }
+    nb->cb[0] = src;
+    nb->cb[1] = sport;
+    netbuf_queue_push(&s->dgrams, nb);
+    return NET_OK;
+}
+
+// ---------------------------------------------------------------------
+// Lifecycle
+// ---------------------------------------------------------------------
+
+Socket *sock_open(int type) {
+    if (type != SOCK_STREAM && type != SOCK_DGRAM) return 0;
+    for (int i = 0; i < NET_MAX_SOCKETS; ++i) {
+        Socket *s = &g_sockets[i];
+        if (s->type) continue;
+        memset(s, 0, sizeof(*s));
+        if (type == SOCK_STREAM) {
+            s->tcb = tcp_open();
+            if (!s->tcb) return 0;
+        }
+        s->type = type;
+        return s;
+    }
+    return 0;
+}
+
+int sock_bind(Socket *s, uint16_t port) {
+    if (s->type == SOCK_STREAM) return tcp_bind(s->tcb, port);
+    if (sock_find_udp(port)) return NET_EADDRINUSE;
+    s->port = port;
+    return NET_OK;
+}
+
+int sock_connect(Socket *s, uint32_t ip, uint16_t port, uint32_t timeout_ms) {
+    if (s->type != SOCK_STREAM) return NET_ENOTSUP;
+    int rc = tcp_connect(s->tcb, ip, port);
+    if (rc < 0) return rc;
+    if (!sock_wait(s, ready_connected, timeout_ms)) {
+        return timeout_ms ? NET_ETIMEDOUT : NET_EAGAIN;
+    }
+    if (tcp_state(s->tcb) == TCP_CLOSED) {
+        return tcp_error(s->tcb) ? tcp_error(s->tcb) : NET_EREFUSED;
+    }
+    return NET_OK;
+}
+
+int sock_listen(Socket *s, int backlog) {
+    if (s->type != SOCK_STREAM) return NET_ENOTSUP;
+    return tcp_listen(s->tcb, backlog);
+}
+
+Socket *sock_accept(Socket *s, uint32_t timeout_ms, int *err) {
+    if (err) *err = NET_OK;
+    if (s->type != SOCK_STREAM || tcp_state(s->tcb) != TCP_LISTEN) {
+        if (err) *err = NET_ENOTSUP;
+        return 0;
+    }
+    if (!sock_wait(s, ready_readable, timeout_ms)) {
+        if (err) *err = timeout_ms ? NET_ETIMEDOUT : NET_EAGAIN;
+        return 0;
+    }
+    for (int i = 0; i < NET_MAX_SOCKETS; ++i) {
+        Socket *c = &g_sockets[i];
+        if (c->type) continue;
+        memset(c, 0, sizeof(*c));
+        c->tcb = tcp_accept(s->tcb);
+        if (!c->tcb) break;
+        c->type = SOCK_STREAM;
+        return c;
+    }
+    if (err) *err = NET_ENOMEM;
+    return 0;
+}
+
+void sock_close(Socket *s) {
+    if (!s || !s->type) return;
+    if (s->type == SOCK_STREAM) {
+        tcp_close(s->tcb);
+    } else {
+        netbuf_queue_purge(&s->dgrams);
+    }
+    memset(s, 0, sizeof(*s));
+}
+
+// ---------------------------------------------------------------------
+// Data transfer
+// ---------------------------------------------------------------------
+
+int sock_send(Socket *s, const void *buf, uint32_t len, uint32_t timeout_ms) {
+    if (s->type != SOCK_STREAM) return NET_ENOTSUP;
+    const uint8_t *p    = (const uint8_t *)buf;
+    uint32_t       sent = 0;
+    uint64_t       deadline = time_ms() + timeout_ms;
+
+    // Keep topping up the send buffer as ACKs free space.
+    while (sent < len) {
+        int n = tcp_send(s->tcb, p + sent, len - sent);
+        if (n < 0) return sent ? (int)sent : n;
+        sent += (uint32_t)n;
+        if (sent == len) break;
+        uint64_t now = time_ms();
+        if (now >= deadline) break;
+        if (!sock_wait(s, ready_writable, (uint32_t)(deadline - now))) break;
+    }
+    if (sent == 0 && len) return timeout_ms ? NET_ETIMEDOUT : NET_EAGAIN;
+    return (int)sent;
+}
+
+int sock_recv(Socket *s, void *buf, uint32_t len, uint32_t timeout_ms) {
+    if (s->type != SOCK_STREAM) return NET_ENOTSUP;
+    if (!sock_wait(s, ready_readable, timeout_ms)) {
+        return timeout_ms ? NET_ETIMEDOUT : NET_EAGAIN;
+    }
+    return tcp_recv(s->tcb, buf, len);
+}
+
+int sock_sendto(Socket *s, const void *buf, uint32_t len, uint32_t ip, uint16_t port) {
+    if (s->type != SOCK_DGRAM) return NET_ENOTSUP;
+    if (!s->port) {
+        s->port = udp_ephemeral_port();
+        if (!s->port) return NET_EADDRINUSE;
+    }
+    NetBuf *nb = netbuf_alloc();
+    if (!nb) return NET_ENOMEM;
+    uint8_t *p = netbuf_put(nb, len);
+    if (!p) {
+        netbuf_free(nb);
+        return NET_ERR;
+    }
+    memcpy(p, buf, len);
+    int rc = udp_output(nb, 0, s->port, ip, port);
+    return rc < 0 ? rc : (int)len;
+}
+
+int sock_recvfrom(Socket *s, void *buf, uint32_t len,
+                  uint32_t *ip, uint16_t *port, uint32_t timeout_ms) {
+    if (s->type != SOCK_DGRAM) return NET_ENOTSUP;
+    if (!sock_wait(s, ready_readable, timeout_ms)) {
+        return timeout_ms ? NET_ETIMEDOUT : NET_EAGAIN;
+    }
+    NetBuf  *nb = netbuf_queue_pop(&s->dgrams);
+    uint32_t n  = nb->len < len ? nb->len : len;
+    memcpy(buf, nb->data, n);
+    if (ip)   *ip   = nb->cb[0];
+    if (port) *port = (uint16_t)nb->cb[1];
+    netbuf_free(nb);
+    return (int)n;
+}
+
+// ---------------------------------------------------------------------
+// Status
+// ---------------------------------------------------------------------
+
+int sock_poll(Socket *s) {
+    int mask = 0;
+    if (ready_readable(s)) mask |= SOCK_READABLE;
+    if (s->type == SOCK_DGRAM) return mask | SOCK_WRITABLE;
+    if (tcp_writable(s->tcb)) mask |= SOCK_WRITABLE;
+    if (tcp_error(s->tcb))    mask |= SOCK_ERROR;
+    return mask;
+}
+
+int sock_state(Socket *s) {
+    return s->type == SOCK_STREAM ? tcp_state(s->tcb) : TCP_CLOSED;
+}
+
+int sock_count(void) {
+    int n = 0;
+    for (int i = 0; i < NET_MAX_SOCKETS; ++i) {
+        if (g_sockets[i].type) n++;
+    }
+    return n;
+}
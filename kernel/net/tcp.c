@@ -0,0 +1,1050 @@
+// kernel/net/tcp.c
+// TCP: connection state machine, sliding-window send path with Reno
+// congestion control, delayed ACKs and an out-of-order reassembly queue.
+//
+// Received segments are never copied inside the stack: in-order buffers go
+// onto rcvq as they arrived (headers pulled off), out-of-order ones wait on
+// the ooo list sorted by sequence number until the hole in front of them is
+// filled. The send side copies user data into a ring once and builds each
+// segment (or retransmission) straight from it.
+
+#include "net.h"
+#include "tcp.h"
+#include "klib.h"
+#include "mm.h"
+#include "timer.h"
+
+#define TCP_HDR_LEN      20
+#define TCP_SNDBUF       16384u
+#define TCP_RCVBUF       32768u
+#define TCP_DEFAULT_MSS  536
+#define TCP_INIT_CWND    10          // segments (RFC 6928)
+#define TCP_RTO_INIT_MS  1000
+#define TCP_RTO_MIN_MS   200
+#define TCP_RTO_MAX_MS   60000
+#define TCP_MAX_RETRIES  8
+#define TCP_DELACK_MS    40
+#define TCP_TIME_WAIT_MS 2000        // short 2MSL; we never reuse ports quickly
+#define TCP_EPHEMERAL_LO 49152u
+
+#define TH_FIN 0x01
+#define TH_SYN 0x02
+#define TH_RST 0x04
+#define TH_PSH 0x08
+#define TH_ACK 0x10
+
+// Sequence space comparisons (mod 2^32).
+#define SEQ_LT(a, b)  ((int32_t)((a) - (b)) < 0)
+#define SEQ_LEQ(a, b) ((int32_t)((a) - (b)) <= 0)
+#define SEQ_GT(a, b)  ((int32_t)((a) - (b)) > 0)
+#define SEQ_GEQ(a, b) ((int32_t)((a) - (b)) >= 0)
+
+// Per-buffer bookkeeping on the reassembly queue (NetBuf.cb).
+#define CB_SEQ 0
+#define CB_FIN 1
+
+struct TcpCb {
+    TcpCb   *next;          // g_tcbs linkage
+    TcpCb   *parent;        // listener that spawned us, until accepted
+    int      state;
+    int      error;         // sticky NET_* error once the connection died
+    int      owned;         // a socket holds this control block
+    int      backlog;
+
+    uint32_t lip, rip;
+    uint16_t lport, rport;
+    uint16_t mss;           // largest segment we send
+
+    // Send sequence space
+    uint32_t iss;
+    uint32_t snd_una;
+    uint32_t snd_nxt;
+    uint32_t snd_max;       // highest sequence sent (snd_nxt rewinds on RTO)
+    uint32_t snd_wnd;
+    uint32_t snd_wl1, snd_wl2;
+    uint32_t cwnd;
+    uint32_t ssthresh;
+    int      dupacks;
+
+    // Send buffer: sbuf_len bytes starting at sequence sbuf_seq
+    uint8_t *sbuf;
+    uint32_t sbuf_head;
+    uint32_t sbuf_len;
+    uint32_t sbuf_seq;
+    int      fin_pending;   // user closed: FIN follows the buffered data
+    int      fin_sent;
+    uint32_t fin_seq;
+
+    // Receive sequence space
+    uint32_t irs;
+    uint32_t rcv_nxt;
+    uint32_t rcv_adv;       // right edge of the last advertised window
+    NetBufQueue rcvq;
+    uint32_t rcv_queued;
+    NetBuf  *ooo;           // out-of-order segments, sorted by CB_SEQ
+    uint32_t ooo_bytes;
+    int      rcv_fin;
+
+    // Timers (absolute time_ms() deadlines, 0 = off)
+    uint64_t rtx_deadline;
+    uint64_t ack_deadline;
+    uint64_t tw_deadline;
+    uint32_t rto;
+    int      rtx_count;
+    int      ack_pending;   // in-order segments received since our last ACK
+    int      ack_pushed;    // a short pushed segment is awaiting our ACK
+    int      has_rtt;
+    int32_t  srtt, rttvar;
+    uint32_t rtt_seq;       // segment being timed (Karn: never a retransmit)
+    uint64_t rtt_start;
+};
+
+static TcpCb     *g_tcbs = 0;
+static KmemCache *g_tcb_cache = 0;
+static uint16_t   g_next_port = 0;
+
+static const char *g_state_names[] = {
+    "CLOSED", "LISTEN", "SYN_SENT", "SYN_RCVD", "ESTABLISHED",
+    "FIN_WAIT_1", "FIN_WAIT_2", "CLOSE_WAIT", "CLOSING", "LAST_ACK",
+    "TIME_WAIT"
+};
+
+static void tcp_output(TcpCb *tcb, int force);
+
+// ---------------------------------------------------------------------
+// Control blocks
+// ---------------------------------------------------------------------
+
+static TcpCb *tcb_alloc(void) {
+    if (!g_tcb_cache) {
+        g_tcb_cache = kmem_cache_create("tcpcb", sizeof(TcpCb), 8);
+        if (!g_tcb_cache) return 0;
+    }
+    TcpCb *tcb = (TcpCb *)kmem_cache_alloc(g_tcb_cache);
+    if (!tcb) return 0;
+    memset(tcb, 0, sizeof(*tcb));
+    tcb->sbuf = (uint8_t *)kmalloc(TCP_SNDBUF);
+    if (!tcb->sbuf) {
+        kmem_cache_free(g_tcb_cache, tcb);
+        return 0;
+    }
+    tcb->state    = TCP_CLOSED;
+    tcb->mss      = TCP_DEFAULT_MSS;
+    tcb->rto      = TCP_RTO_INIT_MS;
+    tcb->ssthresh = 65535;
+    tcb->next     = g_tcbs;
+    g_tcbs        = tcb;
+    return tcb;
+}
+
+static void tcb_free(TcpCb *tcb) {
+    TcpCb **pp = &g_tcbs;
+    while (*pp && *pp != tcb) pp = &(*pp)->next;
+    if (*pp) *pp = tcb->next;
+
+    netbuf_queue_purge(&tcb->rcvq);
+    while (tcb->ooo) {
+        NetBuf *nb = tcb->ooo;
+        tcb->ooo = nb->next;
+        netbuf_free(nb);
+    }
+    kfree(tcb->sbuf);
+    kmem_cache_free(g_tcb_cache, tcb);
+}
+
+static int port_in_use(uint16_t port) {
+    for (TcpCb *t = g_tcbs; t; t = t->next) {
+        if (t->lport == port && t->state != TCP_CLOSED) return 1;
+    }
+    return 0;
+}
+
+static uint16_t ephemeral_port(void) {
+    if (!g_next_port) {
+        g_next_port = (uint16_t)(TCP_EPHEMERAL_LO + (rdtsc() & 0x3FFF));
+    }
+    for (uint32_t tries = 0; tries < 16384; ++tries) {
+        uint16_t p = g_next_port++;
+        if (g_next_port < TCP_EPHEMERAL_LO) g_next_port = TCP_EPHEMERAL_LO;
+        if (!port_in_use(p)) return p;
+    }
+    return 0;
+}
+
+// Out-of-order data already sits inside the window we advertised, so only
+// unread in-order bytes close it.
+static uint32_t tcp_rcv_window(const TcpCb *tcb) {
+    uint32_t used = tcb->rcv_queued;
+    uint32_t wnd  = used < TCP_RCVBUF ? TCP_RCVBUF - used : 0;
+    return wnd > 65535 ? 65535 : wnd;
+}
+
+// Moves to CLOSED with a sticky error. Sockets see it on their next call;
+// an unowned control block is reaped by tcp_tick().
+static void tcp_drop(TcpCb *tcb, int err) {
+    tcb->state        = TCP_CLOSED;
+    if (err && !tcb->error) tcb->error = err;
+    tcb->rtx_deadline = 0;
+    tcb->ack_deadline = 0;
+    tcb->tw_deadline  = 0;
+}
+
+static void tcp_enter_time_wait(TcpCb *tcb) {
+    tcb->state        = TCP_TIME_WAIT;
+    tcb->rtx_deadline = 0;
+    tcb->tw_deadline  = time_ms() + TCP_TIME_WAIT_MS;
+}
+
+// ---------------------------------------------------------------------
+// Segment output
+// ---------------------------------------------------------------------
+
+static int tcp_emit(uint32_t src, uint16_t sport, uint32_t dst, uint16_t dport,
+                    uint32_t seq, uint32_t ack, uint8_t flags, uint16_t wnd,
+                    uint16_t mss_opt, NetBuf *nb) {
+    uint32_t hlen = TCP_HDR_LEN + (mss_opt ? 4 : 0);
+    uint8_t *h    = netbuf_push(nb, hlen);
+    if (!h) {
+        netbuf_free(nb);
+        return NET_ENOMEM;
+    }
+    put_be16(h, sport);
+    put_be16(h + 2, dport);
+    put_be32(h + 4, seq);
+    put_be32(h + 8, ack);
+    h[12] = (uint8_t)((hlen / 4) << 4);
+    h[13] = flags;
+    put_be16(h + 14, wnd);
+    put_be16(h + 16, 0);
+    put_be16(h + 18, 0);
+    if (mss_opt) {
+        h[20] = 2;
+        h[21] = 4;
+        put_be16(h + 22, mss_opt);
+    }
+    uint32_t sum = net_pseudo_sum(src, dst, IP_PROTO_TCP, (uint16_t)nb->len);
+    put_be16(h + 16, net_csum_fold(net_csum_add(sum, nb->data, nb->len)));
+    return ip_output(nb, src, dst, IP_PROTO_TCP);
+}
+
+// Sends one segment for tcb carrying len bytes of the send buffer starting
+// at sequence seq. SYN segments carry our MSS option.
+static int tcp_xmit(TcpCb *tcb, uint32_t seq, uint8_t flags, uint32_t len) {
+    NetBuf *nb = netbuf_alloc();
+    if (!nb) return NET_ENOMEM;
+
+    if (len) {
+        uint8_t *p   = netbuf_put(nb, len);
+        uint32_t off = (tcb->sbuf_head + (seq - tcb->sbuf_seq)) % TCP_SNDBUF;
+        uint32_t n1  = TCP_SNDBUF - off;
+        if (n1 > len) n1 = len;
+        memcpy(p, tcb->sbuf + off, n1);
+        if (len > n1) memcpy(p + n1, tcb->sbuf, len - n1);
+    }
+
+    uint16_t mss_opt = 0;
+    if (flags & TH_SYN) {
+        NetIf *nif = net_default_if();
+        uint32_t mtu = (nif && nif->dev) ? nif->dev->mtu : 1500;
+        mss_opt = (uint16_t)(mtu - IP_HDR_LEN - TCP_HDR_LEN);
+    }
+
+    uint32_t wnd = tcp_rcv_window(tcb);
+    if (flags & TH_ACK) {
+        tcb->rcv_adv      = tcb->rcv_nxt + wnd;
+        tcb->ack_pending  = 0;
+        tcb->ack_pushed   = 0;
+        tcb->ack_deadline = 0;
+    }
+    return tcp_emit(tcb->lip, tcb->lport, tcb->rip, tcb->rport,
+                    seq, (flags & TH_ACK) ? tcb->rcv_nxt : 0, flags,
+                    (uint16_t)wnd, mss_opt, nb);
+}
+
+static void tcp_send_ack(TcpCb *tcb) {
+    tcp_xmit(tcb, tcb->snd_nxt, TH_ACK, 0);
+}
+
+static void tcp_arm_rtx(TcpCb *tcb) {
+    tcb->rtx_deadline = time_ms() + tcb->rto;
+}
+
+// Pushes out as much buffered data (and the FIN, once everything before it
+// is sent) as the peer's window and our congestion window allow. With force
+// set and a zero window, sends a one-byte window probe.
+static void tcp_output(TcpCb *tcb, int force) {
+    switch (tcb->state) {
+        case TCP_ESTABLISHED:
+        case TCP_CLOSE_WAIT:
+        case TCP_FIN_WAIT_1:
+        case TCP_CLOSING:
+        case TCP_LAST_ACK:
+            break;
+        default:
+            return;
+    }
+
+    for (;;) {
+        if (tcb->fin_sent) break;
+
+        uint32_t in_flight = tcb->snd_nxt - tcb->snd_una;
+        uint32_t wnd       = tcb->snd_wnd < tcb->cwnd ? tcb->snd_wnd : tcb->cwnd;
+        uint32_t sent      = tcb->snd_nxt - tcb->sbuf_seq;
+        uint32_t avail     = tcb->sbuf_len - sent;
+
+        if (force && wnd == 0 && in_flight == 0) wnd = 1;
+
+        uint32_t room = wnd > in_flight ? wnd - in_flight : 0;
+        if (avail == 0) {
+            if (!tcb->fin_pending) break;
+            // Everything is out; the FIN takes one sequence number.
+            tcb->fin_seq  = tcb->snd_nxt;
+            tcb->fin_sent = 1;
+            tcp_xmit(tcb, tcb->snd_nxt, TH_FIN | TH_ACK, 0);
+            tcb->snd_nxt++;
+        } else {
+            if (room == 0) break;
+            uint32_t n = avail;
+            if (n > tcb->mss) n = tcb->mss;
+            if (n > room)     n = room;
+            // Sender-side silly window avoidance: hold back a runt while
+            // earlier data is still unacknowledged.
+            if (n < tcb->mss && n < avail && in_flight > 0 && !force) break;
+
+            uint8_t flags = TH_ACK;
+            if (n == avail) flags |= TH_PSH;
+            if (n == avail && tcb->fin_pending && room > n) {
+                flags        |= TH_FIN;
+                tcb->fin_seq  = tcb->snd_nxt + n;
+                tcb->fin_sent = 1;
+            }
+            if (!tcb->rtt_start && tcb->snd_nxt == tcb->snd_max) {
+                tcb->rtt_seq   = tcb->snd_nxt;
+                tcb->rtt_start = time_ms();
+            }
+            if (tcp_xmit(tcb, tcb->snd_nxt, flags, n) < 0) break;
+            tcb->snd_nxt += n + ((flags & TH_FIN) ? 1 : 0);
+        }
+
+        if (SEQ_GT(tcb->snd_nxt, tcb->snd_max)) tcb->snd_max = tcb->snd_nxt;
+        if (!tcb->rtx_deadline) tcp_arm_rtx(tcb);
+        if (force) break;
+    }
+
+    // Zero window with data waiting: the retransmit timer doubles as the
+    // persist timer and probes the window when it fires.
+    if (!tcb->rtx_deadline && tcb->sbuf_len > tcb->snd_nxt - tcb->sbuf_seq) {
+        tcp_arm_rtx(tcb);
+    }
+}
+
+static void tcp_send_rst(uint32_t src, uint16_t sport, uint32_t dst, uint16_t dport,
+                         uint32_t seq, uint32_t ack, uint8_t flags) {
+    NetBuf *nb = netbuf_alloc();
+    if (!nb) return;
+    tcp_emit(src, sport, dst, dport, seq, ack, flags, 0, 0, nb);
+}
+
+static void tcp_abort(TcpCb *tcb, int err) {
+    if (tcb->state != TCP_CLOSED && tcb->state != TCP_LISTEN &&
+        tcb->state != TCP_SYN_SENT && tcb->state != TCP_TIME_WAIT) {
+        tcp_send_rst(tcb->lip, tcb->lport, tcb->rip, tcb->rport,
+                     tcb->snd_nxt, tcb->rcv_nxt, TH_RST | TH_ACK);
+    }
+    tcp_drop(tcb, err);
+}
+
+// ---------------------------------------------------------------------
+// Input
+// ---------------------------------------------------------------------
+
+static void tcp_rtt_sample(TcpCb *tcb, int32_t r) {
+    if (!tcb->has_rtt) {
+        tcb->srtt    = r;
+        tcb->rttvar  = r / 2;
+        tcb->has_rtt = 1;
+    } else {
+        int32_t delta = r - tcb->srtt;
+        tcb->srtt   += delta / 8;
+        if (delta < 0) delta = -delta;
+        tcb->rttvar += (delta - tcb->rttvar) / 4;
+    }
+    int32_t var = 4 * tcb->rttvar;
+    if (var < 1) var = 1;
+    uint32_t rto = (uint32_t)(tcb->srtt + var);
+    if (rto < TCP_RTO_MIN_MS) rto = TCP_RTO_MIN_MS;
+    if (rto > TCP_RTO_MAX_MS) rto = TCP_RTO_MAX_MS;
+    tcb->rto = rto;
+}
+
+static uint16_t tcp_parse_mss(const uint8_t *opt, uint32_t len) {
+    uint32_t i = 0;
+    while (i < len) {
+        uint8_t kind = opt[i];
+        if (kind == 0) break;
+        if (kind == 1) { i++; continue; }
+        if (i + 1 >= len || opt[i + 1] < 2) break;
+        if (kind == 2 && opt[i + 1] == 4 && i + 4 <= len) return get_be16(opt + i + 2);
+        i += opt[i + 1];
+    }
+    return 0;
+}
+
+static void tcp_set_mss(TcpCb *tcb, uint16_t peer_mss) {
+    NetIf *nif   = net_default_if();
+    uint32_t mtu = (nif && nif->dev) ? nif->dev->mtu : 1500;
+    uint32_t mss = mtu - IP_HDR_LEN - TCP_HDR_LEN;
+    if (peer_mss && peer_mss < mss) mss = peer_mss;
+    if (!peer_mss && mss > TCP_DEFAULT_MSS) mss = TCP_DEFAULT_MSS;
+    tcb->mss  = (uint16_t)mss;
+    tcb->cwnd = TCP_INIT_CWND * mss;
+}
+
+// The peer acknowledged up to ack: release send buffer space, take an RTT
+// sample, open the congestion window and manage the retransmit timer.
+static void tcp_ack_advance(TcpCb *tcb, uint32_t ack) {
+    uint32_t acked = ack - tcb->snd_una;
+    if (tcb->fin_sent && SEQ_GT(ack, tcb->fin_seq)) acked--;
+    if (acked > tcb->sbuf_len) acked = tcb->sbuf_len;
+
+    tcb->sbuf_head = (tcb->sbuf_head + acked) % TCP_SNDBUF;
+    tcb->sbuf_len -= acked;
+    tcb->sbuf_seq += acked;
+    tcb->snd_una   = ack;
+    if (SEQ_LT(tcb->snd_nxt, ack)) tcb->snd_nxt = ack;
+
+    if (tcb->rtt_start && SEQ_GT(ack, tcb->rtt_seq)) {
+        tcp_rtt_sample(tcb, (int32_t)(time_ms() - tcb->rtt_start));
+        tcb->rtt_start = 0;
+    }
+
+    if (tcb->dupacks >= 3) {
+        tcb->cwnd = tcb->ssthresh;          // leave fast recovery
+    } else if (tcb->cwnd < tcb->ssthresh) {
+        tcb->cwnd += tcb->mss;              // slow start
+    } else {
+        tcb->cwnd += (uint32_t)tcb->mss * tcb->mss / tcb->cwnd;
+    }
+    tcb->dupacks   = 0;
+    tcb->rtx_count = 0;
+
+    if (tcb->snd_una == tcb->snd_max) tcb->rtx_deadline = 0;
+    else                              tcp_arm_rtx(tcb);
+}
+
+static void tcp_fast_retransmit(TcpCb *tcb) {
+    uint32_t flight = tcb->snd_max - tcb->snd_una;
+    tcb->ssthresh   = flight / 2 > 2u * tcb->mss ? flight / 2 : 2u * tcb->mss;
+    tcb->cwnd       = tcb->ssthresh + 3u * tcb->mss;
+    tcb->rtt_start  = 0;
+
+    uint32_t len = tcb->sbuf_len;
+    if (len > tcb->mss) len = tcb->mss;
+    if (len) tcp_xmit(tcb, tcb->snd_una, TH_ACK, len);
+    tcp_arm_rtx(tcb);
+}
+
+// Appends an in-order segment to the receive queue.
+static void tcp_queue_data(TcpCb *tcb, NetBuf *nb) {
+    if (nb->len == 0) {
+        netbuf_free(nb);
+        return;
+    }
+    tcb->rcv_nxt    += nb->len;
+    tcb->rcv_queued += nb->len;
+    netbuf_queue_push(&tcb->rcvq, nb);
+}
+
+// Moves segments from the reassembly queue that now line up with rcv_nxt.
+// Returns 1 if a FIN was reached.
+static int tcp_reassemble(TcpCb *tcb) {
+    while (tcb->ooo && SEQ_LEQ(tcb->ooo->cb[CB_SEQ], tcb->rcv_nxt)) {
+        NetBuf  *nb  = tcb->ooo;
+        uint32_t seq = nb->cb[CB_SEQ];
+        int      fin = (int)nb->cb[CB_FIN];
+        tcb->ooo        = nb->next;
+        tcb->ooo_bytes -= nb->len;
+
+        uint32_t skip = tcb->rcv_nxt - seq;
+        if (skip > nb->len) {
+            netbuf_free(nb);      // entirely duplicate
+            continue;
+        }
+        netbuf_pull(nb, skip);
+        tcp_queue_data(tcb, nb);
+        if (fin) return 1;
+    }
+    return 0;
+}
+
+static void tcp_ooo_insert(TcpCb *tcb, NetBuf *nb, uint32_t seq, int fin) {
+    nb->cb[CB_SEQ] = seq;
+    nb->cb[CB_FIN] = (uint32_t)fin;
+
+    NetBuf **pp = &tcb->ooo;
+    while (*pp && SEQ_LT((*pp)->cb[CB_SEQ], seq)) pp = &(*pp)->next;
+    if (*pp && (*pp)->cb[CB_SEQ] == seq && (*pp)->len >= nb->len) {
+        netbuf_free(nb);          // retransmission of something we hold
+        return;
+    }
+    nb->next = *pp;
+    *pp      = nb;
+    tcb->ooo_bytes += nb->len;
+}
+
+static void tcp_fin_received(TcpCb *tcb) {
+    tcb->rcv_nxt++;
+    tcb->rcv_fin = 1;
+    switch (tcb->state) {
+        case TCP_SYN_RCVD:
+        case TCP_ESTABLISHED:
+            tcb->state = TCP_CLOSE_WAIT;
+            break;
+        case TCP_FIN_WAIT_1:
+            // Our FIN not acked yet (otherwise we'd be in FIN_WAIT_2).
+            tcb->state = TCP_CLOSING;
+            break;
+        case TCP_FIN_WAIT_2:
+            tcp_enter_time_wait(tcb);
+            break;
+        default:
+            break;
+    }
+    tcp_send_ack(tcb);
+}
+
+static TcpCb *tcp_lookup(uint32_t lip, uint16_t lport, uint32_t rip, uint16_t rport) {
+    TcpCb *listener = 0;
+    for (TcpCb *t = g_tcbs; t; t = t->next) {
+        if (t->lport != lport) continue;
+        if (t->state == TCP_LISTEN) {
+            listener = t;
+        } else if (t->state != TCP_CLOSED &&
+                   t->rport == rport && t->rip == rip &&
+                   (t->lip == lip || !t->lip)) {
+            return t;
+        }
+    }
+    return listener;
+}
+
+static int tcp_pending_children(const TcpCb *listener) {
+    int n = 0;
+    for (TcpCb *t = g_tcbs; t; t = t->next) {
+        if (t->parent == listener) n++;
+    }
+    return n;
+}
+
+static void tcp_listen_input(TcpCb *lst, NetBuf *nb, const IpInfo *ip,
+                             uint16_t sport, uint32_t seq, uint32_t ack,
+                             uint8_t flags, const uint8_t *opt, uint32_t opt_len) {
+    if (flags & TH_RST) goto drop;
+    if (flags & TH_ACK) {
+        tcp_send_rst(ip->dst, lst->lport, ip->src, sport, ack, 0, TH_RST);
+        goto drop;
+    }
+    if (!(flags & TH_SYN)) goto drop;
+    if (tcp_pending_children(lst) >= lst->backlog) goto drop;   // let it retry
+
+    TcpCb *c = tcb_alloc();
+    if (!c) goto drop;
+    c->parent  = lst;
+    c->lip     = ip->dst;
+    c->lport   = lst->lport;
+    c->rip     = ip->src;
+    c->rport   = sport;
+    c->irs     = seq;
+    c->rcv_nxt = seq + 1;
+    c->iss     = (uint32_t)(rdtsc() >> 6);
+    c->snd_una = c->iss;
+    c->snd_nxt = c->iss + 1;
+    c->snd_max = c->snd_nxt;
+    c->sbuf_seq = c->iss + 1;
+    c->snd_wnd = get_be16(nb->data + 14);
+    c->snd_wl1 = seq;
+    c->state   = TCP_SYN_RCVD;
+    tcp_set_mss(c, tcp_parse_mss(opt, opt_len));
+    tcp_xmit(c, c->iss, TH_SYN | TH_ACK, 0);
+    tcp_arm_rtx(c);
+
+drop:
+    netbuf_free(nb);
+}
+
+static void tcp_syn_sent_input(TcpCb *tcb, NetBuf *nb, uint32_t seq, uint32_t ack,
+                               uint8_t flags, uint16_t wnd,
+                               const uint8_t *opt, uint32_t opt_len) {
+    int ack_ok = (flags & TH_ACK) && ack == tcb->iss + 1;
+    if ((flags & TH_ACK) && !ack_ok) {
+        if (!(flags & TH_RST)) {
+            tcp_send_rst(tcb->lip, tcb->lport, tcb->rip, tcb->rport, ack, 0, TH_RST);
+        }
+        goto drop;
+    }
+    if (flags & TH_RST) {
+        if (ack_ok) tcp_drop(tcb, NET_EREFUSED);
+        goto drop;
+    }
+    if (!(flags & TH_SYN)) goto drop;
+
+    tcb->irs     = seq;
+    tcb->rcv_nxt = seq + 1;
+    tcb->snd_wnd = wnd;
+    tcb->snd_wl1 = seq;
+    tcb->snd_wl2 = ack;
+    tcp_set_mss(tcb, tcp_parse_mss(opt, opt_len));
+
+    if (ack_ok) {
+        tcb->snd_una      = ack;
+        tcb->state        = TCP_ESTABLISHED;
+        tcb->rtx_deadline = 0;
+        tcb->rtx_count    = 0;
+        if (tcb->rtt_start) {
+            tcp_rtt_sample(tcb, (int32_t)(time_ms() - tcb->rtt_start));
+            tcb->rtt_start = 0;
+        }
+        tcp_send_ack(tcb);
+        tcp_output(tcb, 0);
+    } else {
+        // Simultaneous open.
+        tcb->state = TCP_SYN_RCVD;
+        tcp_xmit(tcb, tcb->iss, TH_SYN | TH_ACK, 0);
+        tcp_arm_rtx(tcb);
+    }
+
+drop:
+    netbuf_free(nb);
+}
+
+void tcp_input(NetIf *nif, NetBuf *nb, const IpInfo *ip) {
+    (void)nif;
+    if (nb->len < TCP_HDR_LEN) goto drop;
+    uint32_t sum = net_pseudo_sum(ip->src, ip->dst, IP_PROTO_TCP, (uint16_t)nb->len);
+    if (net_csum_fold(net_csum_add(sum, nb->data, nb->len)) != 0) goto drop;
+
+    const uint8_t *h     = nb->data;
+    uint16_t       sport = get_be16(h);
+    uint16_t       dport = get_be16(h + 2);
+    uint32_t       seq   = get_be32(h + 4);
+    uint32_t       ack   = get_be32(h + 8);
+    uint32_t       hlen  = (uint32_t)(h[12] >> 4) * 4;
+    uint8_t        flags = h[13];
+    uint16_t       wnd   = get_be16(h + 14);
+    if (hlen < TCP_HDR_LEN || hlen > nb->len) goto drop;
+
+    uint32_t dlen = nb->len - hlen;
+    TcpCb   *tcb  = tcp_lookup(ip->dst, dport, ip->src, sport);
+
+    if (!tcb) {
+        // No such connection: answer with a reset (RFC 793, CLOSED state).
+        if (!(flags & TH_RST)) {
+            if (flags & TH_ACK) {
+                tcp_send_rst(ip->dst, dport, ip->src, sport, ack, 0, TH_RST);
+            } else {
+                uint32_t seg_len = dlen + ((flags & TH_SYN) ? 1 : 0) + ((flags & TH_FIN) ? 1 : 0);
+                tcp_send_rst(ip->dst, dport, ip->src, sport, 0, seq + seg_len, TH_RST | TH_ACK);
+            }
+        }
+        goto drop;
+    }
+
+    if (tcb->state == TCP_LISTEN) {
+        tcp_listen_input(tcb, nb, ip, sport, seq, ack, flags, h + TCP_HDR_LEN, hlen - TCP_HDR_LEN);
+        return;
+    }
+    if (tcb->state == TCP_SYN_SENT) {
+        tcp_syn_sent_input(tcb, nb, seq, ack, flags, wnd, h + TCP_HDR_LEN, hlen - TCP_HDR_LEN);
+        return;
+    }
+
+    netbuf_pull(nb, hlen);
+
+    // --- Acceptability: trim to the receive window ----------------------
+    uint32_t rwnd     = tcp_rcv_window(tcb);
+    int      fin      = (flags & TH_FIN) != 0;
+    int      need_ack = 0;
+
+    if (flags & TH_RST) {
+        // Only an exact match resets us (RFC 5961 blind-reset protection).
+        if (seq == tcb->rcv_nxt) {
+            tcp_drop(tcb, (tcb->state == TCP_SYN_RCVD && tcb->parent) ? 0 : NET_ERESET);
+        }
+        goto drop;
+    }
+    if (flags & TH_SYN) {
+        // A SYN in a synchronized state: answer with an ACK and ignore it.
+        tcp_send_ack(tcb);
+        goto drop;
+    }
+    if (SEQ_LT(seq, tcb->rcv_nxt)) {
+        uint32_t skip = tcb->rcv_nxt - seq;
+        if (skip > dlen || (skip == dlen && !fin)) {
+            // Entirely old: a retransmission whose ACK got lost. Its ACK
+            // field is still worth processing.
+            skip     = dlen;
+            fin      = 0;
+            need_ack = 1;
+        }
+        netbuf_pull(nb, skip);
+        dlen -= skip;
+        seq   = tcb->rcv_nxt;
+    }
+    // Never shrink the window we already offered.
+    uint32_t edge = tcb->rcv_nxt + rwnd;
+    if (SEQ_LT(edge, tcb->rcv_adv)) edge = tcb->rcv_adv;
+    if (SEQ_GT(seq + dlen, edge)) {
+        uint32_t keep = SEQ_GT(edge, seq) ? edge - seq : 0;
+        nb->len  = keep;
+        dlen     = keep;
+        fin      = 0;
+        need_ack = 1;
+    }
+
+    if (!(flags & TH_ACK)) goto drop;
+
+    // --- ACK ----------------------------------------------------------------
+    if (tcb->state == TCP_SYN_RCVD) {
+        if (SEQ_LEQ(ack, tcb->snd_una) || SEQ_GT(ack, tcb->snd_max)) {
+            tcp_send_rst(tcb->lip, tcb->lport, tcb->rip, tcb->rport, ack, 0, TH_RST);
+            goto drop;
+        }
+        tcb->state        = TCP_ESTABLISHED;
+        tcb->snd_una      = ack;
+        tcb->snd_wnd      = wnd;
+        tcb->snd_wl1      = seq;
+        tcb->snd_wl2      = ack;
+        tcb->rtx_deadline = 0;
+        tcb->rtx_count    = 0;
+    }
+
+    if (SEQ_GT(ack, tcb->snd_max)) {
+        tcp_send_ack(tcb);
+        goto drop;
+    }
+    if (SEQ_GT(ack, tcb->snd_una)) {
+        tcp_ack_advance(tcb, ack);
+    } else if (ack == tcb->snd_una && dlen == 0 && !fin &&
+               wnd == tcb->snd_wnd && tcb->snd_una != tcb->snd_max) {
+        if (++tcb->dupacks == 3) tcp_fast_retransmit(tcb);
+        else if (tcb->dupacks > 3) tcb->cwnd += tcb->mss;
+    }
+    if (SEQ_LT(tcb->snd_wl1, seq) ||
+        (tcb->snd_wl1 == seq && SEQ_LEQ(tcb->snd_wl2, ack))) {
+        tcb->snd_wnd = wnd;
+        tcb->snd_wl1 = seq;
+        tcb->snd_wl2 = ack;
+    }
+
+    int fin_acked = tcb->fin_sent && SEQ_GT(tcb->snd_una, tcb->fin_seq);
+    switch (tcb->state) {
+        case TCP_FIN_WAIT_1:
+            if (fin_acked) tcb->state = TCP_FIN_WAIT_2;
+            break;
+        case TCP_CLOSING:
+            if (fin_acked) tcp_enter_time_wait(tcb);
+            break;
+        case TCP_LAST_ACK:
+            if (fin_acked) {
+                tcp_drop(tcb, 0);
+                goto drop;
+            }
+            break;
+        case TCP_TIME_WAIT:
+            // Retransmitted FIN: re-ACK and restart the 2MSL wait. It is old
+            // by now, so the trim above cleared fin; look at the header.
+            if (flags & TH_FIN) {
+                tcp_send_ack(tcb);
+                tcp_enter_time_wait(tcb);
+            }
+            goto drop;
+        default:
+            break;
+    }
+
+    // --- Data and FIN ----------------------------------------------------------
+    int can_receive = tcb->state == TCP_ESTABLISHED ||
+                      tcb->state == TCP_FIN_WAIT_1 ||
+                      tcb->state == TCP_FIN_WAIT_2;
+    if (!can_receive || (dlen == 0 && !fin)) {
+        if (need_ack) tcp_send_ack(tcb);
+        tcp_output(tcb, 0);
+        goto drop;
+    }
+
+    if (seq == tcb->rcv_nxt) {
+        int had_ooo = tcb->ooo != 0;
+        tcp_queue_data(tcb, nb);
+        nb = 0;
+        if (had_ooo && tcp_reassemble(tcb)) fin = 1;
+        if (fin) {
+            tcp_fin_received(tcb);
+        } else if (had_ooo || ++tcb->ack_pending >= 2) {
+            // Every second full segment, or a hole just closed: ACK now.
+            tcp_send_ack(tcb);
+        } else {
+            // A short pushed segment usually means the sender has nothing
+            // more until it hears from us (Nagle); tcp_recv() ACKs it as
+            // soon as the reader drains it instead of waiting out the timer.
+            if ((flags & TH_PSH) && dlen < tcb->mss) tcb->ack_pushed = 1;
+            if (!tcb->ack_deadline) tcb->ack_deadline = time_ms() + TCP_DELACK_MS;
+        }
+    } else {
+        // Out of order: park it and send an immediate duplicate ACK so the
+        // sender's fast retransmit kicks in.
+        tcp_ooo_insert(tcb, nb, seq, fin);
+        nb = 0;
+        tcp_send_ack(tcb);
+    }
+    tcp_output(tcb, 0);
+
+drop:
+    if (nb) netbuf_free(nb);
+}
+
+// ---------------------------------------------------------------------
+// Timers
+// ---------------------------------------------------------------------
+
+static void tcp_retransmit_timeout(TcpCb *tcb, uint64_t now) {
+    // Probing a zero window is not a failed retransmission.
+    int persist = tcb->snd_una == tcb->snd_max && tcb->state >= TCP_ESTABLISHED;
+    if (!persist && ++tcb->rtx_count > TCP_MAX_RETRIES) {
+        tcp_abort(tcb, NET_ETIMEDOUT);
+        return;
+    }
+    tcb->rto = tcb->rto * 2 > TCP_RTO_MAX_MS ? TCP_RTO_MAX_MS : tcb->rto * 2;
+    tcb->rtt_start    = 0;
+    tcb->rtx_deadline = now + tcb->rto;
+
+    if (tcb->state == TCP_SYN_SENT) {
+        tcp_xmit(tcb, tcb->iss, TH_SYN, 0);
+        return;
+    }
+    if (tcb->state == TCP_SYN_RCVD) {
+        tcp_xmit(tcb, tcb->iss, TH_SYN | TH_ACK, 0);
+        return;
+    }
+
+    // Go back to the first unacknowledged byte and resend from there.
+    uint32_t flight = tcb->snd_max - tcb->snd_una;
+    tcb->ssthresh = flight / 2 > 2u * tcb->mss ? flight / 2 : 2u * tcb->mss;
+    tcb->cwnd     = tcb->mss;
+    tcb->dupacks  = 0;
+    tcb->snd_nxt  = tcb->snd_una;
+    if (tcb->fin_sent && SEQ_GEQ(tcb->fin_seq, tcb->snd_una)) tcb->fin_sent = 0;
+    tcp_output(tcb, 1);
+}
+
+void tcp_tick(uint64_t now) {
+    TcpCb *tcb = g_tcbs;
+    while (tcb) {
+        TcpCb *next = tcb->next;
+
+        if (tcb->ack_deadline && now >= tcb->ack_deadline) {
+            tcp_send_ack(tcb);
+        }
+        if (tcb->rtx_deadline && now >= tcb->rtx_deadline) {
+            tcp_retransmit_timeout(tcb, now);
+        }
+        if (tcb->tw_deadline && now >= tcb->tw_deadline) {
+            tcp_drop(tcb, 0);
+        }
+        // Nobody will look at a closed, unowned block again (tcp_accept()
+        // skips closed children).
+        if (tcb->state == TCP_CLOSED && !tcb->owned) {
+            tcb_free(tcb);
+        }
+        tcb = next;
+    }
+}
+
+// ---------------------------------------------------------------------
+// User interface
+// ---------------------------------------------------------------------
+
+TcpCb *tcp_open(void) {
+    TcpCb *tcb = tcb_alloc();
+    if (tcb) tcb->owned = 1;
+    return tcb;
+}
+
+int tcp_bind(TcpCb *tcb, uint16_t port) {
+    if (tcb->state != TCP_CLOSED) return NET_ERR;
+    if (port_in_use(port)) return NET_EADDRINUSE;
+    tcb->lport = port;
+    return NET_OK;
+}
+
+int tcp_connect(TcpCb *tcb, uint32_t ip, uint16_t port) {
+    if (tcb->state != TCP_CLOSED || tcb->error) return NET_ERR;
+    tcb->lip = ip_source_for(ip);
+    if (!tcb->lip) return NET_EUNREACH;
+    if (!tcb->lport) tcb->lport = ephemeral_port();
+    if (!tcb->lport) return NET_EADDRINUSE;
+
+    tcb->rip      = ip;
+    tcb->rport    = port;
+    tcb->iss      = (uint32_t)(rdtsc() >> 6);
+    tcb->snd_una  = tcb->iss;
+    tcb->snd_nxt  = tcb->iss + 1;
+    tcb->snd_max  = tcb->snd_nxt;
+    tcb->sbuf_seq = tcb->iss + 1;
+    tcb->state    = TCP_SYN_SENT;
+    tcb->rtt_seq  = tcb->iss;
+    tcb->rtt_start = time_ms();
+    tcp_xmit(tcb, tcb->iss, TH_SYN, 0);
+    tcp_arm_rtx(tcb);
+    return NET_OK;
+}
+
+int tcp_listen(TcpCb *tcb, int backlog) {
+    if (tcb->state != TCP_CLOSED || !tcb->lport) return NET_ERR;
+    tcb->backlog = backlog > 0 ? backlog : 1;
+    tcb->state   = TCP_LISTEN;
+    return NET_OK;
+}
+
+TcpCb *tcp_accept(TcpCb *lst) {
+    for (TcpCb *t = g_tcbs; t; t = t->next) {
+        if (t->parent != lst || t->state == TCP_SYN_RCVD || t->state == TCP_CLOSED) continue;
+        t->parent = 0;
+        t->owned  = 1;
+        return t;
+    }
+    return 0;
+}
+
+int tcp_send(TcpCb *tcb, const void *buf, uint32_t len) {
+    switch (tcb->state) {
+        case TCP_SYN_SENT:
+        case TCP_SYN_RCVD:
+        case TCP_ESTABLISHED:
+        case TCP_CLOSE_WAIT:
+            break;
+        default:
+            return tcb->error ? tcb->error : NET_ENOTCONN;
+    }
+    if (tcb->fin_pending) return NET_ENOTCONN;
+
+    uint32_t space = TCP_SNDBUF - tcb->sbuf_len;
+    if (len > space) len = space;
+    const uint8_t *src  = (const uint8_t *)buf;
+    uint32_t       tail = (tcb->sbuf_head + tcb->sbuf_len) % TCP_SNDBUF;
+    uint32_t       n1   = TCP_SNDBUF - tail;
+    if (n1 > len) n1 = len;
+    memcpy(tcb->sbuf + tail, src, n1);
+    if (len > n1) memcpy(tcb->sbuf, src + n1, len - n1);
+    tcb->sbuf_len += len;
+
+    tcp_output(tcb, 0);
+    return (int)len;
+}
+
+int tcp_recv(TcpCb *tcb, void *buf, uint32_t len) {
+    uint8_t *dst    = (uint8_t *)buf;
+    uint32_t copied = 0;
+
+    while (copied < len && tcb->rcvq.head) {
+        NetBuf  *nb = tcb->rcvq.head;
+        uint32_t n  = nb->len;
+        if (n > len - copied) n = len - copied;
+        memcpy(dst + copied, nb->data, n);
+        copied += n;
+        netbuf_pull(nb, n);
+        if (nb->len == 0) netbuf_free(netbuf_queue_pop(&tcb->rcvq));
+    }
+    tcb->rcv_queued -= copied;
+
+    if (copied) {
+        // Window update once the reader has opened a useful amount of space
+        // (receiver-side silly window avoidance), or an early ACK for a
+        // drained short push.
+        uint32_t wnd = tcp_rcv_window(tcb);
+        uint32_t adv = tcb->rcv_adv - tcb->rcv_nxt;
+        uint32_t thr = 2u * tcb->mss < TCP_RCVBUF / 2 ? 2u * tcb->mss : TCP_RCVBUF / 2;
+        int drained_push = tcb->ack_pushed && !tcb->rcvq.head;
+        if ((drained_push || (wnd > adv && wnd - adv >= thr)) &&
+            (tcb->state == TCP_ESTABLISHED || tcb->state == TCP_FIN_WAIT_1 ||
+             tcb->state == TCP_FIN_WAIT_2)) {
+            tcp_send_ack(tcb);
+        }
+        return (int)copied;
+    }
+    if (tcb->rcv_fin) return 0;
+    if (tcb->error) return tcb->error;
+    if (tcb->state == TCP_CLOSED) return 0;
+    return NET_EAGAIN;
+}
+
+void tcp_close(TcpCb *tcb) {
+    tcb->owned = 0;
+    switch (tcb->state) {
+        case TCP_LISTEN:
+            // Reset connections nobody accepted.
+            for (TcpCb *t = g_tcbs; t; t = t->next) {
+                if (t->parent == tcb) tcp_abort(t, NET_ERESET);
+            }
+            tcb->state = TCP_CLOSED;
+            break;
+        case TCP_SYN_SENT:
+            tcp_drop(tcb, 0);
+            break;
+        case TCP_SYN_RCVD:
+        case TCP_ESTABLISHED:
+        case TCP_CLOSE_WAIT:
+            if (tcb->rcvq.head || tcb->ooo) {
+                // Closing with unread data loses it; tell the peer (RFC 2525).
+                tcp_abort(tcb, 0);
+                break;
+            }
+            tcb->fin_pending = 1;
+            tcb->state = (tcb->state == TCP_CLOSE_WAIT) ? TCP_LAST_ACK : TCP_FIN_WAIT_1;
+            tcp_output(tcb, 0);
+            break;
+        default:
+            break;
+    }
+}
+
+int tcp_state(const TcpCb *tcb) {
+    return tcb->state;
+}
+
+int tcp_error(const TcpCb *tcb) {
+    return tcb->error;
+}
+
+int tcp_readable(const TcpCb *tcb) {
+    if (tcb->state == TCP_LISTEN) {
+        for (TcpCb *t = g_tcbs; t; t = t->next) {
+            if (t->parent == tcb && t->state != TCP_SYN_RCVD && t->state != TCP_CLOSED) return 1;
+        }
+        return 0;
+    }
+    return tcb->rcvq.head != 0 || tcb->rcv_fin || tcb->error || tcb->state == TCP_CLOSED;
+}
+
+int tcp_writable(const TcpCb *tcb) {
+    return (tcb->state == TCP_ESTABLISHED || tcb->state == TCP_CLOSE_WAIT) &&
+           !tcb->fin_pending && tcb->sbuf_len < TCP_SNDBUF;
+}
+
+uint32_t tcp_remote_ip(const TcpCb *tcb) {
+    return tcb->rip;
+}
+
+uint16_t tcp_remote_port(const TcpCb *tcb) {
+    return tcb->rport;
+}
+
+const char *tcp_state_name(int state) {
+    if (state < 0 || state > TCP_TIME_WAIT) return "?";
+    return g_state_names[state];
+}
+
+int tcp_count(void) {
+    int n = 0;
+    for (TcpCb *t = g_tcbs; t; t = t->next) n++;
+    return n;
+}
@@ -0,0 +1,58 @@
+// kernel/net/udp.c
+// UDP input/output. Datagrams for the DHCP client port go straight to the
+// DHCP state machine; everything else is matched against bound sockets.
+
+#include "net.h"
+#include "klib.h"
+
+#define UDP_HDR_LEN      8
+#define DHCP_CLIENT_PORT 68
+
+static uint16_t udp_checksum(NetBuf *nb, uint32_t src, uint32_t dst) {
+    uint32_t sum = net_pseudo_sum(src, dst, IP_PROTO_UDP, (uint16_t)nb->len);
+    return net_csum_fold(net_csum_add(sum, nb->data, nb->len));
+}
+
+void udp_input(NetIf *nif, NetBuf *nb, const IpInfo *ip) {
+    uint8_t *h = nb->data;
+    if (nb->len < UDP_HDR_LEN) goto drop;
+
+    uint16_t sport = get_be16(h);
+    uint16_t dport = get_be16(h + 2);
+    uint16_t ulen  = get_be16(h + 4);
+    if (ulen < UDP_HDR_LEN || ulen > nb->len) goto drop;
+    nb->len = ulen;
+
+    // A zero checksum means the sender did not compute one.
+    if (get_be16(h + 6) != 0 && udp_checksum(nb, ip->src, ip->dst) != 0) goto drop;
+
+    netbuf_pull(nb, UDP_HDR_LEN);
+
+    if (dport == DHCP_CLIENT_PORT) {
+        dhcp_input(nif, nb, ip);
+        return;
+    }
+    if (sock_udp_deliver(dport, nb, ip->src, sport) == 0) return;
+
+drop:
+    netbuf_free(nb);
+}
+
+int udp_output(NetBuf *nb, uint32_t src, uint16_t sport, uint32_t dst, uint16_t dport) {
+    if (!src) src = ip_source_for(dst);
+
+    uint16_t ulen = (uint16_t)(nb->len + UDP_HDR_LEN);
+    uint8_t *h    = netbuf_push(nb, UDP_HDR_LEN);
+    if (!h) {
+        netbuf_free(nb);
+        return NET_ENOMEM;
+    }
+    put_be16(h, sport);
+    put_be16(h + 2, dport);
+    put_be16(h + 4, ulen);
+    put_be16(h + 6, 0);
+    uint16_t csum = udp_checksum(nb, src, dst);
+    put_be16(h + 6, csum ? csum : 0xFFFF);
+
+    return ip_output(nb, src, dst, IP_PROTO_UDP);
+}
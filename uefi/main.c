@@ -2,8 +2,10 @@
 #include <efilib.h>
 #include <stdint.h>
 
-#define KERNEL_PATH      L"\\kernel.bin"
-#define KERNEL_LOAD_ADDR 0x00100000ULL
+#define KERNEL_PATH          L"\\kernel.bin"
+#define KERNEL_LOAD_ADDR     0x00100000ULL
+#define KERNEL_RESERVE_BYTES 0x00400000ULL // image + .bss, see boot.h
+#define CONFIG_PATH          L"\\lightos.cfg"
 
 // Must match kernel/include/boot.h
 typedef struct {
@@ -18,6 +20,16 @@ typedef struct {
     uint8_t  hour;
     uint8_t  minute;
     uint8_t  second;
+
+    uint64_t memory_map;
+    uint64_t memory_map_size;
+    uint64_t memory_descriptor_size;
+
+    uint64_t font_base;
+    uint64_t font_size;
+
+    uint64_t acpi_rsdp;
+    uint64_t ap_trampoline;
 } BootInfo;
 
 // Kernel entry: must match kernel/core/kernel.c
@@ -29,6 +41,133 @@ static EFI_STATUS boot_panic(EFI_STATUS Status, CHAR16 *Message) {
     return Status;
 }
 
+// Reads an optional file from the boot volume into fresh EfiLoaderData
+// pages (never handed out by the kernel). Returns 0 and leaves *Base/*Size
+// untouched if the file is not there or cannot be read.
+static UINTN load_optional_file(EFI_FILE_PROTOCOL *Root, CHAR16 *Path,
+                                uint64_t *Base, uint64_t *Size) {
+    EFI_FILE_PROTOCOL *File = NULL;
+    EFI_STATUS Status = uefi_call_wrapper(Root->Open, 5, Root, &File, Path,
+                                          EFI_FILE_MODE_READ, 0);
+    if (EFI_ERROR(Status)) {
+        return 0;
+    }
+
+    EFI_FILE_INFO *Info = LibFileInfo(File);
+    UINTN FileSize = Info ? Info->FileSize : 0;
+    if (Info) {
+        uefi_call_wrapper(BS->FreePool, 1, Info);
+    }
+
+    EFI_PHYSICAL_ADDRESS Addr = 0;
+    if (FileSize) {
+        Status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages,
+                                   EfiLoaderData, EFI_SIZE_TO_PAGES(FileSize),
+                                   &Addr);
+        if (!EFI_ERROR(Status)) {
+            UINTN ReadSize = FileSize;
+            Status = uefi_call_wrapper(File->Read, 3, File, &ReadSize,
+                                       (VOID *)(UINTN)Addr);
+            if (EFI_ERROR(Status) || ReadSize != FileSize) {
+                uefi_call_wrapper(BS->FreePages, 2, Addr,
+                                  EFI_SIZE_TO_PAGES(FileSize));
+                FileSize = 0;
+            }
+        } else {
+            FileSize = 0;
+        }
+    }
+    uefi_call_wrapper(File->Close, 1, File);
+
+    if (!FileSize) {
+        return 0;
+    }
+    *Base = Addr;
+    *Size = FileSize;
+    return FileSize;
+}
+
+// Finds "resolution=WxH" in the config file (one key=value per line, '#'
+// starts a comment). Returns 0 if the key is missing or malformed.
+static UINTN config_resolution(const char *Text, UINTN Len,
+                               UINT32 *Width, UINT32 *Height) {
+    static const char Key[] = "resolution=";
+    UINTN i = 0;
+    while (i < Len) {
+        UINTN End = i;
+        while (End < Len && Text[End] != '\n') End++;
+
+        UINTN k = 0;
+        while (k < sizeof(Key) - 1 && i + k < End && Text[i + k] == Key[k]) k++;
+        if (k == sizeof(Key) - 1) {
+            UINT32 v[2] = { 0, 0 };
+            UINTN Part = 0;
+            for (UINTN j = i + k; j < End; ++j) {
+                char c = Text[j];
+                if (c >= '0' && c <= '9' && v[Part] < 100000) {
+                    v[Part] = v[Part] * 10 + (UINT32)(c - '0');
+                } else if ((c == 'x' || c == 'X') && Part == 0) {
+                    Part = 1;
+                } else if (c == '\r' || c == ' ' || c == '#') {
+                    break;
+                } else {
+                    return 0;
+                }
+            }
+            if (Part != 1 || !v[0] || !v[1]) {
+                return 0;
+            }
+            *Width  = v[0];
+            *Height = v[1];
+            return 1;
+        }
+        i = End + 1;
+    }
+    return 0;
+}
+
+// Switches GOP to the requested resolution, or failing that to the largest
+// mode that fits inside it. Only 32-bit BGRx modes are considered: that is
+// the pixel layout the kernel draws in.
+static VOID gop_select_mode(EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop,
+                            UINT32 Width, UINT32 Height) {
+    UINT32 Best = Gop->Mode->Mode;
+    UINT64 BestArea = 0;
+    for (UINT32 m = 0; m < Gop->Mode->MaxMode; ++m) {
+        EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *Info = NULL;
+        UINTN InfoSize = 0;
+        EFI_STATUS Status = uefi_call_wrapper(Gop->QueryMode, 4, Gop, m,
+                                              &InfoSize, &Info);
+        if (EFI_ERROR(Status) || !Info) {
+            continue;
+        }
+        UINT32 W = Info->HorizontalResolution;
+        UINT32 H = Info->VerticalResolution;
+        UINTN Usable = Info->PixelFormat == PixelBlueGreenRedReserved8BitPerColor;
+        uefi_call_wrapper(BS->FreePool, 1, Info);
+
+        if (!Usable || W > Width || H > Height) {
+            continue;
+        }
+        if ((UINT64)W * H > BestArea) {
+            Best = m;
+            BestArea = (UINT64)W * H;
+        }
+    }
+
+    if (!BestArea) {
+        Print(L"[boot] No GOP mode fits %ux%u, keeping the current one\r\n",
+              Width, Height);
+        return;
+    }
+    if (Best != Gop->Mode->Mode) {
+        EFI_STATUS Status = uefi_call_wrapper(Gop->SetMode, 2, Gop, Best);
+        if (EFI_ERROR(Status)) {
+            Print(L"[boot] WARNING: GOP SetMode(%u) failed: %r\r\n", Best, Status);
+        }
+    }
+}
+
 EFI_STATUS
 efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable) {
     InitializeLib(ImageHandle, SystemTable);
@@ -115,7 +254,25 @@ efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable) {
 
     Print(L"[boot] kernel.bin size: %lu bytes\r\n", KernelSize);
 
-    // --- 6. Read kernel into physical memory at KERNEL_LOAD_ADDR ---
+    // --- 6. Reserve the kernel window so firmware allocations stay out of it,
+    //        then read the kernel into physical memory at KERNEL_LOAD_ADDR ---
+    UINTN ReserveBytes = KERNEL_RESERVE_BYTES;
+    if (KernelSize > ReserveBytes) {
+        ReserveBytes = KernelSize;
+    }
+    EFI_PHYSICAL_ADDRESS KernelAddr = KERNEL_LOAD_ADDR;
+    Status = uefi_call_wrapper(
+        BS->AllocatePages, 4,
+        AllocateAddress,
+        EfiLoaderData,
+        EFI_SIZE_TO_PAGES(ReserveBytes),
+        &KernelAddr
+    );
+    if (EFI_ERROR(Status)) {
+        // Older builds loaded here without reserving anything; keep going.
+        Print(L"[boot] WARNING: could not reserve kernel window: %r\r\n", Status);
+    }
+
     VOID *KernelBuf = (VOID *)KERNEL_LOAD_ADDR;
     Status = uefi_call_wrapper(
         KernelFile->Read, 3,
@@ -129,6 +286,14 @@ efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable) {
         return boot_panic(Status, L"Failed to read kernel.bin");
     }
 
+    // --- 6b. Optional UI font next to the kernel ---
+    uint64_t FontBase = 0;
+    uint64_t FontSize = 0;
+    if (load_optional_file(Root, L"\\font.ttf", &FontBase, &FontSize) ||
+        load_optional_file(Root, L"\\font.psf", &FontBase, &FontSize)) {
+        Print(L"[boot] UI font: %lu bytes\r\n", FontSize);
+    }
+
     // --- 7. Locate GOP (framebuffer) ---
     EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop = NULL;
     Status = uefi_call_wrapper(
@@ -141,6 +306,19 @@ efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable) {
         return boot_panic(Status, L"LocateProtocol(GOP) failed");
     }
 
+    // Resolution from \lightos.cfg. This is the only chance to pick one
+    // freely: GOP modes cannot be changed after ExitBootServices().
+    uint64_t CfgBase = 0;
+    uint64_t CfgSize = 0;
+    if (load_optional_file(Root, CONFIG_PATH, &CfgBase, &CfgSize)) {
+        UINT32 Width, Height;
+        if (config_resolution((const char *)(UINTN)CfgBase, CfgSize, &Width, &Height)) {
+            Print(L"[boot] Config asks for %ux%u\r\n", Width, Height);
+            gop_select_mode(Gop, Width, Height);
+        }
+        uefi_call_wrapper(BS->FreePages, 2, CfgBase, EFI_SIZE_TO_PAGES(CfgSize));
+    }
+
     Print(L"[boot] GOP mode %u: %ux%u pitch %u\r\n",
           Gop->Mode->Mode,
           Gop->Mode->Info->HorizontalResolution,
@@ -153,6 +331,31 @@ efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable) {
     bi.framebuffer_width  = Gop->Mode->Info->HorizontalResolution;
     bi.framebuffer_height = Gop->Mode->Info->VerticalResolution;
     bi.framebuffer_pitch  = Gop->Mode->Info->PixelsPerScanLine;
+    bi.font_base          = FontBase;
+    bi.font_size          = FontSize;
+
+    // --- 8b. What the kernel needs to start the other CPUs: the ACPI
+    //         tables (MADT) and a page of real-mode memory ---
+    EFI_GUID Acpi20Guid = ACPI_20_TABLE_GUID;
+    EFI_GUID Acpi10Guid = ACPI_TABLE_GUID;
+    bi.acpi_rsdp = 0;
+    for (UINTN i = 0; i < ST->NumberOfTableEntries; ++i) {
+        EFI_CONFIGURATION_TABLE *T = &ST->ConfigurationTable[i];
+        if (CompareGuid(&T->VendorGuid, &Acpi20Guid) == 0) {
+            bi.acpi_rsdp = (uint64_t)(UINTN)T->VendorTable;
+            break;
+        }
+        if (CompareGuid(&T->VendorGuid, &Acpi10Guid) == 0) {
+            bi.acpi_rsdp = (uint64_t)(UINTN)T->VendorTable;
+        }
+    }
+
+    EFI_PHYSICAL_ADDRESS Trampoline = 0x9FFFF;
+    Status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateMaxAddress,
+                               EfiLoaderData, 1, &Trampoline);
+    bi.ap_trampoline = (!EFI_ERROR(Status) && Trampoline >= 0x1000) ? Trampoline : 0;
+    Print(L"[boot] ACPI RSDP 0x%lx, AP trampoline 0x%lx\r\n",
+          bi.acpi_rsdp, bi.ap_trampoline);
 
     EFI_TIME Now;
     Status = uefi_call_wrapper(RT->GetTime, 2, &Now, NULL);
@@ -178,12 +381,56 @@ efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable) {
 
     Print(L"[boot] Jumping to kernel at 0x%lx\r\n", (UINT64)KERNEL_LOAD_ADDR);
 
-    // --- 9. Call kernel entry. It should not normally return. ---
+    // --- 9. Capture the final memory map and leave boot services. The kernel
+    //        owns the hardware from here on (firmware drivers stop DMA on
+    //        ExitBootServices), so no more Print() after this point. ---
+    UINTN MapSize = 0;
+    UINTN MapKey = 0;
+    UINTN DescSize = 0;
+    UINT32 DescVersion = 0;
+    EFI_MEMORY_DESCRIPTOR *Map = NULL;
+
+    Status = uefi_call_wrapper(BS->GetMemoryMap, 5,
+                               &MapSize, Map, &MapKey, &DescSize, &DescVersion);
+    if (Status != EFI_BUFFER_TOO_SMALL) {
+        return boot_panic(Status, L"GetMemoryMap(size) failed");
+    }
+
+    // The pool allocation itself can split a region, so leave room for a few
+    // extra descriptors.
+    UINTN MapCapacity = MapSize + 8 * DescSize;
+    Status = uefi_call_wrapper(BS->AllocatePool, 3,
+                               EfiLoaderData, MapCapacity, (VOID **)&Map);
+    if (EFI_ERROR(Status)) {
+        return boot_panic(Status, L"AllocatePool(MemoryMap) failed");
+    }
+
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        MapSize = MapCapacity;
+        Status = uefi_call_wrapper(BS->GetMemoryMap, 5,
+                                   &MapSize, Map, &MapKey, &DescSize, &DescVersion);
+        if (EFI_ERROR(Status)) {
+            return boot_panic(Status, L"GetMemoryMap failed");
+        }
+        // ExitBootServices() fails with EFI_INVALID_PARAMETER if the map
+        // changed since we read it; one re-read is always enough.
+        Status = uefi_call_wrapper(BS->ExitBootServices, 2, ImageHandle, MapKey);
+        if (!EFI_ERROR(Status)) break;
+    }
+    if (EFI_ERROR(Status)) {
+        return boot_panic(Status, L"ExitBootServices failed");
+    }
+
+    bi.memory_map             = (uint64_t)(UINTN)Map;
+    bi.memory_map_size        = MapSize;
+    bi.memory_descriptor_size = DescSize;
+
+    // --- 10. Call kernel entry. It should not normally return. ---
     KernelEntry entry = (KernelEntry)KERNEL_LOAD_ADDR;
     entry(&bi);
 
-    // If we ever get here, the kernel actually returned.
-    Print(L"[boot] Kernel returned, halting.\r\n");
+    // If we ever get here, the kernel actually returned. Boot services are
+    // gone, so we cannot print anything.
     for (;;) {
         __asm__ volatile("hlt");
     }
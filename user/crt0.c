@@ -0,0 +1,36 @@
+// user/crt0.c
+// Program entry: argc and argv from the stack the kernel built, then
+// main() and exit().
+
+#include "lightos.h"
+
+// The kernel enters with rsp at argc and 16-byte aligned, as at a SysV
+// _start.
+__asm__(
+    ".text\n"
+    ".global _start\n"
+    "_start:\n"
+    "    xor  %ebp, %ebp\n"
+    "    mov  %rsp, %rdi\n"
+    "    call start_main\n"
+    "    ud2\n"
+);
+
+void start_main(long *sp);
+void start_main(long *sp) {
+    exit(main((int)sp[0], (char**)(sp + 1)));
+}
+
+// GCC may call these for struct copies and zeroing even when freestanding.
+// rep movsb/stosb keeps it from turning the loops back into calls.
+void *memcpy(void *dst, const void *src, size_t n) {
+    void *ret = dst;
+    __asm__ volatile("rep movsb" : "+D"(dst), "+S"(src), "+c"(n) : : "memory");
+    return ret;
+}
+
+void *memset(void *dst, int c, size_t n) {
+    void *ret = dst;
+    __asm__ volatile("rep stosb" : "+D"(dst), "+c"(n) : "a"((uint8_t)c) : "memory");
+    return ret;
+}
@@ -0,0 +1,116 @@
+// user/echod.c
+// A TCP echo server on one thread: `run echod <port> [seconds]` accepts
+// connections and sends back whatever they send, every connection's reads
+// and writes going through one I/O ring, until Ctrl+C or the time is up.
+
+#include "lightos.h"
+
+#define ECHO_FDS 32                     // PROC_MAX_FILES
+#define ECHO_BUF 512
+
+enum { EV_ACCEPT, EV_READ, EV_WRITE, EV_CLOSE, EV_TIMEOUT };
+
+static IoRingShared *g_ring;
+static unsigned      g_queued;          // entries for the next ioring_enter()
+static char          g_buf[ECHO_FDS][ECHO_BUF];
+static unsigned      g_len[ECHO_FDS];   // read into g_buf
+static unsigned      g_sent[ECHO_FDS];  // of that, written back
+
+// Every completion queues at most two entries and the ring has room for
+// far more than ECHO_FDS of them, so the queue never fills.
+static void queue(int op, int fd, const void *buf, unsigned len, unsigned long off, int event) {
+    IoSqe *sqe = ioring_sqe(g_ring);
+    if (!sqe) return;
+    sqe->opcode    = (uint8_t)op;
+    sqe->fd        = fd;
+    sqe->addr      = (uint64_t)(uintptr_t)buf;
+    sqe->len       = len;
+    sqe->off       = off;
+    sqe->user_data = (uint64_t)event << 32 | (uint32_t)fd;
+    ioring_queue(g_ring);
+    g_queued++;
+}
+
+static unsigned long number(const char *s) {
+    unsigned long v = 0;
+    while (*s >= '0' && *s <= '9') v = v * 10 + (unsigned long)(*s++ - '0');
+    return v;
+}
+
+int main(int argc, char **argv) {
+    char num[21];
+    if (argc < 2) {
+        puts_fd(STDERR_FILENO, "usage: echod <port> [seconds]\n");
+        return 2;
+    }
+    int lfd = listen((int)number(argv[1]), 8);
+    if (lfd < 0) {
+        puts_fd(STDERR_FILENO, "echod: can't listen on that port\n");
+        return 1;
+    }
+    int rfd = ioring_setup(64, &g_ring);
+    if (rfd < 0) {
+        puts_fd(STDERR_FILENO, "echod: no I/O ring\n");
+        return 1;
+    }
+    queue(IORING_OP_ACCEPT, lfd, 0, 0, 0, EV_ACCEPT);
+    if (argc > 2) queue(IORING_OP_TIMEOUT, -1, 0, 0, number(argv[2]) * 1000, EV_TIMEOUT);
+    puts_fd(STDOUT_FILENO, "echod: listening\n");
+
+    unsigned long connections = 0, bytes = 0;
+    for (;;) {
+        unsigned submit = g_queued;
+        g_queued = 0;
+        if (ioring_enter(rfd, submit, 1) < 0) return 1;
+
+        IoCqe *cqe;
+        while ((cqe = ioring_cqe(g_ring)) != 0) {
+            int  event = (int)(cqe->user_data >> 32);
+            int  fd    = (int)(uint32_t)cqe->user_data;
+            long res   = (long)cqe->res;
+            ioring_seen(g_ring);
+
+            switch (event) {
+            case EV_ACCEPT:
+                if (res >= 0 && res < ECHO_FDS) {
+                    connections++;
+                    queue(IORING_OP_READ, (int)res, g_buf[res], ECHO_BUF, IORING_OFF_CUR, EV_READ);
+                } else if (res >= 0) {
+                    queue(IORING_OP_CLOSE, (int)res, 0, 0, 0, EV_CLOSE);
+                }
+                queue(IORING_OP_ACCEPT, lfd, 0, 0, 0, EV_ACCEPT);
+                break;
+            case EV_READ:
+                if (res <= 0) {
+                    queue(IORING_OP_CLOSE, fd, 0, 0, 0, EV_CLOSE);
+                    break;
+                }
+                g_len[fd]  = (unsigned)res;
+                g_sent[fd] = 0;
+                bytes     += (unsigned long)res;
+                queue(IORING_OP_WRITE, fd, g_buf[fd], g_len[fd], IORING_OFF_CUR, EV_WRITE);
+                break;
+            case EV_WRITE:
+                if (res < 0) {
+                    queue(IORING_OP_CLOSE, fd, 0, 0, 0, EV_CLOSE);
+                    break;
+                }
+                g_sent[fd] += (unsigned)res;
+                if (g_sent[fd] < g_len[fd]) {
+                    queue(IORING_OP_WRITE, fd, g_buf[fd] + g_sent[fd], g_len[fd] - g_sent[fd],
+                          IORING_OFF_CUR, EV_WRITE);
+                } else {
+                    queue(IORING_OP_READ, fd, g_buf[fd], ECHO_BUF, IORING_OFF_CUR, EV_READ);
+                }
+                break;
+            case EV_TIMEOUT:
+                puts_fd(STDOUT_FILENO, "echod: ");
+                puts_fd(STDOUT_FILENO, utoa(connections, num));
+                puts_fd(STDOUT_FILENO, " connections, ");
+                puts_fd(STDOUT_FILENO, utoa(bytes, num));
+                puts_fd(STDOUT_FILENO, " bytes echoed\n");
+                return 0;
+            }
+        }
+    }
+}
@@ -0,0 +1,88 @@
+// user/hello.c
+// Prints its arguments and some anonymous memory; `hello -s` spawns a
+// second copy of itself and waits for it, `hello -f` forks and checks the
+// two copies of its memory part, `hello -m <file>` maps a file and prints
+// its first page.
+
+#include "lightos.h"
+
+int main(int argc, char **argv) {
+    char num[21];
+    puts_fd(STDOUT_FILENO, "Hello from ring 3!\n");
+    for (int i = 0; i < argc; ++i) {
+        puts_fd(STDOUT_FILENO, "  argv[");
+        puts_fd(STDOUT_FILENO, utoa((unsigned long)i, num));
+        puts_fd(STDOUT_FILENO, "] = ");
+        puts_fd(STDOUT_FILENO, argv[i]);
+        puts_fd(STDOUT_FILENO, "\n");
+    }
+
+    // Three pages of zeroes, written through and handed back.
+    char *mem = (char*)mmap(0, 3 * 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (mmap_failed(mem)) {
+        puts_fd(STDERR_FILENO, "hello: mmap failed\n");
+        return 1;
+    }
+    unsigned long sum = 0;
+    for (int i = 0; i < 3 * 4096; ++i) {
+        sum += (unsigned char)mem[i];
+        mem[i] = (char)i;
+    }
+    for (int i = 0; i < 3 * 4096; ++i) sum += (unsigned char)mem[i];
+    puts_fd(STDOUT_FILENO, "  mmap: 12288 bytes, checksum ");
+    puts_fd(STDOUT_FILENO, utoa(sum, num));
+    puts_fd(STDOUT_FILENO, "\n");
+    munmap(mem, 3 * 4096);
+
+    if (argc > 1 && argv[1][0] == '-' && argv[1][1] == 's') {
+        int pid = spawn(argv[0], "child");
+        if (pid < 0) {
+            puts_fd(STDERR_FILENO, "hello: spawn failed\n");
+            return 1;
+        }
+        int code = wait(pid);
+        puts_fd(STDOUT_FILENO, "  child ");
+        puts_fd(STDOUT_FILENO, utoa((unsigned long)pid, num));
+        puts_fd(STDOUT_FILENO, " exited with ");
+        puts_fd(STDOUT_FILENO, utoa((unsigned long)code, num));
+        puts_fd(STDOUT_FILENO, "\n");
+    }
+    if (argc > 1 && argv[1][0] == '-' && argv[1][1] == 'f') {
+        // Both write the same page; each must see only its own byte.
+        static char page[4096] = "parent";
+        int pid = fork();
+        if (pid < 0) {
+            puts_fd(STDERR_FILENO, "hello: fork failed\n");
+            return 1;
+        }
+        if (pid == 0) {
+            page[0] = 'P';
+            puts_fd(STDOUT_FILENO, "  forked child sees ");
+            puts_fd(STDOUT_FILENO, page);
+            puts_fd(STDOUT_FILENO, "\n");
+            return 3;
+        }
+        int code = wait(pid);
+        puts_fd(STDOUT_FILENO, "  parent still sees ");
+        puts_fd(STDOUT_FILENO, page);
+        puts_fd(STDOUT_FILENO, ", child exited with ");
+        puts_fd(STDOUT_FILENO, utoa((unsigned long)code, num));
+        puts_fd(STDOUT_FILENO, "\n");
+    }
+
+    if (argc > 2 && argv[1][0] == '-' && argv[1][1] == 'm') {
+        int fd = open(argv[2], O_RDONLY);
+        const char *text = fd < 0 ? 0 : (const char*)mmap(0, 4096, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (fd < 0 || mmap_failed(text)) {
+            puts_fd(STDERR_FILENO, "hello: can't map the file\n");
+            return 1;
+        }
+        close(fd);
+        // The rest of the last page reads as zeroes.
+        size_t len = 0;
+        while (len < 4096 && text[len]) ++len;
+        write(STDOUT_FILENO, text, len);
+        munmap((void*)text, 4096);
+    }
+    return argc > 1 && argv[1][0] != '-' ? 7 : 0;
+}
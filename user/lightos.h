@@ -0,0 +1,142 @@
+#ifndef LIGHTOS_USER_H
+#define LIGHTOS_USER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "syscall.h"
+
+// What user programs have instead of a libc: the system calls of
+// syscall.h and a few string helpers. crt0.c calls main(argc, argv) and
+// exits with what it returns.
+
+static inline long sys_call6(long n, long a, long b, long c, long d, long e, long f) {
+    register long r10 __asm__("r10") = d;
+    register long r8  __asm__("r8")  = e;
+    register long r9  __asm__("r9")  = f;
+    long r;
+    __asm__ volatile("syscall"
+                     : "=a"(r)
+                     : "a"(n), "D"(a), "S"(b), "d"(c), "r"(r10), "r"(r8), "r"(r9)
+                     : "rcx", "r11", "memory");
+    return r;
+}
+
+static inline long sys_call3(long n, long a, long b, long c) {
+    long r;
+    __asm__ volatile("syscall"
+                     : "=a"(r)
+                     : "a"(n), "D"(a), "S"(b), "d"(c)
+                     : "rcx", "r11", "memory");
+    return r;
+}
+
+static inline long read(int fd, void *buf, size_t len) {
+    return sys_call3(SYS_READ, fd, (long)buf, (long)len);
+}
+
+static inline long write(int fd, const void *data, size_t len) {
+    return sys_call3(SYS_WRITE, fd, (long)data, (long)len);
+}
+
+static inline int open(const char *path, int flags) {
+    return (int)sys_call3(SYS_OPEN, (long)path, flags, 0);
+}
+
+static inline int close(int fd) {
+    return (int)sys_call3(SYS_CLOSE, fd, 0, 0);
+}
+
+// Returns the address, or a negative SYS_E* code cast to a pointer.
+static inline void *mmap(void *addr, size_t len, int prot, int flags, int fd, long offset) {
+    return (void*)sys_call6(SYS_MMAP, (long)addr, (long)len, prot, flags, fd, offset);
+}
+
+static inline int munmap(void *addr, size_t len) {
+    return (int)sys_call3(SYS_MUNMAP, (long)addr, (long)len, 0);
+}
+
+__attribute__((noreturn)) static inline void exit(int code) {
+    sys_call3(SYS_EXIT, code, 0, 0);
+    __builtin_unreachable();
+}
+
+static inline int spawn(const char *path, const char *args) {
+    return (int)sys_call3(SYS_SPAWN, (long)path, (long)args, 0);
+}
+
+static inline int wait(int pid) {
+    return (int)sys_call3(SYS_WAIT, pid, 0, 0);
+}
+
+static inline int fork(void) {
+    return (int)sys_call3(SYS_FORK, 0, 0, 0);
+}
+
+// Returns the ring's descriptor; *ring is its memory.
+static inline int ioring_setup(unsigned entries, IoRingShared **ring) {
+    return (int)sys_call3(SYS_IORING_SETUP, entries, (long)ring, 0);
+}
+
+static inline int ioring_enter(int fd, unsigned submit, unsigned wait) {
+    return (int)sys_call3(SYS_IORING_ENTER, fd, submit, wait);
+}
+
+static inline int listen(int port, int backlog) {
+    return (int)sys_call3(SYS_LISTEN, port, backlog, 0);
+}
+
+// The next free submission entry, cleared, or 0 if the queue is full.
+// ioring_queue() makes it visible to the next ioring_enter().
+static inline IoSqe *ioring_sqe(IoRingShared *r) {
+    uint32_t tail = r->sq_tail;
+    if (tail - __atomic_load_n(&r->sq_head, __ATOMIC_ACQUIRE) >= r->sq_entries) return 0;
+    IoSqe *sqe = (IoSqe*)((char*)r + r->sq_offset) + (tail & (r->sq_entries - 1));
+    *sqe = (IoSqe){ 0 };
+    return sqe;
+}
+
+static inline void ioring_queue(IoRingShared *r) {
+    __atomic_store_n(&r->sq_tail, r->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+// The oldest completion, or 0; ioring_seen() hands its slot back.
+static inline IoCqe *ioring_cqe(IoRingShared *r) {
+    uint32_t head = r->cq_head;
+    if (head == __atomic_load_n(&r->cq_tail, __ATOMIC_ACQUIRE)) return 0;
+    return (IoCqe*)((char*)r + r->cq_offset) + (head & (r->cq_entries - 1));
+}
+
+static inline void ioring_seen(IoRingShared *r) {
+    __atomic_store_n(&r->cq_head, r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+static inline int mmap_failed(const void *p) {
+    return (long)p < 0 && (long)p >= -4095;
+}
+
+static inline size_t strlen(const char *s) {
+    size_t n = 0;
+    while (s[n]) ++n;
+    return n;
+}
+
+static inline long puts_fd(int fd, const char *s) {
+    return write(fd, s, strlen(s));
+}
+
+// Decimal, into buf (at least 21 bytes); returns buf.
+static inline char *utoa(unsigned long v, char *buf) {
+    char tmp[21];
+    int  n = 0;
+    do {
+        tmp[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    for (int i = 0; i < n; ++i) buf[i] = tmp[n - 1 - i];
+    buf[n] = '\0';
+    return buf;
+}
+
+int main(int argc, char **argv);
+
+#endif
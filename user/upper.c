@@ -0,0 +1,18 @@
+// user/upper.c
+// Copies its input to its output in upper case: `type file | run upper`,
+// or the console's keys until Ctrl+C.
+
+#include "lightos.h"
+
+int main(int argc, char **argv) {
+    (void)argc; (void)argv;
+    char buf[256];
+    long n;
+    while ((n = read(STDIN_FILENO, buf, sizeof(buf))) > 0) {
+        for (long i = 0; i < n; ++i) {
+            if (buf[i] >= 'a' && buf[i] <= 'z') buf[i] = (char)(buf[i] - 'a' + 'A');
+        }
+        if (write(STDOUT_FILENO, buf, (size_t)n) < 0) return 1;
+    }
+    return 0;
+}